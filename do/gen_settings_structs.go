@@ -303,6 +303,15 @@ var (
 
 	printerDefaults = []*Field{
 		mkField("PrintScale", Utf8String, "shrink", "default value for scaling (shrink, fit, none)"),
+		mkField("MaxBitmapSize", Int, 0,
+			"maximum amount of memory (in MB) used for rendering a single printed page; larger "+
+				"pages are printed in horizontal bands (if this value isn't positive, 64 MB are used)").setVersion("3.3"),
+		mkField("BandHeight", Int, 0,
+			"height (in printer pixels) of the bands large pages are printed in (if this value "+
+				"isn't positive, it's derived from MaxBitmapSize)").setVersion("3.3"),
+		mkField("VectorPrinting", Bool, true,
+			"if true, PDF and XPS pages are printed as vector graphics instead of bitmaps, which makes "+
+				"print jobs much smaller (pages using transparency are still printed as bitmaps)").setVersion("3.3"),
 	}
 
 	forwardSearch = []*Field{
@@ -355,6 +364,9 @@ var (
 				"colors are supported; the idea behind this experimental feature is that the "+
 				"background might allow to subconsciously determine reading progress; "+
 				"suggested values: #2828aa #28aa28 #aa2828"),
+		mkField("SmoothScroll", Bool, true,
+			"if true, scrolling with the mouse wheel or by line and page in continuous "+
+				"modes is animated").setVersion("3.3"),
 		mkField("InvertColors", Bool, false,
 			"if true, TextColor and BackgroundColor will be temporarily swapped").setInternal(),
 		mkField("HideScrollbars", Bool, false,
@@ -575,6 +587,27 @@ var (
 		mkField("CustomScreenDPI", Int, 0,
 			"actual resolution of the main screen in DPI (if this value "+
 				"isn't positive, the system's UI setting is used)").setExpert().setVersion("2.5"),
+		mkField("RenderThreads", Int, 0,
+			"number of threads rendering pages concurrently (if this value isn't "+
+				"positive, it's based on the number of processors)").setExpert().setVersion("3.3"),
+		mkField("RenderCacheSize", Int, 0,
+			"maximum amount of memory (in MB) used for caching rendered pages (if this value "+
+				"isn't positive, it's based on the screen size and the available memory)").setExpert().setVersion("3.3"),
+		mkField("DiskTileCacheSize", Int, 0,
+			"maximum amount of disk space (in MB) used for keeping rendered pages of recently "+
+				"viewed documents between sessions (if this value isn't positive, no pages are "+
+				"kept on disk)").setExpert().setVersion("3.3"),
+		mkField("DiskTextIndexSize", Int, 0,
+			"maximum amount of disk space (in MB) used for keeping the text of recently "+
+				"searched documents between sessions (if this value isn't positive, no text is "+
+				"kept on disk)").setExpert().setVersion("3.3"),
+		mkField("TextCacheSize", Int, 0,
+			"maximum amount of memory (in MB) used for keeping the text of each document "+
+				"(if this value isn't positive, 64 MB are used)").setExpert().setVersion("3.3"),
+		mkField("DocumentCacheSize", Int, 0,
+			"maximum amount of memory (in MB) used for caching decoded images and fonts of each "+
+				"visible document (if this value isn't positive, it's based on the available "+
+				"memory)").setExpert().setVersion("3.3"),
 		mkEmptyLine(),
 
 		mkField("RememberStatePerDocument", Bool, true,
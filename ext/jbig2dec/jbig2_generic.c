@@ -361,6 +361,52 @@ jbig2_generic_stats_size(Jbig2Ctx *ctx, int template)
     return stats_size;
 }
 
+/* sumatrapdf: decodes a single row for GBTEMPLATE 0 with the nominal
+ * GBAT, given the two rows above it (NULL outside of the image). Shared
+ * by the plain and the TPGDON decoders. */
+static inline int
+jbig2_decode_generic_template0_row(Jbig2Ctx *ctx, Jbig2Segment *segment, Jbig2ArithState *as,
+                                   Jbig2ArithCx *GB_stats, uint32_t GBW,
+                                   byte *gbreg_line, const byte *line1, const byte *line2)
+{
+    uint32_t CONTEXT;
+    uint32_t line_m1;
+    uint32_t line_m2;
+    uint32_t padded_width = (GBW + 7) & -8;
+    uint32_t x;
+
+    line_m1 = line1 ? line1[0] : 0;
+    line_m2 = line2 ? line2[0] << 6 : 0;
+    CONTEXT = (line_m1 & 0x7f0) | (line_m2 & 0xf800);
+
+    /* 6.2.5.7 3d */
+    for (x = 0; x < padded_width; x += 8) {
+        byte result = 0;
+        int x_minor;
+        int minor_width = GBW - x > 8 ? 8 : GBW - x;
+
+        if (line1)
+            line_m1 = (line_m1 << 8) | (x + 8 < GBW ? line1[(x >> 3) + 1] : 0);
+
+        if (line2)
+            line_m2 = (line_m2 << 8) | (x + 8 < GBW ? line2[(x >> 3) + 1] << 6 : 0);
+
+        /* This is the speed-critical inner loop. */
+        for (x_minor = 0; x_minor < minor_width; x_minor++) {
+            int bit;
+
+            bit = jbig2_arith_decode(ctx, as, &GB_stats[CONTEXT]);
+            if (bit < 0)
+                return jbig2_error(ctx, JBIG2_SEVERITY_WARNING, segment->number, "failed to decode arithmetic code when handling generic template0 optimized");
+            result |= bit << (7 - x_minor);
+            CONTEXT = ((CONTEXT & 0x7bf7) << 1) | bit | ((line_m1 >> (7 - x_minor)) & 0x10) | ((line_m2 >> (7 - x_minor)) & 0x800);
+        }
+        gbreg_line[x >> 3] = result;
+    }
+
+    return 0;
+}
+
 static int
 jbig2_decode_generic_template0(Jbig2Ctx *ctx,
                                Jbig2Segment *segment,
@@ -370,7 +416,7 @@ jbig2_decode_generic_template0(Jbig2Ctx *ctx,
     const uint32_t GBW = image->width;
     const uint32_t GBH = image->height;
     const uint32_t rowstride = image->stride;
-    uint32_t x, y;
+    uint32_t y;
     byte *line2 = NULL;
     byte *line1 = NULL;
     byte *gbreg_line = (byte *) image->data;
@@ -383,39 +429,9 @@ jbig2_decode_generic_template0(Jbig2Ctx *ctx,
         return 0;
 
     for (y = 0; y < GBH; y++) {
-        uint32_t CONTEXT;
-        uint32_t line_m1;
-        uint32_t line_m2;
-        uint32_t padded_width = (GBW + 7) & -8;
-
-        line_m1 = line1 ? line1[0] : 0;
-        line_m2 = line2 ? line2[0] << 6 : 0;
-        CONTEXT = (line_m1 & 0x7f0) | (line_m2 & 0xf800);
-
-        /* 6.2.5.7 3d */
-        for (x = 0; x < padded_width; x += 8) {
-            byte result = 0;
-            int x_minor;
-            int minor_width = GBW - x > 8 ? 8 : GBW - x;
-
-            if (line1)
-                line_m1 = (line_m1 << 8) | (x + 8 < GBW ? line1[(x >> 3) + 1] : 0);
-
-            if (line2)
-                line_m2 = (line_m2 << 8) | (x + 8 < GBW ? line2[(x >> 3) + 1] << 6 : 0);
-
-            /* This is the speed-critical inner loop. */
-            for (x_minor = 0; x_minor < minor_width; x_minor++) {
-                int bit;
-
-                bit = jbig2_arith_decode(ctx, as, &GB_stats[CONTEXT]);
-                if (bit < 0)
-                    return jbig2_error(ctx, JBIG2_SEVERITY_WARNING, segment->number, "failed to decode arithmetic code when handling generic template0 optimized");
-                result |= bit << (7 - x_minor);
-                CONTEXT = ((CONTEXT & 0x7bf7) << 1) | bit | ((line_m1 >> (7 - x_minor)) & 0x10) | ((line_m2 >> (7 - x_minor)) & 0x800);
-            }
-            gbreg_line[x >> 3] = result;
-        }
+        int code = jbig2_decode_generic_template0_row(ctx, segment, as, GB_stats, GBW, gbreg_line, line1, line2);
+        if (code < 0)
+            return code;
 #ifdef OUTPUT_PBM
         fwrite(gbreg_line, 1, rowstride, stdout);
 #endif
@@ -915,6 +931,39 @@ jbig2_decode_generic_template0_TPGDON(Jbig2Ctx *ctx,
      * Have an optimised version for those locations. This greatly
      * simplifies some of the fetches. It's almost like they thought
      * it through. */
+    if (params->gbat[0] ==  3 && params->gbat[1] == -1 &&
+        params->gbat[2] == -3 && params->gbat[3] == -1 &&
+        params->gbat[4] ==  2 && params->gbat[5] == -2 &&
+        params->gbat[6] == -2 && params->gbat[7] == -2 &&
+        !params->USESKIP)
+    {
+        /* sumatrapdf: the most common case for scanned pages, so the
+         * non-typical rows are decoded by the faster byte-wise row decoder
+         * of jbig2_decode_generic_template0 */
+        const uint32_t rowstride = image->stride;
+
+        if (GBW <= 0)
+            return 0;
+
+        for (y = 0; y < GBH; y++) {
+            int bit = jbig2_arith_decode(ctx, as, &GB_stats[0x9B25]);
+            if (bit < 0)
+                return jbig2_error(ctx, JBIG2_SEVERITY_WARNING, segment->number, "failed to decode arithmetic code when handling generic template0 TPGDON1");
+            LTP ^= bit;
+            if (!LTP) {
+                byte *gbreg_line = image->data + y * rowstride;
+                const byte *line1 = y > 0 ? gbreg_line - rowstride : NULL;
+                const byte *line2 = y > 1 ? gbreg_line - 2 * rowstride : NULL;
+                int code = jbig2_decode_generic_template0_row(ctx, segment, as, GB_stats, GBW, gbreg_line, line1, line2);
+                if (code < 0)
+                    return code;
+            } else {
+                copy_prev_row(image, y);
+            }
+        }
+        return 0;
+    }
+
     if (params->gbat[0] ==  3 && params->gbat[1] == -1 &&
         params->gbat[2] == -3 && params->gbat[3] == -1 &&
         params->gbat[4] ==  2 && params->gbat[5] == -2 &&
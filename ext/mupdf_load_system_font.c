@@ -516,31 +516,152 @@ static void* fz_resize_array(fz_context* ctx, void* p, unsigned int count, unsig
     return np;
 }
 
+// the content of font files is loaded only once per process and shared between
+// all contexts (fz_font objects themselves can't be shared, as they are tied to
+// their context's FreeType library and glyph cache)
+typedef struct shared_font_data {
+    struct shared_font_data* next;
+    sys_font_info* fi;
+    unsigned char* data;
+    size_t size;
+    // number of contexts using data
+    int refs;
+} shared_font_data;
+
+// a context's buffer wrapping shared font data
 typedef struct cached_font {
     struct cached_font* next;
     sys_font_info* fi;
     fz_context* ctx;
     fz_buffer* buffer;
+    shared_font_data* shared;
 } cached_font;
 
+static shared_font_data* shared_fonts = 0;
 static cached_font* cached_fonts = 0;
 
-static fz_buffer* get_cached_font_buffer(fz_context* ctx, sys_font_info* fi) {
+// must be called within cs_fonts
+static shared_font_data* find_shared_font_data(sys_font_info* fi) {
+    shared_font_data* sf = shared_fonts;
+    while (sf && sf->fi != fi) {
+        sf = sf->next;
+    }
+    return sf;
+}
+
+// must be called within cs_fonts
+static void release_shared_font_data(fz_context* ctx, shared_font_data* sf) {
+    shared_font_data** sfp = &shared_fonts;
+    if (--sf->refs > 0) {
+        return;
+    }
+    while (*sfp != sf) {
+        sfp = &(*sfp)->next;
+    }
+    *sfp = sf->next;
+    fz_free(ctx, sf->data);
+    free(sf);
+}
+
+// returns a shared reference to the font file's data
+static shared_font_data* get_shared_font_data(fz_context* ctx, sys_font_info* fi) {
+    shared_font_data* sf;
+    fz_buffer* buffer;
+    unsigned char* data = NULL;
+    size_t size;
+
     EnterCriticalSection(&cs_fonts);
-    cached_font* f = cached_fonts;
+    sf = find_shared_font_data(fi);
+    if (sf) {
+        sf->refs++;
+    }
+    LeaveCriticalSection(&cs_fonts);
+    if (sf) {
+        return sf;
+    }
+
+    // read the file outside of cs_fonts so that other contexts can continue
+    buffer = fz_read_file(ctx, fi->fontpath);
+    size = fz_buffer_extract(ctx, buffer, &data);
+    fz_drop_buffer(ctx, buffer);
+
+    EnterCriticalSection(&cs_fonts);
+    // another context might have loaded the same file in the meantime
+    sf = find_shared_font_data(fi);
+    if (sf) {
+        sf->refs++;
+    } else {
+        sf = (shared_font_data*)calloc(1, sizeof(shared_font_data));
+        if (sf) {
+            sf->fi = fi;
+            sf->data = data;
+            sf->size = size;
+            sf->refs = 1;
+            sf->next = shared_fonts;
+            shared_fonts = sf;
+            data = NULL;
+        }
+    }
+    LeaveCriticalSection(&cs_fonts);
+
+    fz_free(ctx, data);
+    if (!sf) {
+        fz_throw(ctx, FZ_ERROR_MEMORY, "couldn't cache font '%s'", fi->fontpath);
+    }
+    return sf;
+}
+
+// returns a buffer owned by the cache (until drop_cached_fonts_for_ctx)
+static fz_buffer* get_cached_font_buffer(fz_context* ctx, sys_font_info* fi, int* wasCached) {
+    cached_font* f;
     fz_buffer* buffer = NULL;
-    while (f) {
+    shared_font_data* sf;
+
+    EnterCriticalSection(&cs_fonts);
+    for (f = cached_fonts; f; f = f->next) {
         if (f->ctx == ctx && f->fi == fi) {
             buffer = f->buffer;
             break;
         }
-        f = f->next;
     }
     LeaveCriticalSection(&cs_fonts);
+    *wasCached = buffer != NULL;
+    if (buffer) {
+        return buffer;
+    }
+
+    sf = get_shared_font_data(ctx, fi);
+    f = (cached_font*)calloc(1, sizeof(cached_font));
+    fz_try(ctx) {
+        if (!f) {
+            fz_throw(ctx, FZ_ERROR_MEMORY, "couldn't cache font '%s'", fi->fontpath);
+        }
+        buffer = fz_new_buffer_from_shared_data(ctx, sf->data, sf->size);
+    }
+    fz_catch(ctx) {
+        free(f);
+        EnterCriticalSection(&cs_fonts);
+        release_shared_font_data(ctx, sf);
+        LeaveCriticalSection(&cs_fonts);
+        fz_rethrow(ctx);
+    }
+
+    f->fi = fi;
+    f->ctx = ctx;
+    f->buffer = buffer;
+    f->shared = sf;
+    EnterCriticalSection(&cs_fonts);
+    f->next = cached_fonts;
+    cached_fonts = f;
+    LeaveCriticalSection(&cs_fonts);
     return buffer;
 }
 
 void drop_cached_fonts_for_ctx(fz_context* ctx) {
+    // drop fonts still kept alive by the store (through cached font descriptors)
+    // so that the shared font data can be released
+    fz_empty_store(ctx);
+
     EnterCriticalSection(&cs_fonts);
 
     cached_font** currp = &cached_fonts;
@@ -557,11 +678,13 @@ void drop_cached_fonts_for_ctx(fz_context* ctx) {
         if (curr->ctx == ctx) {
             next = *nextp;
             refs = curr->buffer->refs;
-            if (refs != 1) {
-                // TODO: crash?
+            fz_drop_buffer(curr->ctx, curr->buffer);
+            if (refs == 1) {
+                release_shared_font_data(ctx, curr->shared);
+            } else {
+                // a font still uses the data, so rather leak it than free it too early
                 fz_warn(ctx, "drop_cached_fonts_for_ctx: bad refcount %d", refs);
             }
-            fz_drop_buffer(curr->ctx, curr->buffer);
             free(curr);
             *currp = next;
         } else {
@@ -644,23 +767,11 @@ static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_
     if (!found)
         fz_throw(ctx, FZ_ERROR_GENERIC, "couldn't find system font '%s'", orig_name);
 
-    buffer = get_cached_font_buffer(ctx, found);
-    if (buffer) {
+    int wasCached;
+    buffer = get_cached_font_buffer(ctx, found, &wasCached);
+    if (wasCached) {
         fz_warn(ctx, "found cached non-embedded buffer for font '%s' from '%s'", orig_name, found->fontpath);
     } else {
-        buffer = fz_read_file(ctx, found->fontpath);
-        if (!buffer) {
-            return NULL;
-        }
-        cached_font* f = (cached_font*)malloc(sizeof(cached_font));
-        f->fi = found;
-        f->ctx = ctx;
-        f->buffer = buffer;
-        EnterCriticalSection(&cs_fonts);
-        f->next = cached_fonts;
-        cached_fonts = f;
-        LeaveCriticalSection(&cs_fonts);
-
         fz_warn(ctx, "loading non-embedded font '%s' from '%s'", orig_name, found->fontpath);
     }
 
@@ -202,6 +202,14 @@ static bool rar_uncompress(ar_archive *ar, void *buffer, size_t count)
     return true;
 }
 
+bool ar_rar_is_solid(ar_archive *ar)
+{
+    ar_archive_rar *rar = (ar_archive_rar *)ar;
+    if (ar->uncompress != rar_uncompress)
+        return false;
+    return (rar->archive_flags & MHD_SOLID) != 0;
+}
+
 ar_archive *ar_open_rar_archive(ar_stream *stream)
 {
     char signature[FILE_SIGNATURE_SIZE];
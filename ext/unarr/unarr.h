@@ -77,6 +77,8 @@ size_t ar_get_global_comment(ar_archive *ar, void *buffer, size_t count);
 
 /* checks whether 'stream' could contain RAR data and prepares for archive listing/extraction; returns NULL on failure */
 ar_archive *ar_open_rar_archive(ar_stream *stream);
+/* returns whether the entries of a RAR archive are compressed together so that they can't be extracted independently; returns false otherwise (also for non-RAR archives) */
+bool ar_rar_is_solid(ar_archive *ar);
 
 /***** tar/tar *****/
 
@@ -88,6 +90,8 @@ ar_archive *ar_open_tar_archive(ar_stream *stream);
 /* checks whether 'stream' could contain ZIP data and prepares for archive listing/extraction; returns NULL on failure */
 /* set deflatedonly for extracting XPS, EPUB, etc. documents where non-Deflate compression methods are not supported by specification */
 ar_archive *ar_open_zip_archive(ar_stream *stream, bool deflatedonly);
+/* returns the stream offset of the current entry's data if it's stored uncompressed (and unencrypted) so that it can be accessed in place; returns -1 otherwise (also for non-ZIP archives) */
+off64_t ar_zip_entry_get_stored_offset(ar_archive *ar);
 
 /***** _7z/_7z *****/
 
@@ -165,6 +165,23 @@ static bool zip_uncompress(ar_archive *ar, void *buffer, size_t count)
     return true;
 }
 
+off64_t ar_zip_entry_get_stored_offset(ar_archive *ar)
+{
+    ar_archive_zip *zip = (ar_archive_zip *)ar;
+    if (ar->uncompress != zip_uncompress)
+        return -1;
+    if (zip->progress.bytes_done != 0 || (zip->entry.flags & ((1 << 0) | (1 << 6))))
+        return -1;
+    if (zip->entry.method != METHOD_STORE || zip->progress.data_left != ar->entry_size_uncompressed)
+        return -1;
+    if (!zip_seek_to_compressed_data(zip))
+        return -1;
+    /* the local header might disagree with the central directory */
+    if (zip->entry.method != METHOD_STORE)
+        return -1;
+    return ar_tell(ar->stream);
+}
+
 size_t zip_get_global_comment(ar_archive *ar, void *buffer, size_t count)
 {
     ar_archive_zip *zip = (ar_archive_zip *)ar;
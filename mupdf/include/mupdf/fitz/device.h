@@ -245,6 +245,10 @@ enum
 	/* Hints */
 	FZ_DONT_INTERPOLATE_IMAGES = 1,
 	FZ_NO_CACHE = 2,
+	/* interpreters may wrap form xobjects that don't depend on the
+	 * inherited graphics state into tiles painted only once (with
+	 * xstep and ystep 0), so that their rendering can be cached */
+	FZ_CACHE_FORMS = 4,
 };
 
 /**
@@ -355,6 +355,20 @@ void fz_set_pixmap_image_tile(fz_context *ctx, fz_pixmap_image *cimg, fz_pixmap
 */
 fz_pixmap *fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs);
 
+/**
+	Decode a JPX image at a reduced resolution, skipping up to
+	*l2factor resolution levels. On return, *l2factor is updated
+	to the amount of subsampling that is left to do.
+*/
+fz_pixmap *fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs, int *l2factor);
+
+/**
+	sumatrapdf: set how many threads OpenJPEG may use for decoding
+	a single JPX image (1, the default, decodes on the calling thread).
+	JPX images are still decoded one at a time.
+*/
+void fz_set_jpx_decode_threads(int n);
+
 /**
 	Exposed for CBZ.
 */
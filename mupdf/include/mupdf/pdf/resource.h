@@ -70,5 +70,7 @@ int pdf_xobject_isolated(fz_context *ctx, pdf_obj *xobj);
 int pdf_xobject_knockout(fz_context *ctx, pdf_obj *xobj);
 int pdf_xobject_transparency(fz_context *ctx, pdf_obj *xobj);
 fz_colorspace *pdf_xobject_colorspace(fz_context *ctx, pdf_obj *xobj);
+/* whether the xobject is a transparency group or uses blend modes */
+int pdf_xobject_uses_blending(fz_context *ctx, pdf_obj *xobj);
 
 #endif
@@ -13,6 +13,9 @@
 
 #define STACK_SIZE 96
 
+/* Tiles that are painted only once are cached up to this size (16 MB for RGBA). */
+#define FZ_MAX_ONCE_TILE_PIXELS (4096 * 1024)
+
 /* Enable the following to attempt to support knockout and/or isolated
  * blending groups. */
 #define ATTEMPT_KNOCKOUT_AND_ISOLATED
@@ -2417,7 +2420,8 @@ fz_draw_end_group(fz_context *ctx, fz_device *devp)
 typedef struct
 {
 	int refs;
-	float ctm[4];
+	/* the translation is only set for tiles painted once (see fz_draw_begin_tile) */
+	float ctm[6];
 	int id;
 	char has_shape;
 	char has_group_alpha;
@@ -2478,6 +2482,8 @@ fz_cmp_tile_key(fz_context *ctx, void *k0_, void *k1_)
 		k0->ctm[1] == k1->ctm[1] &&
 		k0->ctm[2] == k1->ctm[2] &&
 		k0->ctm[3] == k1->ctm[3] &&
+		k0->ctm[4] == k1->ctm[4] &&
+		k0->ctm[5] == k1->ctm[5] &&
 		k0->cs == k1->cs;
 }
 
@@ -2485,8 +2491,8 @@ static void
 fz_format_tile_key(fz_context *ctx, char *s, size_t n, void *key_)
 {
 	tile_key *key = (tile_key *)key_;
-	fz_snprintf(s, n, "(tile id=%x, ctm=%g %g %g %g, cs=%x, shape=%d, ga=%d)",
-			key->id, key->ctm[0], key->ctm[1], key->ctm[2], key->ctm[3], key->cs,
+	fz_snprintf(s, n, "(tile id=%x, ctm=%g %g %g %g %g %g, cs=%x, shape=%d, ga=%d)",
+			key->id, key->ctm[0], key->ctm[1], key->ctm[2], key->ctm[3], key->ctm[4], key->ctm[5], key->cs,
 			key->has_shape, key->has_group_alpha);
 }
 
@@ -2569,6 +2575,21 @@ fz_draw_begin_tile(fz_context *ctx, fz_device *devp, fz_rect area, fz_rect view,
 	 *	bbox.y0 > state->dest->y || bbox.y1 < state->dest->y + state->dest->h);
 	 */
 
+	/* A tile with no step is painted only once (e.g. a form xobject repeated
+	 * on many pages). Its cached pixmap is placed as is, so the translation
+	 * becomes part of the key. Too large ones are only drawn where visible
+	 * and aren't cached. */
+	if (xstep == 0 && ystep == 0)
+	{
+		int64_t w = (int64_t)bbox.x1 - bbox.x0;
+		int64_t h = (int64_t)bbox.y1 - bbox.y0;
+		if (w * h > FZ_MAX_ONCE_TILE_PIXELS)
+		{
+			bbox = fz_intersect_irect(bbox, state[0].scissor);
+			id = 0;
+		}
+	}
+
 	/* Check to see if we have one cached */
 	if (id)
 	{
@@ -2578,6 +2599,8 @@ fz_draw_begin_tile(fz_context *ctx, fz_device *devp, fz_rect area, fz_rect view,
 		tk.ctm[1] = ctm.b;
 		tk.ctm[2] = ctm.c;
 		tk.ctm[3] = ctm.d;
+		tk.ctm[4] = (xstep == 0 && ystep == 0) ? ctm.e : 0;
+		tk.ctm[5] = (xstep == 0 && ystep == 0) ? ctm.f : 0;
 		tk.id = id;
 		tk.cs = state[1].dest->colorspace;
 		tk.has_shape = (state[1].shape != NULL);
@@ -2680,22 +2703,31 @@ fz_draw_end_tile(fz_context *ctx, fz_device *devp)
 	tile_tmp = fz_expand_rect(tile_tmp, 1);
 	tile_tmp = fz_transform_rect(tile_tmp, ttm);
 
-	/* FIXME: area is a bbox, so FP not appropriate here */
-	/* In PDF files xstep/ystep can be smaller than view (the area of a
-	 * single tile) (see fts_15_1506.pdf for an example). This means that
-	 * we have to bias the left hand/bottom edge calculations by the
-	 * difference between the step and the width/height of the tile. */
-	/* scissor, xstep and area are all in pattern space. */
-	extra_x = tile_tmp.x1 - tile_tmp.x0 - xstep;
-	if (extra_x < 0)
-		extra_x = 0;
-	extra_y = tile_tmp.y1 - tile_tmp.y0 - ystep;
-	if (extra_y < 0)
-		extra_y = 0;
-	x0 = floorf((area.x0 - tile_tmp.x0 - extra_x) / xstep);
-	y0 = floorf((area.y0 - tile_tmp.y0 - extra_y) / ystep);
-	x1 = ceilf((area.x1 - tile_tmp.x0 + extra_x) / xstep);
-	y1 = ceilf((area.y1 - tile_tmp.y0 + extra_y) / ystep);
+	if (xstep == 0 && ystep == 0)
+	{
+		/* painted only once */
+		x0 = y0 = 0;
+		x1 = y1 = 1;
+	}
+	else
+	{
+		/* FIXME: area is a bbox, so FP not appropriate here */
+		/* In PDF files xstep/ystep can be smaller than view (the area of a
+		 * single tile) (see fts_15_1506.pdf for an example). This means that
+		 * we have to bias the left hand/bottom edge calculations by the
+		 * difference between the step and the width/height of the tile. */
+		/* scissor, xstep and area are all in pattern space. */
+		extra_x = tile_tmp.x1 - tile_tmp.x0 - xstep;
+		if (extra_x < 0)
+			extra_x = 0;
+		extra_y = tile_tmp.y1 - tile_tmp.y0 - ystep;
+		if (extra_y < 0)
+			extra_y = 0;
+		x0 = floorf((area.x0 - tile_tmp.x0 - extra_x) / xstep);
+		y0 = floorf((area.y0 - tile_tmp.y0 - extra_y) / ystep);
+		x1 = ceilf((area.x1 - tile_tmp.x0 + extra_x) / xstep);
+		y1 = ceilf((area.y1 - tile_tmp.y0 + extra_y) / ystep);
+	}
 
 	ctm.e = state[1].dest->x;
 	ctm.f = state[1].dest->y;
@@ -2786,6 +2818,8 @@ fz_draw_end_tile(fz_context *ctx, fz_device *devp)
 				key->ctm[1] = ctm.b;
 				key->ctm[2] = ctm.c;
 				key->ctm[3] = ctm.d;
+				key->ctm[4] = (xstep == 0 && ystep == 0) ? state[1].ctm.e : 0;
+				key->ctm[5] = (xstep == 0 && ystep == 0) ? state[1].ctm.f : 0;
 				key->cs = fz_keep_colorspace_store_key(ctx, state[1].dest->colorspace);
 				key->has_shape = (state[1].shape != NULL);
 				key->has_group_alpha = (state[1].group_alpha != NULL);
@@ -1769,6 +1769,13 @@ visible:
 				int cached;
 				fz_list_tile_data *data = (fz_list_tile_data *)node;
 				fz_rect tile_rect;
+				/* tiles painted only once can be culled like their content */
+				if (!tiled && data->xstep == 0 && data->ystep == 0 &&
+					fz_is_empty_rect(fz_intersect_rect(fz_transform_rect(rect, trans_ctm), scissor)))
+				{
+					tile_skip_depth = 1;
+					break;
+				}
 				tiled++;
 				tile_rect = data->view;
 				cached = fz_begin_tile_id(ctx, dev, rect, tile_rect, data->xstep, data->ystep, trans_ctm, data->id);
@@ -465,6 +465,18 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	return jpx_read_image(ctx, &state, data, size, defcs, 0);
 }
 
+void
+fz_set_jpx_decode_threads(int n)
+{
+}
+
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
+{
+	/* reduced resolution decoding isn't supported here */
+	return fz_load_jpx(ctx, data, size, defcs);
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -490,6 +502,7 @@ typedef struct
 	fz_colorspace *cs;
 	int xres;
 	int yres;
+	int l2factor;
 } fz_jpxd;
 
 typedef struct
@@ -659,6 +672,16 @@ void * opj_aligned_realloc(void *ptr, size_t size)
 }
 #endif
 
+/* sumatrapdf: decoding is serialized by opj_lock, so the threads
+   don't add up when several pages with JPX images render in parallel */
+static int jpx_decode_threads = 1;
+
+void
+fz_set_jpx_decode_threads(int n)
+{
+	jpx_decode_threads = n > 1 ? n : 1;
+}
+
 static void fz_opj_error_callback(const char *msg, void *client_data)
 {
 	fz_context *ctx = (fz_context *)client_data;
@@ -724,7 +747,7 @@ static OPJ_BOOL fz_opj_stream_seek(OPJ_OFF_T seek_pos, void * p_user_data)
 }
 
 static fz_pixmap *
-jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta)
+jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta, int l2factor)
 {
 	fz_pixmap *img = NULL;
 	opj_dparameters_t params;
@@ -733,7 +756,7 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 	opj_stream_t *stream;
 	OPJ_CODEC_FORMAT format;
 	int a, n, k;
-	OPJ_UINT32 w, h;
+	OPJ_UINT32 w, h, f;
 	OPJ_UINT32 x, y;
 	stream_block sb;
 	OPJ_UINT32 i;
@@ -762,6 +785,10 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		opj_destroy_codec(codec);
 		fz_throw(ctx, FZ_ERROR_GENERIC, "j2k decode failed");
 	}
+	/* sumatrapdf: decode tiles and code-blocks in parallel (opj_malloc etc.
+	   use the context set by opj_lock, which OpenJPEG's threads share) */
+	if (!onlymeta && jpx_decode_threads > 1 && opj_has_thread_support())
+		opj_codec_set_threads(codec, jpx_decode_threads);
 
 	stream = opj_stream_default_create(OPJ_TRUE);
 	sb.data = data;
@@ -782,11 +809,39 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
 	}
 
+	/* sumatrapdf: skip the highest resolution levels if the caller is
+	   going to subsample the image anyway */
+	if (l2factor > 0)
+	{
+		opj_codestream_info_v2_t *info = opj_get_cstr_info(codec);
+		if (info && info->m_default_tile_info.tccp_info)
+		{
+			for (i = 0; i < info->nbcomps; i++)
+			{
+				OPJ_UINT32 numres = info->m_default_tile_info.tccp_info[i].numresolutions;
+				if ((OPJ_UINT32)l2factor >= numres)
+					l2factor = numres > 0 ? numres - 1 : 0;
+			}
+		}
+		else
+			l2factor = 0;
+		if (info)
+			opj_destroy_cstr_info(&info);
+		if (l2factor > 0 && !opj_set_decoded_resolution_factor(codec, l2factor))
+		{
+			opj_set_decoded_resolution_factor(codec, 0);
+			l2factor = 0;
+		}
+	}
+
 	if (!opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
 		opj_destroy_codec(codec);
 		opj_image_destroy(jpx);
+		/* tiles may have fewer resolution levels than the main header says */
+		if (l2factor > 0)
+			return jpx_read_image(ctx, state, data, size, defcs, onlymeta, 0);
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to decode JPX image");
 	}
 
@@ -816,8 +871,12 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		}
 	}
 
-	state->width = w = jpx->x1 - jpx->x0;
-	state->height = h = jpx->y1 - jpx->y0;
+	state->width = jpx->x1 - jpx->x0;
+	state->height = jpx->y1 - jpx->y0;
+	state->l2factor = l2factor;
+	f = (OPJ_UINT32)1 << l2factor;
+	w = ((jpx->x1 + f - 1) >> l2factor) - ((jpx->x0 + f - 1) >> l2factor);
+	h = ((jpx->y1 + f - 1) >> l2factor) - ((jpx->y0 + f - 1) >> l2factor);
 	state->xres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 	state->yres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 
@@ -893,8 +952,8 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		for (k = 0; k < comps; k++)
 		{
 			opj_image_comp_t *comp = &(jpx->comps[k]);
-			int oy = comp->y0 * comp->dy - jpx->y0;
-			int ox = comp->x0 * comp->dx - jpx->x0;
+			int oy = (comp->y0 * comp->dy - jpx->y0) >> l2factor;
+			int ox = (comp->x0 * comp->dx - jpx->x0) >> l2factor;
 
 			if (comp->data == NULL)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "No data for JP2 image component %d", k);
@@ -958,7 +1017,7 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		pix = jpx_read_image(ctx, &state, data, size, defcs, 0);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, 0, 0);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -968,6 +1027,27 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	return pix;
 }
 
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
+{
+	fz_jpxd state = { 0 };
+	fz_pixmap *pix = NULL;
+
+	fz_try(ctx)
+	{
+		opj_lock(ctx);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, 0, l2factor ? *l2factor : 0);
+	}
+	fz_always(ctx)
+		opj_unlock(ctx);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	if (l2factor)
+		*l2factor -= state.l2factor;
+	return pix;
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -976,7 +1056,8 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		jpx_read_image(ctx, &state, data, size, NULL, 1);
+		/* the metadata doesn't depend on the resolution level */
+		jpx_read_image(ctx, &state, data, size, NULL, 1, 31);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -1000,6 +1081,12 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
 }
 
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
+{
+	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -245,30 +245,57 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 			colorspace = pdf_load_colorspace(ctx, obj);
 
 		len = fz_buffer_storage(ctx, buf, &data);
-		pix = fz_load_jpx(ctx, data, len, colorspace);
 
-		obj = pdf_dict_geta(ctx, dict, PDF_NAME(SMask), PDF_NAME(Mask));
-		if (pdf_is_dict(ctx, obj))
+		/* sumatrapdf: keep plain JPX images compressed so that they're only
+		   decoded when drawn and at no more than the needed resolution */
+		if (!forcemask && colorspace && !fz_colorspace_is_indexed(ctx, colorspace) &&
+			!pdf_dict_geta(ctx, dict, PDF_NAME(Decode), PDF_NAME(D)) &&
+			!pdf_dict_get_int(ctx, dict, PDF_NAME(SMaskInData)))
 		{
-			if (forcemask)
-				fz_warn(ctx, "Ignoring recursive JPX soft mask");
-			else
+			fz_colorspace *cs = NULL;
+			fz_compressed_buffer *cbuf;
+			int w, h, xres, yres;
+
+			fz_load_jpx_info(ctx, data, len, &w, &h, &xres, &yres, &cs);
+			fz_drop_colorspace(ctx, cs);
+
+			obj = pdf_dict_geta(ctx, dict, PDF_NAME(SMask), PDF_NAME(Mask));
+			if (pdf_is_dict(ctx, obj))
 				mask = pdf_load_image_imp(ctx, doc, NULL, obj, NULL, 1);
-		}
 
-		obj = pdf_dict_geta(ctx, dict, PDF_NAME(Decode), PDF_NAME(D));
-		if (obj && !fz_colorspace_is_indexed(ctx, colorspace))
+			cbuf = fz_malloc_struct(ctx, fz_compressed_buffer);
+			cbuf->buffer = fz_keep_buffer(ctx, buf);
+			cbuf->params.type = FZ_IMAGE_JPX;
+			img = fz_new_image_from_compressed_buffer(ctx, w, h, 8, colorspace, xres, yres,
+				pdf_dict_get_bool(ctx, dict, PDF_NAME(Interpolate)), 0, NULL, NULL, cbuf, mask);
+		}
+		else
 		{
-			float decode[FZ_MAX_COLORS * 2];
-			int i;
+			pix = fz_load_jpx(ctx, data, len, colorspace);
 
-			for (i = 0; i < pix->n * 2; i++)
-				decode[i] = pdf_array_get_real(ctx, obj, i);
+			obj = pdf_dict_geta(ctx, dict, PDF_NAME(SMask), PDF_NAME(Mask));
+			if (pdf_is_dict(ctx, obj))
+			{
+				if (forcemask)
+					fz_warn(ctx, "Ignoring recursive JPX soft mask");
+				else
+					mask = pdf_load_image_imp(ctx, doc, NULL, obj, NULL, 1);
+			}
 
-			fz_decode_tile(ctx, pix, decode);
-		}
+			obj = pdf_dict_geta(ctx, dict, PDF_NAME(Decode), PDF_NAME(D));
+			if (obj && !fz_colorspace_is_indexed(ctx, colorspace))
+			{
+				float decode[FZ_MAX_COLORS * 2];
+				int i;
 
-		img = fz_new_image_from_pixmap(ctx, pix, mask);
+				for (i = 0; i < pix->n * 2; i++)
+					decode[i] = pdf_array_get_real(ctx, obj, i);
+
+				fz_decode_tile(ctx, pix, decode);
+			}
+
+			img = fz_new_image_from_pixmap(ctx, pix, mask);
+		}
 	}
 	fz_always(ctx)
 	{
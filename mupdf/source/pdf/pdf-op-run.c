@@ -1127,6 +1127,37 @@ pdf_set_pattern(fz_context *ctx, pdf_run_processor *pr, int what, pdf_pattern *p
 	mat->gstate_num = pr->gparent;
 }
 
+static int
+pdf_is_initial_material(fz_context *ctx, pdf_material *mat)
+{
+	return mat->kind == PDF_MAT_COLOR && mat->colorspace == fz_device_gray(ctx) &&
+		mat->v[0] == 0 && mat->alpha == 1;
+}
+
+/* A form xobject can be rasterized once and reused (even on other pages)
+ * only if what it draws doesn't depend on the graphics state it inherits
+ * (apart from the transformation and the clip), nor on what's below it. */
+static int
+pdf_can_cache_xobject(fz_context *ctx, pdf_run_processor *pr, pdf_obj *xobj, int is_smask)
+{
+	pdf_gstate *gstate = pr->gstate + pr->gtop;
+	fz_stroke_state *stroke = gstate->stroke_state;
+
+	if (!(pr->dev->hints & FZ_CACHE_FORMS) || is_smask || pdf_to_num(ctx, xobj) <= 0)
+		return 0;
+	if (gstate->blendmode || gstate->softmask)
+		return 0;
+	if (!pdf_is_initial_material(ctx, &gstate->fill) || !pdf_is_initial_material(ctx, &gstate->stroke))
+		return 0;
+	if (stroke->linewidth != 1 || stroke->miterlimit != 10 || stroke->linejoin != FZ_LINEJOIN_MITER ||
+		stroke->start_cap != FZ_LINECAP_BUTT || stroke->end_cap != FZ_LINECAP_BUTT || stroke->dash_len != 0)
+		return 0;
+	if (gstate->text.char_space != 0 || gstate->text.word_space != 0 || gstate->text.scale != 1 ||
+		gstate->text.render != 0 || gstate->text.rise != 0)
+		return 0;
+	return !pdf_xobject_uses_blending(ctx, xobj);
+}
+
 static void
 pdf_run_xobject(fz_context *ctx, pdf_run_processor *proc, pdf_obj *xobj, pdf_obj *page_resources, fz_matrix transform, int is_smask)
 {
@@ -1141,6 +1172,8 @@ pdf_run_xobject(fz_context *ctx, pdf_run_processor *proc, pdf_obj *xobj, pdf_obj
 	fz_rect xobj_bbox;
 	fz_matrix xobj_matrix;
 	int transparency = 0;
+	int tiled = 0;
+	int cached = 0;
 	pdf_document *doc;
 	fz_colorspace *cs = NULL;
 	fz_default_colorspaces *save_default_cs = NULL;
@@ -1198,57 +1231,69 @@ pdf_run_xobject(fz_context *ctx, pdf_run_processor *proc, pdf_obj *xobj, pdf_obj
 			gstate->stroke.alpha = 1;
 			gstate->fill.alpha = 1;
 		}
-
-		pdf_gsave(ctx, pr); /* Save here so the clippath doesn't persist */
-
-		/* clip to the bounds */
-		fz_moveto(ctx, pr->path, xobj_bbox.x0, xobj_bbox.y0);
-		fz_lineto(ctx, pr->path, xobj_bbox.x1, xobj_bbox.y0);
-		fz_lineto(ctx, pr->path, xobj_bbox.x1, xobj_bbox.y1);
-		fz_lineto(ctx, pr->path, xobj_bbox.x0, xobj_bbox.y1);
-		fz_closepath(ctx, pr->path);
-		pr->clip = 1;
-		pdf_show_path(ctx, pr, 0, 0, 0, 0);
-
-		/* run contents */
-
-		resources = pdf_xobject_resources(ctx, xobj);
-		if (!resources)
-			resources = page_resources;
-
-		fz_try(ctx)
-			xobj_default_cs = pdf_update_default_colorspaces(ctx, pr->default_cs, resources);
-		fz_catch(ctx)
+		else if (pdf_can_cache_xobject(ctx, pr, xobj, is_smask))
 		{
-			if (fz_caught(ctx) != FZ_ERROR_TRYLATER)
-				fz_rethrow(ctx);
-			if (pr->cookie)
-				pr->cookie->incomplete = 1;
+			/* a tile that's painted once, so that the device can cache it */
+			tiled = 1;
+			cached = fz_begin_tile_id(ctx, pr->dev, xobj_bbox, xobj_bbox, 0, 0, gstate->ctm, pdf_to_num(ctx, xobj));
 		}
-		if (xobj_default_cs != save_default_cs)
+
+		if (!cached)
 		{
-			fz_set_default_colorspaces(ctx, pr->dev, xobj_default_cs);
-			pr->default_cs = xobj_default_cs;
-		}
+			pdf_gsave(ctx, pr); /* Save here so the clippath doesn't persist */
+
+			/* clip to the bounds */
+			fz_moveto(ctx, pr->path, xobj_bbox.x0, xobj_bbox.y0);
+			fz_lineto(ctx, pr->path, xobj_bbox.x1, xobj_bbox.y0);
+			fz_lineto(ctx, pr->path, xobj_bbox.x1, xobj_bbox.y1);
+			fz_lineto(ctx, pr->path, xobj_bbox.x0, xobj_bbox.y1);
+			fz_closepath(ctx, pr->path);
+			pr->clip = 1;
+			pdf_show_path(ctx, pr, 0, 0, 0, 0);
+
+			/* run contents */
+
+			resources = pdf_xobject_resources(ctx, xobj);
+			if (!resources)
+				resources = page_resources;
+
+			fz_try(ctx)
+				xobj_default_cs = pdf_update_default_colorspaces(ctx, pr->default_cs, resources);
+			fz_catch(ctx)
+			{
+				if (fz_caught(ctx) != FZ_ERROR_TRYLATER)
+					fz_rethrow(ctx);
+				if (pr->cookie)
+					pr->cookie->incomplete = 1;
+			}
+			if (xobj_default_cs != save_default_cs)
+			{
+				fz_set_default_colorspaces(ctx, pr->dev, xobj_default_cs);
+				pr->default_cs = xobj_default_cs;
+			}
 
-		doc = pdf_get_bound_document(ctx, xobj);
+			doc = pdf_get_bound_document(ctx, xobj);
 
-		oldbot = pr->gbot;
-		pr->gbot = pr->gtop;
+			oldbot = pr->gbot;
+			pr->gbot = pr->gtop;
 
-		pdf_process_contents(ctx, (pdf_processor*)pr, doc, resources, xobj, pr->cookie);
+			pdf_process_contents(ctx, (pdf_processor*)pr, doc, resources, xobj, pr->cookie);
 
-		/* Undo any gstate mismatches due to the pdf_process_contents call */
-		if (oldbot != -1)
-		{
-			while (pr->gtop > pr->gbot)
+			/* Undo any gstate mismatches due to the pdf_process_contents call */
+			if (oldbot != -1)
 			{
-				pdf_grestore(ctx, pr);
+				while (pr->gtop > pr->gbot)
+				{
+					pdf_grestore(ctx, pr);
+				}
+				pr->gbot = oldbot;
 			}
-			pr->gbot = oldbot;
+
+			pdf_grestore(ctx, pr); /* Remove the state we pushed for the clippath */
 		}
 
-		pdf_grestore(ctx, pr); /* Remove the state we pushed for the clippath */
+		if (tiled)
+			fz_end_tile(ctx, pr->dev);
 
 		/* wrap up transparency stacks */
 		if (transparency)
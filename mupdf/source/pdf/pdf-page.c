@@ -387,7 +387,7 @@ pdf_pattern_uses_blending(fz_context *ctx, pdf_obj *dict)
 	return pdf_extgstate_uses_blending(ctx, obj);
 }
 
-static int
+int
 pdf_xobject_uses_blending(fz_context *ctx, pdf_obj *dict)
 {
 	pdf_obj *obj = pdf_dict_get(ctx, dict, PDF_NAME(Resources));
@@ -365,7 +365,7 @@ xps_count_pages(fz_context *ctx, fz_document *doc_, int chapter)
 }
 
 static fz_xml_doc *
-xps_load_fixed_page(fz_context *ctx, xps_document *doc, xps_fixpage *page)
+xps_load_fixed_page(fz_context *ctx, xps_document *doc, xps_fixpage *page, size_t *size)
 {
 	xps_part *part;
 	fz_xml_doc *xml = NULL;
@@ -374,6 +374,7 @@ xps_load_fixed_page(fz_context *ctx, xps_document *doc, xps_fixpage *page)
 	char *height_att;
 
 	part = xps_read_part(ctx, doc, page->name);
+	*size = part->data->len;
 	fz_try(ctx)
 	{
 		xml = fz_parse_xml(ctx, part->data, 0);
@@ -435,13 +436,40 @@ xps_drop_page_imp(fz_context *ctx, fz_page *page_)
 	fz_drop_xml(ctx, page->xml);
 }
 
+fz_xml *
+xps_page_root(fz_context *ctx, xps_page *page)
+{
+	if (!page->xml)
+		page->xml = xps_load_fixed_page(ctx, page->doc, page->fix, &page->xml_size);
+	return fz_xml_root(page->xml);
+}
+
+size_t
+xps_drop_page_xml(fz_context *ctx, fz_page *page_)
+{
+	xps_page *page = (xps_page*)page_;
+	size_t size = page->xml ? page->xml_size : 0;
+	fz_drop_xml(ctx, page->xml);
+	page->xml = NULL;
+	page->xml_size = 0;
+	return size;
+}
+
+size_t
+xps_page_xml_size(fz_context *ctx, fz_page *page_)
+{
+	xps_page *page = (xps_page*)page_;
+	return page->xml ? page->xml_size : 0;
+}
+
 fz_page *
 xps_load_page(fz_context *ctx, fz_document *doc_, int chapter, int number)
 {
 	xps_document *doc = (xps_document*)doc_;
 	xps_page *page = NULL;
 	xps_fixpage *fix;
-	fz_xml_doc *xml;
+	fz_xml_doc *xml = NULL;
+	size_t xml_size = 0;
 	int n = 0;
 
 	fz_var(page);
@@ -450,7 +478,9 @@ xps_load_page(fz_context *ctx, fz_document *doc_, int chapter, int number)
 	{
 		if (n == number)
 		{
-			xml = xps_load_fixed_page(ctx, doc, fix);
+			/* sumatrapdf: the page size might already be known from the FixedDocument */
+			if (fix->width <= 0 || fix->height <= 0)
+				xml = xps_load_fixed_page(ctx, doc, fix, &xml_size);
 			fz_try(ctx)
 			{
 				page = fz_new_derived_page(ctx, xps_page);
@@ -462,6 +492,7 @@ xps_load_page(fz_context *ctx, fz_document *doc_, int chapter, int number)
 				page->doc = (xps_document*) fz_keep_document(ctx, (fz_document*)doc);
 				page->fix = fix;
 				page->xml = xml;
+				page->xml_size = xml_size;
 			}
 			fz_catch(ctx)
 			{
@@ -11,6 +11,14 @@ fz_page *xps_load_page(fz_context *ctx, fz_document *doc, int chapter, int numbe
 fz_outline *xps_load_outline(fz_context *ctx, fz_document *doc);
 void xps_run_page(fz_context *ctx, fz_page *page, fz_device *dev, fz_matrix ctm, fz_cookie *cookie);
 fz_link *xps_load_links(fz_context *ctx, fz_page *page);
+
+/*
+	sumatrapdf: pages are loaded without parsing their FixedPage part,
+	which is parsed when the page is first run and can be dropped again
+	to save memory (xps_drop_page_xml returns the size of the part).
+*/
+size_t xps_drop_page_xml(fz_context *ctx, fz_page *page);
+size_t xps_page_xml_size(fz_context *ctx, fz_page *page);
 fz_location xps_lookup_link_target(fz_context *ctx, fz_document *doc, const char *target_uri, float *xp, float *yp);
 
 int xps_strcasecmp(char *a, char *b);
@@ -59,6 +67,7 @@ struct xps_page_s
 	xps_document *doc;
 	xps_fixpage *fix;
 	fz_xml_doc *xml;
+	size_t xml_size;
 };
 
 struct xps_target_s
@@ -155,6 +164,7 @@ void xps_parse_element(fz_context *ctx, xps_document *doc, fz_matrix ctm, fz_rec
 void xps_clip(fz_context *ctx, xps_document *doc, fz_matrix ctm, xps_resource *dict, char *clip_att, fz_xml *clip_tag);
 
 fz_xml *xps_lookup_alternate_content(fz_context *ctx, xps_document *doc, fz_xml *node);
+fz_xml *xps_page_root(fz_context *ctx, xps_page *page);
 
 typedef struct xps_entry_s xps_entry;
 
@@ -163,7 +163,7 @@ xps_load_links_in_fixed_page(fz_context *ctx, xps_document *doc, fz_matrix ctm,
 	char base_uri[1024];
 	char *s;
 
-	root = fz_xml_root(page->xml);
+	root = xps_page_root(ctx, page);
 
 	if (!root)
 		return;
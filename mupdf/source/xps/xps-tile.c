@@ -347,7 +347,7 @@ xps_parse_fixed_page(fz_context *ctx, xps_document *doc, fz_matrix ctm, xps_page
 	doc->opacity_top = 0;
 	doc->opacity[0] = 1;
 
-	root = fz_xml_root(page->xml);
+	root = xps_page_root(ctx, page);
 	if (!root)
 		return;
 
@@ -24,6 +24,7 @@ function makelzsa_files()
     "StrUtil.*",
     "StrUtil_win.*",
     "Log.*",
+    "ThreadUtil.*",
     "WinDynCalls.*",
     "WinUtil.*",
   })
@@ -406,8 +407,11 @@ function sumatrapdf_files()
     "CanvasAboutUI.*",
     "ChmModel.*",
     "Commands.*",
+    "ContentBoxCache.*",
     "CrashHandler.*",
     "DisplayModel.*",
+    "DiskTextIndex.*",
+    "DiskTileCache.*",
     "Doc.*",
     "EbookController.*",
     "EbookControls.*",
@@ -426,6 +430,7 @@ function sumatrapdf_files()
     "Menu.*",
     "MuiEbookPageDef.*",
     "Notifications.*",
+    "PageThumbnails.*",
     "PagesLayoutDef.*",
     "ParseBKM.*",
     "PdfSync.*",
@@ -435,6 +440,7 @@ function sumatrapdf_files()
     "resource.h",
     "SaveAsPdf.*",
     "SearchAndDDE.*",
+    "SearchResults.*",
     "Selection.*",
     "SettingsStructs.*",
     "SumatraPDF.cpp",
@@ -446,6 +452,10 @@ function sumatrapdf_files()
     "SumatraDialogs.*",
     "SumatraProperties.*",
     "StressTesting.*",
+    "BatchMode.*",
+    "TextExport.*",
+    "AutomationPipe.*",
+    "MemoryPressure.*",
     "SvgIcons.*",
     "TabInfo.*",
     "TableOfContents.*",
@@ -482,6 +492,7 @@ end
 
 function utils_files()
   files_in_dir("src/utils", {
+    "AllocSampler.*",
     "ApiHook.*",
     "Archive.*",
     "BaseUtil.*",
@@ -514,11 +525,13 @@ function utils_files()
     "LogDbg.*",
     "LzmaSimpleArchive.*",
     "PEB.h",
+    "Regex.*",
     "RegistryPaths.*",
     "Scoped.h",
     "ScopedWin.h",
     "SerializeTxt.*",
     "SettingsUtil.*",
+    "SlowOps.*",
     "SquareTreeParser.*",
     "StrconvUtil.*",
     "StrFormat.*",
@@ -528,6 +541,7 @@ function utils_files()
     "StrUtil_win.cpp",
     "ThreadUtil.*",
     "TgaReader.*",
+    "Trace.*",
     "TrivialHtmlParser.*",
     "TxtParser.*",
     "UITask.*",
@@ -880,6 +894,7 @@ function test_util_files()
   files_in_dir( "src/utils", {
     "BaseUtil.*",
     "BitManip.*",
+    "BitReader.*",
     "ByteOrderDecoder.*",
     "CmdLineParser.*",
     "ColorUtil.*",
@@ -893,6 +908,7 @@ function test_util_files()
     "HtmlPrettyPrint.*",
     "HtmlPullParser.*",
     "JsonParser.*",
+    "Regex.*",
     "Scoped.*",
     "SettingsUtil.*",
     "Log.*",
@@ -902,8 +918,10 @@ function test_util_files()
     "StrUtil.*",
     "StrUtil_win.cpp",
     "SquareTreeParser.*",
+    "ThreadUtil.*",
     "TrivialHtmlParser.*",
     "UtAssert.*",
+    "UtBench.*",
     --"VarintGob*",
     "Vec.*",
     "WinUtil.*",
@@ -936,6 +954,7 @@ function pdf_preview_files()
   files_in_dir("src/previewer", {
     "PdfPreview.*",
     "PdfPreviewDll.cpp",
+    "PreviewCache.*",
   })
 
   files_in_dir("src", {
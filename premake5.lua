@@ -272,7 +272,8 @@ workspace "SumatraPDF"
     -- and we can't provide our own in a different directory because
     -- msvc will include the one in ext/openjpeg/src/lib/openjp2 first
     -- because #include "opj_config_private.h" searches current directory first
-    defines { "_CRT_SECURE_NO_WARNINGS", "USE_JPIP", "OPJ_STATIC", "OPJ_EXPORTS" }
+    -- MUTEX_win32 enables multi-threaded decoding (see fz_set_jpx_decode_threads)
+    defines { "_CRT_SECURE_NO_WARNINGS", "USE_JPIP", "OPJ_STATIC", "OPJ_EXPORTS", "MUTEX_win32" }
     openjpeg_files()
 
 
@@ -15,6 +15,7 @@ ACCEL gAccelerators[] = {
     {FCONTROL | FVIRTKEY, 'C', CmdCopySelection},
     {FCONTROL | FVIRTKEY, 'D', CmdProperties},
     {FCONTROL | FVIRTKEY, 'F', CmdFindFirst},
+    {FSHIFT | FCONTROL | FVIRTKEY, 'F', CmdFindAll},
     {FCONTROL | FVIRTKEY, 'G', CmdGoToPage},
     {FCONTROL | FVIRTKEY, 'L', CmdViewPresentationMode},
     {FSHIFT | FCONTROL | FVIRTKEY, 'L', CmdViewFullScreen},
@@ -60,12 +61,14 @@ ACCEL gAccelerators[] = {
     {FVIRTKEY, VK_F11, CmdViewFullScreen},
     {FSHIFT | FVIRTKEY, VK_F11, CmdViewPresentationMode},
     {FVIRTKEY, VK_F12, CmdViewBookmarks},
+    {FSHIFT | FVIRTKEY, VK_F12, CmdViewThumbnails},
     {FCONTROL | FVIRTKEY, VK_SUBTRACT, CmdZoomOut},
     {FSHIFT | FCONTROL | FVIRTKEY, VK_SUBTRACT, CmdViewRotateLeft},
     {FCONTROL | FVIRTKEY, VK_OEM_MINUS, CmdZoomOut},
     {FSHIFT | FCONTROL | FVIRTKEY, VK_OEM_MINUS, CmdViewRotateLeft},
     {FALT | FVIRTKEY, VK_LEFT, CmdGoToNavBack},
     {FALT | FVIRTKEY, VK_RIGHT, CmdGoToNavForward},
+    {FSHIFT | FCONTROL | FALT | FVIRTKEY, 'P', CmdDebugTogglePerfHud},
 };
 
 HACCEL CreateSumatraAcceleratorTable() {
@@ -105,6 +105,8 @@ std::string_view AnnotationReadableName(AnnotationType tp) {
 }
 
 struct AnnotationPdf {
+    // the EnginePdf the annotation belongs to
+    EngineBase* engine = nullptr;
     fz_context* ctx = nullptr;
     // must protect mupdf calls because we might be e.g. rendering
     // a page in a separate thread
@@ -255,9 +257,13 @@ bool Annotation::SetContents(std::string_view sv) {
     return true;
 }
 
+// in EnginePdf.cpp
+extern void EnginePdfAnnotationDeleted(EngineBase* engine, int pageNo, pdf_annot* annot);
+
 void Annotation::Delete() {
     CrashIf(isDeleted);
     ScopedCritSec cs(pdf->ctxAccess);
+    EnginePdfAnnotationDeleted(pdf->engine, pageNo, pdf->annot);
     pdf_delete_annot(pdf->ctx, pdf->page, pdf->annot);
     isDeleted = true;
     isChanged = true; // TODO: not sure I need this
@@ -490,8 +496,8 @@ void Annotation::SetOpacity(int newOpacity) {
     isChanged = true;
 }
 
-Annotation* MakeAnnotationPdf(CRITICAL_SECTION* ctxAccess, fz_context* ctx, pdf_page* page, pdf_annot* annot,
-                              int pageNo) {
+Annotation* MakeAnnotationPdf(EngineBase* engine, CRITICAL_SECTION* ctxAccess, fz_context* ctx, pdf_page* page,
+                              pdf_annot* annot, int pageNo) {
     ScopedCritSec cs(ctxAccess);
 
     auto tp = pdf_annot_type(ctx, annot);
@@ -501,6 +507,7 @@ Annotation* MakeAnnotationPdf(CRITICAL_SECTION* ctxAccess, fz_context* ctx, pdf_
         return nullptr;
     }
     AnnotationPdf* apdf = new AnnotationPdf();
+    apdf->engine = engine;
     apdf->ctxAccess = ctxAccess;
     apdf->ctx = ctx;
     apdf->annot = annot;
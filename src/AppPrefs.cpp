@@ -6,6 +6,7 @@
 #include "utils/FileWatcher.h"
 #include "utils/UITask.h"
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/TreeModel.h"
 
@@ -68,14 +69,201 @@ WCHAR* GetSettingsPath() {
     return AppGenDataFilename(GetSettingsFileNameNoFree());
 }
 
+// a binary snapshot of the deserialized settings is kept next to the settings
+// file so that parsing a large settings file (e.g. with thousands of FileStates)
+// can be skipped at startup; it's only used if the settings file hasn't been
+// modified (e.g. in a text editor) since the snapshot was written
+struct SettingsSnapshotHeader {
+    u32 magic;
+    u32 settingsSize;
+    FILETIME settingsTime;
+};
+
+static const u32 kSettingsSnapshotMagic = 'SPB1';
+
+static WCHAR* GetSettingsSnapshotPath(const WCHAR* settingsPath) {
+    return str::Join(settingsPath, L".bin");
+}
+
+static bool GetSettingsSnapshotHeader(const WCHAR* settingsPath, SettingsSnapshotHeader* hdr) {
+    WIN32_FILE_ATTRIBUTE_DATA fileInfo;
+    if (!GetFileAttributesExW(settingsPath, GetFileExInfoStandard, &fileInfo) || fileInfo.nFileSizeHigh != 0) {
+        return false;
+    }
+    hdr->magic = kSettingsSnapshotMagic;
+    hdr->settingsSize = fileInfo.nFileSizeLow;
+    hdr->settingsTime = fileInfo.ftLastWriteTime;
+    return true;
+}
+
+static bool IsSettingsSnapshotHeaderValid(const SettingsSnapshotHeader& hdr, const SettingsSnapshotHeader& expected) {
+    return hdr.magic == expected.magic && hdr.settingsSize == expected.settingsSize &&
+           FileTimeEq(hdr.settingsTime, expected.settingsTime);
+}
+
+static GlobalPrefs* LoadSettingsSnapshot(const WCHAR* settingsPath) {
+    SettingsSnapshotHeader expected;
+    if (!GetSettingsSnapshotHeader(settingsPath, &expected)) {
+        return nullptr;
+    }
+    AutoFreeWstr snapshotPath = GetSettingsSnapshotPath(settingsPath);
+    AutoFree data = file::ReadFile(snapshotPath);
+    SettingsSnapshotHeader hdr;
+    if (data.size() < sizeof(hdr)) {
+        return nullptr;
+    }
+    memcpy(&hdr, data.data, sizeof(hdr));
+    if (!IsSettingsSnapshotHeaderValid(hdr, expected)) {
+        return nullptr;
+    }
+    std::span<u8> snapshot = {(u8*)data.data + sizeof(hdr), data.size() - sizeof(hdr)};
+    return NewGlobalPrefsFromBinary(snapshot);
+}
+
+// must be called right after the settings file has been written
+// with prefs (of which snapshot is the binary serialization)
+static void SaveSettingsSnapshot(const WCHAR* settingsPath, GlobalPrefs* prefs, std::span<u8> snapshot) {
+    AutoFreeWstr snapshotPath = GetSettingsSnapshotPath(settingsPath);
+    // SerializeGlobalPrefs drops most per-document state in this case,
+    // so the snapshot wouldn't match what reloading the settings file yields
+    if (!prefs->rememberStatePerDocument || !prefs->rememberOpenedFiles) {
+        file::Delete(snapshotPath);
+        return;
+    }
+    SettingsSnapshotHeader hdr;
+    if (!GetSettingsSnapshotHeader(settingsPath, &hdr)) {
+        file::Delete(snapshotPath);
+        return;
+    }
+    str::Str data(sizeof(hdr) + snapshot.size());
+    data.Append((const char*)&hdr, sizeof(hdr));
+    data.AppendSpan(snapshot);
+    bool ok = file::WriteFile(snapshotPath, data.AsSpan());
+    if (!ok) {
+        file::Delete(snapshotPath);
+    }
+}
+
+static bool IsSettingsSnapshotUpToDate(const WCHAR* settingsPath) {
+    SettingsSnapshotHeader expected;
+    if (!GetSettingsSnapshotHeader(settingsPath, &expected)) {
+        return false;
+    }
+    AutoFreeWstr snapshotPath = GetSettingsSnapshotPath(settingsPath);
+    SettingsSnapshotHeader hdr;
+    int n = file::ReadN(snapshotPath, (char*)&hdr, sizeof(hdr));
+    return n == (int)sizeof(hdr) && IsSettingsSnapshotHeaderValid(hdr, expected);
+}
+
+// Save() only takes a binary snapshot of gGlobalPrefs and hands it to a background
+// thread which writes the settings file once no further changes have been made for
+// kSaveDelayMs, so that e.g. closing a tab never waits for the disk and a burst of
+// changes results in a single write
+static const DWORD kSaveDelayMs = 500;
+
+// protects gPendingSave
+static Mutex gPendingSaveMutex;
+static std::span<u8> gPendingSave;
+// held while the settings file is being written, protects gLastSaveTime
+static Mutex gSaveWriteMutex;
+static FILETIME gLastSaveTime;
+static HANDLE gSaveEvent = nullptr;
+
+class SettingsWriterThread;
+static SettingsWriterThread* gSettingsWriter = nullptr;
+
+static std::span<u8> TakePendingSave() {
+    gPendingSaveMutex.Lock();
+    std::span<u8> snapshot = gPendingSave;
+    gPendingSave = {};
+    gPendingSaveMutex.Unlock();
+    return snapshot;
+}
+
+// replaces the settings file atomically, so that another SumatraPDF
+// process never sees a partially written settings file
+static bool ReplaceSettingsFile(const WCHAR* path, std::span<u8> data) {
+    AutoFreeWstr tmpPath = str::Join(path, L".tmp");
+    bool ok = file::WriteFile(tmpPath, data);
+    if (ok) {
+        BOOL moveOk = MoveFileExW(tmpPath, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+        ok = moveOk != FALSE;
+    }
+    if (!ok) {
+        file::Delete(tmpPath);
+    }
+    return ok;
+}
+
+// called on the writer thread (or on shutdown) and must not access gGlobalPrefs
+static void WriteSettings(std::span<u8> snapshot) {
+    GlobalPrefs* prefs = NewGlobalPrefsFromBinary(snapshot);
+    CrashIf(!prefs);
+    if (!prefs) {
+        return;
+    }
+    AutoFreeWstr path = GetSettingsPath();
+    gSaveWriteMutex.Lock();
+    AutoFree prevPrefs = file::ReadFile(path);
+    AutoFree data = SerializeGlobalPrefs(prefs, prevPrefs.data);
+    // only save if anything's changed at all
+    if (prevPrefs.size() == data.size() && str::Eq(data, prevPrefs)) {
+        if (!IsSettingsSnapshotUpToDate(path)) {
+            SaveSettingsSnapshot(path, prefs, snapshot);
+        }
+    } else if (data.size() > 0 && ReplaceSettingsFile(path, {(u8*)data.data, data.size()})) {
+        gLastSaveTime = file::GetModificationTime(path);
+        SaveSettingsSnapshot(path, prefs, snapshot);
+    }
+    gSaveWriteMutex.Unlock();
+    DeleteGlobalPrefs(prefs);
+}
+
+class SettingsWriterThread : public ThreadBase {
+  public:
+    SettingsWriterThread() : ThreadBase("SettingsWriterThread") {
+    }
+
+    void Run() override {
+        while (!WasCancelRequested()) {
+            WaitForSingleObject(gSaveEvent, INFINITE);
+            // wait for the changes to settle down (unless we're shutting down)
+            while (!WasCancelRequested() && WaitForSingleObject(gSaveEvent, kSaveDelayMs) == WAIT_OBJECT_0) {
+                ;
+            }
+            AutoFree snapshot = TakePendingSave();
+            if (snapshot.data) {
+                WriteSettings({(u8*)snapshot.data, snapshot.size()});
+            }
+        }
+    }
+};
+
+static void ScheduleSave(std::span<u8> snapshot) {
+    if (!gSettingsWriter) {
+        gSaveEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+        gSettingsWriter = new SettingsWriterThread();
+        gSettingsWriter->Start();
+    }
+    gPendingSaveMutex.Lock();
+    free(gPendingSave.data());
+    gPendingSave = snapshot;
+    gPendingSaveMutex.Unlock();
+    SetEvent(gSaveEvent);
+}
+
 /* Caller needs to prefs::CleanUp() */
 bool Load() {
     CrashIf(gGlobalPrefs);
 
     AutoFreeWstr path = GetSettingsPath();
-    AutoFree prefsData = file::ReadFile(path.Get());
-
-    gGlobalPrefs = NewGlobalPrefs(prefsData.data);
+    AutoFree prefsData;
+    gGlobalPrefs = LoadSettingsSnapshot(path);
+    bool fromSnapshot = gGlobalPrefs != nullptr;
+    if (!fromSnapshot) {
+        prefsData.Set(file::ReadFile(path.Get()));
+        gGlobalPrefs = NewGlobalPrefs(prefsData.data);
+    }
     CrashAlwaysIf(!gGlobalPrefs);
     auto* gprefs = gGlobalPrefs;
 
@@ -89,12 +277,12 @@ bool Load() {
 #endif
 
 #ifdef DISABLE_EBOOK_UI
-    if (!prefsData || !str::Find(prefsData, "UseFixedPageUI =")) {
+    if (!fromSnapshot && (!prefsData || !str::Find(prefsData, "UseFixedPageUI ="))) {
         gprefs->ebookUI.useFixedPageUI = gprefs->chmUI.useFixedPageUI = true;
     }
 #endif
 #ifdef DISABLE_TABS
-    if (!prefsData || !str::Find(prefsData, "UseTabs =")) {
+    if (!fromSnapshot && (!prefsData || !str::Find(prefsData, "UseTabs ="))) {
         gprefs->useTabs = false;
     }
 #endif
@@ -160,6 +348,11 @@ static void RememberSessionState() {
         }
         SessionData* data = NewSessionData();
         for (TabInfo* tab : win->tabs) {
+            if (tab->deferredState) {
+                // the document hasn't been loaded since the session was restored
+                data->tabStates->Append(CloneTabState(tab->deferredState));
+                continue;
+            }
             DisplayState* ds = NewDisplayState(tab->filePath);
             if (tab->ctrl) {
                 tab->ctrl->GetDisplayState(ds);
@@ -206,34 +399,41 @@ bool Save() {
     str::ReplacePtr(&gGlobalPrefs->defaultDisplayMode, conv::FromDisplayMode(gGlobalPrefs->defaultDisplayModeEnum));
     conv::FromZoom(&gGlobalPrefs->defaultZoom, gGlobalPrefs->defaultZoomFloat);
 
-    AutoFreeWstr path = GetSettingsPath();
-    DebugCrashIf(!path.data);
-    if (!path.data) {
-        return false;
-    }
-    std::span<u8> prevPrefs = file::ReadFile(path.data);
-    const char* prevPrefsData = (char*)prevPrefs.data();
-    std::span<u8> prefs = SerializeGlobalPrefs(gGlobalPrefs, prevPrefsData);
-    defer {
-        str::Free(prevPrefs.data());
-        str::Free(prefs.data());
-    };
-    CrashIf(prefs.empty());
-    if (prefs.empty()) {
+    std::span<u8> snapshot = SerializeGlobalPrefsBinary(gGlobalPrefs);
+    CrashIf(snapshot.empty());
+    if (snapshot.empty()) {
         return false;
     }
+    ScheduleSave(snapshot);
+    return true;
+}
 
-    // only save if anything's changed at all
-    if (prevPrefs.size() == prefs.size() && str::Eq(prefs, prevPrefs)) {
-        return true;
+// writes out the most recent changes (if any) and stops the writer thread
+void FlushPendingSave() {
+    if (!gSettingsWriter) {
+        return;
     }
-
-    bool ok = file::WriteFile(path.Get(), prefs);
-    if (!ok) {
-        return false;
+    gSettingsWriter->RequestCancel();
+    SetEvent(gSaveEvent);
+    gSettingsWriter->Join();
+    delete gSettingsWriter;
+    gSettingsWriter = nullptr;
+    CloseHandle(gSaveEvent);
+    gSaveEvent = nullptr;
+
+    // the thread might have stopped right before the last Save()
+    AutoFree snapshot = TakePendingSave();
+    if (snapshot.data) {
+        WriteSettings({(u8*)snapshot.data, snapshot.size()});
     }
-    gGlobalPrefs->lastPrefUpdate = file::GetModificationTime(path.Get());
-    return true;
+}
+
+// true if the settings file was last modified by WriteSettings
+static bool IsOwnSave(FILETIME time) {
+    gSaveWriteMutex.Lock();
+    bool isOwn = FileTimeEq(time, gLastSaveTime);
+    gSaveWriteMutex.Unlock();
+    return isOwn;
 }
 
 // refresh the preferences when a different SumatraPDF process saves them
@@ -260,9 +460,12 @@ bool Reload() {
     AutoCloseHandle hScope(h);
 
     FILETIME time = file::GetModificationTime(path);
-    if (FileTimeEq(time, gGlobalPrefs->lastPrefUpdate)) {
+    if (FileTimeEq(time, gGlobalPrefs->lastPrefUpdate) || IsOwnSave(time)) {
         return true;
     }
+    // changes made by another process or a text editor take precedence
+    // over changes which haven't been written yet
+    free(TakePendingSave().data());
 
     AutoFree uiLanguage = str::Dup(gGlobalPrefs->uiLanguage);
     bool showToolbar = gGlobalPrefs->showToolbar;
@@ -0,0 +1,419 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/GdiPlusUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
+#include "utils/WinUtil.h"
+#include "utils/Log.h"
+
+#include "wingui/TreeModel.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "EngineCreate.h"
+#include "DisplayMode.h"
+#include "SettingsStructs.h"
+#include "Controller.h"
+#include "GlobalPrefs.h"
+#include "SumatraPDF.h"
+#include "WindowInfo.h"
+#include "AutomationPipe.h"
+
+/*
+Automation clients (e.g. for testing) send frames, each consisting of a
+little-endian u32 length followed by that many bytes of UTF-8. A frame
+contains one or more commands, one per line, with tab separated arguments:
+
+  <id> TAB <command> [TAB <arg>]*
+
+Every command gets a reply frame of its own as soon as it's been executed
+(which isn't necessarily in the order in which the commands were sent):
+
+  <id> TAB ok [TAB <result>]
+  <id> TAB error TAB <message>
+
+Commands:
+  open <path>                      loads the document (also into a window),
+                                   the result is the number of pages
+  goto <page>                      shows the page in the document's window
+  render <page> <zoom> <png path>  saves the page rendered at zoom (in percent)
+  text <page>                      the result is the text of the page
+  search <text>                    the result are the numbers of the pages
+                                   containing text (ignoring case), separated by spaces
+
+render, text and search use an engine of their own, loaded by open, so that
+they neither wait for nor interfere with the ui. goto is executed on the ui
+thread. Only one client is served at a time.
+*/
+
+#define AUTOMATION_PIPE_BUF_SIZE (64 * 1024)
+// protects against garbage sent to the pipe
+#define MAX_AUTOMATION_FRAME_SIZE (16 * 1024 * 1024)
+
+enum class AutomationCmd {
+    Open,
+    Goto,
+    Render,
+    Text,
+    Search,
+};
+
+static const char* automationCmdNames = "open\0goto\0render\0text\0search\0";
+// number of arguments of each command
+static int automationCmdArgs[] = {1, 1, 3, 1, 1};
+
+struct AutomationConn {
+    // guards replies
+    CRITICAL_SECTION access;
+    // framed replies not yet written to the pipe
+    str::Str replies;
+    // signaled when replies have been added
+    HANDLE replyEvent = nullptr;
+    // commands being executed on the ui thread hold a reference
+    LONG refs = 1;
+
+    // only used on the pipe thread
+    EngineBase* engine = nullptr;
+    WCHAR* filePath = nullptr;
+
+    AutomationConn() {
+        InitializeCriticalSection(&access);
+        replyEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    }
+    ~AutomationConn() {
+        delete engine;
+        free(filePath);
+        CloseHandle(replyEvent);
+        DeleteCriticalSection(&access);
+    }
+};
+
+static HANDLE gAutomationThread = nullptr;
+static HANDLE gAutomationStopEvent = nullptr;
+
+static void ReleaseConn(AutomationConn* conn) {
+    if (0 == InterlockedDecrement(&conn->refs)) {
+        delete conn;
+    }
+}
+
+// can be called from any thread
+static void QueueReply(AutomationConn* conn, const char* id, const char* error, const char* result = nullptr) {
+    str::Str reply;
+    reply.Append(id);
+    if (error) {
+        reply.Append("\terror\t");
+        reply.Append(error);
+    } else {
+        reply.Append("\tok");
+        if (result) {
+            reply.Append("\t");
+            reply.Append(result);
+        }
+    }
+    u32 len = (u32)reply.size();
+
+    ScopedCritSec scope(&conn->access);
+    conn->replies.Append((const char*)&len, sizeof(len));
+    conn->replies.Append(reply.Get(), reply.size());
+    SetEvent(conn->replyEvent);
+}
+
+static const char* AutomationOpen(AutomationConn* conn, const WCHAR* path, str::Str& result) {
+    delete conn->engine;
+    conn->engine = CreateEngine(path);
+    str::ReplacePtr(&conn->filePath, conn->engine ? path : nullptr);
+    if (!conn->engine) {
+        return "failed to load the document";
+    }
+    result.AppendFmt("%d", conn->engine->PageCount());
+
+    // also show the document to the user
+    WCHAR* filePath = str::Dup(path);
+    uitask::Post([filePath] {
+        if (!FindWindowInfoByFile(filePath, true)) {
+            LoadArgs args(filePath, nullptr);
+            LoadDocument(args);
+        }
+        free(filePath);
+    });
+    return nullptr;
+}
+
+static void AutomationGoto(AutomationConn* conn, const char* id, int pageNo) {
+    char* cmdId = str::Dup(id);
+    WCHAR* filePath = str::Dup(conn->filePath);
+    InterlockedIncrement(&conn->refs);
+    uitask::Post([conn, cmdId, filePath, pageNo] {
+        WindowInfo* win = FindWindowInfoByFile(filePath, true);
+        if (!win || !win->IsDocLoaded()) {
+            QueueReply(conn, cmdId, "the document isn't shown");
+        } else if (!win->ctrl->ValidPageNo(pageNo)) {
+            QueueReply(conn, cmdId, "invalid page number");
+        } else {
+            win->ctrl->GoToPage(pageNo, false);
+            QueueReply(conn, cmdId, nullptr);
+        }
+        free(cmdId);
+        free(filePath);
+        ReleaseConn(conn);
+    });
+}
+
+static const char* AutomationRender(AutomationConn* conn, int pageNo, float zoom, const WCHAR* path) {
+    if (zoom <= 0 || zoom > ZOOM_MAX) {
+        return "invalid zoom";
+    }
+    RenderPageArgs args(pageNo, zoom / 100.f, 0);
+    RenderedBitmap* bmp = conn->engine->RenderPage(args);
+    if (!bmp) {
+        return "failed to render the page";
+    }
+    CLSID pngEncId = GetEncoderClsid(L"image/png");
+    Gdiplus::Bitmap gbmp(bmp->GetBitmap(), nullptr);
+    bool ok = gbmp.Save(path, &pngEncId) == Gdiplus::Ok;
+    delete bmp;
+    return ok ? nullptr : "failed to save the page image";
+}
+
+static void AutomationText(AutomationConn* conn, int pageNo, str::Str& result) {
+    PageText pageText = conn->engine->ExtractPageText(pageNo);
+    if (pageText.text) {
+        AutoFree text = strconv::WstrToUtf8(pageText.text);
+        result.Append(text.Get());
+    }
+    FreePageText(&pageText);
+}
+
+static void AutomationSearch(AutomationConn* conn, const WCHAR* text, str::Str& result) {
+    int nPages = conn->engine->PageCount();
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        PageText pageText = conn->engine->ExtractPageText(pageNo);
+        if (pageText.text && str::FindI(pageText.text, text)) {
+            result.AppendFmt(result.size() > 0 ? " %d" : "%d", pageNo);
+        }
+        FreePageText(&pageText);
+    }
+}
+
+static void ExecuteAutomationCmd(AutomationConn* conn, const WCHAR* line) {
+    WStrVec args;
+    args.Split(line, L"\t");
+    if (args.size() == 0 || str::IsEmpty(args.at(0))) {
+        return;
+    }
+    AutoFree id = strconv::WstrToUtf8(args.at(0));
+    AutoFree name = strconv::WstrToUtf8(args.size() > 1 ? args.at(1) : L"");
+    int cmdIdx = seqstrings::StrToIdx(automationCmdNames, name.Get());
+    if (cmdIdx < 0) {
+        QueueReply(conn, id.Get(), "unknown command");
+        return;
+    }
+    if ((int)args.size() != 2 + automationCmdArgs[cmdIdx]) {
+        QueueReply(conn, id.Get(), "wrong number of arguments");
+        return;
+    }
+    auto cmd = (AutomationCmd)cmdIdx;
+    if (cmd != AutomationCmd::Open && !conn->engine) {
+        QueueReply(conn, id.Get(), "no document has been opened");
+        return;
+    }
+    const WCHAR* arg = args.at(2);
+    if ((cmd == AutomationCmd::Render || cmd == AutomationCmd::Text) &&
+        (_wtoi(arg) < 1 || _wtoi(arg) > conn->engine->PageCount())) {
+        QueueReply(conn, id.Get(), "invalid page number");
+        return;
+    }
+
+    const char* error = nullptr;
+    str::Str result;
+    switch (cmd) {
+        case AutomationCmd::Open:
+            error = AutomationOpen(conn, arg, result);
+            break;
+        case AutomationCmd::Goto:
+            // replies once it's been executed on the ui thread
+            AutomationGoto(conn, id.Get(), _wtoi(arg));
+            return;
+        case AutomationCmd::Render:
+            error = AutomationRender(conn, _wtoi(arg), (float)_wtof(args.at(3)), args.at(4));
+            break;
+        case AutomationCmd::Text:
+            AutomationText(conn, _wtoi(arg), result);
+            break;
+        case AutomationCmd::Search:
+            AutomationSearch(conn, arg, result);
+            break;
+    }
+    QueueReply(conn, id.Get(), error, result.size() > 0 ? result.Get() : nullptr);
+}
+
+// executes the commands of all complete frames in data,
+// returns false if data doesn't contain valid frames
+static bool ProcessFrames(AutomationConn* conn, str::Str& data) {
+    while (data.size() >= sizeof(u32)) {
+        u32 len;
+        memcpy(&len, data.Get(), sizeof(len));
+        if (len > MAX_AUTOMATION_FRAME_SIZE) {
+            return false;
+        }
+        if (data.size() < sizeof(len) + len) {
+            return true;
+        }
+        AutoFreeWstr cmds = strconv::Utf8ToWstr({data.Get() + sizeof(len), len});
+        data.RemoveAt(0, sizeof(len) + len);
+
+        str::RemoveChars(cmds, L"\r");
+        WStrVec lines;
+        lines.Split(cmds, L"\n", true);
+        for (const WCHAR* line : lines) {
+            ExecuteAutomationCmd(conn, line);
+        }
+    }
+    return true;
+}
+
+// waits for an overlapped operation to complete,
+// returns false if it failed or if we're stopping
+static bool WaitForPipeIo(HANDLE hPipe, OVERLAPPED* ov, DWORD* n) {
+    HANDLE handles[2] = {ov->hEvent, gAutomationStopEvent};
+    if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+        CancelIo(hPipe);
+        GetOverlappedResult(hPipe, ov, n, TRUE);
+        return false;
+    }
+    return GetOverlappedResult(hPipe, ov, n, FALSE);
+}
+
+// returns false if the client has disconnected (or if we're stopping)
+static bool WriteReplies(HANDLE hPipe, AutomationConn* conn, HANDLE writeEvent) {
+    str::Str data;
+    {
+        ScopedCritSec scope(&conn->access);
+        data = conn->replies;
+        conn->replies.Reset();
+    }
+    if (data.size() == 0) {
+        return true;
+    }
+    OVERLAPPED ov{};
+    ov.hEvent = writeEvent;
+    DWORD n = 0;
+    if (!WriteFile(hPipe, data.Get(), (DWORD)data.size(), &n, &ov) && GetLastError() != ERROR_IO_PENDING) {
+        return false;
+    }
+    return WaitForPipeIo(hPipe, &ov, &n) && n == data.size();
+}
+
+static void ServeAutomationClient(HANDLE hPipe) {
+    AutomationConn* conn = new AutomationConn();
+    AutoCloseHandle readEvent(CreateEvent(nullptr, TRUE, FALSE, nullptr));
+    AutoCloseHandle writeEvent(CreateEvent(nullptr, TRUE, FALSE, nullptr));
+    str::Str data;
+    char buf[4096];
+
+    for (;;) {
+        OVERLAPPED ov{};
+        ov.hEvent = readEvent;
+        DWORD n = 0;
+        if (!ReadFile(hPipe, buf, sizeof(buf), &n, &ov) && GetLastError() != ERROR_IO_PENDING) {
+            break;
+        }
+        // send the replies of commands executed on the ui thread while waiting for more commands
+        HANDLE handles[3] = {readEvent, conn->replyEvent, gAutomationStopEvent};
+        DWORD res = WaitForMultipleObjects(3, handles, FALSE, INFINITE);
+        bool ok = true;
+        while (ok && res == WAIT_OBJECT_0 + 1) {
+            ok = WriteReplies(hPipe, conn, writeEvent);
+            res = WaitForMultipleObjects(3, handles, FALSE, INFINITE);
+        }
+        if (!ok || res != WAIT_OBJECT_0) {
+            CancelIo(hPipe);
+            GetOverlappedResult(hPipe, &ov, &n, TRUE);
+            break;
+        }
+        if (!GetOverlappedResult(hPipe, &ov, &n, FALSE)) {
+            break;
+        }
+        data.Append(buf, n);
+        if (!ProcessFrames(conn, data) || !WriteReplies(hPipe, conn, writeEvent)) {
+            break;
+        }
+    }
+    ReleaseConn(conn);
+}
+
+static DWORD WINAPI AutomationPipeThread(void* data) {
+    HANDLE hPipe = (HANDLE)data;
+    SetThreadName(GetCurrentThreadId(), "AutomationPipe");
+    // some engines use COM (e.g. WIC for images)
+    ScopedCom com;
+    AutoCloseHandle connectEvent(CreateEvent(nullptr, TRUE, FALSE, nullptr));
+
+    for (;;) {
+        OVERLAPPED ov{};
+        ov.hEvent = connectEvent;
+        DWORD n = 0;
+        bool isConnected = ConnectNamedPipe(hPipe, &ov) != 0;
+        DWORD err = GetLastError();
+        if (!isConnected && ERROR_IO_PENDING == err) {
+            isConnected = WaitForPipeIo(hPipe, &ov, &n);
+        } else if (!isConnected && ERROR_PIPE_CONNECTED == err) {
+            isConnected = true;
+        }
+        if (WaitForSingleObject(gAutomationStopEvent, 0) == WAIT_OBJECT_0) {
+            break;
+        }
+        if (!isConnected) {
+            LogLastError(err);
+            break;
+        }
+        logf("AutomationPipeThread: client connected\n");
+        ServeAutomationClient(hPipe);
+        DisconnectNamedPipe(hPipe);
+        logf("AutomationPipeThread: client disconnected\n");
+    }
+    CloseHandle(hPipe);
+    return 0;
+}
+
+bool StartAutomationPipe(const WCHAR* name) {
+    CrashIf(gAutomationThread);
+    AutoFreeWstr pipePath = str::Join(L"\\\\.\\pipe\\", name);
+    // FILE_FLAG_FIRST_PIPE_INSTANCE makes sure that no other process has created the pipe before
+    DWORD openMode = PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE;
+    DWORD pipeMode = PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS;
+    HANDLE hPipe = CreateNamedPipeW(pipePath, openMode, pipeMode, 1, AUTOMATION_PIPE_BUF_SIZE,
+                                    AUTOMATION_PIPE_BUF_SIZE, 0, nullptr);
+    if (INVALID_HANDLE_VALUE == hPipe) {
+        logf(L"StartAutomationPipe: failed to create '%s'\n", pipePath.Get());
+        LogLastError();
+        return false;
+    }
+
+    gAutomationStopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    gAutomationThread = CreateThread(nullptr, 0, AutomationPipeThread, hPipe, 0, nullptr);
+    if (!gAutomationThread) {
+        CloseHandle(hPipe);
+        SafeCloseHandle(&gAutomationStopEvent);
+        return false;
+    }
+    return true;
+}
+
+void StopAutomationPipe() {
+    if (!gAutomationThread) {
+        return;
+    }
+    SetEvent(gAutomationStopEvent);
+    // a command that's being executed isn't aborted (e.g. searching a large
+    // document), so don't wait for it indefinitely
+    if (WaitForSingleObject(gAutomationThread, 2000) != WAIT_OBJECT_0) {
+        return;
+    }
+    SafeCloseHandle(&gAutomationThread);
+    SafeCloseHandle(&gAutomationStopEvent);
+}
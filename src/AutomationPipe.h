@@ -0,0 +1,7 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// serves automation commands sent to the named pipe \\.\pipe\<name>
+// (see AutomationPipe.cpp for the protocol)
+bool StartAutomationPipe(const WCHAR* name);
+void StopAutomationPipe();
@@ -0,0 +1,347 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/DirIter.h"
+#include "utils/FileUtil.h"
+#include "utils/GdiPlusUtil.h"
+#include "utils/GuessFileType.h"
+#include "utils/JsonParser.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
+#include "utils/WinUtil.h"
+#include "utils/Log.h"
+
+#include "wingui/TreeModel.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "EngineCreate.h"
+#include "DisplayMode.h"
+#include "SettingsStructs.h"
+#include "GlobalPrefs.h"
+#include "Flags.h"
+#include "SumatraPDF.h"
+#include "Print.h"
+#include "TextExport.h"
+#include "BatchMode.h"
+
+// headless processing of many documents at once:
+// -batch <render|text|print> <file, directory or file list> <output directory>
+// every file is handled by a single worker with its own engine and the results
+// (page images or text) are written to the output directory together with
+// summary.json listing the outcome and timings for each file
+
+#define MAX_BATCH_WORKERS 32
+
+enum class BatchAction {
+    Render,
+    Text,
+    Print,
+};
+
+static const char* batchActionNames = "render\0text\0print\0";
+
+struct BatchFile {
+    WCHAR* path = nullptr;
+    // base name of the output file(s), unique within the batch
+    WCHAR* outName = nullptr;
+
+    bool ok = false;
+    const char* error = nullptr;
+    int pageCount = 0;
+    double loadMs = 0;
+    double processMs = 0;
+
+    ~BatchFile() {
+        free(path);
+        free(outName);
+    }
+};
+
+struct BatchJob {
+    BatchAction action = BatchAction::Render;
+    const WCHAR* outputDir = nullptr;
+    WCHAR* printerName = nullptr;
+    const WCHAR* printSettings = nullptr;
+    // in percent, like -zoom
+    float zoom = ZOOM_ACTUAL_SIZE;
+    // like -export-text-markers
+    bool pageMarkers = false;
+
+    Vec<BatchFile*> files;
+    LONG nextFile = -1;
+
+    ~BatchJob() {
+        DeleteVecMembers(files);
+    }
+};
+
+static bool IsBatchFile(const WCHAR* path) {
+    Kind kind = GuessFileType(path, true);
+    return IsSupportedFileType(kind, true);
+}
+
+// input is either a directory (searched recursively), a single document
+// or a text file listing one document per line
+static void CollectBatchFiles(const WCHAR* input, WStrVec& paths) {
+    if (dir::Exists(input)) {
+        DirIter di(input, true /* recursive */);
+        for (const WCHAR* path = di.First(); path; path = di.Next()) {
+            if (IsBatchFile(path)) {
+                paths.Append(str::Dup(path));
+            }
+        }
+        paths.SortNatural();
+        return;
+    }
+    if (IsBatchFile(input)) {
+        paths.Append(str::Dup(input));
+        return;
+    }
+    AutoFree data = file::ReadFile(input);
+    if (data.empty()) {
+        return;
+    }
+    AutoFreeWstr list = strconv::Utf8ToWstr(data.AsView());
+    str::RemoveChars(list, L"\r");
+    paths.Split(list, L"\n", true);
+}
+
+static void SetUniqueOutNames(Vec<BatchFile*>& files) {
+    WStrVec used;
+    for (BatchFile* f : files) {
+        const WCHAR* baseName = path::GetBaseNameNoFree(f->path);
+        const WCHAR* ext = path::GetExtNoFree(baseName);
+        AutoFreeWstr name = str::DupN(baseName, ext - baseName);
+        WCHAR* outName = str::Dup(name);
+        for (int n = 2; used.Contains(outName); n++) {
+            free(outName);
+            outName = str::Format(L"%s-%d", name.Get(), n);
+        }
+        used.Append(str::Dup(outName));
+        f->outName = outName;
+    }
+}
+
+static bool BatchRenderPages(BatchJob* job, BatchFile* f, EngineBase* engine) {
+    CLSID pngEncId = GetEncoderClsid(L"image/png");
+    for (int pageNo = 1; pageNo <= f->pageCount; pageNo++) {
+        RenderPageArgs args(pageNo, job->zoom / 100.f, 0);
+        RenderedBitmap* bmp = engine->RenderPage(args);
+        if (!bmp) {
+            f->error = "failed to render a page";
+            return false;
+        }
+        AutoFreeWstr fileName = str::Format(L"%s-%d.png", f->outName, pageNo);
+        AutoFreeWstr path = path::Join(job->outputDir, fileName);
+        Gdiplus::Bitmap gbmp(bmp->GetBitmap(), nullptr);
+        bool ok = gbmp.Save(path, &pngEncId) == Gdiplus::Ok;
+        delete bmp;
+        if (!ok) {
+            f->error = "failed to save a page image";
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool BatchExtractText(BatchJob* job, BatchFile* f, EngineBase* engine) {
+    TextExportOptions opts;
+    opts.pageMarkers = job->pageMarkers;
+    // the files are already processed in parallel, unless there's only one
+    opts.nWorkers = job->files.size() == 1 ? 0 : 1;
+    AutoFreeWstr fileName = str::Join(f->outName, L".txt");
+    AutoFreeWstr path = path::Join(job->outputDir, fileName);
+    if (!ExportText(engine, path, opts)) {
+        f->error = "failed to save the text";
+        return false;
+    }
+    return true;
+}
+
+static void ProcessBatchFile(BatchJob* job, BatchFile* f) {
+    auto t = TimeGet();
+    EngineBase* engine = CreateEngine(f->path);
+    f->loadMs = TimeSinceInMs(t);
+    if (!engine) {
+        f->error = "failed to load";
+        logf(L"Error: failed to load %s", f->path);
+        return;
+    }
+    f->pageCount = engine->PageCount();
+
+    t = TimeGet();
+    switch (job->action) {
+        case BatchAction::Render:
+            f->ok = BatchRenderPages(job, f, engine);
+            break;
+        case BatchAction::Text:
+            f->ok = BatchExtractText(job, f, engine);
+            break;
+        case BatchAction::Print:
+            f->ok = PrintFile(engine, job->printerName, false, job->printSettings);
+            if (!f->ok) {
+                f->error = "failed to print";
+            }
+            break;
+    }
+    f->processMs = TimeSinceInMs(t);
+    delete engine;
+
+    logf(L"%s (in %.2f ms): %s", f->ok ? L"Finished" : L"Failed", f->loadMs + f->processMs, f->path);
+}
+
+static DWORD WINAPI BatchWorker(void* data) {
+    BatchJob* job = (BatchJob*)data;
+    SetThreadName(GetCurrentThreadId(), "BatchWorker");
+    // some engines use COM (e.g. WIC for images)
+    ScopedCom com;
+    for (;;) {
+        LONG fileNo = InterlockedIncrement(&job->nextFile);
+        if (fileNo >= (LONG)job->files.size()) {
+            return 0;
+        }
+        ProcessBatchFile(job, job->files.at(fileNo));
+    }
+}
+
+static bool WriteBatchSummary(BatchJob* job, const char* action, int nWorkers, double totalMs) {
+    str::Str s(4096);
+    s.AppendFmt("{\n  \"action\": \"%s\",\n  \"workers\": %d,\n  \"totalMs\": %.2f,\n  \"files\": [", action, nWorkers,
+                totalMs);
+    for (size_t i = 0; i < job->files.size(); i++) {
+        BatchFile* f = job->files.at(i);
+        s.Append(i > 0 ? ",\n    {" : "\n    {");
+        s.Append("\"path\": ");
+        AutoFree path = strconv::WstrToUtf8(f->path);
+        json::AppendQuoted(s, path.Get());
+        s.AppendFmt(", \"ok\": %s, \"pages\": %d, \"loadMs\": %.2f, \"processMs\": %.2f", f->ok ? "true" : "false",
+                    f->pageCount, f->loadMs, f->processMs);
+        if (f->error) {
+            s.AppendFmt(", \"error\": \"%s\"", f->error);
+        }
+        s.Append("}");
+    }
+    s.Append("\n  ]\n}\n");
+
+    AutoFreeWstr path = path::Join(job->outputDir, L"summary.json");
+    return file::WriteFile(path, s.AsSpan());
+}
+
+static int GetBatchWorkersCount(const Flags& i, BatchAction action) {
+    if (i.batchWorkers > 0) {
+        return std::min(i.batchWorkers, MAX_BATCH_WORKERS);
+    }
+    // keep the order of print jobs unless asked otherwise
+    if (BatchAction::Print == action) {
+        return 1;
+    }
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return std::min((int)si.dwNumberOfProcessors, MAX_BATCH_WORKERS);
+}
+
+// returns the process exit code: 0 if all files were processed successfully
+int RunBatch(const Flags& i) {
+    logToStderr = true;
+
+    AutoFree actionName = strconv::WstrToUtf8(i.batchAction);
+    int actionIdx = seqstrings::StrToIdx(batchActionNames, actionName.Get());
+    if (actionIdx < 0) {
+        logf(L"Error: unknown batch action '%s' (must be render, text or print)", i.batchAction);
+        return 1;
+    }
+
+    BatchJob job;
+    job.action = (BatchAction)actionIdx;
+    job.outputDir = i.batchOutputDir;
+    job.printSettings = i.printSettings;
+    if (i.startZoom > 0) {
+        job.zoom = i.startZoom;
+    }
+    job.pageMarkers = i.exportTextMarkers;
+    AutoFreeWstr defaultPrinter;
+    job.printerName = i.printerName;
+    if (BatchAction::Print == job.action && !job.printerName) {
+        defaultPrinter.Set(GetDefaultPrinterName());
+        job.printerName = defaultPrinter;
+    }
+
+    WStrVec paths;
+    CollectBatchFiles(i.batchInput, paths);
+    if (paths.size() == 0) {
+        logf(L"Error: no documents found in %s", i.batchInput);
+        return 1;
+    }
+    if (!dir::CreateAll(job.outputDir)) {
+        logf(L"Error: failed to create the output directory %s", job.outputDir);
+        return 1;
+    }
+    for (WCHAR* path : paths) {
+        BatchFile* f = new BatchFile();
+        f->path = str::Dup(path);
+        job.files.Append(f);
+    }
+    SetUniqueOutNames(job.files);
+
+    auto total = TimeGet();
+    int nWorkers = std::min(GetBatchWorkersCount(i, job.action), (int)job.files.size());
+    HANDLE workers[MAX_BATCH_WORKERS];
+    int nStarted = 0;
+    for (int n = 0; n < nWorkers; n++) {
+        workers[nStarted] = CreateThread(nullptr, 0, BatchWorker, &job, 0, nullptr);
+        if (workers[nStarted]) {
+            nStarted++;
+        }
+    }
+    if (0 == nStarted) {
+        // process on this thread instead
+        BatchWorker(&job);
+    }
+    WaitForMultipleObjects(nStarted, workers, TRUE, INFINITE);
+    for (int n = 0; n < nStarted; n++) {
+        CloseHandle(workers[n]);
+    }
+    double totalMs = TimeSinceInMs(total);
+
+    int nFailed = 0;
+    for (BatchFile* f : job.files) {
+        if (!f->ok) {
+            nFailed++;
+        }
+    }
+    logf(L"Processed %d files (%d failed) in %.2f ms", (int)job.files.size(), nFailed, totalMs);
+
+    if (!WriteBatchSummary(&job, actionName.Get(), std::max(nStarted, 1), totalMs)) {
+        logf(L"Error: failed to write summary.json to %s", job.outputDir);
+        return 1;
+    }
+    return nFailed > 0 ? 1 : 0;
+}
+
+// -export-text <document> <file.txt>
+// returns the process exit code: 0 if the text was exported successfully
+int RunExportText(const Flags& i) {
+    logToStderr = true;
+
+    auto t = TimeGet();
+    EngineBase* engine = CreateEngine(i.exportTextSrc);
+    if (!engine) {
+        logf(L"Error: failed to load %s", i.exportTextSrc);
+        return 1;
+    }
+    TextExportOptions opts;
+    opts.pageMarkers = i.exportTextMarkers;
+    opts.nWorkers = i.batchWorkers;
+    bool ok = ExportText(engine, i.exportTextDst, opts);
+    int nPages = engine->PageCount();
+    delete engine;
+    if (!ok) {
+        logf(L"Error: failed to write %s", i.exportTextDst);
+        return 1;
+    }
+    logf(L"Exported the text of %d pages in %.2f ms", nPages, TimeSinceInMs(t));
+    return 0;
+}
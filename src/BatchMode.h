@@ -0,0 +1,7 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+struct Flags;
+
+int RunBatch(const Flags& i);
+int RunExportText(const Flags& i);
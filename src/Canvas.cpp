@@ -49,10 +49,12 @@
 #include "uia/Provider.h"
 #include "SearchAndDDE.h"
 #include "Selection.h"
+#include "StressTesting.h"
 #include "SumatraAbout.h"
 #include "Tabs.h"
 #include "Toolbar.h"
 #include "Translations.h"
+#include "PageThumbnails.h"
 
 // these can be global, as the mouse wheel can't affect more than one window at once
 static int gDeltaPerLine = 0;
@@ -77,6 +79,87 @@ void UpdateDeltaPerLine() {
 
 ///// methods needed for FixedPageUI canvases with document loaded /////
 
+static void StopScrollAnimation(WindowInfo* win) {
+    if (win->scrollAnimating) {
+        KillTimer(win->hwndCanvas, SCROLL_ANIMATION_TIMER_ID);
+        win->scrollAnimating = false;
+    }
+}
+
+// moves the viewport a part of the remaining way to the animation's target
+// (each step is painted from the tiles that are already rendered,
+// with lower resolution ones standing in for the missing ones)
+static void StepScrollAnimation(WindowInfo* win) {
+    DisplayModel* dm = win->AsFixed();
+    // stop if something else (e.g. GoToPage or a zoom change) moved the viewport
+    if (!dm || dm->GetViewPort().y != win->scrollAnimY) {
+        StopScrollAnimation(win);
+        return;
+    }
+    int dist = win->scrollAnimTargetY - win->scrollAnimY;
+    int step = dist / 4;
+    if (0 == step) {
+        step = dist;
+    }
+    int y = win->scrollAnimY + step;
+    win->scrollAnimY = y;
+    if (y == win->scrollAnimTargetY) {
+        StopScrollAnimation(win);
+    }
+    if (step != 0) {
+        SCROLLINFO si = {0};
+        si.cbSize = sizeof(si);
+        si.fMask = SIF_POS;
+        si.nPos = y;
+        SetScrollInfo(win->hwndCanvas, SB_VERT, &si, TRUE);
+        dm->ScrollYTo(y);
+    }
+}
+
+// scrolls smoothly to yOff, driven by a timer so that input is handled
+// between the steps; further scrolling only moves the target
+static void AnimateScrollYTo(WindowInfo* win, int yOff) {
+    DisplayModel* dm = win->AsFixed();
+    Rect viewPort = dm->GetViewPort();
+    int maxY = std::max(dm->GetCanvasSize().dy - viewPort.dy, 0);
+    yOff = limitValue(yOff, 0, maxY);
+    if (yOff == viewPort.y) {
+        StopScrollAnimation(win);
+        return;
+    }
+    if (!win->scrollAnimating || yOff != win->scrollAnimTargetY) {
+        dm->RenderPagesAt(yOff);
+    }
+    win->scrollAnimTargetY = yOff;
+    if (win->scrollAnimating) {
+        return;
+    }
+    win->scrollAnimating = true;
+    win->scrollAnimY = viewPort.y;
+    SetTimer(win->hwndCanvas, SCROLL_ANIMATION_TIMER_ID, SCROLL_ANIMATION_INTERVAL_IN_MS, nullptr);
+    StepScrollAnimation(win);
+}
+
+static bool IsAnimatedScroll(WindowInfo* win, USHORT msg) {
+    if (!gGlobalPrefs->fixedPageUI.smoothScroll || !IsContinuous(win->ctrl->GetDisplayMode())) {
+        return false;
+    }
+    // in remote sessions, every step would have to be sent over the network
+    if (gRenderCache.isRemoteSession) {
+        return false;
+    }
+    switch (msg) {
+        case SB_LINEUP:
+        case SB_LINEDOWN:
+        case SB_HPAGEUP:
+        case SB_HPAGEDOWN:
+        case SB_PAGEUP:
+        case SB_PAGEDOWN:
+            return true;
+    }
+    return false;
+}
+
 static void OnVScroll(WindowInfo* win, WPARAM wp) {
     CrashIf(!win->AsFixed());
 
@@ -94,6 +177,11 @@ static void OnVScroll(WindowInfo* win, WPARAM wp) {
     }
 
     USHORT msg = LOWORD(wp);
+    bool animate = IsAnimatedScroll(win, msg);
+    if (animate && win->scrollAnimating) {
+        // scroll relative to where the running animation ends
+        si.nPos = win->scrollAnimTargetY;
+    }
     switch (msg) {
         case SB_TOP:
             si.nPos = si.nMin;
@@ -124,6 +212,12 @@ static void OnVScroll(WindowInfo* win, WPARAM wp) {
             break;
     }
 
+    if (animate) {
+        AnimateScrollYTo(win, si.nPos);
+        return;
+    }
+    StopScrollAnimation(win);
+
     // Set the position and then retrieve it.  Due to adjustments
     // by Windows it may not be the same as the value set.
     si.fMask = SIF_POS;
@@ -790,13 +884,22 @@ static void GetGradientColor(COLORREF a, COLORREF b, float perc, TRIVERTEX* tv)
     tv->Blue = (COLOR16)((ab + perc * (bb - ab)) * 256);
 }
 
-static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
+// returns true if all visible pages could be painted as up-to-date bitmaps
+static bool DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
     CrashIf(!win->AsFixed());
     if (!win->AsFixed()) {
-        return;
+        return false;
     }
     DisplayModel* dm = win->AsFixed();
 
+    // after RepaintScrolled() only the uncovered part has to be painted
+    Rect area = Rect::FromRECT(*rcArea);
+    int savedDC = SaveDC(hdc);
+    IntersectClipRect(hdc, rcArea->left, rcArea->top, rcArea->right, rcArea->bottom);
+    defer {
+        RestoreDC(hdc, savedDC);
+    };
+
     bool isImage = dm->GetEngine()->IsImageCollection();
     // draw comic books and single images on a black background
     // (without frame and shadow)
@@ -870,9 +973,12 @@ static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
     }
 
     bool rendering = false;
+    bool complete = true;
     Rect screen(Point(), dm->GetViewPort().Size());
 
-    for (int pageNo = 1; pageNo <= dm->PageCount(); ++pageNo) {
+    int firstPage = dm->FirstVisiblePageNo();
+    int lastPage = dm->LastVisiblePageNo();
+    for (int pageNo = firstPage; firstPage > 0 && pageNo <= lastPage; ++pageNo) {
         PageInfo* pageInfo = dm->GetPageInfo(pageNo);
         if (!pageInfo || 0.0f == pageInfo->visibleRatio) {
             continue;
@@ -883,6 +989,9 @@ static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
         }
 
         Rect bounds = pageInfo->pageOnScreen.Intersect(screen);
+        if (bounds.Intersect(area).IsEmpty()) {
+            continue;
+        }
         // don't paint the frame background for images
         if (!dm->GetEngine()->IsImageCollection()) {
             Rect r = pageInfo->pageOnScreen;
@@ -891,7 +1000,16 @@ static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
         }
 
         bool renderOutOfDateCue = false;
-        int renderDelay = gRenderCache.Paint(hdc, bounds, dm, pageNo, pageInfo, &renderOutOfDateCue);
+        bool paintedDraft = false;
+        int renderDelay = gRenderCache.Paint(hdc, bounds.Intersect(area), dm, pageNo, pageInfo, &renderOutOfDateCue,
+                                             &paintedDraft);
+        if (renderDelay != 0 || renderOutOfDateCue) {
+            complete = false;
+        }
+        if (paintedDraft) {
+            // the drafts are rendered again when the page is painted after the interaction
+            RepaintAsync(win, INTERACTION_IDLE_MS);
+        }
 
         if (renderDelay != 0) {
             AutoDeleteFont fontRightTxt(CreateSimpleFont(hdc, L"MS Shell Dlg", 14));
@@ -943,6 +1061,70 @@ static void DrawDocument(WindowInfo* win, HDC hdc, RECT* rcArea) {
     if (!rendering) {
         DebugShowLinks(dm, hdc);
     }
+    return complete;
+}
+
+void ShowPerfHud(WindowInfo* win, bool show) {
+    if (!show) {
+        delete win->perfHud;
+        win->perfHud = nullptr;
+        return;
+    }
+    if (win->perfHud) {
+        return;
+    }
+    PerfHud* hud = new PerfHud();
+    hud->wnd = new FrameRateWnd();
+    if (!hud->wnd->Create(win->hwndCanvas)) {
+        delete hud;
+        return;
+    }
+    // only show counters for what happens while the HUD is shown
+    RenderQueueStats stats = gRenderCache.GetStats();
+    hud->tileHits = stats.tileHits;
+    hud->tileMisses = stats.tileMisses;
+    hud->tilesRendered = stats.tilesRendered;
+    hud->totalTileLatencyMs = stats.totalTileLatencyMs;
+    win->perfHud = hud;
+    ScheduleRepaint(win->hwndCanvas);
+}
+
+static void UpdatePerfHud(WindowInfo* win, double paintMs) {
+    PerfHud* hud = win->perfHud;
+    hud->paintMs[hud->nPaints % PERF_HUD_PAINTS] = paintMs;
+    hud->nPaints++;
+    int n = std::min(hud->nPaints, PERF_HUD_PAINTS);
+    double totalMs = 0;
+    double maxMs = 0;
+    for (int i = 0; i < n; i++) {
+        totalMs += hud->paintMs[i];
+        maxMs = std::max(maxMs, hud->paintMs[i]);
+    }
+
+    RenderQueueStats stats = gRenderCache.GetStats();
+    int hits = stats.tileHits - hud->tileHits;
+    int misses = stats.tileMisses - hud->tileMisses;
+    int nRendered = stats.tilesRendered - hud->tilesRendered;
+    u64 latencyMs = stats.totalTileLatencyMs - hud->totalTileLatencyMs;
+
+    str::WStr s;
+    s.AppendFmt(L"paint: %.1f ms (avg %.1f, max %.1f of last %d)", paintMs, totalMs / n, maxMs, n);
+    s.AppendFmt(L"\ntiles: %d hits, %d misses", hits, misses);
+    if (hits + misses > 0) {
+        s.AppendFmt(L" (%d%% hits)", hits * 100 / (hits + misses));
+    }
+    s.AppendFmt(L"\nrender queue: %d (max %d)", stats.queueDepth, stats.maxQueueDepth);
+    s.AppendFmt(L"\ntile latency: last %d ms, avg %d ms, max %d ms (%d tiles)", (int)stats.lastTileLatencyMs,
+                nRendered > 0 ? (int)(latencyMs / nRendered) : 0, (int)stats.maxTileLatencyMs, nRendered);
+    DisplayModel* dm = win->AsFixed();
+    // read without locking, as it's only for display
+    size_t textCacheSize = dm && dm->textCache ? dm->textCache->cachedSize : 0;
+    s.AppendFmt(L"\ntext cache: %.1f MB", textCacheSize / (1024.0 * 1024.0));
+    hud->wnd->ShowText(s.Get());
+}
+
+static bool CoversCanvas(WindowInfo* win, const RECT& rc) {
+    return rc.left <= 0 && rc.top <= 0 && rc.right >= win->canvasRc.dx && rc.bottom >= win->canvasRc.dy;
 }
 
 static void OnPaintDocument(WindowInfo* win) {
@@ -950,6 +1132,9 @@ static void OnPaintDocument(WindowInfo* win) {
     PAINTSTRUCT ps;
     HDC hdc = BeginPaint(win->hwndCanvas, &ps);
 
+    bool complete = true;
+    bool wasComplete = win->canvasPaintComplete;
+    win->canvasPaintComplete = false;
     switch (win->presentation) {
         case PM_BLACK_SCREEN:
             FillRect(hdc, &ps.rcPaint, GetStockBrush(BLACK_BRUSH));
@@ -958,14 +1143,25 @@ static void OnPaintDocument(WindowInfo* win) {
             FillRect(hdc, &ps.rcPaint, GetStockBrush(WHITE_BRUSH));
             break;
         default:
-            DrawDocument(win, win->buffer->GetDC(), &ps.rcPaint);
-            win->buffer->Flush(hdc);
+            complete = DrawDocument(win, win->buffer->GetDC(), &ps.rcPaint);
+            win->buffer->Flush(hdc, Rect::FromRECT(ps.rcPaint));
+            // a partial repaint (e.g. of a single page) can't tell about the rest of the canvas
+            if (!wasComplete && !CoversCanvas(win, ps.rcPaint)) {
+                complete = false;
+            }
+            win->canvasPaintComplete = complete;
     }
 
     EndPaint(win->hwndCanvas, &ps);
     if (gShowFrameRate) {
         win->frameRateWnd->ShowFrameRateDur(TimeSinceInMs(t));
     }
+    if (win->perfHud) {
+        UpdatePerfHud(win, TimeSinceInMs(t));
+    }
+    if (win->stressTest) {
+        OnStressTestPaint(win, TimeSinceInMs(t), complete);
+    }
 }
 
 static void SetTextOrArrorCursor(DisplayModel* dm, Point pt) {
@@ -976,10 +1172,28 @@ static void SetTextOrArrorCursor(DisplayModel* dm, Point pt) {
     }
 }
 
+// prefetch the destination page of an internal link once the cursor has rested on it
+// for a moment (destPageNo is 0 if the cursor isn't over such a link)
+static void UpdateLinkPrefetch(WindowInfo* win, HWND hwnd, int destPageNo) {
+    if (destPageNo == win->linkPrefetchPageNo) {
+        return;
+    }
+    win->linkPrefetchPageNo = destPageNo;
+    if (destPageNo > 0) {
+        SetTimer(hwnd, LINK_PREFETCH_TIMER_ID, LINK_PREFETCH_DELAY_IN_MS, nullptr);
+        return;
+    }
+    KillTimer(hwnd, LINK_PREFETCH_TIMER_ID);
+    if (win->AsFixed()) {
+        win->AsFixed()->PrefetchLinkDestination(0);
+    }
+}
+
 static LRESULT OnSetCursorMouseIdle(WindowInfo* win, HWND hwnd) {
     Point pt;
     DisplayModel* dm = win->AsFixed();
     if (!dm || !GetCursor() || !GetCursorPosInHwnd(hwnd, pt)) {
+        UpdateLinkPrefetch(win, hwnd, 0);
         win->HideToolTip();
         return FALSE;
     }
@@ -990,6 +1204,7 @@ static LRESULT OnSetCursorMouseIdle(WindowInfo* win, HWND hwnd) {
 
     IPageElement* pageEl = dm->GetElementAtPos(pt);
     if (!pageEl) {
+        UpdateLinkPrefetch(win, hwnd, 0);
         SetTextOrArrorCursor(dm, pt);
         win->HideToolTip();
         return TRUE;
@@ -1001,7 +1216,10 @@ static LRESULT OnSetCursorMouseIdle(WindowInfo* win, HWND hwnd) {
     win->ShowToolTip(text, rc, true);
 
     bool isLink = pageEl->Is(kindPageElementDest);
+    PageDestination* dest = isLink ? pageEl->AsLink() : nullptr;
+    int destPageNo = dest && kindDestinationScrollTo == dest->Kind() ? dest->GetPageNo() : 0;
     delete pageEl;
+    UpdateLinkPrefetch(win, hwnd, destPageNo);
 
     if (isLink) {
         SetCursorCached(IDC_HAND);
@@ -1036,6 +1254,12 @@ static LRESULT OnSetCursor(WindowInfo* win, HWND hwnd) {
 }
 
 static LRESULT CanvasOnMouseWheel(WindowInfo* win, UINT msg, WPARAM wp, LPARAM lp) {
+    // Scroll the thumbnails, if they're visible and the cursor is over them
+    HWND hwndThumbnails = GetThumbnailsHwnd(win);
+    if (hwndThumbnails && IsCursorOverWindow(hwndThumbnails)) {
+        return SendMessageW(hwndThumbnails, msg, wp, lp);
+    }
+
     // Scroll the ToC sidebar, if it's visible and the cursor is in it
     if (win->tocVisible && IsCursorOverWindow(win->tocTreeCtrl->hwnd) && !gWheelMsgRedirect) {
         // Note: hwndTocTree's window procedure doesn't always handle
@@ -1428,7 +1652,7 @@ static LRESULT WndProcCanvasEbookUI(WindowInfo* win, HWND hwnd, UINT msg, WPARAM
     }
 }
 
-///// methods needed for FixedPageUI canvases with loading error /////
+///// methods needed for canvases with loading error (or still loading) /////
 
 static void OnPaintError(WindowInfo* win) {
     PAINTSTRUCT ps;
@@ -1440,7 +1664,12 @@ static void OnPaintError(WindowInfo* win) {
     ScopedGdiObj<HBRUSH> bgBrush(CreateSolidBrush(bgCol));
     FillRect(hdc, &ps.rcPaint, bgBrush);
     // TODO: should this be "Error opening %s"?
-    AutoFreeWstr msg(str::Format(_TR("Error loading %s"), win->currentTab->filePath.Get()));
+    const WCHAR* fmt = _TR("Error loading %s");
+    if (win->currentTab->asyncLoad) {
+        // see LoadDocumentAsync
+        fmt = _TR("Loading %s ...");
+    }
+    AutoFreeWstr msg(str::Format(fmt, win->currentTab->filePath.Get()));
     DrawCenteredText(hdc, ClientRect(win->hwndCanvas), msg, IsUIRightToLeft());
     SelectObject(hdc, hPrevFont);
 
@@ -1468,7 +1697,8 @@ static LRESULT WndProcCanvasLoadError(WindowInfo* win, HWND hwnd, UINT msg, WPAR
 void RepaintAsync(WindowInfo* win, int delayInMs) {
     // even though RepaintAsync is mostly called from the UI thread,
     // we depend on the repaint message to happen asynchronously
-    uitask::Post([win, delayInMs] {
+    // (immediate repaints requested in a burst, e.g. for every rendered tile, are done once)
+    auto repaint = [win, delayInMs] {
         if (!WindowInfoStillValid(win)) {
             return;
         }
@@ -1477,6 +1707,51 @@ void RepaintAsync(WindowInfo* win, int delayInMs) {
         } else if (!win->delayedRepaintTimer) {
             win->delayedRepaintTimer = SetTimer(win->hwndCanvas, REPAINT_TIMER_ID, (uint)delayInMs, nullptr);
         }
+    };
+    if (!delayInMs) {
+        uitask::PostCoalesced(win, repaint);
+    } else {
+        uitask::Post(repaint);
+    }
+}
+
+// moves the painted content of the canvas instead of repainting all of it
+// (which is what RepaintAsync does), so that only the uncovered parts have
+// to be painted when scrolling
+void RepaintScrolled(WindowInfo* win, int dx, int dy) {
+    if (0 == dx && 0 == dy) {
+        return;
+    }
+    // the gradient background moves with the viewport and the placeholders
+    // are centered on the visible part of a page
+    bool canScroll = win->AsFixed() && win->canvasPaintComplete && !win->presentation;
+    canScroll = canScroll && gGlobalPrefs->fixedPageUI.gradientColors->size() == 0;
+    canScroll = canScroll && abs(dx) < win->canvasRc.dx && abs(dy) < win->canvasRc.dy;
+    // an update region wouldn't be moved along
+    canScroll = canScroll && !GetUpdateRect(win->hwndCanvas, nullptr, FALSE);
+    if (!canScroll) {
+        RepaintAsync(win, 0);
+        return;
+    }
+    ScrollWindowEx(win->hwndCanvas, -dx, -dy, nullptr, nullptr, nullptr, nullptr, SW_INVALIDATE);
+    UpdateWindow(win->hwndCanvas);
+}
+
+// only invalidates the visible part of a page, e.g. after one of its tiles has been
+// rendered (the canvas is still painted once for a burst of invalidations)
+void RepaintPageAsync(WindowInfo* win, DisplayModel* dm, int pageNo) {
+    uitask::Post([win, dm, pageNo] {
+        // dm might belong to a tab that is no longer shown (or might have been deleted)
+        if (!WindowInfoStillValid(win) || win->AsFixed() != dm) {
+            return;
+        }
+        PageInfo* pageInfo = dm->GetPageInfo(pageNo);
+        if (!pageInfo || !pageInfo->shown || 0.0f == pageInfo->visibleRatio) {
+            return;
+        }
+        Rect screen(Point(), dm->GetViewPort().Size());
+        RECT rc = ToRECT(pageInfo->pageOnScreen.Intersect(screen));
+        InvalidateRect(win->hwndCanvas, &rc, FALSE);
     });
 }
 
@@ -1505,6 +1780,10 @@ static void OnTimer(WindowInfo* win, HWND hwnd, WPARAM timerId) {
             }
             break;
 
+        case SCROLL_ANIMATION_TIMER_ID:
+            StepScrollAnimation(win);
+            break;
+
         case HIDE_CURSOR_TIMER_ID:
             KillTimer(hwnd, HIDE_CURSOR_TIMER_ID);
             if (win->presentation) {
@@ -1540,6 +1819,13 @@ static void OnTimer(WindowInfo* win, HWND hwnd, WPARAM timerId) {
                 }
             }
             break;
+
+        case LINK_PREFETCH_TIMER_ID:
+            KillTimer(hwnd, LINK_PREFETCH_TIMER_ID);
+            if (win->AsFixed() && win->linkPrefetchPageNo > 0) {
+                win->AsFixed()->PrefetchLinkDestination(win->linkPrefetchPageNo);
+            }
+            break;
     }
 }
 
@@ -1563,7 +1849,7 @@ static void OnDropFiles(HDROP hDrop, bool dragFinish) {
             win = CreateAndShowWindowInfo(nullptr);
             args.win = win;
         }
-        LoadDocument(args);
+        LoadDocumentAsync(args);
     }
     if (dragFinish) {
         DragFinish(hDrop);
@@ -7,3 +7,5 @@ LRESULT CALLBACK WndProcCanvas(HWND, UINT, WPARAM, LPARAM);
 LRESULT WndProcCanvasAbout(WindowInfo*, HWND, UINT, WPARAM, LPARAM);
 bool IsDrag(int x1, int x2, int y1, int y2);
 void CancelDrag(WindowInfo*);
+// toggled with CmdDebugTogglePerfHud
+void ShowPerfHud(WindowInfo*, bool show);
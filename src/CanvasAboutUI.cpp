@@ -118,7 +118,7 @@ static void OnMouseLeftButtonUpAbout(WindowInfo* win, int x, int y, WPARAM key)
     } else {
         // assume it's a document
         LoadArgs args(url, win);
-        LoadDocument(args);
+        LoadDocumentAsync(args);
     }
 }
 
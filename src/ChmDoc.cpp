@@ -8,6 +8,7 @@
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/HtmlParserLookup.h"
+#include "utils/HtmlPullParser.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
@@ -270,11 +271,19 @@ void ChmDoc::FixPathCodepage(AutoFree& path, uint& fileCP) {
     }
 }
 
+// CHMLib caches only 5 decompressed LZX blocks by default. Topics and the images
+// and CSS files they reference are often stored in the same blocks, and decoding a
+// block means decoding from the previous reset point, so with such a small cache
+// navigating large CHM files keeps re-decompressing the same data.
+// Blocks are usually 32 KB, so this caches up to ~4 MB per document.
+#define CHM_BLOCKS_CACHED 128
+
 bool ChmDoc::Load(const WCHAR* fileName) {
     chmHandle = chm_open((WCHAR*)fileName);
     if (!chmHandle) {
         return false;
     }
+    chm_set_param(chmHandle, CHM_PARAM_MAX_BLOCKS_CACHED, CHM_BLOCKS_CACHED);
 
     ParseWindowsData();
     if (!ParseSystemData()) {
@@ -350,6 +359,20 @@ Vec<char*>* ChmDoc::GetAllPaths() {
     return paths;
 }
 
+// the <param> attribute value in the document's codepage cp
+static WCHAR* GetChmParamValue(AttrInfo* attr, uint cp) {
+    // decode in the default codepage, so that pre-encoded text and
+    // entities are in the same codepage and yield consistent results
+    AutoFree raw(str::DupN(attr->val, attr->valLen));
+    WCHAR* val = DecodeHtmlEntitites(raw, CP_CHM_DEFAULT);
+    if (cp != CP_CHM_DEFAULT) {
+        AutoFree bytes(strconv::WstrToCodePage(val, CP_CHM_DEFAULT));
+        free(val);
+        val = strconv::FromCodePage(bytes.Get(), cp);
+    }
+    return val;
+}
+
 /* The html looks like:
 <li>
   <object type="text/sitemap">
@@ -361,30 +384,21 @@ Vec<char*>* ChmDoc::GetAllPaths() {
 <li>
   ... siblings ...
 */
-static bool VisitChmTocItem(EbookTocVisitor* visitor, HtmlElement* el, uint cp, int level) {
-    CrashIf(el->tag != Tag_Object || level > 1 && (!el->up || el->up->tag != Tag_Li));
-
-    AutoFreeWstr name, local;
-    for (el = el->GetChildByTag(Tag_Param); el; el = el->next) {
-        if (Tag_Param != el->tag) {
-            continue;
-        }
-        AutoFreeWstr attrName(el->GetAttribute("name"));
-        AutoFreeWstr attrVal(el->GetAttribute("value"));
-        if (attrName && attrVal && cp != CP_CHM_DEFAULT) {
-            AutoFree bytes(strconv::WstrToCodePage(attrVal, CP_CHM_DEFAULT));
-            attrVal.Set(strconv::FromCodePage(bytes.Get(), cp));
-        }
-        if (!attrName || !attrVal) {
-            /* ignore incomplete/unneeded <param> */;
-        } else if (str::EqI(attrName, L"Name")) {
-            name.Set(attrVal.StealData());
+// params are the names and values of the <object>'s <param>s (alternating)
+static bool VisitChmTocItem(EbookTocVisitor* visitor, WStrVec& params, int level) {
+    const WCHAR* name = nullptr;
+    AutoFreeWstr local;
+    for (size_t i = 0; i < params.size(); i += 2) {
+        const WCHAR* attrName = params.at(i);
+        const WCHAR* attrVal = params.at(i + 1);
+        if (str::EqI(attrName, L"Name")) {
+            name = attrVal;
         } else if (str::EqI(attrName, L"Local")) {
             // remove the ITS protocol and any filename references from the URLs
             if (str::Find(attrVal, L"::/")) {
-                attrVal.SetCopy(str::Find(attrVal, L"::/") + 3);
+                attrVal = str::Find(attrVal, L"::/") + 3;
             }
-            local.Set(attrVal.StealData());
+            local.SetCopy(attrVal);
         }
     }
     if (!name) {
@@ -408,38 +422,29 @@ static bool VisitChmTocItem(EbookTocVisitor* visitor, HtmlElement* el, uint cp,
 <li>
   ... siblings ...
 */
-static bool VisitChmIndexItem(EbookTocVisitor* visitor, HtmlElement* el, uint cp, int level) {
-    CrashIf(el->tag != Tag_Object || level > 1 && (!el->up || el->up->tag != Tag_Li));
-
-    WStrVec references;
-    AutoFreeWstr keyword, name;
-    for (el = el->GetChildByTag(Tag_Param); el; el = el->next) {
-        if (Tag_Param != el->tag) {
-            continue;
-        }
-        AutoFreeWstr attrName(el->GetAttribute("name"));
-        AutoFreeWstr attrVal(el->GetAttribute("value"));
-        if (attrName && attrVal && cp != CP_CHM_DEFAULT) {
-            AutoFree bytes(strconv::WstrToCodePage(attrVal, CP_CHM_DEFAULT));
-            attrVal.Set(strconv::FromCodePage(bytes.Get(), cp));
-        }
-        if (!attrName || !attrVal) {
-            /* ignore incomplete/unneeded <param> */;
-        } else if (str::EqI(attrName, L"Keyword")) {
-            keyword.Set(attrVal.StealData());
+static bool VisitChmIndexItem(EbookTocVisitor* visitor, WStrVec& params, int level) {
+    Vec<const WCHAR*> references;
+    const WCHAR* keyword = nullptr;
+    const WCHAR* name = nullptr;
+    for (size_t i = 0; i < params.size(); i += 2) {
+        const WCHAR* attrName = params.at(i);
+        const WCHAR* attrVal = params.at(i + 1);
+        if (str::EqI(attrName, L"Keyword")) {
+            keyword = attrVal;
         } else if (str::EqI(attrName, L"Name")) {
-            name.Set(attrVal.StealData());
+            name = attrVal;
             // some CHM documents seem to use a lonely Name instead of Keyword
             if (!keyword) {
-                keyword.SetCopy(name);
+                keyword = name;
             }
         } else if (str::EqI(attrName, L"Local") && name) {
             // remove the ITS protocol and any filename references from the URLs
             if (str::Find(attrVal, L"::/")) {
-                attrVal.SetCopy(str::Find(attrVal, L"::/") + 3);
+                attrVal = str::Find(attrVal, L"::/") + 3;
             }
-            references.Append(name.StealData());
-            references.Append(attrVal.StealData());
+            references.Append(name);
+            references.Append(attrVal);
+            name = nullptr;
         }
     }
     if (!keyword) {
@@ -457,59 +462,55 @@ static bool VisitChmIndexItem(EbookTocVisitor* visitor, HtmlElement* el, uint cp
     return true;
 }
 
-static void WalkChmTocOrIndex(EbookTocVisitor* visitor, HtmlElement* list, uint cp, bool isIndex, int level = 1) {
-    CrashIf(Tag_Ul != list->tag);
-
-    // some broken ToCs wrap every <li> into its own <ul>
-    for (; list && Tag_Ul == list->tag; list = list->next) {
-        for (HtmlElement* el = list->down; el; el = el->next) {
-            if (Tag_Li != el->tag) {
-                continue; // ignore unexpected elements
-            }
-
-            bool valid;
-            HtmlElement* elObj = el->GetChildByTag(Tag_Object);
-            if (!elObj) {
-                valid = false;
-            } else if (isIndex) {
-                valid = VisitChmIndexItem(visitor, elObj, cp, level);
-            } else {
-                valid = VisitChmTocItem(visitor, elObj, cp, level);
-            }
-            if (!valid) {
-                continue; // skip incomplete elements and all their children
+// visits the items in a single pass without building a DOM (indexes can have
+// tens of thousands of entries). The nesting level is the depth of <ul> lists,
+// which also copes with broken ToCs wrapping every <li> into its own <ul> or
+// having the nested <ul> follow right *after* a <li>. Without any list, all
+// <object type="text/sitemap"> are visited as a linear list.
+static bool WalkChmTocOrIndex(EbookTocVisitor* visitor, const char* html, size_t len, uint cp, bool isIndex) {
+    HtmlPullParser parser(html, len);
+    int listDepth = 0;
+    // incomplete items are skipped together with all their children
+    int skipBelow = INT_MAX;
+    bool inItem = false;
+    bool hadList = false;
+    bool hadItem = false;
+    WStrVec params;
+
+    HtmlToken* tok;
+    while ((tok = parser.Next()) != nullptr && !tok->IsError()) {
+        if (Tag_Ul == tok->tag) {
+            if (tok->IsStartTag()) {
+                listDepth++;
+                hadList = true;
+            } else if (tok->IsEndTag() && listDepth > 0) {
+                listDepth--;
             }
-
-            HtmlElement* nested = el->GetChildByTag(Tag_Ul);
-            // some broken ToCs have the <ul> follow right *after* a <li>
-            if (!nested && el->next && Tag_Ul == el->next->tag) {
-                nested = el->next;
+        } else if (Tag_Object == tok->tag && tok->IsStartTag()) {
+            AttrInfo* type = tok->GetAttrByName("type");
+            inItem = listDepth > 0 || type && type->ValIs("text/sitemap");
+            params.Reset();
+        } else if (Tag_Param == tok->tag && !tok->IsEndTag() && inItem) {
+            AttrInfo* attrName = tok->GetAttrByName("name");
+            AttrInfo* attrVal = attrName ? tok->GetAttrByName("value") : nullptr;
+            if (!attrVal) {
+                continue; // ignore incomplete/unneeded <param>
             }
-            if (nested) {
-                WalkChmTocOrIndex(visitor, nested, cp, isIndex, level + 1);
+            params.Append(GetChmParamValue(attrName, cp));
+            params.Append(GetChmParamValue(attrVal, cp));
+        } else if (Tag_Object == tok->tag && tok->IsEndTag() && inItem) {
+            inItem = false;
+            int level = std::max(listDepth, 1);
+            if (level > skipBelow) {
+                continue;
             }
-        }
-    }
-}
-
-// ignores any <ul><li> list structure and just extracts a linear list of <object type="text/sitemap">...</object>
-static bool WalkBrokenChmTocOrIndex(EbookTocVisitor* visitor, HtmlParser& p, uint cp, bool isIndex) {
-    bool hadOne = false;
-
-    HtmlElement* el = p.FindElementByName("body");
-    while ((el = p.FindElementByName("object", el)) != nullptr) {
-        AutoFreeWstr type(el->GetAttribute("type"));
-        if (!str::EqI(type, L"text/sitemap")) {
-            continue;
-        }
-        if (isIndex) {
-            hadOne |= VisitChmIndexItem(visitor, el, cp, 1);
-        } else {
-            hadOne |= VisitChmTocItem(visitor, el, cp, 1);
+            bool valid = isIndex ? VisitChmIndexItem(visitor, params, level) : VisitChmTocItem(visitor, params, level);
+            skipBelow = valid ? INT_MAX : level;
+            hadItem |= valid;
         }
     }
 
-    return hadOne;
+    return hadList || hadItem;
 }
 
 bool ChmDoc::ParseTocOrIndex(EbookTocVisitor* visitor, const char* path, bool isIndex) {
@@ -521,29 +522,16 @@ bool ChmDoc::ParseTocOrIndex(EbookTocVisitor* visitor, const char* path, bool is
         return false;
     }
     const char* html = htmlData.Get();
+    size_t len = htmlData.size();
 
-    HtmlParser p;
     uint cp = codepage;
     // detect UTF-8 content by BOM
     if (str::StartsWith(html, UTF8_BOM)) {
         html += 3;
+        len -= 3;
         cp = CP_UTF8;
     }
-    // enforce the default codepage, so that pre-encoded text and
-    // entities are in the same codepage and VisitChmTocItem yields
-    // consistent results
-    HtmlElement* el = p.Parse(str::ToSpan(html), CP_CHM_DEFAULT);
-    if (!el) {
-        return false;
-    }
-    el = p.FindElementByName("body");
-    // since <body> is optional, also continue without one
-    el = p.FindElementByName("ul", el);
-    if (!el) {
-        return WalkBrokenChmTocOrIndex(visitor, p, cp, isIndex);
-    }
-    WalkChmTocOrIndex(visitor, el, cp, isIndex);
-    return true;
+    return WalkChmTocOrIndex(visitor, html, len, cp, isIndex);
 }
 
 bool ChmDoc::HasToc() const {
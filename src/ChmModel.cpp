@@ -3,7 +3,10 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/Dict.h"
+#include "utils/HtmlParserLookup.h"
+#include "utils/HtmlPullParser.h"
 #include "utils/HtmlWindow.h"
+#include "utils/ThreadUtil.h"
 #include "utils/UITask.h"
 #include "utils/ScopedWin.h"
 
@@ -84,11 +87,232 @@ struct ChmTocTraceItem {
     int pageNo = 0;
 };
 
+// Full-text search in CHM documents. The topics are indexed in the background
+// from their html: every word maps to the html files containing it, so that
+// a search is a lookup instead of loading and scanning all the topics.
+// The index lives for as long as the document is open.
+struct ChmIndexPosting {
+    int word;
+    int file;
+};
+
+struct ChmIndexWord {
+    const WCHAR* word;
+    // range in ChmIndexThread::postings
+    int first;
+    int count;
+};
+
+class ChmIndexThread : public ThreadBase {
+  public:
+    AutoFreeWstr fileName;
+    WStrList pages;
+    // index of the html file of every page (pages often only differ by their #anchor)
+    Vec<int> pageFiles;
+    int nFiles = 0;
+    // sorted alphabetically
+    Vec<ChmIndexWord> words;
+    // sorted by word, then by file
+    Vec<ChmIndexPosting> postings;
+    LONG finished = 0;
+
+    // for the words' strings
+    PoolAllocator allocator;
+
+    // only needed while indexing
+    dict::MapWStrToInt* wordIds = nullptr;
+    Vec<const WCHAR*> wordsById;
+    // the last file a word was seen in, to only add one posting per file
+    Vec<int> lastFileOfWord;
+
+    ChmIndexThread(const WCHAR* fileName, WStrList& pages);
+    ~ChmIndexThread() override = default;
+
+    void Run() override;
+    void IndexFile(ChmDoc* doc, const WCHAR* url, int fileNo);
+    void AddWords(WCHAR* text, int fileNo);
+    void SortIndex();
+    int FindPage(const WCHAR* text, int startPageNo, bool forward);
+};
+
+ChmIndexThread::ChmIndexThread(const WCHAR* fileName, WStrList& pages) : ThreadBase("ChmIndexThread") {
+    this->fileName.SetCopy(fileName);
+    for (const WCHAR* page : pages) {
+        this->pages.Append(str::Dup(page));
+    }
+}
+
+void ChmIndexThread::Run() {
+    // the index uses its own copy of the document, so that it doesn't have to
+    // contend with the html window for the ChmModel's one
+    ChmDoc* doc = ChmDoc::CreateFromFile(fileName);
+    if (!doc) {
+        return;
+    }
+    dict::MapWStrToInt fileIds(1024);
+    dict::MapWStrToInt ids;
+    wordIds = &ids;
+    for (const WCHAR* page : pages) {
+        if (WasCancelRequested()) {
+            wordIds = nullptr;
+            delete doc;
+            return;
+        }
+        AutoFreeWstr url(url::GetFullPath(page));
+        int fileNo = nFiles;
+        if (fileIds.Insert(url, fileNo, &fileNo)) {
+            IndexFile(doc, url, fileNo);
+            nFiles++;
+        }
+        pageFiles.Append(fileNo);
+    }
+    delete doc;
+    wordIds = nullptr;
+    SortIndex();
+    InterlockedExchange(&finished, 1);
+}
+
+void ChmIndexThread::IndexFile(ChmDoc* doc, const WCHAR* url, int fileNo) {
+    AutoFree urlUtf8(strconv::WstrToUtf8(url));
+    AutoFree data = doc->GetData(urlUtf8.Get());
+    if (data.empty()) {
+        return;
+    }
+    AutoFree html(doc->ToUtf8((u8*)data.Get()));
+    HtmlPullParser parser(html.Get(), str::Len(html.Get()));
+    bool inScriptOrStyle = false;
+    HtmlToken* t;
+    while ((t = parser.Next()) != nullptr && !t->IsError()) {
+        if ((t->IsStartTag() || t->IsEndTag()) && (Tag_Script == t->tag || Tag_Style == t->tag)) {
+            inScriptOrStyle = t->IsStartTag();
+        } else if (t->IsText() && !inScriptOrStyle) {
+            AutoFree text(ResolveHtmlEntities(t->s, t->sLen));
+            AutoFreeWstr ws(strconv::Utf8ToWstr(text.Get()));
+            AddWords(ws, fileNo);
+        }
+    }
+}
+
+// words are case-insensitive runs of letters and digits
+static WCHAR* NextWord(WCHAR*& s) {
+    while (*s && !IsCharAlphaNumericW(*s)) {
+        s++;
+    }
+    if (!*s) {
+        return nullptr;
+    }
+    WCHAR* word = s;
+    while (*s && IsCharAlphaNumericW(*s)) {
+        s++;
+    }
+    if (*s) {
+        *s++ = 0;
+    }
+    return word;
+}
+
+void ChmIndexThread::AddWords(WCHAR* text, int fileNo) {
+    CharLowerBuffW(text, (DWORD)str::Len(text));
+    WCHAR* s = text;
+    WCHAR* word;
+    while ((word = NextWord(s)) != nullptr) {
+        int wordNo = (int)wordsById.size();
+        if (wordIds->Insert(word, wordNo, &wordNo)) {
+            wordsById.Append(Allocator::StrDup(&allocator, word));
+            lastFileOfWord.Append(-1);
+        }
+        if (lastFileOfWord.at(wordNo) != fileNo) {
+            lastFileOfWord.at(wordNo) = fileNo;
+            postings.Append({wordNo, fileNo});
+        }
+    }
+}
+
+void ChmIndexThread::SortIndex() {
+    int nWords = (int)wordsById.size();
+    for (int i = 0; i < nWords; i++) {
+        words.Append({wordsById.at(i), i, 0});
+    }
+    std::sort(words.begin(), words.end(),
+              [](const ChmIndexWord& a, const ChmIndexWord& b) { return wcscmp(a.word, b.word) < 0; });
+    // re-number words in alphabetical order
+    Vec<int> wordRank;
+    wordRank.AppendBlanks(nWords);
+    for (int i = 0; i < nWords; i++) {
+        wordRank.at(words.at(i).first) = i;
+    }
+    for (ChmIndexPosting& p : postings) {
+        p.word = wordRank.at(p.word);
+    }
+    std::sort(postings.begin(), postings.end(), [](const ChmIndexPosting& a, const ChmIndexPosting& b) {
+        return a.word < b.word || a.word == b.word && a.file < b.file;
+    });
+    for (ChmIndexWord& w : words) {
+        w.first = 0;
+    }
+    for (size_t i = postings.size(); i > 0; i--) {
+        ChmIndexWord& w = words.at(postings.at(i - 1).word);
+        w.first = (int)i - 1;
+        w.count++;
+    }
+    wordsById.Reset();
+    lastFileOfWord.Reset();
+}
+
+// returns the number of the first page after startPageNo (in the given direction
+// and wrapping around) whose topic contains all words of text (as words or
+// as the beginning of words) or 0 if there's no such page
+int ChmIndexThread::FindPage(const WCHAR* text, int startPageNo, bool forward) {
+    if (nFiles == 0) {
+        return 0;
+    }
+    AutoFreeWstr query(str::Dup(text));
+    CharLowerBuffW(query, (DWORD)str::Len(query));
+
+    // for every file, how many query words it contains so far
+    Vec<int> fileMatches;
+    fileMatches.AppendBlanks(nFiles);
+    int nQueryWords = 0;
+    WCHAR* s = query;
+    WCHAR* prefix;
+    while ((prefix = NextWord(s)) != nullptr) {
+        auto it = std::lower_bound(words.begin(), words.end(), prefix,
+                                   [](const ChmIndexWord& w, const WCHAR* s) { return wcscmp(w.word, s) < 0; });
+        for (; it != words.end() && str::StartsWith(it->word, prefix); it++) {
+            for (int i = it->first; i < it->first + it->count; i++) {
+                int& matches = fileMatches.at(postings.at(i).file);
+                if (matches == nQueryWords) {
+                    matches++;
+                }
+            }
+        }
+        nQueryWords++;
+    }
+    if (nQueryWords == 0) {
+        return 0;
+    }
+
+    int nPages = (int)pageFiles.size();
+    int pageIdx = startPageNo - 1;
+    for (int i = 0; i < nPages; i++) {
+        pageIdx = (pageIdx + (forward ? 1 : nPages - 1)) % nPages;
+        if (fileMatches.at(pageFiles.at(pageIdx)) == nQueryWords) {
+            return pageIdx + 1;
+        }
+    }
+    return 0;
+}
+
 ChmModel::ChmModel(ControllerCallback* cb) : Controller(cb) {
     InitializeCriticalSection(&docAccess);
 }
 
 ChmModel::~ChmModel() {
+    if (indexThread) {
+        indexThread->RequestCancel();
+        indexThread->Join();
+        delete indexThread;
+    }
     EnterCriticalSection(&docAccess);
     // TODO: deleting htmlWindow seems to spin a modal loop which
     //       can lead to WM_PAINT being dispatched for the parent
@@ -369,7 +593,24 @@ bool ChmModel::Load(const WCHAR* fileName) {
     ChmTocBuilder tmpTocBuilder(doc, &pages, tocTrace, &poolAlloc);
     doc->ParseToc(&tmpTocBuilder);
     CrashIf(pages.size() == 0);
-    return pages.size() > 0;
+    if (pages.size() == 0) {
+        return false;
+    }
+
+    indexThread = new ChmIndexThread(fileName, pages);
+    indexThread->Start();
+    return true;
+}
+
+bool ChmModel::IsSearchIndexReady() {
+    return indexThread && InterlockedAdd(&indexThread->finished, 0) != 0;
+}
+
+int ChmModel::FindPageWithText(const WCHAR* text, int startPageNo, bool forward) {
+    if (!IsSearchIndexReady()) {
+        return 0;
+    }
+    return indexThread->FindPage(text, startPageNo, forward);
 }
 
 struct ChmCacheEntry {
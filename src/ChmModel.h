@@ -6,6 +6,7 @@ struct ChmTocTraceItem;
 class HtmlWindow;
 class HtmlWindowCallback;
 struct ChmCacheEntry;
+class ChmIndexThread;
 
 struct ChmModel : Controller {
     explicit ChmModel(ControllerCallback* cb);
@@ -57,6 +58,11 @@ struct ChmModel : Controller {
     void CopySelection();
     LRESULT PassUIMsg(UINT msg, WPARAM wp, LPARAM lp);
 
+    // full-text search through the index built in the background after loading
+    bool IsSearchIndexReady();
+    // returns 0 if no page contains text (or if the index isn't ready yet)
+    int FindPageWithText(const WCHAR* text, int startPageNo, bool forward);
+
     // for HtmlWindowCallback (called through htmlWindowCb)
     bool OnBeforeNavigate(const WCHAR* url, bool newWindow);
     void OnDocumentComplete(const WCHAR* url);
@@ -77,6 +83,7 @@ struct ChmModel : Controller {
     HtmlWindow* htmlWindow = nullptr;
     HtmlWindowCallback* htmlWindowCb = nullptr;
     float initZoom = INVALID_ZOOM;
+    ChmIndexThread* indexThread = nullptr;
 
     Vec<ChmCacheEntry*> urlDataCache;
     // use a pool allocator for strings that aren't freed until this ChmModel
@@ -28,6 +28,7 @@ Cmd* enum (e.g. CmdOpen) and a human-readable name (not used yet).
     V(CmdViewRotateLeft, "View: Rotate Left")                             \
     V(CmdViewRotateRight, "View: Rotate Right")                           \
     V(CmdViewBookmarks, "View: Bookmarks")                                \
+    V(CmdViewThumbnails, "View: Thumbnails")                              \
     V(CmdViewFullScreen, "View: FullScreen")                              \
     V(CmdViewPresentationMode, "View: Presentation Mode")                 \
     V(CmdViewShowHideToolbar, "View: Toogle Toolbar")                     \
@@ -53,6 +54,9 @@ Cmd* enum (e.g. CmdOpen) and a human-readable name (not used yet).
     V(CmdFindMatch, "Find: Match Case")                                   \
     V(CmdFindNextSel, "Find: Next Selection")                             \
     V(CmdFindPrevSel, "Find: Previous Selection")                         \
+    V(CmdFindAll, "Find: All")                                            \
+    V(CmdFindInOpenDocuments, "Find: In All Open Documents")              \
+    V(CmdFindInFolder, "Find: In Folder")                                 \
     V(CmdSaveAnnotations, "Save Annotations")                             \
     V(CmdEditAnnotations, "Edit Annotations")                             \
     V(CmdZoomFitPage, "Zoom: Fit Page")                                   \
@@ -121,6 +125,10 @@ Cmd* enum (e.g. CmdOpen) and a human-readable name (not used yet).
     V(CmdDebugTestApp, "Debug: Test App")                                 \
     V(CmdDebugShowNotif, "Debug: Show Notification")                      \
     V(CmdDebugMui, "Debug: Mui")                                          \
+    V(CmdDebugRenderStats, "Debug: Show Render Queue Stats")              \
+    V(CmdDebugTogglePerfHud, "Debug: Toggle Performance HUD")             \
+    V(CmdDebugShowMemory, "Debug: Show Memory Usage")                     \
+    V(CmdDebugAllocSamples, "Debug: Write Allocation Samples")            \
     V(CmdNewBookmarks, "New Bookmarks")                                   \
     V(CmdCreateAnnotText, "Create Text Annotation")                       \
     V(CmdCreateAnnotLink, "Create Link Annotation")                       \
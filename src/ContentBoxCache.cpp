@@ -0,0 +1,262 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/WinUtil.h"
+#include "utils/Log.h"
+
+#include "wingui/TreeModel.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "EnginePdf.h"
+#include "DisplayMode.h"
+#include "SettingsStructs.h"
+#include "GlobalPrefs.h"
+
+#include "AppTools.h"
+#include "ContentBoxCache.h"
+
+#define CONTENT_BOXES_DIR_NAME L"sumatrapdfcbox"
+
+// must be changed whenever the file format changes
+#define CONTENT_BOXES_MAGIC 0x31425853 // 'SXB1'
+
+// content boxes are tiny compared to tiles and text, so a number of files is kept instead of a size
+#define MAX_CONTENT_BOXES_FILES 256
+
+// pages are handed to background tasks in batches of this many
+#define CONTENT_BOXES_PER_TASK 32
+
+// a content boxes file consists of this header and a DiskContentBox for every page
+struct DiskContentBoxesHeader {
+    u32 magic;
+    i32 nPages;
+    // digest of DisplayModel::docId, so that outdated boxes are ignored
+    u8 docDigest[16];
+};
+
+struct DiskContentBox {
+    float x, y, dx, dy;
+    // 0 if the box of the page hasn't been computed
+    u32 known;
+};
+
+ContentBoxCache::ContentBoxCache(EngineBase* engine) {
+    this->engine = engine;
+    nPages = engine->PageCount();
+    boxes = AllocArray<RectF>(nPages);
+    known = AllocArray<bool>(nPages);
+}
+
+ContentBoxCache::~ContentBoxCache() {
+    tasks.RequestCancel();
+    tasks.Join();
+    free(boxes);
+    free(known);
+}
+
+bool ContentBoxCache::Lookup(int pageNo, RectF& box) {
+    ScopedCritSec scope(&access.cs);
+    if (!known[pageNo - 1]) {
+        return false;
+    }
+    box = boxes[pageNo - 1];
+    return true;
+}
+
+void ContentBoxCache::Store(int pageNo, RectF box) {
+    ScopedCritSec scope(&access.cs);
+    boxes[pageNo - 1] = box;
+    known[pageNo - 1] = true;
+    changed = true;
+}
+
+RectF ContentBoxCache::Get(int pageNo) {
+    CrashIf(pageNo < 1 || pageNo > nPages);
+    RectF box;
+    if (Lookup(pageNo, box)) {
+        return box;
+    }
+    // a background task might be computing the same box, which is harmless
+    box = engine->PageContentBox(pageNo);
+    Store(pageNo, box);
+    return box;
+}
+
+void ContentBoxCache::ComputeAllInBackground() {
+    if (computingAll) {
+        return;
+    }
+    computingAll = true;
+    for (int first = 1; first <= nPages; first += CONTENT_BOXES_PER_TASK) {
+        int last = std::min(first + CONTENT_BOXES_PER_TASK - 1, nPages);
+        tasks.Run(
+            [this, first, last] {
+                for (int pageNo = first; pageNo <= last && !tasks.WasCancelRequested(); pageNo++) {
+                    RectF box;
+                    if (!Lookup(pageNo, box)) {
+                        Store(pageNo, engine->PageContentBox(pageNo));
+                    }
+                }
+            },
+            TaskPriority::Low);
+    }
+}
+
+// paths (and document ids) are compared case-insensitively
+static bool CalcLowerDigest(const WCHAR* s, u8 digest[16]) {
+    AutoFree sU(strconv::WstrToUtf8(s));
+    if (!sU.Get()) {
+        return false;
+    }
+    str::ToLowerInPlace(sU.Get());
+    CalcFastDigest(sU.Get(), str::Len(sU.Get()), digest);
+    return true;
+}
+
+static WCHAR* GetContentBoxesPathForFile(const WCHAR* filePath) {
+    AutoFreeWstr boxesPath(AppGenDataFilename(CONTENT_BOXES_DIR_NAME));
+    u8 digest[16];
+    if (!boxesPath || !CalcLowerDigest(filePath, digest)) {
+        return nullptr;
+    }
+    AutoFree fingerPrint(_MemToHex(&digest));
+    AutoFreeWstr name(strconv::FromAnsi(fingerPrint.Get()));
+    return str::Format(L"%s\\%s.cbox", boxesPath.Get(), name.Get());
+}
+
+static WCHAR* GetContentBoxesPath(EngineBase* engine, const WCHAR* docId) {
+    // like thumbnails, boxes are only kept for documents in the file history
+    if (!gGlobalPrefs->rememberOpenedFiles) {
+        return nullptr;
+    }
+    // only documents identical to the file on disk can be identified
+    if (!docId || EnginePdfHasUnsavedAnnotations(engine)) {
+        return nullptr;
+    }
+    return GetContentBoxesPathForFile(engine->FileName());
+}
+
+void ContentBoxCache::Load(const WCHAR* docId) {
+    AutoFreeWstr path(GetContentBoxesPath(engine, docId));
+    u8 docDigest[16];
+    if (!path || !file::Exists(path) || !CalcLowerDigest(docId, docDigest)) {
+        return;
+    }
+    AutoFree data = file::ReadFile(path);
+    size_t expectedSize = sizeof(DiskContentBoxesHeader) + (size_t)nPages * sizeof(DiskContentBox);
+    DiskContentBoxesHeader* hdr = (DiskContentBoxesHeader*)data.Get();
+    if (data.size() != expectedSize || hdr->magic != CONTENT_BOXES_MAGIC || hdr->nPages != nPages ||
+        memcmp(hdr->docDigest, docDigest, 16) != 0) {
+        logf(L"ContentBoxCache::Load: removing outdated '%s'\n", path.Get());
+        file::Delete(path);
+        return;
+    }
+
+    // CleanUpDiskContentBoxes removes the files which haven't been used for the longest time
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    file::SetModificationTime(path, now);
+
+    DiskContentBox* diskBoxes = (DiskContentBox*)(data.Get() + sizeof(DiskContentBoxesHeader));
+    ScopedCritSec scope(&access.cs);
+    for (int i = 0; i < nPages; i++) {
+        DiskContentBox& box = diskBoxes[i];
+        if (box.known) {
+            boxes[i] = RectF(box.x, box.y, box.dx, box.dy);
+            known[i] = true;
+        }
+    }
+}
+
+void ContentBoxCache::Save(const WCHAR* docId) {
+    AutoFreeWstr path(GetContentBoxesPath(engine, docId));
+    u8 docDigest[16];
+    if (!path || !CalcLowerDigest(docId, docDigest)) {
+        return;
+    }
+
+    str::Str data;
+    {
+        ScopedCritSec scope(&access.cs);
+        if (!changed) {
+            return;
+        }
+        DiskContentBoxesHeader hdr;
+        hdr.magic = CONTENT_BOXES_MAGIC;
+        hdr.nPages = nPages;
+        memcpy(hdr.docDigest, docDigest, 16);
+        data.Append((char*)&hdr, sizeof(hdr));
+        for (int i = 0; i < nPages; i++) {
+            DiskContentBox box{(float)boxes[i].x, (float)boxes[i].y, (float)boxes[i].dx, (float)boxes[i].dy,
+                               known[i] ? 1u : 0u};
+            data.Append((char*)&box, sizeof(box));
+        }
+        changed = false;
+    }
+
+    AutoFreeWstr boxesPath(path::GetDir(path));
+    if (dir::Create(boxesPath)) {
+        file::WriteFile(path, data.AsSpan());
+    }
+}
+
+struct DiskContentBoxesInfo {
+    WCHAR* name = nullptr;
+    FILETIME lastUsed = {0};
+};
+
+void CleanUpDiskContentBoxes() {
+    AutoFreeWstr boxesPath(AppGenDataFilename(CONTENT_BOXES_DIR_NAME));
+    if (!boxesPath) {
+        return;
+    }
+
+    Vec<DiskContentBoxesInfo> files;
+    AutoFreeWstr filePattern(path::Join(boxesPath, L"*.cbox"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(filePattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            DiskContentBoxesInfo info;
+            info.name = str::Dup(fdata.cFileName);
+            info.lastUsed = fdata.ftLastWriteTime;
+            files.Append(info);
+        }
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    // keep the most recently used files
+    std::sort(files.begin(), files.end(), [](const DiskContentBoxesInfo& a, const DiskContentBoxesInfo& b) {
+        return CompareFileTime(&a.lastUsed, &b.lastUsed) > 0;
+    });
+    for (size_t i = 0; i < files.size(); i++) {
+        if (i >= MAX_CONTENT_BOXES_FILES) {
+            AutoFreeWstr path(path::Join(boxesPath, files.at(i).name));
+            file::Delete(path);
+        }
+        free(files.at(i).name);
+    }
+}
+
+void RemoveDiskContentBoxes(const WCHAR* filePath) {
+    if (!filePath) {
+        AutoFreeWstr boxesPath(AppGenDataFilename(CONTENT_BOXES_DIR_NAME));
+        if (boxesPath) {
+            dir::RemoveAll(boxesPath);
+        }
+        return;
+    }
+    AutoFreeWstr path(GetContentBoxesPathForFile(filePath));
+    if (path) {
+        file::Delete(path);
+    }
+}
@@ -0,0 +1,42 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// caches the content boxes of a document's pages (as needed for ZOOM_FIT_CONTENT).
+// Computing a box requires running a page through a bbox device (or rendering it),
+// so boxes are computed on demand for the visible pages, in the background
+// for the others and kept on disk for documents in the file history
+
+struct ContentBoxCache {
+    explicit ContentBoxCache(EngineBase* engine);
+    // cancels computing boxes in the background and waits for it to stop
+    ~ContentBoxCache();
+
+    // computes the box on the calling thread, if it isn't known yet
+    RectF Get(int pageNo);
+    // starts computing the boxes of all pages not known yet (once)
+    void ComputeAllInBackground();
+
+    // docId as returned by CalcDocumentId
+    void Load(const WCHAR* docId);
+    // stores the boxes if any had to be computed
+    void Save(const WCHAR* docId);
+
+  private:
+    EngineBase* engine = nullptr;
+    int nPages = 0;
+    // guards boxes, known and changed
+    Mutex access;
+    RectF* boxes = nullptr;
+    bool* known = nullptr;
+    bool changed = false;
+    bool computingAll = false;
+    TaskGroup tasks;
+
+    bool Lookup(int pageNo, RectF& box);
+    void Store(int pageNo, RectF box);
+};
+
+// removes the least recently used content boxes beyond a fixed number of documents
+void CleanUpDiskContentBoxes();
+// removes the content boxes of a document (or of all documents, if filePath is nullptr)
+void RemoveDiskContentBoxes(const WCHAR* filePath);
@@ -20,8 +20,16 @@ struct ControllerCallback {
     virtual void GotoLink(PageDestination* dest) = 0;
     // DisplayModel //
     virtual void Repaint() = 0;
+    // like Repaint but the view has only been scrolled by (dx, dy) since
+    // (so that the already painted content can be moved instead)
+    virtual void RepaintScrolled(int dx, int dy) = 0;
+    // like Repaint but only the part of the view showing pageNo of dm has changed
+    virtual void RepaintPage(DisplayModel* dm, int pageNo) = 0;
     virtual void UpdateScrollbars(Size canvas) = 0;
     virtual void RequestRendering(int pageNo) = 0;
+    // like RequestRendering but only done if there's nothing else to render
+    virtual void RequestPrefetch(int pageNo) = 0;
+    virtual void CancelPrefetch(DisplayModel* dm) = 0;
     virtual void CleanUp(DisplayModel* dm) = 0;
     virtual void RenderThumbnail(DisplayModel* dm, Size size, const onBitmapRenderedCb&) = 0;
     // ChmModel //
@@ -67,7 +75,7 @@ struct Controller {
     virtual void SetViewPortSize(Size size) = 0;
 
     // table of contents
-    bool HacToc() {
+    virtual bool HacToc() {
         auto* tree = GetToc();
         return tree != nullptr;
     }
@@ -13,6 +13,7 @@
 #include "utils/FileUtil.h"
 #include "utils/HttpUtil.h"
 #include "utils/LzmaSimpleArchive.h"
+#include "utils/SlowOps.h"
 #include "utils/WinUtil.h"
 #include "utils/LogDbg.h"
 #include "utils/Log.h"
@@ -113,10 +114,18 @@ static std::span<u8> BuildCrashInfoText() {
     dbghelp::GetExceptionInfo(s, gMei.ExceptionPointers);
     dbghelp::GetAllThreadsCallstacks(s);
     s.Append("\n");
-    s.Append(gModulesInfo);
+    if (gModulesInfo) {
+        s.Append(gModulesInfo);
+    }
+
+    s.Append("\n\n-------- Slow operations -----\n\n");
+    GetSlowOpJournal(s);
 
     s.Append("\n\n-------- Log -----------------\n\n");
-    s.AppendView(gLogBuf->AsView());
+    FlushLog();
+    if (gLogBuf) {
+        s.AppendView(gLogBuf->AsView());
+    }
 
     if (gSettingsFile) {
         s.Append("\n\n----- Settings file ----------\n\n");
@@ -668,30 +677,14 @@ void InstallCrashHandler(const WCHAR* crashDumpPath, const WCHAR* crashFilePath,
     gCrashDumpPath = str::Dup(crashDumpPath);
     gCrashFilePath = str::Dup(crashFilePath);
 
-    // don't bother sending crash reports when running under Wine
-    // as they're not helpful
-    bool isWine = BuildModulesInfo();
-    if (isWine) {
-        dbglog("InstallCrashHandler: skipping because isWine\n");
-        return;
-    }
-
     isDllBuild = IsDllBuild();
 
-    BuildSystemInfo();
-    // at this point list of modules should be complete (except
-    // dbghlp.dll which shouldn't be loaded yet)
-
     // we pre-allocate as much as possible to minimize allocations
     // when crash handler is invoked. It's ok to use standard
     // allocation functions here.
     gCrashHandlerAllocator = new HeapAllocator();
     gSymbolsUrl = BuildSymbolsUrl();
 
-    AutoFreeWstr path = prefs::GetSettingsPath();
-    // can be empty on first run but that's fine because then we know it has default values
-    gSettingsFile = (char*)file::ReadFile(path).data();
-
     gDumpEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
     if (!gDumpEvent) {
         dbglog("InstallCrashHandler: skipping because !gDumpEvent\n");
@@ -711,6 +704,31 @@ void InstallCrashHandler(const WCHAR* crashDumpPath, const WCHAR* crashFilePath,
 #endif
 }
 
+// collecting the list of loaded modules, the system information and the settings
+// for crash reports takes a while, so it's done once the first window is shown
+// (a crash before that results in a report without them)
+void FinishCrashHandlerSetup() {
+    if (!gDumpEvent || !gDumpThread || gModulesInfo) {
+        return;
+    }
+
+    // don't bother sending crash reports when running under Wine
+    // as they're not helpful
+    bool isWine = BuildModulesInfo();
+    if (isWine) {
+        dbglog("FinishCrashHandlerSetup: disabling crash handler because isWine\n");
+        SetUnhandledExceptionFilter(gPrevExceptionFilter);
+        gPrevExceptionFilter = nullptr;
+        return;
+    }
+
+    BuildSystemInfo();
+
+    AutoFreeWstr path = prefs::GetSettingsPath();
+    // can be empty on first run but that's fine because then we know it has default values
+    gSettingsFile = (char*)file::ReadFile(path).data();
+}
+
 void UninstallCrashHandler() {
     if (!gDumpEvent || !gDumpThread) {
         return;
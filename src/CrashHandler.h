@@ -4,6 +4,7 @@
 extern WCHAR* gCrashFilePath;
 
 void InstallCrashHandler(const WCHAR* crashDumpPath, const WCHAR* crashFilePath, const WCHAR* symDir);
+void FinishCrashHandlerSetup();
 void SubmitCrashInfo();
 void UninstallCrashHandler();
 bool CrashHandlerDownloadSymbols();
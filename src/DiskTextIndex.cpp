@@ -0,0 +1,382 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/WinUtil.h"
+#include "utils/Log.h"
+
+#include "wingui/TreeModel.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "EnginePdf.h"
+#include "DisplayMode.h"
+#include "SettingsStructs.h"
+#include "Controller.h"
+#include "DisplayModel.h"
+#include "GlobalPrefs.h"
+#include "TextSelection.h"
+
+#include "AppTools.h"
+#include "DiskTextIndex.h"
+
+#define DISK_TEXT_INDEX_DIR_NAME L"sumatrapdftext"
+
+// must be changed whenever the file format changes
+#define DISK_TEXT_INDEX_MAGIC 0x31495453 // 'STI1'
+
+// an index file consists of this header, a DiskTextIndexPage for every page
+// and for every stored page its len UTF-16 characters followed by len glyph boxes
+struct DiskTextIndexHeader {
+    u32 magic;
+    i32 nPages;
+    // digest of DisplayModel::docId, so that outdated indexes are ignored
+    u8 docDigest[16];
+};
+
+struct DiskTextIndexPage {
+    u32 offset;
+    // -1 if the text of the page isn't stored
+    i32 len;
+};
+
+// glyph boxes are quantized to 16 bits per coordinate
+// (page coordinates beyond that range are clamped)
+struct DiskTextIndexBox {
+    i16 x, y, dx, dy;
+};
+
+static_assert(sizeof(DiskTextIndexHeader) % 4 == 0 && sizeof(DiskTextIndexPage) % 4 == 0,
+              "index entries must keep the text aligned");
+
+static i64 gMaxBytes = 0;
+// number of bytes written since the last clean up
+static LONG64 gBytesWritten = 0;
+
+void SetDiskTextIndexSizeMB(int sizeMB) {
+    gMaxBytes = sizeMB > 0 ? (i64)sizeMB * 1024 * 1024 : 0;
+}
+
+// paths (and document ids) are compared case-insensitively
+static bool CalcLowerDigest(const WCHAR* s, u8 digest[16]) {
+    AutoFree sU(strconv::WstrToUtf8(s));
+    if (!sU.Get()) {
+        return false;
+    }
+    str::ToLowerInPlace(sU.Get());
+    CalcFastDigest(sU.Get(), str::Len(sU.Get()), digest);
+    return true;
+}
+
+// indexes are named by the digest of the document's path, so that
+// an outdated index is replaced once the document has changed
+static WCHAR* GetIndexPathForFile(const WCHAR* filePath) {
+    AutoFreeWstr indexesPath(AppGenDataFilename(DISK_TEXT_INDEX_DIR_NAME));
+    u8 digest[16];
+    if (!indexesPath || !CalcLowerDigest(filePath, digest)) {
+        return nullptr;
+    }
+    AutoFree fingerPrint(_MemToHex(&digest));
+    AutoFreeWstr name(strconv::FromAnsi(fingerPrint.Get()));
+    return str::Format(L"%s\\%s.txtidx", indexesPath.Get(), name.Get());
+}
+
+static WCHAR* GetIndexPath(DocumentTextCache* cache, const WCHAR* docId) {
+    // like thumbnails, text is only kept for documents in the file history
+    if (gMaxBytes <= 0 || !gGlobalPrefs->rememberOpenedFiles || !cache) {
+        return nullptr;
+    }
+    // only documents identical to the file on disk can be identified
+    // (DisplayModel::docId also includes the file's size and modification time)
+    EngineBase* engine = cache->engine;
+    if (!docId || EnginePdfHasUnsavedAnnotations(engine)) {
+        return nullptr;
+    }
+    // don't leave the text of encrypted documents lying around unencrypted
+    if (engine->IsPasswordProtected()) {
+        return nullptr;
+    }
+    return GetIndexPathForFile(engine->FileName());
+}
+
+// the text of pages in a memory-mapped index file, decoded when
+// DocumentTextCache first needs it
+struct MappedTextIndex : PageTextStore {
+    HANDLE hFile{INVALID_HANDLE_VALUE};
+    HANDLE hMap{nullptr};
+    const u8* data{nullptr};
+    size_t size{0};
+    int nPages{0};
+
+    ~MappedTextIndex() override;
+    bool HasPageText(int pageNo) override;
+    bool GetPageText(int pageNo, PageText& pageText) override;
+
+    const DiskTextIndexPage* GetPage(int pageNo) const;
+};
+
+MappedTextIndex::~MappedTextIndex() {
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (hMap) {
+        CloseHandle(hMap);
+    }
+    if (hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(hFile);
+    }
+}
+
+const DiskTextIndexPage* MappedTextIndex::GetPage(int pageNo) const {
+    CrashIf(pageNo < 1 || pageNo > nPages);
+    const DiskTextIndexPage* pages = (const DiskTextIndexPage*)(data + sizeof(DiskTextIndexHeader));
+    return &pages[pageNo - 1];
+}
+
+bool MappedTextIndex::HasPageText(int pageNo) {
+    return GetPage(pageNo)->len >= 0;
+}
+
+bool MappedTextIndex::GetPageText(int pageNo, PageText& pageText) {
+    const DiskTextIndexPage* page = GetPage(pageNo);
+    if (page->len < 0) {
+        return false;
+    }
+    int len = page->len;
+    const WCHAR* text = (const WCHAR*)(data + page->offset);
+    const DiskTextIndexBox* boxes = (const DiskTextIndexBox*)(text + len);
+
+    pageText.text = str::DupN(text, len);
+    pageText.coords = AllocArray<Rect>(len + 1);
+    pageText.len = len;
+    if (!pageText.text || !pageText.coords) {
+        FreePageText(&pageText);
+        return false;
+    }
+    for (int i = 0; i < len; i++) {
+        const DiskTextIndexBox& box = boxes[i];
+        pageText.coords[i] = Rect(box.x, box.y, box.dx, box.dy);
+    }
+    return true;
+}
+
+// returns false if the index doesn't match the document or is corrupted
+static bool IsValidIndex(MappedTextIndex* index, const u8 docDigest[16]) {
+    if (index->size < sizeof(DiskTextIndexHeader)) {
+        return false;
+    }
+    DiskTextIndexHeader* hdr = (DiskTextIndexHeader*)index->data;
+    if (hdr->magic != DISK_TEXT_INDEX_MAGIC || memcmp(hdr->docDigest, docDigest, 16) != 0) {
+        return false;
+    }
+    if (hdr->nPages != index->nPages ||
+        index->size < sizeof(DiskTextIndexHeader) + (size_t)index->nPages * sizeof(DiskTextIndexPage)) {
+        return false;
+    }
+    for (int pageNo = 1; pageNo <= index->nPages; pageNo++) {
+        const DiskTextIndexPage* page = index->GetPage(pageNo);
+        if (page->len < 0) {
+            continue;
+        }
+        size_t pageSize = (size_t)page->len * (sizeof(WCHAR) + sizeof(DiskTextIndexBox));
+        if (page->offset % sizeof(WCHAR) != 0 || page->offset > index->size || pageSize > index->size - page->offset) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static MappedTextIndex* MapTextIndex(const WCHAR* path) {
+    MappedTextIndex* index = new MappedTextIndex();
+    index->hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (INVALID_HANDLE_VALUE == index->hFile) {
+        delete index;
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(index->hFile, &size) || size.QuadPart <= 0 || (u64)size.QuadPart > (u64)UINT32_MAX) {
+        delete index;
+        return nullptr;
+    }
+    index->size = (size_t)size.QuadPart;
+    index->hMap = CreateFileMappingW(index->hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (index->hMap) {
+        index->data = (const u8*)MapViewOfFile(index->hMap, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!index->data) {
+        delete index;
+        return nullptr;
+    }
+    return index;
+}
+
+void LoadDiskTextIndex(DocumentTextCache* cache, const WCHAR* docId) {
+    AutoFreeWstr path(GetIndexPath(cache, docId));
+    u8 docDigest[16];
+    if (!path || !file::Exists(path) || !CalcLowerDigest(docId, docDigest)) {
+        return;
+    }
+
+    // CleanUpDiskTextIndexes removes the indexes which haven't been used for the longest time
+    // (this has to happen before mapping the file, as that prevents writing to it)
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    file::SetModificationTime(path, now);
+
+    MappedTextIndex* index = MapTextIndex(path);
+    if (!index) {
+        return;
+    }
+    index->nPages = cache->nPages;
+    if (!IsValidIndex(index, docDigest)) {
+        logf(L"LoadDiskTextIndex: removing outdated '%s'\n", path.Get());
+        delete index;
+        file::Delete(path);
+        return;
+    }
+    cache->SetStore(index);
+}
+
+void LoadDiskTextIndex(DisplayModel* dm) {
+    LoadDiskTextIndex(dm->textCache, dm->docId);
+}
+
+static i16 QuantizeCoord(int c) {
+    return (i16)limitValue(c, (int)INT16_MIN, (int)INT16_MAX);
+}
+
+void SaveDiskTextIndex(DocumentTextCache* cache, const WCHAR* docId) {
+    if (!cache || 0 == cache->nPagesExtracted) {
+        return;
+    }
+    AutoFreeWstr path(GetIndexPath(cache, docId));
+    u8 docDigest[16];
+    if (!path || !CalcLowerDigest(docId, docDigest)) {
+        return;
+    }
+    // the text of the pages being extracted isn't complete yet
+    cache->StopExtractingInBackground();
+    cache->StopPrefetching();
+
+    int nPages = cache->nPages;
+    DiskTextIndexHeader hdr;
+    hdr.magic = DISK_TEXT_INDEX_MAGIC;
+    hdr.nPages = nPages;
+    memcpy(hdr.docDigest, docDigest, sizeof(hdr.docDigest));
+
+    str::Str indexData;
+    indexData.Append((u8*)&hdr, sizeof(hdr));
+    size_t pagesOffset = indexData.size();
+    for (int i = 0; i < nPages; i++) {
+        DiskTextIndexPage page{0, -1};
+        indexData.Append((u8*)&page, sizeof(page));
+    }
+
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        // pages that are neither cached nor stored would have to be extracted first
+        bool isStored = cache->store && cache->store->HasPageText(pageNo);
+        if (!cache->HasTextForPage(pageNo) && !isStored) {
+            continue;
+        }
+        int len = 0;
+        const GlyphCoords* coords = nullptr;
+        const WCHAR* text = cache->GetTextForPage(pageNo, &len, &coords);
+        if (indexData.size() + (size_t)len * (sizeof(WCHAR) + sizeof(DiskTextIndexBox)) > UINT32_MAX) {
+            break;
+        }
+
+        DiskTextIndexPage page;
+        page.offset = (u32)indexData.size();
+        page.len = len;
+        memcpy(indexData.Get() + pagesOffset + (pageNo - 1) * sizeof(page), &page, sizeof(page));
+
+        indexData.Append((const u8*)text, len * sizeof(WCHAR));
+        for (int i = 0; i < len; i++) {
+            Rect r = coords->At(i);
+            DiskTextIndexBox box{QuantizeCoord(r.x), QuantizeCoord(r.y), QuantizeCoord(r.dx), QuantizeCoord(r.dy)};
+            indexData.Append((u8*)&box, sizeof(box));
+        }
+    }
+
+    // the file can't be overwritten while it's mapped
+    cache->SetStore(nullptr);
+
+    AutoFreeWstr indexesPath(path::GetDir(path));
+    if (!dir::Create(indexesPath) || !file::WriteFile(path, indexData.AsSpan())) {
+        return;
+    }
+
+    // don't let the indexes grow much beyond their limit during long sessions
+    i64 written = InterlockedAdd64(&gBytesWritten, (LONG64)indexData.size());
+    if (written > gMaxBytes / 4) {
+        CleanUpDiskTextIndexes();
+    }
+}
+
+void SaveDiskTextIndex(DisplayModel* dm) {
+    SaveDiskTextIndex(dm->textCache, dm->docId);
+}
+
+struct DiskTextIndexInfo {
+    WCHAR* name = nullptr;
+    i64 size = 0;
+    FILETIME lastUsed = {0};
+};
+
+void CleanUpDiskTextIndexes() {
+    InterlockedExchange64(&gBytesWritten, 0);
+
+    AutoFreeWstr indexesPath(AppGenDataFilename(DISK_TEXT_INDEX_DIR_NAME));
+    if (!indexesPath) {
+        return;
+    }
+
+    Vec<DiskTextIndexInfo> indexes;
+    AutoFreeWstr filePattern(path::Join(indexesPath, L"*.txtidx"));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(filePattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            DiskTextIndexInfo index;
+            index.name = str::Dup(fdata.cFileName);
+            index.size = ((i64)fdata.nFileSizeHigh << 32) | fdata.nFileSizeLow;
+            index.lastUsed = fdata.ftLastWriteTime;
+            indexes.Append(index);
+        }
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    // keep the most recently used indexes
+    std::sort(indexes.begin(), indexes.end(), [](const DiskTextIndexInfo& a, const DiskTextIndexInfo& b) {
+        return CompareFileTime(&a.lastUsed, &b.lastUsed) > 0;
+    });
+    i64 totalSize = 0;
+    for (DiskTextIndexInfo& index : indexes) {
+        totalSize += index.size;
+        if (totalSize > gMaxBytes) {
+            AutoFreeWstr indexPath(path::Join(indexesPath, index.name));
+            file::Delete(indexPath);
+        }
+        free(index.name);
+    }
+}
+
+void RemoveDiskTextIndex(const WCHAR* filePath) {
+    if (!filePath) {
+        AutoFreeWstr indexesPath(AppGenDataFilename(DISK_TEXT_INDEX_DIR_NAME));
+        if (indexesPath) {
+            dir::RemoveAll(indexesPath);
+        }
+        return;
+    }
+    AutoFreeWstr path(GetIndexPathForFile(filePath));
+    if (path) {
+        file::Delete(path);
+    }
+}
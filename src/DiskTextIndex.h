@@ -0,0 +1,23 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// keeps the text extracted from recently viewed documents on disk, so that
+// searching a document again doesn't require extracting the text of all its pages
+
+struct DisplayModel;
+struct DocumentTextCache;
+
+void SetDiskTextIndexSizeMB(int sizeMB);
+
+// maps the stored text of dm's document (if any) into dm->textCache
+void LoadDiskTextIndex(DisplayModel* dm);
+// stores the text of all pages extracted so far (if the text of any page had to be extracted)
+void SaveDiskTextIndex(DisplayModel* dm);
+// the same for documents not loaded into a DisplayModel (docId as returned by CalcDocumentId)
+void LoadDiskTextIndex(DocumentTextCache* cache, const WCHAR* docId);
+void SaveDiskTextIndex(DocumentTextCache* cache, const WCHAR* docId);
+
+// removes the least recently used indexes until they fit into their size limit
+void CleanUpDiskTextIndexes();
+// removes the index of a document (or of all documents, if filePath is nullptr)
+void RemoveDiskTextIndex(const WCHAR* filePath);
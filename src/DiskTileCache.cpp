@@ -0,0 +1,371 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/WinUtil.h"
+#include "utils/Log.h"
+
+#include "wingui/TreeModel.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "EnginePdf.h"
+#include "DisplayMode.h"
+#include "SettingsStructs.h"
+#include "Controller.h"
+#include "DisplayModel.h"
+#include "GlobalPrefs.h"
+#include "RenderCache.h"
+
+#include "AppTools.h"
+#include "DiskTileCache.h"
+
+#include <zlib.h>
+
+#define DISK_TILES_DIR_NAME L"sumatrapdftiles"
+
+// must be changed whenever the file format changes
+#define DISK_TILE_MAGIC 0x31544453 // 'SDT1'
+
+// deflating is the most expensive part of saving a tile (which happens
+// on the render thread), so trade size for speed
+#define DISK_TILE_COMPRESSION Z_BEST_SPEED
+
+// a tile file consists of this header, the bitmap's color palette
+// (paletteSize RGBQUADs) and the deflated pixel data of a top-down DIB
+struct DiskTileHeader {
+    u32 magic;
+    i32 dx;
+    i32 dy;
+    u16 bitCount;
+    u16 paletteSize;
+};
+
+static i64 gMaxBytes = 0;
+// number of bytes written since the last clean up
+static LONG64 gBytesWritten = 0;
+static LONG gIsCleaningUp = 0;
+
+void SetDiskTileCacheSizeMB(int sizeMB) {
+    gMaxBytes = sizeMB > 0 ? (i64)sizeMB * 1024 * 1024 : 0;
+}
+
+static WCHAR* GetDigestHex(const char* s) {
+    u8 digest[16];
+    CalcFastDigest(s, str::Len(s), digest);
+    AutoFree fingerPrint(_MemToHex(&digest));
+    return strconv::FromAnsi(fingerPrint.Get());
+}
+
+// paths (and document ids) are compared case-insensitively
+static WCHAR* GetLowerDigestHex(const WCHAR* s) {
+    AutoFree sU(strconv::WstrToUtf8(s));
+    if (!sU.Get()) {
+        return nullptr;
+    }
+    str::ToLowerInPlace(sU.Get());
+    return GetDigestHex(sU.Get());
+}
+
+// tiles are named <path digest>-<tile digest>.tile, so that all the tiles of
+// a document can be removed without having to know which version they're for
+static WCHAR* GetTilePath(PageRenderRequest& req) {
+    // like thumbnails, tiles are only kept for documents in the file history
+    if (!gGlobalPrefs->rememberOpenedFiles) {
+        return nullptr;
+    }
+    DisplayModel* dm = req.dm;
+    // only documents identical to the file on disk can be identified
+    // (DisplayModel::docId also includes the file's size and modification time)
+    if (!dm->docId || EnginePdfHasUnsavedAnnotations(dm->GetEngine())) {
+        return nullptr;
+    }
+    AutoFreeWstr tilesPath(AppGenDataFilename(DISK_TILES_DIR_NAME));
+    AutoFreeWstr pathDigest(GetLowerDigestHex(dm->FilePath()));
+    if (!tilesPath || !pathDigest) {
+        return nullptr;
+    }
+    TilePosition& tile = req.tile;
+    AutoFreeWstr key(str::Format(L"%s|%d|%d|%.4f|%d|%d|%d|%d", dm->docId.Get(), req.pageNo, req.rotation, req.zoom,
+                                 tile.res, tile.row, tile.col, req.isPreview ? 1 : 0));
+    AutoFreeWstr tileDigest(GetLowerDigestHex(key));
+    if (!tileDigest) {
+        return nullptr;
+    }
+    return str::Format(L"%s\\%s-%s.tile", tilesPath.Get(), pathDigest.Get(), tileDigest.Get());
+}
+
+static bool DeflateTo(str::Str& res, const u8* data, size_t len) {
+    z_stream zs = {0};
+    if (deflateInit(&zs, DISK_TILE_COMPRESSION) != Z_OK) {
+        return false;
+    }
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = (uInt)len;
+    u8 buf[64 * 1024];
+    int status = Z_OK;
+    while (Z_OK == status) {
+        zs.next_out = buf;
+        zs.avail_out = sizeof(buf);
+        status = deflate(&zs, Z_FINISH);
+        if (status != Z_STREAM_ERROR) {
+            res.Append(buf, sizeof(buf) - zs.avail_out);
+        }
+    }
+    deflateEnd(&zs);
+    return Z_STREAM_END == status;
+}
+
+static bool InflateTo(u8* dst, size_t dstLen, const u8* data, size_t len) {
+    z_stream zs = {0};
+    if (inflateInit(&zs) != Z_OK) {
+        return false;
+    }
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = (uInt)len;
+    zs.next_out = dst;
+    zs.avail_out = (uInt)dstLen;
+    int status = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    return Z_STREAM_END == status && 0 == zs.avail_out;
+}
+
+static int GetDIBStride(int dx, int bitCount) {
+    return ((dx * bitCount + 31) / 32) * 4;
+}
+
+RenderedBitmap* UnpackTileBitmap(std::span<u8> data) {
+    if (data.size() < sizeof(DiskTileHeader)) {
+        return nullptr;
+    }
+    DiskTileHeader* hdr = (DiskTileHeader*)data.data();
+    size_t paletteBytes = hdr->paletteSize * sizeof(RGBQUAD);
+    bool isValid = DISK_TILE_MAGIC == hdr->magic && hdr->dx > 0 && hdr->dy > 0 && hdr->paletteSize <= 256 &&
+                   (8 == hdr->bitCount || 24 == hdr->bitCount || 32 == hdr->bitCount) &&
+                   data.size() >= sizeof(DiskTileHeader) + paletteBytes;
+    // tiles are at most as large as the screen (see RenderCache::GetTileRes)
+    isValid = isValid && hdr->dx <= 0x4000 && hdr->dy <= 0x4000;
+    if (!isValid) {
+        return nullptr;
+    }
+
+    Size size(hdr->dx, hdr->dy);
+    size_t bitsLen = (size_t)GetDIBStride(hdr->dx, hdr->bitCount) * hdr->dy;
+    void* bits = nullptr;
+    HANDLE hMap = nullptr;
+    HBITMAP hbmp = nullptr;
+    bool isPooled = 32 == hdr->bitCount;
+    if (isPooled) {
+        // the same kind of DIB section that tiles are rendered into
+        hbmp = AllocPooledDib(size, &bits, &hMap);
+    } else {
+        ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
+        BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
+        bmih->biSize = sizeof(*bmih);
+        bmih->biWidth = hdr->dx;
+        bmih->biHeight = -hdr->dy;
+        bmih->biPlanes = 1;
+        bmih->biCompression = BI_RGB;
+        bmih->biBitCount = hdr->bitCount;
+        bmih->biSizeImage = (DWORD)bitsLen;
+        bmih->biClrUsed = hdr->paletteSize;
+        memcpy(bmi.Get()->bmiColors, data.data() + sizeof(DiskTileHeader), paletteBytes);
+
+        hMap = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmih->biSizeImage, nullptr);
+        hbmp = CreateDIBSection(nullptr, bmi, DIB_RGB_COLORS, &bits, hMap, 0);
+        if (!hbmp) {
+            SafeCloseHandle(&hMap);
+        }
+    }
+    if (!hbmp) {
+        return nullptr;
+    }
+    RenderedBitmap* bmp = new RenderedBitmap(hbmp, size, hMap);
+    bmp->isPooled = isPooled;
+
+    size_t offset = sizeof(DiskTileHeader) + paletteBytes;
+    if (!InflateTo((u8*)bits, bitsLen, data.data() + offset, data.size() - offset)) {
+        delete bmp;
+        return nullptr;
+    }
+    return bmp;
+}
+
+bool PackTileBitmap(RenderedBitmap* bmp, str::Str& res) {
+    // all engines render into top-down DIB sections
+    HBITMAP hbmp = bmp ? bmp->GetBitmap() : nullptr;
+    DIBSECTION info = {0};
+    int nBytes = hbmp ? GetObject(hbmp, sizeof(info), &info) : 0;
+    if (nBytes != sizeof(info) || !info.dsBm.bmBits) {
+        return false;
+    }
+    int bitCount = info.dsBmih.biBitCount;
+    if (bitCount != 8 && bitCount != 24 && bitCount != 32) {
+        return false;
+    }
+    int stride = GetDIBStride(info.dsBm.bmWidth, bitCount);
+    if (stride != info.dsBm.bmWidthBytes) {
+        return false;
+    }
+
+    RGBQUAD palette[256];
+    UINT paletteSize = 0;
+    if (8 == bitCount) {
+        HDC hdc = CreateCompatibleDC(nullptr);
+        HGDIOBJ prevBmp = SelectObject(hdc, hbmp);
+        paletteSize = GetDIBColorTable(hdc, 0, dimof(palette), palette);
+        SelectObject(hdc, prevBmp);
+        DeleteDC(hdc);
+        if (0 == paletteSize) {
+            return false;
+        }
+    }
+
+    DiskTileHeader hdr;
+    hdr.magic = DISK_TILE_MAGIC;
+    hdr.dx = info.dsBm.bmWidth;
+    hdr.dy = info.dsBm.bmHeight;
+    hdr.bitCount = (u16)bitCount;
+    hdr.paletteSize = (u16)paletteSize;
+
+    res.Append((u8*)&hdr, sizeof(hdr));
+    res.Append((u8*)palette, paletteSize * sizeof(RGBQUAD));
+    return DeflateTo(res, (u8*)info.dsBm.bmBits, (size_t)stride * hdr.dy);
+}
+
+RenderedBitmap* LoadDiskTile(PageRenderRequest& req) {
+    if (gMaxBytes <= 0) {
+        return nullptr;
+    }
+    AutoFreeWstr path(GetTilePath(req));
+    if (!path) {
+        return nullptr;
+    }
+    AutoFree data = file::ReadFile(path);
+    if (!data.data) {
+        return nullptr;
+    }
+    RenderedBitmap* bmp = UnpackTileBitmap(data.AsSpan());
+    if (!bmp) {
+        logf(L"LoadDiskTile: removing invalid '%s'\n", path.Get());
+        file::Delete(path);
+        return nullptr;
+    }
+
+    // CleanUpDiskTileCache removes the tiles which haven't been used for the longest time
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    file::SetModificationTime(path, now);
+    return bmp;
+}
+
+void SaveDiskTile(PageRenderRequest& req, RenderedBitmap* bmp) {
+    if (gMaxBytes <= 0 || !bmp) {
+        return;
+    }
+    AutoFreeWstr path(GetTilePath(req));
+    if (!path) {
+        return;
+    }
+    // the bitmap isn't in the RenderCache yet, so no other thread can have it selected
+    str::Str tileData;
+    if (!PackTileBitmap(bmp, tileData)) {
+        return;
+    }
+
+    AutoFreeWstr tilesPath(path::GetDir(path));
+    if (!dir::Create(tilesPath) || !file::WriteFile(path, tileData.AsSpan())) {
+        return;
+    }
+
+    // don't let the cache grow much beyond its limit during long sessions
+    i64 written = InterlockedAdd64(&gBytesWritten, (LONG64)tileData.size());
+    if (written > gMaxBytes / 4) {
+        CleanUpDiskTileCache();
+    }
+}
+
+struct DiskTileInfo {
+    WCHAR* name = nullptr;
+    i64 size = 0;
+    FILETIME lastUsed = {0};
+};
+
+// calls fn for every tile whose name matches pattern
+template <typename Fn>
+static void ForEachDiskTile(const WCHAR* tilesPath, const WCHAR* pattern, const Fn& fn) {
+    AutoFreeWstr filePattern(path::Join(tilesPath, pattern));
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(filePattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            fn(fdata);
+        }
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+}
+
+void CleanUpDiskTileCache() {
+    // render threads might try to clean up concurrently
+    if (InterlockedCompareExchange(&gIsCleaningUp, 1, 0) != 0) {
+        return;
+    }
+    InterlockedExchange64(&gBytesWritten, 0);
+
+    AutoFreeWstr tilesPath(AppGenDataFilename(DISK_TILES_DIR_NAME));
+    if (!tilesPath) {
+        InterlockedExchange(&gIsCleaningUp, 0);
+        return;
+    }
+
+    Vec<DiskTileInfo> tiles;
+    ForEachDiskTile(tilesPath, L"*.tile", [&tiles](WIN32_FIND_DATA& fdata) {
+        DiskTileInfo tile;
+        tile.name = str::Dup(fdata.cFileName);
+        tile.size = ((i64)fdata.nFileSizeHigh << 32) | fdata.nFileSizeLow;
+        tile.lastUsed = fdata.ftLastWriteTime;
+        tiles.Append(tile);
+    });
+
+    // keep the most recently used tiles
+    std::sort(tiles.begin(), tiles.end(), [](const DiskTileInfo& a, const DiskTileInfo& b) {
+        return CompareFileTime(&a.lastUsed, &b.lastUsed) > 0;
+    });
+    i64 totalSize = 0;
+    for (DiskTileInfo& tile : tiles) {
+        totalSize += tile.size;
+        if (totalSize > gMaxBytes) {
+            AutoFreeWstr tilePath(path::Join(tilesPath, tile.name));
+            file::Delete(tilePath);
+        }
+        free(tile.name);
+    }
+
+    InterlockedExchange(&gIsCleaningUp, 0);
+}
+
+void RemoveDiskTiles(const WCHAR* filePath) {
+    AutoFreeWstr tilesPath(AppGenDataFilename(DISK_TILES_DIR_NAME));
+    if (!tilesPath) {
+        return;
+    }
+    if (!filePath) {
+        dir::RemoveAll(tilesPath);
+        return;
+    }
+    AutoFreeWstr pathDigest(GetLowerDigestHex(filePath));
+    if (!pathDigest) {
+        return;
+    }
+    AutoFreeWstr pattern(str::Format(L"%s-*.tile", pathDigest.Get()));
+    ForEachDiskTile(tilesPath, pattern, [&tilesPath](WIN32_FIND_DATA& fdata) {
+        AutoFreeWstr tilePath(path::Join(tilesPath, fdata.cFileName));
+        file::Delete(tilePath);
+    });
+}
@@ -0,0 +1,25 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// keeps rendered tiles of recently viewed documents on disk, so that
+// reopening a document doesn't require rendering all its pages again
+
+struct PageRenderRequest;
+
+void SetDiskTileCacheSizeMB(int sizeMB);
+
+// returns nullptr if the tile isn't in the disk cache
+RenderedBitmap* LoadDiskTile(PageRenderRequest& req);
+// bmp must not have been recolored yet (so that the cache doesn't depend on the colors in use)
+void SaveDiskTile(PageRenderRequest& req, RenderedBitmap* bmp);
+
+// the tile format is also used by RenderCache for compressing cached tiles that aren't visible
+// bmp mustn't be selected into a device context while it's being packed
+bool PackTileBitmap(RenderedBitmap* bmp, str::Str& res);
+// returns nullptr if data isn't a valid packed tile
+RenderedBitmap* UnpackTileBitmap(std::span<u8> data);
+
+// removes the least recently used tiles until the cache fits into its size limit
+void CleanUpDiskTileCache();
+// removes all tiles of a document (or of all documents, if filePath is nullptr)
+void RemoveDiskTiles(const WCHAR* filePath);
@@ -46,7 +46,10 @@
 #include "utils/BaseUtil.h"
 #include "utils/WinUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
 #include "utils/Log.h"
+#include "utils/Trace.h"
+#include "utils/SlowOps.h"
 
 #include "wingui/TreeModel.h"
 
@@ -63,10 +66,18 @@
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
+#include "DiskTextIndex.h"
+#include "ContentBoxCache.h"
 
 // if true, we pre-render the pages right before and after the visible pages
 static bool gPredictiveRender = true;
 
+// scrolling events further apart than this don't count as continuous scrolling
+#define SCROLL_IDLE_MS 500
+// how far ahead (in ms of scrolling at the current speed) we prefetch pages
+#define PREFETCH_AHEAD_MS 1000
+#define MAX_PREFETCH_PAGES 8
+
 static int ColumnsFromDisplayMode(DisplayMode displayMode) {
     if (!IsSingle(displayMode)) {
         return 2;
@@ -121,6 +132,11 @@ DisplayMode DisplayModel::GetDisplayMode() const {
     return displayMode;
 }
 
+// doesn't build the ToC, which can take a while for huge outlines
+bool DisplayModel::HacToc() {
+    return engine && engine->HacToc();
+}
+
 TocTree* DisplayModel::GetToc() {
     if (!engine) {
         return nullptr;
@@ -216,6 +232,10 @@ void DisplayModel::RepaintDisplay() {
     cb->Repaint();
 }
 
+void DisplayModel::RepaintPage(int pageNo) {
+    cb->RepaintPage(this, pageNo);
+}
+
 bool DisplayModel::GetPresentationMode() const {
     return presentationMode;
 }
@@ -250,15 +270,34 @@ SizeF DisplayModel::PageSizeAfterRotation(int pageNo, bool fitToContent) const {
     if (!pageInfo) {
         return {};
     }
-    if (fitToContent && pageInfo->contentBox.IsEmpty()) {
-        pageInfo->contentBox = engine->PageContentBox(pageNo);
-        if (pageInfo->contentBox.IsEmpty()) {
+    if (fitToContent) {
+        RectF contentBox = contentBoxes->Get(pageNo);
+        if (contentBox.IsEmpty()) {
             return PageSizeAfterRotation(pageNo);
         }
+        return engine->Transform(contentBox, pageNo, 1.0, rotation).Size();
     }
 
-    RectF box = fitToContent ? pageInfo->contentBox : pageInfo->page;
-    return engine->Transform(box, pageNo, 1.0, rotation).Size();
+    // binary search for the page's run
+    int lo = 0;
+    int hi = pageSizeRuns.isize() - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (pageSizeRuns.at(mid).lastPageNo < pageNo) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (hi < 0) {
+        return engine->Transform(pageInfo->page, pageNo, 1.0, rotation).Size();
+    }
+    SizeF size = pageSizeRuns.at(lo).size;
+    // rotation is a multiple of 90
+    if (rotation % 180 != 0) {
+        std::swap(size.dx, size.dy);
+    }
+    return size;
 }
 
 /* given 'columns' and an absolute 'pageNo', return the number of the first
@@ -290,6 +329,16 @@ static int LastPageInARowNo(int pageNo, int columns, bool showCover, int pageCou
 }
 
 // must call SetInitialViewSettings() after creation
+WCHAR* CalcDocumentId(const WCHAR* filePath) {
+    WIN32_FILE_ATTRIBUTE_DATA fileInfo{};
+    if (!filePath || !GetFileAttributesExW(filePath, GetFileExInfoStandard, &fileInfo)) {
+        return nullptr;
+    }
+    FILETIME& ft = fileInfo.ftLastWriteTime;
+    return str::Format(L"%s|%u:%u|%u:%u", filePath, fileInfo.nFileSizeHigh, fileInfo.nFileSizeLow,
+                       ft.dwHighDateTime, ft.dwLowDateTime);
+}
+
 DisplayModel::DisplayModel(EngineBase* engine, ControllerCallback* cb) : Controller(cb) {
     this->engine = engine;
     CrashIf(!engine || engine->PageCount() <= 0);
@@ -314,6 +363,11 @@ DisplayModel::DisplayModel(EngineBase* engine, ControllerCallback* cb) : Control
     textCache = new DocumentTextCache(engine);
     textSelection = new TextSelection(engine, textCache);
     textSearch = new TextSearch(engine, textCache);
+
+    docId.Set(CalcDocumentId(engine->FileName()));
+    LoadDiskTextIndex(this);
+    contentBoxes = new ContentBoxCache(engine);
+    contentBoxes->Load(docId);
 }
 
 DisplayModel::~DisplayModel() {
@@ -321,6 +375,11 @@ DisplayModel::~DisplayModel() {
     cb->CleanUp(this);
 
     delete pdfSync;
+    delete wordIndex;
+    SaveDiskTextIndex(this);
+    contentBoxes->Save(docId);
+    // waits for the boxes still being computed in the background
+    delete contentBoxes;
     delete textSearch;
     delete textSelection;
     delete textCache;
@@ -336,7 +395,10 @@ PageInfo* DisplayModel::GetPageInfo(int pageNo) const {
     if (!pagesInfo) {
         return nullptr;
     }
-    return &(pagesInfo[pageNo - 1]);
+    PageInfo* pageInfo = &(pagesInfo[pageNo - 1]);
+    pageInfo->pageOnScreen = pageInfo->pos;
+    pageInfo->pageOnScreen.Offset(-viewPort.x, -viewPort.y);
+    return pageInfo;
 }
 
 // Call this before the first Relayout
@@ -410,6 +472,27 @@ void DisplayModel::BuildPagesInfo() {
             pageInfo->shown = true;
         }
     }
+    BuildPageSizeRuns();
+}
+
+void DisplayModel::BuildPageSizeRuns() {
+    pageSizeRuns.Reset();
+    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        SizeF size = engine->Transform(pageInfo->page, pageNo, 1.0, 0).Size();
+        if (pageSizeRuns.size() > 0) {
+            PageSizeRun& last = pageSizeRuns.Last();
+            if (last.size.dx == size.dx && last.size.dy == size.dy) {
+                last.lastPageNo = pageNo;
+                continue;
+            }
+        }
+        PageSizeRun run;
+        run.firstPageNo = pageNo;
+        run.lastPageNo = pageNo;
+        run.size = size;
+        pageSizeRuns.Append(run);
+    }
 }
 
 // TODO: a better name e.g. ShouldShow() to better distinguish between
@@ -444,6 +527,32 @@ bool DisplayModel::PageVisibleNearby(int pageNo) const {
     return false;
 }
 
+/* Return true if a page has been requested ahead of time because we're scrolling towards it */
+bool DisplayModel::PagePrefetched(int pageNo) const {
+    return prefetchFirst != 0 && prefetchFirst <= pageNo && pageNo <= prefetchLast;
+}
+
+// number of Back resp. Forward history entries whose pages are kept rendered
+#define NAV_PINNED_ENTRIES 3
+
+/* Return true if a page isn't visible but its rendering should be kept anyway
+   because it's likely to be shown next (the destination of the hovered link
+   or one of the most recent Back/Forward positions) */
+bool DisplayModel::PagePinned(int pageNo) const {
+    if (linkPrefetchPage != 0 && linkPrefetchPage == pageNo) {
+        return true;
+    }
+    size_t first = navHistoryIx > NAV_PINNED_ENTRIES ? navHistoryIx - NAV_PINNED_ENTRIES : 0;
+    size_t end = std::min(navHistoryIx + 1 + NAV_PINNED_ENTRIES, navHistory.size());
+    for (size_t i = first; i < end; i++) {
+        // the current entry is updated on navigation, its page is the visible one
+        if (i != navHistoryIx && navHistory.at(i).page == pageNo) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Return true if the first page is fully visible and alone on a line in
    show cover mode (i.e. it's not possible to flip to a previous page) */
 bool DisplayModel::FirstBookPageVisible() const {
@@ -495,12 +604,8 @@ float DisplayModel::ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo) co
         RectF box;
         for (int i = first; i <= last; i++) {
             PageInfo* pageInfo = GetPageInfo(i);
-            if (pageInfo->contentBox.IsEmpty()) {
-                pageInfo->contentBox = engine->PageContentBox(i);
-            }
-
             RectF pageBox = engine->Transform(pageInfo->page, i, 1.0, rotation);
-            RectF contentBox = engine->Transform(pageInfo->contentBox, i, 1.0, rotation);
+            RectF contentBox = engine->Transform(contentBoxes->Get(i), i, 1.0, rotation);
             if (contentBox.IsEmpty()) {
                 contentBox = pageBox;
             }
@@ -540,6 +645,9 @@ int DisplayModel::FirstVisiblePageNo() const {
     if (!pagesInfo) {
         return INVALID_PAGE_NO;
     }
+    if (!visiblePartsDirty) {
+        return firstVisible > 0 ? firstVisible : INVALID_PAGE_NO;
+    }
 
     for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
@@ -552,6 +660,24 @@ int DisplayModel::FirstVisiblePageNo() const {
     return INVALID_PAGE_NO;
 }
 
+int DisplayModel::LastVisiblePageNo() const {
+    CrashIf(!pagesInfo);
+    if (!pagesInfo) {
+        return INVALID_PAGE_NO;
+    }
+    if (!visiblePartsDirty) {
+        return lastVisible > 0 ? lastVisible : INVALID_PAGE_NO;
+    }
+
+    for (int pageNo = PageCount(); pageNo >= 1; --pageNo) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        if (pageInfo->visibleRatio > 0.0) {
+            return pageNo;
+        }
+    }
+    return INVALID_PAGE_NO;
+}
+
 // we consider the most visible page the current one
 // (in continuous layout, there's no better criteria)
 int DisplayModel::CurrentPageNo() const {
@@ -567,7 +693,13 @@ int DisplayModel::CurrentPageNo() const {
     int mostVisiblePage = INVALID_PAGE_NO;
     float ratio = 0;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+    int first = 1;
+    int last = PageCount();
+    if (!visiblePartsDirty) {
+        first = std::max(firstVisible, 1);
+        last = lastVisible;
+    }
+    for (int pageNo = first; pageNo <= last; pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > ratio) {
             mostVisiblePage = pageNo;
@@ -596,9 +728,21 @@ void DisplayModel::CalcZoomReal(float newZoomVirtual) {
            across the pages so that the largest page fits. In most documents
            all pages are the same size anyway */
         float minZoom = (float)HUGE_VAL;
+        // the zoom only depends on the page size, so it's only
+        // recalculated at the start of a run of same-sized pages
+        float zoom = 0;
+        const PageSizeRun* lastRun = nullptr;
+        int runIdx = 0;
         for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+            while (runIdx < pageSizeRuns.isize() && pageSizeRuns.at(runIdx).lastPageNo < pageNo) {
+                runIdx++;
+            }
+            const PageSizeRun* run = runIdx < pageSizeRuns.isize() ? &pageSizeRuns.at(runIdx) : nullptr;
             if (PageShown(pageNo)) {
-                float zoom = ZoomRealFromVirtualForPage(newZoomVirtual, pageNo);
+                if (!run || run != lastRun) {
+                    zoom = ZoomRealFromVirtualForPage(newZoomVirtual, pageNo);
+                    lastRun = run;
+                }
                 PageInfo* pageInfo = GetPageInfo(pageNo);
                 pageInfo->zoomReal = zoom;
                 if (minZoom > zoom) {
@@ -609,6 +753,8 @@ void DisplayModel::CalcZoomReal(float newZoomVirtual) {
         CrashIf(minZoom == (float)HUGE_VAL);
         zoomReal = minZoom;
     } else if (ZOOM_FIT_CONTENT == newZoomVirtual) {
+        // the current page's box is computed right away, the others are likely needed soon
+        contentBoxes->ComputeAllInBackground();
         float newZoom = ZoomRealFromVirtualForPage(newZoomVirtual, CurrentPageNo());
         // limit zooming in to 800% on almost empty pages
         if (newZoom > 8.0) {
@@ -657,6 +803,8 @@ float DisplayModel::GetZoomReal(int pageNo) const {
      * switching between display modes
      * navigating to another page in non-continuous mode */
 void DisplayModel::Relayout(float newZoomVirtual, int newRotation) {
+    TRACE_ZONE("DisplayModel::Relayout");
+    SLOW_OP("Layout", FilePath(), 0);
     CrashIf(!pagesInfo);
     if (!pagesInfo) {
         return;
@@ -849,6 +997,46 @@ RestartLayout:
     }
 
     canvasSize = Size(std::max(canvasDx, viewPort.dx), std::max(canvasDy, viewPort.dy));
+    BuildPageRows();
+    visiblePartsDirty = true;
+}
+
+// pages in a row all have the same pos.y, as set in Relayout()
+void DisplayModel::BuildPageRows() {
+    pageRows.Reset();
+    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        if (!pageInfo->shown) {
+            continue;
+        }
+        Rect pos = pageInfo->pos;
+        if (pageRows.size() == 0 || pageRows.Last().y != pos.y) {
+            PageRow row;
+            row.firstPageNo = pageNo;
+            row.y = pos.y;
+            pageRows.Append(row);
+        }
+        PageRow& row = pageRows.Last();
+        row.lastPageNo = pageNo;
+        row.dy = std::max(row.dy, pos.dy);
+    }
+}
+
+// returns the index of the first row that ends below y
+// (pageRows.size() if there's none)
+int DisplayModel::FindPageRow(int y) const {
+    int lo = 0;
+    int hi = pageRows.isize();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        const PageRow& row = pageRows.at(mid);
+        if (row.y + row.dy <= y) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
 }
 
 void DisplayModel::ChangeStartPage(int newStartPage) {
@@ -885,24 +1073,40 @@ void DisplayModel::RecalcVisibleParts() {
         return;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            CrashIf(0.0 != pageInfo->visibleRatio);
-            continue;
+    if (visiblePartsDirty) {
+        for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+            PageInfo* pageInfo = GetPageInfo(pageNo);
+            CrashIf(!pageInfo->shown && 0.0 != pageInfo->visibleRatio);
+            pageInfo->visibleRatio = 0.0;
         }
+        visiblePartsDirty = false;
+    } else {
+        // after scrolling, only the previously visible pages can have become invisible
+        for (int pageNo = firstVisible; pageNo > 0 && pageNo <= lastVisible; ++pageNo) {
+            GetPageInfo(pageNo)->visibleRatio = 0.0;
+        }
+    }
 
-        Rect pageRect = pageInfo->pos;
-        Rect visiblePart = pageRect.Intersect(viewPort);
-
-        pageInfo->visibleRatio = 0.0;
-        if (!visiblePart.IsEmpty()) {
+    firstVisible = 0;
+    lastVisible = 0;
+    int viewPortEndY = viewPort.y + viewPort.dy;
+    for (int i = FindPageRow(viewPort.y); i < pageRows.isize() && pageRows.at(i).y < viewPortEndY; i++) {
+        const PageRow& row = pageRows.at(i);
+        for (int pageNo = row.firstPageNo; pageNo <= row.lastPageNo; ++pageNo) {
+            PageInfo* pageInfo = GetPageInfo(pageNo);
+            Rect pageRect = pageInfo->pos;
+            Rect visiblePart = pageRect.Intersect(viewPort);
+            if (visiblePart.IsEmpty()) {
+                continue;
+            }
             CrashIf(pageRect.dx <= 0 || pageRect.dy <= 0);
             // calculate with floating point precision to prevent an integer overflow
             pageInfo->visibleRatio = 1.0f * visiblePart.dx * visiblePart.dy / ((float)pageRect.dx * pageRect.dy);
+            if (0 == firstVisible) {
+                firstVisible = pageNo;
+            }
+            lastVisible = pageNo;
         }
-        pageInfo->pageOnScreen = pageRect;
-        pageInfo->pageOnScreen.Offset(-viewPort.x, -viewPort.y);
     }
 }
 
@@ -912,14 +1116,15 @@ int DisplayModel::GetPageNoByPoint(Point pt) {
         return -1;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
+    Point canvasPt(pt.x + viewPort.x, pt.y + viewPort.y);
+    int i = FindPageRow(canvasPt.y);
+    if (i >= pageRows.isize()) {
+        return -1;
+    }
+    const PageRow& row = pageRows.at(i);
+    for (int pageNo = row.firstPageNo; pageNo <= row.lastPageNo; ++pageNo) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
-        CrashIf(!(0.0 == pageInfo->visibleRatio || pageInfo->shown));
-        if (!pageInfo->shown) {
-            continue;
-        }
-
-        if (pageInfo->pageOnScreen.Contains(pt)) {
+        if (pageInfo->pos.Contains(canvasPt)) {
             return pageNo;
         }
     }
@@ -932,25 +1137,42 @@ int DisplayModel::GetPageNextToPoint(Point pt) {
         return startPage;
     }
 
+    int pageNo = GetPageNoByPoint(pt);
+    if (pageNo > 0) {
+        return pageNo;
+    }
+
+    // find the page with the closest center, starting with the rows around pt
+    // and stopping once the rows are further away than the closest page so far
     unsigned int maxDist = UINT_MAX;
     int closest = startPage;
-
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        CrashIf(0.0 != pageInfo->visibleRatio && !pageInfo->shown);
-        if (!pageInfo->shown) {
-            continue;
-        }
-
-        if (pageInfo->pageOnScreen.Contains(pt)) {
-            return pageNo;
-        }
-
-        Rect r = pageInfo->pageOnScreen;
-        unsigned int dist = distSq(pt.x - r.x - r.dx / 2, pt.y - r.y - r.dy / 2);
-        if (dist < maxDist) {
-            closest = pageNo;
-            maxDist = dist;
+    Point canvasPt(pt.x + viewPort.x, pt.y + viewPort.y);
+    int nRows = pageRows.isize();
+    int below = FindPageRow(canvasPt.y);
+    int above = below - 1;
+    while (above >= 0 || below < nRows) {
+        int i;
+        if (above < 0) {
+            i = below++;
+        } else if (below >= nRows) {
+            i = above--;
+        } else {
+            int distAbove = canvasPt.y - (pageRows.at(above).y + pageRows.at(above).dy);
+            int distBelow = pageRows.at(below).y - canvasPt.y;
+            i = distAbove <= distBelow ? above-- : below++;
+        }
+        const PageRow& row = pageRows.at(i);
+        int rowDist = std::max(0, std::max(row.y - canvasPt.y, canvasPt.y - (row.y + row.dy)));
+        if (distSq(0, rowDist) > maxDist) {
+            break;
+        }
+        for (pageNo = row.firstPageNo; pageNo <= row.lastPageNo; ++pageNo) {
+            Rect r = GetPageInfo(pageNo)->pos;
+            unsigned int dist = distSq(canvasPt.x - r.x - r.dx / 2, canvasPt.y - r.y - r.dy / 2);
+            if (dist < maxDist || (dist == maxDist && pageNo < closest)) {
+                closest = pageNo;
+                maxDist = dist;
+            }
         }
     }
 
@@ -1064,20 +1286,26 @@ bool DisplayModel::IsOverText(Point pt) {
     return textSelection->IsOverGlyph(pageNo, pos.x, pos.y);
 }
 
-void DisplayModel::RenderVisibleParts() {
-    int firstVisiblePage = 0;
-    int lastVisiblePage = 0;
-
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0) {
-            CrashIf(!pageInfo->shown);
-            if (0 == firstVisiblePage) {
-                firstVisiblePage = pageNo;
+// request the pages that will be visible once the viewport has been
+// scrolled to yOff (e.g. at the end of a scroll animation)
+void DisplayModel::RenderPagesAt(int yOff) {
+    int endY = yOff + viewPort.dy;
+    for (int i = FindPageRow(yOff); i < pageRows.isize() && pageRows.at(i).y < endY; i++) {
+        const PageRow& row = pageRows.at(i);
+        for (int pageNo = row.firstPageNo; pageNo <= row.lastPageNo; pageNo++) {
+            if (PageShown(pageNo)) {
+                cb->RequestRendering(pageNo);
             }
-            lastVisiblePage = pageNo;
         }
     }
+}
+
+void DisplayModel::RenderVisibleParts() {
+    if (visiblePartsDirty) {
+        RecalcVisibleParts();
+    }
+    int firstVisiblePage = firstVisible;
+    int lastVisiblePage = lastVisible;
     // no page is visible if e.g. the window is resized
     // vertically until only the title bar remains visible
     if (0 == firstVisiblePage) {
@@ -1115,6 +1343,107 @@ void DisplayModel::RenderVisibleParts() {
     for (int pageNo = lastVisiblePage; pageNo >= firstVisiblePage; pageNo--) {
         cb->RequestRendering(pageNo);
     }
+
+    if (gPredictiveRender) {
+        PrefetchPages(firstVisiblePage, lastVisiblePage);
+    }
+    textCache->EvictPages(firstVisiblePage, lastVisiblePage);
+    // make text selection and searching instant without delaying rendering
+    if (!engine->IsImageCollection()) {
+        textCache->ExtractInBackground(firstVisiblePage);
+    }
+}
+
+// remember direction and speed of vertical scrolling so that
+// RenderVisibleParts can request pages that are about to be scrolled into view
+void DisplayModel::TrackScrolling(int dy) {
+    if (0 == dy) {
+        return;
+    }
+    TrackInteraction();
+    DWORD now = GetTickCount();
+    DWORD dt = now - lastScrollTime;
+    lastScrollTime = now;
+    int dir = dy > 0 ? 1 : -1;
+    if (dir != scrollDirection || dt > SCROLL_IDLE_MS) {
+        if (dir != scrollDirection && prefetchFirst != 0) {
+            // pages prefetched in the other direction are no longer needed
+            cb->CancelPrefetch(this);
+        }
+        scrollDirection = dir;
+        scrollSpeed = 0.f;
+        prefetchFirst = prefetchLast = 0;
+        return;
+    }
+    float speed = (float)abs(dy) / (float)std::max(dt, (DWORD)1);
+    if (scrollSpeed == 0.f) {
+        scrollSpeed = speed;
+    } else {
+        scrollSpeed = scrollSpeed * 0.7f + speed * 0.3f;
+    }
+}
+
+// a single step (e.g. going to a page) is rendered at full quality right away,
+// only a succession of them is worth rendering drafts for
+void DisplayModel::TrackInteraction() {
+    DWORD now = GetTickCount();
+    isInteractionBurst = now - lastInteractionTime <= INTERACTION_IDLE_MS;
+    lastInteractionTime = now;
+}
+
+bool DisplayModel::IsInteracting() const {
+    return isInteractionBurst && GetTickCount() - lastInteractionTime <= INTERACTION_IDLE_MS;
+}
+
+// request rendering of pages beyond the visible ones in the direction
+// we're scrolling in (with low priority, depending on scrolling speed)
+void DisplayModel::PrefetchPages(int firstVisiblePage, int lastVisiblePage) {
+    bool isScrolling = scrollDirection != 0 && GetTickCount() - lastScrollTime <= SCROLL_IDLE_MS;
+    if (!isScrolling || scrollSpeed == 0.f || !IsContinuous(GetDisplayMode())) {
+        return;
+    }
+
+    int columns = ColumnsFromDisplayMode(GetDisplayMode());
+    PageInfo* pageInfo = GetPageInfo(scrollDirection > 0 ? lastVisiblePage : firstVisiblePage);
+    int pageDy = std::max(pageInfo->pos.dy + pageSpacing.dy, 1);
+    float aheadDy = scrollSpeed * PREFETCH_AHEAD_MS;
+    int nPages = (int)ceilf(aheadDy / pageDy) * columns;
+    nPages = std::min(nPages, MAX_PREFETCH_PAGES);
+
+    // the pages right next to the visible ones have already been requested
+    int first, last;
+    if (scrollDirection > 0) {
+        first = lastVisiblePage + 1 + columns;
+        last = std::min(lastVisiblePage + nPages, PageCount());
+    } else {
+        first = std::max(firstVisiblePage - nPages, 1);
+        last = firstVisiblePage - 1 - columns;
+    }
+    if (first > last) {
+        return;
+    }
+    prefetchFirst = first;
+    prefetchLast = last;
+
+    // nearest pages first
+    for (int i = 0; i <= last - first; i++) {
+        int pageNo = scrollDirection > 0 ? first + i : last - i;
+        if (PageShown(pageNo)) {
+            cb->RequestPrefetch(pageNo);
+        }
+    }
+}
+
+// request rendering of the destination of a link the cursor rests on (with low
+// priority, at the current zoom) so that following the link is instant;
+// 0 once the cursor has left the link
+void DisplayModel::PrefetchLinkDestination(int pageNo) {
+    if (!ValidPageNo(pageNo) || PageVisibleNearby(pageNo)) {
+        linkPrefetchPage = 0;
+        return;
+    }
+    linkPrefetchPage = pageNo;
+    cb->RequestPrefetch(pageNo);
 }
 
 void DisplayModel::SetViewPortSize(Size newViewPortSize) {
@@ -1143,13 +1472,8 @@ void DisplayModel::SetViewPortSize(Size newViewPortSize) {
 }
 
 RectF DisplayModel::GetContentBox(int pageNo) {
-    RectF cbox{};
-    // we cache the contentBox
+    RectF cbox = contentBoxes->Get(pageNo);
     PageInfo* pageInfo = GetPageInfo(pageNo);
-    if (pageInfo->contentBox.IsEmpty()) {
-        pageInfo->contentBox = engine->PageContentBox(pageNo);
-    }
-    cbox = pageInfo->contentBox;
     float zoom = pageInfo->zoomReal;
     // TODO: must be a better way
     if (zoom == 0) {
@@ -1405,6 +1729,7 @@ bool DisplayModel::GoToFirstPage() {
 
 void DisplayModel::ScrollXTo(int xOff) {
     int currPageNo = CurrentPageNo();
+    int dx = xOff - viewPort.x;
     viewPort.x = xOff;
     RecalcVisibleParts();
     cb->UpdateScrollbars(canvasSize);
@@ -1412,7 +1737,7 @@ void DisplayModel::ScrollXTo(int xOff) {
     if (CurrentPageNo() != currPageNo) {
         cb->PageNoChanged(this, CurrentPageNo());
     }
-    RepaintDisplay();
+    cb->RepaintScrolled(dx, 0);
 }
 
 void DisplayModel::ScrollXBy(int dx) {
@@ -1424,6 +1749,8 @@ void DisplayModel::ScrollXBy(int dx) {
 
 void DisplayModel::ScrollYTo(int yOff) {
     int currPageNo = CurrentPageNo();
+    int dy = yOff - viewPort.y;
+    TrackScrolling(dy);
     viewPort.y = yOff;
     RecalcVisibleParts();
     RenderVisibleParts();
@@ -1432,7 +1759,7 @@ void DisplayModel::ScrollYTo(int yOff) {
     if (newPageNo != currPageNo) {
         cb->PageNoChanged(this, newPageNo);
     }
-    RepaintDisplay();
+    cb->RepaintScrolled(0, dy);
 }
 
 /* Scroll the doc in y-axis by 'dy'. If 'changePage' is TRUE, automatically
@@ -1482,6 +1809,7 @@ void DisplayModel::ScrollYBy(int dy, bool changePage) {
     }
 
     currPageNo = CurrentPageNo();
+    TrackScrolling(newYOff - currYOff);
     viewPort.y = newYOff;
     RecalcVisibleParts();
     RenderVisibleParts();
@@ -1490,7 +1818,7 @@ void DisplayModel::ScrollYBy(int dy, bool changePage) {
     if (newPageNo != currPageNo) {
         cb->PageNoChanged(this, newPageNo);
     }
-    RepaintDisplay();
+    cb->RepaintScrolled(0, newYOff - currYOff);
 }
 
 void DisplayModel::SetZoomVirtual(float zoomLevel, Point* fixPt) {
@@ -1505,6 +1833,7 @@ void DisplayModel::SetZoomVirtual(float zoomLevel, Point* fixPt) {
     if (zoomVirtual == zoomLevel && (fixPt || !scrollToFitPage)) {
         return;
     }
+    TrackInteraction();
 
     ScrollState ss = GetScrollState();
 
@@ -1638,7 +1967,7 @@ void DisplayModel::RotateBy(int newRotation) {
 /* Given <region> (in user coordinates ) on page <pageNo>, copies text in that region
  * into a newly allocated buffer (which the caller needs to free()). */
 WCHAR* DisplayModel::GetTextInRegion(int pageNo, RectF region) {
-    Rect* coords;
+    const GlyphCoords* coords;
     const WCHAR* pageText = textCache->GetTextForPage(pageNo, nullptr, &coords);
     if (str::IsEmpty(pageText)) {
         return nullptr;
@@ -1648,7 +1977,7 @@ WCHAR* DisplayModel::GetTextInRegion(int pageNo, RectF region) {
     Rect regionI = region.Round();
     for (const WCHAR* src = pageText; *src; src++) {
         if (*src != '\n') {
-            Rect rect = coords[src - pageText];
+            Rect rect = coords->At((int)(src - pageText));
             Rect isect = regionI.Intersect(rect);
             if (!isect.IsEmpty() && 1.0 * isect.dx * isect.dy / (rect.dx * rect.dy) >= 0.3) {
                 result.Append(*src);
@@ -1764,6 +2093,19 @@ void DisplayModel::SetScrollState(ScrollState state) {
     GoToPage(state.page, newPt.y, false, newPt.x);
 }
 
+// the layout and the viewport are kept while the tab is hidden, so only the
+// window's scrollbars and page number need updating (and pages that have been
+// evicted from the cache re-requested) instead of going through GoToPage
+void DisplayModel::ShowAgain() {
+    if (visiblePartsDirty) {
+        RecalcVisibleParts();
+    }
+    RenderVisibleParts();
+    cb->UpdateScrollbars(canvasSize);
+    cb->PageNoChanged(this, CurrentPageNo());
+    RepaintDisplay();
+}
+
 // don't remember more than "enough" history entries (same number as Firefox uses)
 #define MAX_NAV_HISTORY_LEN 50
 
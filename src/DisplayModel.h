@@ -4,14 +4,15 @@
 // define the following if you want shadows drawn around the pages
 // #define DRAW_PAGE_SHADOWS
 
+// scrolling or zooming steps at most this far apart are part of the same
+// interaction, during which pages are rendered as drafts (see IsInteracting)
+#define INTERACTION_IDLE_MS 300
+
 /* Describes many attributes of one page in one, convenient place */
 struct PageInfo {
     /* data that is constant for a given page. page size in document units */
     RectF page{};
 
-    /* data that is calculated when needed. actual content size within a page (View target) */
-    RectF contentBox{};
-
     /* data that needs to be set before DisplayModel::Relayout().
        Determines whether a given page should be shown on the screen. */
     bool shown = false;
@@ -24,7 +25,8 @@ struct PageInfo {
 
     /* data that changes due to scrolling. Calculated in DisplayModel::RecalcVisibleParts() */
     float visibleRatio; /* (0.0 = invisible, 1.0 = fully visible) */
-    /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y) */
+    /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y)
+       (updated by DisplayModel::GetPageInfo(), so that scrolling doesn't have to touch all pages) */
     Rect pageOnScreen{};
 
     // when zoomVirtual in DisplayMode is ZOOM_FIT_PAGE, ZOOM_FIT_WIDTH
@@ -32,6 +34,25 @@ struct PageInfo {
     float zoomReal;
 };
 
+/* A row of shown pages on the canvas. Rows don't overlap and are sorted by y,
+   so that the pages at a given position can be found with a binary search */
+struct PageRow {
+    int firstPageNo = 0;
+    int lastPageNo = 0;
+    /* top and height of the row's tallest page */
+    int y = 0;
+    int dy = 0;
+};
+
+/* Consecutive pages of the same size (unrotated by the user, but with the
+   page's own rotation applied). Most documents have a single run, so that
+   zoom and page sizes can be calculated per run instead of per page */
+struct PageSizeRun {
+    int firstPageNo = 0;
+    int lastPageNo = 0;
+    SizeF size;
+};
+
 /* The current scroll state (needed for saving/restoring the scroll position) */
 /* coordinates are in user space units (per page) */
 struct ScrollState {
@@ -45,8 +66,10 @@ struct ScrollState {
 };
 
 struct DocumentTextCache;
+struct ContentBoxCache;
 struct TextSelection;
 class TextSearch;
+class DocumentWordIndex;
 struct TextSel;
 class Synchronizer;
 
@@ -87,6 +110,7 @@ struct DisplayModel : public Controller {
     void SetViewPortSize(Size size) override;
 
     // table of contents
+    bool HacToc() override;
     TocTree* GetToc() override;
     void ScrollToLink(PageDestination* dest) override;
     PageDestination* GetNamedDest(const WCHAR* name) override;
@@ -122,8 +146,17 @@ struct DisplayModel : public Controller {
 
     DocumentTextCache* textCache = nullptr;
     TextSelection* textSelection = nullptr;
+    // actual content size within the pages (View target), for ZOOM_FIT_CONTENT
+    ContentBoxCache* contentBoxes = nullptr;
+
+    // identifies the loaded file by path, size and modification time so that
+    // pages rendered for other DisplayModels showing the same file can be reused
+    // (nullptr if the document isn't loaded from a file or has been modified)
+    AutoFreeWstr docId;
     // access only from Search thread
     TextSearch* textSearch = nullptr;
+    // created when all matches are searched for the first time
+    DocumentWordIndex* wordIndex = nullptr;
 
     PageInfo* GetPageInfo(int pageNo) const;
 
@@ -142,7 +175,10 @@ struct DisplayModel : public Controller {
     bool PageShown(int pageNo) const;
     bool PageVisible(int pageNo) const;
     bool PageVisibleNearby(int pageNo) const;
+    bool PagePrefetched(int pageNo) const;
+    bool PagePinned(int pageNo) const;
     int FirstVisiblePageNo() const;
+    int LastVisiblePageNo() const;
     bool FirstBookPageVisible() const;
     bool LastBookPageVisible() const;
 
@@ -150,6 +186,7 @@ struct DisplayModel : public Controller {
     void ScrollXBy(int dx);
     void ScrollYTo(int yOff);
     void ScrollYBy(int dy, bool changePage);
+    void RenderPagesAt(int yOff);
     /* a "virtual" zoom level. Can be either a real zoom level in percent
        (i.e. 100.0 is original size) or one of virtual values ZOOM_FIT_PAGE,
        ZOOM_FIT_WIDTH or ZOOM_FIT_CONTENT, whose real value depends on draw area size */
@@ -170,6 +207,8 @@ struct DisplayModel : public Controller {
 
     ScrollState GetScrollState();
     void SetScrollState(ScrollState state);
+    // re-publishes the unchanged layout and position after the tab was selected again
+    void ShowAgain();
 
     void CopyNavHistory(DisplayModel& orig);
 
@@ -180,19 +219,36 @@ struct DisplayModel : public Controller {
     bool ShouldCacheRendering(int pageNo);
     // called when we decide that the display needs to be redrawn
     void RepaintDisplay();
+    // like RepaintDisplay but only for the visible part of pageNo
+    void RepaintPage(int pageNo);
+    // true during a quick succession of scrolling or zooming steps
+    bool IsInteracting() const;
 
     /* allow resizing a window without triggering a new rendering (needed for window destruction) */
     bool dontRenderFlag = false;
 
+    // measured by RenderCache to adapt the tile size to how expensive pages are to render
+    // (protected by RenderCache::requestAccess): average time for rendering a megapixel
+    // (0 until a tile has been rendered) and by how much the tile resolution is increased
+    float renderMsPerMPixel = 0;
+    int extraTileRes = 0;
+
     bool GetPresentationMode() const;
 
     void BuildPagesInfo();
+    void BuildPageSizeRuns();
     float ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo) const;
     SizeF PageSizeAfterRotation(int pageNo, bool fitToContent = false) const;
     void ChangeStartPage(int startPage);
     Point GetContentStart(int pageNo);
+    void BuildPageRows();
+    int FindPageRow(int y) const;
     void RecalcVisibleParts();
     void RenderVisibleParts();
+    void TrackScrolling(int dy);
+    void TrackInteraction();
+    void PrefetchPages(int firstVisiblePage, int lastVisiblePage);
+    void PrefetchLinkDestination(int pageNo);
     void AddNavPoint();
     RectF GetContentBox(int pageNo);
     void CalcZoomReal(float zoomVirtual);
@@ -204,6 +260,17 @@ struct DisplayModel : public Controller {
 
     /* an array of PageInfo, len of array is pageCount */
     PageInfo* pagesInfo = nullptr;
+    /* sizes of all pages, calculated once in DisplayModel::BuildPagesInfo() */
+    Vec<PageSizeRun> pageSizeRuns;
+    /* rows of shown pages, calculated in DisplayModel::Relayout() */
+    Vec<PageRow> pageRows;
+    /* range of pages with visibleRatio > 0 (0 if none), calculated in
+       DisplayModel::RecalcVisibleParts() */
+    int firstVisible = 0;
+    int lastVisible = 0;
+    /* set when any page's visibility might have changed (e.g. after Relayout),
+       so that the next RecalcVisibleParts() updates all pages */
+    bool visiblePartsDirty = true;
 
     DisplayMode displayMode = DM_AUTOMATIC;
     /* In non-continuous mode is the first page from a file that we're
@@ -241,6 +308,21 @@ struct DisplayModel : public Controller {
     float presZoomVirtual = INVALID_ZOOM;
     DisplayMode presDisplayMode = DM_AUTOMATIC;
 
+    /* direction (1 is down, -1 is up) and smoothed speed (in pixels per ms) of
+       recent vertical scrolling, used for rendering pages ahead of time */
+    int scrollDirection = 0;
+    float scrollSpeed = 0.f;
+    DWORD lastScrollTime = 0;
+    /* time of the most recent scrolling or zooming step and whether
+       it closely followed the one before (see IsInteracting) */
+    DWORD lastInteractionTime = 0;
+    bool isInteractionBurst = false;
+    /* pages requested by PrefetchPages (0 if none) */
+    int prefetchFirst = 0;
+    int prefetchLast = 0;
+    /* destination of the hovered link requested by PrefetchLinkDestination (0 if none) */
+    int linkPrefetchPage = 0;
+
     Vec<ScrollState> navHistory;
     /* index of the "current" history entry (to be updated on navigation),
        resp. number of Back history entries */
@@ -248,3 +330,5 @@ struct DisplayModel : public Controller {
 };
 
 int NormalizeRotation(int rotation);
+// identifies the current version of a file by its path, size and modification time
+WCHAR* CalcDocumentId(const WCHAR* filePath);
@@ -9,6 +9,7 @@
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
 #include "mui/Mui.h"
+#include "utils/SlowOps.h"
 #include "utils/ThreadUtil.h"
 #include "utils/Timer.h"
 #include "utils/TrivialHtmlParser.h"
@@ -70,24 +71,162 @@ static TocItem* newEbookTocDest(TocItem* parent, const WCHAR* title, const WCHAR
     return res;
 }
 
+// EPUB chapters start on a new page with reset CSS rules (cf. EpubFormatter::HandleTagPagebreak),
+// so they can be formatted independently of each other
+#define EPUB_CHAPTER_MARKER "<pagebreak page_path=\""
+// number of finished layouts kept for switching back to them without re-formatting
+#define MAX_CACHED_LAYOUTS 3
+
+// don't notify the ui thread about new pages more often than that
+#define PAGES_NOTIFICATION_INTERVAL_MS 100
+
+// tells the ui thread that formatting thread threadNo has added pages
+// to its EbookPageStream (the pages themselves aren't sent)
 struct EbookFormattingData {
-    enum { MAX_PAGES = 256 };
-    HtmlPage* pages[MAX_PAGES];
-    size_t pageCount;
-    bool finished;
     LONG threadNo;
+    bool finished;
+
+    EbookFormattingData(LONG threadNo, bool finished) : threadNo(threadNo), finished(finished) {
+    }
+};
 
-    EbookFormattingData(HtmlPage** pages, size_t pageCount, bool finished, LONG threadNo)
-        : pageCount(pageCount), finished(finished), threadNo(threadNo) {
-        CrashIf(pageCount > MAX_PAGES);
-        memcpy(this->pages, pages, pageCount * sizeof(*pages));
+// holds the draw instructions and text of all pages of a single layout,
+// usable by several formatting threads at once
+struct LayoutAllocator : Allocator {
+    PoolAllocator allocator;
+    CRITICAL_SECTION cs;
+
+    LayoutAllocator() {
+        allocator.minBlockSize = 64 * 1024;
+        InitializeCriticalSection(&cs);
+    }
+    ~LayoutAllocator() override {
+        DeleteCriticalSection(&cs);
+    }
+    void* Alloc(size_t size) override {
+        ScopedCritSec scope(&cs);
+        return allocator.Alloc(size);
+    }
+    void* Realloc(void* mem, size_t size) override {
+        ScopedCritSec scope(&cs);
+        return allocator.Realloc(mem, size);
     }
+    void Free(const void* mem) override {
+        ScopedCritSec scope(&cs);
+        allocator.Free(mem);
+    }
+    size_t MemoryUsage() {
+        ScopedCritSec scope(&cs);
+        return allocator.blocksSize;
+    }
+};
 
-    void DeletePages() {
-        for (size_t i = 0; i < this->pageCount; i++) {
-            delete this->pages[i];
+// pages of a single layout. They're appended by the formatting thread and read
+// by the ui thread without locking: pages are stored in segments which never move
+// and a page only becomes visible to the ui thread once pageCount includes it.
+// Must only be deleted after the formatting thread has finished.
+struct EbookPageStream {
+    static constexpr int kSegmentSize = 1024;
+    static constexpr int kMaxSegments = 4096;
+
+    HtmlPage** segments[kMaxSegments]{};
+    LONG pageCount = 0;
+    // set while an EbookFormattingData is on its way to the ui thread
+    LONG notificationPending = 0;
+    // draw instructions and text of the pages
+    LayoutAllocator allocator;
+
+    // the layout the pages have been formatted for
+    float pageDx = 0;
+    float pageDy = 0;
+    AutoFreeWstr fontName;
+    float fontSize = 0;
+    TextRenderMethod textRenderMethod = TextRenderMethodGdi;
+    // set on the ui thread once the formatting thread has added all pages
+    bool finished = false;
+
+    EbookPageStream() = default;
+    ~EbookPageStream() {
+        for (int i = 0; i < pageCount; i++) {
+            delete segments[i / kSegmentSize][i % kSegmentSize];
+        }
+        for (HtmlPage** segment : segments) {
+            free(segment);
         }
     }
+
+    // only to be called from the formatting thread
+    bool Append(HtmlPage* page) {
+        int n = (int)pageCount;
+        int segmentNo = n / kSegmentSize;
+        if (segmentNo >= kMaxSegments) {
+            return false;
+        }
+        if (!segments[segmentNo]) {
+            segments[segmentNo] = AllocArray<HtmlPage*>(kSegmentSize);
+            if (!segments[segmentNo]) {
+                return false;
+            }
+        }
+        segments[segmentNo][n % kSegmentSize] = page;
+        // publish the page to the ui thread
+        InterlockedExchange(&pageCount, n + 1);
+        return true;
+    }
+
+    int size() const {
+        return (int)InterlockedAdd((LONG*)&pageCount, 0);
+    }
+
+    HtmlPage* at(int idx) const {
+        CrashIf(idx < 0 || idx >= size());
+        return segments[idx / kSegmentSize][idx % kSegmentSize];
+    }
+
+    void SetLayout(HtmlFormatterArgs* args) {
+        pageDx = args->pageDx;
+        pageDy = args->pageDy;
+        fontName.SetCopy(args->GetFontName());
+        fontSize = args->fontSize;
+        textRenderMethod = args->textRenderMethod;
+    }
+
+    bool HasLayout(HtmlFormatterArgs* args) const {
+        return pageDx == args->pageDx && pageDy == args->pageDy && str::Eq(fontName, args->GetFontName()) &&
+               fontSize == args->fontSize && textRenderMethod == args->textRenderMethod;
+    }
+};
+
+struct ChapterFormattingData {
+    // offsets of the chapter within the document's html
+    size_t start = 0;
+    size_t end = 0;
+    Vec<HtmlPage*> pages;
+    bool done = false;
+};
+
+// shared between the formatting thread and the tasks formatting single chapters
+struct ChapterFormattingPool {
+    const Doc* doc = nullptr;
+    HtmlFormatterArgs* formatterArgs = nullptr;
+    Vec<ChapterFormattingData*> chapters;
+    // one task per chapter
+    TaskGroup tasks;
+    // guards ChapterFormattingData::done
+    CRITICAL_SECTION access;
+    CONDITION_VARIABLE chapterFormatted;
+
+    ChapterFormattingPool() {
+        InitializeCriticalSection(&access);
+        InitializeConditionVariable(&chapterFormatted);
+    }
+    ~ChapterFormattingPool() {
+        for (ChapterFormattingData* chapter : chapters) {
+            DeleteVecMembers(chapter->pages);
+        }
+        DeleteVecMembers(chapters);
+        DeleteCriticalSection(&access);
+    }
 };
 
 class EbookFormattingThread : public ThreadBase {
@@ -97,9 +236,9 @@ class EbookFormattingThread : public ThreadBase {
     EbookController* controller = nullptr;
     ControllerCallback* cb = nullptr;
 
-    // state used during layout process
-    HtmlPage* pages[EbookFormattingData::MAX_PAGES]{};
-    int pageCount = 0;
+    // pages are added here, owned by the controller
+    EbookPageStream* stream = nullptr;
+    LARGE_INTEGER lastNotification{};
 
     // we want to send 2 pages after reparseIdx as soon as we have them,
     // so that we can show them to the user as quickly as possible
@@ -108,23 +247,27 @@ class EbookFormattingThread : public ThreadBase {
     int pagesAfterReparseIdx = 0;
 
   public:
-    void SendPagesIfNecessary(bool force, bool finished);
+    void NotifyPages(bool force, bool finished);
+    void AddPage(HtmlPage* pd);
+    void SendCancelled();
     bool Format();
+    bool FormatChapters(ChapterFormattingPool* pool);
 
-    EbookFormattingThread(const Doc& doc, HtmlFormatterArgs* args, EbookController* ctrl, int reparseIdx,
-                          ControllerCallback* cb);
+    EbookFormattingThread(const Doc& doc, HtmlFormatterArgs* args, EbookPageStream* stream, EbookController* ctrl,
+                          int reparseIdx, ControllerCallback* cb);
     virtual ~EbookFormattingThread();
 
     // ThreadBase
     void Run() override;
 };
 
-EbookFormattingThread::EbookFormattingThread(const Doc& doc, HtmlFormatterArgs* args, EbookController* ctrl,
-                                             int reparseIdx, ControllerCallback* cb) {
+EbookFormattingThread::EbookFormattingThread(const Doc& doc, HtmlFormatterArgs* args, EbookPageStream* stream,
+                                             EbookController* ctrl, int reparseIdx, ControllerCallback* cb) {
     this->doc = doc;
     this->cb = cb;
     this->controller = ctrl;
     this->formatterArgs = args;
+    this->stream = stream;
     this->reparseIdx = reparseIdx;
     CrashIf(reparseIdx < 0);
     CrashIf(!(doc.IsDocLoaded() || (doc.IsNone() && (!args->htmlStr.empty()))));
@@ -135,58 +278,158 @@ EbookFormattingThread::~EbookFormattingThread() {
     delete formatterArgs;
 }
 
-// send accumulated pages if we filled the buffer or the caller forces us
-void EbookFormattingThread::SendPagesIfNecessary(bool force, bool finished) {
-    if (finished) {
-        force = true;
+// tells the ui thread about newly added pages, unless it has been told recently
+// or is about to handle a previous notification (which will see the new pages as well)
+void EbookFormattingThread::NotifyPages(bool force, bool finished) {
+    if (!finished) {
+        if (!force && TimeSinceInMs(lastNotification) < PAGES_NOTIFICATION_INTERVAL_MS) {
+            return;
+        }
+        if (InterlockedExchange(&stream->notificationPending, 1) != 0) {
+            return;
+        }
     }
-    if (!force && (pageCount < dimof(pages))) {
+    lastNotification = TimeGet();
+    // lf("ThreadLayoutEbook::NotifyPages() %d pages, finished=%d", stream->size(), (int)finished);
+    cb->HandleLayoutedPages(controller, new EbookFormattingData(GetNo(), finished));
+}
+
+void EbookFormattingThread::AddPage(HtmlPage* pd) {
+    if (!stream->Append(pd)) {
+        delete pd;
         return;
     }
-    EbookFormattingData* msg = new EbookFormattingData(pages, pageCount, finished, GetNo());
-    // lf("ThreadLayoutEbook::SendPagesIfNecessary() sending %d pages, finished=%d", pageCount, (int)finished);
-    pageCount = 0;
-    memset(pages, 0, sizeof(pages));
-    cb->HandleLayoutedPages(controller, msg);
+    if (pd->reparseIdx >= reparseIdx) {
+        ++pagesAfterReparseIdx;
+    }
+    NotifyPages(2 == pagesAfterReparseIdx, false);
+}
+
+void EbookFormattingThread::SendCancelled() {
+    // lf("layout cancelled");
+    // send a 'finished' message so that the thread object gets deleted
+    NotifyPages(true, true /* finished */);
+}
+
+static void FormatChapter(ChapterFormattingPool* pool, ChapterFormattingData* chapter) {
+    // each task gets its own formatter (and thus its own textMeasure and Graphics)
+    HtmlFormatterArgs args;
+    args.pageDx = pool->formatterArgs->pageDx;
+    args.pageDy = pool->formatterArgs->pageDy;
+    args.SetFontName(pool->formatterArgs->GetFontName());
+    args.fontSize = pool->formatterArgs->fontSize;
+    args.textAllocator = pool->formatterArgs->textAllocator;
+    args.textRenderMethod = pool->formatterArgs->textRenderMethod;
+    args.htmlStr = pool->formatterArgs->htmlStr.subspan(chapter->start, chapter->end - chapter->start);
+    HtmlFormatter* formatter = pool->doc->CreateFormatter(&args);
+    for (HtmlPage* pd = formatter->Next(); pd; pd = formatter->Next()) {
+        // reparse points are relative to the chapter's html
+        pd->reparseIdx += (int)chapter->start;
+        chapter->pages.Append(pd);
+        if (pool->tasks.WasCancelRequested()) {
+            break;
+        }
+    }
+    delete formatter;
+
+    ScopedCritSec scope(&pool->access);
+    chapter->done = true;
+    WakeAllConditionVariable(&pool->chapterFormatted);
+}
+
+// formats the chapters of an EPUB document on the thread pool and
+// sends their pages in document order as soon as a chapter is complete
+// returns true if layout thread was cancelled
+bool EbookFormattingThread::FormatChapters(ChapterFormattingPool* pool) {
+    for (ChapterFormattingData* chapter : pool->chapters) {
+        pool->tasks.Run([pool, chapter] { FormatChapter(pool, chapter); });
+    }
+
+    bool cancelled = false;
+    for (ChapterFormattingData* chapter : pool->chapters) {
+        for (;;) {
+            {
+                ScopedCritSec scope(&pool->access);
+                if (chapter->done || cancelled) {
+                    break;
+                }
+            }
+            // format a chapter on this thread if no other pool thread has taken it yet
+            if (!pool->tasks.RunPending()) {
+                ScopedCritSec scope(&pool->access);
+                if (!chapter->done) {
+                    SleepConditionVariableCS(&pool->chapterFormatted, &pool->access, 100);
+                }
+            }
+            cancelled = WasCancelRequested();
+        }
+        if (cancelled || WasCancelRequested()) {
+            cancelled = true;
+            break;
+        }
+        for (HtmlPage* pd : chapter->pages) {
+            AddPage(pd);
+        }
+        chapter->pages.Reset();
+    }
+
+    pool->tasks.RequestCancel();
+    pool->tasks.Join();
+    if (cancelled) {
+        SendCancelled();
+        return true;
+    }
+    NotifyPages(true, true /* finished */);
+    return false;
+}
+
+static bool HasMultipleProcessors() {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 1;
 }
 
 // layout pages from a given reparse point (beginning if nullptr)
 // returns true if layout thread was cancelled
 bool EbookFormattingThread::Format() {
     // lf("Started laying out ebook, reparseIdx=%d", reparseIdx);
-    int totalPageCount = 0;
+    SLOW_OP("Ebook layout", doc.GetFilePath(), 0);
     formatterArgs->reparseIdx = 0;
     pagesAfterReparseIdx = 0;
+
+    if (DocType::Epub == doc.Type() && HasMultipleProcessors()) {
+        std::string_view html((const char*)formatterArgs->htmlStr.data(), formatterArgs->htmlStr.size());
+        ChapterFormattingPool pool;
+        size_t end = 0;
+        while (end < html.size()) {
+            size_t start = end;
+            end = html.find(EPUB_CHAPTER_MARKER, start + 1);
+            if (end == std::string_view::npos) {
+                end = html.size();
+            }
+            auto chapter = new ChapterFormattingData();
+            chapter->start = start;
+            chapter->end = end;
+            pool.chapters.Append(chapter);
+        }
+        if (pool.chapters.size() > 1) {
+            pool.doc = &doc;
+            pool.formatterArgs = formatterArgs;
+            return FormatChapters(&pool);
+        }
+    }
+
     HtmlFormatter* formatter = doc.CreateFormatter(formatterArgs);
     for (HtmlPage* pd = formatter->Next(); pd; pd = formatter->Next()) {
         if (WasCancelRequested()) {
-            // lf("layout cancelled");
-            for (int i = 0; i < pageCount; i++) {
-                delete pages[i];
-            }
-            pageCount = 0;
             delete pd;
-            // send a 'finished' message so that the thread object gets deleted
-            SendPagesIfNecessary(true, true /* finished */);
+            SendCancelled();
             delete formatter;
             return true;
         }
-        pages[pageCount++] = pd;
-        ++totalPageCount;
-        if (pd->reparseIdx >= reparseIdx) {
-            ++pagesAfterReparseIdx;
-        }
-        // force sending accumulated pages
-        bool force = false;
-        if (2 == pagesAfterReparseIdx) {
-            force = true;
-            // lf("EbookFormattingThread::Format: sending pages because pagesAfterReparseIdx == %d",
-            // pagesAfterReparseIdx);
-        }
-        SendPagesIfNecessary(force, false);
-        CrashIf(pageCount >= dimof(pages));
+        AddPage(pd);
     }
-    SendPagesIfNecessary(true, true /* finished */);
+    NotifyPages(true, true /* finished */);
     delete formatter;
     return false;
 }
@@ -197,12 +440,7 @@ void EbookFormattingThread::Run() {
     // lf("Formatting time: %.2f ms", t.Stop());
 }
 
-static void DeletePages(Vec<HtmlPage*>** toDeletePtr) {
-    if (!*toDeletePtr) {
-        return;
-    }
-
-    DeleteVecMembers(**toDeletePtr);
+static void DeletePages(EbookPageStream** toDeletePtr) {
     delete *toDeletePtr;
     *toDeletePtr = nullptr;
 }
@@ -252,7 +490,31 @@ void EbookController::StopFormattingThread() {
     delete formattingThread;
     formattingThread = nullptr;
     formattingThreadNo = -1;
-    DeletePages(&incomingPages);
+    CacheLayout(&incomingPages);
+}
+
+// keeps a finished layout around so that TriggerLayout can switch back to it
+void EbookController::CacheLayout(EbookPageStream** pagesPtr) {
+    EbookPageStream* stream = *pagesPtr;
+    *pagesPtr = nullptr;
+    if (!stream || !stream->finished) {
+        delete stream;
+        return;
+    }
+    cachedLayouts.Append(stream);
+    if (cachedLayouts.size() > MAX_CACHED_LAYOUTS) {
+        delete cachedLayouts.PopAt(0);
+    }
+}
+
+// returns a previously finished layout for args (if there is one)
+EbookPageStream* EbookController::TakeCachedLayout(HtmlFormatterArgs* args) {
+    for (size_t i = 0; i < cachedLayouts.size(); i++) {
+        if (cachedLayouts.at(i)->HasLayout(args)) {
+            return cachedLayouts.PopAt(i);
+        }
+    }
+    return nullptr;
 }
 
 void EbookController::CloseCurrentDocument() {
@@ -260,6 +522,7 @@ void EbookController::CloseCurrentDocument() {
     ctrls->pagesLayout->GetPage2()->SetPage(nullptr);
     StopFormattingThread();
     DeletePages(&pages);
+    DeleteVecMembers(cachedLayouts);
     doc.Delete();
     pageSize = Size(0, 0);
 }
@@ -268,7 +531,7 @@ void EbookController::CloseCurrentDocument() {
 // page is in 1..$pageCount range to match currPageNo
 // returns 0 if not found (or maybe on the last page)
 // returns -1 if no pages are available
-static int PageForReparsePoint(Vec<HtmlPage*>* pages, int reparseIdx) {
+static int PageForReparsePoint(EbookPageStream* pages, int reparseIdx) {
     if (!pages || pages->size() == 0) {
         return -1;
     }
@@ -279,27 +542,22 @@ static int PageForReparsePoint(Vec<HtmlPage*>* pages, int reparseIdx) {
         return 1;
     }
 
-    for (size_t i = 0; i < pages->size(); i++) {
+    int pageCount = pages->size();
+    for (int i = 0; i < pageCount; i++) {
         HtmlPage* pd = pages->at(i);
         if (pd->reparseIdx == reparseIdx) {
-            return (int)i + 1;
+            return i + 1;
         }
         // this is the first page whose content is after reparseIdx, so
         // the page contining reparseIdx must be the one before
         if (pd->reparseIdx > reparseIdx) {
             CrashIf(0 == i);
-            return (int)i;
+            return i;
         }
     }
     return 0;
 }
 
-// gets pages as formatted from beginning, either from a temporary state
-// when layout is in progress or final formatted pages
-Vec<HtmlPage*>* EbookController::GetPages() {
-    return pages;
-}
-
 void EbookController::HandlePagesFromEbookLayout(EbookFormattingData* ft) {
     if (formattingThreadNo != ft->threadNo) {
         // this is a message from cancelled thread, we can disregard
@@ -309,34 +567,30 @@ void EbookController::HandlePagesFromEbookLayout(EbookFormattingData* ft) {
         DeleteEbookFormattingData(ft);
         return;
     }
-    // lf("EbookController::HandlePagesFromEbookLayout() %d pages, ft=0x%x", ft->pageCount, (int)ft);
+    // the formatting thread appends to incomingPages until they've replaced pages
+    EbookPageStream* stream = incomingPages ? incomingPages : pages;
+    CrashIf(!stream);
+    // lf("EbookController::HandlePagesFromEbookLayout() %d pages, ft=0x%x", stream->size(), (int)ft);
+    // pages added from now on need another notification
+    InterlockedExchange(&stream->notificationPending, 0);
     if (incomingPages) {
-        for (size_t i = 0; i < ft->pageCount; i++) {
-            incomingPages->Append(ft->pages[i]);
-        }
         int pageNo = PageForReparsePoint(incomingPages, currPageReparseIdx);
         if (pageNo > 0) {
-            Vec<HtmlPage*>* toDelete = pages;
+            EbookPageStream* toDelete = pages;
             pages = incomingPages;
             incomingPages = nullptr;
-            DeletePages(&toDelete);
+            CacheLayout(&toDelete);
             GoToPage(pageNo, false);
         }
-    } else {
-        CrashIf(!pages);
-        for (size_t i = 0; i < ft->pageCount; i++) {
-            pages->Append(ft->pages[i]);
-        }
     }
 
     if (ft->finished) {
         CrashIf(!pages);
+        stream->finished = true;
         StopFormattingThread();
     }
     UpdateStatus();
-    // don't call DeleteEbookFormattingData since
-    // ft->pages are now owned by incomingPages or pages
-    delete ft;
+    DeleteEbookFormattingData(ft);
 }
 
 void EbookController::TriggerLayout() {
@@ -362,10 +616,23 @@ void EbookController::TriggerLayout() {
 
     StopFormattingThread();
     CrashIf(incomingPages);
-    incomingPages = new Vec<HtmlPage*>(1024);
 
-    HtmlFormatterArgs* args = CreateFormatterArgsDoc(doc, size.dx, size.dy, &textAllocator);
-    formattingThread = new EbookFormattingThread(doc, args, this, currPageReparseIdx, cb);
+    HtmlFormatterArgs* args = CreateFormatterArgsDoc(doc, size.dx, size.dy);
+    EbookPageStream* cached = TakeCachedLayout(args);
+    if (cached) {
+        // lf("EbookController::TriggerLayout() - re-using a cached layout");
+        delete args;
+        CacheLayout(&pages);
+        pages = cached;
+        int pageNo = PageForReparsePoint(pages, currPageReparseIdx);
+        GoToPage(pageNo > 0 ? pageNo : pages->size(), false);
+        return;
+    }
+
+    incomingPages = new EbookPageStream();
+    incomingPages->SetLayout(args);
+    args->textAllocator = &incomingPages->allocator;
+    formattingThread = new EbookFormattingThread(doc, args, incomingPages, this, currPageReparseIdx, cb);
     formattingThreadNo = formattingThread->GetNo();
     formattingThread->Start();
     UpdateStatus();
@@ -404,7 +671,7 @@ void EbookController::ClickedProgress(Control* c, int x, int y) {
     UNUSED(y);
     CrashIf(c != ctrls->progress);
     float perc = ctrls->progress->GetPercAt(x);
-    int pageCount = (int)GetPages()->size();
+    int pageCount = GetMaxPageCount();
     int newPageNo = IntFromPerc(pageCount, perc) + 1;
     GoToPage(newPageNo, true);
 }
@@ -419,7 +686,7 @@ void EbookController::OnClickedLink(int pageNo, DrawInstr* link) {
         return;
     }
 
-    if (DocType::Epub == doc.Type() && pages && (size_t)pageNo <= pages->size()) {
+    if (DocType::Epub == doc.Type() && pages && pageNo <= pages->size()) {
         // normalize the URL by combining it with the chapter's base path
         for (int j = pageNo; j > 0; j--) {
             HtmlPage* p = pages->at(j - 1);
@@ -473,7 +740,7 @@ void EbookController::ClickedPage2(Control* c, int x, int y) {
 }
 
 int EbookController::GetMaxPageCount() const {
-    Vec<HtmlPage*>* pagesTmp = pages;
+    EbookPageStream* pagesTmp = pages;
     if (incomingPages) {
         CrashIf(!FormattingInProgress());
         pagesTmp = incomingPages;
@@ -481,7 +748,25 @@ int EbookController::GetMaxPageCount() const {
     if (!pagesTmp) {
         return 0;
     }
-    return (int)pagesTmp->size();
+    return pagesTmp->size();
+}
+
+size_t EbookController::GetLayoutMemoryUsage(int* nLayoutsOut) const {
+    Vec<EbookPageStream*> layouts(cachedLayouts);
+    if (pages) {
+        layouts.Append(pages);
+    }
+    if (incomingPages && incomingPages != pages) {
+        layouts.Append(incomingPages);
+    }
+    size_t total = 0;
+    for (EbookPageStream* layout : layouts) {
+        total += layout->allocator.MemoryUsage();
+    }
+    if (nLayoutsOut) {
+        *nLayoutsOut = layouts.isize();
+    }
+    return total;
 }
 
 // show the status text based on current state
@@ -499,7 +784,7 @@ void EbookController::UpdateStatus() {
 #if 1
     ctrls->progress->SetFilled(PercFromInt(pageCount, currPageNo));
 #else
-    if (GetPages())
+    if (pages)
         ctrls->progress->SetFilled(PercFromInt(pageCount, currPageNo));
     else
         ctrls->progress->SetFilled(0.f);
@@ -997,8 +1282,6 @@ EbookController* EbookController::Create(const Doc& doc, HWND hwnd, ControllerCa
 }
 
 // not a destructor so that EbookFormattingData don't have to be exposed in EbookController.h
-// and so that EbookFormattingData::pages aren't always deleted (when ownership has been passed on)
 void EbookController::DeleteEbookFormattingData(EbookFormattingData* data) {
-    data->DeletePages();
     delete data;
 }
@@ -4,6 +4,7 @@
 struct DrawInstr;
 struct EbookControls;
 struct EbookFormattingData;
+struct EbookPageStream;
 struct FrameRateWnd;
 
 struct EbookController;
@@ -93,6 +94,8 @@ struct EbookController : Controller {
     int ResolvePageAnchor(const WCHAR* id);
     void CopyNavHistory(EbookController& orig);
     int CurrentTocPageNo() const;
+    // memory used by the draw instructions of the current and cached layouts
+    size_t GetLayoutMemoryUsage(int* nLayoutsOut = nullptr) const;
 
     // call StartLayouting before using this EbookController
     static EbookController* Create(const Doc& doc, HWND hwnd, ControllerCallback* cb, FrameRateWnd*);
@@ -104,14 +107,14 @@ struct EbookController : Controller {
     TocTree* tocTree = nullptr;
     Doc doc;
 
-    // TODO: this should be recycled along with pages so that its
-    // memory use doesn't grow without bounds
-    PoolAllocator textAllocator;
+    EbookPageStream* pages = nullptr;
 
-    Vec<HtmlPage*>* pages = nullptr;
+    // pages being added by background formatting thread
+    // (replace pages once they include currPageReparseIdx)
+    EbookPageStream* incomingPages = nullptr;
 
-    // pages being sent from background formatting thread
-    Vec<HtmlPage*>* incomingPages = nullptr;
+    // recently used finished layouts, oldest first
+    Vec<EbookPageStream*> cachedLayouts;
 
     // currPageNo is in range 1..$numberOfPages.
     int currPageNo = 0;
@@ -134,12 +137,13 @@ struct EbookController : Controller {
     Vec<int> navHistory;
     size_t navHistoryIdx = 0;
 
-    Vec<HtmlPage*>* GetPages();
     void UpdateStatus();
     bool FormattingInProgress() const {
         return formattingThread != nullptr;
     }
     void StopFormattingThread();
+    void CacheLayout(EbookPageStream** pagesPtr);
+    EbookPageStream* TakeCachedLayout(HtmlFormatterArgs* args);
     void CloseCurrentDocument();
     int GetMaxPageCount() const;
     bool IsDoublePage() const;
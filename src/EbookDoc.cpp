@@ -108,6 +108,14 @@ static char* DecodeTextToUtf8(const char* s, bool isXML = false) {
     return (char*)tmp2.data();
 }
 
+// returns true if DecodeTextToUtf8(s, true) would return a copy of s
+static bool IsUtf8Html(const char* s) {
+    if (str::StartsWith(s, UTF16BE_BOM) || str::StartsWith(s, UTF16_BOM) || str::StartsWith(s, UTF8_BOM)) {
+        return false;
+    }
+    return CP_ACP == GetCodepageFromPI(s) && IsValidUtf8(s);
+}
+
 char* NormalizeURL(const char* url, const char* base) {
     CrashIf(!url || !base);
     if (*url == '/' || str::FindChar(url, ':')) {
@@ -150,57 +158,93 @@ char* NormalizeURL(const char* url, const char* base) {
     return norm.Release();
 }
 
-inline char decode64(char c) {
-    if ('A' <= c && c <= 'Z') {
-        return c - 'A';
-    }
-    if ('a' <= c && c <= 'z') {
-        return c - 'a' + 26;
-    }
-    if ('0' <= c && c <= '9') {
-        return c - '0' + 52;
-    }
-    if ('+' == c) {
-        return 62;
-    }
-    if ('/' == c) {
-        return 63;
+#define B64_WS 0xFE
+#define B64_INVALID 0xFF
+
+// maps base64 characters to their 6-bit values
+struct Base64Table {
+    u8 vals[256];
+
+    constexpr Base64Table() : vals() {
+        for (int i = 0; i < 256; i++) {
+            vals[i] = B64_INVALID;
+        }
+        for (int i = 0; i < 26; i++) {
+            vals['A' + i] = (u8)i;
+            vals['a' + i] = (u8)(26 + i);
+        }
+        for (int i = 0; i < 10; i++) {
+            vals['0' + i] = (u8)(52 + i);
+        }
+        vals['+'] = 62;
+        vals['/'] = 63;
+        // same as str::IsWs
+        const char* ws = " \t\n\v\f\r";
+        for (; *ws; ws++) {
+            vals[(u8)*ws] = B64_WS;
+        }
     }
-    return -1;
-}
+};
+
+static constexpr Base64Table gBase64Table;
 
 static char* Base64Decode(const char* s, size_t sLen, size_t* lenOut) {
-    const char* end = s + sLen;
+    const u8* src = (const u8*)s;
+    const u8* end = src + sLen;
+    const u8* vals = gBase64Table.vals;
     char* result = AllocArray<char>(sLen * 3 / 4);
     char* curr = result;
-    u8 c = 0;
-    int step = 0;
-    for (; s < end && *s != '='; s++) {
-        char n = decode64(*s);
-        if (-1 == n) {
-            if (str::IsWs(*s)) {
-                continue;
+    u32 bits = 0;
+    int nBits = 0;
+    while (src < end) {
+        if (0 == nBits) {
+            // decode blocks of 4 characters at once until a line break or the end
+            while (end - src >= 4) {
+                u32 a = vals[src[0]], b = vals[src[1]], c = vals[src[2]], d = vals[src[3]];
+                if ((a | b | c | d) & 0x80) {
+                    break;
+                }
+                u32 v = (a << 18) | (b << 12) | (c << 6) | d;
+                curr[0] = (char)(v >> 16);
+                curr[1] = (char)(v >> 8);
+                curr[2] = (char)v;
+                curr += 3;
+                src += 4;
+            }
+            if (src == end) {
+                break;
             }
+        }
+        u8 c = *src++;
+        if ('=' == c) {
+            break;
+        }
+        u8 n = vals[c];
+        if (B64_WS == n) {
+            continue;
+        }
+        if (B64_INVALID == n) {
             free(result);
             return nullptr;
         }
-        switch (step++ % 4) {
-            case 0:
-                c = n;
-                break;
-            case 1:
-                *curr++ = (c << 2) | (n >> 4);
-                c = n & 0xF;
-                break;
-            case 2:
-                *curr++ = (c << 4) | (n >> 2);
-                c = n & 0x3;
-                break;
-            case 3:
-                *curr++ = (c << 6) | (n >> 0);
-                break;
+        bits = (bits << 6) | n;
+        nBits += 6;
+        if (24 == nBits) {
+            curr[0] = (char)(bits >> 16);
+            curr[1] = (char)(bits >> 8);
+            curr[2] = (char)bits;
+            curr += 3;
+            bits = 0;
+            nBits = 0;
         }
     }
+    // incomplete last block
+    if (12 == nBits) {
+        *curr++ = (char)(bits >> 4);
+    } else if (18 == nBits) {
+        *curr++ = (char)(bits >> 10);
+        *curr++ = (char)(bits >> 2);
+    }
     if (lenOut) {
         *lenOut = curr - result;
     }
@@ -457,9 +501,16 @@ bool EpubDoc::Load() {
         if (!html.data) {
             continue;
         }
-        char* decoded = DecodeTextToUtf8(html.data, true);
-        html.TakeOwnershipOf(decoded);
-        if (!html.data) {
+        // most chapters are UTF-8 already and are appended without converting (i.e. copying) them
+        const char* utf8 = html.data;
+        if (str::StartsWith(utf8, UTF8_BOM)) {
+            utf8 += 3;
+        } else if (!IsUtf8Html(utf8)) {
+            char* decoded = DecodeTextToUtf8(html.data, true);
+            html.TakeOwnershipOf(decoded);
+            utf8 = html.data;
+        }
+        if (!utf8) {
             continue;
         }
         // insert explicit page-breaks between sections including
@@ -468,12 +519,95 @@ bool EpubDoc::Load() {
         DebugCrashIf(str::FindChar(utf8_path.Get(), '"'));
         str::TransChars(utf8_path.Get(), "\"", "'");
         htmlData.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", utf8_path.Get());
-        htmlData.Append(html.data);
+        htmlData.Append(utf8);
     }
 
     return htmlData.size() > 0;
 }
 
+static std::span<u8> LoadEpubCoverImage(MultiFormatArchive* zip) {
+    AutoFree container(zip->GetFileDataByName("META-INF/container.xml"));
+    if (!container.data) {
+        return {};
+    }
+    HtmlParser parser;
+    HtmlElement* node = parser.ParseInPlace(container.AsSpan());
+    if (!node) {
+        return {};
+    }
+    node = parser.FindElementByNameNS("rootfile", EPUB_CONTAINER_NS);
+    if (!node) {
+        return {};
+    }
+    AutoFreeWstr contentPath(node->GetAttribute("full-path"));
+    if (!contentPath) {
+        return {};
+    }
+    url::DecodeInPlace(contentPath);
+
+    AutoFree content(zip->GetFileDataByName(contentPath));
+    if (!content.data) {
+        return {};
+    }
+    node = parser.ParseInPlace(content.AsSpan());
+    if (!node) {
+        return {};
+    }
+
+    // EPUB 2 references the cover's manifest item through <meta name="cover" content="...">
+    AutoFreeWstr coverId;
+    for (node = parser.FindElementByNameNS("meta", EPUB_OPF_NS); node && !coverId;
+         node = parser.FindElementByNameNS("meta", EPUB_OPF_NS, node)) {
+        AutoFreeWstr name(node->GetAttribute("name"));
+        if (str::Eq(name, L"cover")) {
+            coverId.Set(node->GetAttribute("content"));
+        }
+    }
+
+    node = parser.FindElementByNameNS("manifest", EPUB_OPF_NS);
+    if (!node) {
+        return {};
+    }
+    AutoFreeWstr imgPath;
+    for (node = node->down; node && !imgPath; node = node->next) {
+        AutoFreeWstr mediatype(node->GetAttribute("media-type"));
+        if (!isImageMediaType(mediatype)) {
+            continue;
+        }
+        // EPUB 3 marks the cover with properties="cover-image"
+        AutoFreeWstr properties(node->GetAttribute("properties"));
+        AutoFreeWstr id(node->GetAttribute("id"));
+        if ((properties && str::Find(properties, L"cover-image")) || (coverId && str::Eq(id, coverId))) {
+            imgPath.Set(node->GetAttribute("href"));
+        }
+    }
+    if (!imgPath) {
+        return {};
+    }
+    url::DecodeInPlace(imgPath);
+
+    WCHAR* slashPos = str::FindCharLast(contentPath, '/');
+    if (slashPos) {
+        *(slashPos + 1) = '\0';
+    } else {
+        *contentPath = '\0';
+    }
+    AutoFreeWstr fullPath = str::Join(contentPath, imgPath);
+    return zip->GetFileDataByName(fullPath);
+}
+
+// returns the cover image (if the document declares one) without
+// loading and concatenating the document's content as Load() does
+std::span<u8> EpubDoc::LoadCoverImage(IStream* stream) {
+    MultiFormatArchive* zip = OpenZipArchive(stream, true);
+    if (!zip) {
+        return {};
+    }
+    auto res = LoadEpubCoverImage(zip);
+    delete zip;
+    return res;
+}
+
 void EpubDoc::ParseMetadata(const char* content) {
     struct {
         DocumentProperty prop;
@@ -769,17 +903,21 @@ const char* FB2_MAIN_NS = "http://www.gribuser.ru/xml/fictionbook/2.0";
 const char* FB2_XLINK_NS = "http://www.w3.org/1999/xlink";
 
 Fb2Doc::Fb2Doc(const WCHAR* fileName) : fileName(str::Dup(fileName)) {
+    InitializeCriticalSection(&imagesAccess);
 }
 
 Fb2Doc::Fb2Doc(IStream* stream) : fileName(nullptr), stream(stream) {
     stream->AddRef();
+    InitializeCriticalSection(&imagesAccess);
 }
 
 Fb2Doc::~Fb2Doc() {
     for (size_t i = 0; i < images.size(); i++) {
         free(images.at(i).base.data);
         free(images.at(i).fileName);
+        free((void*)imagesBase64.at(i).data());
     }
+    DeleteCriticalSection(&imagesAccess);
     if (stream) {
         stream->Release();
     }
@@ -965,25 +1103,34 @@ void Fb2Doc::ExtractImage(HtmlPullParser* parser, HtmlToken* tok) {
         return;
     }
 
+    // images are only decoded when needed (cf. GetImageData), which
+    // speeds up loading and saves memory for images that are never shown
     ImageData2 data = {0};
-    data.base.data = Base64Decode(tok->s, tok->sLen, &data.base.len);
-    if (!data.base.data) {
-        return;
-    }
     data.fileName = str::Join("#", id);
     data.fileId = images.size();
     images.Append(data);
+    imagesBase64.Append(std::string_view(str::DupN(tok->s, tok->sLen), tok->sLen));
 }
 
 std::span<u8> Fb2Doc::GetXmlData() const {
     return {(u8*)xmlData.Get(), xmlData.size()};
 }
 
+// can be called from several formatting threads at once
 ImageData* Fb2Doc::GetImageData(const char* fileName) {
     for (size_t i = 0; i < images.size(); i++) {
-        if (str::Eq(images.at(i).fileName, fileName)) {
-            return &images.at(i).base;
+        if (!str::Eq(images.at(i).fileName, fileName)) {
+            continue;
+        }
+        ImageData* img = &images.at(i).base;
+        ScopedCritSec scope(&imagesAccess);
+        std::string_view& base64 = imagesBase64.at(i);
+        if (base64.data()) {
+            img->data = Base64Decode(base64.data(), base64.size(), &img->len);
+            free((void*)base64.data());
+            base64 = {};
         }
+        return img->data ? img : nullptr;
     }
     return nullptr;
 }
@@ -58,6 +58,7 @@ class EpubDoc {
 
     static EpubDoc* CreateFromFile(const WCHAR* path);
     static EpubDoc* CreateFromStream(IStream* stream);
+    static std::span<u8> LoadCoverImage(IStream* stream);
 };
 
 /* ********** FictionBook (FB2) ********** */
@@ -71,6 +72,9 @@ class Fb2Doc {
 
     str::Str xmlData;
     Vec<ImageData2> images;
+    // base64 encoded data for images until they're decoded (parallel to images)
+    Vec<std::string_view> imagesBase64;
+    CRITICAL_SECTION imagesAccess;
     AutoFree coverImage;
     PropertyMap props;
     bool isZipped = false;
@@ -4,6 +4,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
 #include "utils/WinUtil.h"
 #include "utils/Log.h"
 
@@ -21,6 +22,10 @@ void FreePageText(PageText* pageText) {
 }
 
 RenderedBitmap::~RenderedBitmap() {
+    if (isPooled) {
+        ReleasePooledDib(hbmp, hMap.Detach(), size);
+        return;
+    }
     DeleteObject(hbmp);
 }
 
@@ -43,6 +48,114 @@ Size RenderedBitmap::Size() const {
     return size;
 }
 
+#define MAX_POOLED_DIBS 16
+#define MAX_POOLED_DIBS_SIZE (64 * 1024 * 1024)
+
+struct PooledDib {
+    HBITMAP hbmp;
+    HANDLE hMap;
+    void* bits;
+    Size size;
+};
+
+static Mutex gDibPoolMutex;
+// least recently released first
+static Vec<PooledDib> gDibPool;
+static size_t gDibPoolSize = 0;
+
+static size_t GetDibSize(Size size) {
+    return (size_t)size.dx * (size_t)size.dy * 4;
+}
+
+static HBITMAP NewDib(Size size, void** bits, HANDLE* hMap) {
+    BITMAPINFO bmi{};
+    BITMAPINFOHEADER* bmih = &bmi.bmiHeader;
+    bmih->biSize = sizeof(*bmih);
+    bmih->biWidth = size.dx;
+    bmih->biHeight = -size.dy;
+    bmih->biPlanes = 1;
+    bmih->biCompression = BI_RGB;
+    bmih->biBitCount = 32;
+    bmih->biSizeImage = (DWORD)GetDibSize(size);
+
+    *hMap = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, bmih->biSizeImage, nullptr);
+    HBITMAP hbmp = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, bits, *hMap, 0);
+    if (!hbmp || !*bits) {
+        DeleteObject(hbmp);
+        SafeCloseHandle(hMap);
+        return nullptr;
+    }
+    return hbmp;
+}
+
+// must be called with gDibPoolMutex locked
+static void FreePooledDibAt(size_t idx) {
+    PooledDib dib = gDibPool.at(idx);
+    gDibPool.RemoveAt(idx);
+    gDibPoolSize -= GetDibSize(dib.size);
+    DeleteObject(dib.hbmp);
+    CloseHandle(dib.hMap);
+}
+
+HBITMAP AllocPooledDib(Size size, void** bits, HANDLE* hMap) {
+    *bits = nullptr;
+    *hMap = nullptr;
+    if (size.dx <= 0 || size.dy <= 0 || GetDibSize(size) > INT_MAX) {
+        return nullptr;
+    }
+    {
+        ScopedCritSec scope(&gDibPoolMutex.cs);
+        // the most recently released DIB section is the most likely to still be in memory
+        for (size_t i = gDibPool.size(); i > 0; i--) {
+            PooledDib dib = gDibPool.at(i - 1);
+            if (dib.size == size) {
+                gDibPool.RemoveAt(i - 1);
+                gDibPoolSize -= GetDibSize(size);
+                *bits = dib.bits;
+                *hMap = dib.hMap;
+                return dib.hbmp;
+            }
+        }
+    }
+    HBITMAP hbmp = NewDib(size, bits, hMap);
+    if (!hbmp) {
+        // the pooled DIB sections might be what's exhausting the GDI resources
+        FreeDibPool();
+        hbmp = NewDib(size, bits, hMap);
+    }
+    return hbmp;
+}
+
+void ReleasePooledDib(HBITMAP hbmp, HANDLE hMap, Size size) {
+    if (!hbmp) {
+        SafeCloseHandle(&hMap);
+        return;
+    }
+    DIBSECTION info{};
+    size_t dibSize = GetDibSize(size);
+    bool canPool = dibSize <= MAX_POOLED_DIBS_SIZE / 4 && GetObject(hbmp, sizeof(info), &info) == sizeof(info);
+    if (!canPool) {
+        DeleteObject(hbmp);
+        SafeCloseHandle(&hMap);
+        return;
+    }
+
+    ScopedCritSec scope(&gDibPoolMutex.cs);
+    while (gDibPool.size() > 0 &&
+           (gDibPool.size() >= MAX_POOLED_DIBS || gDibPoolSize + dibSize > MAX_POOLED_DIBS_SIZE)) {
+        FreePooledDibAt(0);
+    }
+    gDibPool.Append({hbmp, hMap, info.dsBm.bmBits, size});
+    gDibPoolSize += dibSize;
+}
+
+void FreeDibPool() {
+    ScopedCritSec scope(&gDibPoolMutex.cs);
+    while (gDibPool.size() > 0) {
+        FreePooledDibAt(gDibPool.size() - 1);
+    }
+}
+
 Kind kindPageElementDest = "dest";
 Kind kindPageElementImage = "image";
 Kind kindPageElementComment = "comment";
@@ -187,6 +300,7 @@ IPageElement* PageElement::Clone() {
     res->rect = rect;
     res->value = str::Dup(value);
     res->dest = clonePageDestination(dest);
+    res->imageID = imageID;
     return res;
 }
 
@@ -343,6 +457,13 @@ TreeItem* TocItem::ChildAt(int n) {
     return node;
 }
 
+// walks the list once instead of calling the O(n) ChildAt() n times
+void TocItem::GetChildren(Vec<TreeItem*>& v) {
+    for (auto node = child; node; node = node->next) {
+        v.Append(node);
+    }
+}
+
 bool TocItem::IsExpanded() {
     // leaf items cannot be expanded
     if (child == nullptr) {
@@ -375,9 +496,37 @@ TocTree::TocTree(TocItem* root) {
 }
 
 TocTree::~TocTree() {
+    delete itemsByPage;
     delete root;
 }
 
+TocItem* TocTree::FindItemForPageNo(int pageNo) {
+    if (!itemsByPage) {
+        itemsByPage = new Vec<TocItem*>();
+        VisitTocTree(root, [this](TocItem* ti) {
+            if (ti->pageNo >= 1) {
+                itemsByPage->Append(ti);
+            }
+            return true;
+        });
+        std::stable_sort(itemsByPage->begin(), itemsByPage->end(),
+                         [](TocItem* a, TocItem* b) { return a->pageNo < b->pageNo; });
+    }
+
+    auto cmp = [](int pageNo, TocItem* ti) { return pageNo < ti->pageNo; };
+    auto it = std::upper_bound(itemsByPage->begin(), itemsByPage->end(), pageNo, cmp);
+    if (it == itemsByPage->begin()) {
+        return root;
+    }
+    TocItem* last = *(it - 1);
+    if (last->pageNo < pageNo) {
+        return last;
+    }
+    // exact match: the first item (in tree order) for this page
+    auto cmpLower = [](TocItem* ti, int pageNo) { return ti->pageNo < pageNo; };
+    return *std::lower_bound(itemsByPage->begin(), it, pageNo, cmpLower);
+}
+
 int TocTree::RootCount() {
     int n = 0;
     auto node = root;
@@ -397,6 +546,12 @@ TreeItem* TocTree::RootAt(int n) {
     return node;
 }
 
+void TocTree::GetRoots(Vec<TreeItem*>& v) {
+    for (auto node = root; node; node = node->next) {
+        v.Append(node);
+    }
+}
+
 TocTree* CloneTocTree(TocTree* tree, bool removeUnchecked) {
     TocTree* res = new TocTree();
     res->root = CloneTocItemRecur(tree->root, removeUnchecked);
@@ -532,6 +687,28 @@ const WCHAR* EngineBase::FileName() const {
     return fileNameBase.Get();
 }
 
+bool EngineBase::RenderPageToDC(HDC, RenderPageArgs&, Point) {
+    return false;
+}
+
+bool EngineBase::HasDeferredPageElements(int) {
+    return false;
+}
+
+void EngineBase::LoadPageElements(int) {
+}
+
+void EngineBase::ReleaseCachedResources() {
+}
+
+std::span<u8> EngineBase::BorrowFileData() {
+    return {};
+}
+
+size_t EngineBase::GetMemoryUsage() {
+    return 0;
+}
+
 RenderedBitmap* EngineBase::GetImageForPageElement(IPageElement*) {
     CrashMe();
     return nullptr;
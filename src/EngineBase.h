@@ -48,6 +48,8 @@ class RenderedBitmap {
     HBITMAP hbmp = nullptr;
     Size size = {};
     AutoCloseHandle hMap = {};
+    // set if hbmp came from AllocPooledDib (it's then returned to the pool when deleted)
+    bool isPooled = false;
 
     RenderedBitmap(HBITMAP hbmp, Size size, HANDLE hMap = nullptr) : hbmp(hbmp), size(size), hMap(hMap) {
     }
@@ -58,6 +60,14 @@ class RenderedBitmap {
     bool StretchDIBits(HDC hdc, Rect target) const;
 };
 
+// rendered tiles mostly have the same few sizes, so freed 32-bit top-down DIB sections
+// (and their file mappings) are kept for reuse instead of creating new GDI objects
+// for every tile. bits receives the DIB section's pixels (which aren't cleared)
+HBITMAP AllocPooledDib(Size size, void** bits, HANDLE* hMap);
+// returns a DIB section from AllocPooledDib to the pool (or frees it, if the pool is full)
+void ReleasePooledDib(HBITMAP hbmp, HANDLE hMap, Size size);
+void FreeDibPool();
+
 extern Kind kindDestinationNone;
 extern Kind kindDestinationScrollTo;
 extern Kind kindDestinationLaunchURL;
@@ -243,6 +253,7 @@ struct TocItem : TreeItem {
     TreeItem* Parent() override;
     int ChildCount() override;
     TreeItem* ChildAt(int n) override;
+    void GetChildren(Vec<TreeItem*>& v) override;
     bool IsExpanded() override;
     bool IsChecked() override;
     WCHAR* Text() override;
@@ -254,14 +265,22 @@ TocItem* CloneTocItemRecur(TocItem*, bool);
 
 struct TocTree : TreeModel {
     TocItem* root = nullptr;
+    // items with a page, sorted by page and then in tree order
+    // (built on first use by FindItemForPageNo)
+    Vec<TocItem*>* itemsByPage = nullptr;
 
     TocTree() = default;
     TocTree(TocItem* root);
     ~TocTree() override;
 
+    // the first item for pageNo or else the last item for the closest page
+    // before it (or root if there's no such item)
+    TocItem* FindItemForPageNo(int pageNo);
+
     // TreeModel
     int RootCount() override;
     TreeItem* RootAt(int n) override;
+    void GetRoots(Vec<TreeItem*>& v) override;
 };
 
 TocTree* CloneTocTree(TocTree*, bool removeUnchecked);
@@ -287,6 +306,9 @@ struct RenderPageArgs {
     RectF* pageRect = nullptr;
     RenderTarget target = RenderTarget::View;
     AbortCookie** cookie_out = nullptr;
+    // faster rendering at a lower quality, while the user is scrolling or zooming
+    // (engines which can't render faster just ignore this, see RenderCache)
+    bool isDraft = false;
 
     RenderPageArgs(int pageNo, float zoom, int rotation, RectF* pageRect = nullptr,
                    RenderTarget target = RenderTarget::View, AbortCookie** cookie_out = nullptr);
@@ -327,6 +349,11 @@ class EngineBase {
     // renders a page into a cacheable RenderedBitmap
     // (*cookie_out must be deleted after the call returns)
     virtual RenderedBitmap* RenderPage(RenderPageArgs& args) = 0;
+    // draws a page onto hdc as vector graphics (e.g. for printing), with the top-left
+    // corner of the page where RenderPage's bitmap would be at offset; returns false
+    // if the page can't be drawn that way and has to be rendered with RenderPage
+    // (if hdc is nullptr, only checks whether the page could be drawn)
+    virtual bool RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset);
 
     // applies zoom and rotation to a point in user/page space converting
     // it into device/screen space - or in the inverse direction
@@ -337,6 +364,11 @@ class EngineBase {
     // (e.g. for saving again when the file has already been deleted)
     // caller needs to free() the result
     virtual std::span<u8> GetFileData() = 0;
+    // returns the binary data for the current file without copying it, if the engine
+    // already holds all of it in memory (e.g. for mapped files or in-memory streams)
+    // the data must not be modified or freed and is valid as long as the engine is
+    // returns an empty span if GetFileData would have to read or copy the data
+    virtual std::span<u8> BorrowFileData();
 
     // saves a copy of the current file under a different name (overwriting an existing file)
     // (includeUserAnnots only has an effect if SupportsAnnotation(true) returns true)
@@ -348,7 +380,9 @@ class EngineBase {
     // extracts all text found in the given page (and optionally also the
     // coordinates of the individual glyphs)
     // caller needs to free() the result and *coordsOut (if coordsOut is non-nullptr)
-    virtual PageText ExtractPageText(int pageNo) = 0;
+    // like for RenderPage, the extraction can be aborted through *cookie_out (if the
+    // engine supports that), in which case the result is empty. caller must delete *cookie_out
+    virtual PageText ExtractPageText(int pageNo, AbortCookie** cookie_out = nullptr) = 0;
     // pages where clipping doesn't help are rendered in larger tiles
     virtual bool HasClipOptimizations(int pageNo) = 0;
 
@@ -378,12 +412,18 @@ class EngineBase {
     // caller must delete the result
     virtual IPageElement* GetElementAtPos(int pageNo, PointF pt) = 0;
 
+    // engines may load a page's elements only after it's been rendered, so that
+    // rendering isn't delayed by it (until then, GetElements returns nothing)
+    virtual bool HasDeferredPageElements(int pageNo);
+    virtual void LoadPageElements(int pageNo);
+
     // creates a PageDestination from a name (or nullptr for invalid names)
     // caller must delete the result
     virtual PageDestination* GetNamedDest(const WCHAR* name);
 
     // checks whether this document has an associated Table of Contents
-    bool HacToc();
+    // (without loading it, if possible)
+    virtual bool HacToc();
 
     // returns the root element for the loaded document's Table of Contents
     // caller must delete the result (when no longer needed)
@@ -417,6 +457,14 @@ class EngineBase {
 
     virtual RenderedBitmap* GetImageForPageElement(IPageElement*);
 
+    // frees memory used for caching decoded images, fonts, etc. (which will be
+    // reloaded when needed again), e.g. when the document is no longer visible
+    virtual void ReleaseCachedResources();
+
+    // estimated memory used by the engine for the document and its caches
+    // (for diagnostics only, 0 if the engine doesn't keep track)
+    virtual size_t GetMemoryUsage();
+
     // protected:
     void SetFileName(const WCHAR* s);
 };
@@ -130,18 +130,25 @@ static EngineBase* CreateEngineForKind(Kind kind, const WCHAR* path, PasswordUI*
     return engine;
 }
 
-EngineBase* CreateEngine(const WCHAR* path, PasswordUI* pwdUI, bool enableChmEngine, bool enableEngineEbooks) {
+EngineBase* CreateEngine(const WCHAR* path, PasswordUI* pwdUI, bool enableChmEngine, bool enableEngineEbooks,
+                         Kind* kindOut) {
     CrashIf(!path);
 
     // try to open with the engine guess from file name
     // if that fails, try to guess the file type based on content
     Kind kind = GuessFileTypeFromName(path);
+    if (kindOut) {
+        *kindOut = kind;
+    }
     EngineBase* engine = CreateEngineForKind(kind, path, pwdUI, enableChmEngine, enableEngineEbooks);
     if (engine) {
         return engine;
     }
 
     Kind newKind = GuessFileTypeFromContent(path);
+    if (kindOut && newKind) {
+        *kindOut = newKind;
+    }
     if (kind != newKind) {
         engine = CreateEngineForKind(newKind, path, pwdUI, enableChmEngine, enableEngineEbooks);
     }
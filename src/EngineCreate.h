@@ -3,8 +3,18 @@
 
 bool IsSupportedFileType(Kind kind, bool enableEngineEbooks);
 
+// kindOut receives the file type as guessed from the name or (if that didn't work) sniffed from
+// the content, so that callers trying to load the file differently don't have to sniff it again
 EngineBase* CreateEngine(const WCHAR* filePath, PasswordUI* pwdUI = nullptr, bool enableChmEngine = true,
-                         bool enableEngineEbooks = true);
+                         bool enableEngineEbooks = true, Kind* kindOut = nullptr);
+
+// limits how much memory the PDF and XPS engines use for decoded images and fonts
+// (if sizeMB isn't positive, the limit is based on the physical memory)
+void SetFzStoreSizeMB(int sizeMB);
+// lets JPEG 2000 images be decoded with the processors not used by the other render threads
+void SetJpxDecodeThreads(int renderThreads);
+// memory currently allocated by MuPDF for all documents (incl. rendering engine clones)
+i64 FzAllocatedTotal();
 
 bool EngineSupportsAnnotations(EngineBase*);
 bool EngineGetAnnotations(EngineBase*, Vec<Annotation*>*);
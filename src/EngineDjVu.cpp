@@ -24,6 +24,13 @@
 
 Kind kindEngineDjVu = "engineDjVu";
 
+// number of decoded pages to keep per document (see EngineDjVu::GetDecodedPage)
+#define MAX_DJVU_PAGE_CACHE 8
+// rough memory limit for the decoded pages of one document
+#define MAX_DJVU_PAGE_CACHE_MEMORY (128 * 1024 * 1024)
+// number of pages following a rendered page to start decoding in the background
+#define DJVU_PREFETCH_PAGES 2
+
 // TODO: libdjvu leaks memory - among others
 //       DjVuPort::corpse_lock, DjVuPort::corpse_head, pcaster,
 //       DataPool::OpenFiles::global_ptr, FCPools::global_ptr
@@ -127,17 +134,29 @@ static TocItem* newDjVuTocItem(TocItem* parent, const char* title, const char* l
     return res;
 }
 
+// upper bound for how long WaitUntil sleeps before checking a job again
+// (in case the message for it has been handled by another thread)
+#define DJVU_MESSAGE_WAIT_MS 20
+
+static void DjVuMessageCallback(ddjvu_context_t* context, void* closure);
+
 struct DjVuContext {
     ddjvu_context_t* ctx = nullptr;
     int refCount = 1;
     CRITICAL_SECTION lock;
+    // set by ddjvu (from its decoding threads) whenever a message is posted
+    HANDLE msgEvent = nullptr;
 
     DjVuContext() {
         InitializeCriticalSection(&lock);
+        msgEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
         ctx = ddjvu_context_create("DjVuEngine");
         // reset the locale to "C" as most other code expects
         setlocale(LC_ALL, "C");
         CrashIf(!ctx);
+        if (ctx && msgEvent) {
+            ddjvu_message_set_callback(ctx, DjVuMessageCallback, this);
+        }
     }
 
     int AddRef() {
@@ -159,10 +178,14 @@ struct DjVuContext {
     ~DjVuContext() {
         EnterCriticalSection(&lock);
         if (ctx) {
+            ddjvu_message_set_callback(ctx, nullptr, nullptr);
             ddjvu_context_release(ctx);
         }
         LeaveCriticalSection(&lock);
         DeleteCriticalSection(&lock);
+        if (msgEvent) {
+            CloseHandle(msgEvent);
+        }
     }
 
     void SpinMessageLoop(bool wait = true) {
@@ -170,6 +193,10 @@ struct DjVuContext {
         if (wait) {
             ddjvu_message_wait(ctx);
         }
+        // messages posted from now on will set the event again
+        if (msgEvent) {
+            ResetEvent(msgEvent);
+        }
         while ((msg = ddjvu_message_peek(ctx)) != nullptr) {
             auto tag = msg->m_any.tag;
             if (DDJVU_NEWSTREAM == tag) {
@@ -183,6 +210,23 @@ struct DjVuContext {
         }
     }
 
+    // calls isDone (with lock held) until it returns true. in between, this waits for
+    // ddjvu messages without holding lock, so that e.g. waiting for a page's text
+    // doesn't block rendering of other pages and documents meanwhile
+    template <typename Fn>
+    void WaitUntil(Fn isDone) {
+        for (;;) {
+            {
+                ScopedCritSec scope(&lock);
+                SpinMessageLoop(false);
+                if (isDone()) {
+                    return;
+                }
+            }
+            WaitForSingleObject(msgEvent, DJVU_MESSAGE_WAIT_MS);
+        }
+    }
+
     ddjvu_document_t* OpenFile(const WCHAR* fileName) {
         ScopedCritSec scope(&lock);
         AutoFree fileNameUtf8(strconv::WstrToUtf8(fileName));
@@ -206,6 +250,31 @@ struct DjVuContext {
 // in djvu which got deleted first
 static DjVuContext* gDjVuContext;
 
+static void DjVuMessageCallback(ddjvu_context_t* context, void* closure) {
+    UNUSED(context);
+    DjVuContext* djvu = (DjVuContext*)closure;
+    SetEvent(djvu->msgEvent);
+}
+
+// the mediaboxes of recently loaded files are cached for the lifetime of the process,
+// so that engine clones (see RenderCache) and reloads don't have to scan files again.
+// protected by gDjVuContext->lock
+struct DjVuMediaboxes {
+    AutoFreeWstr path;
+    i64 fileSize = 0;
+    FILETIME modified{};
+    int pageCount = 0;
+    RectF* mediaboxes = nullptr;
+
+    ~DjVuMediaboxes() {
+        free(mediaboxes);
+    }
+};
+
+#define MAX_DJVU_MEDIABOX_CACHE 32
+
+static Vec<DjVuMediaboxes*> gMediaboxCache;
+
 static DjVuContext* GetDjVuContext() {
     if (!gDjVuContext) {
         gDjVuContext = new DjVuContext();
@@ -224,6 +293,7 @@ static void ReleaseDjVuContext() {
 }
 
 void CleanupDjVuEngine() {
+    DeleteVecMembers(gMediaboxCache);
     if (gDjVuContext) {
         CrashIf(gDjVuContext->refCount != 0);
         delete gDjVuContext;
@@ -232,6 +302,24 @@ void CleanupDjVuEngine() {
     minilisp_finish();
 }
 
+// lets ExtractPageText stop waiting for libdjvu to decode a page's text
+class DjVuAbortCookie : public AbortCookie {
+  public:
+    bool abort{false};
+    void Abort() override {
+        abort = true;
+    }
+};
+
+// libdjvu decodes every page in a thread of its own, so pages that are
+// created ahead of time are decoded in parallel to rendering other pages
+struct DjVuDecodedPage {
+    int pageNo = 0;
+    ddjvu_page_t* page = nullptr;
+    // estimated memory used by the decoded layers (0 while still decoding)
+    size_t size = 0;
+};
+
 class EngineDjVu : public EngineBase {
   public:
     EngineDjVu();
@@ -242,13 +330,15 @@ class EngineDjVu : public EngineBase {
     RectF PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs&) override;
+    void ReleaseCachedResources() override;
 
     PointF TransformPoint(PointF pt, int pageNo, float zoom, int rotation, bool inverse = false);
     RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
     std::span<u8> GetFileData() override;
+    std::span<u8> BorrowFileData() override;
     bool SaveFileAs(const char* copyFileName, bool includeUserAnnots = false) override;
-    PageText ExtractPageText(int pageNo) override;
+    PageText ExtractPageText(int pageNo, AbortCookie** cookie_out = nullptr) override;
     bool HasClipOptimizations(int pageNo) override;
 
     WCHAR* GetProperty(DocumentProperty prop) override;
@@ -280,6 +370,14 @@ class EngineDjVu : public EngineBase {
 
     Vec<ddjvu_fileinfo_t> fileInfos;
 
+    // least recently used first, protected by gDjVuContext->lock
+    Vec<DjVuDecodedPage> decodedPages;
+
+    ddjvu_page_t* StartDecodingPage(int pageNo);
+    ddjvu_page_t* GetDecodedPage(int pageNo);
+    void FreeDecodedPages();
+    void ReleaseDecodedPages();
+
     RenderedBitmap* CreateRenderedBitmap(const char* bmpData, Size size, bool grayscale) const;
     bool ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>& coords);
     char* ResolveNamedDest(const char* name);
@@ -304,6 +402,8 @@ EngineDjVu::~EngineDjVu() {
     delete tocTree;
     free(mediaboxes);
 
+    ReleaseDecodedPages();
+
     if (annos) {
         for (int i = 0; i < pageCount; i++) {
             if (annos[i]) {
@@ -360,13 +460,71 @@ bool EngineDjVu::BenchLoadPage(int pageNo) {
 // so try to either only use them when actually needed or replace them
 // with a function that extracts all the data at once:
 
-static bool ReadBytes(HANDLE h, DWORD offset, void* buffer, DWORD count) {
-    DWORD res = SetFilePointer(h, offset, nullptr, FILE_BEGIN);
-    if (res != offset) {
-        return false;
+// reads a file through a buffer, so that the chunk headers of a DjVu file
+// can be scanned without one or two system calls for each of them
+// (which is slow for large bundled files e.g. on network drives)
+class BufferedFileReader {
+    HANDLE h = nullptr;
+    char* buf = nullptr;
+    DWORD bufSize = 0;
+    DWORD bufOffset = 0;
+    DWORD bufLen = 0;
+
+  public:
+    BufferedFileReader(HANDLE h, DWORD bufSize) : h(h), bufSize(bufSize) {
+        buf = AllocArray<char>(bufSize);
     }
-    bool ok = ReadFile(h, buffer, count, &res, nullptr);
-    return ok && res == count;
+    ~BufferedFileReader() {
+        free(buf);
+    }
+
+    bool Read(DWORD offset, void* buffer, DWORD count) {
+        if (!buf || count > bufSize) {
+            return false;
+        }
+        if (offset < bufOffset || offset - bufOffset + (u64)count > bufLen) {
+            // a single system call for both seeking and reading
+            OVERLAPPED ov{};
+            ov.Offset = offset;
+            DWORD read = 0;
+            if (!ReadFile(h, buf, bufSize, &read, &ov) && GetLastError() != ERROR_HANDLE_EOF) {
+                return false;
+            }
+            bufOffset = offset;
+            bufLen = read;
+            if (count > bufLen) {
+                return false;
+            }
+        }
+        memcpy(buffer, buf + (offset - bufOffset), count);
+        return true;
+    }
+};
+
+static DjVuMediaboxes* FindCachedMediaboxes(const WCHAR* path, BY_HANDLE_FILE_INFORMATION& fi, int pageCount) {
+    i64 fileSize = ((i64)fi.nFileSizeHigh << 32) | fi.nFileSizeLow;
+    for (DjVuMediaboxes* mb : gMediaboxCache) {
+        if (str::EqI(mb->path, path) && mb->fileSize == fileSize && mb->pageCount == pageCount &&
+            CompareFileTime(&mb->modified, &fi.ftLastWriteTime) == 0) {
+            return mb;
+        }
+    }
+    return nullptr;
+}
+
+static void CacheMediaboxes(const WCHAR* path, BY_HANDLE_FILE_INFORMATION& fi, int pageCount, RectF* mediaboxes) {
+    if (gMediaboxCache.size() >= MAX_DJVU_MEDIABOX_CACHE) {
+        delete gMediaboxCache[0];
+        gMediaboxCache.RemoveAt(0);
+    }
+    auto mb = new DjVuMediaboxes();
+    mb->path.SetCopy(path);
+    mb->fileSize = ((i64)fi.nFileSizeHigh << 32) | fi.nFileSizeLow;
+    mb->modified = fi.ftLastWriteTime;
+    mb->pageCount = pageCount;
+    mb->mediaboxes = AllocArray<RectF>(pageCount);
+    memcpy(mb->mediaboxes, mediaboxes, pageCount * sizeof(RectF));
+    gMediaboxCache.Append(mb);
 }
 
 #define DJVU_MARK_MAGIC 0x41542654L /* AT&T */
@@ -397,15 +555,28 @@ bool EngineDjVu::LoadMediaboxes() {
     if (!h.IsValid()) {
         return false;
     }
-    char buffer[16];
+    BY_HANDLE_FILE_INFORMATION fi{};
+    if (!GetFileInformationByHandle(h, &fi)) {
+        return false;
+    }
+    DjVuMediaboxes* cached = FindCachedMediaboxes(fileName, fi, pageCount);
+    if (cached) {
+        memcpy(mediaboxes, cached->mediaboxes, pageCount * sizeof(RectF));
+        return true;
+    }
+
+    // a page's header and INFO chunk (as well as the headers of consecutive small chunks)
+    // are read at once
+    BufferedFileReader reader(h, 64 * 1024);
+    char buffer[30];
     ByteReader r(buffer, sizeof(buffer));
-    if (!ReadBytes(h, 0, buffer, 16) || r.DWordBE(0) != DJVU_MARK_MAGIC || r.DWordBE(4) != DJVU_MARK_FORM) {
+    if (!reader.Read(0, buffer, 16) || r.DWordBE(0) != DJVU_MARK_MAGIC || r.DWordBE(4) != DJVU_MARK_FORM) {
         return false;
     }
 
     DWORD offset = r.DWordBE(12) == DJVU_MARK_DJVM ? 16 : 4;
     for (int pages = 0; pages < pageCount;) {
-        if (!ReadBytes(h, offset, buffer, 16)) {
+        if (!reader.Read(offset, buffer, 16)) {
             return false;
         }
         int partLen = r.DWordBE(4);
@@ -413,11 +584,12 @@ bool EngineDjVu::LoadMediaboxes() {
             return false;
         }
         if (r.DWordBE(0) == DJVU_MARK_FORM && r.DWordBE(8) == DJVU_MARK_DJVU && r.DWordBE(12) == DJVU_MARK_INFO) {
-            if (!ReadBytes(h, offset + 16, buffer, 14)) {
+            // the INFO chunk immediately follows the header
+            if (!reader.Read(offset, buffer, 30)) {
                 return false;
             }
             DjVuInfoChunk info;
-            bool ok = r.UnpackBE(&info, sizeof(info), "2w6b", 4);
+            bool ok = r.UnpackBE(&info, sizeof(info), "2w6b", 20);
             CrashIf(!ok);
             int dpi = MAKEWORD(info.dpiLo, info.dpiHi); // dpi is little-endian
             // DjVuLibre ignores DPI values outside 25 to 6000 in DjVuInfo::decode
@@ -434,6 +606,7 @@ bool EngineDjVu::LoadMediaboxes() {
         offset += 8 + partLen + (partLen & 1);
     }
 
+    CacheMediaboxes(fileName, fi, pageCount, mediaboxes);
     return true;
 }
 
@@ -551,6 +724,83 @@ RenderedBitmap* EngineDjVu::CreateRenderedBitmap(const char* bmpData, Size size,
     return new RenderedBitmap(hbmp, size, hMap);
 }
 
+// returns the page (which is decoded in the background) and makes it
+// the most recently used one. the caller must hold gDjVuContext->lock
+ddjvu_page_t* EngineDjVu::StartDecodingPage(int pageNo) {
+    for (size_t i = 0; i < decodedPages.size(); i++) {
+        DjVuDecodedPage dp = decodedPages[i];
+        if (dp.pageNo == pageNo) {
+            decodedPages.RemoveAt(i);
+            decodedPages.Append(dp);
+            return dp.page;
+        }
+    }
+    DjVuDecodedPage dp;
+    dp.pageNo = pageNo;
+    dp.page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    if (!dp.page) {
+        return nullptr;
+    }
+    decodedPages.Append(dp);
+    FreeDecodedPages();
+    return dp.page;
+}
+
+// returns a fully decoded page which remains valid until the next call to
+// StartDecodingPage or GetDecodedPage. the caller must hold gDjVuContext->lock
+ddjvu_page_t* EngineDjVu::GetDecodedPage(int pageNo) {
+    ddjvu_page_t* page = StartDecodingPage(pageNo);
+    if (!page) {
+        return nullptr;
+    }
+    while (!ddjvu_page_decoding_done(page)) {
+        gDjVuContext->SpinMessageLoop();
+    }
+    // page is the most recently used one (at the end)
+    DjVuDecodedPage& dp = decodedPages.Last();
+    CrashIf(dp.page != page);
+    if (ddjvu_page_decoding_error(page)) {
+        ddjvu_page_release(page);
+        decodedPages.RemoveLast();
+        return nullptr;
+    }
+    if (dp.size == 0) {
+        // bitonal pages consist of a JB2 mask, others (also) of IW44 wavelet coefficients
+        size_t pixels = (size_t)ddjvu_page_get_width(page) * (size_t)ddjvu_page_get_height(page);
+        bool isBitonal = DDJVU_PAGETYPE_BITONAL == ddjvu_page_get_type(page);
+        dp.size = std::max(isBitonal ? pixels / 8 : pixels * 2, (size_t)1);
+        FreeDecodedPages();
+    }
+    return page;
+}
+
+// frees the least recently used pages (but never the most recently used one) so that
+// at most MAX_DJVU_PAGE_CACHE pages and about MAX_DJVU_PAGE_CACHE_MEMORY bytes are kept
+void EngineDjVu::FreeDecodedPages() {
+    size_t totalSize = 0;
+    for (auto& dp : decodedPages) {
+        totalSize += dp.size;
+    }
+    while (decodedPages.size() > 1 &&
+           (decodedPages.size() > MAX_DJVU_PAGE_CACHE || totalSize > MAX_DJVU_PAGE_CACHE_MEMORY)) {
+        totalSize -= decodedPages[0].size;
+        ddjvu_page_release(decodedPages[0].page);
+        decodedPages.RemoveAt(0);
+    }
+}
+
+void EngineDjVu::ReleaseDecodedPages() {
+    for (auto& dp : decodedPages) {
+        ddjvu_page_release(dp.page);
+    }
+    decodedPages.Reset();
+}
+
+void EngineDjVu::ReleaseCachedResources() {
+    ScopedCritSec scope(&gDjVuContext->lock);
+    ReleaseDecodedPages();
+}
+
 RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
     ScopedCritSec scope(&gDjVuContext->lock);
     auto pageRect = args.pageRect;
@@ -562,27 +812,21 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
     Rect full = Transform(PageMediabox(pageNo), pageNo, zoom, rotation).Round();
     screen = full.Intersect(screen);
 
-    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    // decoded pages are cached, so that re-rendering e.g. at a different zoom level
+    // doesn't require decoding the page's IW44 and JB2 layers again
+    ddjvu_page_t* page = GetDecodedPage(pageNo);
     if (!page) {
         return nullptr;
     }
     int rotation4 = (((-rotation / 90) % 4) + 4) % 4;
     ddjvu_page_set_rotation(page, (ddjvu_page_rotation_t)rotation4);
 
-    while (!ddjvu_page_decoding_done(page)) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    if (ddjvu_page_decoding_error(page)) {
-        return nullptr;
-    }
-
     bool isBitonal = DDJVU_PAGETYPE_BITONAL == ddjvu_page_get_type(page);
     ddjvu_format_style_t style = isBitonal ? DDJVU_FORMAT_GREY8 : DDJVU_FORMAT_BGR24;
     ddjvu_format_t* fmt = ddjvu_format_create(style, 0, nullptr);
 
     defer {
         ddjvu_format_release(fmt);
-        ddjvu_page_release(page);
     };
 
     int topToBottom = TRUE;
@@ -610,6 +854,12 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
     }
     bmp = CreateRenderedBitmap(bmpData, screen.Size(), isBitonal);
 
+    // while the rendered page is being displayed, the following pages are decoded
+    // in parallel (page is no longer used and may be freed by StartDecodingPage)
+    for (int i = 1; i <= DJVU_PREFETCH_PAGES && pageNo + i <= pageCount; i++) {
+        StartDecodingPage(pageNo + i);
+    }
+
     return bmp;
 }
 
@@ -618,25 +868,17 @@ RectF EngineDjVu::PageContentBox(int pageNo, RenderTarget target) {
     ScopedCritSec scope(&gDjVuContext->lock);
 
     RectF pageRc = PageMediabox(pageNo);
-    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    ddjvu_page_t* page = GetDecodedPage(pageNo);
     if (!page) {
         return pageRc;
     }
     ddjvu_page_set_rotation(page, DDJVU_ROTATE_0);
 
-    while (!ddjvu_page_decoding_done(page)) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    if (ddjvu_page_decoding_error(page)) {
-        return pageRc;
-    }
-
     // render the page in 8-bit grayscale up to 250x250 px in size
     ddjvu_format_t* fmt = ddjvu_format_create(DDJVU_FORMAT_GREY8, 0, nullptr);
 
     defer {
         ddjvu_format_release(fmt);
-        ddjvu_page_release(page);
     };
 
     ddjvu_format_set_row_order(fmt, /* top_to_bottom */ TRUE);
@@ -741,10 +983,18 @@ std::span<u8> EngineDjVu::GetFileData() {
     return GetStreamOrFileData(stream, FileName());
 }
 
+std::span<u8> EngineDjVu::BorrowFileData() {
+    return GetStreamMemory(stream);
+}
+
 bool EngineDjVu::SaveFileAs(const char* copyFileName, bool includeUserAnnots) {
     UNUSED(includeUserAnnots);
     AutoFreeWstr path = strconv::Utf8ToWstr(copyFileName);
     if (stream) {
+        auto data = BorrowFileData();
+        if (!data.empty() && file::WriteFile(path, data)) {
+            return true;
+        }
         AutoFree d = GetDataFromStream(stream, nullptr);
         bool ok = !d.empty() && file::WriteFile(path, d.AsSpan());
         if (ok) {
@@ -827,15 +1077,37 @@ bool EngineDjVu::ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>
     return !item;
 }
 
-PageText EngineDjVu::ExtractPageText(int pageNo) {
+PageText EngineDjVu::ExtractPageText(int pageNo, AbortCookie** cookie_out) {
     const WCHAR* lineSep = L"\n";
-    ScopedCritSec scope(&gDjVuContext->lock);
+    DjVuAbortCookie* cookie = nullptr;
+    if (cookie_out) {
+        cookie = new DjVuAbortCookie();
+        *cookie_out = cookie;
+    }
 
-    miniexp_t pagetext;
-    while ((pagetext = ddjvu_document_get_pagetext(doc, pageNo - 1, nullptr)) == miniexp_dummy) {
-        gDjVuContext->SpinMessageLoop();
+    // request the text and the page info at once and wait for both without blocking other threads
+    // (libdjvu keeps decoding the page after an abort, so that a later request is faster)
+    miniexp_t pagetext = miniexp_dummy;
+    ddjvu_status_t status = DDJVU_JOB_NOTSTARTED;
+    ddjvu_pageinfo_t info;
+    gDjVuContext->WaitUntil([&] {
+        if (miniexp_dummy == pagetext) {
+            pagetext = ddjvu_document_get_pagetext(doc, pageNo - 1, nullptr);
+        }
+        if (status < DDJVU_JOB_OK) {
+            status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info);
+        }
+        bool isAborted = cookie && cookie->abort;
+        return isAborted || pagetext != miniexp_dummy && status >= DDJVU_JOB_OK;
+    });
+
+    // miniexp's symbol table and garbage collector are shared by all documents
+    ScopedCritSec scope(&gDjVuContext->lock);
+    if (miniexp_nil == pagetext || miniexp_dummy == pagetext) {
+        return {};
     }
-    if (miniexp_nil == pagetext) {
+    if (cookie && cookie->abort) {
+        ddjvu_miniexp_release(doc, pagetext);
         return {};
     }
 
@@ -853,11 +1125,6 @@ PageText EngineDjVu::ExtractPageText(int pageNo) {
     PageText res;
 
     CrashIf(str::Len(extracted.Get()) != coords.size());
-    ddjvu_status_t status;
-    ddjvu_pageinfo_t info;
-    while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
-        gDjVuContext->SpinMessageLoop();
-    }
     float dpiFactor = 1.0;
     if (DDJVU_JOB_OK == status) {
         dpiFactor = GetFileDPI() / info.dpi;
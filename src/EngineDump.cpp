@@ -4,10 +4,13 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/CmdLineParser.h"
+#include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/GuessFileType.h"
 #include "mui/MiniMui.h"
 #include "utils/TgaReader.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -473,6 +476,213 @@ class PasswordHolder : public PasswordUI {
     }
 };
 
+// throughput mode (-throughput <render|text>): all pages of many documents
+// are rendered resp. their text is extracted by several threads at once, each
+// with its own clone of the document's engine, to find out how well engines
+// scale and which pages are unusually slow
+
+#define MAX_THROUGHPUT_THREADS 64
+// number of slowest pages to report
+#define MAX_THROUGHPUT_OUTLIERS 10
+
+struct ThroughputPage {
+    int fileNo = 0;
+    int pageNo = 0;
+    double ms = 0;
+    // size of the rendered bitmap resp. the extracted text
+    size_t bytes = 0;
+    bool ok = false;
+};
+
+struct ThroughputJob {
+    bool extractText = false;
+    float zoom = 1.f;
+
+    // the document currently being processed
+    EngineBase* engine = nullptr;
+    int fileNo = 0;
+    int pageCount = 0;
+    LONG nextPage = 0;
+    // one entry per page of the current document, written by the worker processing the page
+    ThroughputPage* pages = nullptr;
+};
+
+static void ThroughputProcessPage(ThroughputJob* job, EngineBase* engine, ThroughputPage* page) {
+    auto t = TimeGet();
+    if (job->extractText) {
+        PageText pageText = engine->ExtractPageText(page->pageNo);
+        page->ok = pageText.text != nullptr;
+        page->bytes = (size_t)pageText.len * sizeof(WCHAR);
+        FreePageText(&pageText);
+    } else {
+        RenderPageArgs args(page->pageNo, job->zoom, 0);
+        RenderedBitmap* bmp = engine->RenderPage(args);
+        page->ok = bmp != nullptr;
+        if (bmp) {
+            Size size = bmp->Size();
+            page->bytes = (size_t)size.dx * (size_t)size.dy * 4;
+        }
+        delete bmp;
+    }
+    page->ms = TimeSinceInMs(t);
+}
+
+static DWORD WINAPI ThroughputWorker(void* data) {
+    ThroughputJob* job = (ThroughputJob*)data;
+    // engines which can't be cloned are shared by all workers
+    EngineBase* clone = job->engine->Clone();
+    EngineBase* engine = clone ? clone : job->engine;
+    for (;;) {
+        LONG pageNo = InterlockedIncrement(&job->nextPage);
+        if (pageNo > job->pageCount) {
+            break;
+        }
+        ThroughputPage* page = &job->pages[pageNo - 1];
+        page->fileNo = job->fileNo;
+        page->pageNo = pageNo;
+        ThroughputProcessPage(job, engine, page);
+    }
+    delete clone;
+    return 0;
+}
+
+// processes the pages of job->engine with nThreads workers
+static void ThroughputRunPages(ThroughputJob* job, int nThreads) {
+    HANDLE threads[MAX_THROUGHPUT_THREADS];
+    int nStarted = 0;
+    for (int i = 0; i < nThreads; i++) {
+        threads[nStarted] = CreateThread(nullptr, 0, ThroughputWorker, job, 0, nullptr);
+        if (threads[nStarted]) {
+            nStarted++;
+        }
+    }
+    if (0 == nStarted) {
+        ThroughputWorker(job);
+    }
+    WaitForMultipleObjects(nStarted, threads, TRUE, INFINITE);
+    for (int i = 0; i < nStarted; i++) {
+        CloseHandle(threads[i]);
+    }
+}
+
+static void CollectThroughputFiles(const WCHAR* input, WStrVec& paths) {
+    if (!dir::Exists(input)) {
+        paths.Append(str::Dup(input));
+        return;
+    }
+    DirIter di(input, true /* recursive */);
+    WStrVec found;
+    for (const WCHAR* path = di.First(); path; path = di.Next()) {
+        if (IsSupportedFileType(GuessFileType(path, true), true)) {
+            found.Append(str::Dup(path));
+        }
+    }
+    found.SortNatural();
+    for (WCHAR* path : found) {
+        paths.Append(str::Dup(path));
+    }
+}
+
+static double ThroughputMedianMs(Vec<ThroughputPage>& pages) {
+    if (pages.size() == 0) {
+        return 0;
+    }
+    Vec<double> times;
+    for (ThroughputPage& page : pages) {
+        times.Append(page.ms);
+    }
+    std::sort(times.begin(), times.end());
+    return times.at(times.size() / 2);
+}
+
+static double PerSec(double n, double ms) {
+    return ms > 0 ? n * 1000.0 / ms : 0;
+}
+
+// returns the number of documents that failed to load or had pages that failed
+int RunThroughput(WStrVec& inputs, bool extractText, float zoom, int nThreads, PasswordUI* pwdUI) {
+    WStrVec paths;
+    for (WCHAR* input : inputs) {
+        CollectThroughputFiles(input, paths);
+    }
+    nThreads = std::clamp(nThreads, 1, MAX_THROUGHPUT_THREADS);
+
+    ThroughputJob job;
+    job.extractText = extractText;
+    job.zoom = zoom;
+
+    Vec<ThroughputPage> allPages;
+    int nFailed = 0;
+    double totalLoadMs = 0;
+    auto total = TimeGet();
+    for (size_t i = 0; i < paths.size(); i++) {
+        const WCHAR* path = paths.at(i);
+        AutoFree pathUtf8 = strconv::WstrToUtf8(path);
+        auto t = TimeGet();
+        EngineBase* engine = CreateEngine(path, pwdUI);
+        double loadMs = TimeSinceInMs(t);
+        totalLoadMs += loadMs;
+        if (!engine) {
+            Out("%s: failed to load\n", pathUtf8.Get());
+            nFailed++;
+            continue;
+        }
+
+        job.engine = engine;
+        job.fileNo = (int)i;
+        job.pageCount = engine->PageCount();
+        job.nextPage = 0;
+        job.pages = AllocArray<ThroughputPage>(job.pageCount);
+        t = TimeGet();
+        ThroughputRunPages(&job, nThreads);
+        double ms = TimeSinceInMs(t);
+
+        int nPagesFailed = 0;
+        for (int pageNo = 1; pageNo <= job.pageCount; pageNo++) {
+            ThroughputPage& page = job.pages[pageNo - 1];
+            if (!page.ok) {
+                nPagesFailed++;
+            }
+            allPages.Append(page);
+        }
+        if (nPagesFailed > 0) {
+            nFailed++;
+        }
+        Out("%s: %d pages (%d failed), load %.2f ms, pages %.2f ms, %.1f pages/sec\n", pathUtf8.Get(), job.pageCount,
+            nPagesFailed, loadMs, ms, PerSec(job.pageCount, ms));
+        free(job.pages);
+        job.pages = nullptr;
+        delete engine;
+    }
+    double totalMs = TimeSinceInMs(total);
+
+    size_t totalBytes = 0;
+    for (ThroughputPage& page : allPages) {
+        totalBytes += page.bytes;
+    }
+    double mb = (double)totalBytes / (1024.0 * 1024.0);
+    double medianMs = ThroughputMedianMs(allPages);
+    Out("\n%d documents (%d failed), %d pages with %d threads in %.2f ms (load %.2f ms)\n", (int)paths.size(),
+        nFailed, (int)allPages.size(), nThreads, totalMs, totalLoadMs);
+    Out("%.1f pages/sec, %.2f MB/sec (%.2f MB %s), median page %.2f ms\n", PerSec((double)allPages.size(), totalMs),
+        PerSec(mb, totalMs), mb, extractText ? "of text" : "rendered", medianMs);
+
+    std::sort(allPages.begin(), allPages.end(),
+              [](const ThroughputPage& p1, const ThroughputPage& p2) { return p1.ms > p2.ms; });
+    size_t nOutliers = std::min(allPages.size(), (size_t)MAX_THROUGHPUT_OUTLIERS);
+    if (nOutliers > 0) {
+        Out("\nslowest pages:\n");
+    }
+    for (size_t i = 0; i < nOutliers; i++) {
+        ThroughputPage& page = allPages.at(i);
+        AutoFree pathUtf8 = strconv::WstrToUtf8(paths.at(page.fileNo));
+        double ratio = medianMs > 0 ? page.ms / medianMs : 0;
+        Out("%8.2f ms (%.1fx median)%s page %d of %s\n", page.ms, ratio, page.ok ? "" : " failed", page.pageNo,
+            pathUtf8.Get());
+    }
+    return nFailed;
+}
+
 int main(int argc, char** argv) {
     UNUSED(argc);
     UNUSED(argv);
@@ -485,6 +695,8 @@ int main(int argc, char** argv) {
     Usage:
         ErrOut("%s [-pwd <password>][-quick][-render <path-%%d.tga>] <filename>",
                path::GetBaseNameNoFree(argList.at(0)));
+        ErrOut("%s [-pwd <password>][-threads <n>] -throughput <render|text> [<zoom>%%] <file or dir> [...]",
+               path::GetBaseNameNoFree(argList.at(0)));
         return 2;
     }
 
@@ -495,6 +707,10 @@ int main(int argc, char** argv) {
     float renderZoom = 1.f;
     bool loadOnly = false, silent = false;
     int breakAlloc = 0;
+    WCHAR* throughputMode = nullptr;
+    int nThreads = 0;
+    // all files and directories for -throughput
+    WStrVec inputs;
 
     for (size_t i = 1; i < argList.size(); i++) {
         if (str::Eq(argList.at(i), L"-pwd") && i + 1 < argList.size() && !password) {
@@ -519,8 +735,21 @@ int main(int argc, char** argv) {
             fullDump = true;
         } else if (str::Eq(argList.at(i), L"-breakalloc") && i + 1 < argList.size()) {
             breakAlloc = _wtoi(argList.at(++i));
+        } else if (str::Eq(argList.at(i), L"-throughput") && i + 1 < argList.size() && !throughputMode) {
+            throughputMode = argList.at(++i);
+            // optional zoom argument (like for -render)
+            float zoom;
+            if (i + 2 < argList.size() && str::Parse(argList.at(i + 1), L"%f%%%$", &zoom) && zoom > 0.f) {
+                renderZoom = zoom / 100.f;
+                i++;
+            }
+        } else if (str::Eq(argList.at(i), L"-threads") && i + 1 < argList.size()) {
+            nThreads = _wtoi(argList.at(++i));
         } else if (!filePath) {
             filePath.SetCopy(argList.at(i));
+            inputs.Append(str::Dup(argList.at(i)));
+        } else if (throughputMode) {
+            inputs.Append(str::Dup(argList.at(i)));
         } else {
             goto Usage;
         }
@@ -528,6 +757,9 @@ int main(int argc, char** argv) {
     if (!filePath) {
         goto Usage;
     }
+    if (throughputMode && !str::Eq(throughputMode, L"render") && !str::Eq(throughputMode, L"text")) {
+        goto Usage;
+    }
 
     if (breakAlloc) {
 #ifdef DEBUG
@@ -546,6 +778,17 @@ int main(int argc, char** argv) {
     ScopedGdiPlus gdiPlus;
     ScopedMiniMui miniMui;
 
+    if (throughputMode) {
+        if (nThreads <= 0) {
+            SYSTEM_INFO si;
+            GetSystemInfo(&si);
+            nThreads = (int)si.dwNumberOfProcessors;
+        }
+        PasswordHolder pwdUI(password);
+        bool extractText = str::Eq(throughputMode, L"text");
+        return RunThroughput(inputs, extractText, renderZoom, nThreads, &pwdUI) > 0 ? 1 : 0;
+    }
+
     WIN32_FIND_DATA fdata;
     HANDLE hfind = FindFirstFile(filePath, &fdata);
     // embedded documents are referred to by an invalid path
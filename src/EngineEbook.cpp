@@ -7,6 +7,7 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/Archive.h"
+#include "utils/CryptoUtil.h"
 #include "utils/Dpi.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
@@ -14,6 +15,8 @@
 #include "utils/HtmlPullParser.h"
 #include "mui/Mui.h"
 #include "utils/PalmDbReader.h"
+#include "utils/StringViewUtil.h"
+#include "utils/ThreadUtil.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
@@ -28,6 +31,12 @@
 #include "HtmlFormatter.h"
 #include "EbookFormatter.h"
 
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#include <emmintrin.h>
+#define HAS_SSE2 1
+#endif
+
 Kind kindEngineEpub = "engineEpub";
 Kind kindEngineFb2 = "engineFb2";
 Kind kindEngineMobi = "engineMobi";
@@ -36,6 +45,11 @@ Kind kindEngineChm = "engineChm";
 Kind kindEngineHtml = "engineHtml";
 Kind kindEngineTxt = "engineTxt";
 
+// remembers the page count of recently opened ebooks, so that they
+// can be shown before all of their pages have been formatted
+#define PAGINATION_CACHE_FILE_NAME L"SumatraPDF-ebook-pages.txt"
+#define PAGINATION_CACHE_MAX_ENTRIES 256
+
 static AutoFreeWstr gDefaultFontName;
 static float gDefaultFontSize = 10.f;
 
@@ -57,6 +71,10 @@ void SetDefaultEbookFont(const WCHAR* name, float size) {
     gDefaultFontSize = size * 0.8f;
 }
 
+void FreeEbookImageCache() {
+    FreeCachedHtmlImages();
+}
+
 /* common classes for EPUB, FictionBook2, Mobi, PalmDOC, CHM, HTML and TXT engines */
 
 struct PageAnchor {
@@ -92,7 +110,7 @@ class EngineEbook : public EngineBase {
     std::span<u8> GetFileData() override;
 
     bool SaveFileAs(const char* copyFileName, bool includeUserAnnots = false) override;
-    PageText ExtractPageText(int pageNo) override;
+    PageText ExtractPageText(int pageNo, AbortCookie** cookie_out = nullptr) override;
     // make RenderCache request larger tiles than per default
     bool HasClipOptimizations(int pageNo) override;
 
@@ -118,13 +136,48 @@ class EngineEbook : public EngineBase {
     RectF pageRect;
     float pageBorder;
 
+    // if the page count is known from an earlier load, all but the first page are
+    // formatted on formatThread and formatAccess then guards pages, anchors and baseAnchors
+    // (never take pagesAccess while holding formatAccess)
+    CRITICAL_SECTION formatAccess;
+    CONDITION_VARIABLE pageFormatted;
+    // formatThread creates its own formatter from these (formatters
+    // measure text with a Graphics object that can't be used across threads)
+    HtmlFormatterArgs* formatterArgs = nullptr;
+    HANDLE formatThread = nullptr;
+    bool formatting = false;
+    bool formatCancelled = false;
+    bool skipEmptyPages = false;
+    // number of pages the formatter produced (can exceed pageCount if the cached count was wrong)
+    int pagesFormatted = 0;
+    AutoFree paginationKey;
+
     void GetTransform(Matrix& m, float zoom, int rotation);
-    bool ExtractPageAnchors();
+    virtual HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) = 0;
+    bool FormatPages(HtmlFormatterArgs& args, bool skipEmptyPages, bool inBackground);
+    void AppendPage(HtmlPage* page);
+    void FinishFormatting();
+    void WaitForPage(int pageNo);
+    void StopFormatting();
+    static DWORD WINAPI FormatThreadProc(void* data);
     WCHAR* ExtractFontList();
 
     virtual PageElement* CreatePageLink(DrawInstr* link, Rect rect, int pageNo);
 
     Vec<DrawInstr>* GetHtmlPage(int pageNo);
+
+    // text and elements of a formatted page, built once on first use
+    // (elements can't be built while formatting, as links need all anchors)
+    struct PageData {
+        PageText text;
+        Vec<IPageElement*>* elements;
+    };
+    // guarded by pagesAccess, has PageCount() entries once used
+    Vec<PageData> pagesData;
+
+    PageData* GetPageData(int pageNo);
+    PageText BuildPageText(int pageNo, EbookAbortCookie* cookie);
+    Vec<IPageElement*>* BuildElements(int pageNo);
 };
 
 static PageElement* newEbookLink(DrawInstr* link, Rect rect, PageDestination* dest, int pageNo = 0,
@@ -176,18 +229,32 @@ EngineEbook::EngineEbook() {
     pageBorder = 0.4f * GetFileDPI();
     preferredLayout = Layout_Book;
     InitializeCriticalSection(&pagesAccess);
+    InitializeCriticalSection(&formatAccess);
+    InitializeConditionVariable(&pageFormatted);
 }
 
 EngineEbook::~EngineEbook() {
+    // subclasses must already have called this before deleting their document
+    StopFormatting();
+
     EnterCriticalSection(&pagesAccess);
 
     if (pages) {
         DeleteVecMembers(*pages);
     }
     delete pages;
+    for (PageData& data : pagesData) {
+        FreePageText(&data.text);
+        if (data.elements) {
+            DeleteVecMembers(*data.elements);
+        }
+        delete data.elements;
+    }
 
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
+    DeleteCriticalSection(&formatAccess);
+    delete formatterArgs;
 }
 
 RectF EngineEbook::PageMediabox(int pageNo) {
@@ -241,34 +308,223 @@ Vec<DrawInstr>* EngineEbook::GetHtmlPage(int pageNo) {
     if (pageNo < 1 || PageCount() < pageNo) {
         return nullptr;
     }
+    WaitForPage(pageNo);
+    ScopedCritSec scope(&formatAccess);
     return &pages->at(pageNo - 1)->instructions;
 }
 
-bool EngineEbook::ExtractPageAnchors() {
-    ScopedCritSec scope(&pagesAccess);
+// identifies a document together with everything that influences its layout
+static char* GetPaginationKey(const WCHAR* path, Kind kind, HtmlFormatterArgs& args) {
+    if (!path || !file::Exists(path)) {
+        return nullptr;
+    }
+    AutoFree pathU(strconv::WstrToUtf8(path));
+    AutoFree fontName(strconv::WstrToUtf8(args.GetFontName()));
+    FILETIME ft = file::GetModificationTime(path);
+    str::Str key;
+    key.AppendFmt("%s|%lld|%u|%u|%s|", pathU.Get(), file::GetSize(pathU.AsView()), ft.dwHighDateTime,
+                  ft.dwLowDateTime, kind);
+    key.AppendFmt("%s|%.3f|%.3f|%.3f|%d", fontName.Get(), args.fontSize, args.pageDx, args.pageDy,
+                  (int)args.textRenderMethod);
+    u8 digest[20];
+    CalcSHA1Digest((const u8*)key.Get(), key.size(), digest);
+    return _MemToHex(&digest);
+}
+
+static WCHAR* GetPaginationCachePath() {
+    AutoFreeWstr tempDir(path::GetTempPath(nullptr));
+    if (!tempDir) {
+        return nullptr;
+    }
+    return path::Join(tempDir, PAGINATION_CACHE_FILE_NAME);
+}
 
-    DrawInstr* baseAnchor = nullptr;
-    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
-        Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
-        if (!pageInstrs) {
-            return false;
+// the cache consists of "${key} ${page count}" lines, most recently used first
+static int GetCachedPageCount(const char* key) {
+    AutoFreeWstr cachePath(GetPaginationCachePath());
+    if (!key || !cachePath) {
+        return 0;
+    }
+    AutoFree data = file::ReadFile(cachePath);
+    std::string_view sv = data.AsView();
+    size_t keyLen = str::Len(key);
+    while (!sv.empty()) {
+        std::string_view line = sv::ParseUntil(sv, '\n');
+        int nPages = 0;
+        if (line.size() > keyLen && str::StartsWith(line.data(), key) &&
+            str::Parse(line.data() + keyLen, line.size() - keyLen, " %d", &nPages)) {
+            return nPages;
         }
+    }
+    return 0;
+}
 
-        for (size_t k = 0; k < pageInstrs->size(); k++) {
-            DrawInstr* i = &pageInstrs->at(k);
-            if (DrawInstrType::Anchor != i->type) {
-                continue;
-            }
-            anchors.Append(PageAnchor(i, pageNo));
-            if (k < 2 && str::StartsWith(i->str.s + i->str.len, "\" page_marker />")) {
-                baseAnchor = i;
-            }
+static void SetCachedPageCount(const char* key, int nPages) {
+    AutoFreeWstr cachePath(GetPaginationCachePath());
+    if (!key || !cachePath) {
+        return;
+    }
+    AutoFree data = file::ReadFile(cachePath);
+    std::string_view sv = data.AsView();
+    size_t keyLen = str::Len(key);
+    str::Str s;
+    s.AppendFmt("%s %d\n", key, nPages);
+    int nEntries = 1;
+    while (!sv.empty() && nEntries < PAGINATION_CACHE_MAX_ENTRIES) {
+        std::string_view line = sv::ParseUntil(sv, '\n');
+        if (line.size() <= keyLen || str::StartsWith(line.data(), key)) {
+            continue;
         }
-        baseAnchors.Append(baseAnchor);
+        s.Append(line.data(), line.size());
+        s.Append("\n");
+        nEntries++;
+    }
+    file::WriteFile(cachePath, s.AsSpan());
+}
+
+// formats all pages right away unless the page count is known from an earlier load
+// with the same layout, in which case only the first page is formatted before returning
+// and the remaining pages are formatted in the background
+bool EngineEbook::FormatPages(HtmlFormatterArgs& args, bool skipEmptyPages, bool inBackground) {
+    CrashIf(pages);
+    pages = new Vec<HtmlPage*>();
+    this->skipEmptyPages = skipEmptyPages;
+    paginationKey.Set(GetPaginationKey(FileName(), kind, args));
+
+    HtmlFormatter* formatter = CreateFormatter(&args);
+    int cachedPageCount = inBackground ? GetCachedPageCount(paginationKey) : 0;
+    if (cachedPageCount > 1) {
+        HtmlPage* page = formatter->Next(skipEmptyPages);
+        if (!page) {
+            delete formatter;
+            return false;
+        }
+        AppendPage(page);
+        pageCount = cachedPageCount;
+        formatterArgs = new HtmlFormatterArgs();
+        formatterArgs->pageDx = args.pageDx;
+        formatterArgs->pageDy = args.pageDy;
+        formatterArgs->SetFontName(args.GetFontName());
+        formatterArgs->fontSize = args.fontSize;
+        formatterArgs->textAllocator = args.textAllocator;
+        formatterArgs->textRenderMethod = args.textRenderMethod;
+        formatterArgs->htmlStr = args.htmlStr;
+        formatting = true;
+        formatThread = CreateThread(nullptr, 0, FormatThreadProc, this, 0, nullptr);
+        if (formatThread) {
+            delete formatter;
+            return true;
+        }
+        // fall back to formatting the remaining pages synchronously
+        formatting = false;
+        delete formatterArgs;
+        formatterArgs = nullptr;
     }
 
+    for (HtmlPage* page = formatter->Next(skipEmptyPages); page; page = formatter->Next(skipEmptyPages)) {
+        AppendPage(page);
+    }
+    delete formatter;
+    pageCount = pagesFormatted;
+    if (inBackground && pageCount != cachedPageCount && pageCount > 1) {
+        SetCachedPageCount(paginationKey, pageCount);
+    }
+    return pageCount > 0;
+}
+
+// records a newly formatted page and the anchors on it
+// must be called with formatAccess held while formatThread is running
+void EngineEbook::AppendPage(HtmlPage* page) {
+    pagesFormatted++;
+    if (formatting && (int)pages->size() >= pageCount) {
+        // the document got more pages than expected, which can't be shown anymore
+        delete page;
+        return;
+    }
+    pages->Append(page);
+    int pageNo = (int)pages->size();
+
+    DrawInstr* baseAnchor = baseAnchors.size() > 0 ? baseAnchors.Last() : nullptr;
+    Vec<DrawInstr>* pageInstrs = &page->instructions;
+    for (size_t k = 0; k < pageInstrs->size(); k++) {
+        DrawInstr* i = &pageInstrs->at(k);
+        if (DrawInstrType::Anchor != i->type) {
+            continue;
+        }
+        anchors.Append(PageAnchor(i, pageNo));
+        if (k < 2 && str::StartsWith(i->str.s + i->str.len, "\" page_marker />")) {
+            baseAnchor = i;
+        }
+    }
+    baseAnchors.Append(baseAnchor);
     CrashIf(baseAnchors.size() != pages->size());
-    return true;
+}
+
+// must be called with formatAccess held
+void EngineEbook::FinishFormatting() {
+    // the page count can't change after loading, so if the layout turned out
+    // different from when the page count was cached, pad with empty pages
+    // (or drop the superfluous ones) and fix the cache for the next time
+    if (!formatCancelled && pagesFormatted != pageCount) {
+        SetCachedPageCount(paginationKey, pagesFormatted);
+    }
+    while ((int)pages->size() < pageCount) {
+        pages->Append(new HtmlPage(pages->Last()->reparseIdx));
+        baseAnchors.Append(baseAnchors.Last());
+    }
+    formatting = false;
+    WakeAllConditionVariable(&pageFormatted);
+}
+
+DWORD WINAPI EngineEbook::FormatThreadProc(void* data) {
+    EngineEbook* engine = (EngineEbook*)data;
+    SetThreadName(GetCurrentThreadId(), "EbookFormatting");
+    HtmlFormatter* formatter = engine->CreateFormatter(engine->formatterArgs);
+    // formatting is deterministic, so skip the page that has already been formatted while loading
+    int nSkip = engine->pagesFormatted;
+    bool cancelled = false;
+    while (!cancelled) {
+        HtmlPage* page = formatter->Next(engine->skipEmptyPages);
+        if (page && nSkip > 0) {
+            delete page;
+            nSkip--;
+            continue;
+        }
+        ScopedCritSec scope(&engine->formatAccess);
+        cancelled = engine->formatCancelled;
+        if (!page) {
+            break;
+        }
+        engine->AppendPage(page);
+        WakeAllConditionVariable(&engine->pageFormatted);
+    }
+    delete formatter;
+
+    ScopedCritSec scope(&engine->formatAccess);
+    engine->FinishFormatting();
+    return 0;
+}
+
+// blocks until formatThread has formatted pageNo
+void EngineEbook::WaitForPage(int pageNo) {
+    ScopedCritSec scope(&formatAccess);
+    while (formatting && (int)pages->size() < pageNo) {
+        SleepConditionVariableCS(&pageFormatted, &formatAccess, INFINITE);
+    }
+}
+
+void EngineEbook::StopFormatting() {
+    HANDLE thread;
+    {
+        ScopedCritSec scope(&formatAccess);
+        formatCancelled = true;
+        thread = formatThread;
+        formatThread = nullptr;
+    }
+    if (thread) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
 }
 
 RectF EngineEbook::Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse) {
@@ -345,10 +601,40 @@ static Rect GetInstrBbox(DrawInstr& instr, float pageBorder) {
     return bbox.Round();
 }
 
-PageText EngineEbook::ExtractPageText(int pageNo) {
-    const WCHAR* lineSep = L"\n";
+// must be called with pagesAccess held
+EngineEbook::PageData* EngineEbook::GetPageData(int pageNo) {
+    if (pagesData.size() == 0) {
+        pagesData.AppendBlanks(PageCount());
+    }
+    return &pagesData.at(pageNo - 1);
+}
+
+PageText EngineEbook::ExtractPageText(int pageNo, AbortCookie** cookie_out) {
+    EbookAbortCookie* cookie = nullptr;
+    if (cookie_out) {
+        cookie = new EbookAbortCookie();
+        *cookie_out = cookie;
+    }
     ScopedCritSec scope(&pagesAccess);
 
+    PageData* data = GetPageData(pageNo);
+    if (!data->text.text) {
+        data->text = BuildPageText(pageNo, cookie);
+        if (!data->text.text) {
+            return {};
+        }
+    }
+    PageText res;
+    res.len = data->text.len;
+    res.text = str::Dup(data->text.text);
+    res.coords = (Rect*)memdup(data->text.coords, res.len * sizeof(Rect));
+    return res;
+}
+
+// returns no text if aborted through cookie
+PageText EngineEbook::BuildPageText(int pageNo, EbookAbortCookie* cookie) {
+    const WCHAR* lineSep = L"\n";
+
     gAllowAllocFailure++;
     defer {
         gAllowAllocFailure--;
@@ -360,6 +646,9 @@ PageText EngineEbook::ExtractPageText(int pageNo) {
 
     Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
     for (DrawInstr& i : *pageInstrs) {
+        if (cookie && cookie->abort) {
+            return {};
+        }
         Rect bbox = GetInstrBbox(i, pageBorder);
         switch (i.type) {
             case DrawInstrType::String:
@@ -435,7 +724,12 @@ PageElement* EngineEbook::CreatePageLink(DrawInstr* link, Rect rect, int pageNo)
         return newEbookLink(link, rect, nullptr, pageNo);
     }
 
-    DrawInstr* baseAnchor = baseAnchors.at(pageNo - 1);
+    DrawInstr* baseAnchor = nullptr;
+    WaitForPage(pageNo);
+    {
+        ScopedCritSec scope(&formatAccess);
+        baseAnchor = baseAnchors.at(pageNo - 1);
+    }
     if (baseAnchor) {
         AutoFree basePath(str::DupN(baseAnchor->str.s, baseAnchor->str.len));
         AutoFree relPath(ResolveHtmlEntities(link->str.s, link->str.len));
@@ -451,6 +745,19 @@ PageElement* EngineEbook::CreatePageLink(DrawInstr* link, Rect rect, int pageNo)
 }
 
 Vec<IPageElement*>* EngineEbook::GetElements(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    PageData* data = GetPageData(pageNo);
+    if (!data->elements) {
+        data->elements = BuildElements(pageNo);
+    }
+    auto els = new Vec<IPageElement*>();
+    for (IPageElement* el : *data->elements) {
+        els->Append(clonePageElement(el));
+    }
+    return els;
+}
+
+Vec<IPageElement*>* EngineEbook::BuildElements(int pageNo) {
     auto els = new Vec<IPageElement*>();
 
     Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
@@ -495,25 +802,17 @@ RenderedBitmap* EngineEbook::GetImageForPageElement(IPageElement* iel) {
 }
 
 IPageElement* EngineEbook::GetElementAtPos(int pageNo, PointF pt) {
-    auto els = GetElements(pageNo);
-    if (!els) {
-        return nullptr;
+    ScopedCritSec scope(&pagesAccess);
+    PageData* data = GetPageData(pageNo);
+    if (!data->elements) {
+        data->elements = BuildElements(pageNo);
     }
-
-    IPageElement* el = nullptr;
-    for (size_t i = 0; i < els->size() && !el; i++) {
-        if (els->at(i)->GetRect().Contains(pt)) {
-            el = els->at(i);
+    for (IPageElement* el : *data->elements) {
+        if (el->GetRect().Contains(pt)) {
+            return clonePageElement(el);
         }
     }
-
-    if (el) {
-        els->Remove(el);
-    }
-    DeleteVecMembers(*els);
-    delete els;
-
-    return el;
+    return nullptr;
 }
 
 PageDestination* EngineEbook::GetNamedDest(const WCHAR* name) {
@@ -522,6 +821,8 @@ PageDestination* EngineEbook::GetNamedDest(const WCHAR* name) {
     if (str::FindChar(id, '#')) {
         id = str::FindChar(id, '#') + 1;
     }
+    // anchors are only complete once all pages have been formatted
+    WaitForPage(PageCount());
 
     // if the name consists of both path and ID,
     // try to first skip to the page with the desired
@@ -688,6 +989,7 @@ class EngineEpub : public EngineEbook {
     EngineBase* Clone() override;
 
     std::span<u8> GetFileData() override;
+    std::span<u8> BorrowFileData() override;
     bool SaveFileAs(const char* copyFileName, bool includeUserAnnots = false) override;
 
     WCHAR* GetProperty(DocumentProperty prop) override {
@@ -704,6 +1006,10 @@ class EngineEpub : public EngineEbook {
     IStream* stream = nullptr;
     TocTree* tocTree = nullptr;
 
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new EpubFormatter(args, doc);
+    }
+
     bool Load(const WCHAR* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
@@ -715,6 +1021,7 @@ EngineEpub::EngineEpub() : EngineEbook() {
 }
 
 EngineEpub::~EngineEpub() {
+    StopFormatting();
     delete doc;
     delete tocTree;
     if (stream) {
@@ -767,11 +1074,7 @@ bool EngineEpub::FinishLoading() {
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
-    pages = EpubFormatter(&args, doc).FormatAllPages(false);
-
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!FormatPages(args, false, true)) {
         return false;
     }
 
@@ -789,11 +1092,19 @@ std::span<u8> EngineEpub::GetFileData() {
     return GetStreamOrFileData(stream, fileName);
 }
 
+std::span<u8> EngineEpub::BorrowFileData() {
+    return GetStreamMemory(stream);
+}
+
 bool EngineEpub::SaveFileAs(const char* copyFileName, bool includeUserAnnots) {
     UNUSED(includeUserAnnots);
     AutoFreeWstr dstPath = strconv::Utf8ToWstr(copyFileName);
 
     if (stream) {
+        auto data = BorrowFileData();
+        if (!data.empty() && file::WriteFile(dstPath, data)) {
+            return true;
+        }
         AutoFree d = GetDataFromStream(stream, nullptr);
         bool ok = !d.empty() && file::WriteFile(dstPath, d.AsSpan());
         if (ok) {
@@ -856,6 +1167,7 @@ class EngineFb2 : public EngineEbook {
         defaultFileExt = L".fb2";
     }
     virtual ~EngineFb2() {
+        StopFormatting();
         delete tocTree;
         delete doc;
     }
@@ -880,6 +1192,10 @@ class EngineFb2 : public EngineEbook {
     Fb2Doc* doc = nullptr;
     TocTree* tocTree = nullptr;
 
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new Fb2Formatter(args, doc);
+    }
+
     bool Load(const WCHAR* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
@@ -914,10 +1230,7 @@ bool EngineFb2::FinishLoading() {
         defaultFileExt = L".fb2z";
     }
 
-    pages = Fb2Formatter(&args, doc).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!FormatPages(args, false, true)) {
         return false;
     }
     return pageCount > 0;
@@ -974,6 +1287,7 @@ class EngineMobi : public EngineEbook {
         defaultFileExt = L".mobi";
     }
     ~EngineMobi() override {
+        StopFormatting();
         delete tocTree;
         delete doc;
     }
@@ -999,6 +1313,10 @@ class EngineMobi : public EngineEbook {
     MobiDoc* doc = nullptr;
     TocTree* tocTree = nullptr;
 
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new MobiFormatter(args, doc);
+    }
+
     bool Load(const WCHAR* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
@@ -1029,10 +1347,7 @@ bool EngineMobi::FinishLoading() {
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
-    pages = MobiFormatter(&args, doc).FormatAllPages();
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!FormatPages(args, true, true)) {
         return false;
     }
     return pageCount > 0;
@@ -1043,6 +1358,7 @@ PageDestination* EngineMobi::GetNamedDest(const WCHAR* name) {
     if (filePos < 0 || 0 == filePos && *name != '0') {
         return nullptr;
     }
+    WaitForPage(PageCount());
     int pageNo;
     for (pageNo = 1; pageNo < PageCount(); pageNo++) {
         if (pages->at(pageNo)->reparseIdx > filePos) {
@@ -1124,6 +1440,7 @@ class EnginePdb : public EngineEbook {
         defaultFileExt = L".pdb";
     }
     virtual ~EnginePdb() {
+        StopFormatting();
         delete tocTree;
         delete doc;
     }
@@ -1147,6 +1464,10 @@ class EnginePdb : public EngineEbook {
     PalmDoc* doc = nullptr;
     TocTree* tocTree = nullptr;
 
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new HtmlFormatter(args);
+    }
+
     bool Load(const WCHAR* fileName);
 };
 
@@ -1167,10 +1488,7 @@ bool EnginePdb::Load(const WCHAR* fileName) {
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
-    pages = HtmlFormatter(&args).FormatAllPages();
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!FormatPages(args, true, true)) {
         return false;
     }
 
@@ -1292,10 +1610,10 @@ void ChmFormatter::HandleTagPagebreak(HtmlToken* t) {
     }
     if (attr) {
         Gdiplus::RectF bbox(0, currY, pageDx, 0);
-        currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
+        currPageInstr.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
         pagePath.Set(str::DupN(attr->val, attr->valLen));
         // reset CSS style rules for the new document
-        styleRules.Reset();
+        ResetStyleRules();
     }
 }
 
@@ -1362,6 +1680,10 @@ class EngineChm : public EngineEbook {
     ChmDataCache* dataCache = nullptr;
     TocTree* tocTree = nullptr;
 
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new ChmFormatter(args, dataCache);
+    }
+
     bool Load(const WCHAR* fileName);
 
     PageElement* CreatePageLink(DrawInstr* link, Rect rect, int pageNo) override;
@@ -1491,10 +1813,8 @@ bool EngineChm::Load(const WCHAR* fileName) {
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplusQuick;
 
-    pages = ChmFormatter(&args, dataCache).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    // chmlib isn't thread-safe and the document is also accessed for the ToC and links
+    if (!FormatPages(args, false, false)) {
         return false;
     }
 
@@ -1588,6 +1908,7 @@ class EngineHtml : public EngineEbook {
         defaultFileExt = L".html";
     }
     virtual ~EngineHtml() {
+        StopFormatting();
         delete doc;
     }
     EngineBase* Clone() override {
@@ -1607,6 +1928,10 @@ class EngineHtml : public EngineEbook {
   protected:
     HtmlDoc* doc = nullptr;
 
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new HtmlFileFormatter(args, doc);
+    }
+
     bool Load(const WCHAR* fileName);
 
     PageElement* CreatePageLink(DrawInstr* link, Rect rect, int pageNo) override;
@@ -1629,10 +1954,7 @@ bool EngineHtml::Load(const WCHAR* fileName) {
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplus;
 
-    pages = HtmlFileFormatter(&args, doc).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!FormatPages(args, false, true)) {
         return false;
     }
 
@@ -1690,6 +2012,7 @@ class EngineTxt : public EngineEbook {
         defaultFileExt = L".txt";
     }
     virtual ~EngineTxt() {
+        StopFormatting();
         delete tocTree;
         delete doc;
     }
@@ -1713,6 +2036,10 @@ class EngineTxt : public EngineEbook {
     TxtDoc* doc = nullptr;
     TocTree* tocTree = nullptr;
 
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new TxtFormatter(args);
+    }
+
     bool Load(const WCHAR* fileName);
 };
 
@@ -1744,10 +2071,7 @@ bool EngineTxt::Load(const WCHAR* fileName) {
     args.textAllocator = &allocator;
     args.textRenderMethod = mui::TextRenderMethodGdiplus;
 
-    pages = TxtFormatter(&args).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!FormatPages(args, false, true)) {
         return false;
     }
 
@@ -1775,6 +2099,426 @@ EngineBase* EngineTxt::CreateFromFile(const WCHAR* fileName) {
     return engine;
 }
 
+/* EngineBase for huge TXT and log files */
+
+// such files are too large to be converted to HTML and formatted up front,
+// so they're memory mapped and only the start of every page is indexed
+// (pages are formatted and decoded on demand, one line of text per line of the file)
+
+#define TXT_STREAM_MIN_FILE_SIZE (16 * 1024 * 1024)
+#define TXT_STREAM_LINES_PER_PAGE 64
+// pages are wide enough for lines of up to this many characters, longer lines are clipped
+#define TXT_STREAM_MIN_LINE_CHARS 80
+#define TXT_STREAM_MAX_LINE_CHARS 400
+// (parts of) lines beyond this many bytes are neither shown nor searched
+#define TXT_STREAM_MAX_LINE_BYTES (16 * 1024)
+#define TXT_STREAM_TAB_SIZE 8
+
+static const WCHAR* GetMonospaceFontName() {
+    Gdiplus::FontFamily family(L"Consolas");
+    return family.IsAvailable() ? L"Consolas" : L"Courier New";
+}
+
+// decodes a line without its line end, with tabs expanded and control characters replaced
+static WCHAR* DecodeTxtLine(const char* s, size_t len, uint codePage) {
+    if (len > 0 && '\r' == s[len - 1]) {
+        len--;
+    }
+    len = std::min(len, (size_t)TXT_STREAM_MAX_LINE_BYTES);
+    if (0 == len) {
+        return str::Dup(L"");
+    }
+    AutoFreeWstr line = strconv::ToWideChar(s, codePage, (int)len);
+    if (!line) {
+        return str::Dup(L"");
+    }
+    str::WStr res(len);
+    for (const WCHAR* c = line; *c; c++) {
+        if ('\t' == *c) {
+            do {
+                res.Append(' ');
+            } while (res.size() % TXT_STREAM_TAB_SIZE != 0);
+        } else if (*c < 0x20) {
+            res.Append(' ');
+        } else {
+            res.Append(*c);
+        }
+    }
+    return res.StealData();
+}
+
+class EngineTxtStream : public EngineBase {
+  public:
+    EngineTxtStream() {
+        kind = kindEngineTxt;
+        defaultFileExt = L".txt";
+    }
+    ~EngineTxtStream() override;
+
+    EngineBase* Clone() override {
+        const WCHAR* fileName = FileName();
+        if (!fileName) {
+            return nullptr;
+        }
+        return CreateFromFile(fileName);
+    }
+
+    RectF PageMediabox(int pageNo) override {
+        UNUSED(pageNo);
+        return pageRect;
+    }
+    RectF PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
+
+    RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+    RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
+
+    std::span<u8> GetFileData() override;
+    std::span<u8> BorrowFileData() override {
+        return {(u8*)data, size};
+    }
+    bool SaveFileAs(const char* copyFileName, bool includeUserAnnots = false) override;
+    PageText ExtractPageText(int pageNo, AbortCookie** cookie_out = nullptr) override;
+    // make RenderCache request larger tiles than per default
+    bool HasClipOptimizations(int pageNo) override {
+        UNUSED(pageNo);
+        return false;
+    }
+
+    WCHAR* GetProperty(DocumentProperty prop) override {
+        UNUSED(prop);
+        return nullptr;
+    }
+
+    Vec<IPageElement*>* GetElements(int pageNo) override {
+        UNUSED(pageNo);
+        return nullptr;
+    }
+    IPageElement* GetElementAtPos(int pageNo, PointF pt) override {
+        UNUSED(pageNo);
+        UNUSED(pt);
+        return nullptr;
+    }
+
+    bool BenchLoadPage(int pageNo) override {
+        UNUSED(pageNo);
+        return true;
+    }
+
+    static EngineBase* CreateFromFile(const WCHAR* fileName);
+
+  protected:
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = nullptr;
+    const char* data = nullptr;
+    size_t size = 0;
+    // after a UTF-8 BOM
+    size_t textStart = 0;
+    uint codePage = CP_ACP;
+    // offset of the first line of every page
+    Vec<size_t> pageStarts;
+    size_t maxLineLen = 0;
+
+    const WCHAR* fontName = nullptr;
+    float fontSize = 0;
+    float charDx = 0;
+    float lineDy = 0;
+    float pageBorder = 0;
+    RectF pageRect;
+
+    bool Load(const WCHAR* fileName);
+    void IndexLines();
+    void CalcPageRect();
+    void GetPageLines(int pageNo, WStrVec& lines);
+    void GetTransform(Matrix& m, float zoom, int rotation);
+};
+
+EngineTxtStream::~EngineTxtStream() {
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (hMapping) {
+        CloseHandle(hMapping);
+    }
+    if (hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(hFile);
+    }
+}
+
+bool EngineTxtStream::Load(const WCHAR* fileName) {
+    SetFileName(fileName);
+    defaultFileExt = path::GetExtNoFree(fileName);
+
+    // log files might still be written to
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    hFile = CreateFileW(fileName, GENERIC_READ, share, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart <= 0 || (u64)fileSize.QuadPart > (u64)SIZE_MAX) {
+        return false;
+    }
+    size = (size_t)fileSize.QuadPart;
+    hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!hMapping) {
+        return false;
+    }
+    data = (const char*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        return false;
+    }
+
+    std::string_view start(data, std::min(size, (size_t)64 * 1024));
+    if (str::StartsWith(start, UTF16_BOM) || str::StartsWith(start, UTF16BE_BOM)) {
+        // not line-indexable byte by byte, TxtDoc handles these
+        return false;
+    }
+    if (str::StartsWith(start, UTF8_BOM)) {
+        textStart = 3;
+        codePage = CP_UTF8;
+    } else {
+        // judge by the complete lines at the start of the file
+        size_t n = start.size();
+        while (n > 0 && data[n - 1] != '\n' && n < size) {
+            n--;
+        }
+        if (0 == n) {
+            n = start.size();
+        }
+        bool isUtf8 = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, data, (int)n, nullptr, 0) != 0;
+        codePage = isUtf8 ? CP_UTF8 : GuessTextCodepage(data, n, CP_ACP);
+    }
+
+    IndexLines();
+    pageCount = (int)pageStarts.size();
+    CalcPageRect();
+    return pageCount > 0;
+}
+
+void EngineTxtStream::IndexLines() {
+    const char* s = data + textStart;
+    const char* end = data + size;
+    const char* lineStart = s;
+    size_t nLines = 0;
+
+    auto addLine = [&](const char* next) {
+        if (nLines % TXT_STREAM_LINES_PER_PAGE == 0) {
+            pageStarts.Append(lineStart - data);
+        }
+        nLines++;
+        maxLineLen = std::max(maxLineLen, (size_t)(next - lineStart));
+        lineStart = next;
+    };
+
+#if defined(HAS_SSE2)
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; s + 16 <= end; s += 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)s), nl));
+        while (mask != 0) {
+            unsigned long idx;
+            _BitScanForward(&idx, mask);
+            addLine(s + idx + 1);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; s < end; s++) {
+        if ('\n' == *s) {
+            addLine(s + 1);
+        }
+    }
+    if (lineStart < end || 0 == nLines) {
+        // the last line without a line end (or an empty file)
+        addLine(end);
+    }
+}
+
+void EngineTxtStream::CalcPageRect() {
+    fontName = GetMonospaceFontName();
+    fontSize = GetDefaultFontSize() * GetFileDPI() / 72.f;
+    pageBorder = 0.4f * GetFileDPI();
+
+    Gdiplus::Bitmap bmp(1, 1, PixelFormat32bppARGB);
+    Graphics g(&bmp);
+    mui::InitGraphicsMode(&g);
+    Gdiplus::Font font(fontName, fontSize, Gdiplus::FontStyleRegular, Gdiplus::UnitPixel);
+    Gdiplus::RectF bbox;
+    const WCHAR* sample = L"0123456789";
+    g.MeasureString(sample, 10, &font, Gdiplus::PointF(0, 0), Gdiplus::StringFormat::GenericTypographic(), &bbox);
+    charDx = bbox.Width / 10;
+    lineDy = font.GetHeight(&g);
+
+    // maxLineLen is in bytes and includes the line end, which is good enough for sizing the pages
+    int lineChars = (int)std::min(maxLineLen, (size_t)TXT_STREAM_MAX_LINE_CHARS);
+    lineChars = std::max(lineChars, TXT_STREAM_MIN_LINE_CHARS);
+    float dx = lineChars * charDx + 2 * pageBorder;
+    float dy = TXT_STREAM_LINES_PER_PAGE * lineDy + 2 * pageBorder;
+    pageRect = RectF(0, 0, ceilf(dx), ceilf(dy));
+}
+
+void EngineTxtStream::GetPageLines(int pageNo, WStrVec& lines) {
+    CrashIf(pageNo < 1 || pageNo > pageCount);
+    if (pageNo < 1 || pageNo > pageCount) {
+        return;
+    }
+    const char* s = data + pageStarts.at(pageNo - 1);
+    const char* end = pageNo < pageCount ? data + pageStarts.at(pageNo) : data + size;
+    while (s < end) {
+        const char* next = (const char*)memchr(s, '\n', end - s);
+        const char* lineEnd = next ? next : end;
+        lines.Append(DecodeTxtLine(s, lineEnd - s, codePage));
+        s = next ? next + 1 : end;
+    }
+}
+
+RectF EngineTxtStream::PageContentBox(int pageNo, RenderTarget target) {
+    UNUSED(target);
+    RectF mbox = PageMediabox(pageNo);
+    mbox.Inflate(-pageBorder, -pageBorder);
+    return mbox;
+}
+
+void EngineTxtStream::GetTransform(Matrix& m, float zoom, int rotation) {
+    GetBaseTransform(m, ToGdipRectF(pageRect), zoom, rotation);
+}
+
+RectF EngineTxtStream::Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse) {
+    UNUSED(pageNo);
+    Gdiplus::PointF pts[2] = {Gdiplus::PointF(rect.x, rect.y), Gdiplus::PointF(rect.x + rect.dx, rect.y + rect.dy)};
+    Matrix m;
+    GetTransform(m, zoom, rotation);
+    if (inverse) {
+        m.Invert();
+    }
+    m.TransformPoints(pts, 2);
+    return RectF::FromXY(pts[0].X, pts[0].Y, pts[1].X, pts[1].Y);
+}
+
+RenderedBitmap* EngineTxtStream::RenderPage(RenderPageArgs& args) {
+    auto pageNo = args.pageNo;
+    RectF pageRc = args.pageRect ? *args.pageRect : PageMediabox(pageNo);
+    Rect screen = Transform(pageRc, pageNo, args.zoom, args.rotation).Round();
+    Point screenTL = screen.TL();
+    screen.Offset(-screen.x, -screen.y);
+
+    HANDLE hMap = nullptr;
+    HBITMAP hbmp = CreateMemoryBitmap(screen.Size(), &hMap);
+    HDC hDC = CreateCompatibleDC(nullptr);
+    DeleteObject(SelectObject(hDC, hbmp));
+
+    WStrVec lines;
+    GetPageLines(pageNo, lines);
+    {
+        Graphics g(hDC);
+        mui::InitGraphicsMode(&g);
+
+        SolidBrush white(Color(0xFF, 0xFF, 0xFF));
+        Gdiplus::Rect screenR(ToGdipRect(screen));
+        screenR.Inflate(1, 1);
+        g.FillRectangle(&white, screenR);
+
+        Matrix m;
+        GetTransform(m, args.zoom, args.rotation);
+        m.Translate((float)-screenTL.x, (float)-screenTL.y, MatrixOrderAppend);
+        g.SetTransform(&m);
+        RectF content = PageContentBox(pageNo);
+        g.SetClip(Gdiplus::RectF(content.x, content.y, content.dx, content.dy));
+
+        Gdiplus::Font font(fontName, fontSize, Gdiplus::FontStyleRegular, Gdiplus::UnitPixel);
+        SolidBrush black(Color((ARGB)Color::Black));
+        const Gdiplus::StringFormat* format = Gdiplus::StringFormat::GenericTypographic();
+        // no need to lay out more than what fits onto the page
+        int maxChars = (int)(content.dx / charDx) + 1;
+        for (size_t i = 0; i < lines.size(); i++) {
+            int len = std::min((int)str::Len(lines.at(i)), maxChars);
+            if (len > 0) {
+                Gdiplus::PointF pt(pageBorder, pageBorder + i * lineDy);
+                g.DrawString(lines.at(i), len, &font, pt, format, &black);
+            }
+        }
+    }
+    DeleteDC(hDC);
+
+    return new RenderedBitmap(hbmp, screen.Size(), hMap);
+}
+
+// a page is only a few lines, so there's no need for aborting
+PageText EngineTxtStream::ExtractPageText(int pageNo, AbortCookie** cookie_out) {
+    UNUSED(cookie_out);
+    gAllowAllocFailure++;
+    defer {
+        gAllowAllocFailure--;
+    };
+
+    WStrVec lines;
+    GetPageLines(pageNo, lines);
+
+    str::WStr content;
+    Vec<Rect> coords;
+    for (size_t i = 0; i < lines.size(); i++) {
+        const WCHAR* line = lines.at(i);
+        size_t len = str::Len(line);
+        float y = pageBorder + i * lineDy;
+        for (size_t k = 0; k < len; k++) {
+            RectF bbox(pageBorder + k * charDx, y, charDx, lineDy);
+            coords.Append(bbox.Round());
+        }
+        content.Append(line);
+        content.Append(L'\n');
+        coords.AppendBlanks(1);
+    }
+    CrashIf(coords.size() != content.size());
+
+    PageText res;
+    res.len = (int)content.size();
+    res.text = content.StealData();
+    res.coords = coords.StealData();
+    return res;
+}
+
+std::span<u8> EngineTxtStream::GetFileData() {
+    const WCHAR* fileName = FileName();
+    if (!fileName) {
+        return {};
+    }
+    return file::ReadFile(fileName);
+}
+
+bool EngineTxtStream::SaveFileAs(const char* copyFileName, bool includeUserAnnots) {
+    UNUSED(includeUserAnnots);
+    const WCHAR* fileName = FileName();
+    if (!fileName) {
+        return false;
+    }
+    AutoFreeWstr path = strconv::Utf8ToWstr(copyFileName);
+    auto res = CopyFileW(fileName, path, FALSE);
+    return res != 0;
+}
+
+EngineBase* EngineTxtStream::CreateFromFile(const WCHAR* fileName) {
+    EngineTxtStream* engine = new EngineTxtStream();
+    if (!engine->Load(fileName)) {
+        delete engine;
+        return nullptr;
+    }
+    return engine;
+}
+
+static bool IsHugeTxtFile(const WCHAR* fileName) {
+    if (str::EndsWithI(fileName, L".tcr")) {
+        // compressed
+        return false;
+    }
+    AutoFree path = strconv::WstrToUtf8(fileName);
+    return file::GetSize(path.AsView()) >= TXT_STREAM_MIN_FILE_SIZE;
+}
+
 EngineBase* CreateTxtEngineFromFile(const WCHAR* fileName) {
+    if (IsHugeTxtFile(fileName)) {
+        EngineBase* engine = EngineTxtStream::CreateFromFile(fileName);
+        if (engine) {
+            return engine;
+        }
+    }
     return EngineTxt::CreateFromFile(fileName);
 }
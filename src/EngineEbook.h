@@ -13,3 +13,5 @@ EngineBase* CreateHtmlEngineFromFile(const WCHAR* fileName);
 EngineBase* CreateTxtEngineFromFile(const WCHAR* fileName);
 
 void SetDefaultEbookFont(const WCHAR* name, float size);
+// frees the decoded images shared by the ebook engines and the ebook UI
+void FreeEbookImageCache();
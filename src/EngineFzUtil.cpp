@@ -8,6 +8,12 @@ extern "C" {
 }
 
 #include "utils/BaseUtil.h"
+#if defined(_M_IX86) || defined(_M_X64)
+// SSE2 is available on all processors we support
+#include <intrin.h>
+#include <emmintrin.h>
+#define HAS_SSE2 1
+#endif
 #include "utils/Archive.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
@@ -31,6 +37,116 @@ extern "C" {
 // and displayed; larger files will be kept open while they're displayed
 // so that their content can be loaded on demand in order to preserve memory
 #define MAX_MEMORY_FILE_SIZE (32 * 1024 * 1024)
+// files on network shares and removable media are slow to read in full,
+// so only very small ones are loaded before the first page can be displayed
+#define MAX_MEMORY_FILE_SIZE_SLOW_DRIVE (2 * 1024 * 1024)
+
+// upper bound for the memory MuPDF uses for caching each document's decoded
+// images, fonts, etc. (only the stores of documents in visible tabs stay
+// filled, see EngineBase::ReleaseCachedResources)
+static size_t gFzStoreSize = FZ_STORE_DEFAULT;
+
+void SetFzStoreSizeMB(int sizeMB) {
+    size_t size = (size_t)sizeMB * 1024 * 1024;
+    if (sizeMB <= 0) {
+        // an eighth of the physical memory (but at least 64 MB and at most 1 GB)
+        size = FZ_STORE_DEFAULT;
+        MEMORYSTATUSEX ms{};
+        ms.dwLength = sizeof(ms);
+        if (GlobalMemoryStatusEx(&ms)) {
+            DWORDLONG s = std::clamp(ms.ullTotalPhys / 8, (DWORDLONG)64 << 20, (DWORDLONG)1 << 30);
+            size = (size_t)s;
+        }
+#ifndef _WIN64
+        // 32-bit processes run out of address space much sooner
+        size = std::min(size, (size_t)FZ_STORE_DEFAULT);
+#endif
+    }
+    gFzStoreSize = size;
+}
+
+#define MAX_JPX_DECODE_THREADS 8
+
+void SetJpxDecodeThreads(int renderThreads) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    // the other render threads might be busy with other pages at the same time
+    int n = (int)si.dwNumberOfProcessors - std::max(renderThreads, 1) + 1;
+    fz_set_jpx_decode_threads(std::clamp(n, 1, MAX_JPX_DECODE_THREADS));
+}
+
+// to be passed to fz_new_context
+size_t FzStoreSize() {
+    return gFzStoreSize;
+}
+
+// each allocation is prefixed with its size (padded to keep the alignment malloc guarantees)
+constexpr size_t kFzMemHeaderSize = 16;
+
+static LONG64 gFzAllocatedTotal = 0;
+
+static void FzMemAdd(FzMemCounter* mc, i64 diff) {
+    InterlockedAdd64(&mc->allocated, diff);
+    InterlockedAdd64(&gFzAllocatedTotal, diff);
+}
+
+static void* FzMemMalloc(void* user, size_t size) {
+    if (size > SIZE_MAX - kFzMemHeaderSize) {
+        return nullptr;
+    }
+    SampleAlloc(size);
+    char* p = (char*)malloc(size + kFzMemHeaderSize);
+    if (!p) {
+        return nullptr;
+    }
+    *(size_t*)p = size;
+    FzMemAdd((FzMemCounter*)user, (i64)size);
+    return p + kFzMemHeaderSize;
+}
+
+static void FzMemFree(void* user, void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    char* p = (char*)ptr - kFzMemHeaderSize;
+    size_t size = *(size_t*)p;
+    FzMemAdd((FzMemCounter*)user, -(i64)size);
+    free(p);
+}
+
+static void* FzMemRealloc(void* user, void* ptr, size_t size) {
+    if (!ptr) {
+        return FzMemMalloc(user, size);
+    }
+    if (0 == size) {
+        FzMemFree(user, ptr);
+        return nullptr;
+    }
+    if (size > SIZE_MAX - kFzMemHeaderSize) {
+        return nullptr;
+    }
+    char* p = (char*)ptr - kFzMemHeaderSize;
+    size_t oldSize = *(size_t*)p;
+    SampleAlloc(size);
+    p = (char*)realloc(p, size + kFzMemHeaderSize);
+    if (!p) {
+        return nullptr;
+    }
+    *(size_t*)p = size;
+    FzMemAdd((FzMemCounter*)user, (i64)size - (i64)oldSize);
+    return p + kFzMemHeaderSize;
+}
+
+FzMemCounter::FzMemCounter() {
+    alloc.user = this;
+    alloc.malloc = FzMemMalloc;
+    alloc.realloc = FzMemRealloc;
+    alloc.free = FzMemFree;
+}
+
+i64 FzAllocatedTotal() {
+    return (i64)InterlockedAdd64(&gFzAllocatedTotal, 0);
+}
 
 RectF ToRectFl(fz_rect rect) {
     return RectF::FromXY(rect.x0, rect.y0, rect.x1, rect.y1);
@@ -101,7 +217,8 @@ fz_matrix fz_create_view_ctm(fz_rect mediabox, float zoom, int rotation) {
 
 struct istream_filter {
     IStream* stream;
-    u8 buf[4096];
+    // large reads are much faster for streams from network shares
+    u8 buf[64 * 1024];
 };
 
 extern "C" int next_istream(fz_context* ctx, fz_stream* stm, size_t max) {
@@ -161,6 +278,94 @@ fz_stream* fz_open_istream(fz_context* ctx, IStream* stream) {
     return stm;
 }
 
+struct mmap_filter {
+    HANDLE hFile;
+    HANDLE hMap;
+    u8* data;
+};
+
+extern "C" int next_mmap(fz_context* ctx, fz_stream* stm, size_t max) {
+    UNUSED(ctx);
+    UNUSED(stm);
+    UNUSED(max);
+    // the whole file is always available between rp and wp
+    return EOF;
+}
+
+extern "C" void seek_mmap(fz_context* ctx, fz_stream* stm, i64 offset, int whence) {
+    UNUSED(ctx);
+    mmap_filter* state = (mmap_filter*)stm->state;
+    // stm->pos is the size of the file, as for fz_open_memory
+    if (whence == 1) {
+        offset += stm->rp - state->data;
+    } else if (whence == 2) {
+        offset += stm->pos;
+    }
+    offset = std::clamp(offset, (i64)0, stm->pos);
+    stm->rp = state->data + offset;
+}
+
+extern "C" void drop_mmap(fz_context* ctx, void* state_) {
+    mmap_filter* state = (mmap_filter*)state_;
+    UnmapViewOfFile(state->data);
+    CloseHandle(state->hMap);
+    CloseHandle(state->hFile);
+    fz_free(ctx, state);
+}
+
+// maps the whole file read-only, so that the OS pages its content in on demand
+// and shares it with the file cache instead of us copying it into the heap.
+// returns nullptr if the file can't be mapped (e.g. it doesn't fit into the
+// address space of a 32-bit process)
+static fz_stream* fz_open_file_mapped(fz_context* ctx, const WCHAR* filePath) {
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE;
+    HANDLE hFile = CreateFileW(filePath, GENERIC_READ, share, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (INVALID_HANDLE_VALUE == hFile) {
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size) || size.QuadPart <= 0 || (u64)size.QuadPart > (u64)SIZE_MAX) {
+        CloseHandle(hFile);
+        return nullptr;
+    }
+    HANDLE hMap = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!hMap) {
+        CloseHandle(hFile);
+        return nullptr;
+    }
+    u8* data = (u8*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(hMap);
+        CloseHandle(hFile);
+        return nullptr;
+    }
+
+    mmap_filter* state = (mmap_filter*)fz_calloc_no_throw(ctx, 1, sizeof(mmap_filter));
+    if (!state) {
+        UnmapViewOfFile(data);
+        CloseHandle(hMap);
+        CloseHandle(hFile);
+        return nullptr;
+    }
+    state->hFile = hFile;
+    state->hMap = hMap;
+    state->data = data;
+
+    fz_stream* stm = nullptr;
+    fz_try(ctx) {
+        stm = fz_new_stream(ctx, state, next_mmap, drop_mmap);
+    }
+    fz_catch(ctx) {
+        // fz_new_stream already called drop_mmap
+        return nullptr;
+    }
+    stm->seek = seek_mmap;
+    stm->rp = data;
+    stm->wp = data + size.QuadPart;
+    stm->pos = size.QuadPart;
+    return stm;
+}
+
 void* fz_memdup(fz_context* ctx, void* p, size_t size) {
     void* res = fz_malloc_no_throw(ctx, size);
     if (!res) {
@@ -176,7 +381,12 @@ fz_stream* fz_open_file2(fz_context* ctx, const WCHAR* filePath) {
     i64 fileSize = file::GetSize(path.AsView());
     // load small files entirely into memory so that they can be
     // overwritten even by programs that don't open files with FILE_SHARE_READ
-    if (fileSize > 0 && fileSize < MAX_MEMORY_FILE_SIZE) {
+    bool isFixedDrive = path::IsOnFixedDrive(filePath);
+    i64 maxMemoryFileSize = MAX_MEMORY_FILE_SIZE;
+    if (fileSize >= MAX_MEMORY_FILE_SIZE_SLOW_DRIVE && !isFixedDrive) {
+        maxMemoryFileSize = MAX_MEMORY_FILE_SIZE_SLOW_DRIVE;
+    }
+    if (fileSize > 0 && fileSize < maxMemoryFileSize) {
         auto dataTmp = file::ReadFileWithAllocator(filePath, nullptr);
         if (dataTmp.empty()) {
             // failed to read
@@ -209,6 +419,15 @@ fz_stream* fz_open_file2(fz_context* ctx, const WCHAR* filePath) {
         return stm;
     }
 
+    // reading from a mapped file on a network share or removable media
+    // raises an exception instead of an error if the drive goes away
+    if (isFixedDrive) {
+        stm = fz_open_file_mapped(ctx, filePath);
+        if (stm) {
+            return stm;
+        }
+    }
+
     fz_try(ctx) {
         stm = fz_open_file_w(ctx, filePath);
     }
@@ -218,7 +437,33 @@ fz_stream* fz_open_file2(fz_context* ctx, const WCHAR* filePath) {
     return stm;
 }
 
+// returns the complete content of streams that are entirely in memory
+// (buffers and mapped files) without copying it. The data may only be used
+// while the stream is still open and nobody else reads from it.
+std::span<u8> fz_stream_mapped_data(fz_context* ctx, fz_stream* stm) {
+    fz_seek(ctx, stm, 0, 2);
+    i64 fileLen = fz_tell(ctx, stm);
+    fz_seek(ctx, stm, 0, 0);
+    if (fileLen <= 0 || (u64)fileLen > (u64)SIZE_MAX) {
+        return {};
+    }
+    size_t size = (size_t)fileLen;
+    if (fz_available(ctx, stm, size) < size) {
+        return {};
+    }
+    return {stm->rp, size};
+}
+
 std::span<u8> fz_extract_stream_data(fz_context* ctx, fz_stream* stream) {
+    auto mapped = fz_stream_mapped_data(ctx, stream);
+    if (!mapped.empty()) {
+        u8* res = (u8*)memdup(mapped.data(), mapped.size());
+        if (!res) {
+            return {};
+        }
+        return {res, mapped.size()};
+    }
+
     fz_seek(ctx, stream, 0, 2);
     i64 fileLen = fz_tell(ctx, stream);
     fz_seek(ctx, stream, 0, 0);
@@ -239,34 +484,111 @@ std::span<u8> fz_extract_stream_data(fz_context* ctx, fz_stream* stream) {
 }
 
 void fz_stream_fingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]) {
-    i64 fileLen = -1;
-    fz_buffer* buf = nullptr;
+    fz_md5 md5;
+    fz_md5_init(&md5);
 
+    // hash files that aren't in memory in chunks instead of reading them in full
+    u8* chunk = nullptr;
+    fz_var(chunk);
     fz_try(ctx) {
-        fz_seek(ctx, stm, 0, 2);
-        fileLen = fz_tell(ctx, stm);
-        fz_seek(ctx, stm, 0, 0);
-        buf = fz_read_all(ctx, stm, fileLen);
+        auto mapped = fz_stream_mapped_data(ctx, stm);
+        if (!mapped.empty()) {
+            fz_md5_update(&md5, mapped.data(), mapped.size());
+        } else {
+            const size_t chunkSize = 64 * 1024;
+            chunk = (u8*)fz_malloc(ctx, chunkSize);
+            fz_seek(ctx, stm, 0, 0);
+            size_t n;
+            while ((n = fz_read(ctx, stm, chunk, chunkSize)) > 0) {
+                fz_md5_update(&md5, chunk, n);
+            }
+        }
+    }
+    fz_always(ctx) {
+        fz_free(ctx, chunk);
     }
     fz_catch(ctx) {
         fz_warn(ctx, "couldn't read stream data, using a nullptr fingerprint instead");
         ZeroMemory(digest, 16);
         return;
     }
-    CrashIf(nullptr == buf);
-    u8* data;
-    size_t size = fz_buffer_extract(ctx, buf, &data);
-    CrashIf((size_t)fileLen != size);
-    fz_drop_buffer(ctx, buf);
-
-    fz_md5 md5;
-    fz_md5_init(&md5);
-    fz_md5_update(&md5, data, size);
     fz_md5_final(&md5, digest);
 }
 
 // try to produce an 8-bit palette for saving some memory
-static RenderedBitmap* try_render_as_palette_image(fz_pixmap* pixmap) {
+// (pixmap must be either RGBA or BGRA)
+// number of rows checked by PixmapMightFitPalette
+#define PALETTE_SAMPLE_ROWS 32
+
+// maps the colors of a pixmap (its pixels without alpha) to palette indices
+struct PaletteHash {
+    // a power of 2 and twice the maximum palette size
+    static constexpr int kSize = 512;
+    // as the alpha byte is masked out, this is never a color
+    static constexpr u32 kNoColor = 0xffffffff;
+
+    u32 colors[kSize];
+    u8 idxs[kSize];
+    int count = 0;
+
+    PaletteHash() {
+        memset(colors, 0xff, sizeof(colors));
+    }
+
+    // returns the color's index, adding it if it's new (or -1 if there are already 256 colors)
+    int FindOrAdd(u32 color) {
+        u32 slot = (color * 2654435761u) >> 23;
+        while (colors[slot] != color) {
+            if (colors[slot] == kNoColor) {
+                if (count == 256) {
+                    return -1;
+                }
+                colors[slot] = color;
+                idxs[slot] = (u8)count;
+                return count++;
+            }
+            slot = (slot + 1) & (kSize - 1);
+        }
+        return idxs[slot];
+    }
+};
+
+static inline u32 PixelColor(const u8* s) {
+    return *(const u32*)s & 0x00ffffff;
+}
+
+// most pages with more than 256 colors have that many in just a few rows,
+// so a sample of rows is checked before converting the whole pixmap
+static bool PixmapMightFitPalette(fz_pixmap* pixmap) {
+    int step = std::max(pixmap->h / PALETTE_SAMPLE_ROWS, 1);
+    PaletteHash hash;
+    for (int j = step / 2; j < pixmap->h; j += step) {
+        const u8* source = pixmap->samples + (size_t)j * pixmap->stride;
+        u32 last = PaletteHash::kNoColor;
+        for (int i = 0; i < pixmap->w; i++, source += 4) {
+            u32 c = PixelColor(source);
+            if (c != last && hash.FindOrAdd(c) < 0) {
+                return false;
+            }
+            last = c;
+        }
+    }
+    return true;
+}
+
+#if defined(HAS_SSE2)
+// returns true if the (4 byte) pixels s[0] to s[3] all have color c (ignoring alpha)
+static inline bool IsRunOf4(const u8* s, __m128i c) {
+    __m128i px = _mm_and_si128(_mm_loadu_si128((const __m128i*)s), _mm_set1_epi32(0x00ffffff));
+    return _mm_movemask_epi8(_mm_cmpeq_epi32(px, c)) == 0xffff;
+}
+#endif
+
+static RenderedBitmap* try_render_as_palette_image(fz_pixmap* pixmap, bool isBgr = false) {
+    if (!PixmapMightFitPalette(pixmap)) {
+        return nullptr;
+    }
+
     int w = pixmap->w;
     int h = pixmap->h;
     int rows8 = ((w + 3) / 4) * 4;
@@ -278,46 +600,47 @@ static RenderedBitmap* try_render_as_palette_image(fz_pixmap* pixmap) {
     ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
 
     u8* dest = bmpData;
-    u8* source = pixmap->samples;
     u32* palette = (u32*)bmi.Get()->bmiColors;
-    u8 grayIdxs[256] = {0};
+    PaletteHash hash;
 
-    int paletteSize = 0;
-    RGBQUAD c;
     for (int j = 0; j < h; j++) {
-        for (int i = 0; i < w; i++) {
-            c.rgbRed = *source++;
-            c.rgbGreen = *source++;
-            c.rgbBlue = *source++;
-            c.rgbReserved = 0;
-            source++;
-
-            /* find this color in the palette */
-            int k;
-            bool isGray = c.rgbRed == c.rgbGreen && c.rgbRed == c.rgbBlue;
-            if (isGray) {
-                k = grayIdxs[c.rgbRed] || palette[0] == *(u32*)&c ? grayIdxs[c.rgbRed] : paletteSize;
-            } else {
-                for (k = 0; k < paletteSize && palette[k] != *(u32*)&c; k++) {
-                    ;
-                }
+        const u8* source = pixmap->samples + (size_t)j * pixmap->stride;
+        u32 last = PaletteHash::kNoColor;
+        u8 lastIdx = 0;
+        for (int i = 0; i < w;) {
+#if defined(HAS_SSE2)
+            // most of a page is usually a single color, so runs are copied 4 pixels at a time
+            if (i + 4 <= w && last != PaletteHash::kNoColor && IsRunOf4(source, _mm_set1_epi32((int)last))) {
+                memset(dest, lastIdx, 4);
+                dest += 4;
+                source += 16;
+                i += 4;
+                continue;
             }
-            /* add it to the palette if it isn't in there and if there's still space left */
-            if (k == paletteSize) {
-                if (++paletteSize > 256) {
+#endif
+            u32 c = PixelColor(source);
+            if (c != last) {
+                int countBefore = hash.count;
+                int k = hash.FindOrAdd(c);
+                if (k < 0) {
                     free(bmpData);
                     return nullptr;
                 }
-                if (isGray) {
-                    grayIdxs[c.rgbRed] = (BYTE)k;
+                if (hash.count > countBefore) {
+                    /* palette entries are RGBQUADs, i.e. blue is the lowest byte */
+                    palette[k] = isBgr ? c : (c >> 16) | (c & 0xff00) | ((c & 0xff) << 16);
                 }
-                palette[k] = *(u32*)&c;
+                last = c;
+                lastIdx = (u8)k;
             }
             /* 8-bit data consists of indices into the color palette */
-            *dest++ = k;
+            *dest++ = lastIdx;
+            source += 4;
+            i++;
         }
         dest += rows8 - w;
     }
+    int paletteSize = hash.count;
 
     BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
     bmih->biSize = sizeof(*bmih);
@@ -381,8 +704,6 @@ RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap) {
         }
     }
 
-    ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
-
     fz_pixmap* bgrPixmap = nullptr;
     fz_var(bgrPixmap);
 
@@ -400,40 +721,641 @@ RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap) {
         return nullptr;
     }
 
-    int w = bgrPixmap->w;
-    int h = bgrPixmap->h;
-    int n = bgrPixmap->n;
-    int imgSize = bgrPixmap->stride * h;
-    int bitsCount = n * 8;
-
-    BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
-    bmih->biSize = sizeof(*bmih);
-    bmih->biWidth = w;
-    bmih->biHeight = -h;
-    bmih->biPlanes = 1;
-    bmih->biCompression = BI_RGB;
-    bmih->biBitCount = bitsCount;
-    bmih->biSizeImage = imgSize;
-    bmih->biClrUsed = 0;
-
+    // BGRA rows are 4 * w bytes, as in a 32-bit DIB section
+    CrashIf(bgrPixmap->n != 4 || bgrPixmap->stride != bgrPixmap->w * 4);
+    Size size(bgrPixmap->w, bgrPixmap->h);
     void* data = nullptr;
-    HANDLE hFile = INVALID_HANDLE_VALUE;
-    DWORD fl = PAGE_READWRITE;
-    HANDLE hMap = CreateFileMappingW(hFile, nullptr, fl, 0, imgSize, nullptr);
-    uint usage = DIB_RGB_COLORS;
-    HBITMAP hbmp = CreateDIBSection(nullptr, bmi, usage, &data, hMap, 0);
-    if (data) {
-        u8* samples = bgrPixmap->samples;
-        memcpy(data, samples, imgSize);
+    HANDLE hMap = nullptr;
+    HBITMAP hbmp = AllocPooledDib(size, &data, &hMap);
+    if (hbmp) {
+        memcpy(data, bgrPixmap->samples, (size_t)bgrPixmap->stride * size.dy);
     }
     fz_drop_pixmap(ctx, bgrPixmap);
     if (!hbmp) {
         return nullptr;
     }
-    // return a RenderedBitmap even if hbmp is nullptr so that callers can
-    // distinguish rendering errors from GDI resource exhaustion
-    // (and in the latter case retry using smaller target rectangles)
-    return new RenderedBitmap(hbmp, Size(w, h), hMap);
+    RenderedBitmap* res = new RenderedBitmap(hbmp, size, hMap);
+    res->isPooled = true;
+    return res;
+}
+
+// creates a pixmap for rendering into (which is cleared by the caller).
+// if no DIB section can be created, falls back to a regular RGBA pixmap
+// which new_rendered_dib_pixmap then converts with new_rendered_fz_pixmap
+fz_pixmap* fz_new_dib_pixmap(fz_context* ctx, fz_irect bbox, FzDibPixmap* dib) {
+    CrashIf(dib->pix || dib->hbmp || dib->hMap);
+    int w = bbox.x1 - bbox.x0;
+    int h = bbox.y1 - bbox.y0;
+    // 32-bit rows are always DWORD aligned, as DIB sections require it
+    void* data = nullptr;
+    dib->hbmp = AllocPooledDib(Size(w, h), &data, &dib->hMap);
+    if (dib->hbmp) {
+        dib->size = Size(w, h);
+        fz_colorspace* cs = fz_device_bgr(ctx);
+        dib->pix = fz_new_pixmap_with_bbox_and_data(ctx, cs, bbox, nullptr, 1, (u8*)data);
+        return dib->pix;
+    }
+    dib->pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), bbox, nullptr, 1);
+    return dib->pix;
+}
+
+// hands the DIB section over to a RenderedBitmap, call after closing the draw device.
+// dib must still be freed with fz_drop_dib_pixmap
+RenderedBitmap* new_rendered_dib_pixmap(fz_context* ctx, FzDibPixmap* dib) {
+    if (!dib->hbmp) {
+        return new_rendered_fz_pixmap(ctx, dib->pix);
+    }
+    RenderedBitmap* res = try_render_as_palette_image(dib->pix, true);
+    if (res) {
+        return res;
+    }
+    res = new RenderedBitmap(dib->hbmp, dib->size, dib->hMap);
+    res->isPooled = true;
+    dib->hbmp = nullptr;
+    dib->hMap = nullptr;
+    return res;
+}
+
+void fz_drop_dib_pixmap(fz_context* ctx, FzDibPixmap* dib) {
+    // the pixmap doesn't own the DIB section's bits
+    fz_drop_pixmap(ctx, dib->pix);
+    dib->pix = nullptr;
+    // e.g. if the page was converted to a palette image
+    ReleasePooledDib(dib->hbmp, dib->hMap, dib->size);
+    dib->hbmp = nullptr;
+    dib->hMap = nullptr;
+}
+
+// pixmaps created by fz_new_dib_pixmap are either BGRA or (if no DIB section
+// could be created) RGBA, so copying between them might require swapping R and B
+static bool IsSamePixmapLayout(fz_pixmap* p1, fz_pixmap* p2) {
+    return p1->x == p2->x && p1->y == p2->y && p1->w == p2->w && p1->h == p2->h && p1->n == p2->n &&
+           p1->alpha == p2->alpha && (p1->colorspace == p2->colorspace || p1->n == 4);
+}
+
+static void CopyPixmapSamples(fz_pixmap* dst, fz_pixmap* src) {
+    CrashIf(!IsSamePixmapLayout(dst, src));
+    size_t rowSize = (size_t)src->w * src->n;
+    bool swapRB = dst->colorspace != src->colorspace;
+    for (int y = 0; y < src->h; y++) {
+        u8* d = dst->samples + y * dst->stride;
+        u8* s = src->samples + y * src->stride;
+        if (!swapRB) {
+            memcpy(d, s, rowSize);
+            continue;
+        }
+        for (int x = 0; x < src->w; x++, d += 4, s += 4) {
+            d[0] = s[2];
+            d[1] = s[1];
+            d[2] = s[0];
+            d[3] = s[3];
+        }
+    }
+}
+
+// rasterizes display lists on top of each other with a clone of ctx, so that this
+// doesn't require the engine's ctxAccess: unlike documents, display lists can be
+// used by several threads at once. firstListSize is set to the size of lists[0],
+// as reported by fz_run_display_list through the cookie.
+// if firstLayer is given, it's used instead of rendering lists[0] and if
+// firstLayerOut is given, it receives a copy of the pixels after rendering lists[0]
+RenderedBitmap* FzRenderDisplayLists(fz_context* ctx, fz_display_list** lists, int nLists, fz_matrix ctm,
+                                     fz_irect bbox, fz_cookie* cookie, size_t* firstListSize,
+                                     fz_pixmap* firstLayer, fz_pixmap** firstLayerOut, bool isDraft) {
+    CrashIf(!cookie || nLists < 1);
+    fz_context* cctx = fz_clone_context(ctx);
+    if (!cctx) {
+        return nullptr;
+    }
+    if (isDraft) {
+        // the anti-aliasing level is per context, so this doesn't affect other renderings.
+        // text keeps its quality, as glyphs are cached (per level) and blurry text is
+        // much more noticeable than blurry graphics
+        fz_set_graphics_aa_level(cctx, 2);
+    }
+
+    fz_rect cliprect = fz_rect_from_irect(bbox);
+    FzDibPixmap dib;
+    fz_device* dev = nullptr;
+    RenderedBitmap* bitmap = nullptr;
+
+    fz_var(dev);
+    fz_var(dib);
+    fz_var(bitmap);
+
+    fz_try(cctx) {
+        // render directly into the bits of the bitmap
+        fz_pixmap* pix = fz_new_dib_pixmap(cctx, bbox, &dib);
+        int first = 0;
+        if (firstLayer && IsSamePixmapLayout(pix, firstLayer)) {
+            CopyPixmapSamples(pix, firstLayer);
+            first = 1;
+        } else {
+            // initialize with white background
+            fz_clear_pixmap_with_value(cctx, pix, 0xff);
+        }
+        dev = fz_new_draw_device(cctx, fz_identity, pix);
+        if (isDraft) {
+            fz_enable_device_hints(cctx, dev, FZ_DONT_INTERPOLATE_IMAGES);
+        }
+        for (int i = first; i < nLists; i++) {
+            if (lists[i]) {
+                fz_run_display_list(cctx, lists[i], dev, ctm, cliprect, cookie);
+            }
+            if (0 == i && lists[i]) {
+                // fz_run_display_list sets progress_max to the number of 32-bit nodes in the list
+                *firstListSize = cookie->progress_max * 4;
+            }
+            if (0 == i && firstLayerOut && !cookie->abort) {
+                // all of lists[0]'s clips and groups have been popped at this point,
+                // so pix contains exactly what it has drawn
+                fz_pixmap* layer = fz_new_pixmap_with_bbox(cctx, pix->colorspace, bbox, nullptr, pix->alpha);
+                CopyPixmapSamples(layer, pix);
+                *firstLayerOut = layer;
+            }
+        }
+        fz_close_device(cctx, dev);
+        bitmap = new_rendered_dib_pixmap(cctx, &dib);
+    }
+    fz_always(cctx) {
+        fz_drop_device(cctx, dev);
+        fz_drop_dib_pixmap(cctx, &dib);
+    }
+    fz_catch(cctx) {
+        delete bitmap;
+        bitmap = nullptr;
+    }
+    fz_drop_context(cctx);
+    return bitmap;
+}
+
+// a fitz device drawing display lists onto a GDI device context as vector
+// graphics, so that printed pages don't have to be spooled as page-sized
+// bitmaps. Glyphs are drawn as outlines and images as (transformed) DIBs.
+// GDI can't draw transparency, blend modes, soft masks, shadings, tiling
+// patterns, image masks and Type 3 glyphs faithfully, so a check pass
+// without hdc first finds out whether a page needs to be rasterized instead.
+struct FzGdiDevice {
+    fz_device super;
+    // nullptr during the check pass
+    HDC hdc;
+    fz_cookie* cookie;
+    bool needsRaster;
+};
+
+struct FzGdiPathArg {
+    HDC hdc;
+    fz_matrix ctm;
+};
+
+static POINT FzGdiPoint(fz_matrix ctm, float x, float y) {
+    fz_point pt = fz_transform_point_xy(x, y, ctm);
+    return POINT{(LONG)floorf(pt.x + 0.5f), (LONG)floorf(pt.y + 0.5f)};
+}
+
+static void FzGdiMoveTo(fz_context*, void* arg, float x, float y) {
+    FzGdiPathArg* pa = (FzGdiPathArg*)arg;
+    POINT pt = FzGdiPoint(pa->ctm, x, y);
+    MoveToEx(pa->hdc, pt.x, pt.y, nullptr);
+}
+
+static void FzGdiLineTo(fz_context*, void* arg, float x, float y) {
+    FzGdiPathArg* pa = (FzGdiPathArg*)arg;
+    POINT pt = FzGdiPoint(pa->ctm, x, y);
+    LineTo(pa->hdc, pt.x, pt.y);
+}
+
+static void FzGdiCurveTo(fz_context*, void* arg, float x1, float y1, float x2, float y2, float x3, float y3) {
+    FzGdiPathArg* pa = (FzGdiPathArg*)arg;
+    POINT pts[3] = {FzGdiPoint(pa->ctm, x1, y1), FzGdiPoint(pa->ctm, x2, y2), FzGdiPoint(pa->ctm, x3, y3)};
+    PolyBezierTo(pa->hdc, pts, 3);
+}
+
+static void FzGdiClosePath(fz_context*, void* arg) {
+    FzGdiPathArg* pa = (FzGdiPathArg*)arg;
+    CloseFigure(pa->hdc);
+}
+
+// quadratic curves and rectangles are converted to the above by fz_walk_path
+static const fz_path_walker gFzGdiPathWalker = {FzGdiMoveTo, FzGdiLineTo, FzGdiCurveTo, FzGdiClosePath};
+
+static bool FzGdiSetPath(fz_context* ctx, HDC hdc, const fz_path* path, fz_matrix ctm) {
+    FzGdiPathArg arg = {hdc, ctm};
+    BeginPath(hdc);
+    fz_walk_path(ctx, path, &gFzGdiPathWalker, &arg);
+    return EndPath(hdc);
+}
+
+static bool FzGdiSetTextPath(fz_context* ctx, HDC hdc, const fz_text* text, fz_matrix ctm) {
+    FzGdiPathArg arg = {hdc, fz_identity};
+    BeginPath(hdc);
+    for (fz_text_span* span = text->head; span; span = span->next) {
+        fz_matrix trm = span->trm;
+        for (int i = 0; i < span->len; i++) {
+            fz_text_item* item = &span->items[i];
+            if (item->gid < 0) {
+                continue;
+            }
+            trm.e = item->x;
+            trm.f = item->y;
+            // returns nullptr for Type 3 glyphs (which are rasterized)
+            fz_path* glyph = fz_outline_glyph(ctx, span->font, item->gid, fz_concat(trm, ctm));
+            if (glyph) {
+                fz_walk_path(ctx, glyph, &gFzGdiPathWalker, &arg);
+                fz_drop_path(ctx, glyph);
+            }
+        }
+    }
+    return EndPath(hdc);
+}
+
+static void FzGdiNeedsRaster(FzGdiDevice* dev) {
+    dev->needsRaster = true;
+    if (!dev->hdc && dev->cookie) {
+        // no need to look at the rest of the page
+        dev->cookie->abort = 1;
+    }
+}
+
+// returns false if there's nothing to draw or if it can't be drawn
+static bool FzGdiCheckAlpha(FzGdiDevice* dev, float alpha) {
+    if (alpha <= 0.f) {
+        return false;
+    }
+    if (alpha < 1.f) {
+        FzGdiNeedsRaster(dev);
+        return false;
+    }
+    return true;
+}
+
+static bool FzGdiCheckText(fz_context* ctx, FzGdiDevice* dev, const fz_text* text) {
+    for (fz_text_span* span = text->head; span; span = span->next) {
+        if (fz_font_t3_procs(ctx, span->font)) {
+            FzGdiNeedsRaster(dev);
+            return false;
+        }
+    }
+    return true;
+}
+
+static COLORREF FzGdiColor(fz_context* ctx, fz_colorspace* cs, const float* color, fz_color_params params) {
+    float rgb[3];
+    fz_convert_color(ctx, cs, color, fz_device_rgb(ctx), rgb, nullptr, params);
+    return RGB((BYTE)(fz_clamp(rgb[0], 0, 1) * 255 + 0.5f), (BYTE)(fz_clamp(rgb[1], 0, 1) * 255 + 0.5f),
+               (BYTE)(fz_clamp(rgb[2], 0, 1) * 255 + 0.5f));
+}
+
+static HPEN FzGdiCreatePen(const fz_stroke_state* stroke, fz_matrix ctm, COLORREF color) {
+    float expansion = fz_matrix_expansion(ctm);
+    DWORD width = (DWORD)std::max(floorf(stroke->linewidth * expansion + 0.5f), 1.f);
+    DWORD style = PS_GEOMETRIC;
+    switch (stroke->start_cap) {
+        case FZ_LINECAP_BUTT:
+            style |= PS_ENDCAP_FLAT;
+            break;
+        case FZ_LINECAP_ROUND:
+            style |= PS_ENDCAP_ROUND;
+            break;
+        default:
+            style |= PS_ENDCAP_SQUARE;
+            break;
+    }
+    switch (stroke->linejoin) {
+        case FZ_LINEJOIN_ROUND:
+            style |= PS_JOIN_ROUND;
+            break;
+        case FZ_LINEJOIN_BEVEL:
+            style |= PS_JOIN_BEVEL;
+            break;
+        default:
+            style |= PS_JOIN_MITER;
+            break;
+    }
+    // GDI supports at most 16 dash entries and no dash phase
+    DWORD dashes[16];
+    DWORD nDashes = (DWORD)std::min(stroke->dash_len, (int)dimof(dashes));
+    for (DWORD i = 0; i < nDashes; i++) {
+        dashes[i] = (DWORD)std::max(floorf(stroke->dash_list[i] * expansion + 0.5f), 1.f);
+    }
+    style |= nDashes > 0 ? PS_USERSTYLE : PS_SOLID;
+    LOGBRUSH lb = {BS_SOLID, color, 0};
+    return ExtCreatePen(style, width, &lb, nDashes, nDashes > 0 ? dashes : nullptr);
+}
+
+static void FzGdiFill(HDC hdc, int even_odd, COLORREF color) {
+    SetPolyFillMode(hdc, even_odd ? ALTERNATE : WINDING);
+    HBRUSH brush = CreateSolidBrush(color);
+    HGDIOBJ prev = SelectObject(hdc, brush);
+    FillPath(hdc);
+    SelectObject(hdc, prev);
+    DeleteObject(brush);
+}
+
+static void FzGdiStroke(HDC hdc, const fz_stroke_state* stroke, fz_matrix ctm, COLORREF color) {
+    HPEN pen = FzGdiCreatePen(stroke, ctm, color);
+    HGDIOBJ prev = SelectObject(hdc, pen);
+    SetMiterLimit(hdc, stroke->miterlimit, nullptr);
+    StrokePath(hdc);
+    SelectObject(hdc, prev);
+    DeleteObject(pen);
+}
+
+// clips are undone in FzGdiPopClip by restoring the DC
+static void FzGdiClip(HDC hdc, bool hasPath, int even_odd) {
+    SaveDC(hdc);
+    SetPolyFillMode(hdc, even_odd ? ALTERNATE : WINDING);
+    if (!hasPath || !SelectClipPath(hdc, RGN_AND)) {
+        // nothing is visible inside an empty clip path
+        IntersectClipRect(hdc, 0, 0, 0, 0);
+    }
+}
+
+static void FzGdiClipStroke(HDC hdc, bool hasPath, const fz_stroke_state* stroke, fz_matrix ctm) {
+    HPEN pen = FzGdiCreatePen(stroke, ctm, 0);
+    HGDIOBJ prev = SelectObject(hdc, pen);
+    SetMiterLimit(hdc, stroke->miterlimit, nullptr);
+    hasPath = hasPath && WidenPath(hdc);
+    SelectObject(hdc, prev);
+    DeleteObject(pen);
+    FzGdiClip(hdc, hasPath, 0);
+}
+
+static void FzGdiFillPath(fz_context* ctx, fz_device* dev, const fz_path* path, int even_odd, fz_matrix ctm,
+                          fz_colorspace* cs, const float* color, float alpha, fz_color_params params) {
+    FzGdiDevice* gdev = (FzGdiDevice*)dev;
+    if (!FzGdiCheckAlpha(gdev, alpha) || !gdev->hdc) {
+        return;
+    }
+    COLORREF col = FzGdiColor(ctx, cs, color, params);
+    if (FzGdiSetPath(ctx, gdev->hdc, path, ctm)) {
+        FzGdiFill(gdev->hdc, even_odd, col);
+    }
+}
+
+static void FzGdiStrokePath(fz_context* ctx, fz_device* dev, const fz_path* path, const fz_stroke_state* stroke,
+                            fz_matrix ctm, fz_colorspace* cs, const float* color, float alpha,
+                            fz_color_params params) {
+    FzGdiDevice* gdev = (FzGdiDevice*)dev;
+    if (!FzGdiCheckAlpha(gdev, alpha) || !gdev->hdc) {
+        return;
+    }
+    COLORREF col = FzGdiColor(ctx, cs, color, params);
+    if (FzGdiSetPath(ctx, gdev->hdc, path, ctm)) {
+        FzGdiStroke(gdev->hdc, stroke, ctm, col);
+    }
+}
+
+static void FzGdiClipPath(fz_context* ctx, fz_device* dev, const fz_path* path, int even_odd, fz_matrix ctm,
+                          fz_rect) {
+    FzGdiDevice* gdev = (FzGdiDevice*)dev;
+    if (gdev->hdc) {
+        bool hasPath = FzGdiSetPath(ctx, gdev->hdc, path, ctm);
+        FzGdiClip(gdev->hdc, hasPath, even_odd);
+    }
+}
+
+static void FzGdiClipStrokePath(fz_context* ctx, fz_device* dev, const fz_path* path, const fz_stroke_state* stroke,
+                                fz_matrix ctm, fz_rect) {
+    FzGdiDevice* gdev = (FzGdiDevice*)dev;
+    if (gdev->hdc) {
+        bool hasPath = FzGdiSetPath(ctx, gdev->hdc, path, ctm);
+        FzGdiClipStroke(gdev->hdc, hasPath, stroke, ctm);
+    }
+}
+
+static void FzGdiFillText(fz_context* ctx, fz_device* dev, const fz_text* text, fz_matrix ctm, fz_colorspace* cs,
+                          const float* color, float alpha, fz_color_params params) {
+    FzGdiDevice* gdev = (FzGdiDevice*)dev;
+    if (!FzGdiCheckAlpha(gdev, alpha) || !FzGdiCheckText(ctx, gdev, text) || !gdev->hdc) {
+        return;
+    }
+    COLORREF col = FzGdiColor(ctx, cs, color, params);
+    if (FzGdiSetTextPath(ctx, gdev->hdc, text, ctm)) {
+        FzGdiFill(gdev->hdc, 0, col);
+    }
+}
+
+static void FzGdiStrokeText(fz_context* ctx, fz_device* dev, const fz_text* text, const fz_stroke_state* stroke,
+                            fz_matrix ctm, fz_colorspace* cs, const float* color, float alpha,
+                            fz_color_params params) {
+    FzGdiDevice* gdev = (FzGdiDevice*)dev;
+    if (!FzGdiCheckAlpha(gdev, alpha) || !FzGdiCheckText(ctx, gdev, text) || !gdev->hdc) {
+        return;
+    }
+    COLORREF col = FzGdiColor(ctx, cs, color, params);
+    if (FzGdiSetTextPath(ctx, gdev->hdc, text, ctm)) {
+        FzGdiStroke(gdev->hdc, stroke, ctm, col);
+    }
+}
+
+static void FzGdiClipText(fz_context* ctx, fz_device* dev, const fz_text* text, fz_matrix ctm, fz_rect) {
+    FzGdiDevice* gdev = (FzGdiDevice*)dev;
+    bool canDraw = FzGdiCheckText(ctx, gdev, text);
+    if (gdev->hdc) {
+        // clips must always be balanced by FzGdiPopClip
+        bool hasPath = canDraw && FzGdiSetTextPath(ctx, gdev->hdc, text, ctm);
+        FzGdiClip(gdev->hdc, hasPath, 0);
+    }
+}
+
+static void FzGdiClipStrokeText(fz_context* ctx, fz_device* dev, const fz_text* text, const fz_stroke_state* stroke,
+                                fz_matrix ctm, fz_rect) {
+    FzGdiDevice* gdev = (FzGdiDevice*)dev;
+    bool canDraw = FzGdiCheckText(ctx, gdev, text);
+    if (gdev->hdc) {
+        bool hasPath = canDraw && FzGdiSetTextPath(ctx, gdev->hdc, text, ctm);
+        FzGdiClipStroke(gdev->hdc, hasPath, stroke, ctm);
+    }
+}
+
+static void FzGdiFillImage(fz_context* ctx, fz_device* dev, fz_image* image, fz_matrix ctm, float alpha,
+                           fz_color_params params) {
+    FzGdiDevice* gdev = (FzGdiDevice*)dev;
+    bool hasAlpha = image->colorspace && image->n > fz_colorspace_n(ctx, image->colorspace);
+    if (image->mask || image->use_colorkey || hasAlpha) {
+        FzGdiNeedsRaster(gdev);
+        return;
+    }
+    if (!FzGdiCheckAlpha(gdev, alpha) || !gdev->hdc) {
+        return;
+    }
+
+    fz_pixmap* pix = nullptr;
+    fz_pixmap* bgr = nullptr;
+    fz_var(pix);
+    fz_var(bgr);
+    fz_try(ctx) {
+        // decode the image at no more than the resolution it's printed at
+        fz_matrix imageCtm = ctm;
+        pix = fz_get_pixmap_from_image(ctx, image, nullptr, &imageCtm, nullptr, nullptr);
+        bgr = fz_convert_pixmap(ctx, pix, fz_device_bgr(ctx), nullptr, nullptr, params, 0);
+        int w = bgr->w, h = bgr->h;
+        // DIB rows have to be DWORD aligned
+        int stride = (w * 3 + 3) & ~3;
+        u8* bits = (u8*)fz_calloc(ctx, h, stride);
+        for (int y = 0; y < h; y++) {
+            memcpy(bits + y * stride, bgr->samples + y * bgr->stride, (size_t)w * 3);
+        }
+
+        BITMAPINFO bmi = {};
+        bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+        bmi.bmiHeader.biWidth = w;
+        bmi.bmiHeader.biHeight = -h;
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 24;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        // the image's pixels are mapped onto the unit square, which ctm maps onto the page
+        HDC hdc = gdev->hdc;
+        XFORM xform = {ctm.a / w, ctm.b / w, ctm.c / h, ctm.d / h, ctm.e, ctm.f};
+        SetWorldTransform(hdc, &xform);
+        StretchDIBits(hdc, 0, 0, w, h, 0, 0, w, h, bits, &bmi, DIB_RGB_COLORS, SRCCOPY);
+        ModifyWorldTransform(hdc, nullptr, MWT_IDENTITY);
+        fz_free(ctx, bits);
+    }
+    fz_always(ctx) {
+        fz_drop_pixmap(ctx, bgr);
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
+static void FzGdiFillImageMask(fz_context*, fz_device* dev, fz_image*, fz_matrix, fz_colorspace*, const float*,
+                               float, fz_color_params) {
+    FzGdiNeedsRaster((FzGdiDevice*)dev);
+}
+
+static void FzGdiClipImageMask(fz_context*, fz_device* dev, fz_image*, fz_matrix, fz_rect) {
+    FzGdiDevice* gdev = (FzGdiDevice*)dev;
+    FzGdiNeedsRaster(gdev);
+    if (gdev->hdc) {
+        FzGdiClip(gdev->hdc, false, 0);
+    }
+}
+
+static void FzGdiFillShade(fz_context*, fz_device* dev, fz_shade*, fz_matrix, float, fz_color_params) {
+    FzGdiNeedsRaster((FzGdiDevice*)dev);
+}
+
+static void FzGdiPopClip(fz_context*, fz_device* dev) {
+    FzGdiDevice* gdev = (FzGdiDevice*)dev;
+    if (gdev->hdc) {
+        RestoreDC(gdev->hdc, -1);
+    }
+}
+
+static void FzGdiBeginMask(fz_context*, fz_device* dev, fz_rect, int, fz_colorspace*, const float*,
+                           fz_color_params) {
+    FzGdiNeedsRaster((FzGdiDevice*)dev);
+}
+
+static void FzGdiBeginGroup(fz_context*, fz_device* dev, fz_rect, fz_colorspace*, int, int knockout, int blendmode,
+                            float alpha) {
+    // opaque groups without blending look the same when drawn directly
+    if (alpha < 1.f || blendmode != FZ_BLEND_NORMAL || knockout) {
+        FzGdiNeedsRaster((FzGdiDevice*)dev);
+    }
+}
+
+static int FzGdiBeginTile(fz_context*, fz_device* dev, fz_rect, fz_rect, float xstep, float ystep, fz_matrix, int) {
+    // a tile without step (a cached form) is drawn by replaying its content
+    if (xstep != 0 || ystep != 0) {
+        FzGdiNeedsRaster((FzGdiDevice*)dev);
+    }
+    return 0;
+}
+
+static fz_device* FzNewGdiDevice(fz_context* ctx, HDC hdc, fz_cookie* cookie) {
+    FzGdiDevice* dev = fz_new_derived_device(ctx, FzGdiDevice);
+    dev->super.fill_path = FzGdiFillPath;
+    dev->super.stroke_path = FzGdiStrokePath;
+    dev->super.clip_path = FzGdiClipPath;
+    dev->super.clip_stroke_path = FzGdiClipStrokePath;
+    dev->super.fill_text = FzGdiFillText;
+    dev->super.stroke_text = FzGdiStrokeText;
+    dev->super.clip_text = FzGdiClipText;
+    dev->super.clip_stroke_text = FzGdiClipStrokeText;
+    dev->super.fill_shade = FzGdiFillShade;
+    dev->super.fill_image = FzGdiFillImage;
+    dev->super.fill_image_mask = FzGdiFillImageMask;
+    dev->super.clip_image_mask = FzGdiClipImageMask;
+    dev->super.pop_clip = FzGdiPopClip;
+    dev->super.begin_mask = FzGdiBeginMask;
+    dev->super.begin_group = FzGdiBeginGroup;
+    dev->super.begin_tile = FzGdiBeginTile;
+    dev->hdc = hdc;
+    dev->cookie = cookie;
+    dev->needsRaster = false;
+    return &dev->super;
+}
+
+// returns true if the display list uses anything FzRunDisplayListOnDC can't draw
+bool FzDisplayListNeedsRaster(fz_context* ctx, fz_display_list* list) {
+    fz_context* cctx = fz_clone_context(ctx);
+    if (!cctx) {
+        return true;
+    }
+
+    fz_cookie cookie = {};
+    fz_device* dev = nullptr;
+    bool needsRaster = true;
+
+    fz_var(dev);
+    fz_var(needsRaster);
+
+    fz_try(cctx) {
+        dev = FzNewGdiDevice(cctx, nullptr, &cookie);
+        fz_run_display_list(cctx, list, dev, fz_identity, fz_infinite_rect, &cookie);
+        fz_close_device(cctx, dev);
+        needsRaster = ((FzGdiDevice*)dev)->needsRaster || cookie.errors > 0;
+    }
+    fz_always(cctx) {
+        fz_drop_device(cctx, dev);
+    }
+    fz_catch(cctx) {
+        needsRaster = true;
+    }
+    fz_drop_context(cctx);
+    return needsRaster;
+}
+
+// draws a display list onto hdc as vector graphics (only to be used
+// if FzDisplayListNeedsRaster has returned false for the list)
+bool FzRunDisplayListOnDC(fz_context* ctx, fz_display_list* list, HDC hdc, fz_matrix ctm, fz_cookie* cookie) {
+    fz_context* cctx = fz_clone_context(ctx);
+    if (!cctx) {
+        return false;
+    }
+
+    // images are drawn through a world transform
+    int savedDC = SaveDC(hdc);
+    SetGraphicsMode(hdc, GM_ADVANCED);
+
+    fz_device* dev = nullptr;
+    bool ok = false;
+
+    fz_var(dev);
+    fz_var(ok);
+
+    fz_try(cctx) {
+        dev = FzNewGdiDevice(cctx, hdc, cookie);
+        fz_run_display_list(cctx, list, dev, ctm, fz_infinite_rect, cookie);
+        fz_close_device(cctx, dev);
+        ok = !cookie || !cookie->abort;
+    }
+    fz_always(cctx) {
+        fz_drop_device(cctx, dev);
+    }
+    fz_catch(cctx) {
+        ok = false;
+    }
+    fz_drop_context(cctx);
+    // this also undoes clips left over from an aborted run
+    RestoreDC(hdc, savedDC);
+    return ok;
 }
 
 static inline int wchars_per_rune(int rune) {
@@ -496,14 +1418,73 @@ static void AddLineSep(str::WStr& s, Vec<Rect>& rects, const WCHAR* lineSep, siz
     }
 }
 
+// like fz_new_stext_page_from_page and fz_text_page_to_str, except that extracting
+// can be aborted through *cookie_out (the result is empty then, as on failure)
+PageText FzExtractPageText(fz_context* ctx, fz_page* page, const fz_stext_options* opts, AbortCookie** cookie_out) {
+    fz_cookie* fzcookie = nullptr;
+    if (cookie_out) {
+        FitzAbortCookie* cookie = new FitzAbortCookie();
+        *cookie_out = cookie;
+        fzcookie = &cookie->cookie;
+    }
+
+    fz_stext_page* stext = nullptr;
+    fz_device* dev = nullptr;
+    fz_var(stext);
+    fz_var(dev);
+    fz_try(ctx) {
+        stext = fz_new_stext_page(ctx, fz_bound_page(ctx, page));
+        dev = fz_new_stext_device(ctx, stext, opts);
+        fz_run_page_contents(ctx, page, dev, fz_identity, fzcookie);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        fz_drop_stext_page(ctx, stext);
+        stext = nullptr;
+    }
+    if (!stext) {
+        return {};
+    }
+    if (fzcookie && fzcookie->abort) {
+        fz_drop_stext_page(ctx, stext);
+        return {};
+    }
+
+    PageText res;
+    res.text = fz_text_page_to_str(stext, &res.coords);
+    fz_drop_stext_page(ctx, stext);
+    res.len = (int)str::Len(res.text);
+    return res;
+}
+
 WCHAR* fz_text_page_to_str(fz_stext_page* text, Rect** coordsOut) {
     const WCHAR* lineSep = L"\n";
 
     size_t lineSepLen = str::Len(lineSep);
-    str::WStr content;
+
+    // pages can have tens of thousands of characters, so allocate the
+    // (maximum) final size upfront instead of growing step by step
+    size_t maxLen = 0;
+    for (fz_stext_block* block = text->first_block; block; block = block->next) {
+        if (block->type != FZ_STEXT_BLOCK_TEXT) {
+            continue;
+        }
+        for (fz_stext_line* line = block->u.t.first_line; line; line = line->next) {
+            for (fz_stext_char* c = line->first_char; c; c = c->next) {
+                maxLen += wchars_per_rune(c->c);
+            }
+            maxLen += lineSepLen;
+        }
+    }
+
+    str::WStr content(maxLen);
     // coordsOut is optional but we ask for it by default so we simplify the code
     // by always calculating it
     Vec<Rect> rects;
+    rects.Reserve(maxLen);
 
     fz_stext_block* block = text->first_block;
     while (block) {
@@ -689,12 +1670,71 @@ static const WCHAR* LinkifyEmailAddress(const WCHAR* start) {
     return end;
 }
 
+#if defined(HAS_SSE2)
+// returns a mask with the two bits for s[i] set if s[i] might start a link
+// (for 0 <= i < 8, reads s[-1] to s[7]): that's an '@' or an 'h', 'm' or 'w'
+// that isn't preceded by a slash or an ASCII letter or digit
+static inline uint LinkifyCandidateMask(const WCHAR* s) {
+    __m128i c = _mm_loadu_si128((const __m128i*)s);
+    __m128i prev = _mm_loadu_si128((const __m128i*)(s - 1));
+
+    __m128i isAt = _mm_cmpeq_epi16(c, _mm_set1_epi16('@'));
+    __m128i isStart = _mm_or_si128(_mm_cmpeq_epi16(c, _mm_set1_epi16('h')), _mm_cmpeq_epi16(c, _mm_set1_epi16('m')));
+    isStart = _mm_or_si128(isStart, _mm_cmpeq_epi16(c, _mm_set1_epi16('w')));
+
+    // chars >= 0x8000 are negative and thus never excluded here (LinkifyText checks them in full)
+    __m128i lower = _mm_or_si128(prev, _mm_set1_epi16(0x20));
+    __m128i isLetter =
+        _mm_and_si128(_mm_cmpgt_epi16(lower, _mm_set1_epi16('a' - 1)), _mm_cmplt_epi16(lower, _mm_set1_epi16('z' + 1)));
+    __m128i isDigit =
+        _mm_and_si128(_mm_cmpgt_epi16(prev, _mm_set1_epi16('0' - 1)), _mm_cmplt_epi16(prev, _mm_set1_epi16('9' + 1)));
+    __m128i isSlash = _mm_cmpeq_epi16(prev, _mm_set1_epi16('/'));
+    __m128i excluded = _mm_or_si128(_mm_or_si128(isLetter, isDigit), isSlash);
+
+    __m128i res = _mm_or_si128(isAt, _mm_andnot_si128(excluded, isStart));
+    return (uint)_mm_movemask_epi8(res);
+}
+#endif
+
+// returns the first position from s on where a link might start or end if there's none
+// (most of the text can't start a link, so it's skipped 8 chars at a time)
+static const WCHAR* LinkifySkipToCandidate(const WCHAR* pageText, const WCHAR* s, const WCHAR* end) {
+#if defined(HAS_SSE2)
+    if (s == pageText && s < end) {
+        // the first character has no predecessor to load
+        if ('@' == *s || 'h' == *s || 'm' == *s || 'w' == *s) {
+            return s;
+        }
+        s++;
+    }
+    for (; s + 8 <= end; s += 8) {
+        uint mask = LinkifyCandidateMask(s);
+        if (mask != 0) {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            return s + bit / 2;
+        }
+    }
+#else
+    UNUSED(pageText);
+#endif
+    while (s < end && '@' != *s && 'h' != *s && 'm' != *s && 'w' != *s) {
+        s++;
+    }
+    return s;
+}
+
 // caller needs to delete the result
 // TODO: return Vec<IPageElement*> directly
 LinkRectList* LinkifyText(const WCHAR* pageText, Rect* coords) {
     LinkRectList* list = new LinkRectList;
+    const WCHAR* textEnd = pageText + str::Len(pageText);
 
-    for (const WCHAR* start = pageText; *start; start++) {
+    for (const WCHAR* start = pageText; start < textEnd; start++) {
+        start = LinkifySkipToCandidate(pageText, start, textEnd);
+        if (start >= textEnd) {
+            break;
+        }
         const WCHAR* end = nullptr;
         bool multiline = false;
         const WCHAR* protocol = nullptr;
@@ -1046,39 +2086,141 @@ TocItem* newTocItemWithDestination(TocItem* parent, WCHAR* title, PageDestinatio
     return res;
 }
 
-IPageElement* FzGetElementAtPos(FzPageInfo* pageInfo, PointF pt) {
-    if (!pageInfo) {
-        return nullptr;
-    }
-    int pageNo = pageInfo->pageNo;
-    fz_link* link = pageInfo->links;
-    fz_point p = {(float)pt.x, (float)pt.y};
-    while (link) {
-        if (fz_is_pt_in_rect(link->rect, p)) {
-            return newFzLink(pageNo, link, nullptr);
+// pages with fewer elements are searched linearly
+#define MIN_GRID_INDEXED_ELEMENTS 32
+#define MAX_ELEMENT_GRID_DIM 64
+
+static int GridCell(float v, float v0, float v1, int n) {
+    int i = (int)((v - v0) * n / (v1 - v0));
+    return limitValue(i, 0, n - 1);
+}
+
+// must be called once links, autoLinks, comments and images have been loaded
+// (and with the page's lock held, as the index is used without it)
+void FzBuildElementIndex(FzPageInfo* pageInfo) {
+    FzElementIndex& index = pageInfo->elementIndex;
+    index.elements.Reset();
+    index.cellStarts.Reset();
+    index.items.Reset();
+    index.cols = index.rows = 0;
+
+    for (fz_link* link = pageInfo->links; link; link = link->next) {
+        FzElementPos ep;
+        ep.rect = link->rect;
+        ep.link = link;
+        index.elements.Append(ep);
+    }
+    for (auto* list : {&pageInfo->autoLinks, &pageInfo->comments}) {
+        for (IPageElement* el : *list) {
+            RectF r = el->GetRect();
+            FzElementPos ep;
+            ep.rect = {r.x, r.y, r.x + r.dx, r.y + r.dy};
+            ep.el = el;
+            index.elements.Append(ep);
         }
-        link = link->next;
+    }
+    for (int i = 0; i < pageInfo->images.isize(); i++) {
+        FzElementPos ep;
+        ep.rect = pageInfo->images.at(i).rect;
+        ep.imageIdx = i;
+        index.elements.Append(ep);
     }
 
-    for (auto* pel : pageInfo->autoLinks) {
-        if (pel->GetRect().Contains(pt)) {
-            return clonePageElement(pel);
+    int n = index.elements.isize();
+    if (n < MIN_GRID_INDEXED_ELEMENTS) {
+        return;
+    }
+    fz_rect bounds = fz_empty_rect;
+    for (FzElementPos& ep : index.elements) {
+        bounds = fz_union_rect(bounds, ep.rect);
+    }
+    if (bounds.x1 <= bounds.x0 || bounds.y1 <= bounds.y0) {
+        return;
+    }
+    int dim = limitValue((int)sqrt((double)n), 1, MAX_ELEMENT_GRID_DIM);
+    index.bounds = bounds;
+    index.cols = index.rows = dim;
+
+    // count the elements overlapping each cell in the first pass,
+    // then place them (in ascending order) in the second one
+    int nCells = dim * dim;
+    int* starts = index.cellStarts.AppendBlanks(nCells + 1);
+    Vec<int> next;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            for (int i = 0; i < nCells; i++) {
+                starts[i + 1] += starts[i];
+            }
+            index.items.AppendBlanks(starts[nCells]);
+            next.Append(starts, nCells);
         }
+        for (int i = 0; i < n; i++) {
+            fz_rect r = index.elements.at(i).rect;
+            if (fz_is_empty_rect(r)) {
+                continue;
+            }
+            int col0 = GridCell(r.x0, bounds.x0, bounds.x1, dim);
+            int col1 = GridCell(r.x1, bounds.x0, bounds.x1, dim);
+            int row0 = GridCell(r.y0, bounds.y0, bounds.y1, dim);
+            int row1 = GridCell(r.y1, bounds.y0, bounds.y1, dim);
+            for (int row = row0; row <= row1; row++) {
+                for (int col = col0; col <= col1; col++) {
+                    int cell = row * dim + col;
+                    if (pass == 0) {
+                        starts[cell + 1]++;
+                    } else {
+                        index.items.at(next.at(cell)++) = i;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static bool ElementContains(FzElementPos& ep, PointF pt) {
+    if (ep.el) {
+        return ep.el->GetRect().Contains(pt);
+    }
+    fz_point p = {(float)pt.x, (float)pt.y};
+    return fz_is_pt_in_rect(ep.rect, p);
+}
+
+static IPageElement* NewElementFromPos(FzPageInfo* pageInfo, FzElementPos& ep) {
+    if (ep.link) {
+        return newFzLink(pageInfo->pageNo, ep.link, nullptr);
+    }
+    if (ep.el) {
+        return clonePageElement(ep.el);
     }
+    return newFzImage(pageInfo->pageNo, ep.rect, (size_t)ep.imageIdx);
+}
 
-    for (auto* pel : pageInfo->comments) {
-        if (pel->GetRect().Contains(pt)) {
-            return clonePageElement(pel);
+IPageElement* FzGetElementAtPos(FzPageInfo* pageInfo, PointF pt) {
+    if (!pageInfo) {
+        return nullptr;
+    }
+    FzElementIndex& index = pageInfo->elementIndex;
+    if (index.cols == 0) {
+        for (FzElementPos& ep : index.elements) {
+            if (ElementContains(ep, pt)) {
+                return NewElementFromPos(pageInfo, ep);
+            }
         }
+        return nullptr;
     }
 
-    size_t imageIdx = 0;
-    for (auto& img : pageInfo->images) {
-        fz_rect ir = img.rect;
-        if (fz_is_pt_in_rect(ir, p)) {
-            return newFzImage(pageNo, ir, imageIdx);
+    fz_rect b = index.bounds;
+    if (pt.x < b.x0 || pt.x > b.x1 || pt.y < b.y0 || pt.y > b.y1) {
+        return nullptr;
+    }
+    int col = GridCell((float)pt.x, b.x0, b.x1, index.cols);
+    int row = GridCell((float)pt.y, b.y0, b.y1, index.rows);
+    int cell = row * index.cols + col;
+    for (int i = index.cellStarts.at(cell); i < index.cellStarts.at(cell + 1); i++) {
+        FzElementPos& ep = index.elements.at(index.items.at(i));
+        if (ElementContains(ep, pt)) {
+            return NewElementFromPos(pageInfo, ep);
         }
-        imageIdx++;
     }
     return nullptr;
 }
@@ -1122,6 +2264,31 @@ void FzGetElements(Vec<IPageElement*>* els, FzPageInfo* pageInfo) {
     els->Reverse();
 }
 
+// placement new doesn't work with DEBUG_NEW (cf. BaseUtil.h)
+#pragma push_macro("new")
+#undef new
+
+// the destructors of elements allocated from a page's arena are never called,
+// so all their data has to be allocated from the arena as well
+PageElement* NewArenaPageElement(FzPageInfo* pageInfo, Kind kind, RectF rect, const WCHAR* value) {
+    PageElement* el = new (pageInfo->arena.AllocStruct<PageElement>()) PageElement();
+    el->kind_ = kind;
+    el->pageNo = pageInfo->pageNo;
+    el->rect = rect;
+    el->value = Allocator::StrDup(&pageInfo->arena, value);
+    return el;
+}
+
+PageDestination* NewArenaPageDestination(FzPageInfo* pageInfo, Kind kind, int pageNo, const WCHAR* value) {
+    PageDestination* dest = new (pageInfo->arena.AllocStruct<PageDestination>()) PageDestination();
+    dest->kind = kind;
+    dest->pageNo = pageNo;
+    dest->value = Allocator::StrDup(&pageInfo->arena, value);
+    return dest;
+}
+
+#pragma pop_macro("new")
+
 void FzLinkifyPageText(FzPageInfo* pageInfo, fz_stext_page* stext) {
     if (!pageInfo || !stext) {
         return;
@@ -1154,15 +2321,8 @@ void FzLinkifyPageText(FzPageInfo* pageInfo, fz_stext_page* stext) {
             continue;
         }
 
-        // TODO: those leak on xps
-        PageElement* pel = new PageElement();
-        pel->kind_ = kindPageElementDest;
-        pel->dest = new PageDestination();
-        pel->dest->kind = kindDestinationLaunchURL;
-        pel->dest->pageNo = 0;
-        pel->dest->value = str::Dup(uri);
-        pel->value = str::Dup(uri);
-        pel->rect = ToRectFl(bbox);
+        PageElement* pel = NewArenaPageElement(pageInfo, kindPageElementDest, ToRectFl(bbox), uri);
+        pel->dest = NewArenaPageDestination(pageInfo, kindDestinationLaunchURL, 0, uri);
         pageInfo->autoLinks.Append(pel);
     }
     delete list;
@@ -1281,3 +2441,172 @@ int ToPdfRgba(COLORREF c, float col[4]) {
     }
     return 4;
 }
+
+static void FzFreeDisplayList(fz_context* ctx, FzPageInfo* pageInfo) {
+    fz_drop_display_list(ctx, pageInfo->list);
+    pageInfo->list = nullptr;
+    pageInfo->listSize = 0;
+}
+
+// cache is ordered from least to most recently used
+// returns a new reference to the page's cached display list (or nullptr)
+// the caller must hold the context's lock
+fz_display_list* FzGetCachedDisplayList(fz_context* ctx, Vec<FzPageInfo*>& cache, FzPageInfo* pageInfo) {
+    if (!pageInfo->list) {
+        return nullptr;
+    }
+    cache.Remove(pageInfo);
+    cache.Append(pageInfo);
+    return fz_keep_display_list(ctx, pageInfo->list);
+}
+
+// keeps a reference to list and evicts least recently used lists so that
+// at most MAX_PAGE_RUN_CACHE lists and about MAX_PAGE_RUN_MEMORY bytes are cached
+void FzCacheDisplayList(fz_context* ctx, Vec<FzPageInfo*>& cache, FzPageInfo* pageInfo, fz_display_list* list,
+                        size_t size) {
+    if (size > MAX_PAGE_RUN_MEMORY) {
+        return;
+    }
+    if (pageInfo->list) {
+        cache.Remove(pageInfo);
+        FzFreeDisplayList(ctx, pageInfo);
+    }
+    size_t totalSize = size;
+    for (FzPageInfo* pi : cache) {
+        totalSize += pi->listSize;
+    }
+    while (cache.size() > 0 && (cache.size() >= MAX_PAGE_RUN_CACHE || totalSize > MAX_PAGE_RUN_MEMORY)) {
+        FzPageInfo* pi = cache[0];
+        totalSize -= pi->listSize;
+        FzFreeDisplayList(ctx, pi);
+        cache.RemoveAt(0);
+    }
+    pageInfo->list = fz_keep_display_list(ctx, list);
+    pageInfo->listSize = size;
+    cache.Append(pageInfo);
+}
+
+void FzFreeDisplayLists(fz_context* ctx, Vec<FzPageInfo*>& cache) {
+    for (FzPageInfo* pi : cache) {
+        FzFreeDisplayList(ctx, pi);
+    }
+    cache.Reset();
+}
+
+// keeps references to all of the page's images in pageInfo->images
+// (they're found in the same order as by fz_find_image_positions)
+static void FzKeepPageImages(fz_context* ctx, FzPageInfo* pageInfo) {
+    fz_stext_options opts{};
+    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
+    fz_stext_page* stext = nullptr;
+    fz_var(stext);
+    fz_try(ctx) {
+        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
+    }
+    fz_catch(ctx) {
+    }
+    if (!stext) {
+        return;
+    }
+    auto& images = pageInfo->images;
+    int idx = 0;
+    for (fz_stext_block* block = stext->first_block; block && idx < images.isize(); block = block->next) {
+        if (block->type != FZ_STEXT_BLOCK_IMAGE || !block->u.i.image->colorspace) {
+            continue;
+        }
+        images.at(idx).image = fz_keep_image(ctx, block->u.i.image);
+        idx++;
+    }
+    fz_drop_stext_page(ctx, stext);
+}
+
+static void FzDropPageImages(fz_context* ctx, FzPageInfo* pageInfo) {
+    for (auto& img : pageInfo->images) {
+        fz_drop_image(ctx, img.image);
+        img.image = nullptr;
+    }
+}
+
+// cache is ordered from least to most recently used
+// returns the page's idx-th image (the reference is owned by the cache) or nullptr
+// finding an image requires extracting the page's content, so the images of the
+// last MAX_PAGE_IMAGES_CACHE pages are kept; this also keeps the decoded images
+// in MuPDF's store (which limits their memory) valid for copying them again
+// the caller must hold the context's lock
+fz_image* FzGetPageImage(fz_context* ctx, Vec<FzPageInfo*>& cache, FzPageInfo* pageInfo, int idx) {
+    if (idx < 0 || idx >= pageInfo->images.isize()) {
+        return nullptr;
+    }
+    if (cache.Contains(pageInfo)) {
+        cache.Remove(pageInfo);
+    } else {
+        while (cache.size() >= MAX_PAGE_IMAGES_CACHE) {
+            FzDropPageImages(ctx, cache[0]);
+            cache.RemoveAt(0);
+        }
+        FzKeepPageImages(ctx, pageInfo);
+    }
+    cache.Append(pageInfo);
+    return pageInfo->images.at(idx).image;
+}
+
+void FzFreePageImages(fz_context* ctx, Vec<FzPageInfo*>& cache) {
+    for (FzPageInfo* pi : cache) {
+        FzDropPageImages(ctx, pi);
+    }
+    cache.Reset();
+}
+
+static size_t ContentLayerSize(fz_pixmap* pix) {
+    return (size_t)pix->stride * pix->h;
+}
+
+// cache is ordered from least to most recently used
+// returns a new reference to the content layer rendered for this page, ctm and bbox (or nullptr)
+// the caller must hold the context's lock
+fz_pixmap* FzGetContentLayer(fz_context* ctx, Vec<FzContentLayer>& cache, int pageNo, fz_matrix ctm, fz_irect bbox) {
+    for (size_t i = 0; i < cache.size(); i++) {
+        FzContentLayer layer = cache[i];
+        if (layer.pageNo != pageNo || memcmp(&layer.ctm, &ctm, sizeof(ctm)) != 0) {
+            continue;
+        }
+        fz_irect r = fz_pixmap_bbox(ctx, layer.pix);
+        if (r.x0 != bbox.x0 || r.y0 != bbox.y0 || r.x1 != bbox.x1 || r.y1 != bbox.y1) {
+            continue;
+        }
+        cache.RemoveAt(i);
+        cache.Append(layer);
+        return fz_keep_pixmap(ctx, layer.pix);
+    }
+    return nullptr;
+}
+
+// keeps a reference to pix and evicts least recently used layers so that at most
+// MAX_CONTENT_LAYER_CACHE layers and MAX_CONTENT_LAYER_MEMORY bytes are cached
+void FzCacheContentLayer(fz_context* ctx, Vec<FzContentLayer>& cache, int pageNo, fz_matrix ctm, fz_pixmap* pix) {
+    size_t size = ContentLayerSize(pix);
+    if (size > MAX_CONTENT_LAYER_MEMORY) {
+        return;
+    }
+    size_t totalSize = size;
+    for (FzContentLayer& layer : cache) {
+        totalSize += ContentLayerSize(layer.pix);
+    }
+    while (cache.size() > 0 && (cache.size() >= MAX_CONTENT_LAYER_CACHE || totalSize > MAX_CONTENT_LAYER_MEMORY)) {
+        totalSize -= ContentLayerSize(cache[0].pix);
+        fz_drop_pixmap(ctx, cache[0].pix);
+        cache.RemoveAt(0);
+    }
+    FzContentLayer layer;
+    layer.pageNo = pageNo;
+    layer.ctm = ctm;
+    layer.pix = fz_keep_pixmap(ctx, pix);
+    cache.Append(layer);
+}
+
+void FzFreeContentLayers(fz_context* ctx, Vec<FzContentLayer>& cache) {
+    for (FzContentLayer& layer : cache) {
+        fz_drop_pixmap(ctx, layer.pix);
+    }
+    cache.Reset();
+}
@@ -9,6 +9,12 @@
 #define MAX_PAGE_RUN_CACHE 8
 // maximum estimated memory requirement allowed for the run cache of one document
 #define MAX_PAGE_RUN_MEMORY (40 * 1024 * 1024)
+// number of pages per document whose images are kept for copying them
+#define MAX_PAGE_IMAGES_CACHE 4
+// number of rendered page contents (without annotations) to cache per document
+#define MAX_CONTENT_LAYER_CACHE 4
+// maximum memory allowed for the content layer cache of one document
+#define MAX_CONTENT_LAYER_MEMORY (64 * 1024 * 1024)
 
 class FitzAbortCookie : public AbortCookie {
   public:
@@ -24,6 +30,32 @@ class FitzAbortCookie : public AbortCookie {
 struct FitzImagePos {
     fz_rect rect = fz_unit_rect;
     fz_matrix transform;
+    // set while the page is in the images cache (see FzGetPageImage)
+    fz_image* image = nullptr;
+};
+
+// a page element's rect for hit-testing (exactly one of link, el and imageIdx is set)
+struct FzElementPos {
+    fz_rect rect = fz_empty_rect;
+    fz_link* link = nullptr;
+    // auto-detected links and comments
+    IPageElement* el = nullptr;
+    int imageIdx = -1;
+};
+
+// spatial index over a page's elements, so that hit-testing pages with
+// thousands of links doesn't have to test them all (see FzGetElementAtPos)
+struct FzElementIndex {
+    // links, auto-detected links, comments and images (in hit-testing order)
+    Vec<FzElementPos> elements;
+    // a grid of cols x rows cells over bounds (not used for a few elements),
+    // the elements overlapping cell i are elements[items[cellStarts[i]]] ..
+    // elements[items[cellStarts[i + 1] - 1]] (in ascending order)
+    fz_rect bounds = fz_empty_rect;
+    int cols = 0;
+    int rows = 0;
+    Vec<int> cellStarts;
+    Vec<int> items;
 };
 
 struct FzPageInfo {
@@ -32,6 +64,10 @@ struct FzPageInfo {
 
     fz_link* links = nullptr;
 
+    // owns autoLinks and comments (incl. their destinations and strings),
+    // which are thus freed all at once together with the page
+    // (create them with NewArenaPageElement and NewArenaPageDestination)
+    PoolAllocator arena;
     // auto-detected links
     Vec<IPageElement*> autoLinks;
     // comments are made out of annotations
@@ -40,9 +76,31 @@ struct FzPageInfo {
     RectF mediabox = {};
     Vec<FitzImagePos> images;
 
+    // built once all of the above have been loaded (see FzBuildElementIndex)
+    FzElementIndex elementIndex;
+
+    // cached content of the page, replayed when rendering at a different
+    // zoom level or for another tile (see FzCacheDisplayList)
+    fz_display_list* list = nullptr;
+    // estimated memory used by list
+    size_t listSize = 0;
+
     // if false, only loaded page (fast)
     // if true, loaded expensive info (extracted text etc.)
     bool fullyLoaded = false;
+
+    // digest of everything that determines how the page looks,
+    // computed when loading the page (see EnginePdfGetPageDigest)
+    u8 digest[16] = {};
+    bool hasDigest = false;
+};
+
+// a page's content rendered without annotations, so that after editing
+// annotations only they have to be rendered again (see FzRenderDisplayLists)
+struct FzContentLayer {
+    int pageNo = 0;
+    fz_matrix ctm = fz_identity;
+    fz_pixmap* pix = nullptr;
 };
 
 struct LinkRectList {
@@ -60,22 +118,58 @@ float fz_calc_overlap(fz_rect r1, fz_rect r2);
 WCHAR* pdf_to_wstr(fz_context* ctx, pdf_obj* obj);
 WCHAR* pdf_clean_string(WCHAR* string);
 
+size_t FzStoreSize();
+
+// allocator that keeps track of how much memory a fz_context has allocated
+// (pass &alloc to fz_new_context and keep the counter alive until fz_drop_context)
+struct FzMemCounter {
+    fz_alloc_context alloc{};
+    LONG64 allocated = 0;
+
+    FzMemCounter();
+};
+
 fz_stream* fz_open_istream(fz_context* ctx, IStream* stream);
 fz_stream* fz_open_file2(fz_context* ctx, const WCHAR* filePath);
 void fz_stream_fingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]);
+std::span<u8> fz_stream_mapped_data(fz_context* ctx, fz_stream* stm);
 std::span<u8> fz_extract_stream_data(fz_context* ctx, fz_stream* stream);
 
 RenderedBitmap* new_rendered_fz_pixmap(fz_context* ctx, fz_pixmap* pixmap);
 
+// a BGRA pixmap whose samples are the bits of a DIB section, so that
+// pages are rendered without having to convert and copy the result
+struct FzDibPixmap {
+    fz_pixmap* pix = nullptr;
+    // from AllocPooledDib
+    HBITMAP hbmp = nullptr;
+    HANDLE hMap = nullptr;
+    Size size;
+};
+
+fz_pixmap* fz_new_dib_pixmap(fz_context* ctx, fz_irect bbox, FzDibPixmap* dib);
+RenderedBitmap* new_rendered_dib_pixmap(fz_context* ctx, FzDibPixmap* dib);
+void fz_drop_dib_pixmap(fz_context* ctx, FzDibPixmap* dib);
+RenderedBitmap* FzRenderDisplayLists(fz_context* ctx, fz_display_list** lists, int nLists, fz_matrix ctm,
+                                     fz_irect bbox, fz_cookie* cookie, size_t* firstListSize,
+                                     fz_pixmap* firstLayer = nullptr, fz_pixmap** firstLayerOut = nullptr,
+                                     bool isDraft = false);
+bool FzDisplayListNeedsRaster(fz_context* ctx, fz_display_list* list);
+bool FzRunDisplayListOnDC(fz_context* ctx, fz_display_list* list, HDC hdc, fz_matrix ctm, fz_cookie* cookie);
+
 WCHAR* fz_text_page_to_str(fz_stext_page* text, Rect** coordsOut);
+PageText FzExtractPageText(fz_context* ctx, fz_page* page, const fz_stext_options* opts, AbortCookie** cookie_out);
 
 LinkRectList* LinkifyText(const WCHAR* pageText, Rect* coords);
 int is_external_link(const char* uri);
 int resolve_link(const char* uri, float* xp, float* yp);
 TocItem* newTocItemWithDestination(TocItem* parent, WCHAR* title, PageDestination* dest);
 PageElement* newFzImage(int pageNo, fz_rect rect, size_t imageIdx);
+PageElement* NewArenaPageElement(FzPageInfo* pageInfo, Kind kind, RectF rect, const WCHAR* value);
+PageDestination* NewArenaPageDestination(FzPageInfo* pageInfo, Kind kind, int pageNo, const WCHAR* value);
 PageElement* newFzLink(int pageNo, fz_link* link, fz_outline* outline);
 PageDestination* newFzDestination(fz_outline*);
+void FzBuildElementIndex(FzPageInfo* pageInfo);
 IPageElement* FzGetElementAtPos(FzPageInfo* pageInfo, PointF pt);
 void FzGetElements(Vec<IPageElement*>* els, FzPageInfo* pageInfo);
 void FzLinkifyPageText(FzPageInfo* pageInfo, fz_stext_page* stext);
@@ -84,6 +178,18 @@ fz_pixmap* fz_convert_pixmap2(fz_context* ctx, fz_pixmap* pix, fz_colorspace* ds
 fz_image* fz_find_image_at_idx(fz_context* ctx, FzPageInfo* pageInfo, int idx);
 void fz_find_image_positions(fz_context* ctx, Vec<FitzImagePos>& images, fz_stext_page* stext);
 
+fz_display_list* FzGetCachedDisplayList(fz_context* ctx, Vec<FzPageInfo*>& cache, FzPageInfo* pageInfo);
+void FzCacheDisplayList(fz_context* ctx, Vec<FzPageInfo*>& cache, FzPageInfo* pageInfo, fz_display_list* list,
+                        size_t size);
+void FzFreeDisplayLists(fz_context* ctx, Vec<FzPageInfo*>& cache);
+
+fz_image* FzGetPageImage(fz_context* ctx, Vec<FzPageInfo*>& cache, FzPageInfo* pageInfo, int idx);
+void FzFreePageImages(fz_context* ctx, Vec<FzPageInfo*>& cache);
+
+fz_pixmap* FzGetContentLayer(fz_context* ctx, Vec<FzContentLayer>& cache, int pageNo, fz_matrix ctm, fz_irect bbox);
+void FzCacheContentLayer(fz_context* ctx, Vec<FzContentLayer>& cache, int pageNo, fz_matrix ctm, fz_pixmap* pix);
+void FzFreeContentLayers(fz_context* ctx, Vec<FzContentLayer>& cache);
+
 // float is in range 0...1
 COLORREF FromPdfColor(fz_context* ctx, int n, float color[4]);
 int ToPdfRgba(COLORREF c, float col[4]);
@@ -2,6 +2,11 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+#if defined(_M_IX86) || defined(_M_X64)
+// SSE2 is available on all processors we support
+#include <emmintrin.h>
+#define HAS_SSE2 1
+#endif
 #include "utils/Archive.h"
 #include "utils/ScopedWin.h"
 
@@ -13,6 +18,7 @@
 #include "utils/JsonParser.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/ThreadUtil.h"
 #include "utils/DirIter.h"
 #include "utils/Log.h"
 
@@ -70,6 +76,19 @@ Kind kindEngineComicBooks = "engineComicBooks";
 
 // number of decoded bitmaps to cache for quicker rendering
 #define MAX_IMAGE_PAGE_CACHE 10
+// (estimated) memory the cached bitmaps may take up before the
+// least recently used ones are dropped
+#define MAX_IMAGE_PAGE_CACHE_MEMORY (256 * 1024 * 1024)
+// number of pages to decode ahead (in reading direction) after rendering a page
+#define IMAGE_PREFETCH_PAGES 2
+// pages shown at 50% or less are decoded at 1/2, 1/4 or 1/8 of their size
+// (if their format allows for it, i.e. for JPEG, else they're reduced after decoding)
+#define MAX_IMAGE_REDUCE_L2FACTOR 3
+// number of bytes read from an image file to find its size (JPEG files
+// may have large metadata such as thumbnails before the size)
+#define IMAGE_HEADER_PROBE_SIZE (64 * 1024)
+// maximum number of threads reading the sizes of images in a directory
+#define MAX_MEDIABOX_LOADERS 8
 
 ///// EngineImages methods apply to all types of engines handling full-page images /////
 
@@ -78,6 +97,10 @@ struct ImagePage {
     Bitmap* bmp = nullptr;
     bool ownBmp = true;
     int refs = 1;
+    // estimated size of the decoded bitmap
+    size_t memSize = 0;
+    // bmp has been decoded at 1/2^l2factor of the image's size
+    int l2factor = 0;
 
     ImagePage(int pageNo, Bitmap* bmp) {
         this->pageNo = pageNo;
@@ -97,9 +120,11 @@ class EngineImages : public EngineBase {
     RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
     std::span<u8> GetFileData() override;
+    std::span<u8> BorrowFileData() override;
     bool SaveFileAs(const char* copyFileName, bool includeUserAnnots = false) override;
-    PageText ExtractPageText(int pageNo) override {
+    PageText ExtractPageText(int pageNo, AbortCookie** cookie_out = nullptr) override {
         UNUSED(pageNo);
+        UNUSED(cookie_out);
         return {};
     }
     bool HasClipOptimizations(int pageNo) override {
@@ -112,6 +137,9 @@ class EngineImages : public EngineBase {
 
     RenderedBitmap* GetImageForPageElement(IPageElement*) override;
 
+    void ReleaseCachedResources() override;
+    size_t GetMemoryUsage() override;
+
     bool BenchLoadPage(int pageNo) override {
         ImagePage* page = GetPage(pageNo);
         if (page) {
@@ -126,14 +154,48 @@ class EngineImages : public EngineBase {
     CRITICAL_SECTION cacheAccess;
     Vec<ImagePage*> pageCache;
     Vec<RectF> mediaboxes;
+    // serializes calls to LoadBitmapForPage, so that bitmaps can be
+    // decoded without holding cacheAccess
+    // (never acquire loadAccess while holding cacheAccess)
+    CRITICAL_SECTION loadAccess;
+
+    // set to false for engines whose LoadBitmapForPage isn't safe to
+    // call while a page is being rendered
+    bool canPrefetch = true;
+    // protected by cacheAccess
+    HANDLE prefetchThread = nullptr;
+    bool prefetchRunning = false;
+    bool prefetchCancelled = false;
+    int prefetchFromPage = 0;
+    int prefetchDir = 1;
+    int prefetchL2factor = 0;
+    int lastRenderedPage = 0;
 
     void GetTransform(Matrix& m, int pageNo, float zoom, int rotation);
 
     virtual Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) = 0;
+    // returns nullptr if the page can't be decoded at a reduced size
+    virtual Bitmap* LoadReducedBitmapForPage(int pageNo, int l2factor) {
+        UNUSED(pageNo);
+        UNUSED(l2factor);
+        return nullptr;
+    }
     virtual RectF LoadMediabox(int pageNo) = 0;
 
-    ImagePage* GetPage(int pageNo, bool tryOnly = false);
+    // with l2factor > 0, the returned page may have been decoded at a
+    // reduced size of at least 1/2^l2factor
+    ImagePage* GetPage(int pageNo, bool tryOnly = false, int l2factor = 0);
     void DropPage(ImagePage* page, bool forceRemove);
+
+    ImagePage* FindCachedPage(int pageNo, int l2factor = 0);
+    ImagePage* ReferencePage(ImagePage* page);
+    ImagePage* LoadPage(int pageNo, int l2factor, bool prefetching);
+    void TrimPageCache(ImagePage* keep);
+    void StartPrefetching(int pageNo, int l2factor);
+    int NextPageToPrefetch();
+    // must be called from the destructor of classes overriding LoadBitmapForPage
+    void StopPrefetching();
+    static DWORD WINAPI PrefetchThreadProc(void* data);
 };
 
 EngineImages::EngineImages() {
@@ -143,9 +205,11 @@ EngineImages::EngineImages() {
     isImageCollection = true;
 
     InitializeCriticalSection(&cacheAccess);
+    InitializeCriticalSection(&loadAccess);
 }
 
 EngineImages::~EngineImages() {
+    StopPrefetching();
     EnterCriticalSection(&cacheAccess);
     while (pageCache.size() > 0) {
         ImagePage* lastPage = pageCache.Last();
@@ -154,6 +218,7 @@ EngineImages::~EngineImages() {
     }
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
+    DeleteCriticalSection(&loadAccess);
 }
 
 RectF EngineImages::PageMediabox(int pageNo) {
@@ -165,13 +230,24 @@ RectF EngineImages::PageMediabox(int pageNo) {
     return mediaboxes.at(n);
 }
 
+// returns how often an image may be halved in size and still be
+// at least as large as when it's shown at the given zoom level
+static int ReducedSizeL2factor(float zoom) {
+    int l2factor = 0;
+    while (l2factor < MAX_IMAGE_REDUCE_L2FACTOR && zoom * (2 << l2factor) <= 1.f) {
+        l2factor++;
+    }
+    return l2factor;
+}
+
 RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     auto pageNo = args.pageNo;
     auto pageRect = args.pageRect;
     auto zoom = args.zoom;
     auto rotation = args.rotation;
 
-    ImagePage* page = GetPage(pageNo);
+    int l2factor = ReducedSizeL2factor(zoom);
+    ImagePage* page = GetPage(pageNo, false, l2factor);
     if (!page) {
         return nullptr;
     }
@@ -211,11 +287,17 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     Rect pageRcI = PageMediabox(pageNo).Round();
     ImageAttributes imgAttrs;
     imgAttrs.SetWrapMode(WrapModeTileFlipXY);
-    Status ok = g.DrawImage(page->bmp, ToGdipRect(pageRcI), 0, 0, pageRcI.dx, pageRcI.dy, UnitPixel, &imgAttrs);
+    Size srcSize = pageRcI.Size();
+    if (page->l2factor > 0) {
+        srcSize = Size(page->bmp->GetWidth(), page->bmp->GetHeight());
+    }
+    Status ok = g.DrawImage(page->bmp, ToGdipRect(pageRcI), 0, 0, srcSize.dx, srcSize.dy, UnitPixel, &imgAttrs);
 
     DropPage(page, false);
     DeleteDC(hDC);
 
+    StartPrefetching(pageNo, l2factor);
+
     if (ok != Ok) {
         DeleteObject(hbmp);
         CloseHandle(hMap);
@@ -308,6 +390,10 @@ std::span<u8> EngineImages::GetFileData() {
     return GetStreamOrFileData(fileStream.Get(), FileName());
 }
 
+std::span<u8> EngineImages::BorrowFileData() {
+    return GetStreamMemory(fileStream.Get());
+}
+
 bool EngineImages::SaveFileAs(const char* copyFileName, bool includeUserAnnots) {
     UNUSED(includeUserAnnots);
     const WCHAR* srcPath = FileName();
@@ -318,6 +404,10 @@ bool EngineImages::SaveFileAs(const char* copyFileName, bool includeUserAnnots)
             return true;
         }
     }
+    auto data = BorrowFileData();
+    if (!data.empty()) {
+        return file::WriteFile(dstPath, data);
+    }
     AutoFree d = GetFileData();
     if (d.empty()) {
         return false;
@@ -325,46 +415,312 @@ bool EngineImages::SaveFileAs(const char* copyFileName, bool includeUserAnnots)
     return file::WriteFile(dstPath, d.AsSpan());
 }
 
-ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly) {
-    ScopedCritSec scope(&cacheAccess);
+// returns a page decoded at 1/2^l2factor of its size or larger
+// must be called with cacheAccess held
+ImagePage* EngineImages::FindCachedPage(int pageNo, int l2factor) {
+    for (ImagePage* page : pageCache) {
+        if (page->pageNo == pageNo && page->l2factor <= l2factor) {
+            return page;
+        }
+    }
+    return nullptr;
+}
 
-    ImagePage* result = nullptr;
+// must be called with cacheAccess held
+ImagePage* EngineImages::ReferencePage(ImagePage* page) {
+    if (page != pageCache.at(0)) {
+        // keep the list Most Recently Used first
+        pageCache.Remove(page);
+        pageCache.InsertAt(0, page);
+    }
+    // return nullptr if a page failed to load
+    if (!page->bmp) {
+        return nullptr;
+    }
+    page->refs++;
+    return page;
+}
 
-    for (size_t i = 0; i < pageCache.size(); i++) {
-        if (pageCache.at(i)->pageNo == pageNo) {
-            result = pageCache.at(i);
-            break;
+ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly, int l2factor) {
+    {
+        ScopedCritSec scope(&cacheAccess);
+        ImagePage* result = FindCachedPage(pageNo, l2factor);
+        if (result) {
+            return ReferencePage(result);
+        }
+        if (tryOnly) {
+            return nullptr;
         }
     }
-    if (!result && tryOnly) {
+    return LoadPage(pageNo, l2factor, false);
+}
+
+// estimate of how much memory a decoded bitmap takes up
+static size_t BitmapMemorySize(Bitmap* bmp) {
+    if (!bmp) {
+        return 0;
+    }
+    size_t bpp = Gdiplus::GetPixelFormatSize(bmp->GetPixelFormat());
+    return (size_t)bmp->GetWidth() * (size_t)bmp->GetHeight() * std::max(bpp, (size_t)8) / 8;
+}
+
+// GDI+ only decodes images loaded from a stream when they're drawn for the first time
+// which for prefetched pages should rather happen on the prefetching thread
+static void DecodeBitmap(Bitmap* bmp) {
+    Gdiplus::Rect r(0, 0, bmp->GetWidth(), bmp->GetHeight());
+    Gdiplus::BitmapData data;
+    if (bmp->LockBits(&r, Gdiplus::ImageLockModeRead, bmp->GetPixelFormat(), &data) == Ok) {
+        bmp->UnlockBits(&data);
+    }
+}
+
+// halves the size of a 32bpp image by averaging 2x2 pixel blocks
+// (dx and dy are the size of dst, an odd last row or column of src is dropped)
+// src and dst may be the same, as every pixel is read before it's overwritten
+static void HalveImage(const u8* src, ptrdiff_t srcStride, u8* dst, ptrdiff_t dstStride, int dx, int dy) {
+    for (int y = 0; y < dy; y++) {
+        const u8* s0 = src + 2 * y * srcStride;
+        const u8* s1 = s0 + srcStride;
+        u8* d = dst + y * dstStride;
+        int x = 0;
+#if defined(HAS_SSE2)
+        for (; x + 4 <= dx; x += 4) {
+            // average the two rows, then the even and odd pixels of the result
+            __m128i v0 = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(s0 + x * 8)),
+                                      _mm_loadu_si128((const __m128i*)(s1 + x * 8)));
+            __m128i v1 = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(s0 + x * 8 + 16)),
+                                      _mm_loadu_si128((const __m128i*)(s1 + x * 8 + 16)));
+            __m128 f0 = _mm_castsi128_ps(v0);
+            __m128 f1 = _mm_castsi128_ps(v1);
+            __m128i even = _mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i odd = _mm_castps_si128(_mm_shuffle_ps(f0, f1, _MM_SHUFFLE(3, 1, 3, 1)));
+            _mm_storeu_si128((__m128i*)(d + x * 4), _mm_avg_epu8(even, odd));
+        }
+#endif
+        for (; x < dx; x++) {
+            for (int c = 0; c < 4; c++) {
+                int sum = s0[x * 8 + c] + s0[x * 8 + 4 + c] + s1[x * 8 + c] + s1[x * 8 + 4 + c];
+                d[x * 4 + c] = (u8)((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+// returns a copy of bmp reduced to 1/2^l2factor of its size (a mipmap level), so that
+// pages shown at a small zoom level don't have to be filtered from the full image
+// for every rendered tile
+static Bitmap* CreateReducedBitmap(Bitmap* bmp, int l2factor) {
+    int dx = (int)bmp->GetWidth() >> l2factor;
+    int dy = (int)bmp->GetHeight() >> l2factor;
+    if (dx < 1 || dy < 1) {
         return nullptr;
     }
 
-    if (!result) {
-        // TODO: drop most memory intensive pages first
-        // (i.e. formats which aren't IsGdiPlusNativeFormat)?
-        if (pageCache.size() >= MAX_IMAGE_PAGE_CACHE) {
-            CrashIf(pageCache.size() != MAX_IMAGE_PAGE_CACHE);
-            DropPage(pageCache.Last(), true);
-        }
-        result = new ImagePage(pageNo, nullptr);
-        result->bmp = LoadBitmapForPage(pageNo, result->ownBmp);
-        pageCache.InsertAt(0, result);
-    } else if (result != pageCache.at(0)) {
-        // keep the list Most Recently Used first
-        pageCache.Remove(result);
-        pageCache.InsertAt(0, result);
+    // premultiplied, so that transparent pixels don't bleed into their neighbors
+    Gdiplus::Rect srcRect(0, 0, bmp->GetWidth(), bmp->GetHeight());
+    Gdiplus::BitmapData srcData;
+    if (bmp->LockBits(&srcRect, Gdiplus::ImageLockModeRead, PixelFormat32bppPARGB, &srcData) != Ok) {
+        return nullptr;
     }
-    // return nullptr if a page failed to load
-    if (result && !result->bmp) {
+    int w = srcRect.Width / 2;
+    int h = srcRect.Height / 2;
+    ptrdiff_t stride = (ptrdiff_t)w * 4;
+    u8* buf = AllocArray<u8>(stride * h);
+    if (buf) {
+        HalveImage((const u8*)srcData.Scan0, srcData.Stride, buf, stride, w, h);
+    }
+    bmp->UnlockBits(&srcData);
+    if (!buf) {
         return nullptr;
     }
-    if (!result) {
+    // the intermediate levels aren't needed, so reduce further in place
+    for (int i = 1; i < l2factor; i++) {
+        w /= 2;
+        h /= 2;
+        HalveImage(buf, stride, buf, stride, w, h);
+    }
+    CrashIf(w != dx || h != dy);
+
+    Bitmap* res = new Bitmap(dx, dy, PixelFormat32bppPARGB);
+    Gdiplus::Rect dstRect(0, 0, dx, dy);
+    Gdiplus::BitmapData dstData;
+    if (res->LockBits(&dstRect, Gdiplus::ImageLockModeWrite, PixelFormat32bppPARGB, &dstData) != Ok) {
+        free(buf);
+        delete res;
         return nullptr;
     }
+    for (int y = 0; y < dy; y++) {
+        memcpy((u8*)dstData.Scan0 + y * dstData.Stride, buf + y * stride, (size_t)dx * 4);
+    }
+    res->UnlockBits(&dstData);
+    free(buf);
+    return res;
+}
+
+// decodes a page (unless another thread already did) and adds it to the cache
+// returns the page referenced as by GetPage or nullptr when prefetching
+ImagePage* EngineImages::LoadPage(int pageNo, int l2factor, bool prefetching) {
+    ScopedCritSec scopeLoad(&loadAccess);
+    {
+        ScopedCritSec scope(&cacheAccess);
+        ImagePage* page = FindCachedPage(pageNo, l2factor);
+        if (page) {
+            return prefetching ? nullptr : ReferencePage(page);
+        }
+    }
 
-    result->refs++;
-    return result;
+    // decode without holding cacheAccess so that the cached pages
+    // remain available to the rendering thread
+    ImagePage* page = new ImagePage(pageNo, nullptr);
+    if (l2factor > 0) {
+        page->bmp = LoadReducedBitmapForPage(pageNo, l2factor);
+        page->l2factor = page->bmp ? l2factor : 0;
+    }
+    if (!page->bmp) {
+        page->bmp = LoadBitmapForPage(pageNo, page->ownBmp);
+    }
+    if (page->bmp && page->l2factor < l2factor) {
+        Bitmap* reduced = CreateReducedBitmap(page->bmp, l2factor - page->l2factor);
+        if (reduced) {
+            if (page->ownBmp) {
+                delete page->bmp;
+            }
+            page->bmp = reduced;
+            page->ownBmp = true;
+            page->l2factor = l2factor;
+        }
+    }
+    if (page->bmp && prefetching) {
+        DecodeBitmap(page->bmp);
+    }
+    page->memSize = BitmapMemorySize(page->bmp);
+
+    ScopedCritSec scope(&cacheAccess);
+    // prefetched pages go behind the page that's currently shown,
+    // so that they don't push it out of the cache
+    pageCache.InsertAt(prefetching && pageCache.size() > 0 ? 1 : 0, page);
+    TrimPageCache(page);
+    return prefetching ? nullptr : ReferencePage(page);
+}
+
+// drops the least recently used pages until the cache is within
+// both its page and its memory limits (keeping the most recent page
+// and the one that's just been added)
+void EngineImages::TrimPageCache(ImagePage* keep) {
+    size_t memTotal = 0;
+    for (ImagePage* page : pageCache) {
+        memTotal += page->memSize;
+    }
+    for (size_t i = pageCache.size() - 1; i > 0; i--) {
+        if (pageCache.size() <= MAX_IMAGE_PAGE_CACHE && memTotal <= MAX_IMAGE_PAGE_CACHE_MEMORY) {
+            break;
+        }
+        ImagePage* page = pageCache.at(i);
+        if (page == keep) {
+            continue;
+        }
+        memTotal -= page->memSize;
+        DropPage(page, true);
+    }
+}
+
+size_t EngineImages::GetMemoryUsage() {
+    ScopedCritSec scope(&cacheAccess);
+    size_t total = 0;
+    for (ImagePage* page : pageCache) {
+        total += page->memSize;
+    }
+    return total;
+}
+
+void EngineImages::ReleaseCachedResources() {
+    ScopedCritSec scope(&cacheAccess);
+    if (pageCache.size() == 0) {
+        return;
+    }
+    // keep the most recently used page and the ones still being used
+    for (size_t i = pageCache.size() - 1; i > 0; i--) {
+        ImagePage* page = pageCache.at(i);
+        if (1 == page->refs) {
+            DropPage(page, true);
+        }
+    }
+}
+
+// decodes the pages following pageNo in the background, so that turning pages
+// doesn't have to wait for the next image to be decompressed
+void EngineImages::StartPrefetching(int pageNo, int l2factor) {
+    if (!canPrefetch) {
+        return;
+    }
+    ScopedCritSec scope(&cacheAccess);
+    if (prefetchCancelled) {
+        return;
+    }
+    // read backwards if the user does so
+    prefetchDir = pageNo < lastRenderedPage ? -1 : 1;
+    lastRenderedPage = pageNo;
+    prefetchFromPage = pageNo + prefetchDir;
+    prefetchL2factor = l2factor;
+    if (prefetchRunning || !NextPageToPrefetch()) {
+        // a running thread picks up the new pages on its own
+        return;
+    }
+    if (prefetchThread) {
+        CloseHandle(prefetchThread);
+    }
+    prefetchRunning = true;
+    prefetchThread = CreateThread(nullptr, 0, PrefetchThreadProc, this, 0, nullptr);
+    if (!prefetchThread) {
+        prefetchRunning = false;
+    }
+}
+
+// returns the next page that would be worth decoding ahead or 0
+// must be called with cacheAccess held
+int EngineImages::NextPageToPrefetch() {
+    for (int i = 0; i < IMAGE_PREFETCH_PAGES && !prefetchCancelled; i++) {
+        int pageNo = prefetchFromPage + i * prefetchDir;
+        if (pageNo < 1 || pageNo > PageCount()) {
+            break;
+        }
+        if (!FindCachedPage(pageNo, prefetchL2factor)) {
+            return pageNo;
+        }
+    }
+    return 0;
+}
+
+DWORD WINAPI EngineImages::PrefetchThreadProc(void* data) {
+    EngineImages* engine = (EngineImages*)data;
+    SetThreadName(GetCurrentThreadId(), "ImagePrefetch");
+    for (;;) {
+        int pageNo, l2factor;
+        {
+            ScopedCritSec scope(&engine->cacheAccess);
+            pageNo = engine->NextPageToPrefetch();
+            if (!pageNo) {
+                engine->prefetchRunning = false;
+                return 0;
+            }
+            l2factor = engine->prefetchL2factor;
+        }
+        engine->LoadPage(pageNo, l2factor, true);
+    }
+}
+
+void EngineImages::StopPrefetching() {
+    HANDLE thread;
+    {
+        ScopedCritSec scope(&cacheAccess);
+        prefetchCancelled = true;
+        thread = prefetchThread;
+        prefetchThread = nullptr;
+    }
+    if (thread) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
 }
 
 void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
@@ -403,10 +759,14 @@ class EngineImage : public EngineImages {
   protected:
     Bitmap* image = nullptr;
     const WCHAR* fileExt = nullptr;
+    // for multi-page TIFFs and animated GIFs: the file data from which other
+    // frames than the first are decoded into Bitmaps of their own
+    ScopedComPtr<IStream> framesStream;
 
     bool LoadSingleFile(const WCHAR* fileName);
     bool LoadFromStream(IStream* stream);
-    bool FinishLoading();
+    bool FinishLoading(std::span<u8> data = {});
+    Bitmap* LoadFrame(int pageNo);
 
     Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
     RectF LoadMediabox(int pageNo) override;
@@ -414,6 +774,8 @@ class EngineImage : public EngineImages {
 
 EngineImage::EngineImage() {
     kind = kindEngineImage;
+    // without framesStream, frames are extracted from the same Bitmap that's drawn for page 1
+    canPrefetch = false;
 }
 
 EngineImage::~EngineImage() {
@@ -434,8 +796,17 @@ EngineBase* EngineImage::Clone() {
     if (fileStream) {
         fileStream->Clone(&clone->fileStream);
     }
+    if (framesStream) {
+        framesStream->AddRef();
+        clone->framesStream = framesStream.Get();
+    }
     clone->image = bmp;
     clone->FinishLoading();
+    if (clone->mediaboxes.size() == mediaboxes.size()) {
+        for (size_t i = 1; i < mediaboxes.size(); i++) {
+            clone->mediaboxes.at(i) = mediaboxes.at(i);
+        }
+    }
 
     return clone;
 }
@@ -450,7 +821,7 @@ bool EngineImage::LoadSingleFile(const WCHAR* file) {
     fileExt = GfxFileExtFromData(data.AsSpan());
     defaultFileExt = fileExt;
     image = BitmapFromData(data.AsSpan());
-    return FinishLoading();
+    return FinishLoading(data.AsSpan());
 }
 
 bool EngineImage::LoadFromStream(IStream* stream) {
@@ -477,10 +848,10 @@ bool EngineImage::LoadFromStream(IStream* stream) {
         image = BitmapFromData(data.AsSpan());
     }
 
-    return FinishLoading();
+    return FinishLoading(data.AsSpan());
 }
 
-bool EngineImage::FinishLoading() {
+bool EngineImage::FinishLoading(std::span<u8> data) {
     if (!image || image->GetLastStatus() != Ok) {
         return false;
     }
@@ -491,8 +862,28 @@ bool EngineImage::FinishLoading() {
 
     // extract all frames from multi-page TIFFs and animated GIFs
     if (str::Eq(fileExt, L".tif") || str::Eq(fileExt, L".gif")) {
-        const GUID* frameDimension = str::Eq(fileExt, L".tif") ? &FrameDimensionPage : &FrameDimensionTime;
-        mediaboxes.AppendBlanks(image->GetFrameCount(frameDimension) - 1);
+        bool isTiff = str::Eq(fileExt, L".tif");
+        const GUID* frameDimension = isTiff ? &FrameDimensionPage : &FrameDimensionTime;
+        int frameCount = (int)image->GetFrameCount(frameDimension);
+        mediaboxes.AppendBlanks(frameCount - 1);
+        if (frameCount > 1 && !data.empty() && !framesStream) {
+            framesStream = CreateStreamFromData(data);
+        }
+        // the other frames can then be decoded concurrently with drawing the first one
+        canPrefetch = framesStream != nullptr;
+
+        // get the frame sizes without decoding the frames (GDI+ composes
+        // all frames of an animated GIF at the same size)
+        Vec<Size> sizes;
+        if (isTiff && TiffPageSizesFromData(data, frameCount, sizes)) {
+            for (int i = 1; i < frameCount; i++) {
+                mediaboxes.at(i) = RectF(0, 0, (float)sizes.at(i).dx, (float)sizes.at(i).dy);
+            }
+        } else if (!isTiff) {
+            for (int i = 1; i < frameCount; i++) {
+                mediaboxes.at(i) = mediaboxes.at(0);
+            }
+        }
     }
     pageCount = (int)mediaboxes.size();
 
@@ -559,6 +950,10 @@ Bitmap* EngineImage::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
     const GUID* frameDimension = str::Eq(fileExt, L".tif") ? &FrameDimensionPage : &FrameDimensionTime;
     uint frameCount = image->GetFrameCount(frameDimension);
     CrashIf((unsigned int)pageNo > frameCount);
+    if (framesStream) {
+        deleteAfterUse = true;
+        return LoadFrame(pageNo);
+    }
     Bitmap* frame = image->Clone(0, 0, image->GetWidth(), image->GetHeight(), PixelFormat32bppARGB);
     if (!frame) {
         return nullptr;
@@ -587,6 +982,14 @@ RectF EngineImage::LoadMediabox(int pageNo) {
 
     CrashIf(!str::Eq(fileExt, L".tif") && !str::Eq(fileExt, L".gif"));
     RectF mbox = RectF(0, 0, (float)image->GetWidth(), (float)image->GetHeight());
+    if (framesStream) {
+        Bitmap* frame = LoadFrame(pageNo);
+        if (frame) {
+            mbox = RectF(0, 0, (float)frame->GetWidth(), (float)frame->GetHeight());
+        }
+        delete frame;
+        return mbox;
+    }
     Bitmap* frame = image->Clone(0, 0, image->GetWidth(), image->GetHeight(), PixelFormat32bppARGB);
     if (!frame) {
         return mbox;
@@ -600,6 +1003,25 @@ RectF EngineImage::LoadMediabox(int pageNo) {
     return mbox;
 }
 
+// decodes a single frame into a Bitmap of its own, which is much cheaper than
+// copying all of image (as a 32-bit bitmap) just to select another frame in it
+Bitmap* EngineImage::LoadFrame(int pageNo) {
+    ScopedComPtr<IStream> stream;
+    if (FAILED(framesStream->Clone(&stream))) {
+        return nullptr;
+    }
+    LARGE_INTEGER zero{};
+    stream->Seek(zero, STREAM_SEEK_SET, nullptr);
+    // GDI+ keeps a reference to the stream and only decodes the selected frame
+    Bitmap* frame = Bitmap::FromStream(stream);
+    const GUID* frameDimension = str::Eq(fileExt, L".tif") ? &FrameDimensionPage : &FrameDimensionTime;
+    if (!frame || frame->GetLastStatus() != Ok || frame->SelectActiveFrame(frameDimension, pageNo - 1) != Ok) {
+        delete frame;
+        return nullptr;
+    }
+    return frame;
+}
+
 bool EngineImage::SaveFileAsPDF(const char* pdfFileName, bool includeUserAnnots) {
     UNUSED(includeUserAnnots);
     bool ok = true;
@@ -675,6 +1097,7 @@ class EngineImageDir : public EngineImages {
     }
 
     virtual ~EngineImageDir() {
+        StopPrefetching();
         delete tocTree;
     }
 
@@ -707,12 +1130,45 @@ class EngineImageDir : public EngineImages {
     // protected:
 
     Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
+    Bitmap* LoadReducedBitmapForPage(int pageNo, int l2factor) override;
     RectF LoadMediabox(int pageNo) override;
 
     WStrVec pageFileNames;
     TocTree* tocTree = nullptr;
 };
 
+// the sizes of all pages are needed for the layout right away and getting them
+// is mostly waiting for the disk, so several files are read at once
+static void LoadImageDirMediaboxes(EngineImageDir* e) {
+    LONG nextIdx = -1;
+    auto loadMediaboxes = [e, &nextIdx] {
+        for (;;) {
+            int idx = (int)InterlockedIncrement(&nextIdx);
+            if (idx >= e->pageCount) {
+                return;
+            }
+            e->mediaboxes.at(idx) = e->LoadMediabox(idx + 1);
+        }
+    };
+
+    HANDLE done[MAX_MEDIABOX_LOADERS - 1];
+    int nDone = 0;
+    int nLoaders = std::min(e->pageCount / 16 + 1, MAX_MEDIABOX_LOADERS);
+    for (int i = 1; i < nLoaders; i++) {
+        HANDLE h = RunAsyncWithHandle(loadMediaboxes);
+        if (h) {
+            done[nDone++] = h;
+        }
+    }
+    loadMediaboxes();
+    if (nDone > 0) {
+        WaitForMultipleObjects(nDone, done, TRUE, INFINITE);
+    }
+    for (int i = 0; i < nDone; i++) {
+        CloseHandle(done[i]);
+    }
+}
+
 static bool LoadImageDir(EngineImageDir* e, const WCHAR* dir) {
     e->SetFileName(dir);
 
@@ -732,6 +1188,7 @@ static bool LoadImageDir(EngineImageDir* e, const WCHAR* dir) {
 
     e->mediaboxes.AppendBlanks(e->pageFileNames.size());
     e->pageCount = (int)e->mediaboxes.size();
+    LoadImageDirMediaboxes(e);
 
     // TODO: better handle the case where images have different resolutions
     ImagePage* page = e->GetPage(1);
@@ -812,8 +1269,32 @@ Bitmap* EngineImageDir::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
     return nullptr;
 }
 
+Bitmap* EngineImageDir::LoadReducedBitmapForPage(int pageNo, int l2factor) {
+    const WCHAR* path = pageFileNames.at(pageNo - 1);
+    // avoid reading files that can't be decoded at a reduced size anyway
+    if (GuessFileTypeFromName(path) != kindFileJpeg) {
+        return nullptr;
+    }
+    AutoFree bmpData = file::ReadFile(path);
+    if (bmpData.data) {
+        return BitmapFromDataReduced(bmpData.AsSpan(), l2factor);
+    }
+    return nullptr;
+}
+
+// reads only the beginning of the file, which for most images contains the size
 RectF EngineImageDir::LoadMediabox(int pageNo) {
-    AutoFree bmpData = file::ReadFile(pageFileNames.at(pageNo - 1));
+    const WCHAR* path = pageFileNames.at(pageNo - 1);
+    ScopedMem<char> header(AllocArray<char>(IMAGE_HEADER_PROBE_SIZE));
+    int n = header ? file::ReadN(path, header, IMAGE_HEADER_PROBE_SIZE) : 0;
+    if (n > 0) {
+        Size size = BitmapSizeFromHeader({(u8*)header.Get(), (size_t)n});
+        if (!size.IsEmpty()) {
+            return RectF(0, 0, (float)size.dx, (float)size.dy);
+        }
+    }
+
+    AutoFree bmpData = file::ReadFile(path);
     if (bmpData.data) {
         std::span<u8> sp{(u8*)bmpData.data, bmpData.size()};
         Size size = BitmapSizeFromData(sp);
@@ -882,9 +1363,12 @@ class EngineCbx : public EngineImages, public json::ValueVisitor {
 
     // an image for each page
     Vec<ImageData> images;
+    // false for pages pointing into cbxFile's memory mapping
+    Vec<bool> imagesOwned;
 
   protected:
     Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
+    Bitmap* LoadReducedBitmapForPage(int pageNo, int l2factor) override;
     RectF LoadMediabox(int pageNo) override;
 
     bool LoadFromFile(const WCHAR* fileName);
@@ -894,7 +1378,8 @@ class EngineCbx : public EngineImages, public json::ValueVisitor {
     ImageData GetImageData(int pageNo);
     void ParseComicInfoXml(std::span<u8> xmlData);
 
-    // access to cbxFile must be protected after initialization (with cacheAccess)
+    // access to cbxFile must be protected after initialization (with loadAccess)
+    // it's only kept after loading if pages are used in place from its memory mapping
     MultiFormatArchive* cbxFile = nullptr;
     Vec<MultiFormatArchive::FileInfo*> files;
     TocTree* tocTree = nullptr;
@@ -920,14 +1405,17 @@ EngineCbx::EngineCbx(MultiFormatArchive* arch) {
 }
 
 EngineCbx::~EngineCbx() {
+    StopPrefetching();
     delete tocTree;
 
     // can be set in error conditions but generally is
     // deleted in FinishLoading
     delete cbxFile;
 
-    for (auto&& img : images) {
-        free(img.data);
+    for (size_t i = 0; i < images.size(); i++) {
+        if (imagesOwned[i]) {
+            free(images[i].data);
+        }
     }
 }
 
@@ -1070,17 +1558,39 @@ bool EngineCbx::FinishLoading() {
     }
     tocTree = new TocTree(root);
 
+    // images stored uncompressed in a memory-mapped .cbz (i.e. most of them)
+    // are used in place, all others are extracted at once in archive order,
+    // as extracting them one by one in page order might decompress a solid
+    // archive from the start for each page
+    Vec<size_t> fileIds;
+    Vec<int> extractedPages;
+    int nStoredPages = 0;
     for (int i = 0; i < pageCount; i++) {
-        size_t fileId = files[i]->fileId;
-        std::span<u8> sv = cbxFile->GetFileDataById(fileId);
+        std::span<u8> sv = cbxFile->GetStoredFileDataById(files[i]->fileId);
         ImageData img;
         img.data = (char*)sv.data();
         img.len = sv.size();
         images.Append(img);
+        imagesOwned.Append(sv.empty());
+        if (sv.empty()) {
+            fileIds.Append(files[i]->fileId);
+            extractedPages.Append(i);
+        } else {
+            nStoredPages++;
+        }
+    }
+    Vec<std::span<u8>> filesData = cbxFile->GetFilesDataById(fileIds);
+    for (size_t i = 0; i < extractedPages.size(); i++) {
+        std::span<u8> sv = filesData[i];
+        ImageData& img = images[extractedPages[i]];
+        img.data = (char*)sv.data();
+        img.len = sv.size();
     }
 
-    delete cbxFile;
-    cbxFile = nullptr;
+    if (0 == nStoredPages) {
+        delete cbxFile;
+        cbxFile = nullptr;
+    }
 
     return true;
 }
@@ -1235,6 +1745,14 @@ Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
     return nullptr;
 }
 
+Bitmap* EngineCbx::LoadReducedBitmapForPage(int pageNo, int l2factor) {
+    ImageData img = GetImageData(pageNo);
+    if (img.data) {
+        return BitmapFromDataReduced(img.AsSpan(), l2factor);
+    }
+    return nullptr;
+}
+
 RectF EngineCbx::LoadMediabox(int pageNo) {
     // fill the cache to prevent the first few images from being unpacked twice
     ImagePage* page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.size());
@@ -1255,11 +1773,10 @@ RectF EngineCbx::LoadMediabox(int pageNo) {
 EngineBase* EngineCbx::CreateFromFile(const WCHAR* path) {
     // we sniff the type from content first because the
     // files can be mis-named e.g. .cbr archive with .cbz ext
-    Kind kind = GuessFileTypeFromContent(path);
+    // (zip archives are opened while sniffing)
     MultiFormatArchive* archive = nullptr;
-    if (kind == kindFileZip) {
-        archive = OpenZipArchive(path, false);
-    } else if (kind == kindFileRar) {
+    Kind kind = GuessFileTypeFromContent(path, &archive);
+    if (kind == kindFileRar) {
         archive = OpenRarArchive(path);
     } else if (kind == kindFile7Z) {
         archive = Open7zArchive(path);
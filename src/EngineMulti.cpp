@@ -9,11 +9,13 @@ extern "C" {
 #include "utils/BaseUtil.h"
 #include "utils/Archive.h"
 #include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/DirIter.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
+#include "utils/StringViewUtil.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
@@ -30,14 +32,35 @@ extern "C" {
 #include "ParseBKM.h"
 #include "EngineMulti.h"
 
+// page boxes of sub-documents are cached in this directory (under %TEMP%), so that
+// a virtual document can be laid out without loading all the documents it's made of
+#define MULTI_MANIFEST_DIR_NAME L"SumatraPDF-vbkm"
+// number of unused sub-documents which are kept loaded
+#define MAX_LOADED_SUB_ENGINES 4
+// sub-documents are unloaded at the earliest after having been unused for this long
+// (page elements handed out by them might still be in use shortly afterwards)
+#define SUB_ENGINE_UNLOAD_DELAY_MS (30 * 1000)
+
 struct EngineInfo {
     TocItem* tocRoot = nullptr;
+    // loaded when its pages are first needed, see UsedEngine
     EngineBase* engine = nullptr;
+    char* path = nullptr;
+    int nPages = 0;
+    Vec<RectF> mediaboxes;
+    // the engine isn't unloaded while it's being used
+    int useCount = 0;
+    DWORD lastUsed = 0;
+
+    ~EngineInfo() {
+        delete engine;
+        free(path);
+    }
 };
 
 struct EnginePage {
     int pageNoInEngine = 0;
-    EngineBase* engine = nullptr;
+    EngineInfo* ei = nullptr;
 };
 
 Kind kindEngineMulti = "enginePdfMulti";
@@ -58,7 +81,7 @@ class EngineMulti : public EngineBase {
     std::span<u8> GetFileData() override;
     bool SaveFileAs(const char* copyFileName, bool includeUserAnnots = false) override;
     bool SaveFileAsPdf(const char* pdfFileName, bool includeUserAnnots = false);
-    PageText ExtractPageText(int pageNo) override;
+    PageText ExtractPageText(int pageNo, AbortCookie** cookie_out = nullptr) override;
 
     bool HasClipOptimizations(int pageNo) override;
     WCHAR* GetProperty(DocumentProperty prop) override;
@@ -75,34 +98,132 @@ class EngineMulti : public EngineBase {
     WCHAR* GetPageLabel(int pageNo) const override;
     int GetPageByLabel(const WCHAR* label) const override;
 
+    void ReleaseCachedResources() override;
+    size_t GetMemoryUsage() override;
+
     bool Load(const WCHAR* fileName, PasswordUI* pwdUI);
     bool LoadFromFiles(std::string_view dir, VecStr& files);
-    void UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo);
+    void UpdatePagesForEngines(Vec<EngineInfo*>& enginesInfo);
+
+    EngineInfo* PageToEngine(int& pageNo) const;
+    EngineBase* UseEngine(EngineInfo* ei);
+    void ReleaseEngine(EngineInfo* ei);
+    void UnloadUnusedEngines(size_t maxLoaded, DWORD minAgeMs);
 
-    EngineBase* PageToEngine(int& pageNo) const;
     VbkmFile vbkm;
     Vec<EnginePage> pageToEngine;
-    Vec<EngineInfo> enginesInfo;
+    Vec<EngineInfo*> enginesInfo;
     TocTree* tocTree = nullptr;
+    // protects loading and unloading of engines in enginesInfo
+    CRITICAL_SECTION enginesAccess;
 };
 
-EngineBase* EngineMulti::PageToEngine(int& pageNo) const {
+// keeps the sub-engine for a page loaded while in scope
+// (and translates pageNo into the sub-engine's page number)
+class UsedEngine {
+    EngineMulti* multi = nullptr;
+    EngineInfo* ei = nullptr;
+
+  public:
+    EngineBase* engine = nullptr;
+
+    UsedEngine(const EngineMulti* multi, int& pageNo) {
+        this->multi = (EngineMulti*)multi;
+        ei = multi->PageToEngine(pageNo);
+        engine = this->multi->UseEngine(ei);
+    }
+    UsedEngine(EngineMulti* multi, EngineInfo* ei) : multi(multi), ei(ei) {
+        engine = multi->UseEngine(ei);
+    }
+    ~UsedEngine() {
+        multi->ReleaseEngine(ei);
+    }
+};
+
+EngineInfo* EngineMulti::PageToEngine(int& pageNo) const {
     const EnginePage& ep = pageToEngine[pageNo - 1];
     pageNo = ep.pageNoInEngine;
-    return ep.engine;
+    return ep.ei;
 }
 
 EngineMulti::EngineMulti() {
     kind = kindEngineMulti;
     defaultFileExt = L".vbkm";
     fileDPI = 72.0f;
+    InitializeCriticalSection(&enginesAccess);
 }
 
 EngineMulti::~EngineMulti() {
-    for (auto&& ei : enginesInfo) {
-        delete ei.engine;
-    }
+    DeleteVecMembers(enginesInfo);
     delete tocTree;
+    DeleteCriticalSection(&enginesAccess);
+}
+
+// loads the engine if necessary, returns nullptr if that fails
+EngineBase* EngineMulti::UseEngine(EngineInfo* ei) {
+    ScopedCritSec scope(&enginesAccess);
+    ei->useCount++;
+    ei->lastUsed = GetTickCount();
+    if (!ei->engine) {
+        AutoFreeWstr pathW = strconv::Utf8ToWstr(ei->path);
+        ei->engine = CreateEngine(pathW, nullptr);
+        // the document has been changed since it was added
+        if (ei->engine && ei->engine->PageCount() != ei->nPages) {
+            logf("EngineMulti: page count of '%s' changed\n", ei->path);
+            delete ei->engine;
+            ei->engine = nullptr;
+        }
+        UnloadUnusedEngines(MAX_LOADED_SUB_ENGINES, SUB_ENGINE_UNLOAD_DELAY_MS);
+    }
+    return ei->engine;
+}
+
+void EngineMulti::ReleaseEngine(EngineInfo* ei) {
+    ScopedCritSec scope(&enginesAccess);
+    ei->useCount--;
+    CrashIf(ei->useCount < 0);
+}
+
+// unloads unused engines, least recently used first, until at most maxLoaded remain
+// must be called with enginesAccess held
+void EngineMulti::UnloadUnusedEngines(size_t maxLoaded, DWORD minAgeMs) {
+    DWORD now = GetTickCount();
+    Vec<EngineInfo*> unused;
+    for (EngineInfo* ei : enginesInfo) {
+        if (ei->engine && ei->useCount == 0 && now - ei->lastUsed >= minAgeMs) {
+            unused.Append(ei);
+        }
+    }
+    if (unused.size() <= maxLoaded) {
+        return;
+    }
+    std::sort(unused.begin(), unused.end(),
+              [now](EngineInfo* ei1, EngineInfo* ei2) { return now - ei1->lastUsed > now - ei2->lastUsed; });
+    for (size_t i = 0; i < unused.size() - maxLoaded; i++) {
+        delete unused[i]->engine;
+        unused[i]->engine = nullptr;
+    }
+}
+
+void EngineMulti::ReleaseCachedResources() {
+    ScopedCritSec scope(&enginesAccess);
+    UnloadUnusedEngines(0, 0);
+    for (EngineInfo* ei : enginesInfo) {
+        if (ei->engine) {
+            ei->engine->ReleaseCachedResources();
+        }
+    }
+}
+
+size_t EngineMulti::GetMemoryUsage() {
+    ScopedCritSec scope(&enginesAccess);
+    size_t total = 0;
+    for (EngineInfo* ei : enginesInfo) {
+        if (ei->engine) {
+            total += ei->engine->GetMemoryUsage();
+        }
+    }
+    return total;
 }
 
 EngineBase* EngineMulti::Clone() {
@@ -112,24 +233,35 @@ EngineBase* EngineMulti::Clone() {
     return CreateEngineMultiFromFile(fileName, nullptr);
 }
 
+// doesn't require the engine to be loaded
 RectF EngineMulti::PageMediabox(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->PageMediabox(pageNo);
+    EngineInfo* ei = PageToEngine(pageNo);
+    return ei->mediaboxes[pageNo - 1];
 }
 
 RectF EngineMulti::PageContentBox(int pageNo, RenderTarget target) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->PageContentBox(pageNo, target);
+    RectF mediabox = PageMediabox(pageNo);
+    UsedEngine e(this, pageNo);
+    if (!e.engine) {
+        return mediabox;
+    }
+    return e.engine->PageContentBox(pageNo, target);
 }
 
 RenderedBitmap* EngineMulti::RenderPage(RenderPageArgs& args) {
-    EngineBase* e = PageToEngine(args.pageNo);
-    return e->RenderPage(args);
+    UsedEngine e(this, args.pageNo);
+    if (!e.engine) {
+        return nullptr;
+    }
+    return e.engine->RenderPage(args);
 }
 
 RectF EngineMulti::Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->Transform(rect, pageNo, zoom, rotation, inverse);
+    UsedEngine e(this, pageNo);
+    if (!e.engine) {
+        return rect;
+    }
+    return e.engine->Transform(rect, pageNo, zoom, rotation, inverse);
 }
 
 std::span<u8> EngineMulti::GetFileData() {
@@ -144,14 +276,20 @@ bool EngineMulti::SaveFileAsPdf(const char* pdfFileName, bool includeUserAnnots)
     return false;
 }
 
-PageText EngineMulti::ExtractPageText(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->ExtractPageText(pageNo);
+PageText EngineMulti::ExtractPageText(int pageNo, AbortCookie** cookie_out) {
+    UsedEngine e(this, pageNo);
+    if (!e.engine) {
+        return {};
+    }
+    return e.engine->ExtractPageText(pageNo, cookie_out);
 }
 
 bool EngineMulti::HasClipOptimizations(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->HasClipOptimizations(pageNo);
+    UsedEngine e(this, pageNo);
+    if (!e.engine) {
+        return false;
+    }
+    return e.engine->HasClipOptimizations(pageNo);
 }
 
 WCHAR* EngineMulti::GetProperty(DocumentProperty prop) {
@@ -159,30 +297,50 @@ WCHAR* EngineMulti::GetProperty(DocumentProperty prop) {
 }
 
 bool EngineMulti::BenchLoadPage(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->BenchLoadPage(pageNo);
+    UsedEngine e(this, pageNo);
+    if (!e.engine) {
+        return false;
+    }
+    return e.engine->BenchLoadPage(pageNo);
 }
 
 Vec<IPageElement*>* EngineMulti::GetElements(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->GetElements(pageNo);
+    UsedEngine e(this, pageNo);
+    if (!e.engine) {
+        return nullptr;
+    }
+    return e.engine->GetElements(pageNo);
 }
 
 IPageElement* EngineMulti::GetElementAtPos(int pageNo, PointF pt) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->GetElementAtPos(pageNo, pt);
+    UsedEngine e(this, pageNo);
+    if (!e.engine) {
+        return nullptr;
+    }
+    return e.engine->GetElementAtPos(pageNo, pt);
 }
 
 RenderedBitmap* EngineMulti::GetImageForPageElement(IPageElement* ipel) {
     PageElement* pel = (PageElement*)ipel;
-    EngineBase* e = PageToEngine(pel->pageNo);
-    return e->GetImageForPageElement(pel);
+    int pageNo = pel->pageNo;
+    UsedEngine e(this, pageNo);
+    if (!e.engine) {
+        return nullptr;
+    }
+    return e.engine->GetImageForPageElement(pel);
 }
 
 PageDestination* EngineMulti::GetNamedDest(const WCHAR* name) {
-    for (auto&& pe : pageToEngine) {
-        EngineBase* e = pe.engine;
-        auto dest = e->GetNamedDest(name);
+    // note: this has to load all sub-documents
+    for (EngineInfo* ei : enginesInfo) {
+        if (ei->tocRoot->isUnchecked) {
+            continue;
+        }
+        UsedEngine e(this, ei);
+        if (!e.engine) {
+            continue;
+        }
+        auto dest = e.engine->GetNamedDest(name);
         if (dest) {
             // TODO: fix up page number in returned destination
             return dest;
@@ -234,14 +392,24 @@ WCHAR* EngineMulti::GetPageLabel(int pageNo) const {
         return nullptr;
     }
 
-    EngineBase* e = PageToEngine(pageNo);
-    return e->GetPageLabel(pageNo);
+    UsedEngine e(this, pageNo);
+    if (!e.engine) {
+        return nullptr;
+    }
+    return e.engine->GetPageLabel(pageNo);
 }
 
 int EngineMulti::GetPageByLabel(const WCHAR* label) const {
-    for (auto&& pe : pageToEngine) {
-        EngineBase* e = pe.engine;
-        int pageNo = e->GetPageByLabel(label);
+    EngineMulti* self = (EngineMulti*)this;
+    for (EngineInfo* ei : enginesInfo) {
+        if (ei->tocRoot->isUnchecked) {
+            continue;
+        }
+        UsedEngine e(self, ei);
+        if (!e.engine) {
+            continue;
+        }
+        int pageNo = e.engine->GetPageByLabel(label);
         if (pageNo != -1) {
             // TODO: fixup page number
             return pageNo;
@@ -340,6 +508,113 @@ std::string_view FindEnginePath(std::string_view vbkmPath, std::string_view engi
     return {};
 }
 
+static WCHAR* GetManifestPath(const char* path) {
+    AutoFreeWstr tempDir(path::GetTempPath(nullptr));
+    if (!tempDir) {
+        return nullptr;
+    }
+    AutoFreeWstr manifestDir(path::Join(tempDir, MULTI_MANIFEST_DIR_NAME));
+    if (!dir::Create(manifestDir)) {
+        return nullptr;
+    }
+    u8 digest[20];
+    CalcSHA1Digest((const u8*)path, str::Len(path), digest);
+    AutoFree fingerPrint(_MemToHex(&digest));
+    AutoFreeWstr fname(strconv::FromAnsi(fingerPrint));
+    return str::Format(L"%s\\%s.txt", manifestDir.Get(), fname.Get());
+}
+
+// identifies the version of a file a manifest has been created for
+static char* GetFileStamp(const char* path) {
+    i64 size = file::GetSize(path);
+    if (size < 0) {
+        return nullptr;
+    }
+    AutoFreeWstr pathW = strconv::Utf8ToWstr(path);
+    FILETIME ft = file::GetModificationTime(pathW);
+    return str::Format("%lld %u %u", size, ft.dwHighDateTime, ft.dwLowDateTime);
+}
+
+// the manifest of a sub-document is:
+// file: ${path}
+// stamp: ${size and modification time}
+// followed by "${x} ${y} ${dx} ${dy}" of each page's mediabox
+static bool LoadManifest(EngineInfo* ei) {
+    AutoFreeWstr manifestPath(GetManifestPath(ei->path));
+    AutoFreeStr stamp(GetFileStamp(ei->path));
+    if (!manifestPath || !stamp) {
+        return false;
+    }
+    AutoFree data = file::ReadFile(manifestPath);
+    if (data.empty()) {
+        return false;
+    }
+    std::string_view sv = data.AsView();
+    sv::ParsedKV file = sv::ParseValueOfKey(sv, "file", true);
+    if (!file.ok || !str::Eq(file.val, ei->path)) {
+        return false;
+    }
+    sv::ParsedKV fileStamp = sv::ParseValueOfKey(sv, "stamp", true);
+    if (!fileStamp.ok || !str::Eq(fileStamp.val, stamp)) {
+        return false;
+    }
+    Vec<RectF> mediaboxes;
+    for (;;) {
+        std::string_view line = sv::ParseUntil(sv, '\n');
+        if (line.empty()) {
+            break;
+        }
+        RectF r;
+        if (!str::Parse(line.data(), line.size(), "%f %f %f %f", &r.x, &r.y, &r.dx, &r.dy)) {
+            return false;
+        }
+        mediaboxes.Append(r);
+    }
+    if (mediaboxes.size() == 0 || (ei->nPages != 0 && (size_t)ei->nPages != mediaboxes.size())) {
+        return false;
+    }
+    ei->nPages = (int)mediaboxes.size();
+    ei->mediaboxes = std::move(mediaboxes);
+    return true;
+}
+
+static void SaveManifest(EngineInfo* ei) {
+    AutoFreeWstr manifestPath(GetManifestPath(ei->path));
+    AutoFreeStr stamp(GetFileStamp(ei->path));
+    if (!manifestPath || !stamp) {
+        return;
+    }
+    str::Str s;
+    s.AppendFmt("file: %s\n", ei->path);
+    s.AppendFmt("stamp: %s\n", stamp.Get());
+    for (RectF& r : ei->mediaboxes) {
+        s.AppendFmt("%.2f %.2f %.2f %.2f\n", r.x, r.y, r.dx, r.dy);
+    }
+    file::WriteFile(manifestPath, s.AsSpan());
+}
+
+// sub-documents are only loaded if there's no (up to date) manifest for them
+static bool InitEngineInfo(EngineInfo* ei, EngineBase* engine) {
+    if (!engine && LoadManifest(ei)) {
+        return true;
+    }
+    if (!engine) {
+        AutoFreeWstr pathW = strconv::Utf8ToWstr(ei->path);
+        engine = CreateEngine(pathW, nullptr);
+    }
+    if (!engine) {
+        return false;
+    }
+    ei->engine = engine;
+    ei->lastUsed = GetTickCount();
+    ei->nPages = engine->PageCount();
+    for (int i = 1; i <= ei->nPages; i++) {
+        ei->mediaboxes.Append(engine->PageMediabox(i));
+    }
+    SaveManifest(ei);
+    return true;
+}
+
 TocItem* CreateWrapperItem(EngineBase* engine) {
     TocItem* tocFileRoot = nullptr;
     TocTree* tocTree = engine->GetToc();
@@ -369,6 +644,7 @@ bool EngineMulti::LoadFromFiles(std::string_view dir, VecStr& files) {
     for (int i = 0; i < n; i++) {
         std::string_view path = files.at(i);
         AutoFreeWstr pathW = strconv::Utf8ToWstr(path);
+        // the table of contents of the documents is needed, so they have to be loaded
         EngineBase* engine = CreateEngine(pathW);
         if (!engine) {
             continue;
@@ -381,15 +657,18 @@ bool EngineMulti::LoadFromFiles(std::string_view dir, VecStr& files) {
             tocFiles->AddSiblingAtEnd(wrapper);
         }
 
-        EngineInfo ei;
-        ei.engine = engine;
-        ei.tocRoot = wrapper;
+        EngineInfo* ei = new EngineInfo();
+        ei->path = str::Dup(path);
+        ei->tocRoot = wrapper;
+        InitEngineInfo(ei, engine);
         enginesInfo.Append(ei);
     }
     if (tocFiles == nullptr) {
         return false;
     }
     UpdatePagesForEngines(enginesInfo);
+    ScopedCritSec scope(&enginesAccess);
+    UnloadUnusedEngines(MAX_LOADED_SUB_ENGINES, 0);
 
     AutoFreeWstr dirW = strconv::Utf8ToWstr(dir);
     TocItem* root = new TocItem(nullptr, dirW, 0);
@@ -402,14 +681,14 @@ bool EngineMulti::LoadFromFiles(std::string_view dir, VecStr& files) {
     return true;
 }
 
-void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
+void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo*>& enginesInfo) {
     int nTotalPages = 0;
-    for (auto&& ei : enginesInfo) {
-        TocItem* root = ei.tocRoot;
+    for (EngineInfo* ei : enginesInfo) {
+        TocItem* root = ei->tocRoot;
         if (root->isUnchecked) {
             continue;
         }
-        int nPages = ei.engine->PageCount();
+        int nPages = ei->nPages;
 #if 0
         Vec<bool> visiblePages;
         for (int i = 0; i < nPages; i++) {
@@ -421,7 +700,7 @@ void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
             if (!visiblePages[i]) {
                 continue;
             }
-            EnginePage ep{i + 1, ei.engine};
+            EnginePage ep{i + 1, ei};
             pageToEngine.Append(ep);
             nPage++;
         }
@@ -429,10 +708,10 @@ void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
         nTotalPages += nPage;
 #else
         for (int i = 1; i <= nPages; i++) {
-            EnginePage ep{i, ei.engine};
+            EnginePage ep{i, ei};
             pageToEngine.Append(ep);
         }
-        updateTocItemsPageNo(ei.tocRoot, nTotalPages, true);
+        updateTocItemsPageNo(ei->tocRoot, nTotalPages, true);
         nTotalPages += nPages;
 #endif
     }
@@ -448,8 +727,8 @@ void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
         return true;
     };
 
-    for (auto&& ei : enginesInfo) {
-        TocItem* root = ei.tocRoot;
+    for (EngineInfo* ei : enginesInfo) {
+        TocItem* root = ei->tocRoot;
         if (root->isUnchecked) {
             continue;
         }
@@ -468,7 +747,8 @@ bool EngineMulti::Load(const WCHAR* fileName, PasswordUI* pwdUI) {
     delete vbkm.tree;
     vbkm.tree = nullptr;
 
-    // load all referenced files
+    // referenced files are only loaded when their pages are needed
+    // (or if there's no manifest with their page sizes yet)
     auto loadEngines = [this, &filePath](TocItem* ti) -> bool {
         if (ti->engineFilePath == nullptr) {
             return true;
@@ -477,20 +757,21 @@ bool EngineMulti::Load(const WCHAR* fileName, PasswordUI* pwdUI) {
             return true;
         }
 
-        EngineBase* engine = nullptr;
         AutoFreeStr path = FindEnginePath(filePath.AsView(), ti->engineFilePath);
         if (path.empty()) {
             return false;
         }
-        AutoFreeWstr pathW = strconv::Utf8ToWstr(path.AsView());
-        engine = CreateEngine(pathW, nullptr);
-        if (!engine) {
+        EngineInfo* ei = new EngineInfo();
+        ei->path = path.Release();
+        ei->tocRoot = ti;
+        ei->nPages = ti->nPages;
+        if (!InitEngineInfo(ei, nullptr)) {
+            delete ei;
             return false;
         }
-        EngineInfo ei;
-        ei.engine = engine;
-        ei.tocRoot = ti;
         this->enginesInfo.Append(ei);
+        ScopedCritSec scope(&this->enginesAccess);
+        this->UnloadUnusedEngines(MAX_LOADED_SUB_ENGINES, 0);
         return true;
     };
 
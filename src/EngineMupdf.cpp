@@ -47,12 +47,15 @@ class EngineMupdf : public EngineBase {
 
     std::span<u8> GetFileData() override;
     bool SaveFileAs(const char* copyFileName, bool includeUserAnnots = false) override;
-    PageText ExtractPageText(int pageNo) override;
+    PageText ExtractPageText(int pageNo, AbortCookie** cookie_out = nullptr) override;
 
     bool HasClipOptimizations(int pageNo) override;
     WCHAR* GetProperty(DocumentProperty prop) override;
 
     bool BenchLoadPage(int pageNo) override;
+    size_t GetMemoryUsage() override {
+        return (size_t)InterlockedAdd64(&fzMem.allocated, 0);
+    }
 
     Vec<IPageElement*>* GetElements(int pageNo) override;
     IPageElement* GetElementAtPos(int pageNo, PointF pt) override;
@@ -69,8 +72,11 @@ class EngineMupdf : public EngineBase {
 
     // make sure to never ask for pagesAccess in an ctxAccess
     // protected critical section in order to avoid deadlocks
+    // ctxAccess serializes all access to _doc, which isn't thread safe
+    // (display lists can be rendered without it, see FzRenderDisplayLists)
     CRITICAL_SECTION* ctxAccess;
     CRITICAL_SECTION pagesAccess;
+    CRITICAL_SECTION docAccess;
 
     CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
 
@@ -78,6 +84,7 @@ class EngineMupdf : public EngineBase {
 
     fz_context* ctx = nullptr;
     fz_locks_context fz_locks_ctx;
+    FzMemCounter fzMem;
     fz_document* _doc = nullptr;
     fz_stream* _docStream = nullptr;
     Vec<FzPageInfo*> _pages;
@@ -128,12 +135,15 @@ EngineMupdf::EngineMupdf() {
         InitializeCriticalSection(&mutexes[i]);
     }
     InitializeCriticalSection(&pagesAccess);
-    ctxAccess = &mutexes[FZ_LOCK_ALLOC];
+    // not MuPDF's FZ_LOCK_ALLOC, as that would block all allocations
+    // (also of cloned contexts) while a thread is using the document
+    InitializeCriticalSection(&docAccess);
+    ctxAccess = &docAccess;
 
     fz_locks_ctx.user = this;
     fz_locks_ctx.lock = fz_lock_context_cs;
     fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(nullptr, &fz_locks_ctx, FZ_STORE_DEFAULT);
+    ctx = fz_new_context(&fzMem.alloc, &fz_locks_ctx, FzStoreSize());
     installFitzErrorCallbacks(ctx);
 
     pdf_install_load_system_font_funcs(ctx);
@@ -152,8 +162,7 @@ EngineMupdf::~EngineMupdf() {
         if (pi->page) {
             fz_drop_page(ctx, pi->page);
         }
-        DeleteVecMembers(pi->autoLinks);
-        DeleteVecMembers(pi->comments);
+        // autoLinks and comments are freed together with pi->arena
     }
 
     DeleteVecMembers(_pages);
@@ -165,9 +174,10 @@ EngineMupdf::~EngineMupdf() {
     fz_drop_context(ctx);
 
     for (size_t i = 0; i < dimof(mutexes); i++) {
-        LeaveCriticalSection(&mutexes[i]);
         DeleteCriticalSection(&mutexes[i]);
     }
+    LeaveCriticalSection(ctxAccess);
+    DeleteCriticalSection(ctxAccess);
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
 }
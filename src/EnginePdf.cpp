@@ -9,6 +9,8 @@ extern "C" {
 #include "utils/BaseUtil.h"
 #include "utils/Archive.h"
 #include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
+#include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/HtmlParserLookup.h"
@@ -17,6 +19,7 @@ extern "C" {
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
 #include "utils/Log.h"
+#include "utils/Trace.h"
 #include "utils/LogDbg.h"
 
 #include "AppColors.h"
@@ -193,6 +196,121 @@ void BuildPageLabelRec(fz_context* ctx, pdf_obj* node, int pageCount, Vec<PageLa
     }
 }
 
+// first page and numbering of pages labeled alike
+struct PageLabelRange {
+    int startAt = 0;
+    int countFrom = 0;
+    // "D", "R", "r", "A", "a" or "" (see FormatPageLabel)
+    char type[2] = {0};
+    WCHAR* prefix = nullptr;
+};
+
+// labels of different types can only be equal if their numbers
+// are made of the same characters
+static int PageLabelCharClass(char type) {
+    switch (type) {
+        case 'D':
+            return 1;
+        case 'R':
+        case 'A':
+            return 2;
+        case 'r':
+        case 'a':
+            return 3;
+    }
+    return 0;
+}
+
+static int PageLabelRangeLen(Vec<PageLabelRange>& ranges, size_t i, int pageCount) {
+    int end = i + 1 < ranges.size() ? ranges.at(i + 1).startAt : pageCount + 1;
+    return end - ranges.at(i).startAt;
+}
+
+// page labels can be formatted on demand (instead of having BuildPageLabelVec
+// make them unique up front) if no two ranges can produce the same label
+static bool ArePageLabelRangesUnique(Vec<PageLabelRange>& ranges, int pageCount) {
+    size_t n = ranges.size();
+    // the pairwise check below doesn't scale
+    if (n > 1000 || ranges.at(0).startAt != 1) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        PageLabelRange& r1 = ranges.at(i);
+        int len1 = PageLabelRangeLen(ranges, i, pageCount);
+        if (len1 < 1 || (!r1.type[0] && len1 > 1)) {
+            return false;
+        }
+        for (size_t j = i + 1; j < n; j++) {
+            PageLabelRange& r2 = ranges.at(j);
+            if (!str::Eq(r1.prefix, r2.prefix)) {
+                if (str::StartsWith(r1.prefix, r2.prefix) || str::StartsWith(r2.prefix, r1.prefix)) {
+                    return false;
+                }
+                continue;
+            }
+            int class1 = PageLabelCharClass(r1.type[0]);
+            int class2 = PageLabelCharClass(r2.type[0]);
+            if (class1 != class2) {
+                // also covers labels without numbers
+                continue;
+            }
+            if (r1.type[0] != r2.type[0] || class1 == 0) {
+                return false;
+            }
+            int len2 = PageLabelRangeLen(ranges, j, pageCount);
+            if (r1.countFrom < r2.countFrom + len2 && r2.countFrom < r1.countFrom + len1) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// returns false if the labels have to be built with BuildPageLabelVec instead
+// (ranges remains empty if the default labels are to be used)
+static bool BuildPageLabelRanges(fz_context* ctx, pdf_obj* root, int pageCount, Vec<PageLabelRange>& ranges) {
+    Vec<PageLabelInfo> data;
+    BuildPageLabelRec(ctx, root, pageCount, data);
+    data.Sort(CmpPageLabelInfo);
+
+    size_t n = data.size();
+    if (n == 0) {
+        return true;
+    }
+    PageLabelInfo& first = data.at(0);
+    if (n == 1 && first.startAt == 1 && first.countFrom == 1 && !first.prefix && str::Eq(first.type, "D")) {
+        return true;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        PageLabelInfo& pli = data.at(i);
+        if (pli.startAt > pageCount) {
+            break;
+        }
+        if (i > 0 && pli.startAt == data.at(i - 1).startAt) {
+            break;
+        }
+        PageLabelRange r;
+        r.startAt = pli.startAt;
+        r.countFrom = pli.countFrom;
+        if (str::Eq(pli.type, "D") || str::EqI(pli.type, "R") || str::EqI(pli.type, "A")) {
+            r.type[0] = pli.type[0];
+        }
+        r.prefix = pdf_to_wstr(ctx, pli.prefix);
+        ranges.Append(r);
+    }
+
+    size_t nRanges = ranges.size();
+    bool ok = nRanges == n && nRanges > 0 && ArePageLabelRangesUnique(ranges, pageCount);
+    if (!ok) {
+        for (auto& r : ranges) {
+            free(r.prefix);
+        }
+        ranges.Reset();
+    }
+    return ok;
+}
+
 WStrVec* BuildPageLabelVec(fz_context* ctx, pdf_obj* root, int pageCount) {
     Vec<PageLabelInfo> data;
     BuildPageLabelRec(ctx, root, pageCount, data);
@@ -296,6 +414,19 @@ struct PageTreeStackItem {
     }
 };
 
+// digest of the raw data of a stream object, cached as fonts
+// and images are usually shared by many pages
+struct PdfStreamDigest {
+    int num = 0;
+    u8 digest[16] = {};
+};
+
+// an annotation of a supported type (see MakeAnnotationPdf)
+struct PdfAnnotEntry {
+    pdf_annot* annot = nullptr;
+    AnnotationType type = AnnotationType::Unknown;
+};
+
 class EnginePdf : public EngineBase {
   public:
     EnginePdf();
@@ -306,38 +437,51 @@ class EnginePdf : public EngineBase {
     RectF PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+    bool RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset) override;
 
     RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
     std::span<u8> GetFileData() override;
+    std::span<u8> BorrowFileData() override;
     bool SaveFileAs(const char* copyFileName, bool includeUserAnnots = false) override;
     bool SaveFileAsPdf(const char* pdfFileName, bool includeUserAnnots = false);
-    PageText ExtractPageText(int pageNo) override;
+    PageText ExtractPageText(int pageNo, AbortCookie** cookie_out = nullptr) override;
 
     bool HasClipOptimizations(int pageNo) override;
     WCHAR* GetProperty(DocumentProperty prop) override;
 
     bool BenchLoadPage(int pageNo) override;
+    void ReleaseCachedResources() override;
+    size_t GetMemoryUsage() override {
+        return (size_t)InterlockedAdd64(&fzMem.allocated, 0);
+    }
 
     Vec<IPageElement*>* GetElements(int pageNo) override;
     IPageElement* GetElementAtPos(int pageNo, PointF pt) override;
+    bool HasDeferredPageElements(int pageNo) override;
+    void LoadPageElements(int pageNo) override;
     RenderedBitmap* GetImageForPageElement(IPageElement*) override;
 
     PageDestination* GetNamedDest(const WCHAR* name) override;
+    bool HacToc() override;
     TocTree* GetToc() override;
 
     WCHAR* GetPageLabel(int pageNo) const override;
     int GetPageByLabel(const WCHAR* label) const override;
 
     int GetAnnotations(Vec<Annotation*>* annotsOut);
+    Vec<PdfAnnotEntry>* GetPageAnnots(int pageNo);
 
     static EngineBase* CreateFromFile(const WCHAR* path, PasswordUI* pwdUI);
     static EngineBase* CreateFromStream(IStream* stream, PasswordUI* pwdUI);
 
     // make sure to never ask for pagesAccess in an ctxAccess
     // protected critical section in order to avoid deadlocks
+    // ctxAccess serializes all access to _doc, which isn't thread safe
+    // (display lists can be rendered without it, see FzRenderDisplayLists)
     CRITICAL_SECTION* ctxAccess;
     CRITICAL_SECTION pagesAccess;
+    CRITICAL_SECTION docAccess;
 
     CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
 
@@ -345,12 +489,33 @@ class EnginePdf : public EngineBase {
 
     fz_context* ctx = nullptr;
     fz_locks_context fz_locks_ctx;
+    FzMemCounter fzMem;
     fz_document* _doc = nullptr;
     fz_stream* _docStream = nullptr;
     Vec<FzPageInfo*> _pages;
+    // pages with a cached display list, protected by ctxAccess
+    Vec<FzPageInfo*> runCache;
+    // pages with kept images (see FzGetPageImage), protected by ctxAccess
+    Vec<FzPageInfo*> imagesCache;
+    // digests of the streams hashed for page digests, sorted by object number
+    // and protected by ctxAccess
+    Vec<PdfStreamDigest> streamDigests;
+    // rendered content of pages with annotations, protected by ctxAccess
+    Vec<FzContentLayer> contentLayers;
+    // the annotations of each page, in drawing order (nullptr until requested), kept
+    // up to date as annotations are created and deleted, protected by ctxAccess
+    Vec<Vec<PdfAnnotEntry>*> pagesAnnots;
+    // cached result of ExtractFontList, protected by ctxAccess
+    bool hasFontList = false;
+    WCHAR* cachedFontList = nullptr;
+    // the outline is only loaded by GetToc, as that can take a while
+    bool hasOutline = false;
     fz_outline* outline = nullptr;
     fz_outline* attachments = nullptr;
     pdf_obj* _info = nullptr;
+    // labels are either formatted per range on demand or, if they might
+    // have to be made unique, all built up front
+    Vec<PageLabelRange> pageLabelRanges;
     WStrVec* _pageLabels = nullptr;
 
     TocTree* tocTree = nullptr;
@@ -364,12 +529,14 @@ class EnginePdf : public EngineBase {
 
     FzPageInfo* GetFzPageInfoFast(int pageNo);
     FzPageInfo* GetFzPageInfo(int pageNo, bool loadQuick);
+    void CalcPageDigest(FzPageInfo* pageInfo);
     fz_matrix viewctm(int pageNo, float zoom, int rotation);
     fz_matrix viewctm(fz_page* page, float zoom, int rotation);
     TocItem* BuildTocTree(TocItem* parent, fz_outline* outline, int& idCounter, bool isAttachment);
     WCHAR* ExtractFontList();
 
     std::span<u8> LoadStreamFromPDFFile(const WCHAR* filePath);
+    RenderedBitmap* LoadPageThumbnail(IStream* stream);
 };
 
 // https://github.com/sumatrapdfreader/sumatrapdf/issues/1336
@@ -414,12 +581,15 @@ EnginePdf::EnginePdf() {
         InitializeCriticalSection(&mutexes[i]);
     }
     InitializeCriticalSection(&pagesAccess);
-    ctxAccess = &mutexes[FZ_LOCK_ALLOC];
+    // not MuPDF's FZ_LOCK_ALLOC, as that would block all allocations
+    // (also of cloned contexts) while a thread is using the document
+    InitializeCriticalSection(&docAccess);
+    ctxAccess = &docAccess;
 
     fz_locks_ctx.user = this;
     fz_locks_ctx.lock = fz_lock_context_cs;
     fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(nullptr, &fz_locks_ctx, FZ_STORE_DEFAULT);
+    ctx = fz_new_context(&fzMem.alloc, &fz_locks_ctx, FzStoreSize());
     installFitzErrorCallbacks(ctx);
 
     pdf_install_load_system_font_funcs(ctx);
@@ -431,6 +601,9 @@ EnginePdf::~EnginePdf() {
     // TODO: remove this lock and see what happens
     EnterCriticalSection(ctxAccess);
 
+    FzFreeDisplayLists(ctx, runCache);
+    FzFreePageImages(ctx, imagesCache);
+    FzFreeContentLayers(ctx, contentLayers);
     for (auto* pi : _pages) {
         if (pi->links) {
             fz_drop_link(ctx, pi->links);
@@ -438,11 +611,11 @@ EnginePdf::~EnginePdf() {
         if (pi->page) {
             fz_drop_page(ctx, pi->page);
         }
-        DeleteVecMembers(pi->autoLinks);
-        DeleteVecMembers(pi->comments);
+        // autoLinks and comments are freed together with pi->arena
     }
 
     DeleteVecMembers(_pages);
+    DeleteVecMembers(pagesAnnots);
 
     fz_drop_outline(ctx, outline);
     fz_drop_outline(ctx, attachments);
@@ -453,12 +626,17 @@ EnginePdf::~EnginePdf() {
     fz_drop_context(ctx);
 
     delete _pageLabels;
+    free(cachedFontList);
+    for (auto& r : pageLabelRanges) {
+        free(r.prefix);
+    }
     delete tocTree;
 
     for (size_t i = 0; i < dimof(mutexes); i++) {
-        LeaveCriticalSection(&mutexes[i]);
         DeleteCriticalSection(&mutexes[i]);
     }
+    LeaveCriticalSection(ctxAccess);
+    DeleteCriticalSection(ctxAccess);
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
 }
@@ -585,6 +763,53 @@ std::span<u8> EnginePdf::LoadStreamFromPDFFile(const WCHAR* filePath) {
     return {data, dataSize};
 }
 
+RenderedBitmap* LoadEmbeddedPdfThumbnail(IStream* stream) {
+    EnginePdf* engine = new EnginePdf();
+    RenderedBitmap* res = engine->LoadPageThumbnail(stream);
+    delete engine;
+    return res;
+}
+
+// returns the first page's /Thumb image, which only requires
+// reading the xref table and the page object (no fonts, no outline)
+RenderedBitmap* EnginePdf::LoadPageThumbnail(IStream* stream) {
+    fz_stream* stm = nullptr;
+    fz_try(ctx) {
+        stm = fz_open_istream(ctx, stream);
+    }
+    fz_catch(ctx) {
+        return nullptr;
+    }
+    if (!LoadFromStream(stm, nullptr)) {
+        return nullptr;
+    }
+
+    pdf_document* doc = (pdf_document*)_doc;
+    RenderedBitmap* bmp = nullptr;
+    fz_image* image = nullptr;
+    fz_pixmap* pixmap = nullptr;
+    fz_var(bmp);
+    fz_var(image);
+    fz_var(pixmap);
+    fz_try(ctx) {
+        pdf_obj* pageObj = pdf_lookup_page_obj(ctx, doc, 0);
+        pdf_obj* thumb = pdf_dict_gets(ctx, pageObj, "Thumb");
+        if (pdf_is_stream(ctx, thumb)) {
+            image = pdf_load_image(ctx, doc, thumb);
+            pixmap = fz_get_pixmap_from_image(ctx, image, nullptr, nullptr, nullptr, nullptr);
+            bmp = new_rendered_fz_pixmap(ctx, pixmap);
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_pixmap(ctx, pixmap);
+        fz_drop_image(ctx, image);
+    }
+    fz_catch(ctx) {
+        bmp = nullptr;
+    }
+    return bmp;
+}
+
 bool EnginePdf::Load(const WCHAR* filePath, PasswordUI* pwdUI) {
     CrashIf(FileName() || _doc || !ctx);
     SetFileName(filePath);
@@ -764,6 +989,37 @@ static PageLayoutType GetPreferredLayout(fz_context* ctx, pdf_document* doc) {
     return layout;
 }
 
+// collects all page objects in document order with a single pass over the page tree
+// (pdf_lookup_page_obj walks the tree from its root for every page, which is
+// quadratic in the page count for the flat page trees many generators produce)
+static void CollectPageObjs(fz_context* ctx, pdf_obj* node, Vec<pdf_obj*>& pageObjs, int depth = 0) {
+    if (depth > 64 || pdf_mark_obj(ctx, node)) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "malformed page tree");
+    }
+    fz_try(ctx) {
+        pdf_obj* kids = pdf_dict_gets(ctx, node, "Kids");
+        int n = pdf_array_len(ctx, kids);
+        for (int i = 0; i < n; i++) {
+            pdf_obj* kid = pdf_array_get(ctx, kids, i);
+            // same distinction between Pages and Page nodes as in pdf_lookup_page_loc
+            pdf_obj* type = pdf_dict_gets(ctx, kid, "Type");
+            bool isPagesNode = type ? str::Eq(pdf_to_name(ctx, type), "Pages")
+                                    : pdf_dict_gets(ctx, kid, "Kids") && !pdf_dict_gets(ctx, kid, "MediaBox");
+            if (isPagesNode) {
+                CollectPageObjs(ctx, kid, pageObjs, depth + 1);
+            } else {
+                pageObjs.Append(kid);
+            }
+        }
+    }
+    fz_always(ctx) {
+        pdf_unmark_obj(ctx, node);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
 static bool IsLinearizedFile(EnginePdf* e) {
     ScopedCritSec scope(e->ctxAccess);
 
@@ -778,6 +1034,95 @@ static bool IsLinearizedFile(EnginePdf* e) {
     return isLinear;
 }
 
+// the mediaboxes of documents with many pages are cached on disk, as reading
+// them requires walking the whole page tree (which takes a while for e.g.
+// catalogs with tens of thousands of pages)
+#define PAGE_CACHE_DIR_NAME L"SumatraPDF-pdf-pages"
+#define PAGE_CACHE_MIN_PAGES 1000
+#define PAGE_CACHE_MAX_FILES 32
+// must be changed whenever the file format changes
+#define PAGE_CACHE_MAGIC 0x31435053 // 'SPC1'
+
+// followed by nPages mediaboxes (as x, y, dx, dy floats)
+struct PageCacheHeader {
+    u32 magic;
+    i32 nPages;
+};
+
+// cache files are named by a digest of the document's path, size and modification time,
+// so that the cache is ignored once the document has changed
+static WCHAR* GetPageCachePath(const WCHAR* filePath) {
+    if (!filePath || !file::Exists(filePath)) {
+        return nullptr;
+    }
+    AutoFreeWstr tempDir(path::GetTempPath(nullptr));
+    if (!tempDir) {
+        return nullptr;
+    }
+    AutoFree pathU(strconv::WstrToUtf8(filePath));
+    FILETIME ft = file::GetModificationTime(filePath);
+    str::Str key;
+    key.AppendFmt("%s|%lld|%u|%u", pathU.Get(), file::GetSize(pathU.AsView()), ft.dwHighDateTime,
+                  ft.dwLowDateTime);
+    u8 digest[20];
+    CalcSHA1Digest((const u8*)key.Get(), key.size(), digest);
+    AutoFree digestHex(_MemToHex(&digest));
+    AutoFreeWstr fileName(strconv::Utf8ToWstr(digestHex.Get()));
+    AutoFreeWstr cacheDir(path::Join(tempDir, PAGE_CACHE_DIR_NAME));
+    return path::Join(cacheDir, fileName);
+}
+
+// returns false if the cache doesn't contain pageCount mediaboxes
+static bool LoadCachedMediaboxes(const WCHAR* cachePath, int pageCount, Vec<RectF>& mediaboxes) {
+    AutoFree data = file::ReadFile(cachePath);
+    if (data.size() != sizeof(PageCacheHeader) + (size_t)pageCount * 4 * sizeof(float)) {
+        return false;
+    }
+    PageCacheHeader* hdr = (PageCacheHeader*)data.Get();
+    if (hdr->magic != PAGE_CACHE_MAGIC || hdr->nPages != pageCount) {
+        return false;
+    }
+    const float* f = (const float*)(data.Get() + sizeof(PageCacheHeader));
+    for (int i = 0; i < pageCount; i++, f += 4) {
+        mediaboxes.Append(RectF(f[0], f[1], f[2], f[3]));
+    }
+    return true;
+}
+
+static void SaveCachedMediaboxes(const WCHAR* cachePath, Vec<RectF>& mediaboxes) {
+    AutoFreeWstr cacheDir(path::GetDir(cachePath));
+    dir::Create(cacheDir);
+    // make room by removing the least recently written cache files
+    WStrVec files;
+    DirIter di(cacheDir);
+    for (const WCHAR* path = di.First(); path; path = di.Next()) {
+        files.Append(str::Dup(path));
+    }
+    while (files.size() >= PAGE_CACHE_MAX_FILES) {
+        size_t oldest = 0;
+        FILETIME oldestTime = file::GetModificationTime(files.at(0));
+        for (size_t i = 1; i < files.size(); i++) {
+            FILETIME ft = file::GetModificationTime(files.at(i));
+            if (CompareFileTime(&ft, &oldestTime) < 0) {
+                oldest = i;
+                oldestTime = ft;
+            }
+        }
+        file::Delete(files.at(oldest));
+        free(files.at(oldest));
+        files.RemoveAt(oldest);
+    }
+
+    PageCacheHeader hdr = {PAGE_CACHE_MAGIC, (i32)mediaboxes.size()};
+    str::Str data(sizeof(hdr) + mediaboxes.size() * 4 * sizeof(float));
+    data.Append((const char*)&hdr, sizeof(hdr));
+    for (RectF& r : mediaboxes) {
+        float f[4] = {r.x, r.y, r.dx, r.dy};
+        data.Append((const char*)f, sizeof(f));
+    }
+    file::WriteFile(cachePath, data.AsSpan());
+}
+
 bool EnginePdf::FinishLoading() {
     pageCount = 0;
     fz_try(ctx) {
@@ -800,41 +1145,61 @@ bool EnginePdf::FinishLoading() {
 
     ScopedCritSec scope(ctxAccess);
 
-    // this does the job of pdf_bound_page but without doing pdf_load_page()
-    // TODO: time pdf_load_page(), maybe it's not slow?
-    for (int i = 0; i < pageCount; i++) {
-        fz_rect mbox{};
-        fz_matrix page_ctm{};
-
+    Vec<RectF> mediaboxes;
+    AutoFreeWstr cachePath(pageCount >= PAGE_CACHE_MIN_PAGES ? GetPageCachePath(FileName()) : nullptr);
+    if (!cachePath || !LoadCachedMediaboxes(cachePath, pageCount, mediaboxes)) {
+        Vec<pdf_obj*> pageObjs;
         fz_try(ctx) {
-            pdf_obj* pageref = pdf_lookup_page_obj(ctx, doc, i);
-            pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
-            mbox = fz_transform_rect(mbox, page_ctm);
+            CollectPageObjs(ctx, pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/Pages"), pageObjs);
         }
         fz_catch(ctx) {
+            pageObjs.Reset();
         }
-        if (fz_is_empty_rect(mbox)) {
-            fz_warn(ctx, "cannot find page size for page %d", i);
-            mbox.x0 = 0;
-            mbox.y0 = 0;
-            mbox.x1 = 612;
-            mbox.y1 = 792;
+        // pdf_lookup_page_obj relies on the nodes' /Count values, so in case
+        // of inconsistencies, fall back to looking up every page individually
+        if (pageObjs.size() != (size_t)pageCount) {
+            pageObjs.Reset();
         }
+
+        // this does the job of pdf_bound_page but without doing pdf_load_page()
+        // TODO: time pdf_load_page(), maybe it's not slow?
+        for (int i = 0; i < pageCount; i++) {
+            fz_rect mbox{};
+            fz_matrix page_ctm{};
+
+            fz_try(ctx) {
+                pdf_obj* pageref = pageObjs.size() > 0 ? pageObjs.at(i) : pdf_lookup_page_obj(ctx, doc, i);
+                pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
+                mbox = fz_transform_rect(mbox, page_ctm);
+            }
+            fz_catch(ctx) {
+            }
+            if (fz_is_empty_rect(mbox)) {
+                fz_warn(ctx, "cannot find page size for page %d", i);
+                mbox.x0 = 0;
+                mbox.y0 = 0;
+                mbox.x1 = 612;
+                mbox.y1 = 792;
+            }
+            mediaboxes.Append(ToRectFl(mbox));
+        }
+        if (cachePath) {
+            SaveCachedMediaboxes(cachePath, mediaboxes);
+        }
+    }
+
+    for (int i = 0; i < pageCount; i++) {
         FzPageInfo* pageInfo = new FzPageInfo();
-        pageInfo->mediabox = ToRectFl(mbox);
+        pageInfo->mediabox = mediaboxes.at(i);
         pageInfo->pageNo = i + 1;
         _pages.Append(pageInfo);
     }
 
     fz_try(ctx) {
-        outline = fz_load_outline(ctx, _doc);
+        hasOutline = pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/Outlines/First") != nullptr;
     }
     fz_catch(ctx) {
-        // ignore errors from pdf_load_outline()
-        // this information is not critical and checking the
-        // error might prevent loading some pdfs that would
-        // otherwise get displayed
-        fz_warn(ctx, "Couldn't load outline");
+        fz_warn(ctx, "Couldn't check for an outline");
     }
 
     fz_try(ctx) {
@@ -895,14 +1260,14 @@ bool EnginePdf::FinishLoading() {
 
     fz_try(ctx) {
         pdf_obj* pageLabels = pdf_dict_getp(ctx, pdf_trailer(ctx, doc), "Root/PageLabels");
-        if (pageLabels) {
+        if (pageLabels && !BuildPageLabelRanges(ctx, pageLabels, PageCount(), pageLabelRanges)) {
             _pageLabels = BuildPageLabelVec(ctx, pageLabels, PageCount());
         }
     }
     fz_catch(ctx) {
         fz_warn(ctx, "Couldn't load page labels");
     }
-    if (_pageLabels) {
+    if (_pageLabels || pageLabelRanges.size() > 0) {
         hasPageLabels = true;
     }
 
@@ -983,11 +1348,29 @@ TocItem* EnginePdf::BuildTocTree(TocItem* parent, fz_outline* outline, int& idCo
     return root;
 }
 
-// TODO: maybe build in FinishDownload
+bool EnginePdf::HacToc() {
+    return tocTree || hasOutline || attachments;
+}
+
 TocTree* EnginePdf::GetToc() {
     if (tocTree) {
         return tocTree;
     }
+    if (hasOutline && !outline) {
+        ScopedCritSec scope(ctxAccess);
+        fz_try(ctx) {
+            outline = fz_load_outline(ctx, _doc);
+        }
+        fz_catch(ctx) {
+            // ignore errors from pdf_load_outline()
+            // this information is not critical and checking the
+            // error might prevent loading some pdfs that would
+            // otherwise get displayed
+            fz_warn(ctx, "Couldn't load outline");
+        }
+        // don't try again
+        hasOutline = outline != nullptr;
+    }
     if (outline == nullptr && attachments == nullptr) {
         return nullptr;
     }
@@ -1073,16 +1456,7 @@ FzPageInfo* EnginePdf::GetFzPageInfoFast(int pageNo) {
     return pageInfo;
 }
 
-static PageElement* newFzComment(const WCHAR* comment, int pageNo, RectF rect) {
-    auto res = new PageElement();
-    res->kind_ = kindPageElementComment;
-    res->pageNo = pageNo;
-    res->rect = rect;
-    res->value = str::Dup(comment);
-    return res;
-}
-
-static PageElement* makePdfCommentFromPdfAnnot(fz_context* ctx, int pageNo, pdf_annot* annot) {
+static PageElement* makePdfCommentFromPdfAnnot(fz_context* ctx, FzPageInfo* pageInfo, pdf_annot* annot) {
     fz_rect rect = pdf_annot_rect(ctx, annot);
     auto tp = pdf_annot_type(ctx, annot);
     const char* contents = pdf_annot_contents(ctx, annot);
@@ -1094,7 +1468,7 @@ static PageElement* makePdfCommentFromPdfAnnot(fz_context* ctx, int pageNo, pdf_
     }
     AutoFreeWstr ws = strconv::Utf8ToWstr(s);
     RectF rd = ToRectFl(rect);
-    return newFzComment(ws, pageNo, rd);
+    return NewArenaPageElement(pageInfo, kindPageElementComment, rd, ws);
 }
 
 static void MakePageElementCommentsFromAnnotations(fz_context* ctx, FzPageInfo* pageInfo) {
@@ -1128,15 +1502,9 @@ static void MakePageElementCommentsFromAnnotations(fz_context* ctx, FzPageInfo*
 
             dbglogf("attachement: %s\n", attname);
 
-            PageElement* el = new PageElement();
-            el->kind_ = kindPageElementDest;
-            el->pageNo = pageNo;
-            el->rect = ToRectFl(rect);
-            el->value = strconv::Utf8ToWstr(attname);
-            el->dest = new PageDestination();
-            el->dest->kind = kindDestinationLaunchEmbedded;
-            el->dest->value = strconv::Utf8ToWstr(attname);
-            el->dest->pageNo = pageNo;
+            AutoFreeWstr name = strconv::Utf8ToWstr(attname);
+            PageElement* el = NewArenaPageElement(pageInfo, kindPageElementDest, ToRectFl(rect), name);
+            el->dest = NewArenaPageDestination(pageInfo, kindDestinationLaunchEmbedded, pageNo, name);
             comments.Append(el);
             // TODO: need to implement https://github.com/sumatrapdfreader/sumatrapdf/issues/1336
             // for saving the attachment to a file
@@ -1145,14 +1513,14 @@ static void MakePageElementCommentsFromAnnotations(fz_context* ctx, FzPageInfo*
         }
 
         if (!isContentsEmpty && tp != PDF_ANNOT_FREE_TEXT) {
-            auto comment = makePdfCommentFromPdfAnnot(ctx, pageNo, annot);
+            auto comment = makePdfCommentFromPdfAnnot(ctx, pageInfo, annot);
             comments.Append(comment);
             continue;
         }
 
         if (PDF_ANNOT_WIDGET == tp && !isLabelEmpty) {
             if (!(flags & PDF_FIELD_IS_READ_ONLY)) {
-                auto comment = makePdfCommentFromPdfAnnot(ctx, pageNo, annot);
+                auto comment = makePdfCommentFromPdfAnnot(ctx, pageInfo, annot);
                 comments.Append(comment);
             }
         }
@@ -1167,12 +1535,16 @@ static void MakePageElementCommentsFromAnnotations(fz_context* ctx, FzPageInfo*
 // Maybe: when loading fully, cache extracted text in FzPageInfo
 // so that we don't have to re-do fz_new_stext_page_from_page() when doing search
 FzPageInfo* EnginePdf::GetFzPageInfo(int pageNo, bool loadQuick) {
+    TRACE_ZONE("EnginePdf::GetFzPageInfo");
     // TODO: minimize time spent under pagesAccess when fully loading
     ScopedCritSec scope(&pagesAccess);
 
     CrashIf(pageNo < 1 || pageNo > pageCount);
     int pageIdx = pageNo - 1;
     FzPageInfo* pageInfo = _pages[pageIdx];
+    if (pageInfo->page && (loadQuick || pageInfo->fullyLoaded)) {
+        return pageInfo;
+    }
 
     ScopedCritSec ctxScope(ctxAccess);
     if (!pageInfo->page) {
@@ -1181,6 +1553,8 @@ FzPageInfo* EnginePdf::GetFzPageInfo(int pageNo, bool loadQuick) {
         }
         fz_catch(ctx) {
         }
+        // the digest has to be computed while the file is still unmodified
+        CalcPageDigest(pageInfo);
     }
 
     fz_page* page = pageInfo->page;
@@ -1210,16 +1584,129 @@ FzPageInfo* EnginePdf::GetFzPageInfo(int pageNo, bool loadQuick) {
 
     pageInfo->links = FixupPageLinks(links);
     MakePageElementCommentsFromAnnotations(ctx, pageInfo);
-    if (!stext) {
-        return pageInfo;
+    if (stext) {
+        FzLinkifyPageText(pageInfo, stext);
+        fz_find_image_positions(ctx, pageInfo->images, stext);
+        fz_drop_stext_page(ctx, stext);
     }
-
-    FzLinkifyPageText(pageInfo, stext);
-    fz_find_image_positions(ctx, pageInfo->images, stext);
-    fz_drop_stext_page(ctx, stext);
+    FzBuildElementIndex(pageInfo);
     return pageInfo;
 }
 
+static void UpdateDigest(fz_md5* md5, char tag, const void* data, size_t len) {
+    fz_md5_update(md5, (const u8*)&tag, 1);
+    fz_md5_update(md5, (const u8*)&len, sizeof(len));
+    fz_md5_update(md5, (const u8*)data, len);
+}
+
+static void GetStreamDigest(fz_context* ctx, pdf_obj* obj, Vec<PdfStreamDigest>& streamDigests, u8 digest[16]) {
+    PdfStreamDigest sd;
+    sd.num = pdf_to_num(ctx, obj);
+    auto less = [](const PdfStreamDigest& a, const PdfStreamDigest& b) { return a.num < b.num; };
+    PdfStreamDigest* it = std::lower_bound(streamDigests.begin(), streamDigests.end(), sd, less);
+    if (it == streamDigests.end() || it->num != sd.num) {
+        fz_buffer* buf = pdf_load_raw_stream(ctx, obj);
+        fz_md5 md5;
+        fz_md5_init(&md5);
+        fz_md5_update(&md5, buf->data, buf->len);
+        fz_md5_final(&md5, sd.digest);
+        fz_drop_buffer(ctx, buf);
+        size_t idx = it - streamDigests.begin();
+        streamDigests.InsertAt(idx, sd);
+        it = &streamDigests.at(idx);
+    }
+    memcpy(digest, it->digest, sizeof(sd.digest));
+}
+
+// hashes obj and everything reachable from it (including the raw data of streams),
+// except for the parents of pages, annotations and form fields
+static void UpdatePdfObjDigest(fz_context* ctx, fz_md5* md5, pdf_obj* obj, Vec<pdf_obj*>& marked,
+                               Vec<PdfStreamDigest>& streamDigests, int depth) {
+    if (depth > 100) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "objects nested too deeply");
+    }
+    if (pdf_is_indirect(ctx, obj)) {
+        int num = pdf_to_num(ctx, obj);
+        if (pdf_mark_obj(ctx, obj)) {
+            // shared (or recursive) objects are only hashed once
+            UpdateDigest(md5, 'R', &num, sizeof(num));
+            return;
+        }
+        marked.Append(obj);
+        if (pdf_is_stream(ctx, obj)) {
+            u8 digest[16];
+            GetStreamDigest(ctx, obj, streamDigests, digest);
+            UpdateDigest(md5, 'S', digest, sizeof(digest));
+        }
+    }
+
+    if (pdf_is_array(ctx, obj)) {
+        int n = pdf_array_len(ctx, obj);
+        UpdateDigest(md5, '[', &n, sizeof(n));
+        for (int i = 0; i < n; i++) {
+            UpdatePdfObjDigest(ctx, md5, pdf_array_get(ctx, obj, i), marked, streamDigests, depth + 1);
+        }
+    } else if (pdf_is_dict(ctx, obj)) {
+        int n = pdf_dict_len(ctx, obj);
+        UpdateDigest(md5, '<', &n, sizeof(n));
+        for (int i = 0; i < n; i++) {
+            pdf_obj* key = pdf_dict_get_key(ctx, obj, i);
+            if (pdf_name_eq(ctx, key, PDF_NAME(Parent)) || pdf_name_eq(ctx, key, PDF_NAME(P))) {
+                continue;
+            }
+            UpdatePdfObjDigest(ctx, md5, key, marked, streamDigests, depth + 1);
+            UpdatePdfObjDigest(ctx, md5, pdf_dict_get_val(ctx, obj, i), marked, streamDigests, depth + 1);
+        }
+    } else if (pdf_is_name(ctx, obj)) {
+        const char* name = pdf_to_name(ctx, obj);
+        UpdateDigest(md5, '/', name, str::Len(name));
+    } else if (pdf_is_string(ctx, obj)) {
+        UpdateDigest(md5, '(', pdf_to_str_buf(ctx, obj), pdf_to_str_len(ctx, obj));
+    } else if (pdf_is_int(ctx, obj)) {
+        int64_t v = pdf_to_int64(ctx, obj);
+        UpdateDigest(md5, 'i', &v, sizeof(v));
+    } else if (pdf_is_real(ctx, obj)) {
+        float v = pdf_to_real(ctx, obj);
+        UpdateDigest(md5, 'f', &v, sizeof(v));
+    } else if (pdf_is_bool(ctx, obj)) {
+        int v = pdf_to_bool(ctx, obj);
+        UpdateDigest(md5, 'b', &v, sizeof(v));
+    } else {
+        UpdateDigest(md5, 'n', nullptr, 0);
+    }
+}
+
+// must be called while holding ctxAccess
+void EnginePdf::CalcPageDigest(FzPageInfo* pageInfo) {
+    pageInfo->hasDigest = false;
+    if (!pageInfo->page) {
+        return;
+    }
+    pdf_obj* pageObj = pdf_page_from_fz_page(ctx, pageInfo->page)->obj;
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    Vec<pdf_obj*> marked;
+    fz_try(ctx) {
+        UpdatePdfObjDigest(ctx, &md5, pageObj, marked, streamDigests, 0);
+        // attributes inherited from the page tree
+        pdf_obj* inherited[] = {PDF_NAME(Resources), PDF_NAME(MediaBox), PDF_NAME(CropBox), PDF_NAME(Rotate)};
+        for (pdf_obj* key : inherited) {
+            pdf_obj* val = pdf_dict_get_inheritable(ctx, pageObj, key);
+            UpdatePdfObjDigest(ctx, &md5, val, marked, streamDigests, 0);
+        }
+        pageInfo->hasDigest = true;
+    }
+    fz_always(ctx) {
+        for (pdf_obj* obj : marked) {
+            pdf_unmark_obj(ctx, obj);
+        }
+    }
+    fz_catch(ctx) {
+        pageInfo->hasDigest = false;
+    }
+    fz_md5_final(&md5, pageInfo->digest);
+}
+
 RectF EnginePdf::PageMediabox(int pageNo) {
     FzPageInfo* pi = _pages[pageNo - 1];
     return pi->mediabox;
@@ -1287,9 +1774,11 @@ RectF EnginePdf::Transform(const RectF& rect, int pageNo, float zoom, int rotati
 }
 
 RenderedBitmap* EnginePdf::RenderPage(RenderPageArgs& args) {
+    TRACE_ZONE("EnginePdf::RenderPage");
     auto pageNo = args.pageNo;
 
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
+    // links, comments and images are loaded afterwards (see LoadPageElements)
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
     if (!pageInfo || !pageInfo->page) {
         return nullptr;
     }
@@ -1304,64 +1793,177 @@ RenderedBitmap* EnginePdf::RenderPage(RenderPageArgs& args) {
         fzcookie = &cookie->cookie;
     }
 
-    // TODO(port): I don't see why this lock is needed
-    ScopedCritSec cs(ctxAccess);
+    // fz_run_display_list reports the size of the list through the cookie,
+    // so use one even if the caller doesn't want to abort rendering
+    fz_cookie localCookie = {};
+    fz_cookie* runCookie = fzcookie ? fzcookie : &localCookie;
 
-    auto pageRect = args.pageRect;
-    auto zoom = args.zoom;
-    auto rotation = args.rotation;
-    fz_rect pRect;
-    if (pageRect) {
-        pRect = To_fz_rect(*pageRect);
-    } else {
-        // TODO(port): use pageInfo->mediabox?
-        pRect = fz_bound_page(ctx, page);
-    }
-    fz_matrix ctm = viewctm(page, zoom, rotation);
-    fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
+    fz_display_list* list = nullptr;
+    fz_display_list* annotsList = nullptr;
+    fz_device* listDev = nullptr;
+    fz_device* annotsDev = nullptr;
+    bool canCacheList = false;
+    // pages with annotations keep their rendered content, so that after
+    // editing annotations only the annotations have to be rasterized again
+    fz_pixmap* contentLayer = nullptr;
+    bool wantContentLayer = false;
+    int errors = runCookie->errors;
 
-    fz_colorspace* colorspace = fz_device_rgb(ctx);
-    fz_irect ibounds = bbox;
-    fz_rect cliprect = fz_rect_from_irect(bbox);
+    fz_var(list);
+    fz_var(annotsList);
+    fz_var(listDev);
+    fz_var(annotsDev);
+    fz_var(canCacheList);
+    fz_var(contentLayer);
+
+    fz_matrix ctm;
+    fz_irect bbox;
+    {
+        // only interpreting the page needs the document
+        ScopedCritSec cs(ctxAccess);
+
+        fz_rect pRect;
+        if (args.pageRect) {
+            pRect = To_fz_rect(*args.pageRect);
+        } else {
+            // TODO(port): use pageInfo->mediabox?
+            pRect = fz_bound_page(ctx, page);
+        }
+        ctm = viewctm(page, args.zoom, args.rotation);
+        bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_pixmap* pix = nullptr;
-    fz_device* dev = nullptr;
-    RenderedBitmap* bitmap = nullptr;
+        fz_try(ctx) {
+            fz_rect bounds = fz_bound_page(ctx, page);
+            pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
+            if (args.target != RenderTarget::View) {
+                // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
+                // or "Print". "Export" is not used
+                const char* usage = args.target == RenderTarget::Print ? "Print" : "View";
+                list = fz_new_display_list(ctx, bounds);
+                listDev = fz_new_list_device(ctx, list);
+                pdf_run_page_with_usage(ctx, doc, pdfpage, listDev, fz_identity, usage, runCookie);
+                fz_close_device(ctx, listDev);
+            } else {
+                // page content is interpreted once into a display list which is then replayed
+                // for every zoom level and tile; annotations and form fields are always
+                // interpreted anew, as they can be modified
+                if (pdf_first_annot(ctx, pdfpage)) {
+                    contentLayer = FzGetContentLayer(ctx, contentLayers, pageNo, ctm, bbox);
+                    // a draft rendering isn't good enough for being reused
+                    wantContentLayer = !contentLayer && !args.isDraft;
+                }
+                if (!contentLayer) {
+                    list = FzGetCachedDisplayList(ctx, runCache, pageInfo);
+                }
+                if (!list && !contentLayer) {
+                    list = fz_new_display_list(ctx, bounds);
+                    listDev = fz_new_list_device(ctx, list);
+                    // forms repeated on many pages (letterheads, watermarks) are rasterized only once
+                    fz_enable_device_hints(ctx, listDev, FZ_CACHE_FORMS);
+                    pdf_run_page_contents(ctx, pdfpage, listDev, fz_identity, runCookie);
+                    fz_close_device(ctx, listDev);
+                    canCacheList = true;
+                }
+                annotsList = fz_new_display_list(ctx, bounds);
+                annotsDev = fz_new_list_device(ctx, annotsList);
+                pdf_run_page_annots(ctx, pdfpage, annotsDev, fz_identity, runCookie);
+                pdf_run_page_widgets(ctx, pdfpage, annotsDev, fz_identity, runCookie);
+                fz_close_device(ctx, annotsDev);
+            }
+        }
+        fz_always(ctx) {
+            fz_drop_device(ctx, listDev);
+            fz_drop_device(ctx, annotsDev);
+        }
+        fz_catch(ctx) {
+            fz_drop_display_list(ctx, list);
+            fz_drop_display_list(ctx, annotsList);
+            fz_drop_pixmap(ctx, contentLayer);
+            return nullptr;
+        }
+    }
 
-    fz_var(dev);
-    fz_var(pix);
-    fz_var(bitmap);
+    // rasterizing (including decoding images) is what takes the longest
+    // and happens concurrently for all threads rendering this document
+    fz_display_list* lists[] = {list, annotsList};
+    size_t listSize = 0;
+    fz_pixmap* newContentLayer = nullptr;
+    RenderedBitmap* bitmap = FzRenderDisplayLists(ctx, lists, (int)dimof(lists), ctm, bbox, runCookie, &listSize,
+                                                  contentLayer, wantContentLayer ? &newContentLayer : nullptr,
+                                                  args.isDraft);
 
-    const char* usage = "View";
-    switch (args.target) {
-        case RenderTarget::Print:
-            usage = "Print";
-            break;
+    ScopedCritSec cs(ctxAccess);
+    bool isComplete = bitmap && !runCookie->abort && !runCookie->incomplete && errors == runCookie->errors;
+    if (canCacheList && isComplete) {
+        FzCacheDisplayList(ctx, runCache, pageInfo, list, listSize);
+    }
+    if (newContentLayer && isComplete) {
+        FzCacheContentLayer(ctx, contentLayers, pageNo, ctm, newContentLayer);
     }
+    fz_drop_pixmap(ctx, newContentLayer);
+    fz_drop_pixmap(ctx, contentLayer);
+    fz_drop_display_list(ctx, list);
+    fz_drop_display_list(ctx, annotsList);
+    return bitmap;
+}
 
-    fz_try(ctx) {
-        pix = fz_new_pixmap_with_bbox(ctx, colorspace, ibounds, nullptr, 1);
-        // initialize with white background
-        fz_clear_pixmap_with_value(ctx, pix, 0xff);
-        // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
-        // or "Print". "Export" is not used
-        dev = fz_new_draw_device(ctx, fz_identity, pix);
-        pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
-        pdf_run_page_with_usage(ctx, doc, pdfpage, dev, ctm, usage, fzcookie);
-        bitmap = new_rendered_fz_pixmap(ctx, pix);
-        fz_close_device(ctx, dev);
+bool EnginePdf::RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset) {
+    FzPageInfo* pageInfo = GetFzPageInfo(args.pageNo, true);
+    if (!pageInfo || !pageInfo->page) {
+        return false;
     }
-    fz_always(ctx) {
-        if (dev) {
-            fz_drop_device(ctx, dev);
+    fz_page* page = pageInfo->page;
+    pdf_page* pdfpage = pdf_page_from_fz_page(ctx, page);
+
+    fz_cookie* fzcookie = nullptr;
+    if (args.cookie_out) {
+        FitzAbortCookie* cookie = new FitzAbortCookie();
+        *args.cookie_out = cookie;
+        fzcookie = &cookie->cookie;
+    }
+
+    fz_display_list* list = nullptr;
+    fz_device* listDev = nullptr;
+
+    fz_var(list);
+    fz_var(listDev);
+
+    fz_matrix ctm;
+    {
+        ScopedCritSec cs(ctxAccess);
+
+        fz_rect pRect = args.pageRect ? To_fz_rect(*args.pageRect) : fz_bound_page(ctx, page);
+        ctm = viewctm(page, args.zoom, args.rotation);
+        fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
+        // move the page to where RenderPage's bitmap would be drawn
+        ctm = fz_concat(ctm, fz_translate((float)(offset.x - bbox.x0), (float)(offset.y - bbox.y0)));
+
+        fz_try(ctx) {
+            pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
+            const char* usage = args.target == RenderTarget::Print ? "Print" : "View";
+            list = fz_new_display_list(ctx, fz_bound_page(ctx, page));
+            listDev = fz_new_list_device(ctx, list);
+            pdf_run_page_with_usage(ctx, doc, pdfpage, listDev, fz_identity, usage, fzcookie);
+            fz_close_device(ctx, listDev);
+        }
+        fz_always(ctx) {
+            fz_drop_device(ctx, listDev);
+        }
+        fz_catch(ctx) {
+            fz_drop_display_list(ctx, list);
+            return false;
         }
-        fz_drop_pixmap(ctx, pix);
     }
-    fz_catch(ctx) {
-        delete bitmap;
-        return nullptr;
+
+    // like rasterizing, drawing doesn't need the document
+    bool ok = !FzDisplayListNeedsRaster(ctx, list);
+    if (ok && hdc) {
+        ok = FzRunDisplayListOnDC(ctx, list, hdc, ctm, fzcookie);
     }
-    return bitmap;
+
+    ScopedCritSec cs(ctxAccess);
+    fz_drop_display_list(ctx, list);
+    return ok;
 }
 
 IPageElement* EnginePdf::GetElementAtPos(int pageNo, PointF pt) {
@@ -1380,6 +1982,19 @@ Vec<IPageElement*>* EnginePdf::GetElements(int pageNo) {
     return res;
 }
 
+// reading fullyLoaded without pagesAccess is fine, as it's only ever set
+// (at worst, LoadPageElements will be called once too often)
+bool EnginePdf::HasDeferredPageElements(int pageNo) {
+    CrashIf(pageNo < 1 || pageNo > pageCount);
+    return !_pages[pageNo - 1]->fullyLoaded;
+}
+
+// extracting text for links and image positions takes about as long as
+// rendering a page, so RenderPage leaves it to RenderCache to call this later
+void EnginePdf::LoadPageElements(int pageNo) {
+    GetFzPageInfo(pageNo, false);
+}
+
 RenderedBitmap* EnginePdf::GetImageForPageElement(IPageElement* ipel) {
     PageElement* pel = (PageElement*)ipel;
     auto r = pel->rect;
@@ -1396,6 +2011,15 @@ bool EnginePdf::BenchLoadPage(int pageNo) {
     return GetFzPageInfo(pageNo, false) != nullptr;
 }
 
+void EnginePdf::ReleaseCachedResources() {
+    ScopedCritSec scope(ctxAccess);
+    // cached display lists keep images and fonts alive
+    FzFreeDisplayLists(ctx, runCache);
+    FzFreePageImages(ctx, imagesCache);
+    FzFreeContentLayers(ctx, contentLayers);
+    fz_empty_store(ctx);
+}
+
 fz_matrix EnginePdf::viewctm(int pageNo, float zoom, int rotation) {
     const fz_rect tmpRc = To_fz_rect(PageMediabox(pageNo));
     return fz_create_view_ctm(tmpRc, zoom, rotation);
@@ -1422,8 +2046,8 @@ RenderedBitmap* EnginePdf::GetPageImage(int pageNo, RectF rect, int imageIdx) {
 
     ScopedCritSec scope(ctxAccess);
 
-    fz_image* image = fz_find_image_at_idx(ctx, pageInfo, imageIdx);
-    CrashIf(!image);
+    // owned by imagesCache
+    fz_image* image = FzGetPageImage(ctx, imagesCache, pageInfo, imageIdx);
     if (!image) {
         return nullptr;
     }
@@ -1448,39 +2072,34 @@ RenderedBitmap* EnginePdf::GetPageImage(int pageNo, RectF rect, int imageIdx) {
     return bmp;
 }
 
-PageText EnginePdf::ExtractPageText(int pageNo) {
+PageText EnginePdf::ExtractPageText(int pageNo, AbortCookie** cookie_out) {
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
-    if (!pageInfo) {
+    if (!pageInfo || !pageInfo->page) {
         return {};
     }
 
     ScopedCritSec scope(ctxAccess);
-
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
     fz_stext_options opts{};
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
-    }
-    fz_catch(ctx) {
-    }
-    if (!stext) {
-        return {};
+    return FzExtractPageText(ctx, pageInfo->page, &opts, cookie_out);
+}
+
+// returns false if obj was already in visited (which is kept sorted)
+static bool MarkVisited(Vec<pdf_obj*>& visited, pdf_obj* obj) {
+    pdf_obj** end = visited.end();
+    pdf_obj** pos = std::lower_bound(visited.begin(), end, obj);
+    if (pos != end && *pos == obj) {
+        return false;
     }
-    PageText res;
-    // TODO: convert to return PageText
-    WCHAR* text = fz_text_page_to_str(stext, &res.coords);
-    fz_drop_stext_page(ctx, stext);
-    res.text = text;
-    res.len = (int)str::Len(text);
-    return res;
+    visited.InsertAt(pos - visited.begin(), obj);
+    return true;
 }
 
+// resources shared by pages and XObjects are only walked once (instead of
+// pdf_mark_obj, as the document is used by other threads between pages)
 static void pdf_extract_fonts(fz_context* ctx, pdf_obj* res, Vec<pdf_obj*>& fontList, Vec<pdf_obj*>& resList) {
-    if (!res || pdf_mark_obj(ctx, res)) {
+    if (!res || !MarkVisited(resList, res)) {
         return;
     }
-    resList.Append(res);
 
     pdf_obj* fonts = pdf_dict_gets(ctx, res, "Font");
     for (int k = 0; k < pdf_dict_len(ctx, fonts); k++) {
@@ -1498,49 +2117,56 @@ static void pdf_extract_fonts(fz_context* ctx, pdf_obj* res, Vec<pdf_obj*>& font
     }
 }
 
+// extracts the fonts of the resources of an annotation's normal appearance
+// (which is either a stream or a dictionary of streams, one per state)
+static void pdf_extract_annot_fonts(fz_context* ctx, pdf_obj* annot, Vec<pdf_obj*>& fontList,
+                                    Vec<pdf_obj*>& resList) {
+    pdf_obj* ap = pdf_dict_getp(ctx, annot, "AP/N");
+    if (pdf_is_stream(ctx, ap)) {
+        pdf_extract_fonts(ctx, pdf_xobject_resources(ctx, ap), fontList, resList);
+        return;
+    }
+    for (int k = 0; k < pdf_dict_len(ctx, ap); k++) {
+        pdf_obj* state = pdf_dict_get_val(ctx, ap, k);
+        if (pdf_is_stream(ctx, state)) {
+            pdf_extract_fonts(ctx, pdf_xobject_resources(ctx, state), fontList, resList);
+        }
+    }
+}
+
 WCHAR* EnginePdf::ExtractFontList() {
+    {
+        ScopedCritSec scope(ctxAccess);
+        if (hasFontList) {
+            return str::Dup(cachedFontList);
+        }
+    }
+
     Vec<pdf_obj*> fontList;
     Vec<pdf_obj*> resList;
 
-    // collect all fonts from all page objects
+    // collect all fonts from all page objects (without loading the pages, as only their
+    // resources are needed, which are only walked once if they're shared between pages)
+    pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
     int nPages = PageCount();
     for (int i = 1; i <= nPages; i++) {
-        auto pageInfo = GetFzPageInfo(i, false);
-        if (!pageInfo) {
-            continue;
-        }
-        fz_page* fzpage = pageInfo->page;
-        if (!fzpage) {
-            continue;
-        }
-
+        // don't block rendering for longer than a page at a time
         ScopedCritSec scope(ctxAccess);
-        pdf_page* page = pdf_page_from_fz_page(ctx, fzpage);
         fz_try(ctx) {
-            pdf_obj* resources = pdf_page_resources(ctx, page);
+            pdf_obj* pageObj = pdf_lookup_page_obj(ctx, doc, i - 1);
+            pdf_obj* resources = pdf_dict_get_inheritable(ctx, pageObj, PDF_NAME(Resources));
             pdf_extract_fonts(ctx, resources, fontList, resList);
-            pdf_annot* annot;
-            for (annot = pdf_first_annot(ctx, page); annot; annot = pdf_next_annot(ctx, annot)) {
-                if (annot->ap) {
-                    pdf_obj* o = annot->ap;
-                    // TODO(port): not sure this is the right thing
-                    resources = pdf_xobject_resources(ctx, o);
-                    pdf_extract_fonts(ctx, resources, fontList, resList);
-                }
+            pdf_obj* annots = pdf_dict_get(ctx, pageObj, PDF_NAME(Annots));
+            for (int k = 0; k < pdf_array_len(ctx, annots); k++) {
+                pdf_extract_annot_fonts(ctx, pdf_array_get(ctx, annots, k), fontList, resList);
             }
         }
         fz_catch(ctx) {
         }
     }
 
-    // start ctxAccess scope here so that we don't also have to
-    // ask for pagesAccess (as is required for GetFzPage)
     ScopedCritSec scope(ctxAccess);
 
-    for (pdf_obj* res : resList) {
-        pdf_unmark_obj(ctx, res);
-    }
-
     WStrVec fonts;
     for (size_t i = 0; i < fontList.size(); i++) {
         const char *name = nullptr, *type = nullptr, *encoding = nullptr;
@@ -1625,12 +2251,17 @@ WCHAR* EnginePdf::ExtractFontList() {
             fonts.Append(fontInfo.StealData());
         }
     }
-    if (fonts.size() == 0) {
-        return nullptr;
+    WCHAR* res = nullptr;
+    if (fonts.size() > 0) {
+        fonts.SortNatural();
+        res = fonts.Join(L"\n");
     }
-
-    fonts.SortNatural();
-    return fonts.Join(L"\n");
+    // walking the resources of all pages can take a while, so this is only done once
+    if (!hasFontList) {
+        cachedFontList = str::Dup(res);
+        hasFontList = true;
+    }
+    return res;
 }
 
 WCHAR* EnginePdf::GetProperty(DocumentProperty prop) {
@@ -1740,23 +2371,41 @@ std::span<u8> EnginePdf::GetFileData() {
     return file::ReadFile(path);
 }
 
+// the data of buffers and mapped files doesn't move while the document is open
+std::span<u8> EnginePdf::BorrowFileData() {
+    std::span<u8> mapped;
+    ScopedCritSec scope(ctxAccess);
+
+    pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
+
+    fz_var(mapped);
+    fz_try(ctx) {
+        mapped = fz_stream_mapped_data(ctx, doc->file);
+    }
+    fz_catch(ctx) {
+        mapped = {};
+    }
+    return mapped;
+}
+
 // TODO: proper support for includeUserAnnots or maybe just remove it
 bool EnginePdf::SaveFileAs(const char* copyFileName, bool includeUserAnnots) {
     AutoFreeWstr dstPath = strconv::Utf8ToWstr(copyFileName);
-    AutoFree d = GetFileData();
-    if (!d.empty()) {
-        bool ok = file::WriteFile(dstPath, d.AsSpan());
-        return ok;
+    // write mapped files straight from the mapping instead of copying them first
+    auto mapped = BorrowFileData();
+    if (!mapped.empty()) {
+        return file::WriteFile(dstPath, mapped);
     }
+    // stream the file to the destination instead of loading it into memory
     auto path = FileName();
-    if (!path) {
-        return false;
+    if (path && file::Exists(path)) {
+        return file::Copy(path, dstPath, nullptr);
     }
-    bool ok = CopyFileW(path, dstPath, FALSE);
-    if (!ok) {
+    AutoFree d = GetFileData();
+    if (d.empty()) {
         return false;
     }
-    return true;
+    return file::WriteFile(dstPath, d.AsSpan());
 }
 
 const pdf_write_options pdf_default_write_options2 = {
@@ -1782,6 +2431,10 @@ const pdf_write_options pdf_default_write_options2 = {
 // this is used after the PDF was modified by the user (e.g. by adding / changing
 // annotations).
 // if filePath is not given, we save under the same name
+// changes are appended to the file as an incremental update, so that saving takes
+// time proportional to the changed objects and not to the size of the file (when
+// saving under a new name, the original data is copied there first). Documents that
+// can't be updated incrementally (e.g. repaired or redacted ones) are written in full.
 // TODO: if the file is locked, this might fail.
 bool EnginePdfSaveUpdated(EngineBase* engine, std::string_view path) {
     CrashIf(!engine);
@@ -1793,29 +2446,53 @@ bool EnginePdfSaveUpdated(EngineBase* engine, std::string_view path) {
     if (path.empty()) {
         path = {currPath.Get()};
     }
+    AutoFreeWstr dstPath = strconv::Utf8ToWstr(path);
+    bool isSameFile = str::Eq(path.data(), currPath.Get()) || path::IsSame(engine->FileName(), dstPath);
+
     fz_context* ctx = enginePdf->ctx;
+    ScopedCritSec scope(enginePdf->ctxAccess);
     pdf_document* doc = pdf_document_from_fz_document(ctx, enginePdf->_doc);
 
     pdf_write_options save_opts;
     save_opts = pdf_default_write_options2;
-    save_opts.do_incremental = 1;
+    save_opts.do_incremental = doc->file && pdf_can_be_saved_incrementally(ctx, doc);
     save_opts.do_compress = 1;
     save_opts.do_compress_images = 1;
     save_opts.do_compress_fonts = 1;
-    if (doc->redacted) {
+    if (save_opts.do_incremental && !isSameFile) {
+        // the incremental update refers to the original data by offset
+        save_opts.do_incremental = enginePdf->SaveFileAs(path.data());
+    }
+    if (!save_opts.do_incremental && doc->redacted) {
         save_opts.do_garbage = 1;
     }
 
+    // a full write can't overwrite the file it's still reading from
+    AutoFree tmpPath;
+    const char* savePath = path.data();
+    if (!save_opts.do_incremental && isSameFile) {
+        tmpPath.Set(str::Join(path.data(), ".tmp"));
+        savePath = tmpPath.Get();
+    }
+
     bool ok = true;
     fz_try(ctx) {
-        pdf_save_document(ctx, doc, path.data(), &save_opts);
+        pdf_save_document(ctx, doc, savePath, &save_opts);
     }
     fz_catch(ctx) {
         const char* errMsg = fz_caught_message(enginePdf->ctx);
-        logf("Pdf save of '%s' failed with '%s'\n", path.data(), errMsg);
+        logf("Pdf save of '%s' failed with '%s'\n", savePath, errMsg);
         // TODO: show error message
         ok = false;
     }
+    if (tmpPath.Get()) {
+        AutoFreeWstr tmpPathW = strconv::Utf8ToWstr(tmpPath.Get());
+        // only works if the file isn't mapped (i.e. if it has been loaded into memory)
+        ok = ok && MoveFileExW(tmpPathW, dstPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+        if (!ok) {
+            file::Delete(tmpPathW);
+        }
+    }
     return ok;
 }
 
@@ -1860,17 +2537,41 @@ bool EnginePdf::HasClipOptimizations(int pageNo) {
 }
 
 WCHAR* EnginePdf::GetPageLabel(int pageNo) const {
-    if (!_pageLabels || pageNo < 1 || PageCount() < pageNo) {
+    if (pageNo < 1 || PageCount() < pageNo) {
+        return EngineBase::GetPageLabel(pageNo);
+    }
+    if (_pageLabels) {
+        return str::Dup(_pageLabels->at(pageNo - 1));
+    }
+    if (pageLabelRanges.size() == 0) {
         return EngineBase::GetPageLabel(pageNo);
     }
 
-    return str::Dup(_pageLabels->at(pageNo - 1));
+    // find the last range starting at or before pageNo
+    size_t lo = 0, hi = pageLabelRanges.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (pageLabelRanges.at(mid).startAt <= pageNo) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    const PageLabelRange& r = pageLabelRanges.at(lo);
+    return FormatPageLabel(r.type, r.countFrom + pageNo - r.startAt, r.prefix);
 }
 
 int EnginePdf::GetPageByLabel(const WCHAR* label) const {
     int pageNo = 0;
     if (_pageLabels) {
         pageNo = _pageLabels->Find(label) + 1;
+    } else if (pageLabelRanges.size() > 0) {
+        for (int i = 1; i <= PageCount() && !pageNo; i++) {
+            AutoFreeWstr pageLabel = GetPageLabel(i);
+            if (str::Eq(pageLabel, label)) {
+                pageNo = i;
+            }
+        }
     }
 
     if (!pageNo) {
@@ -1881,22 +2582,77 @@ int EnginePdf::GetPageByLabel(const WCHAR* label) const {
 }
 
 // in Annotation.cpp
-extern Annotation* MakeAnnotationPdf(CRITICAL_SECTION* ctxAccess, fz_context* ctx, pdf_page* page, pdf_annot* annot,
-                                     int pageNo);
+extern Annotation* MakeAnnotationPdf(EngineBase* engine, CRITICAL_SECTION* ctxAccess, fz_context* ctx,
+                                     pdf_page* page, pdf_annot* annot, int pageNo);
+
+// only pages listing annotations have to be loaded for finding them
+static bool PageMightHaveAnnots(fz_context* ctx, pdf_document* doc, int pageNo) {
+    bool hasAnnots = true;
+    fz_try(ctx) {
+        pdf_obj* pageObj = pdf_lookup_page_obj(ctx, doc, pageNo - 1);
+        hasAnnots = pdf_array_len(ctx, pdf_dict_get(ctx, pageObj, PDF_NAME(Annots))) > 0;
+    }
+    fz_catch(ctx) {
+    }
+    return hasAnnots;
+}
+
+// returns nullptr if the page can't be loaded
+// (the returned list must only be accessed with ctxAccess locked)
+Vec<PdfAnnotEntry>* EnginePdf::GetPageAnnots(int pageNo) {
+    {
+        ScopedCritSec scope(ctxAccess);
+        if (pagesAnnots.size() == 0) {
+            pagesAnnots.AppendBlanks(pageCount);
+        }
+        Vec<PdfAnnotEntry>* annots = pagesAnnots.at(pageNo - 1);
+        if (annots) {
+            return annots;
+        }
+        // created annotations are added to the index, so pages which
+        // aren't loaded yet can only have annotations listed in the file
+        pdf_document* doc = pdf_document_from_fz_document(ctx, _doc);
+        if (!_pages[pageNo - 1]->page && !PageMightHaveAnnots(ctx, doc, pageNo)) {
+            annots = new Vec<PdfAnnotEntry>();
+            pagesAnnots.at(pageNo - 1) = annots;
+            return annots;
+        }
+    }
+
+    // GetFzPageInfo locks pagesAccess, which mustn't be done with ctxAccess locked
+    FzPageInfo* pi = GetFzPageInfo(pageNo, true);
+    if (!pi) {
+        return nullptr;
+    }
+    ScopedCritSec scope(ctxAccess);
+    Vec<PdfAnnotEntry>* annots = pagesAnnots.at(pageNo - 1);
+    if (annots) {
+        return annots;
+    }
+    annots = new Vec<PdfAnnotEntry>();
+    pdf_page* pdfpage = pdf_page_from_fz_page(ctx, pi->page);
+    for (pdf_annot* annot = pdf_first_annot(ctx, pdfpage); annot; annot = pdf_next_annot(ctx, annot)) {
+        AnnotationType type = AnnotationTypeFromPdfAnnot(pdf_annot_type(ctx, annot));
+        if (type != AnnotationType::Unknown) {
+            annots->Append({annot, type});
+        }
+    }
+    pagesAnnots.at(pageNo - 1) = annots;
+    return annots;
+}
 
 int EnginePdf::GetAnnotations(Vec<Annotation*>* annotsOut) {
     int nAnnots = 0;
     for (int i = 1; i <= pageCount; i++) {
-        auto pi = GetFzPageInfo(i, true);
-        pdf_page* pdfpage = pdf_page_from_fz_page(ctx, pi->page);
-        pdf_annot* annot = pdf_first_annot(ctx, pdfpage);
-        while (annot) {
-            Annotation* a = MakeAnnotationPdf(ctxAccess, ctx, pdfpage, annot, i);
-            if (a) {
-                annotsOut->Append(a);
-                nAnnots++;
-            }
-            annot = pdf_next_annot(ctx, annot);
+        Vec<PdfAnnotEntry>* annots = GetPageAnnots(i);
+        if (!annots || annots->size() == 0) {
+            continue;
+        }
+        ScopedCritSec scope(ctxAccess);
+        pdf_page* pdfpage = pdf_page_from_fz_page(ctx, _pages[i - 1]->page);
+        for (PdfAnnotEntry& e : *annots) {
+            annotsOut->Append(MakeAnnotationPdf(this, ctxAccess, ctx, pdfpage, e.annot, i));
+            nAnnots++;
         }
     }
     return nAnnots;
@@ -1951,6 +2707,8 @@ Annotation* EnginePdfCreateAnnotation(EngineBase* engine, AnnotationType typ, in
     fz_context* ctx = epdf->ctx;
 
     auto pageInfo = epdf->GetFzPageInfo(pageNo, true);
+    // index the page's existing annotations before adding the new one
+    Vec<PdfAnnotEntry>* pageAnnots = epdf->GetPageAnnots(pageNo);
 
     ScopedCritSec cs(epdf->ctxAccess);
 
@@ -1992,7 +2750,11 @@ Annotation* EnginePdfCreateAnnotation(EngineBase* engine, AnnotationType typ, in
     }
 
     pdf_update_appearance(ctx, annot);
-    auto res = MakeAnnotationPdf(epdf->ctxAccess, ctx, page, annot, pageNo);
+    // new annotations are drawn last
+    if (pageAnnots) {
+        pageAnnots->Append({annot, typ});
+    }
+    auto res = MakeAnnotationPdf(engine, epdf->ctxAccess, ctx, page, annot, pageNo);
     return res;
 }
 
@@ -2011,6 +2773,22 @@ bool EnginePdfHasUnsavedAnnotations(EngineBase* engine) {
     return pdfdoc->dirty;
 }
 
+// only available for pages that have been loaded (e.g. rendered or
+// searched) or, if compute is true, that can be loaded now
+bool EnginePdfGetPageDigest(EngineBase* engine, int pageNo, u8 digest[16], bool compute) {
+    if (!engine || engine->kind != kindEnginePdf || pageNo < 1 || pageNo > engine->PageCount()) {
+        return false;
+    }
+    EnginePdf* epdf = (EnginePdf*)engine;
+    FzPageInfo* pageInfo = compute ? epdf->GetFzPageInfo(pageNo, true) : epdf->_pages[pageNo - 1];
+    ScopedCritSec scope(&epdf->pagesAccess);
+    if (!pageInfo || !pageInfo->hasDigest) {
+        return false;
+    }
+    memcpy(digest, pageInfo->digest, sizeof(pageInfo->digest));
+    return true;
+}
+
 static bool IsAllowedAnnot(AnnotationType tp, AnnotationType* allowed) {
     if (!allowed) {
         return true;
@@ -2031,31 +2809,44 @@ Annotation* EnginePdfGetAnnotationAtPos(EngineBase* engine, int pageNo, PointF p
         return nullptr;
     }
     EnginePdf* epdf = (EnginePdf*)engine;
-    FzPageInfo* pi = epdf->GetFzPageInfo(pageNo, true);
+    Vec<PdfAnnotEntry>* annots = epdf->GetPageAnnots(pageNo);
+    if (!annots) {
+        return nullptr;
+    }
 
     ScopedCritSec cs(epdf->ctxAccess);
-
-    pdf_page* pdfpage = pdf_page_from_fz_page(epdf->ctx, pi->page);
-    pdf_annot* annot = pdf_first_annot(epdf->ctx, pdfpage);
     fz_point p{pos.x, pos.y};
 
     // find last annotation that contains this point
     // they are drawn in order so later annotations
     // are drawn on top of earlier
-    pdf_annot* matched = nullptr;
-    while (annot) {
-        enum pdf_annot_type tp = pdf_annot_type(epdf->ctx, annot);
-        AnnotationType atp = AnnotationTypeFromPdfAnnot(tp);
-        if (IsAllowedAnnot(atp, allowedAnnots)) {
-            fz_rect rc = pdf_annot_rect(epdf->ctx, annot);
-            if (fz_is_point_inside_rect(p, rc)) {
-                matched = annot;
-            }
+    for (int i = annots->isize() - 1; i >= 0; i--) {
+        PdfAnnotEntry& e = annots->at(i);
+        if (!IsAllowedAnnot(e.type, allowedAnnots)) {
+            continue;
+        }
+        fz_rect rc = pdf_annot_rect(epdf->ctx, e.annot);
+        if (fz_is_point_inside_rect(p, rc)) {
+            pdf_page* pdfpage = pdf_page_from_fz_page(epdf->ctx, epdf->_pages[pageNo - 1]->page);
+            return MakeAnnotationPdf(engine, epdf->ctxAccess, epdf->ctx, pdfpage, e.annot, pageNo);
         }
-        annot = pdf_next_annot(epdf->ctx, annot);
-    }
-    if (matched) {
-        return MakeAnnotationPdf(epdf->ctxAccess, epdf->ctx, pdfpage, matched, pageNo);
     }
     return nullptr;
 }
+
+// must be called before the annotation is deleted from its page
+void EnginePdfAnnotationDeleted(EngineBase* engine, int pageNo, pdf_annot* annot) {
+    CrashIf(engine->kind != kindEnginePdf);
+    EnginePdf* epdf = (EnginePdf*)engine;
+    ScopedCritSec cs(epdf->ctxAccess);
+    if (epdf->pagesAnnots.size() == 0 || !epdf->pagesAnnots.at(pageNo - 1)) {
+        return;
+    }
+    Vec<PdfAnnotEntry>* annots = epdf->pagesAnnots.at(pageNo - 1);
+    for (int i = 0; i < annots->isize(); i++) {
+        if (annots->at(i).annot == annot) {
+            annots->RemoveAt(i);
+            return;
+        }
+    }
+}
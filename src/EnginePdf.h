@@ -6,9 +6,11 @@ EngineBase* CreateEnginePdfFromFile(const WCHAR* path, PasswordUI* pwdUI = nullp
 EngineBase* CreateEnginePdfFromStream(IStream* stream, PasswordUI* pwdUI = nullptr);
 
 std::span<u8> LoadEmbeddedPDFFile(const WCHAR* path);
+RenderedBitmap* LoadEmbeddedPdfThumbnail(IStream* stream);
 const WCHAR* ParseEmbeddedStreamNumber(const WCHAR* path, int* streamNoOut);
 Annotation* EnginePdfCreateAnnotation(EngineBase* engine, AnnotationType type, int pageNo, PointF pos);
 int EnginePdfGetAnnotations(EngineBase*, Vec<Annotation*>*);
 bool EnginePdfHasUnsavedAnnotations(EngineBase* engine);
+bool EnginePdfGetPageDigest(EngineBase* engine, int pageNo, u8 digest[16], bool compute);
 bool EnginePdfSaveUpdated(EngineBase* engine, std::string_view path);
 Annotation* EnginePdfGetAnnotationAtPos(EngineBase* engine, int pageNo, PointF pos, AnnotationType* allowedAnnots);
@@ -5,6 +5,7 @@
 #include <zlib.h>
 #include "utils/ByteReader.h"
 #include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/WinUtil.h"
@@ -19,6 +20,12 @@
 
 Kind kindEnginePostScript = "enginePostScript";
 
+// PDF files converted by Ghostscript are kept in this directory (under %TEMP%)
+// so that reopening the same PostScript file doesn't have to convert it again
+#define PS_CACHE_DIR_NAME L"SumatraPDF-ps2pdf"
+// total size of the cached PDF files, above which the least recently used are removed
+#define PS_CACHE_MAX_SIZE (512 * 1024 * 1024)
+
 static WCHAR* GetGhostscriptPath() {
     const WCHAR* gsProducts[] = {
         L"AFPL Ghostscript",
@@ -132,6 +139,88 @@ static Rect ExtractDSCPageSize(const WCHAR* path) {
     return {};
 }
 
+static WCHAR* GetPsCacheDir() {
+    AutoFreeWstr tempDir(path::GetTempPath(nullptr));
+    if (!tempDir) {
+        return nullptr;
+    }
+    AutoFreeWstr cacheDir(path::Join(tempDir, PS_CACHE_DIR_NAME));
+    if (!dir::Create(cacheDir)) {
+        return nullptr;
+    }
+    return cacheDir.StealData();
+}
+
+// the conversion result depends on the file's content, the Ghostscript
+// installation and the command line (which includes the page size setup)
+static WCHAR* GetPsCachePath(const WCHAR* cacheDir, const WCHAR* path, const WCHAR* gswin32c, const WCHAR* psSetup) {
+    AutoFree data = file::ReadFile(path);
+    if (data.empty()) {
+        return nullptr;
+    }
+    u8 digest[20];
+    CalcSHA1Digest((const u8*)data.data, data.size(), digest);
+    AutoFreeWstr cmdKey(str::Format(L"%s|%s", gswin32c, psSetup));
+    AutoFree cmdKeyU(strconv::WstrToUtf8(cmdKey));
+    str::Str key;
+    key.Append((const char*)digest, sizeof(digest));
+    key.Append(cmdKeyU.Get());
+    CalcSHA1Digest((const u8*)key.Get(), key.size(), digest);
+    AutoFree fingerPrint(_MemToHex(&digest));
+    AutoFreeWstr fname(strconv::FromAnsi(fingerPrint));
+    return str::Format(L"%s\\%s.pdf", cacheDir, fname.Get());
+}
+
+struct PsCacheFile {
+    WCHAR* name;
+    i64 size;
+    FILETIME lastUsed;
+};
+
+// removes the least recently used conversion results until the cache
+// is within PS_CACHE_MAX_SIZE (files in use can't be removed and are skipped)
+static void CleanUpPsCache(const WCHAR* cacheDir) {
+    AutoFreeWstr pattern(path::Join(cacheDir, L"*.pdf"));
+    Vec<PsCacheFile> files;
+    i64 totalSize = 0;
+
+    WIN32_FIND_DATA fdata;
+    HANDLE hfind = FindFirstFile(pattern, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            i64 size = ((i64)fdata.nFileSizeHigh << 32) | fdata.nFileSizeLow;
+            files.Append({str::Dup(fdata.cFileName), size, fdata.ftLastWriteTime});
+            totalSize += size;
+        }
+    } while (FindNextFile(hfind, &fdata));
+    FindClose(hfind);
+
+    std::sort(files.begin(), files.end(), [](const PsCacheFile& f1, const PsCacheFile& f2) {
+        return CompareFileTime(&f1.lastUsed, &f2.lastUsed) < 0;
+    });
+    for (PsCacheFile& f : files) {
+        if (totalSize > PS_CACHE_MAX_SIZE) {
+            AutoFreeWstr filePath(path::Join(cacheDir, f.name));
+            if (file::Delete(filePath)) {
+                totalSize -= f.size;
+            }
+        }
+        free(f.name);
+    }
+}
+
+static EngineBase* CreateEngineFromPdfData(std::span<u8> pdfData) {
+    auto strm = CreateStreamFromData(pdfData);
+    ScopedComPtr<IStream> stream(strm);
+    if (!stream) {
+        return nullptr;
+    }
+    return CreateEnginePdfFromStream(stream);
+}
+
 static EngineBase* ps2pdf(const WCHAR* path) {
     // TODO: read from gswin32c's stdout instead of using a TEMP file
     AutoFreeWstr shortPath(path::ShortPath(path));
@@ -150,6 +239,26 @@ static EngineBase* ps2pdf(const WCHAR* path) {
     }
 
     const WCHAR* psSetupStr = psSetup ? psSetup.Get() : L"";
+
+    AutoFreeWstr cacheDir(GetPsCacheDir());
+    AutoFreeWstr cachePath;
+    if (cacheDir) {
+        cachePath.Set(GetPsCachePath(cacheDir, path, gswin32c, psSetupStr));
+    }
+    if (cachePath && file::Exists(cachePath)) {
+        AutoFree pdfData = file::ReadFile(cachePath);
+        EngineBase* engine = pdfData.empty() ? nullptr : CreateEngineFromPdfData(pdfData.AsSpan());
+        if (engine) {
+            // mark as recently used for CleanUpPsCache
+            FILETIME now;
+            GetSystemTimeAsFileTime(&now);
+            file::SetModificationTime(cachePath, now);
+            logf("- %s:%d: using cached conversion result\n", path::GetBaseNameNoFree(__FILE__), __LINE__);
+            return engine;
+        }
+        // the cached file is corrupted, convert again
+        file::Delete(cachePath);
+    }
     AutoFreeWstr cmdLine = str::Format(
         L"\"%s\" -q -dSAFER -dNOPAUSE -dBATCH -dEPSCrop -sOutputFile=\"%s\" -sDEVICE=pdfwrite -c "
         L"\".setpdfwrite%s\" -f \"%s\"",
@@ -188,13 +297,14 @@ static EngineBase* ps2pdf(const WCHAR* path) {
         return nullptr;
     }
 
-    auto strm = CreateStreamFromData(pdfData.AsSpan());
-    ScopedComPtr<IStream> stream(strm);
-    if (!stream) {
-        return nullptr;
+    EngineBase* engine = CreateEngineFromPdfData(pdfData.AsSpan());
+    if (engine && cachePath) {
+        // (the pdf data has already been read, so the file can be moved away)
+        if (MoveFileExW(tmpFile, cachePath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED)) {
+            CleanUpPsCache(cacheDir);
+        }
     }
-
-    return CreateEnginePdfFromStream(stream);
+    return engine;
 }
 
 static EngineBase* psgz2pdf(const WCHAR* fileName) {
@@ -289,8 +399,8 @@ class EnginePs : public EngineBase {
         return pdfEngine->SaveFileAs(pdfFileName, includeUserAnnots);
     }
 
-    PageText ExtractPageText(int pageNo) override {
-        return pdfEngine->ExtractPageText(pageNo);
+    PageText ExtractPageText(int pageNo, AbortCookie** cookie_out = nullptr) override {
+        return pdfEngine->ExtractPageText(pageNo, cookie_out);
     }
 
     bool HasClipOptimizations(int pageNo) override {
@@ -32,53 +32,51 @@ Kind kindEngineXps = "engineXps";
 // TODO: use http://schemas.openxps.org/oxps/v1.0 as well once NS actually matters
 #define NS_XPS_MICROSOFT "http://schemas.microsoft.com/xps/2005/06"
 
-#if 0
-fz_rect xps_bound_page_quick(xps_document* doc, int number) {
-    fz_rect bounds = fz_empty_rect;
-    fz_page* page = doc->first_page;
-    for (int n = 0; n < number && page; n++)
-        page = page->next;
-
-    xps_part* part = page ? xps_read_part(doc, page->name) : nullptr;
-    if (!part)
-        return fz_empty_rect;
+// parsing a FixedPage part takes a multiple of its size
+#define MAX_XPS_PARSED_PAGES_SIZE (16 * 1024 * 1024)
 
-    const char* data = (const char*)part->data;
-    size_t data_size = part->size;
+// reads the page size from the attributes of the FixedPage element, without parsing
+// the complete page (which only happens once the page is needed)
+static void xps_read_page_size_quick(fz_context* ctx, xps_document* doc, xps_fixpage* fix) {
+    xps_part* part = xps_read_part(ctx, doc, fix->name);
+    // the attributes are expected close to the start
+    std::string_view data((const char*)part->data->data, std::min(part->data->len, (size_t)64 * 1024));
 
     AutoFree dataUtf8;
-    if (str::StartsWith(data, UTF16BE_BOM)) {
-        for (int i = 0; i + 1 < part->size; i += 2) {
-            std::swap(part->data[i], part->data[i + 1]);
-        }
-    }
-    if (str::StartsWith(data, UTF16_BOM)) {
-        const WCHAR* s = (const WCHAR*)(part->data + 2);
-        size_t n = (part->size - 2) / 2;
-        auto tmp = strconv::ToUtf8(s, n);
-        dataUtf8.Set(tmp.StealData());
-        data = dataUtf8;
-        data_size = str::Len(dataUtf8);
+    if (str::StartsWith(data, UTF16_BOM) || str::StartsWith(data, UTF16BE_BOM)) {
+        bool isBE = str::StartsWith(data, UTF16BE_BOM);
+        size_t n = (data.size() - 2) / 2;
+        WCHAR* s = AllocArray<WCHAR>(n + 1);
+        if (s) {
+            const u8* d = (const u8*)data.data() + 2;
+            for (size_t i = 0; i < n; i++) {
+                s[i] = isBE ? (WCHAR)((d[2 * i] << 8) | d[2 * i + 1]) : (WCHAR)(d[2 * i] | (d[2 * i + 1] << 8));
+            }
+            dataUtf8 = strconv::WstrToUtf8(s, n);
+            free(s);
+        }
+        data = dataUtf8.AsView();
     } else if (str::StartsWith(data, UTF8_BOM)) {
-        data += 3;
-        data_size -= 3;
+        data.remove_prefix(3);
     }
 
-    HtmlPullParser p(data, data_size);
+    HtmlPullParser p(data.data(), data.size());
     HtmlToken* tok = p.Next();
-    if (tok && tok->IsStartTag() && tok->NameIsNS("FixedPage", NS_XPS_MICROSOFT)) {
-        AttrInfo* attr = tok->GetAttrByNameNS("Width", NS_XPS_MICROSOFT);
-        if (attr)
-            bounds.x1 = fz_atof(attr->val) * 72.0f / 96.0f;
-        attr = tok->GetAttrByNameNS("Height", NS_XPS_MICROSOFT);
-        if (attr)
-            bounds.y1 = fz_atof(attr->val) * 72.0f / 96.0f;
+    while (tok && tok->IsText()) {
+        tok = p.Next();
+    }
+    if (tok && (tok->IsStartTag() || tok->IsEmptyElementEndTag()) && tok->NameIsNS("FixedPage", NS_XPS_MICROSOFT)) {
+        AttrInfo* width = tok->GetAttrByName("Width");
+        AttrInfo* height = tok->GetAttrByName("Height");
+        if (width && height) {
+            // like xps_load_fixed_page
+            fix->width = atoi(width->val);
+            fix->height = atoi(height->val);
+        }
     }
 
     xps_drop_part(ctx, doc, part);
-    return bounds;
 }
-#endif
 
 class xps_doc_props {
   public:
@@ -201,12 +199,14 @@ class EngineXps : public EngineBase {
     RectF PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+    bool RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset) override;
 
     RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
     std::span<u8> GetFileData() override;
+    std::span<u8> BorrowFileData() override;
     bool SaveFileAs(const char* copyFileName, bool includeUserAnnots = false) override;
-    PageText ExtractPageText(int pageNo) override;
+    PageText ExtractPageText(int pageNo, AbortCookie** cookie_out = nullptr) override;
     bool HasClipOptimizations(int pageNo) override;
     WCHAR* GetProperty(DocumentProperty prop) override;
 
@@ -215,6 +215,10 @@ class EngineXps : public EngineBase {
     bool BenchLoadPage(int pageNo) override {
         return GetFzPageInfo(pageNo, false) != nullptr;
     }
+    void ReleaseCachedResources() override;
+    size_t GetMemoryUsage() override {
+        return (size_t)InterlockedAdd64(&fzMem.allocated, 0);
+    }
 
     Vec<IPageElement*>* GetElements(int pageNo) override;
     IPageElement* GetElementAtPos(int pageNo, PointF pt) override;
@@ -229,17 +233,27 @@ class EngineXps : public EngineBase {
   public:
     // make sure to never ask for pagesAccess in an ctxAccess
     // protected critical section in order to avoid deadlocks
+    // ctxAccess serializes all access to _doc, which isn't thread safe
+    // (display lists can be rendered without it, see FzRenderDisplayLists)
     CRITICAL_SECTION* ctxAccess;
     CRITICAL_SECTION pagesAccess;
+    CRITICAL_SECTION docAccess;
     CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
 
     fz_context* ctx = nullptr;
     fz_locks_context fz_locks_ctx;
+    FzMemCounter fzMem;
     fz_document* _doc = nullptr;
     fz_stream* _docStream = nullptr;
     Vec<FzPageInfo*> _pages;
+    // pages with a cached display list, protected by ctxAccess
+    Vec<FzPageInfo*> runCache;
+    // loaded pages, least recently used first (see TouchParsedPage), protected by ctxAccess
+    Vec<FzPageInfo*> parsedPages;
     fz_outline* _outline = nullptr;
+    // loaded on demand in GetProperty, protected by ctxAccess
     xps_doc_props* _info = nullptr;
+    bool _infoLoaded = false;
     fz_rect** imageRects = nullptr;
 
     TocTree* tocTree = nullptr;
@@ -251,6 +265,7 @@ class EngineXps : public EngineBase {
     bool LoadFromStream(fz_stream* stm);
 
     FzPageInfo* GetFzPageInfo(int pageNo, bool failIfBusy);
+    void TouchParsedPage(FzPageInfo* pageInfo);
     int GetPageNo(fz_page* page);
     fz_matrix viewctm(int pageNo, float zoom, int rotation) {
         const fz_rect tmpRect = To_fz_rect(PageMediabox(pageNo));
@@ -294,12 +309,15 @@ EngineXps::EngineXps() {
         InitializeCriticalSection(&mutexes[i]);
     }
     InitializeCriticalSection(&pagesAccess);
-    ctxAccess = &mutexes[FZ_LOCK_ALLOC];
+    // not MuPDF's FZ_LOCK_ALLOC, as that would block all allocations
+    // (also of cloned contexts) while a thread is using the document
+    InitializeCriticalSection(&docAccess);
+    ctxAccess = &docAccess;
 
     fz_locks_ctx.user = this;
     fz_locks_ctx.lock = fz_lock_context_cs;
     fz_locks_ctx.unlock = fz_unlock_context_cs;
-    ctx = fz_new_context(nullptr, &fz_locks_ctx, FZ_STORE_DEFAULT);
+    ctx = fz_new_context(&fzMem.alloc, &fz_locks_ctx, FzStoreSize());
     installFitzErrorCallbacks(ctx);
 }
 
@@ -307,6 +325,7 @@ EngineXps::~EngineXps() {
     EnterCriticalSection(&pagesAccess);
     EnterCriticalSection(ctxAccess);
 
+    FzFreeDisplayLists(ctx, runCache);
     for (auto* pi : _pages) {
         if (pi->links) {
             fz_drop_link(ctx, pi->links);
@@ -332,9 +351,10 @@ EngineXps::~EngineXps() {
     fz_drop_context(ctx);
 
     for (size_t i = 0; i < dimof(mutexes); i++) {
-        LeaveCriticalSection(&mutexes[i]);
         DeleteCriticalSection(&mutexes[i]);
     }
+    LeaveCriticalSection(ctxAccess);
+    DeleteCriticalSection(ctxAccess);
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
 }
@@ -423,19 +443,36 @@ bool EngineXps::LoadFromStream(fz_stream* stm) {
         return false;
     }
 
-    // TODO: this might be slow. Try port xps_bound_page_quick
+    // pages are only loaded (and their FixedPage parts parsed) once they're needed,
+    // the page sizes are either listed in the FixedDocument or quickly read from the pages
+    xps_document* xpsdoc = (xps_document*)_doc;
+    xps_fixpage* fix = xpsdoc->first_page;
     for (int i = 0; i < pageCount; i++) {
         FzPageInfo* pageInfo = new FzPageInfo();
         pageInfo->pageNo = i + 1;
 
         fz_rect mbox{};
 
-        fz_try(ctx) {
-            pageInfo->page = fz_load_page(ctx, _doc, i);
-            mbox = fz_bound_page(ctx, pageInfo->page);
+        if (fix && (fix->width <= 0 || fix->height <= 0)) {
+            fz_try(ctx) {
+                xps_read_page_size_quick(ctx, xpsdoc, fix);
+            }
+            fz_catch(ctx) {
+            }
         }
-        fz_catch(ctx) {
+        if (fix && fix->width > 0 && fix->height > 0) {
+            mbox.x1 = fix->width * 72.0f / 96.0f;
+            mbox.y1 = fix->height * 72.0f / 96.0f;
+        } else {
+            // fall back to parsing the complete page
+            fz_try(ctx) {
+                pageInfo->page = fz_load_page(ctx, _doc, i);
+                mbox = fz_bound_page(ctx, pageInfo->page);
+            }
+            fz_catch(ctx) {
+            }
         }
+        fix = fix ? fix->next : nullptr;
         if (fz_is_empty_rect(mbox)) {
             fz_warn(ctx, "cannot find page size for page %d", i);
             mbox.x0 = 0;
@@ -453,12 +490,6 @@ bool EngineXps::LoadFromStream(fz_stream* stm) {
     fz_catch(ctx) {
         fz_warn(ctx, "Couldn't load outline");
     }
-    fz_try(ctx) {
-        _info = xps_extract_doc_props(ctx, (xps_document*)_doc);
-    }
-    fz_catch(ctx) {
-        fz_warn(ctx, "Couldn't load document properties");
-    }
 
     return true;
 }
@@ -470,30 +501,24 @@ FzPageInfo* EngineXps::GetFzPageInfo(int pageNo, bool failIfBusy) {
     int pageIdx = pageNo - 1;
     FzPageInfo* pageInfo = _pages[pageIdx];
     // TODO: not sure what failIfBusy is supposed to do
-    if (pageInfo->page || failIfBusy) {
+    if (pageInfo->fullyLoaded || failIfBusy) {
         return pageInfo;
     }
 
     ScopedCritSec ctxScope(ctxAccess);
 
-#if 0
-    // was loaded in LoadFromStream
-    fz_var(page);
-    fz_try(ctx) {
-        page = fz_load_page(ctx, _doc, pageIdx);
-        pageInfo->page = page;
-    }
-    fz_catch(ctx) {
+    if (!pageInfo->page) {
+        fz_try(ctx) {
+            pageInfo->page = fz_load_page(ctx, _doc, pageIdx);
+        }
+        fz_catch(ctx) {
+        }
     }
-#endif
-
     fz_page* page = pageInfo->page;
-    fz_rect bounds;
-    fz_display_list* list = NULL;
-    fz_device* dev = NULL;
-    fz_cookie cookie = {0};
-    fz_var(list);
-    fz_var(dev);
+    if (!page) {
+        return pageInfo;
+    }
+    pageInfo->fullyLoaded = true;
 
     /* TODO: handle try later?
         if (fz_caught(ctx) != FZ_ERROR_TRYLATER) {
@@ -501,30 +526,11 @@ FzPageInfo* EngineXps::GetFzPageInfo(int pageNo, bool failIfBusy) {
         }
     */
 
-    // TODO: use fz_new_display_list_from_page
     fz_try(ctx) {
-        bounds = fz_bound_page(ctx, page);
-        list = fz_new_display_list(ctx, bounds);
-        dev = fz_new_list_device(ctx, list);
-        // TODO(port): should this be just fz_run_page_contents?
-        fz_run_page(ctx, page, dev, fz_identity, &cookie);
-        fz_close_device(ctx, dev);
-    }
-    fz_always(ctx) {
-        fz_drop_device(ctx, dev);
-        if (list) {
-            fz_drop_display_list(ctx, list);
-        }
-        dev = NULL;
+        pageInfo->links = fz_load_links(ctx, page);
     }
     fz_catch(ctx) {
-        fz_drop_display_list(ctx, list);
-        // fz_drop_separations(ctx, seps);
-    }
-    if (!list) {
-        return pageInfo;
     }
-    pageInfo->links = fz_load_links(ctx, page);
 
     fz_stext_page* stext = nullptr;
     fz_var(stext);
@@ -535,16 +541,40 @@ FzPageInfo* EngineXps::GetFzPageInfo(int pageNo, bool failIfBusy) {
     fz_catch(ctx) {
     }
 
-    if (!stext) {
-        return pageInfo;
+    if (stext) {
+        FzLinkifyPageText(pageInfo, stext);
+        fz_find_image_positions(ctx, pageInfo->images, stext);
+        fz_drop_stext_page(ctx, stext);
     }
-    FzLinkifyPageText(pageInfo, stext);
-    fz_find_image_positions(ctx, pageInfo->images, stext);
-    fz_drop_stext_page(ctx, stext);
+    FzBuildElementIndex(pageInfo);
+    TouchParsedPage(pageInfo);
 
     return pageInfo;
 }
 
+// makes pageInfo the most recently used page and drops the parsed FixedPage parts of the
+// least recently used pages so that at most MAX_XPS_PARSED_PAGES_SIZE bytes of them are kept
+// (they're parsed again when needed). the caller must hold ctxAccess
+void EngineXps::TouchParsedPage(FzPageInfo* pageInfo) {
+    if (!pageInfo->page) {
+        return;
+    }
+    int idx = parsedPages.Find(pageInfo);
+    if (idx >= 0) {
+        parsedPages.RemoveAt(idx);
+    }
+    parsedPages.Append(pageInfo);
+
+    size_t totalSize = 0;
+    for (auto* pi : parsedPages) {
+        totalSize += xps_page_xml_size(ctx, pi->page);
+    }
+    while (parsedPages.size() > 1 && totalSize > MAX_XPS_PARSED_PAGES_SIZE) {
+        totalSize -= xps_drop_page_xml(ctx, parsedPages[0]->page);
+        parsedPages.RemoveAt(0);
+    }
+}
+
 int EngineXps::GetPageNo(fz_page* page) {
     for (auto& pageInfo : _pages) {
         if (pageInfo->page == page) {
@@ -592,6 +622,7 @@ RectF EngineXps::PageContentBox(int pageNo, RenderTarget target) {
     fz_catch(ctx) {
         return mediabox;
     }
+    TouchParsedPage(pageInfo);
 
     if (fz_is_infinite_rect(rect)) {
         return mediabox;
@@ -626,55 +657,128 @@ RenderedBitmap* EngineXps::RenderPage(RenderPageArgs& args) {
         fzcookie = &cookie->cookie;
     }
 
-    // TODO(port): I don't see why this lock is needed
-    ScopedCritSec cs(ctxAccess);
+    // fz_run_display_list reports the size of the list through the cookie,
+    // so use one even if the caller doesn't want to abort rendering
+    fz_cookie localCookie = {};
+    fz_cookie* runCookie = fzcookie ? fzcookie : &localCookie;
+
+    fz_display_list* list = nullptr;
+    fz_device* listDev = nullptr;
+    bool isNewList = false;
+    int errors = runCookie->errors;
 
-    fz_rect pRect;
-    if (args.pageRect) {
-        pRect = To_fz_rect(*args.pageRect);
-    } else {
-        // TODO(port): use pageInfo->mediabox?
-        pRect = fz_bound_page(ctx, page);
+    fz_var(list);
+    fz_var(listDev);
+    fz_var(isNewList);
+
+    fz_matrix ctm;
+    fz_irect bbox;
+    {
+        // only interpreting the page needs the document
+        ScopedCritSec cs(ctxAccess);
+
+        fz_rect pRect;
+        if (args.pageRect) {
+            pRect = To_fz_rect(*args.pageRect);
+        } else {
+            // TODO(port): use pageInfo->mediabox?
+            pRect = fz_bound_page(ctx, page);
+        }
+        ctm = viewctm(page, args.zoom, args.rotation);
+        bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
+
+        fz_try(ctx) {
+            // the page is interpreted once into a display list which is then
+            // replayed for every zoom level and tile
+            list = FzGetCachedDisplayList(ctx, runCache, pageInfo);
+            if (!list) {
+                isNewList = true;
+                list = fz_new_display_list(ctx, fz_bound_page(ctx, page));
+                listDev = fz_new_list_device(ctx, list);
+                fz_run_page(ctx, page, listDev, fz_identity, runCookie);
+                fz_close_device(ctx, listDev);
+                TouchParsedPage(pageInfo);
+            }
+        }
+        fz_always(ctx) {
+            fz_drop_device(ctx, listDev);
+        }
+        fz_catch(ctx) {
+            fz_drop_display_list(ctx, list);
+            return nullptr;
+        }
     }
-    fz_matrix ctm = viewctm(page, args.zoom, args.rotation);
-    fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_colorspace* colorspace = fz_device_rgb(ctx);
-    fz_irect ibounds = bbox;
-    fz_rect cliprect = fz_rect_from_irect(bbox);
+    // rasterizing (including decoding images) is what takes the longest
+    // and happens concurrently for all threads rendering this document
+    size_t listSize = 0;
+    RenderedBitmap* bitmap =
+        FzRenderDisplayLists(ctx, &list, 1, ctm, bbox, runCookie, &listSize, nullptr, nullptr, args.isDraft);
 
-    fz_pixmap* pix = nullptr;
-    fz_device* dev = nullptr;
-    RenderedBitmap* bitmap = nullptr;
+    ScopedCritSec cs(ctxAccess);
+    if (isNewList && bitmap && !runCookie->abort && !runCookie->incomplete && errors == runCookie->errors) {
+        FzCacheDisplayList(ctx, runCache, pageInfo, list, listSize);
+    }
+    fz_drop_display_list(ctx, list);
+    return bitmap;
+}
 
-    fz_var(dev);
-    fz_var(pix);
-    fz_var(bitmap);
+bool EngineXps::RenderPageToDC(HDC hdc, RenderPageArgs& args, Point offset) {
+    FzPageInfo* pageInfo = GetFzPageInfo(args.pageNo, false);
+    fz_page* page = pageInfo->page;
+    if (!page) {
+        return false;
+    }
 
-    fz_try(ctx) {
-        pix = fz_new_pixmap_with_bbox(ctx, colorspace, ibounds, nullptr, 1);
-        // initialize with white background
-        fz_clear_pixmap_with_value(ctx, pix, 0xff);
-
-        // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
-        // or "Print". "Export" is not used
-        dev = fz_new_draw_device(ctx, fz_identity, pix);
-        // TODO: use fz_infinite_rect instead of cliprect?
-        fz_run_page(ctx, page, dev, ctm, fzcookie);
-        bitmap = new_rendered_fz_pixmap(ctx, pix);
-        fz_close_device(ctx, dev);
+    fz_cookie* fzcookie = nullptr;
+    if (args.cookie_out) {
+        FitzAbortCookie* cookie = new FitzAbortCookie();
+        *args.cookie_out = cookie;
+        fzcookie = &cookie->cookie;
     }
-    fz_always(ctx) {
-        if (dev) {
-            fz_drop_device(ctx, dev);
+
+    fz_display_list* list = nullptr;
+    fz_device* listDev = nullptr;
+
+    fz_var(list);
+    fz_var(listDev);
+
+    fz_matrix ctm;
+    {
+        ScopedCritSec cs(ctxAccess);
+
+        fz_rect pRect = args.pageRect ? To_fz_rect(*args.pageRect) : fz_bound_page(ctx, page);
+        ctm = viewctm(page, args.zoom, args.rotation);
+        fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
+        ctm = fz_concat(ctm, fz_translate((float)(offset.x - bbox.x0), (float)(offset.y - bbox.y0)));
+
+        fz_try(ctx) {
+            list = FzGetCachedDisplayList(ctx, runCache, pageInfo);
+            if (!list) {
+                list = fz_new_display_list(ctx, fz_bound_page(ctx, page));
+                listDev = fz_new_list_device(ctx, list);
+                fz_run_page(ctx, page, listDev, fz_identity, fzcookie);
+                fz_close_device(ctx, listDev);
+                TouchParsedPage(pageInfo);
+            }
+        }
+        fz_always(ctx) {
+            fz_drop_device(ctx, listDev);
+        }
+        fz_catch(ctx) {
+            fz_drop_display_list(ctx, list);
+            return false;
         }
-        fz_drop_pixmap(ctx, pix);
     }
-    fz_catch(ctx) {
-        delete bitmap;
-        return nullptr;
+
+    bool ok = !FzDisplayListNeedsRaster(ctx, list);
+    if (ok && hdc) {
+        ok = FzRunDisplayListOnDC(ctx, list, hdc, ctm, fzcookie);
     }
-    return bitmap;
+
+    ScopedCritSec cs(ctxAccess);
+    fz_drop_display_list(ctx, list);
+    return ok;
 }
 
 std::span<u8> EngineXps::GetFileData() {
@@ -700,21 +804,42 @@ std::span<u8> EngineXps::GetFileData() {
     return file::ReadFile(path);
 }
 
+void EngineXps::ReleaseCachedResources() {
+    ScopedCritSec scope(ctxAccess);
+    // cached display lists keep images and fonts alive
+    FzFreeDisplayLists(ctx, runCache);
+    fz_empty_store(ctx);
+}
+
+std::span<u8> EngineXps::BorrowFileData() {
+    std::span<u8> mapped;
+    ScopedCritSec scope(ctxAccess);
+
+    fz_var(mapped);
+    fz_try(ctx) {
+        mapped = fz_stream_mapped_data(ctx, _docStream);
+    }
+    fz_catch(ctx) {
+        mapped = {};
+    }
+    return mapped;
+}
+
 bool EngineXps::SaveFileAs(const char* copyFileName, bool includeUserAnnots) {
     UNUSED(includeUserAnnots);
     AutoFreeWstr dstPath = strconv::Utf8ToWstr(copyFileName);
-    AutoFree d = GetFileData();
-    if (!d.empty()) {
-        bool ok = file::WriteFile(dstPath, d.AsSpan());
-        if (ok) {
-            return true;
-        }
+    // write mapped files straight from the mapping instead of copying them first
+    auto mapped = BorrowFileData();
+    if (!mapped.empty() && file::WriteFile(dstPath, mapped)) {
+        return true;
     }
+    // copy the file instead of loading it into memory
     auto path = FileName();
-    if (!path) {
-        return false;
+    if (path && CopyFileW(path, dstPath, FALSE)) {
+        return true;
     }
-    return CopyFileW(path, dstPath, FALSE);
+    AutoFree d = GetFileData();
+    return !d.empty() && file::WriteFile(dstPath, d.AsSpan());
 }
 
 WCHAR* EngineXps::ExtractFontList() {
@@ -746,6 +871,18 @@ WCHAR* EngineXps::GetProperty(DocumentProperty prop) {
     if (DocumentProperty::FontList == prop) {
         return ExtractFontList();
     }
+
+    // the document properties are only needed for the properties dialog
+    ScopedCritSec scope(ctxAccess);
+    if (!_infoLoaded) {
+        _infoLoaded = true;
+        fz_try(ctx) {
+            _info = xps_extract_doc_props(ctx, (xps_document*)_doc);
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "Couldn't load document properties");
+        }
+    }
     if (!_info) {
         return nullptr;
     }
@@ -822,28 +959,15 @@ RenderedBitmap* EngineXps::GetImageForPageElement(IPageElement* ipel) {
     return GetPageImage(pageNo, r, imageID);
 }
 
-PageText EngineXps::ExtractPageText(int pageNo) {
+PageText EngineXps::ExtractPageText(int pageNo, AbortCookie** cookie_out) {
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
-    if (!pageInfo) {
+    if (!pageInfo || !pageInfo->page) {
         return {};
     }
 
     ScopedCritSec scope(ctxAccess);
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, nullptr);
-    }
-    fz_catch(ctx) {
-    }
-    if (!stext) {
-        return {};
-    }
-    PageText res;
-    res.text = fz_text_page_to_str(stext, &res.coords);
-    fz_drop_stext_page(ctx, stext);
-    res.len = (int)str::Len(res.text);
+    PageText res = FzExtractPageText(ctx, pageInfo->page, nullptr, cookie_out);
+    TouchParsedPage(pageInfo);
     return res;
 }
 
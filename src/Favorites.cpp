@@ -656,7 +656,7 @@ void AddFavoriteForCurrentPage(WindowInfo* win, int pageNo) {
     if (ctrl->HacToc()) {
         // use the current ToC heading as default name
         auto* docTree = ctrl->GetToc();
-        TocItem* root = docTree->root;
+        TocItem* root = docTree ? docTree->root : nullptr;
         TocItem* item = TocItemForPageNo(root, pageNo);
         if (item) {
             name.SetCopy(item->title);
@@ -60,17 +60,69 @@ static int cmpOpenCount(const void* a, const void* b) {
     return dsA->index < dsB->index ? -1 : 1;
 }
 
+// case insensitive for ASCII characters, all others hash the same (like WStrList::GetQuickHashI)
+static u32 HashFilePath(const WCHAR* s) {
+    u32 hash = 2166136261u;
+    for (; *s; s++) {
+        WCHAR c = *s;
+        u8 b = (c & 0xFF80) ? 0x80 : 'A' <= c && c <= 'Z' ? (u8)(c + 'a' - 'A') : (u8)c;
+        hash = (hash ^ b) * 16777619u;
+    }
+    return hash;
+}
+
+// inserts in the order of states, so that Find returns the first of several states
+// for the same path, the same as a linear search would
+void FileHistory::RebuildIndex() const {
+    size_t n = states ? states->size() : 0;
+    size_t size = 64;
+    while (size < n * 2) {
+        size *= 2;
+    }
+    pathIndex.Reset();
+    pathIndex.AppendBlanks(size);
+    indexedCount = 0;
+    indexStale = false;
+    for (size_t i = 0; i < n; i++) {
+        AddToIndex(states->at(i));
+    }
+}
+
+void FileHistory::AddToIndex(DisplayState* state) const {
+    if (indexStale || (indexedCount + 1) * 2 > pathIndex.size()) {
+        // indexes state as well, as it's already been added to states
+        RebuildIndex();
+        return;
+    }
+    size_t mask = pathIndex.size() - 1;
+    size_t i = HashFilePath(state->filePath) & mask;
+    while (pathIndex.at(i)) {
+        i = (i + 1) & mask;
+    }
+    pathIndex.at(i) = state;
+    indexedCount++;
+}
+
 void FileHistory::Append(DisplayState* state) {
     CrashIf(!state->filePath);
     states->Append(state);
+    AddToIndex(state);
 }
 
 void FileHistory::Remove(DisplayState* state) {
     states->Remove(state);
+    indexStale = true;
 }
 
 void FileHistory::UpdateStatesSource(Vec<DisplayState*>* states) {
     this->states = states;
+    indexStale = true;
+}
+
+// to be used instead of changing state->filePath directly, so that Find keeps finding it
+void FileHistory::SetFilePath(DisplayState* state, const WCHAR* filePath) {
+    str::ReplacePtr(&state->filePath, filePath);
+    indexStale = true;
 }
 
 void FileHistory::Clear(bool keepFavorites) {
@@ -87,6 +139,7 @@ void FileHistory::Clear(bool keepFavorites) {
         }
     }
     *states = keep;
+    indexStale = true;
 }
 
 DisplayState* FileHistory::Get(size_t index) const {
@@ -97,12 +150,18 @@ DisplayState* FileHistory::Get(size_t index) const {
 }
 
 DisplayState* FileHistory::Find(const WCHAR* filePath, size_t* idxOut) const {
-    for (size_t i = 0; i < states->size(); i++) {
-        if (str::EqI(states->at(i)->filePath, filePath)) {
+    // states might have been added or removed directly
+    if (indexStale || indexedCount != states->size()) {
+        RebuildIndex();
+    }
+    size_t mask = pathIndex.size() - 1;
+    for (size_t i = HashFilePath(filePath) & mask; pathIndex.at(i); i = (i + 1) & mask) {
+        DisplayState* state = pathIndex.at(i);
+        if (str::EqI(state->filePath, filePath)) {
             if (idxOut) {
-                *idxOut = i;
+                *idxOut = (size_t)states->Find(state);
             }
-            return states->at(i);
+            return state;
         }
     }
     return nullptr;
@@ -114,7 +173,8 @@ DisplayState* FileHistory::MarkFileLoaded(const WCHAR* filePath) {
     // then reuse it. That way we don't have duplicates and
     // the file moves to the front of the list
     DisplayState* state = Find(filePath, nullptr);
-    if (!state) {
+    bool isNew = !state;
+    if (isNew) {
         state = NewDisplayState(filePath);
         state->useDefaultState = true;
     } else {
@@ -122,6 +182,9 @@ DisplayState* FileHistory::MarkFileLoaded(const WCHAR* filePath) {
         state->isMissing = false;
     }
     states->InsertAt(0, state);
+    if (isNew) {
+        AddToIndex(state);
+    }
     state->openCount++;
     return state;
 }
@@ -160,7 +223,9 @@ bool FileHistory::MarkFileInexistent(const WCHAR* filePath, bool hide) {
 // by open count (which has a pre-multiplied recency factor)
 // and with all missing states filtered out
 // caller needs to delete the result (but not the contained states)
-void FileHistory::GetFrequencyOrder(Vec<DisplayState*>& list) const {
+// if maxCount is given, only that many most frequently used
+// states are returned (which is faster for a long history)
+void FileHistory::GetFrequencyOrder(Vec<DisplayState*>& list, size_t maxCount) const {
     CrashIf(list.size() > 0);
     size_t i = 0;
     for (DisplayState* ds : *states) {
@@ -169,7 +234,13 @@ void FileHistory::GetFrequencyOrder(Vec<DisplayState*>& list) const {
             list.Append(ds);
         }
     }
-    list.Sort(cmpOpenCount);
+    if (maxCount >= list.size()) {
+        list.Sort(cmpOpenCount);
+        return;
+    }
+    auto isMoreFrequent = [](DisplayState* a, DisplayState* b) { return cmpOpenCount(&a, &b) < 0; };
+    std::partial_sort(list.begin(), list.begin() + maxCount, list.end(), isMoreFrequent);
+    list.RemoveAt(maxCount, list.size() - maxCount);
 }
 
 // removes file history entries which shouldn't be saved anymore
@@ -181,7 +252,7 @@ void FileHistory::Purge(bool alwaysUseDefaultState) {
     int minOpenCount = 0;
     if (alwaysUseDefaultState) {
         Vec<DisplayState*> frequencyList;
-        GetFrequencyOrder(frequencyList);
+        GetFrequencyOrder(frequencyList, FILE_HISTORY_MAX_FREQUENT + 1);
         if (frequencyList.size() > FILE_HISTORY_MAX_RECENT) {
             minOpenCount = frequencyList.at(FILE_HISTORY_MAX_FREQUENT)->openCount / 2;
         }
@@ -207,5 +278,6 @@ void FileHistory::Purge(bool alwaysUseDefaultState) {
             continue;
         }
         DeleteDisplayState(state);
+        indexStale = true;
     }
 }
@@ -14,6 +14,12 @@ struct FileHistory {
     // owned by gGlobalPrefs->fileStates
     Vec<DisplayState*>* states = nullptr;
 
+    // hash table of states by file path (with open addressing and linear probing),
+    // rebuilt by Find when states have been removed or their number has changed
+    mutable Vec<DisplayState*> pathIndex;
+    mutable size_t indexedCount = 0;
+    mutable bool indexStale = true;
+
     FileHistory() = default;
     ~FileHistory() = default;
 
@@ -24,7 +30,12 @@ struct FileHistory {
     DisplayState* Find(const WCHAR* filePath, size_t* idxOut) const;
     DisplayState* MarkFileLoaded(const WCHAR* filePath);
     bool MarkFileInexistent(const WCHAR* filePath, bool hide = false);
-    void GetFrequencyOrder(Vec<DisplayState*>& list) const;
+    void GetFrequencyOrder(Vec<DisplayState*>& list, size_t maxCount = (size_t)-1) const;
     void Purge(bool alwaysUseDefaultState = false);
     void UpdateStatesSource(Vec<DisplayState*>* states);
+    void SetFilePath(DisplayState* state, const WCHAR* filePath);
+
+  private:
+    void RebuildIndex() const;
+    void AddToIndex(DisplayState* state) const;
 };
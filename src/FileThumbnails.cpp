@@ -6,12 +6,15 @@
 #include "utils/CryptoUtil.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
 
 #include "Annotation.h"
 #include "EngineBase.h"
+#include "EngineCreate.h"
 #include "DisplayMode.h"
 #include "SettingsStructs.h"
 #include "FileHistory.h"
@@ -20,26 +23,108 @@
 #include "FileThumbnails.h"
 
 #define THUMBNAILS_DIR_NAME L"sumatrapdfcache"
+#define THUMBNAIL_STORE_NAME L"thumbnails.dat"
 
-// TODO: create in TEMP directory instead?
-static WCHAR* GetThumbnailPath(const WCHAR* filePath) {
-    // create a fingerprint of a (normalized) path for the file name
-    // I'd have liked to also include the file's last modification time
-    // in the fingerprint (much quicker than hashing the entire file's
-    // content), but that's too expensive for files on slow drives
-    u8 digest[16];
+// must be changed whenever the file format changes
+#define THUMBNAIL_STORE_MAGIC 0x31425453 // 'STB1'
+
+// All thumbnails are kept in a single memory-mapped file, so that the start page
+// doesn't have to read and decode a PNG file per document. The file consists of
+// this header, a ThumbnailStoreEntry per thumbnail and the thumbnails' pixels
+// (uncompressed top-down 32-bit BGR rows)
+struct ThumbnailStoreHeader {
+    u32 magic;
+    i32 count;
+};
+
+struct ThumbnailStoreEntry {
+    // digest of the document's (normalized) path
+    u8 pathDigest[16];
+    u32 offset;
+    i32 dx;
+    i32 dy;
+    // when the thumbnail was created, to tell whether the document is newer
+    FILETIME created;
+};
+
+static_assert(sizeof(ThumbnailStoreHeader) % 4 == 0 && sizeof(ThumbnailStoreEntry) % 4 == 0,
+              "store entries must keep the pixels aligned");
+
+struct MappedThumbnailStore {
+    HANDLE hFile{INVALID_HANDLE_VALUE};
+    HANDLE hMap{nullptr};
+    const u8* data{nullptr};
+    size_t size{0};
+
+    ~MappedThumbnailStore();
+    int Count() const;
+    const ThumbnailStoreEntry* Entry(int idx) const;
+    const ThumbnailStoreEntry* Find(const u8 pathDigest[16]) const;
+};
+
+// only accessed from the UI thread. nullptr if not mapped yet (or if
+// it's being rewritten, which can't happen while it's mapped)
+static MappedThumbnailStore* gThumbnailStore = nullptr;
+
+MappedThumbnailStore::~MappedThumbnailStore() {
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (hMap) {
+        CloseHandle(hMap);
+    }
+    if (hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(hFile);
+    }
+}
+
+int MappedThumbnailStore::Count() const {
+    return ((const ThumbnailStoreHeader*)data)->count;
+}
+
+const ThumbnailStoreEntry* MappedThumbnailStore::Entry(int idx) const {
+    CrashIf(idx < 0 || idx >= Count());
+    const ThumbnailStoreEntry* entries = (const ThumbnailStoreEntry*)(data + sizeof(ThumbnailStoreHeader));
+    return &entries[idx];
+}
+
+const ThumbnailStoreEntry* MappedThumbnailStore::Find(const u8 pathDigest[16]) const {
+    for (int i = 0; i < Count(); i++) {
+        const ThumbnailStoreEntry* e = Entry(i);
+        if (memeq(e->pathDigest, pathDigest, sizeof(e->pathDigest))) {
+            return e;
+        }
+    }
+    return nullptr;
+}
+
+// create a fingerprint of a (normalized) path
+// I'd have liked to also include the file's last modification time
+// in the fingerprint (much quicker than hashing the entire file's
+// content), but that's too expensive for files on slow drives
+static bool GetThumbnailDigest(const WCHAR* filePath, u8 digest[16]) {
     // TODO: why is this happening? Seen in crash reports e.g. 35043
     if (!filePath) {
-        return nullptr;
+        return false;
     }
     AutoFree pathU(strconv::WstrToUtf8(filePath));
     if (!pathU.Get()) {
-        return nullptr;
+        return false;
     }
     if (path::HasVariableDriveLetter(filePath)) {
         pathU.Get()[0] = '?'; // ignore the drive letter, if it might change
     }
     CalcMD5Digest((u8*)pathU.Get(), str::Len(pathU.Get()), digest);
+    return true;
+}
+
+// thumbnails used to be stored as <digest>.png files, which are
+// still read (and moved into the store) if there's one
+static WCHAR* GetLegacyThumbnailPath(const WCHAR* filePath) {
+    u8 digest[16];
+    if (!GetThumbnailDigest(filePath, digest)) {
+        return nullptr;
+    }
     AutoFree fingerPrint(_MemToHex(&digest));
 
     AutoFreeWstr thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
@@ -51,12 +136,172 @@ static WCHAR* GetThumbnailPath(const WCHAR* filePath) {
     return str::Format(L"%s\\%s.png", thumbsPath.Get(), fname.Get());
 }
 
+// TODO: create in TEMP directory instead?
+static WCHAR* GetThumbnailStorePath() {
+    AutoFreeWstr thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
+    if (!thumbsPath) {
+        return nullptr;
+    }
+    return path::Join(thumbsPath, THUMBNAIL_STORE_NAME);
+}
+
+static bool IsValidThumbnailStore(MappedThumbnailStore* store) {
+    if (store->size < sizeof(ThumbnailStoreHeader)) {
+        return false;
+    }
+    const ThumbnailStoreHeader* hdr = (const ThumbnailStoreHeader*)store->data;
+    if (hdr->magic != THUMBNAIL_STORE_MAGIC || hdr->count < 0 ||
+        (size_t)hdr->count > (store->size - sizeof(ThumbnailStoreHeader)) / sizeof(ThumbnailStoreEntry)) {
+        return false;
+    }
+    for (int i = 0; i < hdr->count; i++) {
+        const ThumbnailStoreEntry* e = store->Entry(i);
+        if (e->dx <= 0 || e->dy <= 0 || e->dx > 4 * THUMBNAIL_DX || e->dy > 4 * THUMBNAIL_DY) {
+            return false;
+        }
+        size_t pixelsSize = (size_t)e->dx * e->dy * 4;
+        if (e->offset % 4 != 0 || e->offset > store->size || pixelsSize > store->size - e->offset) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static MappedThumbnailStore* GetThumbnailStore() {
+    if (gThumbnailStore) {
+        return gThumbnailStore;
+    }
+    AutoFreeWstr path(GetThumbnailStorePath());
+    if (!path) {
+        return nullptr;
+    }
+    MappedThumbnailStore* store = new MappedThumbnailStore();
+    store->hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (INVALID_HANDLE_VALUE == store->hFile) {
+        delete store;
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(store->hFile, &size) || size.QuadPart <= 0 || (u64)size.QuadPart > (u64)UINT32_MAX) {
+        delete store;
+        return nullptr;
+    }
+    store->size = (size_t)size.QuadPart;
+    store->hMap = CreateFileMappingW(store->hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (store->hMap) {
+        store->data = (const u8*)MapViewOfFile(store->hMap, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!store->data || !IsValidThumbnailStore(store)) {
+        delete store;
+        return nullptr;
+    }
+    gThumbnailStore = store;
+    return store;
+}
+
+struct PendingThumbnail {
+    u8 pathDigest[16];
+    i32 dx;
+    i32 dy;
+    FILETIME created;
+    const u8* pixels;
+};
+
+// replaces the store with the given thumbnails (whose pixels
+// may point into the current store)
+static bool WriteThumbnailStore(Vec<PendingThumbnail>& thumbnails) {
+    AutoFreeWstr path(GetThumbnailStorePath());
+    if (!path) {
+        return false;
+    }
+
+    ThumbnailStoreHeader hdr;
+    hdr.magic = THUMBNAIL_STORE_MAGIC;
+    hdr.count = (i32)thumbnails.size();
+
+    str::Str storeData;
+    storeData.Append((u8*)&hdr, sizeof(hdr));
+    u32 offset = (u32)(sizeof(hdr) + thumbnails.size() * sizeof(ThumbnailStoreEntry));
+    for (PendingThumbnail& t : thumbnails) {
+        ThumbnailStoreEntry e;
+        memcpy(e.pathDigest, t.pathDigest, sizeof(e.pathDigest));
+        e.offset = offset;
+        e.dx = t.dx;
+        e.dy = t.dy;
+        e.created = t.created;
+        storeData.Append((u8*)&e, sizeof(e));
+        offset += (u32)(t.dx * t.dy * 4);
+    }
+    for (PendingThumbnail& t : thumbnails) {
+        storeData.Append(t.pixels, (size_t)t.dx * t.dy * 4);
+    }
+
+    // the file can't be overwritten while it's mapped
+    delete gThumbnailStore;
+    gThumbnailStore = nullptr;
+
+    if (thumbnails.size() == 0) {
+        return file::Delete(path);
+    }
+    AutoFreeWstr thumbsPath(path::GetDir(path));
+    return dir::Create(thumbsPath) && file::WriteFile(path, storeData.AsSpan());
+}
+
+// collects the stored thumbnails for which keep returns true
+template <typename Func>
+static void GetStoredThumbnails(Vec<PendingThumbnail>& thumbnails, const Func& keep) {
+    MappedThumbnailStore* store = GetThumbnailStore();
+    if (!store) {
+        return;
+    }
+    for (int i = 0; i < store->Count(); i++) {
+        const ThumbnailStoreEntry* e = store->Entry(i);
+        if (!keep(e->pathDigest)) {
+            continue;
+        }
+        PendingThumbnail t;
+        memcpy(t.pathDigest, e->pathDigest, sizeof(t.pathDigest));
+        t.dx = e->dx;
+        t.dy = e->dy;
+        t.created = e->created;
+        t.pixels = store->data + e->offset;
+        thumbnails.Append(t);
+    }
+}
+
 // removes thumbnails that don't belong to any frequently used item in file history
 void CleanUpThumbnailCache(const FileHistory& fileHistory) {
     AutoFreeWstr thumbsPath(AppGenDataFilename(THUMBNAILS_DIR_NAME));
     if (!thumbsPath) {
         return;
     }
+
+    Vec<DisplayState*> list;
+    fileHistory.GetFrequencyOrder(list, FILE_HISTORY_MAX_FREQUENT * 2);
+    Vec<u8> digests;
+    for (size_t i = 0; i < list.size() && i < FILE_HISTORY_MAX_FREQUENT * 2; i++) {
+        u8 digest[16];
+        if (GetThumbnailDigest(list.at(i)->filePath, digest)) {
+            digests.Append(digest, sizeof(digest));
+        }
+    }
+
+    Vec<PendingThumbnail> thumbnails;
+    bool removedAny = false;
+    GetStoredThumbnails(thumbnails, [&](const u8 pathDigest[16]) {
+        for (size_t i = 0; i < digests.size(); i += 16) {
+            if (memeq(digests.LendData() + i, pathDigest, 16)) {
+                return true;
+            }
+        }
+        removedAny = true;
+        return false;
+    });
+    if (removedAny) {
+        WriteThumbnailStore(thumbnails);
+    }
+
+    // remove the legacy .png thumbnails that no longer belong to any item
     AutoFreeWstr pattern(path::Join(thumbsPath, L"*.png"));
 
     WStrVec files;
@@ -73,10 +318,8 @@ void CleanUpThumbnailCache(const FileHistory& fileHistory) {
     } while (FindNextFile(hfind, &fdata));
     FindClose(hfind);
 
-    Vec<DisplayState*> list;
-    fileHistory.GetFrequencyOrder(list);
     for (size_t i = 0; i < list.size() && i < FILE_HISTORY_MAX_FREQUENT * 2; i++) {
-        AutoFreeWstr bmpPath(GetThumbnailPath(list.at(i)->filePath));
+        AutoFreeWstr bmpPath(GetLegacyThumbnailPath(list.at(i)->filePath));
         if (!bmpPath) {
             continue;
         }
@@ -144,12 +387,85 @@ static RenderedBitmap* LoadRenderedBitmap(const WCHAR* filePath) {
     return rendered;
 }
 
+static void InitThumbnailBitmapInfo(BITMAPINFO& bmi, int dx, int dy) {
+    bmi = {};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = dx;
+    bmi.bmiHeader.biHeight = -dy; // top-down
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+}
+
+static RenderedBitmap* CreateThumbnailBitmap(const u8* pixels, int dx, int dy) {
+    BITMAPINFO bmi;
+    InitThumbnailBitmapInfo(bmi, dx, dy);
+    void* bits = nullptr;
+    HBITMAP hbmp = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &bits, nullptr, 0);
+    if (!hbmp) {
+        return nullptr;
+    }
+    memcpy(bits, pixels, (size_t)dx * dy * 4);
+    return new RenderedBitmap(hbmp, Size(dx, dy));
+}
+
+// adds ds.thumbnail to the store, replacing a previous thumbnail of the same document
+static bool StoreThumbnail(DisplayState& ds, FILETIME created) {
+    u8 digest[16];
+    if (!ds.thumbnail || !GetThumbnailDigest(ds.filePath, digest)) {
+        return false;
+    }
+    Size size = ds.thumbnail->Size();
+    if (size.dx > 4 * THUMBNAIL_DX || size.dy > 4 * THUMBNAIL_DY) {
+        return false;
+    }
+
+    BITMAPINFO bmi;
+    InitThumbnailBitmapInfo(bmi, size.dx, size.dy);
+    AutoFree pixels((char*)AllocArray<u8>((size_t)size.dx * size.dy * 4));
+    if (!pixels) {
+        return false;
+    }
+    HDC hdc = GetDC(nullptr);
+    int nLines = GetDIBits(hdc, ds.thumbnail->GetBitmap(), 0, size.dy, pixels, &bmi, DIB_RGB_COLORS);
+    ReleaseDC(nullptr, hdc);
+    if (nLines != size.dy) {
+        return false;
+    }
+
+    Vec<PendingThumbnail> thumbnails;
+    GetStoredThumbnails(thumbnails, [&](const u8 pathDigest[16]) { return !memeq(pathDigest, digest, 16); });
+    PendingThumbnail t;
+    memcpy(t.pathDigest, digest, sizeof(t.pathDigest));
+    t.dx = size.dx;
+    t.dy = size.dy;
+    t.created = created;
+    t.pixels = (const u8*)pixels.Get();
+    thumbnails.Append(t);
+    return WriteThumbnailStore(thumbnails);
+}
+
+static const ThumbnailStoreEntry* FindStoredThumbnail(const WCHAR* filePath) {
+    u8 digest[16];
+    if (!GetThumbnailDigest(filePath, digest)) {
+        return nullptr;
+    }
+    MappedThumbnailStore* store = GetThumbnailStore();
+    return store ? store->Find(digest) : nullptr;
+}
+
 bool LoadThumbnail(DisplayState& ds) {
     delete ds.thumbnail;
     ds.thumbnail = nullptr;
 
-    AutoFreeWstr bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath) {
+    const ThumbnailStoreEntry* e = FindStoredThumbnail(ds.filePath);
+    if (e) {
+        ds.thumbnail = CreateThumbnailBitmap(gThumbnailStore->data + e->offset, e->dx, e->dy);
+        return ds.thumbnail != nullptr;
+    }
+
+    AutoFreeWstr bmpPath(GetLegacyThumbnailPath(ds.filePath));
+    if (!bmpPath || !file::Exists(bmpPath)) {
         return false;
     }
 
@@ -160,6 +476,10 @@ bool LoadThumbnail(DisplayState& ds) {
     }
 
     ds.thumbnail = bmp;
+    // move the thumbnail into the store (keeping its age)
+    if (StoreThumbnail(ds, file::GetModificationTime(bmpPath))) {
+        file::Delete(bmpPath);
+    }
     return true;
 }
 
@@ -168,14 +488,13 @@ bool HasThumbnail(DisplayState& ds) {
         return false;
     }
 
-    AutoFreeWstr bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath) {
+    const ThumbnailStoreEntry* e = FindStoredThumbnail(ds.filePath);
+    if (!e) {
         return true;
     }
-    FILETIME bmpTime = file::GetModificationTime(bmpPath);
     FILETIME fileTime = file::GetModificationTime(ds.filePath);
     // delete the thumbnail if the file is newer than the thumbnail
-    if (FileTimeDiffInSecs(fileTime, bmpTime) > 0) {
+    if (FileTimeDiffInSecs(fileTime, e->created) > 0) {
         delete ds.thumbnail;
         ds.thumbnail = nullptr;
     }
@@ -195,32 +514,120 @@ void SetThumbnail(DisplayState* ds, RenderedBitmap* bmp) {
 }
 
 void SaveThumbnail(DisplayState& ds) {
-    if (!ds.thumbnail) {
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    StoreThumbnail(ds, now);
+}
+
+void RemoveThumbnail(DisplayState& ds) {
+    if (!HasThumbnail(ds)) {
         return;
     }
 
-    AutoFreeWstr bmpPath(GetThumbnailPath(ds.filePath));
-    if (!bmpPath) {
-        return;
+    u8 digest[16];
+    if (GetThumbnailDigest(ds.filePath, digest)) {
+        Vec<PendingThumbnail> thumbnails;
+        bool found = false;
+        GetStoredThumbnails(thumbnails, [&](const u8 pathDigest[16]) {
+            if (memeq(pathDigest, digest, 16)) {
+                found = true;
+                return false;
+            }
+            return true;
+        });
+        if (found) {
+            WriteThumbnailStore(thumbnails);
+        }
+    }
+    delete ds.thumbnail;
+    ds.thumbnail = nullptr;
+}
+
+#define MAX_THUMBNAIL_WORKERS 2
+
+struct ThumbnailRequest {
+    WCHAR* filePath = nullptr;
+    ThumbnailCreatedCb onCreated;
+};
+
+struct ThumbnailQueue {
+    CRITICAL_SECTION access;
+    Vec<ThumbnailRequest*> pending;
+    int nWorkers = 0;
+
+    ThumbnailQueue() {
+        InitializeCriticalSection(&access);
     }
-    AutoFreeWstr thumbsPath(path::GetDir(bmpPath));
-    if (dir::Create(thumbsPath)) {
-        CrashIf(!str::EndsWithI(bmpPath, L".png"));
-        Gdiplus::Bitmap bmp(ds.thumbnail->GetBitmap(), nullptr);
-        CLSID tmpClsid = GetEncoderClsid(L"image/png");
-        bmp.Save(bmpPath.Get(), &tmpClsid, nullptr);
+};
+
+static ThumbnailQueue gThumbnailQueue;
+// only accessed from the UI thread: documents for which a background
+// thumbnail has already been requested (so that each is only tried once)
+static WStrVec gThumbnailsRequested;
+
+static RenderedBitmap* RenderFirstPageThumbnail(EngineBase* engine, Size size) {
+    RectF pageRect = engine->PageMediabox(1);
+    if (pageRect.IsEmpty()) {
+        return nullptr;
+    }
+
+    pageRect = engine->Transform(pageRect, 1, 1.0f, 0);
+    float zoom = size.dx / (float)pageRect.dx;
+    if (pageRect.dy > (float)size.dy / zoom) {
+        pageRect.dy = (float)size.dy / zoom;
     }
+    pageRect = engine->Transform(pageRect, 1, 1.0f, 0, true);
+
+    RenderPageArgs args(1, zoom, 0, &pageRect);
+    return engine->RenderPage(args);
 }
 
-void RemoveThumbnail(DisplayState& ds) {
-    if (!HasThumbnail(ds)) {
+// runs as a Low priority task, i.e. with lowered cpu and i/o priority
+// so that the documents being viewed aren't slowed down
+static void ThumbnailWorker() {
+    ScopedCom com;
+    for (;;) {
+        ThumbnailRequest* req = nullptr;
+        {
+            ScopedCritSec scope(&gThumbnailQueue.access);
+            if (gThumbnailQueue.pending.size() == 0) {
+                gThumbnailQueue.nWorkers--;
+                return;
+            }
+            req = gThumbnailQueue.pending.PopAt(0);
+        }
+
+        // ebook and CHM documents are skipped as they'd have to be laid out
+        // completely; the other engines only parse the pages they render
+        RenderedBitmap* bmp = nullptr;
+        EngineBase* engine = CreateEngine(req->filePath, nullptr, false, false);
+        if (engine) {
+            bmp = RenderFirstPageThumbnail(engine, Size(THUMBNAIL_DX, THUMBNAIL_DY));
+            delete engine;
+        }
+        uitask::Post([=] {
+            req->onCreated(req->filePath, bmp);
+            free(req->filePath);
+            delete req;
+        });
+    }
+}
+
+void CreateThumbnailInBackground(const WCHAR* filePath, const ThumbnailCreatedCb& onCreated) {
+    if (!filePath || gThumbnailsRequested.Contains(filePath)) {
         return;
     }
+    gThumbnailsRequested.Append(str::Dup(filePath));
 
-    AutoFreeWstr bmpPath(GetThumbnailPath(ds.filePath));
-    if (bmpPath) {
-        file::Delete(bmpPath);
+    ThumbnailRequest* req = new ThumbnailRequest();
+    req->filePath = str::Dup(filePath);
+    req->onCreated = onCreated;
+
+    ScopedCritSec scope(&gThumbnailQueue.access);
+    gThumbnailQueue.pending.Append(req);
+    if (gThumbnailQueue.nWorkers >= MAX_THUMBNAIL_WORKERS) {
+        return;
     }
-    delete ds.thumbnail;
-    ds.thumbnail = nullptr;
+    gThumbnailQueue.nWorkers++;
+    RunAsync(ThumbnailWorker, TaskPriority::Low);
 }
@@ -13,3 +13,9 @@ bool HasThumbnail(DisplayState& ds);
 void SetThumbnail(DisplayState* ds, RenderedBitmap* bmp);
 void SaveThumbnail(DisplayState& ds);
 void RemoveThumbnail(DisplayState& ds);
+
+typedef std::function<void(const WCHAR* filePath, RenderedBitmap* bmp)> ThumbnailCreatedCb;
+// renders a thumbnail for a document that isn't loaded on a low priority
+// background worker. onCreated is called on the ui thread (with bmp being
+// nullptr if the document couldn't be rendered) and owns bmp
+void CreateThumbnailInBackground(const WCHAR* filePath, const ThumbnailCreatedCb& onCreated);
@@ -77,7 +77,25 @@ static const char* argNames =
     "new-window\0"
     "log\0"
     "s\0"
-    "silent\0";
+    "silent\0"
+    "batch\0"
+    "batch-workers\0"
+    "automation-pipe\0"
+    "bench-out\0"
+    "bench-runs\0"
+    "bench-warmup\0"
+    "bench-zoom\0"
+    "bench-rotation\0"
+    "bench-search\0"
+    "regress-perf\0"
+    "regress-workers\0"
+    "regress-tolerance\0"
+    "trace\0"
+    "stress-responsiveness\0"
+    "alloc-sample\0"
+    "alloc-sample-interval\0"
+    "export-text\0"
+    "export-text-markers\0";
 
 enum {
     RegisterForPdf,
@@ -142,7 +160,25 @@ enum {
     NewWindow,
     Log,
     Silent2,
-    Silent
+    Silent,
+    Batch,
+    BatchWorkers,
+    AutomationPipe,
+    BenchOut,
+    BenchRuns,
+    BenchWarmup,
+    BenchZoom,
+    BenchRotation,
+    BenchSearch,
+    RegressPerf,
+    RegressWorkers,
+    RegressTolerance,
+    Trace,
+    StressResponsiveness,
+    AllocSample,
+    AllocSampleInterval,
+    ExportText,
+    ExportTextMarkers
 };
 
 Flags::~Flags() {
@@ -157,6 +193,20 @@ Flags::~Flags() {
     free(stressTestFilter);
     free(stressTestRanges);
     free(lang);
+    free(batchAction);
+    free(batchInput);
+    free(batchOutputDir);
+    free(automationPipeName);
+    free(benchOutPath);
+    free(benchZooms);
+    free(benchRotations);
+    free(benchSearchText);
+    free(regressPerfManifest);
+    free(regressPerfBaseline);
+    free(traceFilePath);
+    free(allocSamplePath);
+    free(exportTextSrc);
+    free(exportTextDst);
 }
 
 static void EnumeratePrinters() {
@@ -445,6 +495,10 @@ void ParseCommandLine(const WCHAR* cmdLine, Flags& i) {
             i.withPreview = true;
         } else if (Rand == arg) {
             i.stressRandomizeFiles = true;
+        } else if (StressResponsiveness == arg) {
+            // with -stress-test: script scrolling, zooming and page jumps and
+            // measure how long it takes until they're completely painted
+            i.stressResponsiveness = true;
         } else if (Regress == arg) {
             i.regress = true;
         } else if (AutoUpdate == arg) {
@@ -475,6 +529,57 @@ void ParseCommandLine(const WCHAR* cmdLine, Flags& i) {
             }
             i.pathsToBenchmark.Append(s);
             i.exitImmediately = true;
+        } else if (is_arg_with_param(Batch) && argCount > n + 3) {
+            // -batch <render|text|print> <file, dir or file list> <output dir>
+            // e.g. -batch text C:\docs C:\out  extracts the text of all documents in C:\docs
+            handle_string_param(i.batchAction);
+            handle_string_param(i.batchInput);
+            handle_string_param(i.batchOutputDir);
+        } else if (is_arg_with_param(BatchWorkers)) {
+            handle_int_param(i.batchWorkers);
+        } else if (is_arg_with_param(ExportText) && argCount > n + 2) {
+            // -export-text <document> <file.txt> extracts the pages on -batch-workers threads
+            handle_string_param(i.exportTextSrc);
+            handle_string_param(i.exportTextDst);
+        } else if (ExportTextMarkers == arg) {
+            // precede the text of every page with a "--- Page N ---" line
+            i.exportTextMarkers = true;
+        } else if (is_arg_with_param(AutomationPipe)) {
+            // -automation-pipe <name> accepts commands over \\.\pipe\<name>
+            handle_string_param(i.automationPipeName);
+        } else if (is_arg_with_param(BenchOut)) {
+            // -bench-out <file.json|file.csv> collects -bench statistics into a file
+            handle_string_param(i.benchOutPath);
+        } else if (is_arg_with_param(BenchRuns)) {
+            handle_int_param(i.benchRuns);
+        } else if (is_arg_with_param(BenchWarmup)) {
+            handle_int_param(i.benchWarmupRuns);
+        } else if (is_arg_with_param(BenchZoom)) {
+            // -bench-zoom 100,200 (in percent)
+            handle_string_param(i.benchZooms);
+        } else if (is_arg_with_param(BenchRotation)) {
+            // -bench-rotation 0,90
+            handle_string_param(i.benchRotations);
+        } else if (is_arg_with_param(BenchSearch)) {
+            handle_string_param(i.benchSearchText);
+        } else if (is_arg_with_param(RegressPerf) && argCount > n + 2) {
+            // -regress-perf <corpus manifest> <baseline>
+            handle_string_param(i.regressPerfManifest);
+            handle_string_param(i.regressPerfBaseline);
+            i.regress = true;
+        } else if (is_arg_with_param(RegressWorkers)) {
+            handle_int_param(i.regressWorkers);
+        } else if (is_arg_with_param(RegressTolerance)) {
+            handle_int_param(i.regressTolerance);
+        } else if (is_arg_with_param(Trace)) {
+            // -trace <file.json> records where the time goes (see utils/Trace.h)
+            handle_string_param(i.traceFilePath);
+        } else if (is_arg_with_param(AllocSample)) {
+            // -alloc-sample <report.txt> samples allocations every -alloc-sample-interval KB
+            // and writes the top allocation sites on exit (see utils/AllocSampler.h)
+            handle_string_param(i.allocSamplePath);
+        } else if (is_arg_with_param(AllocSampleInterval)) {
+            handle_int_param(i.allocSampleIntervalKB);
         } else if (CrashOnOpen == arg) {
             // to make testing of crash reporting system in pre-release/release
             // builds possible
@@ -15,6 +15,15 @@ struct Flags {
     //   to benchmark. It can also be a string "loadonly" which means we'll
     //   only benchmark loading of the catalog
     WStrVec pathsToBenchmark;
+    // if set, -bench collects statistics over several runs into this
+    // .json or .csv file (see BenchFileOrDir)
+    WCHAR* benchOutPath = nullptr;
+    int benchRuns = 5;
+    int benchWarmupRuns = 1;
+    // comma-separated lists, nullptr means only 100% resp. 0 degrees
+    WCHAR* benchZooms = nullptr;
+    WCHAR* benchRotations = nullptr;
+    WCHAR* benchSearchText = nullptr;
     bool exitWhenDone = false;
     bool printDialog = false;
     WCHAR* printerName = nullptr;
@@ -39,6 +48,13 @@ struct Flags {
     WCHAR* inverseSearchCmdLine = nullptr;
     bool invertColors = false;
     bool regress = false;
+    // -regress-perf <corpus manifest> <baseline> (see RegressPerf.cpp)
+    WCHAR* regressPerfManifest = nullptr;
+    WCHAR* regressPerfBaseline = nullptr;
+    // 0 means one worker per processor
+    int regressWorkers = 0;
+    // in percent
+    int regressTolerance = 20;
     bool tester = false;
     bool ramicro = false;
     // -new-window, if true and we're using tabs, opens
@@ -53,6 +69,7 @@ struct Flags {
     int stressTestCycles = 1;
     int stressParallelCount = 1;
     bool stressRandomizeFiles = false;
+    bool stressResponsiveness = false;
 
     // related to testing
     bool testRenderPage = false;
@@ -62,6 +79,29 @@ struct Flags {
 
     bool crashOnOpen = false;
 
+    // headless batch processing
+    WCHAR* batchAction = nullptr;
+    WCHAR* batchInput = nullptr;
+    WCHAR* batchOutputDir = nullptr;
+    // 0 means one worker per processor
+    int batchWorkers = 0;
+
+    // writes the text of exportTextSrc to exportTextDst (see TextExport.h)
+    WCHAR* exportTextSrc = nullptr;
+    WCHAR* exportTextDst = nullptr;
+    // also for -batch text
+    bool exportTextMarkers = false;
+
+    // Chrome trace event file written at exit (see utils/Trace.h)
+    WCHAR* traceFilePath = nullptr;
+
+    // allocation sampling report written at exit (see utils/AllocSampler.h)
+    WCHAR* allocSamplePath = nullptr;
+    int allocSampleIntervalKB = 256;
+
+    // name of the pipe accepting automation commands (see AutomationPipe.cpp)
+    WCHAR* automationPipeName = nullptr;
+
     // deprecated flags
     char* lang = nullptr;
     WStrVec globalPrefArgs;
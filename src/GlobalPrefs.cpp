@@ -46,30 +46,48 @@ GlobalPrefs* NewGlobalPrefs(const char* data) {
 }
 
 // prevData is used to preserve fields that exists in prevField but not in GlobalPrefs
+// note: this is called on a background thread (see prefs::Save)
 std::span<u8> SerializeGlobalPrefs(GlobalPrefs* prefs, const char* prevData) {
-    if (!prefs->rememberStatePerDocument || !prefs->rememberOpenedFiles) {
-        for (DisplayState* ds : *prefs->fileStates) {
-            ds->useDefaultState = true;
+    if (prefs->rememberStatePerDocument && prefs->rememberOpenedFiles) {
+        return SerializeStruct(&gGlobalPrefsInfo, prefs, prevData);
+    }
+
+    for (DisplayState* ds : *prefs->fileStates) {
+        ds->useDefaultState = true;
+    }
+    // prevent unnecessary settings from being written out
+    u16 fieldCount = 0;
+    while (++fieldCount <= dimof(gFileStateFields)) {
+        // count the number of fields up to and including useDefaultState
+        if (gFileStateFields[fieldCount - 1].offset == offsetof(FileState, useDefaultState)) {
+            break;
         }
-        // prevent unnecessary settings from being written out
-        u16 fieldCount = 0;
-        while (++fieldCount <= dimof(gFileStateFields)) {
-            // count the number of fields up to and including useDefaultState
-            if (gFileStateFields[fieldCount - 1].offset == offsetof(FileState, useDefaultState)) {
-                break;
-            }
+    }
+    // use modified copies of the struct infos instead of changing
+    // gFileStateInfo which is used concurrently on the UI thread
+    StructInfo fileStateInfo = gFileStateInfo;
+    fileStateInfo.fieldCount = fieldCount;
+    FieldInfo prefsFields[dimof(gGlobalPrefsFields)];
+    for (size_t i = 0; i < dimof(gGlobalPrefsFields); i++) {
+        prefsFields[i] = gGlobalPrefsFields[i];
+        if (prefsFields[i].value == (intptr_t)&gFileStateInfo) {
+            prefsFields[i].value = (intptr_t)&fileStateInfo;
         }
-        // restore the correct fieldCount ASAP after serialization
-        gFileStateInfo.fieldCount = fieldCount;
     }
+    StructInfo prefsInfo = gGlobalPrefsInfo;
+    prefsInfo.fields = prefsFields;
 
-    std::span<u8> serialized = SerializeStruct(&gGlobalPrefsInfo, prefs, prevData);
+    return SerializeStruct(&prefsInfo, prefs, prevData);
+}
 
-    if (!prefs->rememberStatePerDocument || !prefs->rememberOpenedFiles) {
-        gFileStateInfo.fieldCount = dimof(gFileStateFields);
-    }
+// returns nullptr if data isn't a valid snapshot for this build
+GlobalPrefs* NewGlobalPrefsFromBinary(std::span<u8> data) {
+    return (GlobalPrefs*)DeserializeStructBinary(&gGlobalPrefsInfo, data);
+}
 
-    return serialized;
+// note: unlike SerializeGlobalPrefs, this always includes all per-document state
+std::span<u8> SerializeGlobalPrefsBinary(GlobalPrefs* prefs) {
+    return SerializeStructBinary(&gGlobalPrefsInfo, prefs);
 }
 
 void DeleteGlobalPrefs(GlobalPrefs* gp) {
@@ -100,6 +118,23 @@ TabState* NewTabState(DisplayState* ds) {
     return state;
 }
 
+TabState* CloneTabState(TabState* state) {
+    TabState* clone = (TabState*)DeserializeStruct(&gTabStateInfo, nullptr);
+    str::ReplacePtr(&clone->filePath, state->filePath);
+    str::ReplacePtr(&clone->displayMode, state->displayMode);
+    clone->pageNo = state->pageNo;
+    str::ReplacePtr(&clone->zoom, state->zoom);
+    clone->rotation = state->rotation;
+    clone->scrollPos = state->scrollPos;
+    clone->showToc = state->showToc;
+    *clone->tocState = *state->tocState;
+    return clone;
+}
+
+void DeleteTabState(TabState* state) {
+    FreeStruct(&gTabStateInfo, state);
+}
+
 void ResetSessionState(Vec<SessionData*>* sessionData) {
     CrashIf(!sessionData);
     if (!sessionData) {
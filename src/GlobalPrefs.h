@@ -12,7 +12,11 @@ void DeleteFavorite(Favorite* fav);
 GlobalPrefs* NewGlobalPrefs(const char* data);
 std::span<u8> SerializeGlobalPrefs(GlobalPrefs* gp, const char* prevData);
 void DeleteGlobalPrefs(GlobalPrefs* gp);
+GlobalPrefs* NewGlobalPrefsFromBinary(std::span<u8> data);
+std::span<u8> SerializeGlobalPrefsBinary(GlobalPrefs* gp);
 
 SessionData* NewSessionData();
 TabState* NewTabState(DisplayState* ds);
+TabState* CloneTabState(TabState* state);
+void DeleteTabState(TabState* state);
 void ResetSessionState(Vec<SessionData*>* sessionData);
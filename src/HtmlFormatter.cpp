@@ -2,6 +2,7 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/CssParser.h"
@@ -9,6 +10,7 @@
 #include "utils/Log.h"
 #include "mui/Mui.h"
 #include "utils/Timer.h"
+#include "utils/Trace.h"
 
 // rendering engines
 #include "EbookBase.h"
@@ -465,8 +467,8 @@ static RectF RectFUnion(RectF& r1, RectF& r2) {
     return r1.Union(r2);
 }
 
-void HtmlFormatter::UpdateLinkBboxes(HtmlPage* page) {
-    for (DrawInstr& i : page->instructions) {
+void HtmlFormatter::UpdateLinkBboxes(Vec<DrawInstr>& instructions) {
+    for (DrawInstr& i : instructions) {
         if (DrawInstrType::LinkStart != i.type) {
             continue;
         }
@@ -478,13 +480,25 @@ void HtmlFormatter::UpdateLinkBboxes(HtmlPage* page) {
     }
 }
 
+// moves the instructions of the current page into a single allocation
+// from textAllocator and queues the page for sending, so that all pages
+// of a layout can be freed at once together with their text
+void HtmlFormatter::FinishCurrPage() {
+    UpdateLinkBboxes(currPageInstr);
+    size_t n = currPageInstr.size();
+    currPage->instructions.capacityHint = n;
+    currPage->instructions.Append(currPageInstr.LendData(), n);
+    // keep the buffer around for the next page
+    currPageInstr.RemoveAt(0, n);
+    pagesToSend.Append(currPage);
+}
+
 void HtmlFormatter::ForceNewPage() {
     bool createdNewPage = FlushCurrLine(true);
     if (createdNewPage) {
         return;
     }
-    UpdateLinkBboxes(currPage);
-    pagesToSend.Append(currPage);
+    FinishCurrPage();
 
     EmitNewPage();
     currX = NewLineX();
@@ -517,8 +531,7 @@ bool HtmlFormatter::FlushCurrLine(bool isParagraphBreak) {
     if (currY + totalLineDy > pageDy) {
         // current line too big to fit in current page,
         // so need to start another page
-        UpdateLinkBboxes(currPage);
-        pagesToSend.Append(currPage);
+        FinishCurrPage();
         // instructions for each page need to be self-contained
         // so we have to carry over some state (like current font)
         CrashIf(!CurrFont());
@@ -536,8 +549,8 @@ bool HtmlFormatter::FlushCurrLine(bool isParagraphBreak) {
         // TODO: this occasionally leads to empty links
         AppendInstr(DrawInstr(DrawInstrType::LinkEnd));
     }
-    currPage->instructions.Append(currLineInstr.LendData(), currLineInstr.size());
-    currLineInstr.Reset();
+    currPageInstr.Append(currLineInstr.LendData(), currLineInstr.size());
+    currLineInstr.RemoveAt(0, currLineInstr.size());
     currLineReparseIdx = -1; // mark as not set
     currLineTopPadding = 0;
     currX = NewLineX();
@@ -551,8 +564,8 @@ bool HtmlFormatter::FlushCurrLine(bool isParagraphBreak) {
 
 void HtmlFormatter::EmitNewPage() {
     CrashIf(currReparseIdx > INT_MAX);
-    currPage = new HtmlPage((int)currReparseIdx);
-    currPage->instructions.Append(DrawInstr::SetFont(nextPageStyle.font));
+    currPage = new HtmlPage((int)currReparseIdx, textAllocator);
+    currPageInstr.Append(DrawInstr::SetFont(nextPageStyle.font));
     currY = 0.f;
 }
 
@@ -617,7 +630,7 @@ bool HtmlFormatter::EmitImage(ImageData* img) {
         // scale down images that follow right after a line
         // containing a single image as little as possible,
         // as they might be intended to be of the same size
-        if (scale < scalePage && HasPreviousLineSingleImage(currPage->instructions)) {
+        if (scale < scalePage && HasPreviousLineSingleImage(currPageInstr)) {
             ForceNewPage();
             scale = scalePage;
         }
@@ -731,7 +744,7 @@ void HtmlFormatter::EmitTextRun(const char* s, const char* end) {
             break;
         }
         textMeasure->SetFont(CurrFont());
-        RectF bbox = textMeasure->Measure(buf, strLen);
+        RectF bbox = MeasureCached(textMeasure, CurrFont(), buf, strLen);
         if (bbox.dx <= pageDx - currX) {
             AppendInstr(DrawInstr::Str(s, end - s, bbox, dirRtl));
             currX += bbox.dx;
@@ -767,7 +780,7 @@ void HtmlFormatter::EmitTextRun(const char* s, const char* end) {
         }
 
         textMeasure->SetFont(CurrFont());
-        bbox = ToGdipRectF(textMeasure->Measure(buf, lenThatFits));
+        bbox = ToGdipRectF(MeasureCached(textMeasure, CurrFont(), buf, lenThatFits));
         CrashIf(bbox.dx > pageDx);
         // s is UTF-8 and buf is UTF-16, so one
         // WCHAR doesn't always equal one char
@@ -798,7 +811,7 @@ void HtmlFormatter::HandleAnchorAttr(HtmlToken* t, bool idsOnly) {
     RectF bbox(0, currY, pageDx, 0);
     // append at the start of the line to prevent the anchor
     // from being flushed to the next page (with wrong currY value)
-    currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
+    currPageInstr.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
 }
 
 void HtmlFormatter::HandleDirAttr(HtmlToken* t) {
@@ -974,44 +987,97 @@ void HtmlFormatter::HandleTagPre(HtmlToken* t) {
     }
 }
 
+static u32 StyleRuleHash(HtmlTag tag, u32 classHash) {
+    return (classHash ^ ((u32)tag * 0x9E3779B1)) * 0x85EBCA6B;
+}
+
 StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen) {
     u32 classHash = clazz ? MurmurHash2(clazz, clazzLen) : 0;
-    for (size_t i = 0; i < styleRules.size(); i++) {
-        StyleRule& rule = styleRules.at(i);
+    return FindStyleRule(tag, classHash);
+}
+
+StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, u32 classHash) {
+    size_t n = styleRulesIndex.size();
+    if (0 == n) {
+        return nullptr;
+    }
+    // n is a power of 2 and the table is never more than half full
+    size_t i = StyleRuleHash(tag, classHash) & (n - 1);
+    for (int idx = styleRulesIndex.at(i); idx != 0; idx = styleRulesIndex.at(i)) {
+        StyleRule& rule = styleRules.at(idx - 1);
         if (tag == rule.tag && classHash == rule.classHash) {
             return &rule;
         }
+        i = (i + 1) & (n - 1);
     }
     return nullptr;
 }
 
-StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken* t) {
-    StyleRule rule;
-    // get style rules ordered by specificity
-    StyleRule* prevRule = FindStyleRule(Tag_Body, nullptr, 0);
-    if (prevRule) {
-        rule.Merge(*prevRule);
+void HtmlFormatter::AddStyleRuleToIndex(size_t idx) {
+    if (styleRules.size() * 2 > styleRulesIndex.size()) {
+        // grow the table and re-add all rules (including idx)
+        size_t n = std::max(styleRulesIndex.size() * 2, (size_t)64);
+        styleRulesIndex.Reset();
+        styleRulesIndex.AppendBlanks(n);
+        for (size_t i = 0; i < styleRules.size(); i++) {
+            AddStyleRuleToIndex(i);
+        }
+        return;
     }
-    prevRule = FindStyleRule(Tag_Any, nullptr, 0);
-    if (prevRule) {
-        rule.Merge(*prevRule);
+    StyleRule& rule = styleRules.at(idx);
+    size_t n = styleRulesIndex.size();
+    size_t i = StyleRuleHash(rule.tag, rule.classHash) & (n - 1);
+    while (styleRulesIndex.at(i) != 0) {
+        i = (i + 1) & (n - 1);
     }
-    prevRule = FindStyleRule(t->tag, nullptr, 0);
-    if (prevRule) {
-        rule.Merge(*prevRule);
+    styleRulesIndex.at(i) = (int)idx + 1;
+}
+
+void HtmlFormatter::ResetStyleRules() {
+    styleRules.Reset();
+    styleRulesIndex.Reset();
+    for (ComputedStyle& cs : computedStyles) {
+        cs.tag = Tag_NotFound;
     }
+}
+
+StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken* t) {
     // TODO: support multiple class names
     AttrInfo* attr = t->GetAttrByName("class");
-    if (attr) {
-        prevRule = FindStyleRule(Tag_Any, attr->val, attr->valLen);
+    u32 classHash = attr ? MurmurHash2(attr->val, attr->valLen) : 0;
+
+    ComputedStyle& cs = computedStyles[StyleRuleHash(t->tag, classHash) % dimof(computedStyles)];
+    if (cs.tag != t->tag || cs.classHash != classHash) {
+        StyleRule rule;
+        // get style rules ordered by specificity
+        StyleRule* prevRule = FindStyleRule(Tag_Body, 0);
+        if (prevRule) {
+            rule.Merge(*prevRule);
+        }
+        prevRule = FindStyleRule(Tag_Any, 0);
         if (prevRule) {
             rule.Merge(*prevRule);
         }
-        prevRule = FindStyleRule(t->tag, attr->val, attr->valLen);
+        prevRule = FindStyleRule(t->tag, 0);
         if (prevRule) {
             rule.Merge(*prevRule);
         }
+        if (attr) {
+            prevRule = FindStyleRule(Tag_Any, classHash);
+            if (prevRule) {
+                rule.Merge(*prevRule);
+            }
+            prevRule = FindStyleRule(t->tag, classHash);
+            if (prevRule) {
+                rule.Merge(*prevRule);
+            }
+        }
+        cs.tag = t->tag;
+        cs.classHash = classHash;
+        cs.rule = rule;
     }
+
+    StyleRule rule = cs.rule;
     attr = t->GetAttrByName("style");
     if (attr) {
         StyleRule newRule = StyleRule::Parse(attr->val, attr->valLen);
@@ -1036,9 +1102,14 @@ void HtmlFormatter::ParseStyleSheet(const char* data, size_t len) {
                 rule.tag = sel->tag;
                 rule.classHash = sel->clazz ? MurmurHash2(sel->clazz, sel->clazzLen) : 0;
                 styleRules.Append(rule);
+                AddStyleRuleToIndex(styleRules.size() - 1);
             }
         }
     }
+    // rules have changed, so previously computed styles might be outdated
+    for (ComputedStyle& cs : computedStyles) {
+        cs.tag = Tag_NotFound;
+    }
 }
 
 void HtmlFormatter::HandleTagStyle(HtmlToken* t) {
@@ -1336,6 +1407,7 @@ static bool IsEmptyPage(HtmlPage* p) {
 // or more pages, which we remeber and send to the caller
 // if we detect accumulated pages.
 HtmlPage* HtmlFormatter::Next(bool skipEmptyPages) {
+    TRACE_ZONE("HtmlFormatter::Next");
     gAllowAllocFailure++;
     defer {
         gAllowAllocFailure--;
@@ -1375,8 +1447,7 @@ HtmlPage* HtmlFormatter::Next(bool skipEmptyPages) {
     AutoCloseTags(tagNesting.size());
     FlushCurrLine(true);
 
-    UpdateLinkBboxes(currPage);
-    pagesToSend.Append(currPage);
+    FinishCurrPage();
     currPage = nullptr;
     // call ourselves recursively to return accumulated pages
     finishedParsing = true;
@@ -1392,6 +1463,173 @@ Vec<HtmlPage*>* HtmlFormatter::FormatAllPages(bool skipEmptyPages) {
     return pages;
 }
 
+// decoded images are kept around until they exceed this total size
+#define MAX_CACHED_IMAGES_SIZE (64 * 1024 * 1024)
+
+// an image of a DrawInstrType::Image instruction, decoded and scaled
+// down to the (device) size at which it has been drawn
+struct CachedImage {
+    const char* data = nullptr;
+    size_t len = 0;
+    // of the start and end of data, in case data has been reused for another image
+    u32 hash = 0;
+    Size size;
+    Bitmap* bmp = nullptr;
+    size_t memSize = 0;
+    // set while being drawn (GDI+ objects can't be drawn from several threads at once)
+    bool inUse = false;
+};
+
+// shared between the ebook UI and EngineEbook's rendering threads
+struct ImageCache {
+    CRITICAL_SECTION access;
+    // least recently used first
+    Vec<CachedImage*> images;
+    size_t totalSize = 0;
+
+    ImageCache() {
+        InitializeCriticalSection(&access);
+    }
+    ~ImageCache() {
+        for (CachedImage* img : images) {
+            delete img->bmp;
+        }
+        DeleteVecMembers(images);
+        DeleteCriticalSection(&access);
+    }
+};
+
+static ImageCache gImageCache;
+
+static u32 ImageDataHash(ImageData& img) {
+    size_t n = std::min(img.len, (size_t)1024);
+    u32 hash = MurmurHash2(img.data, n);
+    return hash ^ MurmurHash2(img.data + img.len - n, n);
+}
+
+// must be called with gImageCache.access held
+static void FreeCachedImagesOverLimit(size_t maxSize = MAX_CACHED_IMAGES_SIZE) {
+    for (size_t i = 0; i < gImageCache.images.size() && gImageCache.totalSize > maxSize;) {
+        CachedImage* img = gImageCache.images.at(i);
+        if (img->inUse) {
+            i++;
+            continue;
+        }
+        gImageCache.images.RemoveAt(i);
+        gImageCache.totalSize -= img->memSize;
+        delete img->bmp;
+        delete img;
+    }
+}
+
+// decodes the image at no more than the size it'll be drawn at
+static Bitmap* DecodeImage(ImageData& img, Size size) {
+    Size imgSize = BitmapSizeFromData(img.AsSpan());
+    // JPEG images can be decoded at 1/2, 1/4 or 1/8 of their size much faster
+    int l2factor = 0;
+    while (l2factor < 3 && (imgSize.dx >> (l2factor + 1)) >= size.dx && (imgSize.dy >> (l2factor + 1)) >= size.dy) {
+        l2factor++;
+    }
+    Bitmap* bmp = BitmapFromDataReduced(img.AsSpan(), l2factor);
+    if (!bmp) {
+        bmp = BitmapFromData(img.AsSpan());
+    }
+    if (!bmp || ((int)bmp->GetWidth() <= size.dx && (int)bmp->GetHeight() <= size.dy)) {
+        return bmp;
+    }
+    Bitmap* scaled = new Bitmap(size.dx, size.dy, PixelFormat32bppPARGB);
+    Graphics g(scaled);
+    g.SetInterpolationMode(InterpolationModeHighQualityBicubic);
+    g.SetPixelOffsetMode(Gdiplus::PixelOffsetModeHalf);
+    Gdiplus::Rect r(0, 0, size.dx, size.dy);
+    Status status = g.DrawImage(bmp, r, 0, 0, (int)bmp->GetWidth(), (int)bmp->GetHeight(), UnitPixel);
+    delete bmp;
+    if (status != Ok) {
+        delete scaled;
+        return nullptr;
+    }
+    return scaled;
+}
+
+// returns the decoded image (from the cache if possible) which must
+// be released with ReleaseImage once it has been drawn
+static CachedImage* GetImage(ImageData& img, Size size) {
+    u32 hash = ImageDataHash(img);
+    {
+        ScopedCritSec scope(&gImageCache.access);
+        for (size_t i = 0; i < gImageCache.images.size(); i++) {
+            CachedImage* cached = gImageCache.images.at(i);
+            if (cached->data == img.data && cached->len == img.len && cached->hash == hash && cached->size == size &&
+                !cached->inUse) {
+                cached->inUse = true;
+                // move to the end as the most recently used image
+                gImageCache.images.RemoveAt(i);
+                gImageCache.images.Append(cached);
+                return cached;
+            }
+        }
+    }
+
+    Bitmap* bmp = DecodeImage(img, size);
+    if (!bmp) {
+        return nullptr;
+    }
+    CachedImage* cached = new CachedImage();
+    cached->data = img.data;
+    cached->len = img.len;
+    cached->hash = hash;
+    cached->size = size;
+    cached->bmp = bmp;
+    cached->memSize = (size_t)bmp->GetWidth() * bmp->GetHeight() * 4;
+    cached->inUse = true;
+    if (cached->memSize <= MAX_CACHED_IMAGES_SIZE) {
+        ScopedCritSec scope(&gImageCache.access);
+        gImageCache.images.Append(cached);
+        gImageCache.totalSize += cached->memSize;
+    }
+    return cached;
+}
+
+static void ReleaseImage(CachedImage* cached) {
+    ScopedCritSec scope(&gImageCache.access);
+    cached->inUse = false;
+    if (!gImageCache.images.Contains(cached)) {
+        // too large to be cached
+        delete cached->bmp;
+        delete cached;
+        return;
+    }
+    FreeCachedImagesOverLimit();
+}
+
+void FreeCachedHtmlImages() {
+    ScopedCritSec scope(&gImageCache.access);
+    FreeCachedImagesOverLimit(0);
+}
+
+static void DrawImageInstr(Graphics* g, DrawInstr& i, RectF bbox) {
+    // the size at which the image will end up on the screen
+    Gdiplus::Matrix m;
+    g->GetTransform(&m);
+    Gdiplus::PointF v[2] = {Gdiplus::PointF(bbox.dx, 0), Gdiplus::PointF(0, bbox.dy)};
+    m.TransformVectors(v, 2);
+    Size size((int)ceilf(hypotf(v[0].X, v[0].Y)), (int)ceilf(hypotf(v[1].X, v[1].Y)));
+    if (size.IsEmpty()) {
+        return;
+    }
+
+    CachedImage* img = GetImage(i.img, size);
+    if (!img) {
+        return;
+    }
+    Bitmap* bmp = img->bmp;
+    Status status =
+        g->DrawImage(bmp, ToGdipRectF(bbox), 0, 0, (float)bmp->GetWidth(), (float)bmp->GetHeight(), UnitPixel);
+    // GDI+ sometimes seems to succeed in loading an image because it lazily decodes it
+    CrashIf(status != Ok && status != Win32Error);
+    ReleaseImage(img);
+}
+
 // TODO: draw link in the appropriate format (blue text, underlined, should show hand cursor when
 // mouse is over a link. There's a slight complication here: we only get explicit information about
 // strings, not about the whitespace and we should underline the whitespace as well. Also the text
@@ -1450,15 +1688,7 @@ void DrawHtmlPage(Graphics* g, mui::ITextRender* textDraw, Vec<DrawInstr>* drawI
             status = g->DrawLine(&linePen, p1, p2);
             CrashIf(status != Ok);
         } else if (DrawInstrType::Image == i.type) {
-            // TODO: cache the bitmap somewhere (?)
-            Bitmap* bmp = BitmapFromData(i.img.AsSpan());
-            if (bmp) {
-                status = g->DrawImage(bmp, ToGdipRectF(bbox), 0, 0, (float)bmp->GetWidth(), (float)bmp->GetHeight(),
-                                      UnitPixel);
-                // GDI+ sometimes seems to succeed in loading an image because it lazily decodes it
-                CrashIf(status != Ok && status != Win32Error);
-            }
-            delete bmp;
+            DrawImageInstr(g, i, bbox);
         } else if (DrawInstrType::LinkStart == i.type) {
             // TODO: set text color to blue
             float y = floorf(bbox.y + bbox.dy + 0.5f);
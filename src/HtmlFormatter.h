@@ -123,6 +123,13 @@ struct StyleRule {
     static StyleRule Parse(const char* s, size_t len);
 };
 
+// StyleRule merged from all rules applying to a tag with a given class
+struct ComputedStyle {
+    HtmlTag tag = Tag_NotFound;
+    u32 classHash{0};
+    StyleRule rule;
+};
+
 struct DrawStyle {
     mui::CachedFont* font{nullptr};
     AlignAttr align{Align_NotFound};
@@ -130,9 +137,12 @@ struct DrawStyle {
 };
 
 struct HtmlPage {
-    explicit HtmlPage(int reparseIdx = 0) : reparseIdx(reparseIdx) {
+    explicit HtmlPage(int reparseIdx = 0, Allocator* allocator = nullptr)
+        : instructions(0, allocator), reparseIdx(reparseIdx) {
     }
 
+    // allocated from HtmlFormatterArgs::textAllocator (if set), which
+    // thus has to outlive the page
     Vec<DrawInstr> instructions;
     // if we start parsing html again from reparseIdx, we should
     // get the same instructions. reparseIdx is an offset within
@@ -216,7 +226,8 @@ class HtmlFormatter {
     void JustifyLineBoth();
     void JustifyCurrLine(AlignAttr align);
     bool FlushCurrLine(bool isParagraphBreak);
-    void UpdateLinkBboxes(HtmlPage* page);
+    void UpdateLinkBboxes(Vec<DrawInstr>& instructions);
+    void FinishCurrPage();
 
     bool EmitImage(ImageData* img);
     void EmitHr();
@@ -241,7 +252,10 @@ class HtmlFormatter {
     void RevertStyleChange();
 
     void ParseStyleSheet(const char* data, size_t len);
+    void ResetStyleRules();
     StyleRule* FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen);
+    StyleRule* FindStyleRule(HtmlTag tag, u32 classHash);
+    void AddStyleRuleToIndex(size_t idx);
     StyleRule ComputeStyleRule(HtmlToken* t);
 
     void AppendInstr(DrawInstr di);
@@ -282,12 +296,20 @@ class HtmlFormatter {
     bool keepTagNesting{false};
     // set from CSS and to be checked by the individual tag handlers
     Vec<StyleRule> styleRules;
+    // hash table for looking up styleRules by tag and class hash
+    // contains index + 1 of a rule, 0 for empty slots
+    Vec<int> styleRulesIndex;
+    // results of ComputeStyleRule (without the style attribute) by tag and class
+    ComputedStyle computedStyles[64];
 
     // isntructions for the current line
     Vec<DrawInstr> currLineInstr;
     // reparse point of the first instructions in a current line
     ptrdiff_t currLineReparseIdx{0};
     HtmlPage* currPage{nullptr};
+    // instructions for currPage, copied to it once it's complete
+    // (reused for all pages to avoid reallocations while formatting)
+    Vec<DrawInstr> currPageInstr;
 
     // for tracking whether we're currently inside <a> tag
     size_t currLinkIdx{0};
@@ -319,6 +341,8 @@ class HtmlFormatter {
 
 void DrawHtmlPage(Graphics* g, mui::ITextRender* textDraw, Vec<DrawInstr>* drawInstructions, float offX, float offY,
                   bool showBbox, Color textColor, bool* abortCookie = nullptr);
+// frees the decoded images DrawHtmlPage keeps cached (except for those currently being drawn)
+void FreeCachedHtmlImages();
 
 mui::TextRenderMethod GetTextRenderMethod();
 void SetTextRenderMethod(mui::TextRenderMethod method);
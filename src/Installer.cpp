@@ -14,6 +14,7 @@
 #include "utils/Log.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/ThreadUtil.h"
 #include "utils/CmdLineParser.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/ByteOrderDecoder.h"
@@ -107,30 +108,130 @@ static void CreateButtonExit(HWND hwndParent) {
     gButtonExit->onClicked = OnButtonExit;
 }
 
-bool ExtractFiles(lzma::SimpleArchive* archive, const WCHAR* destDir) {
-    lzma::FileInfo* fi;
-    u8* uncompressed;
+struct ExtractedChunk {
+    lzma::ChunkInfo info;
+    OVERLAPPED overlapped = {};
+    bool decompressed = false;
+    bool writeStarted = false;
+};
+
+struct ExtractedFile {
+    lzma::FileInfo* fi = nullptr;
+    AutoFreeWstr path;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    u8* data = nullptr;
+    Vec<ExtractedChunk*> chunks;
+    bool writeOk = false;
+
+    ~ExtractedFile() {
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
+        }
+        for (ExtractedChunk* chunk : chunks) {
+            if (chunk->overlapped.hEvent) {
+                CloseHandle(chunk->overlapped.hEvent);
+            }
+        }
+        DeleteVecMembers(chunks);
+        free(data);
+    }
+};
+
+// decompresses a chunk and starts writing it to disk without waiting for the write to finish
+static void ExtractChunk(ExtractedFile* f, ExtractedChunk* chunk) {
+    chunk->decompressed = lzma::DecompressChunk(&chunk->info, f->data, nullptr);
+    if (!chunk->decompressed || 0 == chunk->info.uncompressedSize) {
+        return;
+    }
+    chunk->overlapped.Offset = chunk->info.uncompressedOffset;
+    chunk->overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!chunk->overlapped.hEvent) {
+        return;
+    }
+    const u8* d = f->data + chunk->info.uncompressedOffset;
+    BOOL ok = WriteFile(f->hFile, d, chunk->info.uncompressedSize, nullptr, &chunk->overlapped);
+    chunk->writeStarted = ok || GetLastError() == ERROR_IO_PENDING;
+}
+
+// waits for all writes of a file's chunks to finish
+static bool FinishWritingFile(ExtractedFile* f) {
+    bool ok = true;
+    for (ExtractedChunk* chunk : f->chunks) {
+        if (0 == chunk->info.uncompressedSize) {
+            continue;
+        }
+        DWORD written = 0;
+        if (!chunk->writeStarted || !GetOverlappedResult(f->hFile, &chunk->overlapped, &written, TRUE) ||
+            written != chunk->info.uncompressedSize) {
+            ok = false;
+        }
+    }
+    return ok;
+}
 
+// big files are split into chunks which are decompressed in parallel on the thread pool
+// and written with overlapped I/O as soon as they've been decompressed
+bool ExtractFiles(lzma::SimpleArchive* archive, const WCHAR* destDir) {
     int nFiles = archive->filesCount;
+    const WCHAR* corruptedMsg =
+        _TR("The installer has been corrupted. Please download it again.\nSorry for the inconvenience!");
 
+    Vec<ExtractedFile*> files;
+    defer {
+        DeleteVecMembers(files);
+    };
     for (int i = 0; i < nFiles; i++) {
-        fi = &archive->files[i];
-        uncompressed = lzma::GetFileDataByIdx(archive, i, nullptr);
+        ExtractedFile* f = new ExtractedFile();
+        files.Append(f);
+        f->fi = &archive->files[i];
+        AutoFreeWstr fileName = strconv::Utf8ToWstr(f->fi->name);
+        f->path.Set(path::Join(destDir, fileName));
+
+        Vec<lzma::ChunkInfo> chunks;
+        f->data = AllocArray<u8>(f->fi->uncompressedSize + 1);
+        if (!f->data || !lzma::GetFileChunks(f->fi, chunks)) {
+            NotifyFailed(corruptedMsg);
+            return false;
+        }
+        for (lzma::ChunkInfo& info : chunks) {
+            ExtractedChunk* chunk = new ExtractedChunk();
+            chunk->info = info;
+            f->chunks.Append(chunk);
+        }
 
-        if (!uncompressed) {
-            NotifyFailed(
-                _TR("The installer has been corrupted. Please download it again.\nSorry for the inconvenience!"));
+        DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED;
+        f->hFile = CreateFileW(f->path, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, flags, nullptr);
+        if (f->hFile == INVALID_HANDLE_VALUE) {
+            WCHAR* msg = str::Format(_TR("Couldn't write %s to disk"), f->path.Get());
+            NotifyFailed(msg);
+            free(msg);
             return false;
         }
-        AutoFreeWstr fileName = strconv::Utf8ToWstr(fi->name);
-        AutoFreeWstr filePath = path::Join(destDir, fileName);
+    }
 
-        std::span<u8> d = {uncompressed, fi->uncompressedSize};
-        bool ok = file::WriteFile(filePath, d);
-        free(uncompressed);
+    TaskGroup tasks;
+    for (ExtractedFile* f : files) {
+        for (ExtractedChunk* chunk : f->chunks) {
+            tasks.Run([f, chunk] { ExtractChunk(f, chunk); }, TaskPriority::High);
+        }
+    }
+    tasks.Join();
+    // the data must stay around until it has been written
+    for (ExtractedFile* f : files) {
+        f->writeOk = FinishWritingFile(f);
+    }
 
-        if (!ok) {
-            WCHAR* msg = str::Format(_TR("Couldn't write %s to disk"), filePath.data);
+    for (ExtractedFile* f : files) {
+        bool dataOk = true;
+        for (ExtractedChunk* chunk : f->chunks) {
+            dataOk &= chunk->decompressed;
+        }
+        if (!dataOk || !lzma::VerifyFileData(f->fi, f->data)) {
+            NotifyFailed(corruptedMsg);
+            return false;
+        }
+        if (!f->writeOk) {
+            WCHAR* msg = str::Format(_TR("Couldn't write %s to disk"), f->path.Get());
             NotifyFailed(msg);
             free(msg);
             return false;
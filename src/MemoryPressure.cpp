@@ -0,0 +1,81 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/WinUtil.h"
+#include "utils/UITask.h"
+#include "utils/Log.h"
+
+#include "MemoryPressure.h"
+
+// while memory stays low, trim again at most this often
+constexpr DWORD kLowMemoryRetrimMs = 30 * 1000;
+
+struct CacheTrimmer {
+    CacheTier tier;
+    CacheTrimmerFunc trimmer;
+};
+
+static Vec<CacheTrimmer> gCacheTrimmers;
+
+static HANDLE gLowMemoryNotification = nullptr;
+static HANDLE gMonitorThread = nullptr;
+static HANDLE gMonitorStopEvent = nullptr;
+
+void RegisterCacheTrimmer(CacheTier tier, CacheTrimmerFunc trimmer) {
+    // keep the trimmers sorted by tier (and by registration within a tier)
+    size_t idx = 0;
+    while (idx < gCacheTrimmers.size() && gCacheTrimmers.at(idx).tier <= tier) {
+        idx++;
+    }
+    gCacheTrimmers.InsertAt(idx, {tier, trimmer});
+}
+
+void TrimCaches(TrimLevel level) {
+    logf("TrimCaches: level %d\n", (int)level);
+    for (CacheTrimmer& t : gCacheTrimmers) {
+        t.trimmer(level);
+    }
+}
+
+static DWORD WINAPI MemoryPressureThread(void*) {
+    SetThreadName(GetCurrentThreadId(), "MemoryPressure");
+    HANDLE handles[2] = {gMonitorStopEvent, gLowMemoryNotification};
+    for (;;) {
+        DWORD res = WaitForMultipleObjects(dimof(handles), handles, FALSE, INFINITE);
+        if (res != WAIT_OBJECT_0 + 1) {
+            return 0;
+        }
+        uitask::PostCoalesced(&gLowMemoryNotification, [] { TrimCaches(TrimLevel::LowMemory); });
+        // the notification stays signaled for as long as memory is low
+        if (WaitForSingleObject(gMonitorStopEvent, kLowMemoryRetrimMs) != WAIT_TIMEOUT) {
+            return 0;
+        }
+    }
+}
+
+void StartMemoryPressureMonitor() {
+    if (gMonitorThread) {
+        return;
+    }
+    gLowMemoryNotification = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+    gMonitorStopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (gLowMemoryNotification && gMonitorStopEvent) {
+        gMonitorThread = CreateThread(nullptr, 0, MemoryPressureThread, nullptr, 0, nullptr);
+    }
+    if (!gMonitorThread) {
+        StopMemoryPressureMonitor();
+    }
+}
+
+void StopMemoryPressureMonitor() {
+    if (gMonitorThread) {
+        SetEvent(gMonitorStopEvent);
+        WaitForSingleObject(gMonitorThread, INFINITE);
+        CloseHandle(gMonitorThread);
+        gMonitorThread = nullptr;
+    }
+    SafeCloseHandle(&gLowMemoryNotification);
+    SafeCloseHandle(&gMonitorStopEvent);
+}
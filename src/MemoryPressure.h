@@ -0,0 +1,38 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// lets caches give up their contents when SumatraPDF goes into the background
+// or the system runs low on memory (instead of making the OS page hard)
+
+// how much is trimmed, in increasing order
+enum class TrimLevel {
+    // no window is active: free what isn't needed by any visible document
+    Inactive,
+    // all windows are minimized
+    Minimized,
+    // the system is low on memory: free everything not needed for painting
+    LowMemory,
+};
+
+// caches are trimmed in this order (the cheapest to get back first)
+enum class CacheTier {
+    // decoded images of ebooks
+    EbookImages,
+    // extracted text of pages (often still available from the disk text index)
+    DocumentText,
+    // decoded images, fonts and display lists kept by the engines
+    EngineResources,
+    // rendered tiles of pages that aren't visible
+    RenderedTiles,
+};
+
+typedef void (*CacheTrimmerFunc)(TrimLevel level);
+
+// must be called from the ui thread (as are the trimmers)
+void RegisterCacheTrimmer(CacheTier tier, CacheTrimmerFunc trimmer);
+void TrimCaches(TrimLevel level);
+
+// calls TrimCaches(TrimLevel::LowMemory) on the ui thread whenever the
+// system signals low memory (see CreateMemoryResourceNotification)
+void StartMemoryPressureMonitor();
+void StopMemoryPressureMonitor();
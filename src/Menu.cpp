@@ -9,6 +9,7 @@
 #include "utils/BitManip.h"
 #include "utils/Dpi.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/ThreadUtil.h"
 #include "mui/Mui.h"
 #include "utils/WinUtil.h"
 
@@ -38,11 +39,15 @@
 #include "ExternalViewers.h"
 #include "Favorites.h"
 #include "FileThumbnails.h"
+#include "DiskTileCache.h"
+#include "DiskTextIndex.h"
+#include "ContentBoxCache.h"
 #include "Menu.h"
 #include "Selection.h"
 #include "SumatraAbout.h"
 #include "SumatraDialogs.h"
 #include "Translations.h"
+#include "PageThumbnails.h"
 #include "TocEditor.h"
 #include "EditAnnotations.h"
 
@@ -142,6 +147,7 @@ static MenuDef menuDefView[] = {
     { _TRN("F&ullscreen\tF11"),             CmdViewFullScreen,        MF_REQ_FULLSCREEN },
     { SEP_ITEM,                             0,                        MF_REQ_FULLSCREEN },
     { _TRN("Show Book&marks\tF12"),         CmdViewBookmarks,         0 },
+    { _TRN("Show T&humbnails\tShift+F12"),  CmdViewThumbnails,        MF_NOT_FOR_CHM | MF_NOT_FOR_EBOOK_UI },
     { _TRN("Show &Toolbar\tF8"),            CmdViewShowHideToolbar,   MF_NOT_FOR_EBOOK_UI },
     { _TRN("Show Scr&ollbars"),             CmdViewShowHideScrollbars,MF_NOT_FOR_CHM | MF_NOT_FOR_EBOOK_UI },
     { SEP_ITEM,                             0,                        MF_REQ_ALLOW_COPY | MF_NOT_FOR_EBOOK_UI },
@@ -163,6 +169,9 @@ static MenuDef menuDefGoTo[] = {
     { _TRN("F&orward\tAlt+Right Arrow"),    CmdGoToNavForward,       0 },
     { SEP_ITEM,                             0,                       MF_NOT_FOR_EBOOK_UI },
     { _TRN("Fin&d...\tCtrl+F"),             CmdFindFirst,            MF_NOT_FOR_EBOOK_UI },
+    { _TRN("Find &All...\tCtrl+Shift+F"),   CmdFindAll,              MF_NOT_FOR_EBOOK_UI | MF_NOT_FOR_CHM },
+    { _TRN("Find in All Op&en Documents..."), CmdFindInOpenDocuments, MF_NOT_FOR_EBOOK_UI | MF_NOT_FOR_CHM },
+    { _TRN("Find in Folde&r..."),           CmdFindInFolder,         MF_NOT_FOR_EBOOK_UI | MF_NOT_FOR_CHM | MF_REQ_DISK_ACCESS },
     { 0, 0, 0 },
 };
 //] ACCESSKEY_GROUP GoTo Menu
@@ -237,6 +246,10 @@ static MenuDef menuDefDebug[] = {
     { "Download symbols",                   CmdDebugDownloadSymbols,  MF_NO_TRANSLATE },
     { "Test app",                           CmdDebugTestApp,          MF_NO_TRANSLATE },
     { "Show notification",                  CmdDebugShowNotif,        MF_NO_TRANSLATE },
+    { "Show render queue stats",            CmdDebugRenderStats,      MF_NO_TRANSLATE },
+    { "Show performance HUD",               CmdDebugTogglePerfHud,    MF_NO_TRANSLATE },
+    { "Show memory usage",                  CmdDebugShowMemory,       MF_NO_TRANSLATE },
+    { "Write allocation samples",           CmdDebugAllocSamples,     MF_NO_TRANSLATE },
     { 0, 0, 0 },
 };
 //] ACCESSKEY_GROUP Debug Menu
@@ -549,6 +562,7 @@ static void MenuUpdateStateForWindow(WindowInfo* win) {
     static int menusToDisableIfNoDocument[] = {
         CmdViewRotateLeft, CmdViewRotateRight,      CmdGoToNextPage,     CmdGoToPrevPage,  CmdGoToFirstPage,
         CmdGoToLastPage,   CmdGoToNavBack,          CmdGoToNavForward,   CmdGoToPage,      CmdFindFirst,
+        CmdFindAll,        CmdFindInOpenDocuments,  CmdFindInFolder,
         CmdSaveAs,         CmdSaveAsBookmark,       CmdSendByEmail,      CmdSelectAll,     CmdCopySelection,
         CmdProperties,     CmdViewPresentationMode, CmdOpenWithAcrobat,  CmdOpenWithFoxIt, CmdOpenWithPdfXchange,
         CmdRenameFile,     CmdShowInFolder,         CmdDebugAnnotations,
@@ -580,7 +594,9 @@ static void MenuUpdateStateForWindow(WindowInfo* win) {
 
     bool documentSpecific = win->IsDocLoaded();
     bool checked = documentSpecific ? win->tocVisible : gGlobalPrefs->showToc;
-    win::menu::SetChecked(win->menu, CmdViewBookmarks, checked);
+    win::menu::SetChecked(win->menu, CmdViewBookmarks, checked && !IsShowingThumbnails(win));
+    win::menu::SetEnabled(win->menu, CmdViewThumbnails, win->AsFixed() != nullptr);
+    win::menu::SetChecked(win->menu, CmdViewThumbnails, IsShowingThumbnails(win));
 
     win::menu::SetChecked(win->menu, CmdFavoriteToggle, gGlobalPrefs->showFavorites);
     win::menu::SetChecked(win->menu, CmdViewShowHideToolbar, gGlobalPrefs->showToolbar);
@@ -612,6 +628,10 @@ static void MenuUpdateStateForWindow(WindowInfo* win) {
     EngineBase* engine = dm ? dm->GetEngine() : nullptr;
     if (engine) {
         win::menu::SetEnabled(win->menu, CmdFindFirst, !engine->IsImageCollection());
+        win::menu::SetEnabled(win->menu, CmdFindAll, !engine->IsImageCollection());
+        // the text to search for is taken from the current document's find box
+        win::menu::SetEnabled(win->menu, CmdFindInOpenDocuments, !engine->IsImageCollection());
+        win::menu::SetEnabled(win->menu, CmdFindInFolder, !engine->IsImageCollection());
     }
 
     if (win->IsDocLoaded() && !fileExists) {
@@ -624,6 +644,7 @@ static void MenuUpdateStateForWindow(WindowInfo* win) {
 #endif
 
     win::menu::SetChecked(win->menu, CmdDebugShowLinks, gDebugShowLinks);
+    win::menu::SetChecked(win->menu, CmdDebugTogglePerfHud, gShowPerfHud);
     win::menu::SetChecked(win->menu, CmdDebugEbookUI, gGlobalPrefs->ebookUI.useFixedPageUI);
     win::menu::SetChecked(win->menu, CmdDebugMui, mui::IsDebugPaint());
     win::menu::SetEnabled(win->menu, CmdDebugAnnotations,
@@ -658,7 +679,7 @@ void OnAboutContextMenu(WindowInfo* win, int x, int y) {
 
     if (CmdOpenSelectedDocument == cmd) {
         LoadArgs args(filePath, win);
-        LoadDocument(args);
+        LoadDocumentAsync(args);
         return;
     }
 
@@ -670,6 +691,9 @@ void OnAboutContextMenu(WindowInfo* win, int x, int y) {
     }
 
     if (CmdForgetSelectedDocument == cmd) {
+        RemoveDiskTiles(filePath);
+        RemoveDiskTextIndex(filePath);
+        RemoveDiskContentBoxes(filePath);
         if (state->favorites->size() > 0) {
             // just hide documents with favorites
             gFileHistory.MarkFileInexistent(state->filePath, true);
@@ -2,7 +2,6 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
-#include "utils/BitReader.h"
 #include "utils/ByteOrderDecoder.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
@@ -190,9 +189,25 @@ static_assert(kCdicHeaderLen == sizeof(CdicHeader), "wrong size of CdicHeader st
 
 #define kCdicsMax 32
 
+// codes of up to this many bits are decoded with a single lookup in codeTable
+#define kCodeTableBits 12
+
+// a dictionary entry which is itself compressed, expanded by DecodeOne
+struct HuffDicExpansion {
+    // offset within HuffDicDecompressor::expanded + 1
+    // (0 if it hasn't been expanded yet, kExpanding while it's being expanded)
+    u32 start;
+    u32 len;
+};
+
+#define kExpanding ((u32)-1)
+
 class HuffDicDecompressor {
     u32 cacheTable[kCacheItemCount] = {};
     u32 baseTable[kBaseTableItemCount] = {};
+    // for all values of the next kCodeTableBits bits: the code they start with
+    // in the upper 24 bits and its length in the lower 8 bits (0 if it's longer)
+    u32 codeTable[1 << kCodeTableBits] = {};
 
     size_t dictsCount = 0;
     // owned by the creator (in our case: by the PdbReader)
@@ -201,7 +216,12 @@ class HuffDicDecompressor {
 
     u32 codeLength = 0;
 
-    Vec<u32> recursionGuard;
+    // dictionary entries are mostly expanded many times, so they're only decompressed
+    // once; expansions is indexed by the full code (i.e. including the dict)
+    Vec<HuffDicExpansion> expansions;
+    str::Str expanded;
+
+    bool DecodeCode(u32 bits, u32* codeLenOut, u32* codeOut) const;
 
   public:
     HuffDicDecompressor();
@@ -221,7 +241,24 @@ bool HuffDicDecompressor::DecodeOne(u32 code, str::Str& dst) {
         logf("invalid dict value\n");
         return false;
     }
+    if (expansions.size() == 0) {
+        expansions.AppendBlanks(dictsCount << codeLength);
+    }
+    HuffDicExpansion* exp = &expansions.at(code);
+    if (kExpanding == exp->start) {
+        logf("infinite recursion\n");
+        return false;
+    }
+    if (exp->start != 0) {
+        dst.Append(expanded.Get() + exp->start - 1, exp->len);
+        return true;
+    }
+
     code &= ((1 << (codeLength)) - 1);
+    if ((u32)code * 2 + 2 > dictSize[dict]) {
+        logf("invalid code\n");
+        return false;
+    }
     u16 offset = UInt16BE(dicts[dict] + code * 2);
 
     if ((u32)offset + 2 > dictSize[dict]) {
@@ -235,80 +272,104 @@ bool HuffDicDecompressor::DecodeOne(u32 code, str::Str& dst) {
         return false;
     }
 
-    if (!(symLen & 0x8000)) {
-        if (recursionGuard.Contains(code)) {
-            logf("infinite recursion\n");
-            return false;
-        }
-        recursionGuard.Append(code);
-        if (!Decompress(p, symLen, dst)) {
-            return false;
-        }
-        recursionGuard.Pop();
-    } else {
+    if (symLen & 0x8000) {
         symLen &= 0x7fff;
         if (symLen > 127) {
             logf("symLen too big\n");
             return false;
         }
         dst.Append((char*)p, symLen);
+        return true;
     }
+
+    exp->start = kExpanding;
+    size_t dstLen = dst.size();
+    if (!Decompress(p, symLen, dst)) {
+        exp->start = 0;
+        return false;
+    }
+    // note: exp is still valid, as expansions doesn't grow
+    exp->start = (u32)expanded.size() + 1;
+    exp->len = (u32)(dst.size() - dstLen);
+    expanded.Append(dst.Get() + dstLen, exp->len);
+    return true;
+}
+
+// decodes the code at the start of bits (with the first bit being the highest one)
+bool HuffDicDecompressor::DecodeCode(u32 bits, u32* codeLenOut, u32* codeOut) const {
+    u32 v = cacheTable[bits >> 24];
+    u32 codeLen = v & 0x1f;
+    if (!codeLen) {
+        return false;
+    }
+    bool isTerminal = (v & 0x80) != 0;
+
+    u32 code;
+    if (isTerminal) {
+        code = (v >> 8) - (bits >> (32 - codeLen));
+    } else {
+        u32 baseVal;
+        codeLen -= 1;
+        do {
+            codeLen++;
+            if (codeLen > 32) {
+                return false;
+            }
+            baseVal = baseTable[codeLen * 2 - 2];
+            code = (bits >> (32 - codeLen));
+        } while (baseVal > code);
+        code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
+    }
+    *codeLenOut = codeLen;
+    *codeOut = code;
     return true;
 }
 
 bool HuffDicDecompressor::Decompress(u8* src, size_t srcSize, str::Str& dst) {
-    u32 bitsConsumed = 0;
+    // the upcoming bits, starting with the highest one (and
+    // followed by zeros after the end of src)
+    u64 buf = 0;
+    u32 bufBits = 0;
+    size_t nextByte = 0;
+    size_t bitsLeft = srcSize * 8;
     u32 bits = 0;
 
-    BitReader br(src, srcSize);
-
-    for (;;) {
-        if (bitsConsumed > br.BitsLeft()) {
-            logf("not enough data\n");
-            return false;
-        }
-        br.Eat(bitsConsumed);
-        if (0 == br.BitsLeft()) {
-            break;
+    while (bitsLeft > 0) {
+        while (bufBits <= 56) {
+            u64 b = nextByte < srcSize ? src[nextByte] : 0;
+            buf |= b << (56 - bufBits);
+            nextByte++;
+            bufBits += 8;
         }
-
-        bits = br.Peek(32);
-        if (br.BitsLeft() < 8 && 0 == bits) {
+        bits = (u32)(buf >> 32);
+        if (bitsLeft < 8 && 0 == bits) {
             break;
         }
-        u32 v = cacheTable[bits >> 24];
-        u32 codeLen = v & 0x1f;
-        if (!codeLen) {
-            logf("corrupted table, zero code len\n");
-            return false;
-        }
-        bool isTerminal = (v & 0x80) != 0;
 
+        u32 codeLen;
         u32 code;
-        if (isTerminal) {
-            code = (v >> 8) - (bits >> (32 - codeLen));
-        } else {
-            u32 baseVal;
-            codeLen -= 1;
-            do {
-                codeLen++;
-                if (codeLen > 32) {
-                    logf("code len > 32 bits\n");
-                    return false;
-                }
-                baseVal = baseTable[codeLen * 2 - 2];
-                code = (bits >> (32 - codeLen));
-            } while (baseVal > code);
-            code = baseTable[codeLen * 2 - 1] - (bits >> (32 - codeLen));
+        u32 entry = codeTable[bits >> (32 - kCodeTableBits)];
+        if (entry != 0) {
+            codeLen = entry & 0xff;
+            code = entry >> 8;
+        } else if (!DecodeCode(bits, &codeLen, &code)) {
+            logf("corrupted table\n");
+            return false;
         }
 
         if (!DecodeOne(code, dst)) {
             return false;
         }
-        bitsConsumed = codeLen;
+        if (codeLen > bitsLeft) {
+            logf("not enough data\n");
+            return false;
+        }
+        buf <<= codeLen;
+        bufBits -= codeLen;
+        bitsLeft -= codeLen;
     }
 
-    if (br.BitsLeft() > 0 && 0 != bits) {
+    if (bitsLeft > 0 && 0 != bits) {
         logf("compressed data left\n");
     }
     return true;
@@ -359,6 +420,15 @@ bool HuffDicDecompressor::SetHuffData(u8* huffData, size_t huffDataLen) {
         baseTable[i] = d.UInt32();
     }
     CrashIf(d.Offset() != kHuffRecordMinLen);
+
+    // the codes following short enough prefixes are known in advance
+    for (u32 i = 0; i < dimof(codeTable); i++) {
+        u32 codeLen, code;
+        bool ok = DecodeCode(i << (32 - kCodeTableBits), &codeLen, &code);
+        if (ok && codeLen <= kCodeTableBits && code < (1 << 24)) {
+            codeTable[i] = (code << 8) | codeLen;
+        }
+    }
     return true;
 }
 
@@ -0,0 +1,825 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/Dpi.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
+#include "utils/WinUtil.h"
+
+#include "wingui/WinGui.h"
+#include "wingui/Layout.h"
+#include "wingui/Window.h"
+#include "wingui/LabelWithCloseWnd.h"
+#include "wingui/TreeModel.h"
+#include "wingui/TreeCtrl.h"
+#include "wingui/DropDownCtrl.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "DisplayMode.h"
+#include "SettingsStructs.h"
+#include "Controller.h"
+#include "GlobalPrefs.h"
+#include "RenderCache.h"
+#include "SumatraPDF.h"
+#include "WindowInfo.h"
+#include "DisplayModel.h"
+#include "TabInfo.h"
+#include "TextSelection.h"
+#include "Translations.h"
+#include "PageThumbnails.h"
+
+// The thumbnails are rendered by a single thread of their own at the lowest priority,
+// which only renders while the RenderCache has nothing to do (see WaitForRenderingIdle)
+// and uses its own clone of the engine, so that it never holds up the pages in the canvas.
+// Only the thumbnails visible in the strip and those within a screen of them are requested
+// (the requests of a strip are replaced whenever it's painted), so that even documents
+// with thousands of pages only cost as much as the part that is being looked at.
+// Rendered thumbnails are kept with 8 bits per pixel (gray) or per channel in a small
+// cache of their own.
+
+#define THUMBNAILS_CLASS_NAME L"SUMATRA_PDF_THUMBNAILS"
+
+constexpr int kMaxThumbnailDx = 160;
+constexpr int kThumbnailMargin = 8;
+constexpr size_t kMaxThumbnailsMemory = 16 * 1024 * 1024;
+
+struct ThumbnailRequest {
+    WindowInfo* win = nullptr;
+    DisplayModel* dm = nullptr;
+    int pageNo = 0;
+    int rotation = 0;
+    Size size{};
+};
+
+struct PageThumbnail {
+    DisplayModel* dm = nullptr;
+    int pageNo = 0;
+    int rotation = 0;
+    // the requested size (the bitmap might be a pixel larger or smaller)
+    Size size{};
+    Size bmpSize{};
+    // 8 (gray) or 24
+    int bitCount = 0;
+    int stride = 0;
+    // top-down rows, each padded to a multiple of 4 bytes
+    u8* bits = nullptr;
+    size_t nBytes = 0;
+    u32 lastUsed = 0;
+
+    ~PageThumbnail() {
+        free(bits);
+    }
+};
+
+struct ThumbnailRenderer {
+    // protects everything below
+    CRITICAL_SECTION access;
+    HANDLE wakeUp = nullptr;
+
+    Vec<ThumbnailRequest> requests;
+    // the request being rendered (if curReq.dm is set)
+    ThumbnailRequest curReq;
+    AbortCookie* abortCookie = nullptr;
+    bool abortCurReq = false;
+
+    // clone of cloneDm's engine, owned by the rendering thread
+    DisplayModel* cloneDm = nullptr;
+    EngineBase* clone = nullptr;
+    bool cloneFailed = false;
+
+    Vec<PageThumbnail*> cache;
+    size_t cacheSize = 0;
+    u32 useCount = 0;
+
+    ThumbnailRenderer() {
+        InitializeCriticalSection(&access);
+        wakeUp = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    }
+};
+
+struct ThumbnailStrip {
+    WindowInfo* win = nullptr;
+    HWND hwnd = nullptr;
+    bool isShown = false;
+    // the document the strip was last laid out for
+    DisplayModel* dm = nullptr;
+    int scrollY = 0;
+    int selectedPageNo = 0;
+    bool scrollToSelection = false;
+    int labelDy = 0;
+};
+
+struct StripLayout {
+    Rect client{};
+    int margin = 0;
+    // the box every page is fitted into
+    Size img{};
+    int cellDy = 0;
+    int totalDy = 0;
+};
+
+static ThumbnailRenderer* gThumbnails = nullptr;
+
+static bool IsSameRequest(const ThumbnailRequest& r1, const ThumbnailRequest& r2) {
+    return r1.win == r2.win && r1.dm == r2.dm && r1.pageNo == r2.pageNo && r1.rotation == r2.rotation &&
+           r1.size == r2.size;
+}
+
+// must be called with gThumbnails->access locked
+static PageThumbnail* FindThumbnail(const ThumbnailRequest& req) {
+    for (PageThumbnail* thumb : gThumbnails->cache) {
+        if (thumb->dm == req.dm && thumb->pageNo == req.pageNo && thumb->rotation == req.rotation) {
+            thumb->lastUsed = ++gThumbnails->useCount;
+            return thumb;
+        }
+    }
+    return nullptr;
+}
+
+// must be called with gThumbnails->access locked
+static void AddThumbnail(PageThumbnail* thumb) {
+    ThumbnailRenderer* r = gThumbnails;
+    for (size_t i = 0; i < r->cache.size(); i++) {
+        PageThumbnail* prev = r->cache.at(i);
+        if (prev->dm == thumb->dm && prev->pageNo == thumb->pageNo) {
+            r->cacheSize -= prev->nBytes;
+            r->cache.RemoveAtFast(i);
+            delete prev;
+            break;
+        }
+    }
+    thumb->lastUsed = ++r->useCount;
+    r->cache.Append(thumb);
+    r->cacheSize += thumb->nBytes;
+
+    while (r->cacheSize > kMaxThumbnailsMemory && r->cache.size() > 1) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < r->cache.size(); i++) {
+            if (r->cache.at(i)->lastUsed < r->cache.at(oldest)->lastUsed) {
+                oldest = i;
+            }
+        }
+        PageThumbnail* evicted = r->cache.at(oldest);
+        r->cacheSize -= evicted->nBytes;
+        r->cache.RemoveAtFast(oldest);
+        delete evicted;
+    }
+}
+
+// converts a rendered 32-bit bitmap to 8 bits per pixel for gray pages
+// (the most common case) or to 8 bits per channel for the others
+static PageThumbnail* PackThumbnail(RenderedBitmap* bmp) {
+    DIBSECTION info{};
+    if (!GetObject(bmp->GetBitmap(), sizeof(info), &info) || info.dsBm.bmBitsPixel != 32 || !info.dsBm.bmBits) {
+        return nullptr;
+    }
+    int dx = info.dsBm.bmWidth;
+    int dy = info.dsBm.bmHeight;
+    bool isTopDown = info.dsBmih.biHeight < 0;
+    auto srcRow = [&](int y) {
+        int row = isTopDown ? y : dy - 1 - y;
+        return (const u8*)info.dsBm.bmBits + (size_t)row * info.dsBm.bmWidthBytes;
+    };
+
+    bool isGray = true;
+    for (int y = 0; y < dy && isGray; y++) {
+        const u8* src = srcRow(y);
+        for (int x = 0; x < dx; x++, src += 4) {
+            if (src[0] != src[1] || src[1] != src[2]) {
+                isGray = false;
+                break;
+            }
+        }
+    }
+
+    auto thumb = new PageThumbnail();
+    thumb->bmpSize = Size(dx, dy);
+    thumb->bitCount = isGray ? 8 : 24;
+    thumb->stride = RoundUp(dx * thumb->bitCount / 8, 4);
+    thumb->nBytes = (size_t)thumb->stride * dy;
+    thumb->bits = AllocArray<u8>(thumb->nBytes);
+    if (!thumb->bits) {
+        delete thumb;
+        return nullptr;
+    }
+    for (int y = 0; y < dy; y++) {
+        const u8* src = srcRow(y);
+        u8* dst = thumb->bits + (size_t)y * thumb->stride;
+        for (int x = 0; x < dx; x++, src += 4) {
+            if (isGray) {
+                *dst++ = src[0];
+            } else {
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+                dst += 3;
+            }
+        }
+    }
+    return thumb;
+}
+
+// returns the engine to render req's page with, preferably a clone
+static EngineBase* GetEngineForThumbnail(ThumbnailRenderer* r, DisplayModel* dm) {
+    EngineBase* prevClone = nullptr;
+    {
+        ScopedCritSec scope(&r->access);
+        if (r->cloneDm != dm) {
+            prevClone = r->clone;
+            r->clone = nullptr;
+            r->cloneDm = dm;
+            r->cloneFailed = false;
+        }
+    }
+    delete prevClone;
+
+    if (!r->clone && !r->cloneFailed) {
+        r->clone = dm->GetEngine()->Clone();
+        r->cloneFailed = !r->clone;
+    }
+    return r->clone ? r->clone : dm->GetEngine();
+}
+
+static void RenderThumbnail(ThumbnailRenderer* r) {
+    // curReq is only modified by this thread
+    ThumbnailRequest req = r->curReq;
+    if (req.dm->dontRenderFlag) {
+        return;
+    }
+    EngineBase* engine = GetEngineForThumbnail(r, req.dm);
+    RectF mediabox = engine->Transform(engine->PageMediabox(req.pageNo), req.pageNo, 1.0f, req.rotation);
+    if (mediabox.IsEmpty()) {
+        return;
+    }
+    float zoom = (float)req.size.dx / mediabox.dx;
+    RenderPageArgs args(req.pageNo, zoom, req.rotation, nullptr, RenderTarget::View, &r->abortCookie);
+    // the lower quality is hardly visible at this size
+    args.isDraft = true;
+    RenderedBitmap* bmp = engine->RenderPage(args);
+    // don't replace colors for individual images
+    if (bmp && !engine->IsImageCollection()) {
+        UpdateBitmapColors(bmp->GetBitmap(), gRenderCache.textColor, gRenderCache.backgroundColor);
+    }
+    PageThumbnail* thumb = bmp ? PackThumbnail(bmp) : nullptr;
+    delete bmp;
+    if (!thumb) {
+        return;
+    }
+    thumb->dm = req.dm;
+    thumb->pageNo = req.pageNo;
+    thumb->rotation = req.rotation;
+    thumb->size = req.size;
+    {
+        // the thumbnail must be added before curReq is cleared, as that's
+        // what FreeThumbnailsForDisplayModel waits for
+        ScopedCritSec scope(&r->access);
+        if (r->abortCurReq) {
+            delete thumb;
+            return;
+        }
+        AddThumbnail(thumb);
+    }
+
+    WindowInfo* win = req.win;
+    uitask::PostCoalesced(&win->thumbnails, [win] {
+        if (WindowInfoStillValid(win) && IsShowingThumbnails(win)) {
+            InvalidateRect(win->thumbnails->hwnd, nullptr, FALSE);
+        }
+    });
+}
+
+static DWORD WINAPI ThumbnailRenderThread(void* data) {
+    ThumbnailRenderer* r = (ThumbnailRenderer*)data;
+    SetThreadName(GetCurrentThreadId(), "ThumbnailRenderer");
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+    // some engines use COM (e.g. WIC for images)
+    ScopedCom com;
+
+    for (;;) {
+        bool hasRequests = false;
+        {
+            ScopedCritSec scope(&r->access);
+            hasRequests = r->requests.size() > 0;
+        }
+        if (!hasRequests) {
+            WaitForSingleObject(r->wakeUp, INFINITE);
+            continue;
+        }
+        // the pages in the canvas always go first
+        // (the requests might change in the meantime)
+        if (!WaitForRenderingIdle(100)) {
+            continue;
+        }
+        {
+            ScopedCritSec scope(&r->access);
+            if (r->requests.size() == 0) {
+                continue;
+            }
+            r->curReq = r->requests.PopAt(0);
+            r->abortCurReq = false;
+        }
+
+        RenderThumbnail(r);
+
+        ScopedCritSec scope(&r->access);
+        delete r->abortCookie;
+        r->abortCookie = nullptr;
+        r->curReq = ThumbnailRequest();
+    }
+}
+
+static void StartThumbnailRenderer() {
+    if (gThumbnails) {
+        return;
+    }
+    gThumbnails = new ThumbnailRenderer();
+    HANDLE h = CreateThread(nullptr, 0, ThumbnailRenderThread, gThumbnails, 0, nullptr);
+    if (h) {
+        CloseHandle(h);
+    }
+}
+
+// replaces all previous requests of win
+static void RequestThumbnails(WindowInfo* win, Vec<ThumbnailRequest>& reqs) {
+    ThumbnailRenderer* r = gThumbnails;
+    if (!r) {
+        return;
+    }
+    ScopedCritSec scope(&r->access);
+    for (size_t i = r->requests.size(); i > 0; i--) {
+        if (r->requests.at(i - 1).win == win) {
+            r->requests.RemoveAt(i - 1);
+        }
+    }
+    for (ThumbnailRequest& req : reqs) {
+        if (!IsSameRequest(req, r->curReq)) {
+            r->requests.Append(req);
+        }
+    }
+    if (r->requests.size() > 0) {
+        SetEvent(r->wakeUp);
+    }
+}
+
+void FreeThumbnailsForDisplayModel(DisplayModel* dm) {
+    ThumbnailRenderer* r = gThumbnails;
+    if (!r) {
+        return;
+    }
+    for (;;) {
+        {
+            ScopedCritSec scope(&r->access);
+            for (size_t i = r->requests.size(); i > 0; i--) {
+                if (r->requests.at(i - 1).dm == dm) {
+                    r->requests.RemoveAt(i - 1);
+                }
+            }
+            if (r->curReq.dm != dm) {
+                break;
+            }
+            r->abortCurReq = true;
+            if (r->abortCookie) {
+                r->abortCookie->Abort();
+            }
+        }
+        // wait for the thumbnail being rendered to be aborted
+        Sleep(50);
+    }
+
+    ScopedCritSec scope(&r->access);
+    if (r->cloneDm == dm) {
+        delete r->clone;
+        r->clone = nullptr;
+        r->cloneDm = nullptr;
+        r->cloneFailed = false;
+    }
+    for (size_t i = r->cache.size(); i > 0; i--) {
+        PageThumbnail* thumb = r->cache.at(i - 1);
+        if (thumb->dm == dm) {
+            r->cacheSize -= thumb->nBytes;
+            r->cache.RemoveAtFast(i - 1);
+            delete thumb;
+        }
+    }
+}
+
+static SizeF RotatedPageSize(DisplayModel* dm, int pageNo) {
+    RectF page = dm->GetPageInfo(pageNo)->page;
+    if (dm->GetRotation() % 180 != 0) {
+        return SizeF(page.dy, page.dx);
+    }
+    return SizeF(page.dx, page.dy);
+}
+
+static void UpdateStripScrollbar(ThumbnailStrip* s, const StripLayout& l) {
+    SCROLLINFO si{};
+    si.cbSize = sizeof(si);
+    // the scrollbar is always visible, so that the width of the strip doesn't change
+    si.fMask = SIF_ALL | SIF_DISABLENOSCROLL;
+    si.nMax = std::max(l.totalDy - 1, 0);
+    si.nPage = (UINT)l.client.dy;
+    si.nPos = s->scrollY;
+    SetScrollInfo(s->hwnd, SB_VERT, &si, TRUE);
+}
+
+// all cells have the size of the first page's, which fits most documents
+// (and makes finding the cells of pages trivial)
+static StripLayout GetStripLayout(ThumbnailStrip* s) {
+    StripLayout l;
+    l.client = ClientRect(s->hwnd);
+    DisplayModel* dm = s->win->AsFixed();
+    if (dm != s->dm) {
+        s->dm = dm;
+        s->scrollY = 0;
+        s->selectedPageNo = dm ? dm->CurrentPageNo() : 0;
+        s->scrollToSelection = true;
+    }
+    if (!dm || dm->PageCount() == 0) {
+        s->scrollY = 0;
+        UpdateStripScrollbar(s, l);
+        return l;
+    }
+
+    l.margin = DpiScale(s->hwnd, kThumbnailMargin);
+    l.img.dx = limitValue(l.client.dx - 2 * l.margin, 16, DpiScale(s->hwnd, kMaxThumbnailDx));
+    SizeF first = RotatedPageSize(dm, 1);
+    float ratio = first.IsEmpty() ? 1.f : first.dy / first.dx;
+    l.img.dy = (int)(l.img.dx * limitValue(ratio, 0.25f, 4.f));
+    l.cellDy = l.margin + l.img.dy + l.margin / 2 + s->labelDy + l.margin / 2;
+    l.totalDy = dm->PageCount() * l.cellDy + l.margin;
+
+    if (s->scrollToSelection && s->selectedPageNo > 0) {
+        int top = (s->selectedPageNo - 1) * l.cellDy;
+        if (top < s->scrollY) {
+            s->scrollY = top;
+        } else if (top + l.cellDy > s->scrollY + l.client.dy) {
+            s->scrollY = top + l.cellDy - l.client.dy;
+        }
+    }
+    s->scrollToSelection = false;
+    s->scrollY = limitValue(s->scrollY, 0, std::max(l.totalDy - l.client.dy, 0));
+    UpdateStripScrollbar(s, l);
+    return l;
+}
+
+// the part of pageNo's box covered by its thumbnail
+static Rect ThumbnailRect(ThumbnailStrip* s, const StripLayout& l, int pageNo) {
+    Rect box((l.client.dx - l.img.dx) / 2, (pageNo - 1) * l.cellDy + l.margin - s->scrollY, l.img.dx, l.img.dy);
+    SizeF page = RotatedPageSize(s->dm, pageNo);
+    if (page.IsEmpty()) {
+        return box;
+    }
+    float scale = std::min((float)box.dx / page.dx, (float)box.dy / page.dy);
+    int dx = std::max((int)(page.dx * scale), 1);
+    int dy = std::max((int)(page.dy * scale), 1);
+    return Rect(box.x + (box.dx - dx) / 2, box.y + (box.dy - dy) / 2, dx, dy);
+}
+
+static ThumbnailRequest MakeRequest(ThumbnailStrip* s, int pageNo, Size size) {
+    ThumbnailRequest req;
+    req.win = s->win;
+    req.dm = s->dm;
+    req.pageNo = pageNo;
+    req.rotation = s->dm->GetRotation();
+    req.size = size;
+    return req;
+}
+
+// a BITMAPINFO with room for a palette
+struct ThumbnailBitmapInfo {
+    BITMAPINFOHEADER bmiHeader;
+    RGBQUAD bmiColors[256];
+};
+
+static void PaintThumbnailBits(HDC hdc, Rect dest, PageThumbnail* thumb) {
+    ThumbnailBitmapInfo bmi{};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = thumb->bmpSize.dx;
+    bmi.bmiHeader.biHeight = -thumb->bmpSize.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = (WORD)thumb->bitCount;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    if (8 == thumb->bitCount) {
+        bmi.bmiHeader.biClrUsed = 256;
+        for (int i = 0; i < 256; i++) {
+            bmi.bmiColors[i] = {(BYTE)i, (BYTE)i, (BYTE)i, 0};
+        }
+    }
+    SetStretchBltMode(hdc, HALFTONE);
+    SetBrushOrgEx(hdc, 0, 0, nullptr);
+    StretchDIBits(hdc, dest.x, dest.y, dest.dx, dest.dy, 0, 0, thumb->bmpSize.dx, thumb->bmpSize.dy, thumb->bits,
+                  (BITMAPINFO*)&bmi, DIB_RGB_COLORS, SRCCOPY);
+}
+
+// returns false if the thumbnail (still) has to be rendered
+static bool PaintThumbnail(ThumbnailStrip* s, HDC hdc, const StripLayout& l, int pageNo) {
+    Rect rc = ThumbnailRect(s, l, pageNo);
+    int labelY = (pageNo - 1) * l.cellDy + l.margin + l.img.dy + l.margin / 2 - s->scrollY;
+    Rect labelRc(0, labelY, l.client.dx, s->labelDy);
+
+    bool isSelected = pageNo == s->selectedPageNo;
+    if (isSelected) {
+        RECT sel = ToRECT(rc.Union(Rect(rc.x, labelY, rc.dx, s->labelDy)));
+        InflateRect(&sel, l.margin / 2, l.margin / 2);
+        FillRect(hdc, &sel, GetSysColorBrush(COLOR_HIGHLIGHT));
+    }
+
+    bool isUpToDate = false;
+    {
+        ScopedCritSec scope(&gThumbnails->access);
+        ThumbnailRequest req = MakeRequest(s, pageNo, rc.Size());
+        PageThumbnail* thumb = FindThumbnail(req);
+        if (thumb) {
+            // a thumbnail of a different size is better than none (while the strip is resized)
+            PaintThumbnailBits(hdc, rc, thumb);
+            isUpToDate = thumb->size == req.size;
+        }
+    }
+    RECT r = ToRECT(rc);
+    if (!isUpToDate) {
+        ScopedGdiObj<HBRUSH> brush(CreateSolidBrush(gRenderCache.backgroundColor));
+        FillRect(hdc, &r, brush);
+    }
+    FrameRect(hdc, &r, GetSysColorBrush(COLOR_BTNSHADOW));
+
+    AutoFreeWstr label = s->win->ctrl->GetPageLabel(pageNo);
+    RECT lr = ToRECT(labelRc);
+    SetTextColor(hdc, GetSysColor(isSelected ? COLOR_HIGHLIGHTTEXT : COLOR_WINDOWTEXT));
+    DrawTextW(hdc, label, -1, &lr, DT_CENTER | DT_SINGLELINE | DT_NOPREFIX | DT_END_ELLIPSIS);
+    return isUpToDate;
+}
+
+static bool HasUpToDateThumbnail(ThumbnailStrip* s, const StripLayout& l, int pageNo) {
+    ScopedCritSec scope(&gThumbnails->access);
+    ThumbnailRequest req = MakeRequest(s, pageNo, ThumbnailRect(s, l, pageNo).Size());
+    PageThumbnail* thumb = FindThumbnail(req);
+    return thumb && thumb->size == req.size;
+}
+
+static void OnPaintStrip(ThumbnailStrip* s) {
+    PAINTSTRUCT ps;
+    HDC hdc = BeginPaint(s->hwnd, &ps);
+    StripLayout l = GetStripLayout(s);
+    DoubleBuffer buffer(s->hwnd, l.client);
+    HDC hdcBuf = buffer.GetDC();
+    RECT rc = ToRECT(l.client);
+    FillRect(hdcBuf, &rc, GetSysColorBrush(COLOR_WINDOW));
+
+    Vec<ThumbnailRequest> reqs;
+    DisplayModel* dm = s->dm;
+    if (dm && l.cellDy > 0) {
+        ScopedSelectObject font(hdcBuf, GetDefaultGuiFont());
+        SetBkMode(hdcBuf, TRANSPARENT);
+        int nPages = dm->PageCount();
+        int first = s->scrollY / l.cellDy + 1;
+        int last = std::min((s->scrollY + l.client.dy) / l.cellDy + 1, nPages);
+        for (int pageNo = first; pageNo <= last; pageNo++) {
+            if (!PaintThumbnail(s, hdcBuf, l, pageNo)) {
+                reqs.Append(MakeRequest(s, pageNo, ThumbnailRect(s, l, pageNo).Size()));
+            }
+        }
+        // prepare the thumbnails within a screen of the visible ones (below before above)
+        int n = last - first + 1;
+        for (int pageNo = last + 1; pageNo <= std::min(last + n, nPages); pageNo++) {
+            if (!HasUpToDateThumbnail(s, l, pageNo)) {
+                reqs.Append(MakeRequest(s, pageNo, ThumbnailRect(s, l, pageNo).Size()));
+            }
+        }
+        for (int pageNo = first - 1; pageNo >= std::max(first - n, 1); pageNo--) {
+            if (!HasUpToDateThumbnail(s, l, pageNo)) {
+                reqs.Append(MakeRequest(s, pageNo, ThumbnailRect(s, l, pageNo).Size()));
+            }
+        }
+    }
+
+    buffer.Flush(hdc);
+    EndPaint(s->hwnd, &ps);
+    RequestThumbnails(s->win, reqs);
+}
+
+static void ScrollStripTo(ThumbnailStrip* s, int y) {
+    if (y != s->scrollY) {
+        s->scrollY = y;
+        InvalidateRect(s->hwnd, nullptr, FALSE);
+    }
+}
+
+static void OnVScrollStrip(ThumbnailStrip* s, WPARAM wp) {
+    StripLayout l = GetStripLayout(s);
+    int y = s->scrollY;
+    switch (LOWORD(wp)) {
+        case SB_TOP:
+            y = 0;
+            break;
+        case SB_BOTTOM:
+            y = l.totalDy;
+            break;
+        case SB_LINEUP:
+            y -= l.cellDy;
+            break;
+        case SB_LINEDOWN:
+            y += l.cellDy;
+            break;
+        case SB_PAGEUP:
+            y -= l.client.dy;
+            break;
+        case SB_PAGEDOWN:
+            y += l.client.dy;
+            break;
+        case SB_THUMBTRACK:
+        case SB_THUMBPOSITION: {
+            SCROLLINFO si{};
+            si.cbSize = sizeof(si);
+            si.fMask = SIF_TRACKPOS;
+            GetScrollInfo(s->hwnd, SB_VERT, &si);
+            y = si.nTrackPos;
+            break;
+        }
+    }
+    ScrollStripTo(s, limitValue(y, 0, std::max(l.totalDy - l.client.dy, 0)));
+}
+
+static void OnMouseWheelStrip(ThumbnailStrip* s, WPARAM wp) {
+    StripLayout l = GetStripLayout(s);
+    int y = s->scrollY - MulDiv(GET_WHEEL_DELTA_WPARAM(wp), l.cellDy, WHEEL_DELTA);
+    ScrollStripTo(s, limitValue(y, 0, std::max(l.totalDy - l.client.dy, 0)));
+}
+
+static void OnClickStrip(ThumbnailStrip* s, LPARAM lp) {
+    StripLayout l = GetStripLayout(s);
+    if (!s->dm || l.cellDy <= 0) {
+        return;
+    }
+    int pageNo = (GET_Y_LPARAM(lp) + s->scrollY) / l.cellDy + 1;
+    if (pageNo >= 1 && pageNo <= s->dm->PageCount()) {
+        s->win->ctrl->GoToPage(pageNo, true);
+    }
+}
+
+static LRESULT CALLBACK WndProcThumbnails(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
+    ThumbnailStrip* s;
+    if (WM_NCCREATE == msg) {
+        LPCREATESTRUCT lpcs = reinterpret_cast<LPCREATESTRUCT>(lp);
+        s = reinterpret_cast<ThumbnailStrip*>(lpcs->lpCreateParams);
+        s->hwnd = hwnd;
+        SetWindowLongPtr(hwnd, GWLP_USERDATA, reinterpret_cast<LPARAM>(s));
+    } else {
+        s = reinterpret_cast<ThumbnailStrip*>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
+    }
+    if (!s) {
+        return DefWindowProc(hwnd, msg, wp, lp);
+    }
+
+    switch (msg) {
+        case WM_ERASEBKGND:
+            return TRUE;
+
+        case WM_PAINT:
+            OnPaintStrip(s);
+            return 0;
+
+        case WM_SIZE:
+            InvalidateRect(hwnd, nullptr, FALSE);
+            break;
+
+        case WM_VSCROLL:
+            OnVScrollStrip(s, wp);
+            return 0;
+
+        case WM_MOUSEWHEEL:
+            OnMouseWheelStrip(s, wp);
+            return 0;
+
+        case WM_LBUTTONDOWN:
+            OnClickStrip(s, lp);
+            return 0;
+
+        case WM_NCDESTROY:
+            SetWindowLongPtr(hwnd, GWLP_USERDATA, 0);
+            s->hwnd = nullptr;
+            break;
+    }
+    return DefWindowProc(hwnd, msg, wp, lp);
+}
+
+static void RegisterThumbnailsWndClass() {
+    static ATOM atom = 0;
+    if (atom != 0) {
+        // already registered
+        return;
+    }
+    WNDCLASSEX wcex = {};
+    FillWndClassEx(wcex, THUMBNAILS_CLASS_NAME, WndProcThumbnails);
+    atom = RegisterClassEx(&wcex);
+    CrashIf(!atom);
+}
+
+static void CreateThumbnailStrip(WindowInfo* win) {
+    StartThumbnailRenderer();
+    RegisterThumbnailsWndClass();
+
+    auto s = new ThumbnailStrip();
+    s->win = win;
+    DWORD style = WS_CHILD | WS_VSCROLL;
+    HWND hwnd = CreateWindowExW(WS_EX_STATICEDGE, THUMBNAILS_CLASS_NAME, L"", style, 0, 0, 0, 0, win->hwndTocBox,
+                                nullptr, GetModuleHandle(nullptr), s);
+    if (!hwnd) {
+        delete s;
+        return;
+    }
+    HDC hdc = GetDC(hwnd);
+    {
+        ScopedSelectObject font(hdc, GetDefaultGuiFont());
+        TEXTMETRIC tm{};
+        GetTextMetrics(hdc, &tm);
+        s->labelDy = tm.tmHeight;
+    }
+    ReleaseDC(hwnd, hdc);
+    win->thumbnails = s;
+}
+
+bool IsShowingThumbnails(WindowInfo* win) {
+    return win->thumbnails && win->thumbnails->isShown;
+}
+
+HWND GetThumbnailsHwnd(WindowInfo* win) {
+    return IsShowingThumbnails(win) ? win->thumbnails->hwnd : nullptr;
+}
+
+// the strip takes the place of the (hidden) tree
+void LayoutThumbnails(WindowInfo* win) {
+    if (!IsShowingThumbnails(win)) {
+        return;
+    }
+    Size labelSize = win->tocLabelWithClose->GetIdealSize();
+    Rect rc = ClientRect(win->hwndTocBox);
+    MoveWindow(win->thumbnails->hwnd, 0, labelSize.dy, rc.dx, rc.dy - labelSize.dy, TRUE);
+}
+
+void ShowThumbnails(WindowInfo* win, bool show) {
+    if (show && !win->thumbnails) {
+        CreateThumbnailStrip(win);
+    }
+    ThumbnailStrip* s = win->thumbnails;
+    if (!s) {
+        return;
+    }
+    if (show) {
+        s->selectedPageNo = win->ctrl->CurrentPageNo();
+        s->scrollToSelection = true;
+        InvalidateRect(s->hwnd, nullptr, FALSE);
+    } else {
+        Vec<ThumbnailRequest> none;
+        RequestThumbnails(win, none);
+    }
+    if (show == s->isShown) {
+        return;
+    }
+    s->isShown = show;
+
+    win::SetVisibility(win->tocTreeCtrl->hwnd, !show);
+    bool showAltBookmarks = !show && win->currentTab && win->currentTab->altBookmarks.size() > 0;
+    win->altBookmarks->SetVisibility(showAltBookmarks ? Visibility::Visible : Visibility::Collapse);
+    win::SetVisibility(s->hwnd, show);
+    win->tocLabelWithClose->SetLabel(show ? _TR("Thumbnails") : _TR("Bookmarks"));
+    LayoutTreeContainer(win->tocLabelWithClose, win->altBookmarks, win->tocTreeCtrl->hwnd);
+    LayoutThumbnails(win);
+}
+
+void ToggleThumbnails(WindowInfo* win) {
+    if (!win->IsDocLoaded() || !win->AsFixed()) {
+        return;
+    }
+    if (IsShowingThumbnails(win)) {
+        SetSidebarVisibility(win, false, gGlobalPrefs->showFavorites);
+        return;
+    }
+    win->thumbnailsVisible = true;
+    SetSidebarVisibility(win, true, gGlobalPrefs->showFavorites);
+}
+
+void UpdateThumbnailsSelection(WindowInfo* win, int currPageNo) {
+    if (!IsShowingThumbnails(win) || win->thumbnails->selectedPageNo == currPageNo) {
+        return;
+    }
+    win->thumbnails->selectedPageNo = currPageNo;
+    win->thumbnails->scrollToSelection = true;
+    InvalidateRect(win->thumbnails->hwnd, nullptr, FALSE);
+}
+
+void DeleteThumbnails(WindowInfo* win) {
+    ThumbnailStrip* s = win->thumbnails;
+    if (!s) {
+        return;
+    }
+    Vec<ThumbnailRequest> none;
+    RequestThumbnails(win, none);
+    if (s->hwnd) {
+        DestroyWindow(s->hwnd);
+    }
+    delete s;
+    win->thumbnails = nullptr;
+}
@@ -0,0 +1,17 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+struct ThumbnailStrip;
+
+// shows a strip of page thumbnails in the ToC box instead of the bookmarks
+// (the thumbnails are rendered by their own low-priority thread, see PageThumbnails.cpp)
+void ToggleThumbnails(WindowInfo*);
+bool IsShowingThumbnails(WindowInfo*);
+void ShowThumbnails(WindowInfo*, bool show);
+void LayoutThumbnails(WindowInfo*);
+void UpdateThumbnailsSelection(WindowInfo*, int currPageNo);
+// nullptr if the thumbnails aren't shown
+HWND GetThumbnailsHwnd(WindowInfo*);
+void DeleteThumbnails(WindowInfo*);
+// must be called before dm is deleted
+void FreeThumbnailsForDisplayModel(DisplayModel* dm);
@@ -6,9 +6,13 @@ extern "C" {
 #include <mupdf/pdf.h>
 }
 
+#include <zlib.h>
+
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/ThreadUtil.h"
 #include "utils/Log.h"
 
 #include "wingui/TreeModel.h"
@@ -264,30 +268,35 @@ bool PdfCreator::AddPageFromImageData(const char* data, size_t len, float imgDpi
     return ok;
 }
 
+// adapted from EnginePdf::GetProperty
+static struct {
+    DocumentProperty prop;
+    const char* name;
+} pdfPropNames[] = {
+    {DocumentProperty::Title, "Title"},
+    {DocumentProperty::Author, "Author"},
+    {DocumentProperty::Subject, "Subject"},
+    {DocumentProperty::Copyright, "Copyright"},
+    {DocumentProperty::ModificationDate, "ModDate"},
+    {DocumentProperty::CreatorApp, "Creator"},
+    {DocumentProperty::PdfProducer, "Producer"},
+};
+
+static const char* GetPdfPropName(DocumentProperty prop) {
+    for (int i = 0; i < dimof(pdfPropNames); i++) {
+        if (pdfPropNames[i].prop == prop) {
+            return pdfPropNames[i].name;
+        }
+    }
+    return nullptr;
+}
+
 bool PdfCreator::SetProperty(DocumentProperty prop, const WCHAR* value) {
     if (!ctx || !doc) {
         return false;
     }
 
-    // adapted from EnginePdf::GetProperty
-    static struct {
-        DocumentProperty prop;
-        const char* name;
-    } pdfPropNames[] = {
-        {DocumentProperty::Title, "Title"},
-        {DocumentProperty::Author, "Author"},
-        {DocumentProperty::Subject, "Subject"},
-        {DocumentProperty::Copyright, "Copyright"},
-        {DocumentProperty::ModificationDate, "ModDate"},
-        {DocumentProperty::CreatorApp, "Creator"},
-        {DocumentProperty::PdfProducer, "Producer"},
-    };
-    const char* name = nullptr;
-    for (int i = 0; i < dimof(pdfPropNames) && !name; i++) {
-        if (pdfPropNames[i].prop == prop) {
-            name = pdfPropNames[i].name;
-        }
-    }
+    const char* name = GetPdfPropName(prop);
     if (!name) {
         return false;
     }
@@ -380,26 +389,516 @@ bool PdfCreator::SaveToFile(const char* filePath) {
     return true;
 }
 
+// number of threads rendering and encoding pages for RenderToFile
+#define RENDER_TO_FILE_THREADS 4
+// how many pages may be rendered ahead of the page being written
+// (this bounds memory use independently of the document's size)
+#define RENDER_TO_FILE_MAX_PAGES_AHEAD 8
+
+static bool DeflateTo(str::Str& res, const u8* data, size_t len) {
+    z_stream zs = {0};
+    if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        return false;
+    }
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = (uInt)len;
+    u8 buf[64 * 1024];
+    int status = Z_OK;
+    while (Z_OK == status) {
+        zs.next_out = buf;
+        zs.avail_out = sizeof(buf);
+        status = deflate(&zs, Z_FINISH);
+        if (status != Z_STREAM_ERROR) {
+            res.Append((const char*)buf, sizeof(buf) - zs.avail_out);
+        }
+    }
+    deflateEnd(&zs);
+    return Z_STREAM_END == status;
+}
+
+// pages with at least this many distinct colors are considered photos and JPEG encoded
+#define EXPORT_PHOTO_MIN_COLORS 4096
+// quality (0 to 100) of JPEG encoded pages
+#define EXPORT_JPEG_QUALITY 85
+
+// a page rendered and compressed for RenderToFile
+struct ExportedPage {
+    Size size;
+    // the image dictionary's entries describing data
+    str::Str dict;
+    // the encoded samples
+    str::Str data;
+    bool isDone = false;
+    bool ok = false;
+};
+
+// maps colors to indices in order of their first occurrence
+// (only as many colors as fit into the table are counted)
+struct ExportColorTable {
+    static const int kSize = 2 * EXPORT_PHOTO_MIN_COLORS;
+    // colors are stored incremented by 1, so that 0 marks an empty slot
+    u32 keys[kSize];
+    u16 indices[kSize];
+    u32 colors[EXPORT_PHOTO_MIN_COLORS];
+    int count = 0;
+
+    ExportColorTable() {
+        ZeroArray(keys);
+    }
+
+    // returns -1 if the table is full
+    int Add(u32 color) {
+        u32 i = (color * 2654435761u) % kSize;
+        while (keys[i] != 0) {
+            if (keys[i] == color + 1) {
+                return indices[i];
+            }
+            i = (i + 1) % kSize;
+        }
+        if (count >= EXPORT_PHOTO_MIN_COLORS) {
+            return -1;
+        }
+        keys[i] = color + 1;
+        indices[i] = (u16)count;
+        colors[count] = color;
+        return count++;
+    }
+};
+
+static u32 BgrColor(const u8* p) {
+    return ((u32)p[2] << 16) | ((u32)p[1] << 8) | p[0];
+}
+
+// packs 1-, 2-, 4- or 8-bit samples into byte-aligned rows
+static void PackSamples(str::Str& res, const u8* samples, int w, int h, int bpc) {
+    int rowBytes = (w * bpc + 7) / 8;
+    u8* row = AllocArray<u8>(rowBytes);
+    for (int y = 0; y < h; y++) {
+        memset(row, 0, rowBytes);
+        const u8* s = samples + (size_t)y * w;
+        for (int x = 0; x < w; x++) {
+            int bit = x * bpc;
+            row[bit / 8] |= (u8)(s[x] << (8 - bpc - bit % 8));
+        }
+        res.Append((const char*)row, rowBytes);
+    }
+    free(row);
+}
+
+static bool EncodeJpeg(str::Str& res, const u8* bgr, int w, int h, int stride) {
+    Bitmap bmp(w, h, stride, PixelFormat24bppRGB, (BYTE*)bgr);
+    CLSID jpgEncId = GetEncoderClsid(L"image/jpeg");
+    ULONG quality = EXPORT_JPEG_QUALITY;
+    Gdiplus::EncoderParameters params;
+    params.Count = 1;
+    params.Parameter[0].Guid = Gdiplus::EncoderQuality;
+    params.Parameter[0].Type = Gdiplus::EncoderParameterValueTypeLong;
+    params.Parameter[0].NumberOfValues = 1;
+    params.Parameter[0].Value = &quality;
+
+    ScopedComPtr<IStream> stream;
+    if (FAILED(CreateStreamOnHGlobal(nullptr, TRUE, &stream))) {
+        return false;
+    }
+    if (bmp.Save(stream, &jpgEncId, &params) != Ok) {
+        return false;
+    }
+    AutoFree data = GetDataFromStream(stream, nullptr);
+    return data.data && res.Append(data.data, data.len);
+}
+
+// picks an encoding for a rendered page (given as a top-down BGR DIB) that's
+// much smaller than deflated RGB samples for typical pages: CCITT G4 for black
+// and white (e.g. scanned text), an indexed color space for few colors
+// (e.g. anti-aliased text) and JPEG for photos
+static bool EncodeExportedPage(fz_context* ctx, const u8* bgr, int w, int h, int stride, ExportedPage& page) {
+    ExportColorTable* table = new ExportColorTable();
+    bool isBilevel = true;
+    bool isPhoto = false;
+    for (int y = 0; y < h && !isPhoto; y++) {
+        const u8* p = bgr + (size_t)y * stride;
+        for (int x = 0; x < w; x++, p += 3) {
+            u32 c = BgrColor(p);
+            isBilevel = isBilevel && (c == 0 || c == 0xffffff);
+            if (table->Add(c) < 0) {
+                isPhoto = true;
+                break;
+            }
+        }
+    }
+
+    bool ok = false;
+    page.size = Size(w, h);
+    if (isBilevel && ctx) {
+        // in DeviceGray, 1 is white
+        u8* samples = AllocArray<u8>((size_t)w * h);
+        for (int y = 0; y < h; y++) {
+            const u8* p = bgr + (size_t)y * stride;
+            for (int x = 0; x < w; x++, p += 3) {
+                samples[(size_t)y * w + x] = p[0] ? 1 : 0;
+            }
+        }
+        str::Str packed;
+        PackSamples(packed, samples, w, h, 1);
+        free(samples);
+        fz_buffer* buf = nullptr;
+        fz_var(buf);
+        fz_try(ctx) {
+            buf = fz_compress_ccitt_fax_g4(ctx, (const u8*)packed.Get(), w, h);
+            u8* encoded = nullptr;
+            size_t len = fz_buffer_storage(ctx, buf, &encoded);
+            ok = page.data.Append(encoded, len);
+        }
+        fz_always(ctx) {
+            fz_drop_buffer(ctx, buf);
+        }
+        fz_catch(ctx) {
+            ok = false;
+        }
+        page.dict.AppendFmt("/ColorSpace/DeviceGray/BitsPerComponent 1/Filter/CCITTFaxDecode"
+                            "/DecodeParms<</K -1/Columns %d/Rows %d>>",
+                            w, h);
+    } else if (table->count <= 256) {
+        int n = table->count;
+        int bpc = n <= 2 ? 1 : n <= 4 ? 2 : n <= 16 ? 4 : 8;
+        u8* samples = AllocArray<u8>((size_t)w * h);
+        for (int y = 0; y < h; y++) {
+            const u8* p = bgr + (size_t)y * stride;
+            for (int x = 0; x < w; x++, p += 3) {
+                samples[(size_t)y * w + x] = (u8)table->Add(BgrColor(p));
+            }
+        }
+        str::Str packed;
+        PackSamples(packed, samples, w, h, bpc);
+        free(samples);
+        ok = DeflateTo(page.data, (const u8*)packed.Get(), packed.size());
+        page.dict.AppendFmt("/ColorSpace[/Indexed/DeviceRGB %d <", n - 1);
+        for (int i = 0; i < n; i++) {
+            page.dict.AppendFmt("%06x", table->colors[i]);
+        }
+        page.dict.AppendFmt(">]/BitsPerComponent %d/Filter/FlateDecode", bpc);
+    } else if (isPhoto && EncodeJpeg(page.data, bgr, w, h, stride)) {
+        ok = true;
+        page.dict.Append("/ColorSpace/DeviceRGB/BitsPerComponent 8/Filter/DCTDecode");
+    } else {
+        page.data.Reset();
+        u8* rgb = AllocArray<u8>((size_t)w * 3 * h);
+        for (int y = 0; y < h; y++) {
+            const u8* s = bgr + (size_t)y * stride;
+            u8* d = rgb + (size_t)y * w * 3;
+            for (int x = 0; x < w; x++, s += 3, d += 3) {
+                d[0] = s[2];
+                d[1] = s[1];
+                d[2] = s[0];
+            }
+        }
+        ok = DeflateTo(page.data, rgb, (size_t)w * 3 * h);
+        free(rgb);
+        page.dict.Append("/ColorSpace/DeviceRGB/BitsPerComponent 8/Filter/FlateDecode");
+    }
+    delete table;
+    return ok;
+}
+
+static bool RenderExportedPage(fz_context* ctx, EngineBase* engine, int pageNo, float zoom, ExportedPage& page) {
+    RenderPageArgs args(pageNo, zoom, 0, nullptr, RenderTarget::Export);
+    RenderedBitmap* bmp = engine->RenderPage(args);
+    if (!bmp) {
+        return false;
+    }
+
+    int w = bmp->Size().dx;
+    int h = bmp->Size().dy;
+    int stride = ((w * 3 + 3) / 4) * 4;
+    u8* data = AllocArray<u8>((size_t)stride * h);
+    bool ok = false;
+    if (data) {
+        BITMAPINFO bmi = {0};
+        bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+        bmi.bmiHeader.biWidth = w;
+        bmi.bmiHeader.biHeight = -h;
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 24;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        HDC hDC = GetDC(nullptr);
+        ok = GetDIBits(hDC, bmp->GetBitmap(), 0, h, data, &bmi, DIB_RGB_COLORS) != 0;
+        ReleaseDC(nullptr, hDC);
+    }
+    delete bmp;
+
+    if (ok) {
+        ok = EncodeExportedPage(ctx, data, w, h, stride, page);
+    }
+    free(data);
+    return ok;
+}
+
+class PdfExporter;
+
+class PdfExportThread : public ThreadBase {
+  public:
+    PdfExporter* exporter = nullptr;
+
+    explicit PdfExportThread(PdfExporter* exporter) : ThreadBase("PdfExportThread"), exporter(exporter) {
+    }
+    ~PdfExportThread() override {
+    }
+
+    void Run() override;
+};
+
+// Renders and encodes pages on PdfExportThreads (which call the engine
+// concurrently, as the render cache does) while RenderToFile writes the
+// already finished ones to the file in order. Pages are kept in a ring of
+// RENDER_TO_FILE_MAX_PAGES_AHEAD slots, so that memory is bounded by the
+// pages in flight and not by the document's page count.
+class PdfExporter {
+    CRITICAL_SECTION access;
+    // signaled whenever a page has been rendered
+    HANDLE pageDone = nullptr;
+    // signaled whenever a page has been written
+    HANDLE pageWritten = nullptr;
+    EngineBase* engine = nullptr;
+    float zoom = 1.f;
+    int pageCount = 0;
+    int nextToRender = 1;
+    int nextToWrite = 1;
+    bool stopped = false;
+    ExportedPage pages[RENDER_TO_FILE_MAX_PAGES_AHEAD];
+    Vec<PdfExportThread*> threads;
+
+  public:
+    PdfExporter(EngineBase* engine, float zoom) : engine(engine), zoom(zoom) {
+        InitializeCriticalSection(&access);
+        pageDone = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        pageWritten = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        pageCount = engine->PageCount();
+        int nThreads = std::min(RENDER_TO_FILE_THREADS, pageCount);
+        for (int i = 0; i < nThreads; i++) {
+            threads.Append(new PdfExportThread(this));
+        }
+        for (PdfExportThread* thread : threads) {
+            thread->Start();
+        }
+    }
+
+    ~PdfExporter() {
+        EnterCriticalSection(&access);
+        stopped = true;
+        LeaveCriticalSection(&access);
+        for (PdfExportThread* thread : threads) {
+            // waiting threads notice that they've been stopped within 100 ms
+            thread->Join();
+            delete thread;
+        }
+        CloseHandle(pageDone);
+        CloseHandle(pageWritten);
+        DeleteCriticalSection(&access);
+    }
+
+    // called on the PdfExportThreads (with a context of their own for encoding)
+    void RenderPages(fz_context* ctx) {
+        for (;;) {
+            EnterCriticalSection(&access);
+            if (stopped || nextToRender > pageCount) {
+                LeaveCriticalSection(&access);
+                return;
+            }
+            int pageNo = nextToRender;
+            // the slot of pageNo is free once the page before it has been written
+            bool mayRender = pageNo < nextToWrite + RENDER_TO_FILE_MAX_PAGES_AHEAD;
+            if (mayRender) {
+                nextToRender++;
+            }
+            LeaveCriticalSection(&access);
+            if (!mayRender) {
+                WaitForSingleObject(pageWritten, 100);
+                continue;
+            }
+
+            ExportedPage& page = pages[pageNo % RENDER_TO_FILE_MAX_PAGES_AHEAD];
+            bool ok = RenderExportedPage(ctx, engine, pageNo, zoom, page);
+
+            EnterCriticalSection(&access);
+            page.ok = ok;
+            page.isDone = true;
+            LeaveCriticalSection(&access);
+            SetEvent(pageDone);
+        }
+    }
+
+    // returns nullptr if the page couldn't be rendered
+    ExportedPage* WaitForPage(int pageNo) {
+        ExportedPage& page = pages[pageNo % RENDER_TO_FILE_MAX_PAGES_AHEAD];
+        for (;;) {
+            EnterCriticalSection(&access);
+            bool isDone = page.isDone;
+            LeaveCriticalSection(&access);
+            if (isDone) {
+                return page.ok ? &page : nullptr;
+            }
+            WaitForSingleObject(pageDone, 100);
+        }
+    }
+
+    // frees the page's slot for a page further ahead
+    void ReleasePage(int pageNo) {
+        EnterCriticalSection(&access);
+        ExportedPage& page = pages[pageNo % RENDER_TO_FILE_MAX_PAGES_AHEAD];
+        page.dict.Reset();
+        page.data.Reset();
+        page.isDone = false;
+        page.ok = false;
+        nextToWrite++;
+        LeaveCriticalSection(&access);
+        SetEvent(pageWritten);
+    }
+};
+
+void PdfExportThread::Run() {
+    // without a context, black and white pages aren't CCITT encoded
+    fz_context* ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+    if (ctx) {
+        installFitzErrorCallbacks(ctx);
+    }
+    exporter->RenderPages(ctx);
+    if (ctx) {
+        fz_flush_warnings(ctx);
+        fz_drop_context(ctx);
+    }
+}
+
+// writes a PDF object with a stream and returns its offset
+static int64_t WritePdfStreamObject(fz_context* ctx, fz_output* out, int num, const char* dict,
+                                    const char* data, size_t len) {
+    int64_t offset = fz_tell_output(ctx, out);
+    fz_write_printf(ctx, out, "%d 0 obj\n<<%s/Length %d>>\nstream\n", num, dict, (int)len);
+    fz_write_data(ctx, out, data, len);
+    fz_write_string(ctx, out, "\nendstream\nendobj\n");
+    return offset;
+}
+
+// PDF text strings are written as UTF-16BE with a BOM, so that they don't need escaping
+static void WritePdfTextString(fz_context* ctx, fz_output* out, const WCHAR* s) {
+    fz_write_string(ctx, out, "<FEFF");
+    for (; *s; s++) {
+        fz_write_printf(ctx, out, "%04x", (int)(u16)*s);
+    }
+    fz_write_string(ctx, out, ">");
+}
+
+// creates a simple PDF with all pages rendered as a single image. Pages are
+// rendered and encoded in parallel and written to the file as soon as
+// all preceding pages have been written, so that (unlike with a pdf_document)
+// exporting a document of thousands of pages doesn't need memory for all of them
 bool PdfCreator::RenderToFile(const char* pdfFileName, EngineBase* engine, int dpi) {
-    PdfCreator* c = new PdfCreator();
-    bool ok = true;
-    // render all pages to images
+    int pageCount = engine->PageCount();
+    if (pageCount < 1) {
+        return false;
+    }
+    fz_context* ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+    if (!ctx) {
+        return false;
+    }
+    installFitzErrorCallbacks(ctx);
+
+    // objects 1 to 3 are the catalog, the page tree and the document info,
+    // each page is made of an image, a content stream and a page object
+    int objCount = 4 + 3 * pageCount;
+    Vec<int64_t> offsets;
+    offsets.AppendBlanks(objCount);
+
     float zoom = dpi / engine->GetFileDPI();
-    for (int i = 1; ok && i <= engine->PageCount(); i++) {
-        RenderPageArgs args(i, zoom, 0, nullptr, RenderTarget::Export);
-        RenderedBitmap* bmp = engine->RenderPage(args);
-        ok = false;
-        if (bmp) {
-            ok = AddPageFromHBITMAP(c, bmp->GetBitmap(), bmp->Size(), dpi);
+    PdfExporter* exporter = new PdfExporter(engine, zoom);
+    fz_output* out = nullptr;
+    bool ok = false;
+
+    fz_var(out);
+    fz_var(ok);
+
+    fz_try(ctx) {
+        out = fz_new_output_with_path(ctx, pdfFileName, 0);
+        fz_write_string(ctx, out, "%PDF-1.4\n%\xE2\xE3\xCF\xD3\n");
+
+        for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+            ExportedPage* page = exporter->WaitForPage(pageNo);
+            if (!page) {
+                fz_throw(ctx, FZ_ERROR_GENERIC, "failed to render page %d", pageNo);
+            }
+            int imageNum = 4 + 3 * (pageNo - 1);
+            int w = page->size.dx;
+            int h = page->size.dy;
+            AutoFree dict =
+                str::Format("/Type/XObject/Subtype/Image/Width %d/Height %d%s", w, h, page->dict.Get());
+            offsets[imageNum] = WritePdfStreamObject(ctx, out, imageNum, dict, page->data.Get(), page->data.size());
+            exporter->ReleasePage(pageNo);
+
+            float dx = w * 72.f / dpi;
+            float dy = h * 72.f / dpi;
+            AutoFree content = str::Format("q %.4f 0 0 %.4f 0 0 cm /Im0 Do Q", dx, dy);
+            offsets[imageNum + 1] =
+                WritePdfStreamObject(ctx, out, imageNum + 1, "", content, str::Len(content));
+
+            offsets[imageNum + 2] = fz_tell_output(ctx, out);
+            AutoFree pageDict = str::Format("%d 0 obj\n<</Type/Page/Parent 2 0 R/MediaBox[0 0 %.4f %.4f]"
+                                            "/Resources<</XObject<</Im0 %d 0 R>>>>/Contents %d 0 R>>\nendobj\n",
+                                            imageNum + 2, dx, dy, imageNum, imageNum + 1);
+            fz_write_string(ctx, out, pageDict);
         }
-        delete bmp;
+
+        offsets[1] = fz_tell_output(ctx, out);
+        fz_write_string(ctx, out, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+
+        offsets[2] = fz_tell_output(ctx, out);
+        fz_write_string(ctx, out, "2 0 obj\n<</Type/Pages/Kids[");
+        for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+            fz_write_printf(ctx, out, "%d 0 R ", 4 + 3 * (pageNo - 1) + 2);
+        }
+        fz_write_printf(ctx, out, "]/Count %d>>\nendobj\n", pageCount);
+
+        offsets[3] = fz_tell_output(ctx, out);
+        fz_write_string(ctx, out, "3 0 obj\n<<");
+        for (DocumentProperty prop : propsToCopy) {
+            AutoFreeWstr value = engine->GetProperty(prop);
+            if (value) {
+                fz_write_printf(ctx, out, "/%s", GetPdfPropName(prop));
+                WritePdfTextString(ctx, out, value);
+            }
+        }
+        if (gPdfProducer) {
+            fz_write_printf(ctx, out, "/%s", GetPdfPropName(DocumentProperty::PdfProducer));
+            WritePdfTextString(ctx, out, gPdfProducer);
+        }
+        fz_write_string(ctx, out, ">>\nendobj\n");
+
+        int64_t xrefOffset = fz_tell_output(ctx, out);
+        fz_write_printf(ctx, out, "xref\n0 %d\n0000000000 65535 f \n", objCount);
+        for (int num = 1; num < objCount; num++) {
+            char entry[32];
+            snprintf(entry, sizeof(entry), "%010lld 00000 n \n", (long long)offsets[num]);
+            fz_write_string(ctx, out, entry);
+        }
+        fz_write_printf(ctx, out, "trailer\n<</Size %d/Root 1 0 R/Info 3 0 R>>\n", objCount);
+        char startxref[48];
+        snprintf(startxref, sizeof(startxref), "startxref\n%lld\n%%%%EOF\n", (long long)xrefOffset);
+        fz_write_string(ctx, out, startxref);
+        fz_close_output(ctx, out);
+        ok = true;
     }
+    fz_always(ctx) {
+        fz_drop_output(ctx, out);
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+
+    delete exporter;
+    fz_flush_warnings(ctx);
+    fz_drop_context(ctx);
     if (!ok) {
-        delete c;
-        return false;
+        AutoFreeWstr path = strconv::Utf8ToWstr(pdfFileName);
+        file::Delete(path);
     }
-    c->CopyProperties(engine);
-    ok = c->SaveToFile(pdfFileName);
-    delete c;
     return ok;
 }
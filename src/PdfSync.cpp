@@ -4,6 +4,7 @@
 #include "utils/BaseUtil.h"
 #include <synctex_parser.h>
 #include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
 #include "utils/FileUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -30,15 +31,22 @@ struct PdfsyncFileIndex {
     size_t start, end; // first and one-after-last index of lines associated with a file
 };
 
+// records are kept at 16 bytes so that the index of a large document stays small
 struct PdfsyncLine {
-    UINT record; // index for mapping line(s) to point(s)
-    size_t file; // index into srcfiles
-    UINT line, column;
+    u32 record; // index for mapping line(s) to point(s)
+    u32 file;   // index into srcfiles
+    u32 line, column;
 };
 
 struct PdfsyncPoint {
-    UINT record; // index for mapping point(s) to line(s)
-    UINT page, x, y;
+    u32 record; // index for mapping point(s) to line(s)
+    u32 page, x, y;
+};
+
+// lines and points sorted by record number for binary searches
+struct PdfsyncRecordIdx {
+    u32 record;
+    u32 idx; // index into lines or points
 };
 
 // Synchronizer based on .pdfsync file generated with the pdfsync tex package
@@ -47,12 +55,17 @@ class Pdfsync : public Synchronizer {
     Pdfsync(const WCHAR* syncfilename, EngineBase* engine) : Synchronizer(syncfilename), engine(engine) {
         CrashIf(!str::EndsWithI(syncfilename, PDFSYNC_EXTENSION));
     }
+    ~Pdfsync() override {
+        WaitForPreload();
+    }
 
-    int DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) override;
-    int SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) override;
+  protected:
+    int RebuildIndex() override;
+    int DocToSourceFromIndex(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) override;
+    int SourceToDocFromIndex(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) override;
 
   private:
-    int RebuildIndex();
+    int ParseSyncData(const char* data, size_t len);
     UINT SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<size_t>& records);
 
     EngineBase* engine;              // needed for converting between coordinate systems
@@ -61,6 +74,11 @@ class Pdfsync : public Synchronizer {
     Vec<PdfsyncPoint> points;        // record-to-point mapping
     Vec<PdfsyncFileIndex> fileIndex; // start and end of entries for a file in <lines>
     Vec<size_t> sheetIndex;          // start of entries for a sheet in <points>
+    // built on first use (inverse search only needs lineRecords, forward search only pointRecords)
+    Vec<PdfsyncRecordIdx> lineRecords;
+    Vec<PdfsyncRecordIdx> pointRecords;
+    // digest of the data the index was built from (LaTeX often rewrites an unchanged file)
+    u8 dataDigest[16] = {0};
 };
 
 // Synchronizer based on .synctex file generated with SyncTex
@@ -70,22 +88,43 @@ class SyncTex : public Synchronizer {
         : Synchronizer(syncfilename), engine(engine), scanner(nullptr) {
         CrashIf(!str::EndsWithI(syncfilename, SYNCTEX_EXTENSION));
     }
-    virtual ~SyncTex() {
+    ~SyncTex() override {
+        WaitForPreload();
         synctex_scanner_free(scanner);
     }
 
-    int DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) override;
-    int SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) override;
+  protected:
+    int RebuildIndex() override;
+    int DocToSourceFromIndex(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) override;
+    int SourceToDocFromIndex(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) override;
 
   private:
-    int RebuildIndex();
 
     EngineBase* engine; // needed for converting between coordinate systems
     synctex_scanner_t scanner;
 };
 
+// number of forward search answers kept per synchronizer
+#define MAX_RECENT_SYNC_RESULTS 16
+
+struct SourceToDocResult {
+    AutoFreeWstr srcfilename;
+    UINT line = 0;
+    UINT col = 0;
+    int res = PDFSYNCERR_SUCCESS;
+    UINT page = 0;
+    Vec<Rect> rects;
+};
+
 Synchronizer::Synchronizer(const WCHAR* syncfilepath) : indexDiscarded(true), syncfilepath(str::Dup(syncfilepath)) {
     _wstat(syncfilepath, &syncfileTimestamp);
+    InitializeCriticalSection(&indexAccess);
+}
+
+Synchronizer::~Synchronizer() {
+    WaitForPreload();
+    DeleteVecMembers(recentResults);
+    DeleteCriticalSection(&indexAccess);
 }
 
 bool Synchronizer::IsIndexDiscarded() const {
@@ -109,9 +148,94 @@ int Synchronizer::RebuildIndex() {
     indexDiscarded = false;
     // save sync file timestamp
     _wstat(syncfilepath, &syncfileTimestamp);
+    DeleteVecMembers(recentResults);
     return PDFSYNCERR_SUCCESS;
 }
 
+// must be called with indexAccess held
+int Synchronizer::EnsureIndex() {
+    if (IsIndexDiscarded() && RebuildIndex() != PDFSYNCERR_SUCCESS) {
+        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+    }
+    return PDFSYNCERR_SUCCESS;
+}
+
+DWORD WINAPI Synchronizer::PreloadThread(void* data) {
+    Synchronizer* sync = (Synchronizer*)data;
+    ScopedCritSec scope(&sync->indexAccess);
+    sync->EnsureIndex();
+    return 0;
+}
+
+void Synchronizer::PreloadIndex() {
+    if (!preloadThread) {
+        preloadThread = CreateThread(nullptr, 0, PreloadThread, this, 0, nullptr);
+    }
+}
+
+void Synchronizer::WaitForPreload() {
+    if (preloadThread) {
+        WaitForSingleObject(preloadThread, INFINITE);
+        CloseHandle(preloadThread);
+        preloadThread = nullptr;
+    }
+}
+
+int Synchronizer::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
+    ScopedCritSec scope(&indexAccess);
+    int res = EnsureIndex();
+    if (res != PDFSYNCERR_SUCCESS) {
+        return res;
+    }
+    return DocToSourceFromIndex(pageNo, pt, filename, line, col);
+}
+
+// the same queries tend to repeat (e.g. FindWindowInfoBySyncFile asks every
+// document whether it knows a source file) so recent answers are remembered
+int Synchronizer::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) {
+    ScopedCritSec scope(&indexAccess);
+    int res = EnsureIndex();
+    if (res != PDFSYNCERR_SUCCESS) {
+        return res;
+    }
+
+    for (size_t i = 0; i < recentResults.size(); i++) {
+        SourceToDocResult* r = recentResults.at(i);
+        if (r->line != line || r->col != col || !str::EqI(r->srcfilename, srcfilename)) {
+            continue;
+        }
+        recentResults.RemoveAt(i);
+        recentResults.InsertAt(0, r);
+        if (PDFSYNCERR_SUCCESS == r->res) {
+            *page = r->page;
+            rects.Reset();
+            for (Rect& rc : r->rects) {
+                rects.Append(rc);
+            }
+        }
+        return r->res;
+    }
+
+    res = SourceToDocFromIndex(srcfilename, line, col, page, rects);
+
+    SourceToDocResult* r = new SourceToDocResult();
+    r->srcfilename.SetCopy(srcfilename);
+    r->line = line;
+    r->col = col;
+    r->res = res;
+    if (PDFSYNCERR_SUCCESS == res) {
+        r->page = *page;
+        for (Rect& rc : rects) {
+            r->rects.Append(rc);
+        }
+    }
+    recentResults.InsertAt(0, r);
+    if (recentResults.size() > MAX_RECENT_SYNC_RESULTS) {
+        delete recentResults.Pop();
+    }
+    return res;
+}
+
 WCHAR* Synchronizer::PrependDir(const WCHAR* filename) const {
     AutoFreeWstr dir(path::GetDir(syncfilepath));
     return path::Join(dir, filename);
@@ -183,38 +307,105 @@ WCHAR* Synchronizer::PrepareCommandline(const WCHAR* pattern, const WCHAR* filen
 
 // PDFSYNC synchronizer
 
-// move to the next line in a list of zero-terminated lines
-static char* Advance0Line(char* line, char* end) {
-    line += str::Len(line);
-    // skip all zeroes until the next non-empty line
-    for (; line < end && !*line; line++) {
+// read-only view of a sync file (which for large documents
+// can be tens of megabytes) so that it doesn't have to be copied
+class MappedSyncFile {
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMap = nullptr;
+
+  public:
+    const char* data = nullptr;
+    size_t size = 0;
+
+    explicit MappedSyncFile(const WCHAR* path) {
+        hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0 || fileSize.QuadPart > INT_MAX) {
+            return;
+        }
+        hMap = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!hMap) {
+            return;
+        }
+        data = (const char*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+        size = data ? (size_t)fileSize.QuadPart : 0;
+    }
+    ~MappedSyncFile() {
+        if (data) {
+            UnmapViewOfFile(data);
+        }
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
+        }
+    }
+};
+
+// returns the next non-empty line (which isn't zero-terminated) and moves pos past it
+static const char* NextSyncLine(const char*& pos, const char* end, size_t* len) {
+    for (; pos < end && ('\r' == *pos || '\n' == *pos || '\0' == *pos); pos++) {
+        ;
+    }
+    if (pos >= end) {
+        return nullptr;
+    }
+    const char* line = pos;
+    for (; pos < end && '\r' != *pos && '\n' != *pos && '\0' != *pos; pos++) {
         ;
     }
-    return line < end ? line : nullptr;
+    *len = pos - line;
+    return line;
 }
 
 // see http://itexmac.sourceforge.net/pdfsync.html for the specification
 int Pdfsync::RebuildIndex() {
-    AutoFree data(file::ReadFile(syncfilepath));
-    if (!data.data) {
+    MappedSyncFile file(syncfilepath);
+    if (!file.data) {
         return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
     }
-    // convert the file data into a list of zero-terminated strings
-    str::TransChars(data.data, "\r\n", "\0\0");
 
-    // parse preamble (jobname and version marker)
-    char* line = data.data;
-    char* dataEnd = data.data + data.size();
+    // a compilation that didn't change anything only touches the file's timestamp
+    u8 digest[16];
+    CalcFastDigest(file.data, file.size, digest);
+    if (srcfiles.size() > 0 && memeq(digest, dataDigest, sizeof(digest))) {
+        return Synchronizer::RebuildIndex();
+    }
+
+    int res = ParseSyncData(file.data, file.size);
+    if (res != PDFSYNCERR_SUCCESS) {
+        ZeroMemory(dataDigest, sizeof(dataDigest));
+        return res;
+    }
+    memcpy(dataDigest, digest, sizeof(digest));
+    return Synchronizer::RebuildIndex();
+}
 
+int Pdfsync::ParseSyncData(const char* data, size_t len) {
+    const char* pos = data;
+    const char* dataEnd = data + len;
+
+    // parse preamble (jobname and version marker)
+    size_t lineLen = 0;
+    const char* line = NextSyncLine(pos, dataEnd, &lineLen);
+    if (!line) {
+        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+    }
+    AutoFree jobNameA(str::DupN(line, lineLen));
     // replace star by spaces (TeX uses stars instead of spaces in filenames)
-    str::TransChars(line, "*/", " \\");
-    AutoFreeWstr jobName(strconv::FromAnsi(line));
+    str::TransChars(jobNameA.Get(), "*/", " \\");
+    AutoFreeWstr jobName(strconv::FromAnsi(jobNameA.Get()));
     jobName.Set(str::Join(jobName, L".tex"));
     jobName.Set(PrependDir(jobName));
 
-    line = Advance0Line(line, dataEnd);
+    line = NextSyncLine(pos, dataEnd, &lineLen);
     UINT versionNumber = 0;
-    if (!line || !str::Parse(line, "version %u", &versionNumber) || versionNumber != 1) {
+    if (!line || !str::Parse(line, lineLen, "version %u", &versionNumber) || versionNumber != 1) {
         return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
     }
 
@@ -224,6 +415,8 @@ int Pdfsync::RebuildIndex() {
     points.Reset();
     fileIndex.Reset();
     sheetIndex.Reset();
+    lineRecords.Reset();
+    pointRecords.Reset();
 
     Vec<size_t> filestack;
     UINT page = 1;
@@ -241,16 +434,16 @@ int Pdfsync::RebuildIndex() {
     // parse data
     UINT maxPageNo = engine->PageCount();
     while (true) {
-        line = Advance0Line(line, dataEnd);
+        line = NextSyncLine(pos, dataEnd, &lineLen);
         if (!line) {
             break;
         }
         switch (*line) {
             case 'l':
-                psline.file = filestack.Last();
-                if (str::Parse(line, "l %u %u %u", &psline.record, &psline.line, &psline.column)) {
+                psline.file = (u32)filestack.Last();
+                if (str::Parse(line, lineLen, "l %u %u %u", &psline.record, &psline.line, &psline.column)) {
                     lines.Append(psline);
-                } else if (str::Parse(line, "l %u %u", &psline.record, &psline.line)) {
+                } else if (str::Parse(line, lineLen, "l %u %u", &psline.record, &psline.line)) {
                     psline.column = 0;
                     lines.Append(psline);
                 }
@@ -258,7 +451,7 @@ int Pdfsync::RebuildIndex() {
                 break;
 
             case 's':
-                if (str::Parse(line, "s %u", &page)) {
+                if (str::Parse(line, lineLen, "s %u", &page)) {
                     sheetIndex.Append(points.size());
                 }
                 // else dbg("Bad 's' line in the pdfsync file");
@@ -270,16 +463,17 @@ int Pdfsync::RebuildIndex() {
                 pspoint.page = page;
                 if (0 == page || page > maxPageNo) {
                     /* ignore point for invalid page number */;
-                } else if (str::Parse(line, "p %u %u %u", &pspoint.record, &pspoint.x, &pspoint.y)) {
+                } else if (str::Parse(line, lineLen, "p %u %u %u", &pspoint.record, &pspoint.x, &pspoint.y)) {
                     points.Append(pspoint);
-                } else if (str::Parse(line, "p* %u %u %u", &pspoint.record, &pspoint.x, &pspoint.y)) {
+                } else if (str::Parse(line, lineLen, "p* %u %u %u", &pspoint.record, &pspoint.x, &pspoint.y)) {
                     points.Append(pspoint);
                 }
                 // else dbg("Bad 'p' line in the pdfsync file");
                 break;
 
             case '(': {
-                AutoFreeWstr filename(strconv::FromAnsi(line + 1));
+                AutoFree filenameA(str::DupN(line + 1, lineLen - 1));
+                AutoFreeWstr filename(strconv::FromAnsi(filenameA.Get()));
                 // if the filename contains quotes then remove them
                 // TODO: this should never happen!?
                 if (filename[0] == '"' && filename[str::Len(filename) - 1] == '"') {
@@ -318,22 +512,35 @@ int Pdfsync::RebuildIndex() {
     fileIndex.at(0).end = lines.size();
     SubmitCrashIf(filestack.size() != 1);
 
-    return Synchronizer::RebuildIndex();
+    return PDFSYNCERR_SUCCESS;
 }
 
 // convert a coordinate from the sync file into a PDF coordinate
 #define SYNC_TO_PDF_COORDINATE(c) (c / 65781.76)
 
-static int cmpLineRecords(const void* a, const void* b) {
-    return ((PdfsyncLine*)a)->record - ((PdfsyncLine*)b)->record;
+template <typename T>
+static void BuildRecordIndex(Vec<PdfsyncRecordIdx>& index, Vec<T>& items) {
+    index.Reset();
+    for (size_t i = 0; i < items.size(); i++) {
+        index.Append({items.at(i).record, (u32)i});
+    }
+    // items with the same record stay in the order of declaration
+    std::sort(index.begin(), index.end(), [](const PdfsyncRecordIdx& a, const PdfsyncRecordIdx& b) {
+        return a.record < b.record || (a.record == b.record && a.idx < b.idx);
+    });
 }
 
-int Pdfsync::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
-    if (IsIndexDiscarded()) {
-        if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
-            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
-        }
+// returns the first entry for record (or index.end() if there's none)
+static PdfsyncRecordIdx* FindRecord(Vec<PdfsyncRecordIdx>& index, u32 record) {
+    PdfsyncRecordIdx* it = std::lower_bound(
+        index.begin(), index.end(), record, [](const PdfsyncRecordIdx& a, u32 rec) { return a.record < rec; });
+    if (it != index.end() && it->record != record) {
+        return index.end();
     }
+    return it;
+}
+
+int Pdfsync::DocToSourceFromIndex(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
 
     // find the entry in the index corresponding to this page
     UINT nPages = (UINT)engine->PageCount();
@@ -380,14 +587,14 @@ int Pdfsync::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* li
     }
 
     // We have a record number, we need to find its declaration ('l ...') in the syncfile
-    PdfsyncLine cmp;
-    cmp.record = selected_record;
-    PdfsyncLine* found =
-        (PdfsyncLine*)bsearch(&cmp, lines.LendData(), lines.size(), sizeof(PdfsyncLine), cmpLineRecords);
-    CrashIf(!found);
-    if (!found) {
+    if (lineRecords.size() != lines.size()) {
+        BuildRecordIndex(lineRecords, lines);
+    }
+    PdfsyncRecordIdx* rec = FindRecord(lineRecords, selected_record);
+    if (rec == lineRecords.end()) {
         return PDFSYNCERR_NO_SYNC_AT_LOCATION;
     }
+    PdfsyncLine* found = &lines.at(rec->idx);
 
     filename.SetCopy(srcfiles.at(found->file));
     *line = found->line;
@@ -470,12 +677,7 @@ UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<
     return PDFSYNCERR_SUCCESS;
 }
 
-int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) {
-    if (IsIndexDiscarded()) {
-        if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
-            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
-        }
-    }
+int Pdfsync::SourceToDocFromIndex(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) {
 
     Vec<size_t> found_records;
     UINT ret = SourceToRecord(srcfilename, line, col, found_records);
@@ -487,11 +689,21 @@ int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* pa
 
     // records have been found for the desired source position:
     // we now find the page and positions in the PDF corresponding to these found records
-    UINT firstPage = UINT_MAX;
-    for (size_t i = 0; i < points.size(); i++) {
-        if (!found_records.Contains(points.at(i).record)) {
-            continue;
+    if (pointRecords.size() != points.size()) {
+        BuildRecordIndex(pointRecords, points);
+    }
+    Vec<u32> pointIdxs;
+    for (size_t record : found_records) {
+        PdfsyncRecordIdx* rec = FindRecord(pointRecords, (u32)record);
+        for (; rec != pointRecords.end() && rec->record == (u32)record; rec++) {
+            pointIdxs.Append(rec->idx);
         }
+    }
+    // the first page is the one of the first point declared in the sync file
+    std::sort(pointIdxs.begin(), pointIdxs.end());
+
+    UINT firstPage = UINT_MAX;
+    for (u32 i : pointIdxs) {
         if (firstPage != UINT_MAX && firstPage != points.at(i).page) {
             continue;
         }
@@ -529,12 +741,7 @@ int SyncTex::RebuildIndex() {
     return Synchronizer::RebuildIndex();
 }
 
-int SyncTex::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
-    if (IsIndexDiscarded()) {
-        if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
-            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
-        }
-    }
+int SyncTex::DocToSourceFromIndex(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
     CrashIf(!this->scanner);
 
     // Coverity: at this point, this->scanner->flags.has_parsed == 1 and thus
@@ -580,12 +787,7 @@ TryAgainAnsi:
     return PDFSYNCERR_SUCCESS;
 }
 
-int SyncTex::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) {
-    if (IsIndexDiscarded()) {
-        if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
-            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
-        }
-    }
+int SyncTex::SourceToDocFromIndex(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) {
     CrashIf(!this->scanner);
 
     AutoFreeWstr srcfilepath;
@@ -19,12 +19,12 @@ enum {
 };
 
 class EngineBase;
+struct SourceToDocResult;
 
 class Synchronizer {
   public:
     explicit Synchronizer(const WCHAR* syncfilepath);
-    virtual ~Synchronizer() {
-    }
+    virtual ~Synchronizer();
 
     // Inverse-search:
     //  - pageNo: page number in the PDF (starting from 1)
@@ -33,11 +33,15 @@ class Synchronizer {
     //  - filename: receives the name of the source file
     //  - line: receives the line number
     //  - col: receives the column number
-    virtual int DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) = 0;
+    int DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col);
 
     // Forward-search:
     // The result is returned in page and rects (list of rectangles to highlight).
-    virtual int SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) = 0;
+    int SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects);
+
+    // starts building the index on a background thread so that the
+    // first search after a (re)load doesn't have to wait for it
+    void PreloadIndex();
 
     // the caller must free() the command line
     WCHAR* PrepareCommandline(const WCHAR* pattern, const WCHAR* filename, UINT line, UINT col);
@@ -47,9 +51,24 @@ class Synchronizer {
                          // pdfsync file is detected)
     struct _stat syncfileTimestamp; // time stamp of sync file when index was last built
 
+    // guards the index which is either built by PreloadIndex or on first use
+    CRITICAL_SECTION indexAccess;
+    HANDLE preloadThread = nullptr;
+    // answers to recent forward searches (most recent first, cleared when the index is rebuilt)
+    Vec<SourceToDocResult*> recentResults;
+
+    int EnsureIndex();
+    static DWORD WINAPI PreloadThread(void* data);
+
   protected:
     bool IsIndexDiscarded() const;
-    int RebuildIndex();
+    // implementations must call Synchronizer::RebuildIndex after successfully building their index
+    virtual int RebuildIndex() = 0;
+    virtual int DocToSourceFromIndex(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) = 0;
+    virtual int SourceToDocFromIndex(const WCHAR* srcfilename, UINT line, UINT col, UINT* page,
+                                     Vec<Rect>& rects) = 0;
+    // must be called by the destructors of implementations before freeing their index
+    void WaitForPreload();
     WCHAR* PrependDir(const WCHAR* filename) const;
 
     AutoFreeWstr syncfilepath; // path to the synchronization file
@@ -5,6 +5,8 @@
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
 #include "utils/UITask.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 #include "utils/Log.h"
 
@@ -42,11 +44,20 @@ struct PrintData {
     Vec<SelectionOnPage> sel;   // empty when printing a page range
     Print_Advanced_Data advData;
     int rotation = 0;
+    // pages needing larger bitmaps are printed in bands of bandHeight pixels
+    size_t maxBitmapBytes = 0;
+    int bandHeight = 0;
+    // pages without transparency are printed as vector graphics
+    bool vectorPrinting = false;
 
     PrintData(EngineBase* engine, PRINTER_INFO_2* printerInfo, DEVMODEW* devMode, Vec<PRINTPAGERANGE>& ranges,
               Print_Advanced_Data& advData, int rotation = 0, Vec<SelectionOnPage>* sel = nullptr) {
         this->advData = advData;
         this->rotation = rotation;
+        int maxBitmapMb = gGlobalPrefs->printerDefaults.maxBitmapSize;
+        maxBitmapBytes = (size_t)(maxBitmapMb > 0 ? maxBitmapMb : 64) * 1024 * 1024;
+        bandHeight = gGlobalPrefs->printerDefaults.bandHeight;
+        vectorPrinting = gGlobalPrefs->printerDefaults.vectorPrinting;
         if (engine) {
             this->engine = engine->Clone();
         }
@@ -101,6 +112,376 @@ class AbortCookieManager {
     }
 };
 
+// device properties needed for placing a page on the paper
+struct PrintPageLayout {
+    Size paperSize;
+    Rect printable;
+    float dpiFactor = 1.f;
+    bool printPortrait = true;
+    PrintScaleAdv scale = PrintScaleAdv::Shrink;
+    size_t maxBitmapBytes = 0;
+    bool vectorPrinting = false;
+};
+
+struct PrintPageJob {
+    int pageNo = 0;
+    // set by LayoutPrintPage
+    float zoom = 1.f;
+    int rotation = 0;
+    Point offset;
+    // true if the page is too large for rendering it as a single bitmap
+    bool needsBands = false;
+    // true if the page can be printed as vector graphics (and thus needs no bitmap)
+    bool isVector = false;
+    // set once the page has been rendered (bmp can be nullptr if rendering failed)
+    RenderedBitmap* bmp = nullptr;
+    bool isRendered = false;
+    // time spent laying out and rendering the page (on whichever thread)
+    double renderMs = 0;
+};
+
+// per job statistics for tuning the print path: each page's timings
+// are logged as it's spooled and the totals once the job is done
+struct PrintStats {
+    int pages = 0;
+    int vectorPages = 0;
+    int bandedPages = 0;
+    int failedPages = 0;
+    int shrinkRetries = 0;
+    double renderMs = 0;
+    double spoolMs = 0;
+    double totalMs = 0;
+    size_t maxBitmapBytes = 0;
+
+    void Log() const {
+        logf("Print: %d pages in %.1f ms (render: %.1f ms, spool: %.1f ms), %d as vectors, %d in bands, %d failed, "
+             "%d shrink retries, largest bitmap: %d KB\n",
+             pages, totalMs, renderMs, spoolMs, vectorPages, bandedPages, failedPages, shrinkRetries,
+             (int)(maxBitmapBytes / 1024));
+    }
+};
+
+static void LayoutPrintPage(EngineBase& engine, const PrintPageLayout& layout, PrintPageJob& job) {
+    int pageNo = job.pageNo;
+    const Size& paperSize = layout.paperSize;
+    const Rect& printable = layout.printable;
+    float dpiFactor = layout.dpiFactor;
+
+    SizeF pSize = engine.PageMediabox(pageNo).Size();
+    int rotation = 0;
+    // Turn the document by 90 deg if it isn't in portrait mode
+    if (pSize.dx > pSize.dy) {
+        rotation += 90;
+        std::swap(pSize.dx, pSize.dy);
+    }
+    // make sure not to print upside-down
+    rotation = (rotation % 180) == 0 ? 0 : 270;
+    // finally turn the page by (another) 90 deg in landscape mode
+    if (!layout.printPortrait) {
+        rotation = (rotation + 90) % 360;
+        std::swap(pSize.dx, pSize.dy);
+    }
+
+    // dpiFactor means no physical zoom
+    float zoom = dpiFactor;
+    // offset of the top-left corner of the page from the printable area
+    // (negative values move the page into the left/top margins, etc.);
+    // offset adjustments are needed because the GDI coordinate system
+    // starts at the corner of the printable area and we rather want to
+    // center the page on the physical paper (except for PrintScaleNone
+    // where the page starts at the very top left of the physical paper so
+    // that printing forms/labels of varying size remains reliably possible)
+    Point offset(-printable.x, -printable.y);
+
+    if (layout.scale != PrintScaleAdv::None) {
+        // make sure to fit all content into the printable area when scaling
+        // and the whole document page on the physical paper
+        RectF rect = engine.PageContentBox(pageNo, RenderTarget::Print);
+        RectF cbox = engine.Transform(rect, pageNo, 1.0, rotation);
+        zoom = std::min((float)printable.dx / cbox.dx,
+                        std::min((float)printable.dy / cbox.dy,
+                                 std::min((float)paperSize.dx / pSize.dx, (float)paperSize.dy / pSize.dy)));
+        // use the correct zoom values, if the page fits otherwise
+        // and the user didn't ask for anything else (default setting)
+        if (PrintScaleAdv::Shrink == layout.scale && dpiFactor < zoom) {
+            zoom = dpiFactor;
+        }
+        // center the page on the physical paper
+        offset.x += (int)(paperSize.dx - pSize.dx * zoom) / 2;
+        offset.y += (int)(paperSize.dy - pSize.dy * zoom) / 2;
+        // make sure that no content lies in the non-printable paper margins
+        RectF onPaper(printable.x + offset.x + cbox.x * zoom, printable.y + offset.y + cbox.y * zoom,
+                      cbox.dx * zoom, cbox.dy * zoom);
+        if (onPaper.x < printable.x) {
+            offset.x += (int)(printable.x - onPaper.x);
+        } else if (onPaper.BR().x > printable.BR().x) {
+            offset.x -= (int)(onPaper.BR().x - printable.BR().x);
+        }
+        if (onPaper.y < printable.y) {
+            offset.y += (int)(printable.y - onPaper.y);
+        } else if (onPaper.BR().y > printable.BR().y) {
+            offset.y -= (int)(onPaper.BR().y - printable.BR().y);
+        }
+    }
+
+    job.zoom = zoom;
+    job.rotation = rotation;
+    job.offset = offset;
+
+    Rect pageRc = engine.Transform(engine.PageMediabox(pageNo), pageNo, zoom, rotation).Round();
+    job.needsBands = (size_t)pageRc.dx * pageRc.dy * 4 > layout.maxBitmapBytes;
+}
+
+static RenderedBitmap* RenderPrintPage(EngineBase& engine, const PrintPageJob& job, short shrink,
+                                       AbortCookieManager* abortCookie) {
+    RenderPageArgs args(job.pageNo, job.zoom / shrink, job.rotation, nullptr, RenderTarget::Print);
+    if (abortCookie) {
+        args.cookie_out = &abortCookie->cookie;
+    }
+    RenderedBitmap* bmp = engine.RenderPage(args);
+    if (abortCookie) {
+        abortCookie->Clear();
+    }
+    return bmp;
+}
+
+// draws a page as vector graphics or, if hdc is nullptr, checks whether that's possible
+static bool PrintPageAsVectors(HDC hdc, EngineBase& engine, const PrintPageJob& job,
+                               AbortCookieManager* abortCookie) {
+    RenderPageArgs args(job.pageNo, job.zoom, job.rotation, nullptr, RenderTarget::Print);
+    if (abortCookie) {
+        args.cookie_out = &abortCookie->cookie;
+    }
+    bool ok = engine.RenderPageToDC(hdc, args, job.offset);
+    if (abortCookie) {
+        abortCookie->Clear();
+    }
+    return ok;
+}
+
+// lays out a page and renders it, unless it's printed as vector graphics
+// or is so large that the print thread has to render it in bands
+static RenderedBitmap* PreparePrintPage(EngineBase& engine, const PrintPageLayout& layout, PrintPageJob& job,
+                                        AbortCookieManager* abortCookie) {
+    auto t = TimeGet();
+    LayoutPrintPage(engine, layout, job);
+    RenderedBitmap* bmp = nullptr;
+    if (layout.vectorPrinting && PrintPageAsVectors(nullptr, engine, job, abortCookie)) {
+        job.isVector = true;
+    } else if (!job.needsBands) {
+        bmp = RenderPrintPage(engine, job, 1, abortCookie);
+    }
+    job.renderMs = TimeSinceInMs(t);
+    return bmp;
+}
+
+// prints a page at full resolution in horizontal bands of at most bandDy pixels,
+// so that large pages (e.g. for plotters) don't need a single huge bitmap
+static bool PrintPageInBands(HDC hdc, EngineBase& engine, const PrintPageJob& job, int bandDy,
+                             ProgressUpdateUI* progressUI, AbortCookieManager* abortCookie) {
+    int pageNo = job.pageNo;
+    RectF pageRect = engine.Transform(engine.PageMediabox(pageNo), pageNo, job.zoom, job.rotation);
+    Rect pageRc = pageRect.Round();
+    bandDy = std::max(bandDy, 1);
+    for (int y = 0; y < pageRc.dy; y += bandDy) {
+        if (progressUI && progressUI->WasCanceled()) {
+            return false;
+        }
+        RectF band((float)pageRc.x, (float)(pageRc.y + y), (float)pageRc.dx, (float)std::min(bandDy, pageRc.dy - y));
+        RectF bandOnPage = engine.Transform(band, pageNo, job.zoom, job.rotation, true);
+        RenderPageArgs args(pageNo, job.zoom, job.rotation, &bandOnPage, RenderTarget::Print);
+        if (abortCookie) {
+            args.cookie_out = &abortCookie->cookie;
+        }
+        RenderedBitmap* bmp = engine.RenderPage(args);
+        if (abortCookie) {
+            abortCookie->Clear();
+        }
+        bool ok = false;
+        if (bmp && bmp->GetBitmap()) {
+            auto size = bmp->Size();
+            Rect rc(job.offset.x, job.offset.y + y, size.dx, size.dy);
+            ok = bmp->StretchDIBits(hdc, rc);
+        }
+        delete bmp;
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// number of threads rendering pages ahead of the page being spooled
+// (each of them uses its own clone of the engine)
+#define PRINT_RENDER_THREADS 2
+// how many pages may be rendered ahead of the page being spooled
+#define PRINT_MAX_PAGES_AHEAD 4
+// how much memory rendered but not yet spooled pages may use
+#define PRINT_MAX_BYTES_AHEAD (256 * 1024 * 1024)
+
+class PrintPipeline;
+
+class PrintRenderThread : public ThreadBase {
+  public:
+    PrintPipeline* pipeline = nullptr;
+    EngineBase* engine = nullptr;
+    AbortCookieManager cookie;
+
+    PrintRenderThread(PrintPipeline* pipeline, EngineBase* engine)
+        : ThreadBase("PrintRenderThread"), pipeline(pipeline), engine(engine) {
+    }
+    ~PrintRenderThread() override {
+        delete engine;
+    }
+
+    void Run() override;
+};
+
+// Renders pages on PrintRenderThreads while the print thread spools
+// the already rendered ones to the printer, so that rasterization
+// and spooling overlap. If no engine clone could be created, pages
+// are rendered on the print thread instead.
+class PrintPipeline {
+    CRITICAL_SECTION access;
+    // signaled whenever a page has been rendered
+    HANDLE pageRendered = nullptr;
+    // signaled whenever a page has been spooled
+    HANDLE pageSpooled = nullptr;
+    Vec<PrintPageJob> jobs;
+    PrintPageLayout layout;
+    Vec<PrintRenderThread*> threads;
+    size_t nextToRender = 0;
+    size_t nextToSpool = 0;
+    size_t bytesAhead = 0;
+    bool stopped = false;
+
+  public:
+    PrintPipeline(EngineBase* engine, const PrintPageLayout& layout, const Vec<int>& pageNos) : layout(layout) {
+        InitializeCriticalSection(&access);
+        pageRendered = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        pageSpooled = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        for (int pageNo : pageNos) {
+            PrintPageJob* job = jobs.AppendBlanks(1);
+            *job = PrintPageJob();
+            job->pageNo = pageNo;
+        }
+        int nThreads = jobs.size() > 1 ? PRINT_RENDER_THREADS : 0;
+        for (int i = 0; i < nThreads; i++) {
+            EngineBase* clone = engine->Clone();
+            if (!clone) {
+                break;
+            }
+            threads.Append(new PrintRenderThread(this, clone));
+        }
+        for (PrintRenderThread* thread : threads) {
+            thread->Start();
+        }
+    }
+
+    ~PrintPipeline() {
+        EnterCriticalSection(&access);
+        stopped = true;
+        LeaveCriticalSection(&access);
+        for (PrintRenderThread* thread : threads) {
+            thread->cookie.Abort();
+            thread->RequestCancel();
+        }
+        for (PrintRenderThread* thread : threads) {
+            // waiting threads notice that they've been stopped within 100 ms
+            thread->Join();
+            delete thread;
+        }
+        for (PrintPageJob& job : jobs) {
+            delete job.bmp;
+        }
+        CloseHandle(pageRendered);
+        CloseHandle(pageSpooled);
+        DeleteCriticalSection(&access);
+    }
+
+    size_t PageCount() const {
+        return jobs.size();
+    }
+
+    // called on the PrintRenderThreads
+    void RenderPages(PrintRenderThread* thread) {
+        for (;;) {
+            EnterCriticalSection(&access);
+            if (stopped || nextToRender >= jobs.size()) {
+                LeaveCriticalSection(&access);
+                return;
+            }
+            size_t idx = nextToRender;
+            // the page to be spooled next is always rendered, further pages
+            // only as long as they don't use too much memory
+            bool mayRender = idx == nextToSpool || (idx < nextToSpool + PRINT_MAX_PAGES_AHEAD &&
+                                                     bytesAhead < PRINT_MAX_BYTES_AHEAD);
+            if (mayRender) {
+                nextToRender++;
+            }
+            LeaveCriticalSection(&access);
+            if (!mayRender) {
+                WaitForSingleObject(pageSpooled, 100);
+                continue;
+            }
+
+            PrintPageJob& job = jobs.at(idx);
+            RenderedBitmap* bmp = PreparePrintPage(*thread->engine, layout, job, &thread->cookie);
+
+            EnterCriticalSection(&access);
+            job.bmp = bmp;
+            job.isRendered = true;
+            if (bmp) {
+                bytesAhead += (size_t)bmp->Size().dx * bmp->Size().dy * 4;
+            }
+            LeaveCriticalSection(&access);
+            SetEvent(pageRendered);
+        }
+    }
+
+    // returns nullptr if printing was canceled while waiting for the page
+    PrintPageJob* WaitForPage(size_t idx, EngineBase& engine, ProgressUpdateUI* progressUI,
+                              AbortCookieManager* abortCookie) {
+        PrintPageJob& job = jobs.at(idx);
+        if (threads.size() == 0) {
+            job.bmp = PreparePrintPage(engine, layout, job, abortCookie);
+            job.isRendered = true;
+            return &job;
+        }
+        for (;;) {
+            EnterCriticalSection(&access);
+            bool isRendered = job.isRendered;
+            LeaveCriticalSection(&access);
+            if (isRendered) {
+                return &job;
+            }
+            if (progressUI && progressUI->WasCanceled()) {
+                return nullptr;
+            }
+            WaitForSingleObject(pageRendered, 100);
+        }
+    }
+
+    // frees the page's bitmap after it has been spooled
+    void ReleasePage(size_t idx) {
+        EnterCriticalSection(&access);
+        PrintPageJob& job = jobs.at(idx);
+        if (job.bmp) {
+            size_t bytes = (size_t)job.bmp->Size().dx * job.bmp->Size().dy * 4;
+            bytesAhead -= std::min(bytes, bytesAhead);
+            delete job.bmp;
+            job.bmp = nullptr;
+        }
+        nextToSpool = idx + 1;
+        LeaveCriticalSection(&access);
+        SetEvent(pageSpooled);
+    }
+};
+
+void PrintRenderThread::Run() {
+    pipeline->RenderPages(this);
+}
+
 static RectF BoundSelectionOnPage(const Vec<SelectionOnPage>& sel, int pageNo) {
     RectF bounds;
     for (size_t i = 0; i < sel.size(); i++) {
@@ -111,8 +492,9 @@ static RectF BoundSelectionOnPage(const Vec<SelectionOnPage>& sel, int pageNo) {
     return bounds;
 }
 
+// returns false if printing failed, was canceled or some pages couldn't be printed
 static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI* progressUI = nullptr,
-                          AbortCookieManager* abortCookie = nullptr) {
+                          AbortCookieManager* abortCookie = nullptr, PrintStats* stats = nullptr) {
     CrashIf(!pd.engine);
     if (!pd.engine) {
         return false;
@@ -261,6 +643,7 @@ static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI* progressUI = nu
     }
 
     // print all the pages the user requested
+    Vec<int> pageNos;
     for (size_t i = 0; i < pd.ranges.size(); i++) {
         int dir = pd.ranges.at(i).nFromPage > pd.ranges.at(i).nToPage ? -1 : 1;
         for (DWORD pageNo = pd.ranges.at(i).nFromPage; pageNo != pd.ranges.at(i).nToPage + dir; pageNo += dir) {
@@ -268,100 +651,115 @@ static bool PrintToDevice(const PrintData& pd, ProgressUpdateUI* progressUI = nu
                 (PrintRangeAdv::Odd == pd.advData.range && pageNo % 2 == 0)) {
                 continue;
             }
-            if (progressUI) {
-                progressUI->UpdateProgress(current, total);
-            }
+            pageNos.Append((int)pageNo);
+        }
+    }
 
-            StartPage(hdc);
+    PrintPageLayout layout;
+    layout.paperSize = paperSize;
+    layout.printable = printable;
+    layout.dpiFactor = dpiFactor;
+    layout.printPortrait = bPrintPortrait;
+    layout.scale = pd.advData.scale;
+    layout.maxBitmapBytes = pd.maxBitmapBytes;
+    layout.vectorPrinting = pd.vectorPrinting;
 
-            SizeF pSize = engine.PageMediabox(pageNo).Size();
-            int rotation = 0;
-            // Turn the document by 90 deg if it isn't in portrait mode
-            if (pSize.dx > pSize.dy) {
-                rotation += 90;
-                std::swap(pSize.dx, pSize.dy);
-            }
-            // make sure not to print upside-down
-            rotation = (rotation % 180) == 0 ? 0 : 270;
-            // finally turn the page by (another) 90 deg in landscape mode
-            if (!bPrintPortrait) {
-                rotation = (rotation + 90) % 360;
-                std::swap(pSize.dx, pSize.dy);
-            }
+    PrintStats localStats;
+    if (!stats) {
+        stats = &localStats;
+    }
+    auto total = TimeGet();
+    PrintPipeline pipeline(&engine, layout, pageNos);
 
-            // dpiFactor means no physical zoom
-            float zoom = dpiFactor;
-            // offset of the top-left corner of the page from the printable area
-            // (negative values move the page into the left/top margins, etc.);
-            // offset adjustments are needed because the GDI coordinate system
-            // starts at the corner of the printable area and we rather want to
-            // center the page on the physical paper (except for PrintScaleNone
-            // where the page starts at the very top left of the physical paper so
-            // that printing forms/labels of varying size remains reliably possible)
-            Point offset(-printable.x, -printable.y);
-
-            if (pd.advData.scale != PrintScaleAdv::None) {
-                // make sure to fit all content into the printable area when scaling
-                // and the whole document page on the physical paper
-                RectF rect = engine.PageContentBox(pageNo, RenderTarget::Print);
-                RectF cbox = engine.Transform(rect, pageNo, 1.0, rotation);
-                zoom = std::min((float)printable.dx / cbox.dx,
-                                std::min((float)printable.dy / cbox.dy,
-                                         std::min((float)paperSize.dx / pSize.dx, (float)paperSize.dy / pSize.dy)));
-                // use the correct zoom values, if the page fits otherwise
-                // and the user didn't ask for anything else (default setting)
-                if (PrintScaleAdv::Shrink == pd.advData.scale && dpiFactor < zoom) {
-                    zoom = dpiFactor;
-                }
-                // center the page on the physical paper
-                offset.x += (int)(paperSize.dx - pSize.dx * zoom) / 2;
-                offset.y += (int)(paperSize.dy - pSize.dy * zoom) / 2;
-                // make sure that no content lies in the non-printable paper margins
-                RectF onPaper(printable.x + offset.x + cbox.x * zoom, printable.y + offset.y + cbox.y * zoom,
-                              cbox.dx * zoom, cbox.dy * zoom);
-                if (onPaper.x < printable.x) {
-                    offset.x += (int)(printable.x - onPaper.x);
-                } else if (onPaper.BR().x > printable.BR().x) {
-                    offset.x -= (int)(onPaper.BR().x - printable.BR().x);
-                }
-                if (onPaper.y < printable.y) {
-                    offset.y += (int)(printable.y - onPaper.y);
-                } else if (onPaper.BR().y > printable.BR().y) {
-                    offset.y -= (int)(onPaper.BR().y - printable.BR().y);
-                }
-            }
+    for (size_t i = 0; i < pipeline.PageCount(); i++) {
+        if (progressUI) {
+            progressUI->UpdateProgress(current, total);
+        }
 
-            bool ok = false;
-            short shrink = 1;
-            do {
-                RenderPageArgs args(pageNo, zoom / shrink, rotation, nullptr, RenderTarget::Print);
-                if (abortCookie) {
-                    args.cookie_out = &abortCookie->cookie;
-                }
-                RenderedBitmap* bmp = engine.RenderPage(args);
-                if (abortCookie) {
-                    abortCookie->Clear();
-                }
-                if (bmp && bmp->GetBitmap()) {
-                    auto size = bmp->Size();
-                    Rect rc(offset.x, offset.y, size.dx * shrink, size.dy * shrink);
-                    ok = bmp->StretchDIBits(hdc, rc);
-                }
-                delete bmp;
-                shrink *= 2;
-            } while (!ok && shrink < 32 && !(progressUI && progressUI->WasCanceled()));
-            // TODO: abort if !ok?
+        PrintPageJob* job = pipeline.WaitForPage(i, engine, progressUI, abortCookie);
+        if (!job) {
+            AbortDoc(hdc);
+            return false;
+        }
 
-            if (EndPage(hdc) <= 0 || progressUI && progressUI->WasCanceled()) {
-                AbortDoc(hdc);
-                return false;
+        StartPage(hdc);
+
+        auto t = TimeGet();
+        bool ok = false;
+        if (job->isVector) {
+            ok = PrintPageAsVectors(hdc, engine, *job, abortCookie);
+        }
+        RenderedBitmap* bmp = job->bmp;
+        Size bmpSize;
+        if (!ok && bmp && bmp->GetBitmap()) {
+            bmpSize = bmp->Size();
+            Rect rc(job->offset.x, job->offset.y, bmpSize.dx, bmpSize.dy);
+            ok = bmp->StretchDIBits(hdc, rc);
+        }
+        double spoolMs = TimeSinceInMs(t);
+        double renderMs = job->renderMs;
+        bool isVector = job->isVector && ok;
+        bool isBanded = false;
+        int shrinkRetries = 0;
+        pipeline.ReleasePage(i);
+        if (!ok && !(progressUI && progressUI->WasCanceled())) {
+            // render large pages (or pages whose bitmap couldn't be allocated
+            // or spooled) in bands so that they're still printed at full resolution
+            int bandDy = pd.bandHeight;
+            if (bandDy <= 0) {
+                Rect pageRc = engine.Transform(engine.PageMediabox(job->pageNo), job->pageNo, job->zoom, job->rotation)
+                                  .Round();
+                size_t maxBytes = job->needsBands ? pd.maxBitmapBytes : pd.maxBitmapBytes / 4;
+                bandDy = (int)(maxBytes / ((size_t)std::max(pageRc.dx, 1) * 4));
             }
-            current++;
+            // bands are rendered and spooled in turns, so count them as spooling
+            t = TimeGet();
+            ok = PrintPageInBands(hdc, engine, *job, bandDy, progressUI, abortCookie);
+            spoolMs += TimeSinceInMs(t);
+            isBanded = ok;
+        }
+        // as a last resort, retry at lower resolutions
+        for (short shrink = 2; !ok && shrink < 32 && !(progressUI && progressUI->WasCanceled()); shrink *= 2) {
+            shrinkRetries++;
+            t = TimeGet();
+            bmp = RenderPrintPage(engine, *job, shrink, abortCookie);
+            renderMs += TimeSinceInMs(t);
+            if (bmp && bmp->GetBitmap()) {
+                bmpSize = bmp->Size();
+                Rect rc(job->offset.x, job->offset.y, bmpSize.dx * shrink, bmpSize.dy * shrink);
+                t = TimeGet();
+                ok = bmp->StretchDIBits(hdc, rc);
+                spoolMs += TimeSinceInMs(t);
+            }
+            delete bmp;
         }
+
+        size_t bmpBytes = (size_t)bmpSize.dx * bmpSize.dy * 4;
+        logf("Print: page %d: %s, render: %.1f ms, bitmap: %dx%d (%d KB), spool: %.1f ms, shrink retries: %d\n",
+             job->pageNo, !ok ? "failed" : isVector ? "vectors" : isBanded ? "bands" : "bitmap", renderMs,
+             bmpSize.dx, bmpSize.dy, (int)(bmpBytes / 1024), spoolMs, shrinkRetries);
+        stats->pages++;
+        stats->vectorPages += isVector ? 1 : 0;
+        stats->bandedPages += isBanded ? 1 : 0;
+        stats->failedPages += ok ? 0 : 1;
+        stats->shrinkRetries += shrinkRetries;
+        stats->renderMs += renderMs;
+        stats->spoolMs += spoolMs;
+        stats->maxBitmapBytes = std::max(stats->maxBitmapBytes, bmpBytes);
+
+        if (EndPage(hdc) <= 0 || progressUI && progressUI->WasCanceled()) {
+            AbortDoc(hdc);
+            stats->totalMs = TimeSinceInMs(total);
+            stats->Log();
+            return false;
+        }
+        current++;
     }
 
     EndDoc(hdc);
-    return true;
+    stats->totalMs = TimeSinceInMs(total);
+    stats->Log();
+    return stats->failedPages == 0;
 }
 
 class PrintThreadData : public ProgressUpdateUI {
@@ -373,6 +771,7 @@ class PrintThreadData : public ProgressUpdateUI {
 
     PrintData* data = nullptr;
     HANDLE thread = nullptr; // close the print thread handle after execution
+    PrintStats stats;
 
     PrintThreadData(WindowInfo* win, PrintData* data) {
         this->win = win;
@@ -417,8 +816,7 @@ class PrintThreadData : public ProgressUpdateUI {
     }
 };
 
-static DWORD WINAPI PrintThread(LPVOID data) {
-    PrintThreadData* threadData = (PrintThreadData*)data;
+static void PrintThread(PrintThreadData* threadData) {
     WindowInfo* win = threadData->win;
     // wait for PrintToDeviceOnThread to return so that we
     // close the correct handle to the current printing thread
@@ -427,22 +825,31 @@ static DWORD WINAPI PrintThread(LPVOID data) {
     }
 
     HANDLE thread = threadData->thread = win->printThread;
-    PrintToDevice(*threadData->data, threadData, &threadData->cookie);
+    PrintToDevice(*threadData->data, threadData, &threadData->cookie, &threadData->stats);
 
     uitask::Post([=] {
         if (WindowInfoStillValid(win) && thread == win->printThread) {
             win->printThread = nullptr;
         }
+        const PrintStats& stats = threadData->stats;
+        if (WindowInfoStillValid(win) && !threadData->WasCanceled() && stats.pages > 0) {
+            AutoFreeWstr msg(str::Format(_TR("Printed %d pages in %.1f s (rendering: %.1f s, spooling: %.1f s)"),
+                                         stats.pages, stats.totalMs / 1000, stats.renderMs / 1000,
+                                         stats.spoolMs / 1000));
+            if (stats.failedPages > 0) {
+                msg.Set(str::Format(L"%s - %s", msg.Get(), _TR("some pages couldn't be printed")));
+            }
+            win->ShowNotification(msg, stats.failedPages > 0 ? NOS_HIGHLIGHT : NOS_WITH_TIMEOUT);
+        }
         delete threadData;
     });
-    return 0;
 }
 
 static void PrintToDeviceOnThread(WindowInfo* win, PrintData* data) {
     CrashIf(win->printThread);
     PrintThreadData* threadData = new PrintThreadData(win, data);
     win->printThread = nullptr;
-    win->printThread = CreateThread(nullptr, 0, PrintThread, threadData, 0, nullptr);
+    win->printThread = RunAsyncWithHandle([threadData] { PrintThread(threadData); });
 }
 
 void AbortPrinting(WindowInfo* win) {
@@ -907,9 +1314,14 @@ bool PrintFile(EngineBase* engine, WCHAR* printerName, bool displayErrors, const
         ApplyPrintSettings(printerName, settings, engine->PageCount(), ranges, advanced, devMode);
 
         PrintData pd(engine, infoData, devMode, ranges, advanced);
-        ok = PrintToDevice(pd);
+        PrintStats stats;
+        ok = PrintToDevice(pd, nullptr, nullptr, &stats);
         if (!ok && displayErrors) {
-            MessageBoxWarning(nullptr, _TR("Couldn't initialize printer"), _TR("Printing problem."));
+            const WCHAR* msg = _TR("Couldn't initialize printer");
+            if (stats.failedPages > 0) {
+                msg = _TR("Some pages couldn't be printed");
+            }
+            MessageBoxWarning(nullptr, msg, _TR("Printing problem."));
         }
     }
 
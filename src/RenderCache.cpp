@@ -6,6 +6,8 @@
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
 #include "utils/Log.h"
+#include "utils/Trace.h"
+#include "utils/SlowOps.h"
 #include "utils/LogDbg.h"
 
 #include "wingui/TreeModel.h"
@@ -13,12 +15,14 @@
 #include "Annotation.h"
 #include "EngineBase.h"
 #include "EngineCreate.h"
+#include "EnginePdf.h"
 #include "DisplayMode.h"
 #include "SettingsStructs.h"
 #include "Controller.h"
 #include "DisplayModel.h"
 #include "GlobalPrefs.h"
 #include "RenderCache.h"
+#include "DiskTileCache.h"
 #include "TextSelection.h"
 
 #pragma warning(disable : 28159) // silence /analyze: Consider using 'GetTickCount64' instead of 'GetTickCount'
@@ -29,6 +33,17 @@
    due to insufficient (GDI) memory. */
 #define CONSERVE_MEMORY
 
+// page previews are rendered at a quarter of the resolution
+// (i.e. they need a 16th of the time and memory of the whole page)
+#define PREVIEW_ZOOM_FACTOR 0.25f
+
+// tiles estimated to take longer than kSlowTileMs to render are split further (up to
+// MAX_EXTRA_TILE_RES times), so that the parts render in parallel and appear one after
+// another. tiles of pages estimated to take less than kFastTileMs get larger instead
+constexpr double kSlowTileMs = 200;
+constexpr double kFastTileMs = 25;
+#define MAX_EXTRA_TILE_RES 2
+
 bool gShowTileLayout = false;
 
 RenderCache::RenderCache() : maxTileSize({GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN)}) {
@@ -42,18 +57,22 @@ RenderCache::RenderCache() : maxTileSize({GetSystemMetrics(SM_CXSCREEN), GetSyst
     InitializeCriticalSection(&cacheAccess);
     InitializeCriticalSection(&requestAccess);
 
+    SetMaxCacheSizeMB(0);
+
     startRendering = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    renderThread = CreateThread(nullptr, 0, RenderCacheThread, this, 0, 0);
-    CrashIf(nullptr == renderThread);
+    StartWorker();
 }
 
 RenderCache::~RenderCache() {
     EnterCriticalSection(&requestAccess);
     EnterCriticalSection(&cacheAccess);
 
-    CloseHandle(renderThread);
+    for (int i = 0; i < workersCount; i++) {
+        CrashIf(workers[i].curReq);
+        CloseHandle(workers[i].thread);
+    }
     CloseHandle(startRendering);
-    CrashIf(curReq || 0 != requestCount || 0 != cacheCount);
+    CrashIf(0 != requestCount || 0 != cacheCount);
 
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
@@ -61,22 +80,126 @@ RenderCache::~RenderCache() {
     DeleteCriticalSection(&requestAccess);
 }
 
+void RenderCache::StartWorker() {
+    CrashIf(workersCount >= MAX_RENDER_THREADS);
+    RenderWorker* worker = &workers[workersCount];
+    worker->cache = this;
+    worker->thread = CreateThread(nullptr, 0, RenderCacheThread, worker, 0, 0);
+    CrashIf(nullptr == worker->thread);
+    workersCount++;
+}
+
+void RenderCache::SetRenderThreadsCount(int n) {
+    if (n <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        // leave one processor for the UI thread and don't use too many
+        // engine clones as each of them costs (at least) a parsed document
+        n = std::min((int)si.dwNumberOfProcessors - 1, 4);
+    }
+    n = limitValue(n, 1, MAX_RENDER_THREADS);
+
+    ScopedCritSec scope(&requestAccess);
+    while (workersCount < n) {
+        StartWorker();
+    }
+}
+
+void RenderCache::SetMaxCacheSizeMB(int sizeMB) {
+    size_t size = (size_t)sizeMB * 1024 * 1024;
+    if (sizeMB <= 0) {
+        // enough for several screen-sized tiles (but at least 256 MB)...
+        int dx = GetSystemMetrics(SM_CXVIRTUALSCREEN);
+        int dy = GetSystemMetrics(SM_CYVIRTUALSCREEN);
+        size_t screenSize = (size_t)dx * (size_t)dy * 4;
+        size = std::max(screenSize * 8, (size_t)256 * 1024 * 1024);
+        // ... without taking more than a quarter of the physical memory
+        MEMORYSTATUSEX ms{};
+        ms.dwLength = sizeof(ms);
+        if (GlobalMemoryStatusEx(&ms)) {
+            size = (size_t)std::min((DWORDLONG)size, ms.ullTotalPhys / 4);
+        }
+#ifndef _WIN64
+        // 32-bit processes run out of address space much sooner
+        size = std::min(size, (size_t)512 * 1024 * 1024);
+#endif
+    }
+
+    ScopedCritSec scope(&cacheAccess);
+    maxCacheSize = size;
+}
+
+// bitmaps rendered for one DisplayModel can be used for any other one
+// showing the same file (e.g. in another tab or window)
+static bool IsSameDocument(DisplayModel* dm1, DisplayModel* dm2) {
+    if (dm1 == dm2) {
+        return true;
+    }
+    if (!dm1->docId || !dm2->docId || !str::EqI(dm1->docId, dm2->docId)) {
+        return false;
+    }
+    // in-memory modifications are (by definition) not in the file
+    return !EnginePdfHasUnsavedAnnotations(dm1->GetEngine()) && !EnginePdfHasUnsavedAnnotations(dm2->GetEngine());
+}
+
+// entries belong to the DisplayModel they've last been used for,
+// so that they're kept for as long as that one shows them
+static void UseCacheEntry(BitmapCacheEntry* e, DisplayModel* dm) {
+    e->refs++;
+    e->lastUsed = GetTickCount();
+    e->dm = dm;
+}
+
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
    <rotation> and <zoom> in the cache - call DropCacheEntry when you
    no longer need a found entry. */
 BitmapCacheEntry* RenderCache::Find(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
     ScopedCritSec scope(&cacheAccess);
     rotation = NormalizeRotation(rotation);
+    BitmapCacheEntry* shared = nullptr;
     for (int i = 0; i < cacheCount; i++) {
         BitmapCacheEntry* e = cache[i];
-        if ((dm == e->dm) && (pageNo == e->pageNo) && (rotation == e->rotation) &&
-            (INVALID_ZOOM == zoom || zoom == e->zoom) && (!tile || e->tile == *tile)) {
-            e->refs++;
+        if ((pageNo == e->pageNo) && (rotation == e->rotation) && (INVALID_ZOOM == zoom || zoom == e->zoom) &&
+            (!tile || e->tile == *tile) && !e->isPreview) {
             CrashIf(i != e->cacheIdx);
-            return e;
+            if (dm == e->dm) {
+                UseCacheEntry(e, dm);
+                return e;
+            }
+            if (!shared && IsSameDocument(dm, e->dm)) {
+                shared = e;
+            }
         }
     }
-    return nullptr;
+    if (shared) {
+        UseCacheEntry(shared, dm);
+    }
+    return shared;
+}
+
+/* Find the preview of a page (at any zoom level) - call DropCacheEntry when you
+   no longer need a found entry. */
+BitmapCacheEntry* RenderCache::FindPreview(DisplayModel* dm, int pageNo, int rotation) {
+    ScopedCritSec scope(&cacheAccess);
+    rotation = NormalizeRotation(rotation);
+    BitmapCacheEntry* shared = nullptr;
+    for (int i = 0; i < cacheCount; i++) {
+        BitmapCacheEntry* e = cache[i];
+        if ((pageNo == e->pageNo) && (rotation == e->rotation) && e->isPreview) {
+            CrashIf(i != e->cacheIdx);
+            if (dm == e->dm) {
+                UseCacheEntry(e, dm);
+                return e;
+            }
+            if (!shared && IsSameDocument(dm, e->dm)) {
+                shared = e;
+            }
+        }
+    }
+    if (shared) {
+        UseCacheEntry(shared, dm);
+    }
+    return shared;
 }
 
 bool RenderCache::Exists(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
@@ -109,6 +232,8 @@ bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
     dbglogf("RenderCache::DropCacheEntry: pageNo: %d, rotation: %d, zoom: %.2f\n", entry->pageNo, entry->rotation,
             entry->zoom);
 
+    CrashIf(cacheSize < entry->nBytes);
+    cacheSize -= entry->nBytes;
     delete entry;
 
     // fast removal by replacing freed item with the item at the end
@@ -124,40 +249,136 @@ bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
     return true;
 }
 
-static bool FreeIfFull(RenderCache* rc, const PageRenderRequest& req) {
-    int n = rc->cacheCount;
-    if (n < MAX_BITMAPS_CACHED) {
+// pages that are visible or about to become visible shouldn't be freed
+static bool IsPageNeeded(DisplayModel* dm, int pageNo) {
+    return dm->PageVisibleNearby(pageNo) || dm->PagePrefetched(pageNo);
+}
+
+// memory used by the bitmap's pixels
+static size_t GetBitmapMemorySize(RenderedBitmap* bmp) {
+    HBITMAP hbmp = bmp ? bmp->GetBitmap() : nullptr;
+    if (!hbmp) {
+        return 0;
+    }
+    BITMAP info{};
+    if (GetObject(hbmp, sizeof(info), &info) == 0) {
+        Size size = bmp->Size();
+        return (size_t)size.dx * (size_t)size.dy * 4;
+    }
+    return (size_t)info.bmWidthBytes * (size_t)info.bmHeight;
+}
+
+static bool IsCacheFull(RenderCache* rc, size_t nBytes) {
+    if (rc->cacheCount >= MAX_BITMAPS_CACHED) {
         return true;
     }
+    return rc->cacheSize + nBytes > rc->maxCacheSize;
+}
 
-    DisplayModel* dm = req.dm;
-    // free an invisible page of the same DisplayModel ...
-    for (int i = 0; i < n; i++) {
-        auto entry = rc->cache[i];
-        if (entry->dm == dm && !dm->PageVisibleNearby(entry->pageNo)) {
-            bool didDrop = rc->DropCacheEntry(entry);
-            if (didDrop) {
-                return true;
-            }
+static bool CanPack(BitmapCacheEntry* e) {
+    return e->bitmap && !e->packTried;
+}
+
+// replaces e's bitmap with a compressed copy, if that saves at least half of its memory
+// must be called within cacheAccess
+static bool PackCacheEntry(RenderCache* rc, BitmapCacheEntry* e) {
+    CrashIf(e->refs > 1);
+    e->packTried = true;
+    // entries not currently used for painting aren't selected into a DC
+    str::Str data;
+    if (!PackTileBitmap(e->bitmap, data) || data.size() > e->nBytes / 2) {
+        return false;
+    }
+    e->packedLen = data.size();
+    e->packed = (u8*)data.StealData();
+    delete e->bitmap;
+    e->bitmap = nullptr;
+
+    rc->cacheSize -= e->nBytes - e->packedLen;
+    e->nBytes = e->packedLen;
+    return true;
+}
+
+// returns the entry's bitmap, unpacking it if needed (the cache may temporarily
+// exceed its memory budget until FreeIfFull packs or drops other entries)
+static RenderedBitmap* GetCacheEntryBitmap(RenderCache* rc, BitmapCacheEntry* e) {
+    ScopedCritSec scope(&rc->cacheAccess);
+    if (e->bitmap || !e->packed) {
+        return e->bitmap;
+    }
+    RenderedBitmap* bmp = UnpackTileBitmap({e->packed, e->packedLen});
+    if (!bmp) {
+        return nullptr;
+    }
+    size_t nBytes = GetBitmapMemorySize(bmp);
+    rc->cacheSize += nBytes - e->nBytes;
+    e->bitmap = bmp;
+    e->nBytes = nBytes;
+    free(e->packed);
+    e->packed = nullptr;
+    e->packedLen = 0;
+    e->packTried = false;
+    return bmp;
+}
+
+// pages not visible are evicted first, then pages from other documents
+// and pinned pages of dm (see DisplayModel::PagePinned) (least recently used
+// first, so that the pages of the most recently selected tabs survive
+// longest); visible pages of dm are never evicted
+// as that leads to flicker, and neither are the current and neighboring
+// slides of a presentation (so that advancing doesn't ever flash)
+// within each group, bitmaps that can still be packed go first (if allowPack),
+// so that entries are only dropped once compressing them no longer helps
+// TODO: it can still flicker if the dm is from a visible tab
+// in a different window, but it's harder to detect
+static BitmapCacheEntry* FindEntryToEvict(RenderCache* rc, DisplayModel* dm, bool allowPack) {
+    DWORD now = GetTickCount();
+    BitmapCacheEntry* res = nullptr;
+    int resPriority = 0;
+    DWORD resAge = 0;
+    for (int i = 0; i < rc->cacheCount; i++) {
+        BitmapCacheEntry* entry = rc->cache[i];
+        if (entry->refs > 1) {
+            // currently used for painting
+            continue;
+        }
+        int priority;
+        bool isNeeded = IsPageNeeded(entry->dm, entry->pageNo);
+        if (!isNeeded && !entry->dm->PagePinned(entry->pageNo)) {
+            priority = 0;
+        } else if (!isNeeded || entry->dm != dm && !entry->dm->GetPresentationMode()) {
+            priority = 1;
+        } else {
+            continue;
+        }
+        priority = priority * 2 + (allowPack && CanPack(entry) ? 0 : 1);
+        DWORD age = now - entry->lastUsed;
+        if (!res || priority < resPriority || (priority == resPriority && age > resAge)) {
+            res = entry;
+            resPriority = priority;
+            resAge = age;
         }
     }
+    return res;
+}
 
-    // ... or just the oldest cached page
-    for (int i = 0; i < n; i++) {
-        auto entry = rc->cache[i];
-        if (entry->dm == dm) {
-            // don't free pages from the document we're currently displaying
-            // as it leads to flicker
-            // TODO: it can still flicker if the dm is from a visible tab
-            // in a different window, but it's harder to detect
+// make room for a bitmap of nBytes, returns false if there's no free slot in rc->cache
+// note: the memory budget can be exceeded if only visible pages are cached
+static bool FreeIfFull(RenderCache* rc, const PageRenderRequest& req, size_t nBytes) {
+    while (IsCacheFull(rc, nBytes)) {
+        // packing doesn't help if all slots are taken
+        bool allowPack = rc->cacheCount < MAX_BITMAPS_CACHED;
+        BitmapCacheEntry* entry = FindEntryToEvict(rc, req.dm, allowPack);
+        if (!entry) {
+            break;
+        }
+        if (allowPack && CanPack(entry) && PackCacheEntry(rc, entry)) {
             continue;
         }
         bool didDrop = rc->DropCacheEntry(entry);
-        if (didDrop) {
-            return true;
-        }
+        CrashIf(!didDrop);
     }
-    return false;
+    return rc->cacheCount < MAX_BITMAPS_CACHED;
 }
 
 void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
@@ -167,18 +388,48 @@ void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
     req.rotation = NormalizeRotation(req.rotation);
     CrashIf(cacheCount > MAX_BITMAPS_CACHED);
 
-    /* It's possible there still is a cached bitmap with different zoom/rotation */
-    FreePage(req.dm, req.pageNo, &req.tile);
+    if (req.isPreview) {
+        // there's only one preview per page
+        for (int i = cacheCount - 1; i >= 0; i--) {
+            BitmapCacheEntry* entry = cache[i];
+            if (entry->isPreview && entry->dm == req.dm && entry->pageNo == req.pageNo) {
+                DropCacheEntry(entry);
+            }
+        }
+    } else {
+        /* It's possible there still is a cached bitmap with different zoom/rotation */
+        FreePage(req.dm, req.pageNo, &req.tile);
+    }
 
-    bool hasSpace = FreeIfFull(this, req);
-    CrashIf(!hasSpace); // TODO: FreeIfFull() might actually fail to free
-    CrashIf(cacheCount > MAX_BITMAPS_CACHED);
+    // another DisplayModel of the same document might have rendered
+    // the same bitmap in the meantime
+    BitmapCacheEntry* shared = req.isPreview ? nullptr : Find(req.dm, req.pageNo, req.rotation, req.zoom, &req.tile);
+    if (shared) {
+        DropCacheEntry(shared);
+        delete bmp;
+        return;
+    }
+
+    size_t nBytes = GetBitmapMemorySize(bmp);
+    bool hasSpace = FreeIfFull(this, req, nBytes);
+    if (!hasSpace) {
+        // all slots are taken by visible pages that are being painted
+        logf("RenderCache::Add: no space for pageNo: %d\n", req.pageNo);
+        delete bmp;
+        return;
+    }
+    CrashIf(cacheCount >= MAX_BITMAPS_CACHED);
 
     // Copy the PageRenderRequest as it will be reused
     auto entry = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bmp);
+    entry->nBytes = nBytes;
+    entry->lastUsed = GetTickCount();
+    entry->isPreview = req.isPreview;
+    entry->isDraft = req.isDraft;
     entry->cacheIdx = cacheCount;
     cache[cacheCount] = entry;
     cacheCount++;
+    cacheSize += nBytes;
 }
 
 static RectF GetTileRect(RectF pagerect, TilePosition tile) {
@@ -250,18 +501,19 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
             shouldFree = (entry->dm == dm) && (entry->pageNo == pageNo);
             if (tile) {
                 // a given tile of the page or all tiles not rendered at a given resolution
-                // (and at resolution 0 for quick zoom previews)
+                // (and at resolution 0 for quick zoom previews) and the page's preview
                 shouldFree =
                     shouldFree && (entry->tile == *tile ||
                                    tile->row == (USHORT)-1 && entry->tile.res > 0 && entry->tile.res != tile->res ||
-                                   tile->row == (USHORT)-1 && entry->tile.res == 0 && entry->outOfDate);
+                                   tile->row == (USHORT)-1 && entry->tile.res == 0 && entry->outOfDate ||
+                                   tile->row == (USHORT)-1 && entry->isPreview);
             }
         } else if (dm) {
             // all pages of this DisplayModel
             shouldFree = (entry->dm == dm);
         } else {
             // all invisible pages resp. page tiles
-            shouldFree = !entry->dm->PageVisibleNearby(entry->pageNo);
+            shouldFree = !IsPageNeeded(entry->dm, entry->pageNo);
             if (!shouldFree && entry->tile.res > 1) {
                 shouldFree = !IsTileVisible(entry->dm, entry->pageNo, entry->tile, 2.0);
             }
@@ -273,22 +525,43 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
 }
 
 void RenderCache::FreeForDisplayModel(DisplayModel* dm) {
+    FreeEngineClones(dm);
     FreePage(dm);
 }
 
+// only needed when we're over the memory budget, otherwise invisible
+// pages are kept until FreeIfFull needs their space
 void RenderCache::FreeNotVisible() {
+    {
+        ScopedCritSec scope(&cacheAccess);
+        if (cacheSize <= maxCacheSize) {
+            return;
+        }
+    }
     FreePage();
 }
 
 // keep the cached bitmaps for visible pages to avoid flickering during a reload.
 // mark invisible pages as out-of-date to prevent inconsistencies
-void RenderCache::KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm) {
+void RenderCache::KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm, const Vec<int>& unchangedPages) {
+    // the document might have been modified (e.g. by adding annotations)
+    FreeEngineClones(oldDm);
+
     ScopedCritSec scope(&cacheAccess);
+    // once modified, the document can no longer be matched to its file
+    // (not even after saving the modifications to a different file)
+    if (EnginePdfHasUnsavedAnnotations(newDm->GetEngine())) {
+        newDm->docId.Set(nullptr);
+    }
     for (int i = 0; i < cacheCount; i++) {
         BitmapCacheEntry* entry = cache[i];
         if (entry->dm != oldDm) {
             continue;
         }
+        if (unchangedPages.Contains(entry->pageNo)) {
+            entry->dm = newDm;
+            continue;
+        }
         if (oldDm->PageVisible(entry->pageNo)) {
             entry->dm = newDm;
         }
@@ -303,9 +576,7 @@ void RenderCache::Invalidate(DisplayModel* dm, int pageNo, RectF rect) {
     ScopedCritSec scopeReq(&requestAccess);
 
     ClearQueueForDisplayModel(dm, pageNo);
-    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo) {
-        AbortCurrentRequest();
-    }
+    AbortCurrentRequests(dm, pageNo);
 
     ScopedCritSec scopeCache(&cacheAccess);
 
@@ -319,6 +590,39 @@ void RenderCache::Invalidate(DisplayModel* dm, int pageNo, RectF rect) {
     }
 }
 
+// estimated time for rendering a tile of maxTileSize (0 if unknown)
+static double EstimateTileRenderMs(RenderCache* rc, DisplayModel* dm) {
+    return dm->renderMsPerMPixel * ((double)rc->maxTileSize.dx * rc->maxTileSize.dy / 1e6);
+}
+
+// updates dm's render cost with a tile of size that took renderMs
+void RenderCache::RecordTileRenderTime(DisplayModel* dm, Size size, double renderMs) {
+    double mpixels = (double)size.dx * size.dy / 1e6;
+    if (mpixels < 0.01) {
+        // too small for a meaningful measurement
+        return;
+    }
+    ScopedCritSec scope(&requestAccess);
+    float cost = (float)(renderMs / mpixels);
+    dm->renderMsPerMPixel = dm->renderMsPerMPixel > 0 ? dm->renderMsPerMPixel * 0.75f + cost * 0.25f : cost;
+
+    // each level quarters the tile area. only go back once the larger tiles
+    // would clearly be fast enough, so that the tiles aren't changed back and forth
+    double tileMs = EstimateTileRenderMs(this, dm);
+    int extra = dm->extraTileRes;
+    while (extra < MAX_EXTRA_TILE_RES && tileMs / (1 << (2 * extra)) > kSlowTileMs) {
+        extra++;
+    }
+    while (extra > 0 && tileMs / (1 << (2 * (extra - 1))) < kSlowTileMs / 2) {
+        extra--;
+    }
+    if (extra != dm->extraTileRes) {
+        logf("RenderCache: %.1f ms per megapixel, changing the extra tile resolution to %d\n",
+             dm->renderMsPerMPixel, extra);
+        dm->extraTileRes = extra;
+    }
+}
+
 // determine the count of tiles required for a page at a given zoom level
 USHORT RenderCache::GetTileRes(DisplayModel* dm, int pageNo) {
     auto engine = dm->GetEngine();
@@ -338,9 +642,12 @@ USHORT RenderCache::GetTileRes(DisplayModel* dm, int pageNo) {
 
     // use larger tiles when fitting page or width or when a page is smaller
     // than the visible canvas width/height or when rendering pages
-    // without clipping optimizations
+    // without clipping optimizations or pages that are fast to render
+    bool hasClipOptimizations = engine->HasClipOptimizations(pageNo);
+    double tileMs = EstimateTileRenderMs(this, dm);
+    bool isFast = tileMs > 0 && tileMs < kFastTileMs;
     if (zoomVirt == ZOOM_FIT_PAGE || zoomVirt == ZOOM_FIT_WIDTH || pixelbox.dx <= viewPort.dx ||
-        pixelbox.dy < viewPort.dy || !engine->HasClipOptimizations(pageNo)) {
+        pixelbox.dy < viewPort.dy || !hasClipOptimizations || isFast) {
         factorAvg /= 2.0;
     }
 
@@ -348,6 +655,12 @@ USHORT RenderCache::GetTileRes(DisplayModel* dm, int pageNo) {
     if (factorAvg > 1.5) {
         res = (USHORT)ceilf(log(factorAvg) / log(2.0f));
     }
+    // smaller tiles for pages that are slow to render (which only
+    // helps if the engine doesn't have to render the whole page anyway
+    // and not at all for presentations, where the whole page is always visible)
+    if (hasClipOptimizations && !dm->GetPresentationMode()) {
+        res += (USHORT)dm->extraTileRes;
+    }
     // limit res to 30, so that (1 << res) doesn't overflow for 32-bit signed int
     return std::min(res, (USHORT)30);
 }
@@ -358,7 +671,7 @@ USHORT RenderCache::GetMaxTileRes(DisplayModel* dm, int pageNo, int rotation) {
     USHORT maxRes = 0;
     for (int i = 0; i < cacheCount; i++) {
         auto e = cache[i];
-        if (e->dm == dm && e->pageNo == pageNo && e->rotation == rotation) {
+        if (e->pageNo == pageNo && e->rotation == rotation && IsSameDocument(dm, e->dm)) {
             maxRes = std::max(e->tile.res, maxRes);
         }
     }
@@ -383,17 +696,19 @@ bool RenderCache::ReduceTileSize() {
 
     // invalidate all rendered bitmaps and all requests
     while (cacheCount > 0) {
-        FreeForDisplayModel(cache[0]->dm);
+        FreePage(cache[0]->dm);
     }
     while (requestCount > 0) {
         ClearQueueForDisplayModel(requests[0].dm);
     }
-    AbortCurrentRequest();
+    AbortCurrentRequests();
 
     return true;
 }
 
 void RenderCache::RequestRendering(DisplayModel* dm, int pageNo) {
+    RequestPageElements(dm, pageNo);
+
     TilePosition tile(GetTileRes(dm, pageNo), 0, 0);
     // only honor the request if there's a good chance that the
     // rendered tile will actually be used
@@ -408,6 +723,14 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo) {
         tile.col = 1;
         RequestRendering(dm, pageNo, tile, false);
     }
+    // a presentation's next and previous slides are shown all at once,
+    // so they have to be completely rendered before they're flipped to
+    if (tile.res == 1 && dm->GetPresentationMode()) {
+        tile.row = 1;
+        for (tile.col = 0; tile.col <= 1 && !IsRenderQueueFull(); tile.col++) {
+            RequestRendering(dm, pageNo, tile, false);
+        }
+    }
 }
 
 /* Render a bitmap for page <pageNo> in <dm>. */
@@ -422,14 +745,16 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
     int rotation = NormalizeRotation(dm->GetRotation());
     float zoom = dm->GetZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
+    RenderWorker* worker = FindRenderingWorker(dm, pageNo, &tile);
+    if (worker) {
+        PageRenderRequest* curReq = worker->curReq;
         if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
             /* we're already rendering exactly the same page */
             return;
         }
         /* Currently rendered page is for the same page but with different zoom
         or rotation, so abort it */
-        AbortCurrentRequest();
+        AbortCurrentRequest(worker);
     }
 
     // clear requests for tiles of different resolution and invisible tiles
@@ -439,7 +764,7 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
 
     for (int i = 0; i < requestCount; i++) {
         PageRenderRequest* req = &(requests[i]);
-        if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile)) {
+        if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile) && !req->isPreview) {
             if ((req->zoom == zoom) && (req->rotation == rotation)) {
                 /* Request with exactly the same parameters already queued for
                    rendering. Move it to the top of the queue so that it'll
@@ -448,11 +773,15 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
                 tmp = requests[requestCount - 1];
                 requests[requestCount - 1] = *req;
                 *req = tmp;
+                requests[requestCount - 1].isPrefetch = false;
+                requests[requestCount - 1].isDraft = dm->IsInteracting();
             } else {
                 /* There was a request queued for the same page but with different
                    zoom or rotation, so only replace this request */
                 req->zoom = zoom;
                 req->rotation = rotation;
+                req->isPrefetch = false;
+                req->isDraft = dm->IsInteracting();
             }
             return;
         }
@@ -464,7 +793,155 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
         return;
     }
 
-    Render(dm, pageNo, rotation, zoom, &tile);
+    // only tiles needed right away are rendered as drafts
+    // (prefetched ones should be ready by the time they're needed)
+    if (Render(dm, pageNo, rotation, zoom, &tile)) {
+        requests[requestCount - 1].isDraft = dm->IsInteracting();
+    }
+}
+
+/* Render a bitmap for page <pageNo> in <dm> but only if there's room in the queue.
+   The request is put at the bottom of the queue so that it's rendered after all other requests. */
+void RenderCache::RequestPrefetch(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&requestAccess);
+    CrashIf(!dm);
+    if (!dm || dm->dontRenderFlag) {
+        return;
+    }
+
+    TilePosition tile(GetTileRes(dm, pageNo), 0, 0);
+    // same as in RequestRendering(dm, pageNo)
+    if (tile.res > 1) {
+        return;
+    }
+    int rotation = NormalizeRotation(dm->GetRotation());
+    float zoom = dm->GetZoomReal(pageNo);
+
+    for (tile.col = 0; tile.col <= tile.res; tile.col++) {
+        // prefetching must not push out any other request
+        if (IsRenderQueueFull()) {
+            return;
+        }
+        if (FindRenderingWorker(dm, pageNo, &tile)) {
+            continue;
+        }
+        bool isQueued = false;
+        for (int i = 0; i < requestCount && !isQueued; i++) {
+            PageRenderRequest* req = &(requests[i]);
+            isQueued = (req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile) && !req->isPreview;
+        }
+        if (isQueued || Exists(dm, pageNo, rotation, zoom, &tile)) {
+            continue;
+        }
+        if (!Render(dm, pageNo, rotation, zoom, &tile)) {
+            return;
+        }
+        PageRenderRequest req = requests[requestCount - 1];
+        memmove(&(requests[1]), &(requests[0]), sizeof(PageRenderRequest) * (requestCount - 1));
+        requests[0] = req;
+        requests[0].isPrefetch = true;
+    }
+}
+
+// remove prefetch requests for <dm> e.g. because the scrolling direction changed
+void RenderCache::CancelPrefetch(DisplayModel* dm) {
+    ScopedCritSec scope(&requestAccess);
+    int curPos = 0;
+    for (int i = 0; i < requestCount; i++) {
+        bool shouldRemove = requests[i].dm == dm && requests[i].isPrefetch;
+        if (shouldRemove) {
+            CrashIf(requests[i].renderCb);
+            continue;
+        }
+        if (i != curPos) {
+            requests[curPos] = requests[i];
+        }
+        curPos++;
+    }
+    requestCount = curPos;
+
+    for (int i = 0; i < workersCount; i++) {
+        PageRenderRequest* curReq = workers[i].curReq;
+        if (curReq && curReq->dm == dm && curReq->isPrefetch) {
+            AbortCurrentRequest(&workers[i]);
+        }
+    }
+}
+
+/* Render the whole page at a low resolution so that there's something to show
+   until its tiles are rendered. */
+void RenderCache::RequestPreview(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&requestAccess);
+    CrashIf(!dm);
+    // previews aren't worth the additional repaints in remote sessions
+    // (where we don't paint out-of-date replacements either)
+    if (!dm || dm->dontRenderFlag || isRemoteSession) {
+        return;
+    }
+
+    TilePosition tile(0, 0, 0);
+    if (FindRenderingWorker(dm, pageNo, &tile, true)) {
+        return;
+    }
+    for (int i = 0; i < requestCount; i++) {
+        PageRenderRequest* req = &(requests[i]);
+        if ((req->pageNo == pageNo) && (req->dm == dm) && req->isPreview) {
+            return;
+        }
+    }
+    int rotation = NormalizeRotation(dm->GetRotation());
+    // also don't retry if rendering the preview failed
+    BitmapCacheEntry* entry = FindPreview(dm, pageNo, rotation);
+    if (entry) {
+        DropCacheEntry(entry);
+        return;
+    }
+
+    float zoom = dm->GetZoomReal(pageNo);
+    if (!Render(dm, pageNo, rotation, zoom, &tile)) {
+        return;
+    }
+    requests[requestCount - 1].isPreview = true;
+}
+
+/* Load the links, comments and images of page <pageNo> after its tiles have been
+   rendered, for engines which don't load them while rendering (see
+   EngineBase::HasDeferredPageElements). */
+void RenderCache::RequestPageElements(DisplayModel* dm, int pageNo) {
+    CrashIf(!dm);
+    if (!dm || dm->dontRenderFlag || !dm->GetEngine()->HasDeferredPageElements(pageNo)) {
+        return;
+    }
+
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < workersCount; i++) {
+        PageRenderRequest* req = workers[i].curReq;
+        if (req && req->dm == dm && req->pageNo == pageNo && req->isPageElements) {
+            return;
+        }
+    }
+    for (int i = 0; i < requestCount; i++) {
+        PageRenderRequest* req = &(requests[i]);
+        if (req->dm == dm && req->pageNo == pageNo && req->isPageElements) {
+            return;
+        }
+    }
+    // like prefetching, this must not push out any rendering request
+    if (IsRenderQueueFull()) {
+        return;
+    }
+
+    PageRenderRequest* newRequest = &(requests[requestCount]);
+    requestCount++;
+    *newRequest = PageRenderRequest();
+    newRequest->dm = dm;
+    newRequest->pageNo = pageNo;
+    newRequest->isPageElements = true;
+    newRequest->timestamp = GetTickCount();
+    stats.maxQueueDepth = std::max(stats.maxQueueDepth, requestCount);
+
+    SetRenderingIdle(false);
+    SetEvent(startRendering);
 }
 
 void RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RectF pageRect,
@@ -519,11 +996,17 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
     } else {
         CrashMe();
     }
+    newRequest->isPrefetch = false;
+    newRequest->isPreview = false;
+    newRequest->isPageElements = false;
+    newRequest->isDraft = false;
     newRequest->abort = false;
     newRequest->abortCookie = nullptr;
     newRequest->timestamp = GetTickCount();
     newRequest->renderCb = renderCb;
+    stats.maxQueueDepth = std::max(stats.maxQueueDepth, requestCount);
 
+    SetRenderingIdle(false);
     SetEvent(startRendering);
 
     return true;
@@ -532,12 +1015,14 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
 int RenderCache::GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile) {
     ScopedCritSec scope(&requestAccess);
 
-    if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile) {
-        return GetTickCount() - curReq->timestamp;
+    RenderWorker* worker = FindRenderingWorker(dm, pageNo, &tile);
+    if (worker) {
+        return GetTickCount() - worker->curReq->timestamp;
     }
 
     for (int i = 0; i < requestCount; i++) {
-        if (requests[i].pageNo == pageNo && requests[i].dm == dm && requests[i].tile == tile) {
+        if (requests[i].pageNo == pageNo && requests[i].dm == dm && requests[i].tile == tile &&
+            !requests[i].isPreview) {
             return GetTickCount() - requests[i].timestamp;
         }
     }
@@ -545,35 +1030,270 @@ int RenderCache::GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile)
     return RENDER_DELAY_UNDEFINED;
 }
 
-bool RenderCache::GetNextRequest(PageRenderRequest* req) {
+// the currently rendered request of a worker matching <dm>, <pageNo> and <tile>
+// (and being a preview or not, if <tile> is given)
+RenderWorker* RenderCache::FindRenderingWorker(DisplayModel* dm, int pageNo, TilePosition* tile, bool isPreview) {
     ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < workersCount; i++) {
+        PageRenderRequest* req = workers[i].curReq;
+        if (!req || req->dm != dm) {
+            continue;
+        }
+        bool isSameTile = !tile || (req->tile == *tile && req->isPreview == isPreview);
+        if ((pageNo == INVALID_PAGE_NO || req->pageNo == pageNo) && isSameTile) {
+            return &workers[i];
+        }
+    }
+    return nullptr;
+}
 
-    if (requestCount == 0) {
-        return false;
+// only engines that do their own locking can be rendered by several workers at once
+// and only if cloning doesn't lose any in-memory modifications
+static bool CanRenderWithClone(EngineBase* engine) {
+    if (engine->kind == kindEnginePdf) {
+        return !EnginePdfHasUnsavedAnnotations(engine);
+    }
+    return engine->kind == kindEngineXps;
+}
+
+static bool IsPrimaryEngineBusy(RenderCache* rc, DisplayModel* dm) {
+    for (int i = 0; i < rc->workersCount; i++) {
+        RenderWorker* w = &rc->workers[i];
+        if (w->curReq && w->usesPrimary && w->curReq->dm == dm) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static RenderRequestClass GetRequestClass(PageRenderRequest* req) {
+    if (req->renderCb) {
+        return RenderRequestClass::Callback;
+    }
+    if (req->isPageElements) {
+        return RenderRequestClass::PageElements;
+    }
+    if (req->isPrefetch) {
+        return RenderRequestClass::Prefetch;
     }
+    if (!req->dm->PageVisible(req->pageNo)) {
+        return RenderRequestClass::Nearby;
+    }
+    if (req->isPreview) {
+        return RenderRequestClass::Preview;
+    }
+    if (IsTileVisible(req->dm, req->pageNo, req->tile)) {
+        return RenderRequestClass::Visible;
+    }
+    return RenderRequestClass::Nearby;
+}
+
+struct RequestPriority {
+    RenderRequestClass cls = RenderRequestClass::Count;
+    // distance in pixels between the tile and the viewport
+    int distance = 0;
+    float visibleRatio = 0.f;
+
+    bool IsHigherThan(const RequestPriority& other) const {
+        if (cls != other.cls) {
+            return cls < other.cls;
+        }
+        if (distance != other.distance) {
+            return distance < other.distance;
+        }
+        return visibleRatio > other.visibleRatio;
+    }
+};
+
+// visibility changes while requests are queued, so the priority
+// is determined when picking the next request to render
+static RequestPriority GetRequestPriority(PageRenderRequest* req) {
+    RequestPriority prio;
+    prio.cls = GetRequestClass(req);
+    if (prio.cls == RenderRequestClass::Callback || prio.cls == RenderRequestClass::PageElements) {
+        return prio;
+    }
+    DisplayModel* dm = req->dm;
+    PageInfo* pageInfo = dm->GetPageInfo(req->pageNo);
+    if (!pageInfo) {
+        return prio;
+    }
+    prio.visibleRatio = pageInfo->visibleRatio;
+    if (prio.cls != RenderRequestClass::Preview && prio.cls != RenderRequestClass::Visible) {
+        int rotation = dm->GetRotation();
+        float zoom = dm->GetZoomReal(req->pageNo);
+        Rect r = GetTileOnScreen(dm->GetEngine(), req->pageNo, rotation, zoom, req->tile, pageInfo->pageOnScreen);
+        Size viewPort = dm->GetViewPort().Size();
+        int dx = std::max(0, std::max(-(r.x + r.dx), r.x - viewPort.dx));
+        int dy = std::max(0, std::max(-(r.y + r.dy), r.y - viewPort.dy));
+        prio.distance = std::max(dx, dy);
+    }
+    return prio;
+}
+
+bool RenderCache::GetNextRequest(RenderWorker* worker) {
+    ScopedCritSec scope(&requestAccess);
 
     CrashIf(requestCount < 0);
     CrashIf(requestCount > MAX_PAGE_REQUESTS);
-    requestCount--;
-    *req = requests[requestCount];
-    curReq = req;
-    CrashIf(requestCount < 0);
-    CrashIf(req->abort);
+    CrashIf(worker->curReq);
+
+    int bestIdx = -1;
+    bool bestPrimaryBusy = false;
+    RequestPriority bestPrio;
+    // the most recent requests are at the end of the queue and
+    // are preferred over older requests of the same priority
+    for (int i = requestCount - 1; i >= 0; i--) {
+        DisplayModel* dm = requests[i].dm;
+        bool primaryBusy = IsPrimaryEngineBusy(this, dm);
+        // page elements are only queried from the primary engine
+        if (primaryBusy && requests[i].isPageElements) {
+            continue;
+        }
+        if (primaryBusy) {
+            bool cloneFailed = worker->cloneDm == dm && worker->cloneFailed && !worker->cloneOutOfDate;
+            if (cloneFailed || !CanRenderWithClone(dm->GetEngine())) {
+                continue;
+            }
+        }
+        RequestPriority prio = GetRequestPriority(&requests[i]);
+        if (bestIdx == -1 || prio.IsHigherThan(bestPrio)) {
+            bestIdx = i;
+            bestPrio = prio;
+            bestPrimaryBusy = primaryBusy;
+        }
+    }
+    if (bestIdx == -1) {
+        return false;
+    }
 
+    int i = bestIdx;
+    worker->req = requests[i];
+    requestCount--;
+    memmove(&(requests[i]), &(requests[i + 1]), sizeof(PageRenderRequest) * (requestCount - i));
+    worker->curReq = &worker->req;
+    worker->usesPrimary = !bestPrimaryBusy;
+    CrashIf(worker->req.abort);
+
+    int cls = (int)bestPrio.cls;
+    DWORD waitMs = GetTickCount() - worker->req.timestamp;
+    stats.rendered[cls]++;
+    stats.totalWaitMs[cls] += waitMs;
+    stats.maxWaitMs[cls] = std::max(stats.maxWaitMs[cls], waitMs);
+
+    if (requestCount > 0) {
+        // let another idle worker pick up the next request
+        SetEvent(startRendering);
+    }
     return true;
 }
 
-bool RenderCache::ClearCurrentRequest() {
+RenderQueueStats RenderCache::GetStats() {
+    ScopedCritSec scope(&requestAccess);
+    RenderQueueStats res = stats;
+    res.queueDepth = requestCount;
+    return res;
+}
+
+size_t RenderCache::GetMemoryUsage(DisplayModel* dm, int* nBitmapsOut) {
+    ScopedCritSec scope(&cacheAccess);
+    size_t total = 0;
+    int nBitmaps = 0;
+    for (int i = 0; i < cacheCount; i++) {
+        if (!dm || cache[i]->dm == dm) {
+            total += cache[i]->nBytes;
+            nBitmaps++;
+        }
+    }
+    if (nBitmapsOut) {
+        *nBitmapsOut = nBitmaps;
+    }
+    return total;
+}
+
+void RenderCache::RecordTileLatency(DWORD latencyMs) {
+    ScopedCritSec scope(&requestAccess);
+    stats.tilesRendered++;
+    stats.totalTileLatencyMs += latencyMs;
+    stats.lastTileLatencyMs = latencyMs;
+    stats.maxTileLatencyMs = std::max(stats.maxTileLatencyMs, latencyMs);
+}
+
+// returns the engine the worker should use for rendering its current request
+EngineBase* RenderCache::GetEngineForRequest(RenderWorker* worker) {
+    DisplayModel* dm = worker->req.dm;
+    if (worker->usesPrimary) {
+        return dm->GetEngine();
+    }
+
+    EngineBase* prevClone = nullptr;
+    {
+        ScopedCritSec scope(&requestAccess);
+        if (worker->cloneDm != dm || worker->cloneOutOfDate) {
+            prevClone = worker->clone;
+            worker->clone = nullptr;
+            worker->cloneDm = dm;
+            worker->cloneFailed = false;
+            worker->cloneOutOfDate = false;
+        }
+    }
+    delete prevClone;
+
+    if (!worker->clone && !worker->cloneFailed) {
+        worker->clone = dm->GetEngine()->Clone();
+        worker->cloneFailed = !worker->clone;
+    }
+    // the primary engine does its own locking (see CanRenderWithClone),
+    // so using it only means having to wait for the other worker
+    return worker->clone ? worker->clone : dm->GetEngine();
+}
+
+// free the worker's clones of dm's engine (e.g. because dm is about to be deleted)
+void RenderCache::FreeEngineClones(DisplayModel* dm) {
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < workersCount; i++) {
+        RenderWorker* worker = &workers[i];
+        if (worker->cloneDm != dm) {
+            continue;
+        }
+        bool isCloneInUse = worker->curReq && !worker->usesPrimary;
+        if (isCloneInUse) {
+            // the worker is about to replace the clone
+            worker->cloneOutOfDate = true;
+            continue;
+        }
+        delete worker->clone;
+        worker->clone = nullptr;
+        worker->cloneDm = nullptr;
+        worker->cloneFailed = false;
+        worker->cloneOutOfDate = false;
+    }
+}
+
+bool RenderCache::ClearCurrentRequest(RenderWorker* worker) {
     ScopedCritSec scope(&requestAccess);
-    if (curReq) {
-        delete curReq->abortCookie;
+    if (worker->curReq) {
+        delete worker->curReq->abortCookie;
+        worker->curReq->abortCookie = nullptr;
     }
-    curReq = nullptr;
+    worker->curReq = nullptr;
+    worker->usesPrimary = false;
+    UpdateRenderingIdle();
 
     bool isQueueEmpty = requestCount == 0;
     return isQueueEmpty;
 }
 
+// lets DocumentTextCache extract text in the background while nothing is being
+// rendered (must be called while holding requestAccess)
+void RenderCache::UpdateRenderingIdle() {
+    bool isIdle = requestCount == 0;
+    for (int i = 0; i < workersCount && isIdle; i++) {
+        isIdle = !workers[i].curReq;
+    }
+    SetRenderingIdle(isIdle);
+}
+
 /* Wait until rendering of a page beloging to <dm> has finished. */
 /* TODO: this might take some time, would be good to show a dialog to let the
    user know he has to wait until we finish */
@@ -582,14 +1302,14 @@ void RenderCache::CancelRendering(DisplayModel* dm) {
 
     for (;;) {
         EnterCriticalSection(&requestAccess);
-        if (!curReq || (curReq->dm != dm)) {
+        if (!FindRenderingWorker(dm)) {
             // to be on the safe side
             ClearQueueForDisplayModel(dm);
             LeaveCriticalSection(&requestAccess);
             return;
         }
 
-        AbortCurrentRequest();
+        AbortCurrentRequests(dm);
         LeaveCriticalSection(&requestAccess);
 
         /* TODO: busy loop is not good, but I don't have a better idea */
@@ -603,8 +1323,10 @@ void RenderCache::ClearQueueForDisplayModel(DisplayModel* dm, int pageNo, TilePo
     int curPos = 0;
     for (int i = 0; i < reqCount; i++) {
         PageRenderRequest* req = &(requests[i]);
+        // previews and page elements are only removed along with all other requests for the page
         bool shouldRemove = req->dm == dm && (pageNo == INVALID_PAGE_NO || req->pageNo == pageNo) &&
-                            (!tile || req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5));
+                            (!tile || !req->isPreview && !req->isPageElements && (req->tile.res != tile->res ||
+                                                          !IsTileVisible(dm, req->pageNo, *tile, 0.5)));
         if (i != curPos) {
             requests[curPos] = requests[i];
         }
@@ -617,10 +1339,12 @@ void RenderCache::ClearQueueForDisplayModel(DisplayModel* dm, int pageNo, TilePo
             curPos++;
         }
     }
+    UpdateRenderingIdle();
 }
 
-void RenderCache::AbortCurrentRequest() {
+void RenderCache::AbortCurrentRequest(RenderWorker* worker) {
     ScopedCritSec scope(&requestAccess);
+    PageRenderRequest* curReq = worker->curReq;
     if (!curReq) {
         return;
     }
@@ -630,25 +1354,37 @@ void RenderCache::AbortCurrentRequest() {
     curReq->abort = true;
 }
 
+// aborts requests currently rendered for <dm> (or all of them if dm is nullptr)
+void RenderCache::AbortCurrentRequests(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < workersCount; i++) {
+        PageRenderRequest* curReq = workers[i].curReq;
+        if (!curReq) {
+            continue;
+        }
+        if (!dm || (curReq->dm == dm && (pageNo == INVALID_PAGE_NO || curReq->pageNo == pageNo))) {
+            AbortCurrentRequest(&workers[i]);
+        }
+    }
+}
+
 DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
-    RenderCache* cache = (RenderCache*)data;
-    PageRenderRequest req;
+    RenderWorker* worker = (RenderWorker*)data;
+    RenderCache* cache = worker->cache;
+    PageRenderRequest& req = worker->req;
     RenderedBitmap* bmp;
 
     for (;;) {
-        if (cache->ClearCurrentRequest()) {
-            DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
-            // Is it not a page render request?
-            if (WAIT_OBJECT_0 != waitResult) {
-                continue;
-            }
-        }
+        cache->ClearCurrentRequest(worker);
 
-        if (!cache->GetNextRequest(&req)) {
+        // wait if the queue is empty or if all queued requests
+        // are for engines already busy with another worker
+        if (!cache->GetNextRequest(worker)) {
+            WaitForSingleObject(cache->startRendering, INFINITE);
             continue;
         }
 
-        if (!req.dm->PageVisibleNearby(req.pageNo) && !req.renderCb) {
+        if (!IsPageNeeded(req.dm, req.pageNo) && !req.dm->PagePinned(req.pageNo) && !req.renderCb) {
             continue;
         }
 
@@ -659,17 +1395,35 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             continue;
         }
 
-        // make sure that we have extracted page text for
-        // all rendered pages to allow text selection and
-        // searching without any further delays
-        if (!req.dm->textCache->HasTextForPage(req.pageNo)) {
-            req.dm->textCache->GetTextForPage(req.pageNo);
+        if (req.isPageElements) {
+            CrashIf(!worker->usesPrimary);
+            req.dm->GetEngine()->LoadPageElements(req.pageNo);
+            continue;
         }
 
+        TRACE_ZONE("RenderCacheThread::Render");
+        SLOW_OP("Render", req.dm->FilePath(), req.pageNo);
         CrashIf(req.abortCookie != nullptr);
-        EngineBase* engine = req.dm->GetEngine();
-        RenderPageArgs args(req.pageNo, req.zoom, req.rotation, &req.pageRect, RenderTarget::View, &req.abortCookie);
-        bmp = engine->RenderPage(args);
+        EngineBase* engine = cache->GetEngineForRequest(worker);
+        // tiles of recently viewed documents might still be on disk
+        bool useDiskCache = !req.renderCb;
+        bmp = useDiskCache ? LoadDiskTile(req) : nullptr;
+        if (bmp) {
+            req.isDraft = false;
+        } else {
+            float zoom = req.isPreview ? req.zoom * PREVIEW_ZOOM_FACTOR : req.zoom;
+            RenderPageArgs args(req.pageNo, zoom, req.rotation, &req.pageRect, RenderTarget::View, &req.abortCookie);
+            args.isDraft = req.isDraft;
+            auto renderStart = TimeGet();
+            bmp = engine->RenderPage(args);
+            // drafts would make pages seem cheaper to render than they are
+            if (bmp && !req.abort && !req.isPreview && !req.renderCb && !req.isDraft) {
+                cache->RecordTileRenderTime(req.dm, bmp->Size(), TimeSinceInMs(renderStart));
+            }
+            if (bmp && useDiskCache && !req.abort && !req.isDraft) {
+                SaveDiskTile(req, bmp);
+            }
+        }
         if (req.abort) {
             delete bmp;
             if (req.renderCb) {
@@ -687,8 +1441,16 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             if (bmp && !engine->IsImageCollection()) {
                 UpdateBitmapColors(bmp->GetBitmap(), cache->textColor, cache->backgroundColor);
             }
+            if (bmp && !req.isPreview) {
+                cache->RecordTileLatency(GetTickCount() - req.timestamp);
+            }
             cache->Add(req, bmp);
-            req.dm->RepaintDisplay();
+            // in remote sessions, every repainted pixel has to be sent over the network
+            if (cache->isRemoteSession) {
+                req.dm->RepaintPage(req.pageNo);
+            } else {
+                req.dm->RepaintDisplay();
+            }
         }
     }
 }
@@ -696,10 +1458,30 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
 // TODO: conceptually, RenderCache is not the right place for code that paints
 //       (this is the only place that knows about Tiles, though)
 int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, TilePosition tile, Rect tileOnScreen,
-                           bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement) {
+                           bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement,
+                           bool* paintedDraft) {
     float zoom = dm->GetZoomReal(pageNo);
     BitmapCacheEntry* entry = Find(dm, pageNo, dm->GetRotation(), zoom, &tile);
     int renderDelay = 0;
+    {
+        ScopedCritSec scope(&requestAccess);
+        if (entry) {
+            stats.tileHits++;
+        } else {
+            stats.tileMisses++;
+        }
+    }
+
+    if (entry && entry->isDraft && renderMissing) {
+        if (dm->IsInteracting()) {
+            if (paintedDraft) {
+                *paintedDraft = true;
+            }
+        } else if (RENDER_DELAY_UNDEFINED == GetRenderDelay(dm, pageNo, tile) && !IsRenderQueueFull()) {
+            // the draft is painted until it's been replaced (see Add)
+            Render(dm, pageNo, NormalizeRotation(dm->GetRotation()), zoom, &tile);
+        }
+    }
 
     if (!entry) {
         if (!isRemoteSession) {
@@ -713,7 +1495,7 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
             RequestRendering(dm, pageNo, tile);
         }
     }
-    RenderedBitmap* renderedBmp = entry ? entry->bitmap : nullptr;
+    RenderedBitmap* renderedBmp = entry ? GetCacheEntryBitmap(this, entry) : nullptr;
     HBITMAP hbmp = renderedBmp ? renderedBmp->GetBitmap() : nullptr;
 
     if (!hbmp) {
@@ -773,13 +1555,111 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
     return 0;
 }
 
+// paints the page's preview (if there is one) scaled to the page's current size
+bool RenderCache::PaintPreview(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, Rect pageOnScreen) {
+    BitmapCacheEntry* entry = FindPreview(dm, pageNo, dm->GetRotation());
+    if (!entry) {
+        return false;
+    }
+    RenderedBitmap* renderedBmp = GetCacheEntryBitmap(this, entry);
+    HBITMAP hbmp = renderedBmp ? renderedBmp->GetBitmap() : nullptr;
+    Rect isect = bounds.Intersect(pageOnScreen);
+    HDC bmpDC = hbmp && !isect.IsEmpty() ? CreateCompatibleDC(hdc) : nullptr;
+    if (!bmpDC) {
+        DropCacheEntry(entry);
+        return false;
+    }
+
+    Size bmpSize = renderedBmp->Size();
+    float factorX = 1.0f * bmpSize.dx / pageOnScreen.dx;
+    float factorY = 1.0f * bmpSize.dy / pageOnScreen.dy;
+    int xSrc = (int)((isect.x - pageOnScreen.x) * factorX);
+    int ySrc = (int)((isect.y - pageOnScreen.y) * factorY);
+    int dxSrc = (int)(isect.dx * factorX);
+    int dySrc = (int)(isect.dy * factorY);
+
+    HGDIOBJ prevBmp = SelectObject(bmpDC, hbmp);
+    StretchBlt(hdc, isect.x, isect.y, isect.dx, isect.dy, bmpDC, xSrc, ySrc, dxSrc, dySrc, SRCCOPY);
+    SelectObject(bmpDC, prevBmp);
+    DeleteDC(bmpDC);
+
+    DropCacheEntry(entry);
+    return true;
+}
+
+// paints the page's tiles rendered at the cached zoom level closest to the current
+// one, scaled to the current zoom (in place of tiles not yet rendered after zooming,
+// whose resolution usually differs from the cached ones)
+bool RenderCache::PaintScaledTiles(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, Rect pageOnScreen) {
+    int rotation = NormalizeRotation(dm->GetRotation());
+    float zoom = dm->GetZoomReal(pageNo);
+    BitmapCacheEntry* entries[MAX_BITMAPS_CACHED];
+    int nEntries = 0;
+    {
+        ScopedCritSec scope(&cacheAccess);
+        float bestZoom = 0;
+        for (int i = 0; i < cacheCount; i++) {
+            BitmapCacheEntry* e = cache[i];
+            if (e->dm != dm || e->pageNo != pageNo || e->rotation != rotation || e->isPreview || e->zoom <= 0 ||
+                e->zoom == zoom || (!e->bitmap && !e->packed)) {
+                continue;
+            }
+            if (0 == bestZoom || fabs(log(e->zoom / zoom)) < fabs(log(bestZoom / zoom))) {
+                bestZoom = e->zoom;
+            }
+        }
+        for (int i = 0; i < cacheCount && bestZoom != 0; i++) {
+            BitmapCacheEntry* e = cache[i];
+            if (e->dm == dm && e->pageNo == pageNo && e->rotation == rotation && !e->isPreview &&
+                e->zoom == bestZoom && (e->bitmap || e->packed)) {
+                UseCacheEntry(e, dm);
+                entries[nEntries++] = e;
+            }
+        }
+    }
+    if (0 == nEntries) {
+        return false;
+    }
+
+    bool painted = false;
+    HDC bmpDC = CreateCompatibleDC(hdc);
+    int prevMode = SetStretchBltMode(hdc, HALFTONE);
+    SetBrushOrgEx(hdc, 0, 0, nullptr);
+    for (int i = 0; i < nEntries; i++) {
+        BitmapCacheEntry* e = entries[i];
+        RenderedBitmap* bmp = GetCacheEntryBitmap(this, e);
+        HBITMAP hbmp = bmp ? bmp->GetBitmap() : nullptr;
+        Rect tileOnScreen = GetTileOnScreen(dm->GetEngine(), pageNo, rotation, zoom, e->tile, pageOnScreen);
+        Rect isect = bounds.Intersect(tileOnScreen);
+        if (bmpDC && hbmp && !isect.IsEmpty()) {
+            Size bmpSize = bmp->Size();
+            float factorX = 1.0f * bmpSize.dx / tileOnScreen.dx;
+            float factorY = 1.0f * bmpSize.dy / tileOnScreen.dy;
+            int xSrc = (int)((isect.x - tileOnScreen.x) * factorX);
+            int ySrc = (int)((isect.y - tileOnScreen.y) * factorY);
+            int dxSrc = (int)(isect.dx * factorX);
+            int dySrc = (int)(isect.dy * factorY);
+            HGDIOBJ prevBmp = SelectObject(bmpDC, hbmp);
+            StretchBlt(hdc, isect.x, isect.y, isect.dx, isect.dy, bmpDC, xSrc, ySrc, dxSrc, dySrc, SRCCOPY);
+            SelectObject(bmpDC, prevBmp);
+            painted = true;
+        }
+        DropCacheEntry(e);
+    }
+    SetStretchBltMode(hdc, prevMode);
+    if (bmpDC) {
+        DeleteDC(bmpDC);
+    }
+    return painted;
+}
+
 static int cmpTilePosition(const void* a, const void* b) {
     const TilePosition *ta = (const TilePosition*)a, *tb = (const TilePosition*)b;
     return ta->res != tb->res ? ta->res - tb->res : ta->row != tb->row ? ta->row - tb->row : ta->col - tb->col;
 }
 
 int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo,
-                       bool* renderOutOfDateCue) {
+                       bool* renderOutOfDateCue, bool* paintedDraft) {
     CrashIf(!pageInfo->shown || 0.0 == pageInfo->visibleRatio);
 
 #if 0
@@ -816,10 +1696,14 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
         maxRes = targetRes;
     }
 
+    // tiles which have been rendered are painted over the preview
+    bool paintedPreview = PaintPreview(hdc, bounds, dm, pageNo, pageInfo->pageOnScreen);
+
     Vec<TilePosition> queue;
     queue.Append(TilePosition(0, 0, 0));
     int renderDelayMin = RENDER_DELAY_UNDEFINED;
     bool neededScaling = false;
+    bool paintedScaled = false;
 
     while (queue.size() > 0) {
         TilePosition tile = queue.PopAt(0);
@@ -837,7 +1721,7 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
 
         bool isTargetRes = tile.res == targetRes;
         int renderDelay = PaintTile(hdc, isect, dm, pageNo, tile, tileOnScreen, isTargetRes, renderOutOfDateCue,
-                                    isTargetRes ? &neededScaling : nullptr);
+                                    isTargetRes ? &neededScaling : nullptr, paintedDraft);
         if (!(isTargetRes && 0 == renderDelay) && tile.res < maxRes) {
             queue.Append(TilePosition(tile.res + 1, tile.row * 2, tile.col * 2));
             queue.Append(TilePosition(tile.res + 1, tile.row * 2, tile.col * 2 + 1));
@@ -846,6 +1730,11 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
         }
         if (isTargetRes && renderDelay != 0) {
             neededScaling = true;
+            // fill the hole with what's been rendered at another zoom
+            // (higher resolution tiles are painted over it)
+            if (renderDelay != RENDER_DELAY_FAILED) {
+                paintedScaled |= PaintScaledTiles(hdc, isect, dm, pageNo, pageInfo->pageOnScreen);
+            }
         }
         if (renderDelay == RENDER_DELAY_FAILED || renderDelayMin == RENDER_DELAY_FAILED) {
             renderDelayMin = RENDER_DELAY_FAILED;
@@ -858,6 +1747,19 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
         }
     }
 
+    if (renderDelayMin != 0 && renderDelayMin != RENDER_DELAY_FAILED) {
+        // nothing but the preview could be painted, so make sure there is one
+        // (previews are rendered before tiles, see GetRequestClass)
+        if (paintedPreview) {
+            renderDelayMin = 0;
+        } else {
+            RequestPreview(dm, pageNo);
+            if (paintedScaled) {
+                renderDelayMin = 0;
+            }
+        }
+    }
+
 #ifdef CONSERVE_MEMORY
     if (!neededScaling) {
         if (renderOutOfDateCue) {
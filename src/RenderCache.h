@@ -7,11 +7,12 @@ constexpr int RENDER_DELAY_UNDEFINED = std::numeric_limits<int>::max() - 2;
 #define INVALID_TILE_RES ((USHORT)-1)
 
 #define MAX_PAGE_REQUESTS 8
-// keep this value reasonably low, else we'll run out of
-// GDI resources/memory when caching many larger bitmaps
-// TODO: this should be based on amount of memory taken by rendered pages
-// i.e. one big page can use as much memory as lots of small pages
-#define MAX_BITMAPS_CACHED 64
+// upper bound for the number of threads rendering pages concurrently
+#define MAX_RENDER_THREADS 8
+// the amount of memory used by cached bitmaps is limited by RenderCache.maxCacheSize,
+// this limit only prevents us from running out of GDI handles
+// when caching lots of small bitmaps (e.g. thumbnails)
+#define MAX_BITMAPS_CACHED 256
 
 class RenderingCallback {
   public:
@@ -51,6 +52,22 @@ struct BitmapCacheEntry {
 
     // owned by the BitmapCacheEntry
     RenderedBitmap* bitmap = nullptr;
+    // bitmap compressed with PackTileBitmap while it isn't needed for painting
+    // (either bitmap or packed is set, unless rendering failed)
+    u8* packed = nullptr;
+    size_t packedLen = 0;
+    // set once packing has been tried, so that incompressible bitmaps are only tried once
+    bool packTried = false;
+    // memory used by bitmap's pixels (or by packed)
+    size_t nBytes = 0;
+    // GetTickCount() when the entry was last used for painting
+    DWORD lastUsed = 0;
+    // a low resolution rendering of the whole page which is painted
+    // in place of tiles that haven't been rendered yet
+    bool isPreview = false;
+    // rendered at a lower quality during an interaction (see DisplayModel::IsInteracting),
+    // PaintTile has it rendered again once the interaction is over
+    bool isDraft = false;
     bool outOfDate = false;
     int refs = 1;
 
@@ -65,6 +82,7 @@ struct BitmapCacheEntry {
     }
     ~BitmapCacheEntry() {
         delete bitmap;
+        free(packed);
     }
 };
 
@@ -79,6 +97,14 @@ struct PageRenderRequest {
     TilePosition tile;
 
     RectF pageRect; // calculated from TilePosition
+    // requested ahead of time (see DisplayModel::PrefetchPages)
+    bool isPrefetch = false;
+    // rendered at PREVIEW_ZOOM_FACTOR * zoom (see RenderCache::RequestPreview)
+    bool isPreview = false;
+    // loads the page's elements instead of rendering (see RenderCache::RequestPageElements)
+    bool isPageElements = false;
+    // see BitmapCacheEntry::isDraft
+    bool isDraft = false;
     bool abort = false;
     AbortCookie* abortCookie = nullptr;
     DWORD timestamp = 0;
@@ -87,19 +113,85 @@ struct PageRenderRequest {
     RenderingCallback* renderCb = nullptr;
 };
 
+// requests are rendered in this order (see GetRequestPriority)
+enum class RenderRequestClass {
+    // preview of a visible page (see RequestPreview)
+    Preview,
+    // tile at least partially visible
+    Visible,
+    // tile of a page close to the visible area
+    Nearby,
+    // links, comments and images of a visible page (see RequestPageElements)
+    PageElements,
+    // tile of a page we're scrolling towards (see RequestPrefetch)
+    Prefetch,
+    // rendered for a RenderingCallback (e.g. thumbnails)
+    Callback,
+    Count,
+};
+
+// counters for judging how well requests are prioritized
+struct RenderQueueStats {
+    int maxQueueDepth = 0;
+    int rendered[(int)RenderRequestClass::Count]{};
+    // time between requesting and starting rendering
+    u64 totalWaitMs[(int)RenderRequestClass::Count]{};
+    DWORD maxWaitMs[(int)RenderRequestClass::Count]{};
+    // number of requests currently queued (only set by GetStats)
+    int queueDepth = 0;
+
+    // tiles PaintTile found resp. didn't find at the current zoom
+    int tileHits = 0;
+    int tileMisses = 0;
+    // time between requesting a tile (not a preview) and having its bitmap
+    int tilesRendered = 0;
+    u64 totalTileLatencyMs = 0;
+    DWORD lastTileLatencyMs = 0;
+    DWORD maxTileLatencyMs = 0;
+};
+
+class RenderCache;
+
+/* A thread rendering requests from RenderCache.requests. Additional workers
+   render with their own clone of the document's engine (if the engine
+   supports it) so that they don't have to wait for each other. */
+struct RenderWorker {
+    RenderCache* cache = nullptr;
+    HANDLE thread = nullptr;
+
+    PageRenderRequest req;
+    // points to req while a request is being rendered (protected by requestAccess)
+    PageRenderRequest* curReq = nullptr;
+    // true if curReq is being rendered with the DisplayModel's own engine
+    bool usesPrimary = false;
+
+    // clone of cloneDm's engine, owned by the worker
+    DisplayModel* cloneDm = nullptr;
+    EngineBase* clone = nullptr;
+    bool cloneFailed = false;
+    bool cloneOutOfDate = false;
+};
+
 class RenderCache {
   public:
     BitmapCacheEntry* cache[MAX_BITMAPS_CACHED]{};
     int cacheCount = 0;
+    // total of BitmapCacheEntry.nBytes for all cached entries
+    size_t cacheSize = 0;
+    size_t maxCacheSize = 0;
     // make sure to never ask for requestAccess in a cacheAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION cacheAccess;
 
     PageRenderRequest requests[MAX_PAGE_REQUESTS]{};
     int requestCount = 0;
-    PageRenderRequest* curReq = nullptr;
     CRITICAL_SECTION requestAccess;
-    HANDLE renderThread = nullptr;
+
+    RenderWorker workers[MAX_RENDER_THREADS]{};
+    int workersCount = 0;
+
+    // protected by requestAccess
+    RenderQueueStats stats;
 
     Size maxTileSize{};
     bool isRemoteSession = false;
@@ -115,20 +207,35 @@ class RenderCache {
     RenderCache& operator=(RenderCache const&) = delete;
     ~RenderCache();
 
+    // starts additional rendering threads (0 means based on the number of processors)
+    void SetRenderThreadsCount(int n);
+    // sets the memory budget for cached bitmaps (0 means based on screen size and available memory)
+    void SetMaxCacheSizeMB(int sizeMB);
+
     void RequestRendering(DisplayModel* dm, int pageNo);
+    void RequestPrefetch(DisplayModel* dm, int pageNo);
+    void CancelPrefetch(DisplayModel* dm);
+    void RequestPreview(DisplayModel* dm, int pageNo);
+    void RequestPageElements(DisplayModel* dm, int pageNo);
     void Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RectF pageRect, RenderingCallback& callback);
     void CancelRendering(DisplayModel* dm);
     bool Exists(DisplayModel* dm, int pageNo, int rotation, float zoom = INVALID_ZOOM, TilePosition* tile = nullptr);
     void FreeForDisplayModel(DisplayModel* dm);
-    void KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm);
+    // unchangedPages look the same in newDm as in oldDm, so their bitmaps don't have to be rerendered
+    void KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm, const Vec<int>& unchangedPages);
     void Invalidate(DisplayModel* dm, int pageNo, RectF rect);
     // returns how much time in ms has past since the most recent rendering
     // request for the visible part of the page if nothing at all could be
     // painted, 0 if something has been painted and RENDER_DELAY_FAILED on failure
-    int Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo, bool* renderOutOfDateCue);
+    // paintedDraft is set if draft tiles have been painted that should be rendered again
+    // once the current interaction is over (i.e. a repaint is needed then)
+    int Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo, bool* renderOutOfDateCue,
+              bool* paintedDraft = nullptr);
 
-    bool ClearCurrentRequest();
-    bool GetNextRequest(PageRenderRequest* req);
+    bool ClearCurrentRequest(RenderWorker* worker);
+    void UpdateRenderingIdle();
+    bool GetNextRequest(RenderWorker* worker);
+    EngineBase* GetEngineForRequest(RenderWorker* worker);
     void Add(PageRenderRequest& req, RenderedBitmap* bmp);
 
     USHORT GetTileRes(DisplayModel* dm, int pageNo);
@@ -139,20 +246,33 @@ class RenderCache {
         return requestCount == MAX_PAGE_REQUESTS;
     }
     int GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile);
+    RenderQueueStats GetStats();
+    // memory used by the bitmaps cached for dm (or for all documents if dm is nullptr)
+    size_t GetMemoryUsage(DisplayModel* dm = nullptr, int* nBitmapsOut = nullptr);
+    void RecordTileLatency(DWORD latencyMs);
+    void RecordTileRenderTime(DisplayModel* dm, Size size, double renderMs);
     void RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, bool clearQueueForPage = true);
     bool Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile = nullptr,
                 RectF* pageRect = nullptr, RenderingCallback* renderCb = nullptr);
     void ClearQueueForDisplayModel(DisplayModel* dm, int pageNo = INVALID_PAGE_NO, TilePosition* tile = nullptr);
-    void AbortCurrentRequest();
+    RenderWorker* FindRenderingWorker(DisplayModel* dm, int pageNo = INVALID_PAGE_NO, TilePosition* tile = nullptr,
+                                      bool isPreview = false);
+    void AbortCurrentRequest(RenderWorker* worker);
+    void AbortCurrentRequests(DisplayModel* dm = nullptr, int pageNo = INVALID_PAGE_NO);
+    void FreeEngineClones(DisplayModel* dm);
 
+    void StartWorker();
     static DWORD WINAPI RenderCacheThread(LPVOID data);
 
     BitmapCacheEntry* Find(DisplayModel* dm, int pageNo, int rotation, float zoom = INVALID_ZOOM,
                            TilePosition* tile = nullptr);
+    BitmapCacheEntry* FindPreview(DisplayModel* dm, int pageNo, int rotation);
     bool DropCacheEntry(BitmapCacheEntry* entry);
     void FreePage(DisplayModel* dm = nullptr, int pageNo = -1, TilePosition* tile = nullptr);
     void FreeNotVisible();
 
     int PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, TilePosition tile, Rect tileOnScreen,
-                  bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement);
+                  bool renderMissing, bool* renderOutOfDateCue, bool* renderedReplacement, bool* paintedDraft);
+    bool PaintPreview(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, Rect pageOnScreen);
+    bool PaintScaledTiles(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, Rect pageOnScreen);
 };
@@ -9,6 +9,8 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
+#include "utils/SlowOps.h"
+#include "utils/ThreadUtil.h"
 #include "utils/UITask.h"
 #include "utils/WinUtil.h"
 #include "utils/Log.h"
@@ -59,6 +61,10 @@ bool NeedsFindUI(WindowInfo* win) {
     if (!win->IsDocLoaded()) {
         return true;
     }
+    if (win->AsChm()) {
+        // searches topics through ChmModel's full-text index
+        return true;
+    }
     if (!win->AsFixed()) {
         return false;
     }
@@ -144,7 +150,7 @@ void OnMenuFindPrev(WindowInfo* win) {
 }
 
 void OnMenuFindMatchCase(WindowInfo* win) {
-    if (!win->IsDocLoaded() || !NeedsFindUI(win)) {
+    if (!win->IsDocLoaded() || !NeedsFindUI(win) || !win->AsFixed()) {
         return;
     }
     WORD state = (WORD)SendMessageW(win->hwndToolbar, TB_GETSTATE, CmdFindMatch, 0);
@@ -153,7 +159,7 @@ void OnMenuFindMatchCase(WindowInfo* win) {
 }
 
 void OnMenuFindSel(WindowInfo* win, TextSearchDirection direction) {
-    if (!win->IsDocLoaded() || !NeedsFindUI(win)) {
+    if (!win->IsDocLoaded() || !NeedsFindUI(win) || !win->AsFixed()) {
         return;
     }
     DisplayModel* dm = win->AsFixed();
@@ -314,11 +320,11 @@ static void FindEndTask(WindowInfo* win, FindThreadData* ftd, TextSel* textSel,
     delete ftd;
 }
 
-static DWORD WINAPI FindThread(LPVOID data) {
-    FindThreadData* ftd = (FindThreadData*)data;
+static void FindThread(FindThreadData* ftd) {
     CrashIf(!(ftd && ftd->win && ftd->win->ctrl && ftd->win->ctrl->AsFixed()));
     WindowInfo* win = ftd->win;
     DisplayModel* dm = win->AsFixed();
+    SLOW_OP("Search", dm->FilePath(), 0);
 
     TextSel* rect;
     dm->textSearch->SetDirection(ftd->direction);
@@ -351,13 +357,15 @@ static DWORD WINAPI FindThread(LPVOID data) {
     } else {
         uitask::Post([=] { FindEndTask(win, ftd, nullptr, win->findCanceled, false); });
     }
-
-    return 0;
 }
 
 void AbortFinding(WindowInfo* win, bool hideMessage) {
     if (win->findThread) {
         win->findCanceled = true;
+        // don't wait for the extraction of a (slow) page's text to complete
+        if (win->AsFixed()) {
+            win->AsFixed()->textSearch->AbortExtraction();
+        }
         WaitForSingleObject(win->findThread, INFINITE);
     }
     win->findCanceled = false;
@@ -367,7 +375,40 @@ void AbortFinding(WindowInfo* win, bool hideMessage) {
     }
 }
 
+// CHM documents are searched one topic at a time through their full-text index,
+// which is fast enough to not need a thread. There's no find-as-you-type for them,
+// as that would navigate to another topic with every key press
+static void FindTopicInChm(WindowInfo* win, TextSearchDirection direction, bool showProgress) {
+    if (!showProgress) {
+        return;
+    }
+    AutoFreeWstr text(win::GetText(win->hwndFindBox));
+    Edit_SetModify(win->hwndFindBox, FALSE);
+    if (str::IsEmpty(text.Get())) {
+        return;
+    }
+
+    ChmModel* chm = win->AsChm();
+    if (!chm->IsSearchIndexReady()) {
+        win->ShowNotification(_TR("The document is still being indexed for searching"), NOS_WITH_TIMEOUT,
+                              NG_FIND_PROGRESS);
+        return;
+    }
+    bool forward = TextSearchDirection::Forward == direction;
+    int pageNo = chm->FindPageWithText(text, chm->CurrentPageNo(), forward);
+    if (0 == pageNo) {
+        win->ShowNotification(_TR("No matches were found"), NOS_WITH_TIMEOUT, NG_FIND_PROGRESS);
+        return;
+    }
+    win->notifications->RemoveForGroup(NG_FIND_PROGRESS);
+    chm->GoToPage(pageNo, true);
+}
+
 void FindTextOnThread(WindowInfo* win, TextSearchDirection direction, bool showProgress) {
+    if (win->AsChm()) {
+        FindTopicInChm(win, direction, showProgress);
+        return;
+    }
     AbortFinding(win, true);
 
     FindThreadData* ftd = new FindThreadData(win, direction, win->hwndFindBox);
@@ -380,7 +421,8 @@ void FindTextOnThread(WindowInfo* win, TextSearchDirection direction, bool showP
 
     ftd->ShowUI(showProgress);
     win->findThread = nullptr;
-    win->findThread = CreateThread(nullptr, 0, FindThread, ftd, 0, 0);
+    // the user is waiting for the result, so it goes ahead of other background work
+    win->findThread = RunAsyncWithHandle([ftd] { FindThread(ftd); }, TaskPriority::High);
     ftd->thread = win->findThread; // safe because only accesssed on ui thread
 }
 
@@ -591,28 +633,44 @@ LRESULT OnDDEInitiate(HWND hwnd, WPARAM wp, LPARAM lp) {
 //  eg: [ForwardSearch("c:\file.pdf","c:\folder\source.tex",298,0)]
 // Synchronization command format:
 // [ForwardSearch(["<pdffile>",]"<srcfile>",<line>,<col>[,<newwindow>,<setfocus>])]
-static const WCHAR* HandleSyncCmd(const WCHAR* cmd, DDEACK& ack) {
-    AutoFreeWstr pdfFile, srcFile;
-    BOOL line = 0, col = 0, newWindow = 0, setFocus = 0;
-    const WCHAR* next = str::Parse(cmd, L"[ForwardSearch(\"%S\",%? \"%S\",%u,%u)]", &pdfFile, &srcFile, &line, &col);
+struct SyncCmdArgs {
+    AutoFreeWstr pdfFile;
+    AutoFreeWstr srcFile;
+    BOOL line = 0;
+    BOOL col = 0;
+    BOOL newWindow = 0;
+    BOOL setFocus = 0;
+};
+
+static const WCHAR* ParseSyncCmd(const WCHAR* cmd, SyncCmdArgs& a) {
+    const WCHAR* next =
+        str::Parse(cmd, L"[ForwardSearch(\"%S\",%? \"%S\",%u,%u)]", &a.pdfFile, &a.srcFile, &a.line, &a.col);
     if (!next) {
-        next = str::Parse(cmd, L"[ForwardSearch(\"%S\",%? \"%S\",%u,%u,%u,%u)]", &pdfFile, &srcFile, &line, &col,
-                          &newWindow, &setFocus);
+        next = str::Parse(cmd, L"[ForwardSearch(\"%S\",%? \"%S\",%u,%u,%u,%u)]", &a.pdfFile, &a.srcFile, &a.line,
+                          &a.col, &a.newWindow, &a.setFocus);
     }
     // allow to omit the pdffile path, so that editors don't have to know about
     // multi-file projects (requires that the PDF has already been opened)
     if (!next) {
-        pdfFile.Reset();
-        next = str::Parse(cmd, L"[ForwardSearch(\"%S\",%u,%u)]", &srcFile, &line, &col);
+        a.pdfFile.Reset();
+        next = str::Parse(cmd, L"[ForwardSearch(\"%S\",%u,%u)]", &a.srcFile, &a.line, &a.col);
         if (!next) {
-            next =
-                str::Parse(cmd, L"[ForwardSearch(\"%S\",%u,%u,%u,%u)]", &srcFile, &line, &col, &newWindow, &setFocus);
+            next = str::Parse(cmd, L"[ForwardSearch(\"%S\",%u,%u,%u,%u)]", &a.srcFile, &a.line, &a.col, &a.newWindow,
+                              &a.setFocus);
         }
     }
+    return next;
+}
 
+static const WCHAR* HandleSyncCmd(const WCHAR* cmd, DDEACK& ack) {
+    SyncCmdArgs a;
+    const WCHAR* next = ParseSyncCmd(cmd, a);
     if (!next) {
         return nullptr;
     }
+    const WCHAR* pdfFile = a.pdfFile;
+    const WCHAR* srcFile = a.srcFile;
+    BOOL line = a.line, col = a.col, newWindow = a.newWindow, setFocus = a.setFocus;
 
     WindowInfo* win = nullptr;
     if (pdfFile) {
@@ -872,6 +930,71 @@ static void HandleDdeCmds(HWND hwnd, const WCHAR* cmd, DDEACK& ack) {
     }
 }
 
+// DDE commands are acknowledged right away and executed afterwards, in the
+// order in which they were received, so that editors sending many commands
+// (e.g. a forward search after every cursor move) don't have to wait for
+// documents to be loaded. A forward search still waiting to be executed is
+// superseded by a later one for the same document.
+struct DdeCmd {
+    HWND hwnd = nullptr;
+    WCHAR* cmd = nullptr;
+};
+
+// only accessed from the ui thread
+static Vec<DdeCmd> gDdeQueue;
+static bool gDdeQueueScheduled = false;
+
+// returns true if cmd consists of a single forward search which can
+// be superseded by another one for the same document
+static bool IsSupersedableSyncCmd(const WCHAR* cmd, SyncCmdArgs& a) {
+    const WCHAR* next = ParseSyncCmd(cmd, a);
+    return next && str::IsEmpty(next) && !a.newWindow;
+}
+
+static void ExecuteNextDdeCmd() {
+    if (gDdeQueue.size() == 0) {
+        gDdeQueueScheduled = false;
+        return;
+    }
+    DdeCmd c = gDdeQueue.at(0);
+    gDdeQueue.RemoveAt(0);
+    // commands received in the meantime (e.g. while loading a document) are only queued
+    DDEACK ack = {0};
+    HandleDdeCmds(c.hwnd, c.cmd, ack);
+    free(c.cmd);
+
+    // give the ui a chance to update between commands
+    if (gDdeQueue.size() > 0) {
+        uitask::Post(ExecuteNextDdeCmd);
+    } else {
+        gDdeQueueScheduled = false;
+    }
+}
+
+static void QueueDdeCmds(HWND hwnd, const WCHAR* cmd) {
+    SyncCmdArgs newArgs;
+    if (IsSupersedableSyncCmd(cmd, newArgs)) {
+        for (size_t i = 0; i < gDdeQueue.size(); i++) {
+            SyncCmdArgs a;
+            if (IsSupersedableSyncCmd(gDdeQueue.at(i).cmd, a) && str::EqI(a.pdfFile, newArgs.pdfFile)) {
+                logf("QueueDdeCmds: superseding a forward search\n");
+                free(gDdeQueue.at(i).cmd);
+                gDdeQueue.RemoveAt(i);
+                break;
+            }
+        }
+    }
+
+    DdeCmd c;
+    c.hwnd = hwnd;
+    c.cmd = str::Dup(cmd);
+    gDdeQueue.Append(c);
+    if (!gDdeQueueScheduled) {
+        gDdeQueueScheduled = true;
+        uitask::Post(ExecuteNextDdeCmd);
+    }
+}
+
 LRESULT OnDDExecute(HWND hwnd, WPARAM wp, LPARAM lp) {
     UINT_PTR lo = 0, hi = 0;
     if (!UnpackDDElParam(WM_DDE_EXECUTE, lp, &lo, &hi)) {
@@ -890,7 +1013,10 @@ LRESULT OnDDExecute(HWND hwnd, WPARAM wp, LPARAM lp) {
     } else {
         cmd = strconv::FromAnsi((const char*)command);
     }
-    HandleDdeCmds(hwnd, cmd, ack);
+    if (!str::IsEmpty(cmd.Get())) {
+        QueueDdeCmds(hwnd, cmd);
+        ack.fAck = 1;
+    }
     GlobalUnlock((HGLOBAL)hi);
 
     lp = ReuseDDElParam(lp, WM_DDE_EXECUTE, WM_DDE_ACK, *(WORD*)&ack, hi);
@@ -906,7 +1032,6 @@ LRESULT OnDDETerminate(HWND hwnd, WPARAM wp, LPARAM lp) {
 }
 
 LRESULT OnCopyData(HWND hwnd, WPARAM wp, LPARAM lp) {
-    UNUSED(hwnd);
     COPYDATASTRUCT* cds = (COPYDATASTRUCT*)lp;
     if (!cds || cds->dwData != 0x44646557 /* DdeW */ || wp) {
         return FALSE;
@@ -917,7 +1042,9 @@ LRESULT OnCopyData(HWND hwnd, WPARAM wp, LPARAM lp) {
         return FALSE;
     }
 
-    DDEACK ack = {0};
-    HandleDdeCmds(hwnd, cmd, ack);
-    return ack.fAck ? TRUE : FALSE;
+    if (str::IsEmpty(cmd)) {
+        return FALSE;
+    }
+    QueueDdeCmds(hwnd, cmd);
+    return TRUE;
 }
@@ -0,0 +1,833 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/DirIter.h"
+#include "utils/FileUtil.h"
+#include "utils/GuessFileType.h"
+#include "utils/SlowOps.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
+#include "utils/WinUtil.h"
+
+#include "wingui/WinGui.h"
+#include "wingui/TreeModel.h"
+#include "wingui/Layout.h"
+#include "wingui/Window.h"
+#include "wingui/StaticCtrl.h"
+#include "wingui/ButtonCtrl.h"
+#include "wingui/ListBoxCtrl.h"
+
+#include "Annotation.h"
+#include "EngineBase.h"
+#include "EngineCreate.h"
+#include "DisplayMode.h"
+#include "SumatraConfig.h"
+#include "SettingsStructs.h"
+#include "Controller.h"
+#include "DisplayModel.h"
+#include "ProgressUpdateUI.h"
+#include "TextSelection.h"
+#include "TextSearch.h"
+#include "Notifications.h"
+#include "WindowInfo.h"
+#include "TabInfo.h"
+#include "resource.h"
+#include "Commands.h"
+#include "SearchAndDDE.h"
+#include "Selection.h"
+#include "SumatraPDF.h"
+#include "DiskTextIndex.h"
+#include "Translations.h"
+#include "SearchResults.h"
+
+using std::placeholders::_1;
+
+// number of characters shown around a match
+#define CONTEXT_BEFORE_MATCH 24
+#define CONTEXT_AFTER_MATCH 48
+
+struct SearchResultsWindow : ProgressUpdateUI {
+    TabInfo* tab = nullptr;
+    Window* mainWindow = nullptr;
+    LayoutBase* mainLayout = nullptr;
+    StaticCtrl* staticStatus = nullptr;
+    ListBoxCtrl* listBox = nullptr;
+    ListBoxModel* lbModel = nullptr;
+
+    // separate from DisplayModel::textSearch, so that
+    // FindNext can be used while searching for all matches
+    TextSearch* textSearch = nullptr;
+    AutoFreeWstr text;
+    bool caseSensitive = false;
+    // results of the last completed search
+    Vec<TextSearchHit>* hits = nullptr;
+
+    HANDLE thread = nullptr;
+    LONG cancelled = 0;
+    // identifies the current search, so that results of canceled searches are ignored
+    int searchNo = 0;
+
+    ~SearchResultsWindow() override;
+
+    void UpdateProgress(int current, int total) override;
+    bool WasCanceled() override;
+};
+
+// only accessed on the ui thread
+static Vec<SearchResultsWindow*> gSearchResultsWindows;
+
+static void StopFindAll(SearchResultsWindow* srw) {
+    if (!srw->thread) {
+        return;
+    }
+    InterlockedIncrement(&srw->cancelled);
+    WaitForSingleObject(srw->thread, INFINITE);
+    CloseHandle(srw->thread);
+    srw->thread = nullptr;
+}
+
+SearchResultsWindow::~SearchResultsWindow() {
+    gSearchResultsWindows.Remove(this);
+    StopFindAll(this);
+    delete textSearch;
+    delete hits;
+    delete mainWindow;
+    delete mainLayout;
+    delete lbModel;
+}
+
+static void UpdateFindAllStatusTask(SearchResultsWindow* srw, int searchNo, int current, int total) {
+    if (!gSearchResultsWindows.Contains(srw) || srw->searchNo != searchNo) {
+        return;
+    }
+    AutoFreeWstr status(str::Format(_TR("Searching %d of %d..."), current, total));
+    srw->staticStatus->SetText(status.Get());
+}
+
+void SearchResultsWindow::UpdateProgress(int current, int total) {
+    // only report progress every few pages
+    if (current % 16 != 0 || WasCanceled()) {
+        return;
+    }
+    SearchResultsWindow* srw = this;
+    int no = searchNo;
+    uitask::Post([=] { UpdateFindAllStatusTask(srw, no, current, total); });
+}
+
+bool SearchResultsWindow::WasCanceled() {
+    return InterlockedAdd(&cancelled, 0) > 0;
+}
+
+// describes a match by its page (and document, if docName is given) and the text around it
+static void AppendHitDescription(VecStr& strings, DocumentTextCache* textCache, TextSearchHit& hit,
+                                 const WCHAR* docName = nullptr) {
+    int len = 0;
+    const WCHAR* pageText = textCache->GetTextForPage(hit.startPage, &len);
+    int start = std::max(hit.startGlyph - CONTEXT_BEFORE_MATCH, 0);
+    int end = hit.endPage == hit.startPage ? hit.endGlyph : len;
+    end = std::min(end + CONTEXT_AFTER_MATCH, len);
+
+    AutoFreeWstr context(str::DupN(pageText + start, end - start));
+    str::NormalizeWS(context);
+    AutoFreeWstr label(textCache->engine->GetPageLabel(hit.startPage));
+    if (docName) {
+        label.Set(str::Format(L"%s, %s", docName, label.Get()));
+    }
+    AutoFreeWstr s(str::Format(L"%s: %s%s%s", label.Get(), start > 0 ? L"..." : L"", context.Get(),
+                               end < len ? L"..." : L""));
+    AutoFree sU(strconv::WstrToUtf8(s));
+    strings.Append(sU.AsView());
+}
+
+static void FindAllEndTask(SearchResultsWindow* srw, int searchNo, Vec<TextSearchHit>* hits,
+                           ListBoxModelStrings* model) {
+    if (!gSearchResultsWindows.Contains(srw) || srw->searchNo != searchNo) {
+        delete hits;
+        delete model;
+        return;
+    }
+    delete srw->hits;
+    srw->hits = hits;
+    srw->listBox->SetModel(model);
+    delete srw->lbModel;
+    srw->lbModel = model;
+
+    AutoFreeWstr status;
+    if (0 == hits->size()) {
+        status.SetCopy(_TR("No matches were found"));
+    } else {
+        status.Set(str::Format(_TR("Found %d matches"), hits->isize()));
+    }
+    srw->staticStatus->SetText(status.Get());
+}
+
+static DWORD WINAPI FindAllThread(LPVOID data) {
+    SearchResultsWindow* srw = (SearchResultsWindow*)data;
+    SetThreadName(GetCurrentThreadId(), "FindAll");
+    DisplayModel* dm = srw->tab->AsFixed();
+    ScopedTextCachePin pin(dm->textCache);
+    SLOW_OP("Find all", dm->FilePath(), 0);
+
+    auto hits = new Vec<TextSearchHit>();
+    srw->textSearch->SetSensitive(srw->caseSensitive);
+    srw->textSearch->FindAll(srw->text, *hits, dm->wordIndex, srw);
+
+    auto model = new ListBoxModelStrings();
+    for (TextSearchHit& hit : *hits) {
+        if (srw->WasCanceled()) {
+            break;
+        }
+        AppendHitDescription(model->strings, dm->textCache, hit);
+    }
+
+    int no = srw->searchNo;
+    uitask::Post([=] { FindAllEndTask(srw, no, hits, model); });
+    return 0;
+}
+
+static void StartFindAll(SearchResultsWindow* srw, const WCHAR* text, bool caseSensitive) {
+    StopFindAll(srw);
+    DisplayModel* dm = srw->tab->AsFixed();
+    if (!srw->textSearch) {
+        srw->textSearch = new TextSearch(dm->GetEngine(), dm->textCache);
+    }
+    // the index makes finding all matches again much faster, even if it's still incomplete
+    if (!dm->wordIndex) {
+        dm->wordIndex = new DocumentWordIndex(dm->textCache);
+    }
+    dm->wordIndex->StartIndexing();
+
+    srw->text.SetCopy(text);
+    srw->caseSensitive = caseSensitive;
+    srw->searchNo++;
+    srw->cancelled = 0;
+
+    AutoFreeWstr title(str::Format(_TR("Search results for \"%s\""), text));
+    srw->mainWindow->SetText(title.Get());
+    srw->staticStatus->SetText(_TR("Searching..."));
+    srw->thread = CreateThread(nullptr, 0, FindAllThread, srw, 0, nullptr);
+}
+
+// selects the match in win's current document
+static void ShowHit(WindowInfo* win, TextSearchHit& hit) {
+    DisplayModel* dm = win->AsFixed();
+    // the document might have changed since it's been searched
+    if (!dm || hit.endPage > dm->PageCount()) {
+        return;
+    }
+    if (!dm->PageShown(hit.startPage)) {
+        win->ctrl->GoToPage(hit.startPage, true);
+    }
+    dm->textSelection->StartAt(hit.startPage, hit.startGlyph);
+    dm->textSelection->SelectUpTo(hit.endPage, hit.endGlyph);
+    UpdateTextSelection(win, false);
+    dm->ShowResultRectToScreen(&dm->textSelection->result);
+    RepaintAsync(win, 0);
+}
+
+static void ListBoxSelectionChanged(SearchResultsWindow* srw, ListBoxSelectionChangedEvent* ev) {
+    int idx = ev->idx;
+    TabInfo* tab = srw->tab;
+    WindowInfo* win = tab->win;
+    if (!srw->hits || idx < 0 || idx >= srw->hits->isize() || win->currentTab != tab) {
+        return;
+    }
+    ShowHit(win, srw->hits->at(idx));
+}
+
+static void WndCloseHandler(SearchResultsWindow* srw, WindowCloseEvent* ev) {
+    CrashIf(srw->mainWindow != ev->w);
+    srw->tab->searchResultsWindow = nullptr;
+    delete srw;
+}
+
+static void WndSizeHandler(SearchResultsWindow* srw, SizeEvent* ev) {
+    int dx = ev->dx;
+    int dy = ev->dy;
+    if (dx == 0 || dy == 0) {
+        return;
+    }
+    ev->didHandle = true;
+    InvalidateRect(ev->hwnd, nullptr, false);
+    LayoutToSize(srw->mainLayout, {dx, dy});
+}
+
+static void CreateMainLayout(SearchResultsWindow* srw) {
+    HWND parent = srw->mainWindow->hwnd;
+    auto vbox = new VBox();
+    vbox->alignMain = MainAxisAlign::MainStart;
+    vbox->alignCross = CrossAxisAlign::Stretch;
+
+    {
+        auto w = new StaticCtrl(parent);
+        bool ok = w->Create();
+        CrashIf(!ok);
+        srw->staticStatus = w;
+        vbox->AddChild(w);
+    }
+
+    {
+        auto w = new ListBoxCtrl(parent);
+        w->idealSizeLines = 20;
+        w->SetInsetsPt(4, 0, 0, 0);
+        bool ok = w->Create();
+        CrashIf(!ok);
+        srw->lbModel = new ListBoxModelStrings();
+        w->SetModel(srw->lbModel);
+        w->onSelectionChanged = std::bind(ListBoxSelectionChanged, srw, _1);
+        srw->listBox = w;
+        vbox->AddChild(w, 1);
+    }
+
+    srw->mainLayout = new Padding(vbox, DpiScaledInsets(parent, 4, 8));
+}
+
+static SearchResultsWindow* CreateSearchResultsWindow(TabInfo* tab) {
+    auto srw = new SearchResultsWindow();
+    srw->tab = tab;
+    auto mainWindow = new Window();
+    HMODULE h = GetModuleHandleW(nullptr);
+    mainWindow->hIcon = LoadIconW(h, MAKEINTRESOURCEW(GetAppIconID()));
+    mainWindow->isDialog = true;
+    mainWindow->backgroundColor = MkRgb((u8)0xee, (u8)0xee, (u8)0xee);
+    bool ok = mainWindow->Create();
+    CrashIf(!ok);
+    mainWindow->onClose = std::bind(WndCloseHandler, srw, _1);
+    mainWindow->onSize = std::bind(WndSizeHandler, srw, _1);
+    srw->mainWindow = mainWindow;
+    CreateMainLayout(srw);
+
+    int minDy = 480;
+    auto rc = ClientRect(tab->win->hwndCanvas);
+    if (rc.dy > 0) {
+        minDy = rc.dy;
+    }
+    LayoutAndSizeToContent(srw->mainLayout, 400, minDy, mainWindow->hwnd);
+    HwndPositionToTheRightOf(mainWindow->hwnd, tab->win->hwndFrame);
+
+    gSearchResultsWindows.Append(srw);
+    tab->searchResultsWindow = srw;
+    return srw;
+}
+
+// returns the text in the find box (or the selected text), nullptr if
+// the user has to enter the text to search for first
+static WCHAR* GetTextToFind(WindowInfo* win, bool* caseSensitive) {
+    DisplayModel* dm = win->AsFixed();
+    if (!dm || !NeedsFindUI(win)) {
+        return nullptr;
+    }
+
+    AutoFreeWstr text(win::GetText(win->hwndFindBox));
+    if (str::IsEmpty(text.Get()) && dm->textSelection->result.len > 0) {
+        text.Set(dm->textSelection->ExtractText(L" "));
+        str::NormalizeWS(text);
+        win::SetText(win->hwndFindBox, text);
+    }
+    if (str::IsEmpty(text.Get())) {
+        // let the user enter the text to search for first
+        OnMenuFind(win);
+        return nullptr;
+    }
+    WORD state = (WORD)SendMessageW(win->hwndToolbar, TB_GETSTATE, CmdFindMatch, 0);
+    *caseSensitive = (state & TBSTATE_CHECKED) != 0;
+    return text.StealData();
+}
+
+void ShowSearchResults(WindowInfo* win) {
+    bool caseSensitive = false;
+    AutoFreeWstr text(GetTextToFind(win, &caseSensitive));
+    if (!text) {
+        return;
+    }
+
+    TabInfo* tab = win->currentTab;
+    SearchResultsWindow* srw = tab->searchResultsWindow;
+    if (!srw) {
+        srw = CreateSearchResultsWindow(tab);
+    }
+    StartFindAll(srw, text, caseSensitive);
+    srw->mainWindow->SetIsVisible(true);
+    BringWindowToTop(srw->mainWindow->hwnd);
+}
+
+void CloseSearchResults(TabInfo* tab) {
+    delete tab->searchResultsWindow;
+    tab->searchResultsWindow = nullptr;
+    StopSearchingDocument(tab->AsFixed());
+}
+
+/* searching all open documents or all documents within a folder */
+
+#define MAX_DOCUMENT_SEARCH_THREADS 4
+
+struct DocumentSearchJob {
+    AutoFreeWstr filePath;
+    // set for documents that are open (reset when they're closed during the search,
+    // in which case documents not searched yet are loaded from their file instead)
+    DisplayModel* dm = nullptr;
+    bool isRunning = false;
+    LONG cancelled = 0;
+};
+
+struct DocumentSearchHit {
+    int jobNo = 0;
+    TextSearchHit hit{};
+};
+
+struct DocumentsSearchWindow;
+
+struct DocumentSearchWorker : ProgressUpdateUI {
+    DocumentsSearchWindow* dsw = nullptr;
+    // the job currently being searched, only changed by the worker (while holding dsw->access)
+    DocumentSearchJob* job = nullptr;
+    HANDLE thread = nullptr;
+
+    void UpdateProgress(int current, int total) override;
+    bool WasCanceled() override;
+};
+
+struct DocumentsSearchWindow {
+    // the window in which documents not currently open are opened
+    WindowInfo* win = nullptr;
+    Window* mainWindow = nullptr;
+    LayoutBase* mainLayout = nullptr;
+    StaticCtrl* staticStatus = nullptr;
+    ListBoxCtrl* listBox = nullptr;
+    ListBoxModelStrings* lbModel = nullptr;
+    ButtonCtrl* buttonStop = nullptr;
+
+    AutoFreeWstr text;
+    bool caseSensitive = false;
+    // jobs are only added or removed while no workers are running
+    Vec<DocumentSearchJob*> jobs;
+    // matches of all documents searched so far, in the order of lbModel
+    Vec<DocumentSearchHit> hits;
+    int nJobsDone = 0;
+    int nDocumentsWithHits = 0;
+    bool isSearching = false;
+
+    // guards nextJob and the jobs' dm and isRunning
+    CRITICAL_SECTION access;
+    CONDITION_VARIABLE jobFinished;
+    int nextJob = 0;
+    DocumentSearchWorker workers[MAX_DOCUMENT_SEARCH_THREADS];
+    int nWorkers = 0;
+    LONG cancelled = 0;
+    int searchNo = 0;
+
+    DocumentsSearchWindow();
+    ~DocumentsSearchWindow();
+};
+
+// only accessed on the ui thread
+static DocumentsSearchWindow* gDocumentsSearchWindow = nullptr;
+// identifies searches across all windows, so that results of stopped searches are ignored
+static int gDocumentsSearchNo = 0;
+
+void DocumentSearchWorker::UpdateProgress(int, int) {
+    // progress is reported per document
+}
+
+bool DocumentSearchWorker::WasCanceled() {
+    if (InterlockedAdd(&dsw->cancelled, 0) > 0) {
+        return true;
+    }
+    return job && InterlockedAdd(&job->cancelled, 0) > 0;
+}
+
+DocumentsSearchWindow::DocumentsSearchWindow() {
+    InitializeCriticalSection(&access);
+    InitializeConditionVariable(&jobFinished);
+    for (DocumentSearchWorker& worker : workers) {
+        worker.dsw = this;
+    }
+}
+
+static void StopDocumentsSearch(DocumentsSearchWindow* dsw) {
+    InterlockedIncrement(&dsw->cancelled);
+    for (int i = 0; i < dsw->nWorkers; i++) {
+        HANDLE thread = dsw->workers[i].thread;
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        dsw->workers[i].thread = nullptr;
+    }
+    dsw->nWorkers = 0;
+    dsw->isSearching = false;
+}
+
+DocumentsSearchWindow::~DocumentsSearchWindow() {
+    StopDocumentsSearch(this);
+    DeleteVecMembers(jobs);
+    delete mainWindow;
+    delete mainLayout;
+    delete lbModel;
+    DeleteCriticalSection(&access);
+}
+
+static void UpdateDocumentsSearchStatus(DocumentsSearchWindow* dsw) {
+    AutoFreeWstr status;
+    int nMatches = dsw->hits.isize();
+    if (dsw->isSearching) {
+        status.Set(str::Format(_TR("Searched %d of %d documents, found %d matches"), dsw->nJobsDone,
+                               dsw->jobs.isize(), nMatches));
+    } else if (0 == nMatches) {
+        status.SetCopy(_TR("No matches were found"));
+    } else {
+        status.Set(str::Format(_TR("Found %d matches in %d documents"), nMatches, dsw->nDocumentsWithHits));
+    }
+    dsw->staticStatus->SetText(status.Get());
+    dsw->buttonStop->SetIsEnabled(dsw->isSearching);
+}
+
+static void DocumentSearchedTask(DocumentsSearchWindow* dsw, int searchNo, int jobNo, Vec<TextSearchHit>* hits,
+                                 VecStr* descriptions) {
+    if (dsw != gDocumentsSearchWindow || dsw->searchNo != searchNo) {
+        delete hits;
+        delete descriptions;
+        return;
+    }
+    // descriptions are incomplete if the search has been stopped meanwhile
+    int n = std::min(hits->isize(), descriptions->size());
+    for (int i = 0; i < n; i++) {
+        dsw->hits.Append({jobNo, hits->at(i)});
+        dsw->lbModel->strings.Append(descriptions->at(i));
+    }
+    if (n > 0) {
+        dsw->nDocumentsWithHits++;
+        dsw->listBox->ItemsAppended();
+    }
+    dsw->nJobsDone++;
+    if (dsw->nJobsDone == dsw->jobs.isize()) {
+        StopDocumentsSearch(dsw);
+    }
+    UpdateDocumentsSearchStatus(dsw);
+    delete hits;
+    delete descriptions;
+}
+
+static void SearchDocument(DocumentSearchWorker* worker, DocumentSearchJob* job, DisplayModel* dm,
+                           Vec<TextSearchHit>& hits, VecStr& descriptions) {
+    DocumentsSearchWindow* dsw = worker->dsw;
+    const WCHAR* docName = path::GetBaseNameNoFree(job->filePath);
+    if (dm) {
+        ScopedTextCachePin pin(dm->textCache);
+        TextSearch textSearch(dm->GetEngine(), dm->textCache);
+        textSearch.SetSensitive(dsw->caseSensitive);
+        textSearch.FindAll(dsw->text, hits, dm->wordIndex, worker);
+        for (int i = 0; i < hits.isize() && !worker->WasCanceled(); i++) {
+            AppendHitDescription(descriptions, dm->textCache, hits.at(i), docName);
+        }
+        return;
+    }
+
+    // documents which would ask for a password are skipped
+    EngineBase* engine = CreateEngine(job->filePath, nullptr, false, false);
+    if (!engine) {
+        return;
+    }
+    if (!engine->IsImageCollection()) {
+        // the text of documents searched before is read from disk instead of being extracted again
+        AutoFreeWstr docId(CalcDocumentId(job->filePath));
+        auto textCache = new DocumentTextCache(engine);
+        LoadDiskTextIndex(textCache, docId);
+        {
+            TextSearch textSearch(engine, textCache);
+            textSearch.SetSensitive(dsw->caseSensitive);
+            textSearch.FindAll(dsw->text, hits, nullptr, worker);
+        }
+        for (int i = 0; i < hits.isize() && !worker->WasCanceled(); i++) {
+            AppendHitDescription(descriptions, textCache, hits.at(i), docName);
+        }
+        SaveDiskTextIndex(textCache, docId);
+        delete textCache;
+    }
+    delete engine;
+}
+
+static DWORD WINAPI DocumentSearchThread(LPVOID data) {
+    DocumentSearchWorker* worker = (DocumentSearchWorker*)data;
+    DocumentsSearchWindow* dsw = worker->dsw;
+    SetThreadName(GetCurrentThreadId(), "DocumentSearch");
+    int searchNo = dsw->searchNo;
+
+    for (;;) {
+        int jobNo;
+        DocumentSearchJob* job;
+        DisplayModel* dm;
+        {
+            ScopedCritSec scope(&dsw->access);
+            if (dsw->nextJob >= dsw->jobs.isize() || worker->WasCanceled()) {
+                break;
+            }
+            jobNo = dsw->nextJob++;
+            job = dsw->jobs.at(jobNo);
+            job->isRunning = true;
+            worker->job = job;
+            dm = job->dm;
+        }
+
+        auto hits = new Vec<TextSearchHit>();
+        auto descriptions = new VecStr();
+        SearchDocument(worker, job, dm, *hits, *descriptions);
+
+        {
+            ScopedCritSec scope(&dsw->access);
+            job->isRunning = false;
+            worker->job = nullptr;
+        }
+        WakeAllConditionVariable(&dsw->jobFinished);
+        uitask::Post([=] { DocumentSearchedTask(dsw, searchNo, jobNo, hits, descriptions); });
+    }
+    return 0;
+}
+
+static DisplayModel* FindOpenDocument(const WCHAR* filePath) {
+    for (WindowInfo* win : gWindows) {
+        for (TabInfo* tab : win->tabs) {
+            DisplayModel* dm = tab->AsFixed();
+            if (dm && path::IsSame(dm->FilePath(), filePath)) {
+                return dm;
+            }
+        }
+    }
+    return nullptr;
+}
+
+static void AddDocumentSearchJob(DocumentsSearchWindow* dsw, const WCHAR* filePath, DisplayModel* dm) {
+    for (DocumentSearchJob* job : dsw->jobs) {
+        if (path::IsSame(job->filePath, filePath)) {
+            return;
+        }
+    }
+    auto job = new DocumentSearchJob();
+    job->filePath.SetCopy(filePath);
+    job->dm = dm;
+    dsw->jobs.Append(job);
+}
+
+static void StartDocumentsSearch(DocumentsSearchWindow* dsw, const WCHAR* text, bool caseSensitive,
+                                 const WCHAR* folder) {
+    StopDocumentsSearch(dsw);
+    DeleteVecMembers(dsw->jobs);
+    dsw->hits.Reset();
+    auto model = new ListBoxModelStrings();
+    dsw->listBox->SetModel(model);
+    delete dsw->lbModel;
+    dsw->lbModel = model;
+
+    if (folder) {
+        DirIter di(folder, true);
+        for (const WCHAR* path = di.First(); path; path = di.Next()) {
+            if (!IsSupportedFileType(GuessFileTypeFromName(path), false)) {
+                continue;
+            }
+            // for documents which are already open, their extracted text is reused
+            DisplayModel* dm = FindOpenDocument(path);
+            if (!dm || !dm->GetEngine()->IsImageCollection()) {
+                AddDocumentSearchJob(dsw, path, dm);
+            }
+        }
+    } else {
+        for (WindowInfo* win : gWindows) {
+            for (TabInfo* tab : win->tabs) {
+                DisplayModel* dm = tab->AsFixed();
+                if (dm && dm->FilePath() && !dm->GetEngine()->IsImageCollection()) {
+                    AddDocumentSearchJob(dsw, dm->FilePath(), dm);
+                }
+            }
+        }
+    }
+    for (DocumentSearchJob* job : dsw->jobs) {
+        DisplayModel* dm = job->dm;
+        // the index also speeds up searching open documents again
+        if (dm) {
+            if (!dm->wordIndex) {
+                dm->wordIndex = new DocumentWordIndex(dm->textCache);
+            }
+            dm->wordIndex->StartIndexing();
+        }
+    }
+
+    dsw->text.SetCopy(text);
+    dsw->caseSensitive = caseSensitive;
+    dsw->searchNo = ++gDocumentsSearchNo;
+    dsw->cancelled = 0;
+    dsw->nextJob = 0;
+    dsw->nJobsDone = 0;
+    dsw->nDocumentsWithHits = 0;
+    dsw->isSearching = dsw->jobs.size() > 0;
+
+    AutoFreeWstr title;
+    if (folder) {
+        title.Set(str::Format(_TR("Search results for \"%s\" in %s"), text, folder));
+    } else {
+        title.Set(str::Format(_TR("Search results for \"%s\" in all open documents"), text));
+    }
+    dsw->mainWindow->SetText(title.Get());
+    UpdateDocumentsSearchStatus(dsw);
+
+    // each worker might also load a document, so their number is kept low
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int n = limitValue((int)si.dwNumberOfProcessors - 1, 1, MAX_DOCUMENT_SEARCH_THREADS);
+    n = std::min(n, dsw->jobs.isize());
+    for (int i = 0; i < n; i++) {
+        DocumentSearchWorker* worker = &dsw->workers[i];
+        worker->thread = CreateThread(nullptr, 0, DocumentSearchThread, worker, 0, nullptr);
+    }
+    dsw->nWorkers = n;
+}
+
+void StopSearchingDocument(DisplayModel* dm) {
+    DocumentsSearchWindow* dsw = gDocumentsSearchWindow;
+    if (!dsw || !dm) {
+        return;
+    }
+    ScopedCritSec scope(&dsw->access);
+    for (DocumentSearchJob* job : dsw->jobs) {
+        if (job->dm != dm) {
+            continue;
+        }
+        job->dm = nullptr;
+        if (job->isRunning) {
+            InterlockedIncrement(&job->cancelled);
+        }
+        while (job->isRunning) {
+            SleepConditionVariableCS(&dsw->jobFinished, &dsw->access, INFINITE);
+        }
+    }
+}
+
+static void DocumentsSearchHitSelected(DocumentsSearchWindow* dsw, ListBoxSelectionChangedEvent* ev) {
+    int idx = ev->idx;
+    if (idx < 0 || idx >= dsw->hits.isize()) {
+        return;
+    }
+    DocumentSearchHit& dh = dsw->hits.at(idx);
+    const WCHAR* filePath = dsw->jobs.at(dh.jobNo)->filePath;
+    WindowInfo* win = FindWindowInfoByFile(filePath, true);
+    if (!win) {
+        win = dsw->win;
+        if (!WindowInfoStillValid(win)) {
+            win = gWindows.size() > 0 ? gWindows.at(0) : nullptr;
+        }
+        if (!win || !file::Exists(filePath)) {
+            return;
+        }
+        LoadArgs args(filePath, win);
+        win = LoadDocument(args);
+        if (!win) {
+            return;
+        }
+    }
+    ShowHit(win, dh.hit);
+}
+
+static void ButtonStopHandler(DocumentsSearchWindow* dsw) {
+    StopDocumentsSearch(dsw);
+    UpdateDocumentsSearchStatus(dsw);
+}
+
+static void DocumentsSearchWndCloseHandler(DocumentsSearchWindow* dsw, WindowCloseEvent* ev) {
+    CrashIf(dsw->mainWindow != ev->w);
+    gDocumentsSearchWindow = nullptr;
+    delete dsw;
+}
+
+static void DocumentsSearchWndSizeHandler(DocumentsSearchWindow* dsw, SizeEvent* ev) {
+    int dx = ev->dx;
+    int dy = ev->dy;
+    if (dx == 0 || dy == 0) {
+        return;
+    }
+    ev->didHandle = true;
+    InvalidateRect(ev->hwnd, nullptr, false);
+    LayoutToSize(dsw->mainLayout, {dx, dy});
+}
+
+static void CreateDocumentsSearchLayout(DocumentsSearchWindow* dsw) {
+    HWND parent = dsw->mainWindow->hwnd;
+    auto vbox = new VBox();
+    vbox->alignMain = MainAxisAlign::MainStart;
+    vbox->alignCross = CrossAxisAlign::Stretch;
+
+    {
+        auto w = new StaticCtrl(parent);
+        bool ok = w->Create();
+        CrashIf(!ok);
+        dsw->staticStatus = w;
+        vbox->AddChild(w);
+    }
+
+    {
+        auto w = new ListBoxCtrl(parent);
+        w->idealSizeLines = 20;
+        w->SetInsetsPt(4, 0, 0, 0);
+        bool ok = w->Create();
+        CrashIf(!ok);
+        dsw->lbModel = new ListBoxModelStrings();
+        w->SetModel(dsw->lbModel);
+        w->onSelectionChanged = std::bind(DocumentsSearchHitSelected, dsw, _1);
+        dsw->listBox = w;
+        vbox->AddChild(w, 1);
+    }
+
+    {
+        auto w = new ButtonCtrl(parent);
+        w->SetInsetsPt(4, 0, 0, 0);
+        w->SetText(_TR("Stop"));
+        bool ok = w->Create();
+        CrashIf(!ok);
+        w->onClicked = std::bind(&ButtonStopHandler, dsw);
+        dsw->buttonStop = w;
+        vbox->AddChild(w);
+    }
+
+    dsw->mainLayout = new Padding(vbox, DpiScaledInsets(parent, 4, 8));
+}
+
+static DocumentsSearchWindow* CreateDocumentsSearchWindow(WindowInfo* win) {
+    auto dsw = new DocumentsSearchWindow();
+    auto mainWindow = new Window();
+    HMODULE h = GetModuleHandleW(nullptr);
+    mainWindow->hIcon = LoadIconW(h, MAKEINTRESOURCEW(GetAppIconID()));
+    mainWindow->isDialog = true;
+    mainWindow->backgroundColor = MkRgb((u8)0xee, (u8)0xee, (u8)0xee);
+    bool ok = mainWindow->Create();
+    CrashIf(!ok);
+    mainWindow->onClose = std::bind(DocumentsSearchWndCloseHandler, dsw, _1);
+    mainWindow->onSize = std::bind(DocumentsSearchWndSizeHandler, dsw, _1);
+    dsw->mainWindow = mainWindow;
+    CreateDocumentsSearchLayout(dsw);
+
+    int minDy = 480;
+    auto rc = ClientRect(win->hwndCanvas);
+    if (rc.dy > 0) {
+        minDy = rc.dy;
+    }
+    LayoutAndSizeToContent(dsw->mainLayout, 480, minDy, mainWindow->hwnd);
+    HwndPositionToTheRightOf(mainWindow->hwnd, win->hwndFrame);
+
+    gDocumentsSearchWindow = dsw;
+    return dsw;
+}
+
+void ShowSearchResultsInDocuments(WindowInfo* win, const WCHAR* folder) {
+    bool caseSensitive = false;
+    AutoFreeWstr text(GetTextToFind(win, &caseSensitive));
+    if (!text) {
+        return;
+    }
+
+    DocumentsSearchWindow* dsw = gDocumentsSearchWindow;
+    if (!dsw) {
+        dsw = CreateDocumentsSearchWindow(win);
+    }
+    dsw->win = win;
+    StartDocumentsSearch(dsw, text, caseSensitive, folder);
+    dsw->mainWindow->SetIsVisible(true);
+    BringWindowToTop(dsw->mainWindow->hwnd);
+}
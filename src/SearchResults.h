@@ -0,0 +1,15 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+struct SearchResultsWindow;
+
+// lists all matches of the text in the find box within the current document
+void ShowSearchResults(WindowInfo* win);
+// must be called before the tab's document is unloaded
+void CloseSearchResults(TabInfo* tab);
+
+// lists all matches of the text in the find box within all open documents
+// or (if folder isn't nullptr) within all supported documents in folder
+void ShowSearchResultsInDocuments(WindowInfo* win, const WCHAR* folder);
+// must be called before dm is deleted (also called by CloseSearchResults)
+void StopSearchingDocument(DisplayModel* dm);
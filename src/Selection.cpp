@@ -6,6 +6,7 @@
 #include <UIAutomationCoreApi.h>
 #include "utils/ScopedWin.h"
 #include "utils/Dpi.h"
+#include "utils/UITask.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -31,6 +32,12 @@
 #include "Translations.h"
 #include "uia/Provider.h"
 
+// text selections with at least this many pages whose text hasn't been
+// extracted yet are copied on a background thread
+#define MIN_PAGES_TO_COPY_ON_THREAD 8
+
+NotificationGroupId NG_COPY_PROGRESS = "copyProgress";
+
 SelectionOnPage::SelectionOnPage(int pageNo, RectF* rect) {
     this->pageNo = pageNo;
     if (rect) {
@@ -135,6 +142,28 @@ void PaintTransparentRectangles(HDC hdc, Rect screenRc, Vec<Rect>& rects, COLORR
     }
 }
 
+// a text selection can consist of hundreds of thousands of lines, so only
+// the rectangles on the visible pages are converted to screen coordinates
+// (relies on selections being ordered by page, as they are created)
+static void AppendVisibleSelectionRects(DisplayModel* dm, Vec<SelectionOnPage>* sel, Vec<Rect>& rects) {
+    int firstPage = dm->FirstVisiblePageNo();
+    int lastPage = dm->LastVisiblePageNo();
+    if (!dm->ValidPageNo(firstPage) || !dm->ValidPageNo(lastPage)) {
+        return;
+    }
+    SelectionOnPage* begin = sel->begin();
+    SelectionOnPage* end = sel->end();
+    SelectionOnPage* it = std::lower_bound(
+        begin, end, firstPage, [](const SelectionOnPage& s, int pageNo) -> bool { return s.pageNo < pageNo; });
+    for (; it < end && it->pageNo <= lastPage; it++) {
+        PageInfo* pageInfo = dm->GetPageInfo(it->pageNo);
+        if (!pageInfo || pageInfo->visibleRatio <= 0.0) {
+            continue;
+        }
+        rects.Append(dm->CvtToScreen(it->pageNo, it->rect));
+    }
+}
+
 void PaintSelection(WindowInfo* win, HDC hdc) {
     CrashIf(!win->AsFixed());
 
@@ -171,9 +200,7 @@ void PaintSelection(WindowInfo* win, HDC hdc) {
             return;
         }
 
-        for (SelectionOnPage& sel : *win->currentTab->selectionOnPage) {
-            rects.Append(sel.GetRect(win->AsFixed()));
-        }
+        AppendVisibleSelectionRects(win->AsFixed(), win->currentTab->selectionOnPage, rects);
     }
 
     PaintTransparentRectangles(hdc, win->canvasRc, rects, gGlobalPrefs->fixedPageUI.selectionColor);
@@ -185,13 +212,18 @@ void UpdateTextSelection(WindowInfo* win, bool select) {
     }
 
     DisplayModel* dm = win->AsFixed();
+    bool changed = true;
     if (select) {
         int pageNo = dm->GetPageNoByPoint(win->selectionRect.BR());
         if (win->ctrl->ValidPageNo(pageNo)) {
             PointF pt = dm->CvtFromScreen(win->selectionRect.BR(), pageNo);
-            dm->textSelection->SelectUpTo(pageNo, pt.x, pt.y);
+            changed = dm->textSelection->SelectUpTo(pageNo, pt.x, pt.y);
         }
     }
+    // this is called for every repaint while selecting, so don't rebuild an unchanged selection
+    if (!changed && win->currentTab->selectionOnPage && dm->textSelection->result.len > 0) {
+        return;
+    }
 
     DeleteOldSelectionInfo(win);
     win->currentTab->selectionOnPage = SelectionOnPage::FromTextSelect(&dm->textSelection->result);
@@ -288,10 +320,181 @@ WCHAR* GetSelectedText(WindowInfo* win, const WCHAR* lineSep, bool& isTextOnlySe
     return s;
 }
 
-//
+// text copied by CopyTextOnThread, which is only put on the clipboard
+// when another application asks for it (cf. OnRenderClipboardFormat)
+static WCHAR* gClipboardText = nullptr;
+
+static bool RenderClipboardText() {
+    if (!gClipboardText) {
+        return false;
+    }
+    size_t size = (str::Len(gClipboardText) + 1) * sizeof(WCHAR);
+    HGLOBAL handle = GlobalAlloc(GMEM_MOVEABLE, size);
+    if (!handle) {
+        return false;
+    }
+    void* data = GlobalLock(handle);
+    if (!data) {
+        GlobalFree(handle);
+        return false;
+    }
+    memcpy(data, gClipboardText, size);
+    GlobalUnlock(handle);
+    return SetClipboardData(CF_UNICODETEXT, handle) != nullptr;
+}
+
+void OnRenderClipboardFormat(UINT format) {
+    if (CF_UNICODETEXT == format) {
+        RenderClipboardText();
+    }
+}
+
+// called before hwnd is destroyed, so that the copied text remains available
+void OnRenderAllClipboardFormats(HWND hwnd) {
+    if (!OpenClipboard(hwnd)) {
+        return;
+    }
+    if (GetClipboardOwner() == hwnd) {
+        RenderClipboardText();
+    }
+    CloseClipboard();
+}
+
+void OnDestroyClipboard() {
+    free(gClipboardText);
+    gClipboardText = nullptr;
+}
+
+struct CopyThreadData : public ProgressUpdateUI {
+    WindowInfo* win = nullptr;
+    // only the glyph range is copied from the selection (which the user can change
+    // while it's being extracted), as computing its rects would require its text
+    TextSelection* sel = nullptr;
+    // owned by win->notifications
+    NotificationWnd* wnd = nullptr;
+    HANDLE thread = nullptr;
+
+    explicit CopyThreadData(WindowInfo* win) : win(win) {
+        DisplayModel* dm = win->AsFixed();
+        sel = new TextSelection(dm->GetEngine(), dm->textCache);
+        sel->startPage = dm->textSelection->startPage;
+        sel->startGlyph = dm->textSelection->startGlyph;
+        sel->endPage = dm->textSelection->endPage;
+        sel->endGlyph = dm->textSelection->endGlyph;
+
+        auto notifications = win->notifications;
+        wnd = new NotificationWnd(win->hwndCanvas, 0);
+        wnd->wndRemovedCb = [notifications](NotificationWnd* wnd) { notifications->RemoveNotification(wnd); };
+        wnd->Create(L"", _TR("Copying page %d of %d..."));
+        win->notifications->Add(wnd, NG_COPY_PROGRESS);
+    }
+    CopyThreadData(CopyThreadData const&) = delete;
+    CopyThreadData& operator=(CopyThreadData const&) = delete;
+
+    ~CopyThreadData() {
+        delete sel;
+        CloseHandle(thread);
+    }
+
+    void UpdateProgress(int current, int total) override {
+        WindowInfo* win = this->win;
+        NotificationWnd* wnd = this->wnd;
+        uitask::Post([=] {
+            if (!WindowInfoStillValid(win)) {
+                return;
+            }
+            if (win->notifications->Contains(wnd)) {
+                wnd->UpdateProgress(current, total);
+            } else {
+                // copying has been canceled by closing the notification
+                win->copyCanceled = true;
+            }
+        });
+    }
+
+    bool WasCanceled() override {
+        return !WindowInfoStillValid(win) || win->copyCanceled;
+    }
+};
+
+static void CopyEndTask(WindowInfo* win, CopyThreadData* ctd, WCHAR* text) {
+    if (!WindowInfoStillValid(win) || win->copyThread != ctd->thread) {
+        // AbortCopying was called after the copy thread ended
+        str::Free(text);
+        delete ctd;
+        return;
+    }
+    win->copyThread = nullptr;
+    win->notifications->RemoveNotification(ctd->wnd);
+    delete ctd;
+
+    // don't copy empty text
+    if (str::IsEmpty(text) || !OpenClipboard(win->hwndFrame)) {
+        str::Free(text);
+        return;
+    }
+    // the text is only rendered to the clipboard when it's pasted, as it might be huge
+    EmptyClipboard();
+    free(gClipboardText);
+    gClipboardText = text;
+    SetClipboardData(CF_UNICODETEXT, nullptr);
+    CloseClipboard();
+}
+
+static DWORD WINAPI CopyThread(LPVOID data) {
+    CopyThreadData* ctd = (CopyThreadData*)data;
+    WindowInfo* win = ctd->win;
+    WCHAR* text = ctd->sel->ExtractText(L"\r\n", ctd);
+    uitask::Post([=] { CopyEndTask(win, ctd, text); });
+    return 0;
+}
+
+// extracting the text of many pages takes too long for the ui thread
+static bool ShouldCopyTextOnThread(DisplayModel* dm) {
+    int fromPage, fromGlyph, toPage, toGlyph;
+    dm->textSelection->GetGlyphRange(&fromPage, &fromGlyph, &toPage, &toGlyph);
+    int nPagesToExtract = 0;
+    for (int pageNo = fromPage; pageNo <= toPage; pageNo++) {
+        if (!dm->textCache->HasTextForPage(pageNo)) {
+            nPagesToExtract++;
+        }
+    }
+    return nPagesToExtract >= MIN_PAGES_TO_COPY_ON_THREAD;
+}
+
+static void CopyTextOnThread(WindowInfo* win) {
+    AbortCopying(win);
+    CopyThreadData* ctd = new CopyThreadData(win);
+    win->copyThread = CreateThread(nullptr, 0, CopyThread, ctd, 0, nullptr);
+    if (!win->copyThread) {
+        win->notifications->RemoveNotification(ctd->wnd);
+        delete ctd;
+        return;
+    }
+    ctd->thread = win->copyThread; // safe because only accessed on ui thread
+}
+
+void AbortCopying(WindowInfo* win) {
+    if (win->copyThread) {
+        win->copyCanceled = true;
+        WaitForSingleObject(win->copyThread, INFINITE);
+        // CopyEndTask frees the thread's data
+        win->copyThread = nullptr;
+    }
+    win->copyCanceled = false;
+    win->notifications->RemoveForGroup(NG_COPY_PROGRESS);
+}
+
 void CopySelectionToClipboard(WindowInfo* win) {
     CrashIf(win->currentTab->selectionOnPage->size() == 0 && win->mouseAction != MouseAction::SelectingText);
 
+    DisplayModel* dm = win->AsFixed();
+    bool mayCopyText = gDisableDocumentRestrictions || dm->GetEngine()->AllowsCopyingText();
+    if (mayCopyText && dm->textSelection->result.len > 0 && ShouldCopyTextOnThread(dm)) {
+        CopyTextOnThread(win);
+        return;
+    }
+
     if (!OpenClipboard(nullptr)) {
         return;
     }
@@ -302,7 +505,7 @@ void CopySelectionToClipboard(WindowInfo* win) {
 
     WCHAR* selText = nullptr;
     bool isTextOnlySelectionOut = false;
-    if (!gDisableDocumentRestrictions && !win->AsFixed()->GetEngine()->AllowsCopyingText()) {
+    if (!mayCopyText) {
         win->ShowNotification(_TR("Copying text was denied (copying as image only)"));
     } else {
         selText = GetSelectedText(win, L"\r\n", isTextOnlySelectionOut);
@@ -317,7 +520,6 @@ void CopySelectionToClipboard(WindowInfo* win) {
         return;
     }
 
-    DisplayModel* dm = win->AsFixed();
     /* also copy a screenshot of the current selection to the clipboard */
     SelectionOnPage* selOnPage = &win->currentTab->selectionOnPage->at(0);
     float zoom = dm->GetZoomReal(selOnPage->pageNo);
@@ -42,6 +42,9 @@ struct FixedPageUI {
     // subconsciously determine reading progress; suggested values: #2828aa
     // #28aa28 #aa2828
     Vec<COLORREF>* gradientColors;
+    // if true, scrolling with the mouse wheel or by line and page in
+    // continuous modes is animated
+    bool smoothScroll;
     // if true, TextColor and BackgroundColor will be temporarily swapped
     bool invertColors;
     // if true, hides the scrollbars but retain ability to scroll
@@ -105,6 +108,17 @@ struct ExternalViewer {
 struct PrinterDefaults {
     // default value for scaling (shrink, fit, none)
     char* printScale;
+    // maximum amount of memory (in MB) used for rendering a single printed
+    // page; larger pages are printed in horizontal bands (if this value
+    // isn't positive, 64 MB are used)
+    int maxBitmapSize;
+    // height (in printer pixels) of the bands large pages are printed in
+    // (if this value isn't positive, it's derived from MaxBitmapSize)
+    int bandHeight;
+    // if true, PDF and XPS pages are printed as vector graphics instead of
+    // bitmaps, which makes print jobs much smaller (pages using
+    // transparency are still printed as bitmaps)
+    bool vectorPrinting;
 };
 
 // customization options for how we show forward search results (used
@@ -306,6 +320,28 @@ struct GlobalPrefs {
     // actual resolution of the main screen in DPI (if this value isn't
     // positive, the system's UI setting is used)
     int customScreenDPI;
+    // number of threads rendering pages concurrently (if this value isn't
+    // positive, it's based on the number of processors)
+    int renderThreads;
+    // maximum amount of memory (in MB) used for caching rendered pages (if
+    // this value isn't positive, it's based on the screen size and the
+    // available memory)
+    int renderCacheSize;
+    // maximum amount of disk space (in MB) used for keeping rendered pages
+    // of recently viewed documents between sessions (if this value isn't
+    // positive, no pages are kept on disk)
+    int diskTileCacheSize;
+    // maximum amount of disk space (in MB) used for keeping the text of
+    // recently searched documents between sessions (if this value isn't
+    // positive, no text is kept on disk)
+    int diskTextIndexSize;
+    // maximum amount of memory (in MB) used for keeping the text of each
+    // document (if this value isn't positive, 64 MB are used)
+    int textCacheSize;
+    // maximum amount of memory (in MB) used for caching decoded images and
+    // fonts of each visible document (if this value isn't positive, it's
+    // based on the available memory)
+    int documentCacheSize;
     // if true, we store display settings for each document separately
     // (i.e. everything after UseDefaultState in FileStates)
     bool rememberStatePerDocument;
@@ -405,10 +441,11 @@ static const FieldInfo gFixedPageUIFields[] = {
     {offsetof(FixedPageUI, windowMargin), SettingType::Compact, (intptr_t)&gWindowMarginInfo},
     {offsetof(FixedPageUI, pageSpacing), SettingType::Compact, (intptr_t)&gSizeInfo},
     {offsetof(FixedPageUI, gradientColors), SettingType::ColorArray, 0},
+    {offsetof(FixedPageUI, smoothScroll), SettingType::Bool, true},
 };
 static const StructInfo gFixedPageUIInfo = {
-    sizeof(FixedPageUI), 6, gFixedPageUIFields,
-    "TextColor\0BackgroundColor\0SelectionColor\0WindowMargin\0PageSpacing\0GradientColors"};
+    sizeof(FixedPageUI), 7, gFixedPageUIFields,
+    "TextColor\0BackgroundColor\0SelectionColor\0WindowMargin\0PageSpacing\0GradientColors\0SmoothScroll"};
 
 static const FieldInfo gEbookUIFields[] = {
     {offsetof(EbookUI, fontName), SettingType::String, (intptr_t)L"Georgia"},
@@ -458,8 +495,12 @@ static const StructInfo gExternalViewerInfo = {sizeof(ExternalViewer), 3, gExter
 
 static const FieldInfo gPrinterDefaultsFields[] = {
     {offsetof(PrinterDefaults, printScale), SettingType::Utf8String, (intptr_t) "shrink"},
+    {offsetof(PrinterDefaults, maxBitmapSize), SettingType::Int, 0},
+    {offsetof(PrinterDefaults, bandHeight), SettingType::Int, 0},
+    {offsetof(PrinterDefaults, vectorPrinting), SettingType::Bool, true},
 };
-static const StructInfo gPrinterDefaultsInfo = {sizeof(PrinterDefaults), 1, gPrinterDefaultsFields, "PrintScale"};
+static const StructInfo gPrinterDefaultsInfo = {sizeof(PrinterDefaults), 4, gPrinterDefaultsFields,
+                                                "PrintScale\0MaxBitmapSize\0BandHeight\0VectorPrinting"};
 
 static const FieldInfo gForwardSearchFields[] = {
     {offsetof(ForwardSearch, highlightOffset), SettingType::Int, 0},
@@ -603,6 +644,12 @@ static const FieldInfo gGlobalPrefsFields[] = {
     {offsetof(GlobalPrefs, annotationDefaults), SettingType::Prerelease, (intptr_t)&gAnnotationDefaultsInfo},
     {offsetof(GlobalPrefs, defaultPasswords), SettingType::StringArray, 0},
     {offsetof(GlobalPrefs, customScreenDPI), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, renderThreads), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, renderCacheSize), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, diskTileCacheSize), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, diskTextIndexSize), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, textCacheSize), SettingType::Int, 0},
+    {offsetof(GlobalPrefs, documentCacheSize), SettingType::Int, 0},
     {(size_t)-1, SettingType::Comment, 0},
     {offsetof(GlobalPrefs, rememberStatePerDocument), SettingType::Bool, true},
     {offsetof(GlobalPrefs, uiLanguage), SettingType::Utf8String, 0},
@@ -636,14 +683,15 @@ static const FieldInfo gGlobalPrefsFields[] = {
      (intptr_t) "Settings after this line have not been recognized by the current version"},
 };
 static const StructInfo gGlobalPrefsInfo = {
-    sizeof(GlobalPrefs), 55, gGlobalPrefsFields,
+    sizeof(GlobalPrefs), 61, gGlobalPrefsFields,
     "\0\0MainWindowBackground\0EscToExit\0ReuseInstance\0UseSysColors\0RestoreSession\0TabWidth\0\0FixedPageUI\0EbookUI"
     "\0ComicBookUI\0ChmUI\0ExternalViewers\0ShowMenubar\0ReloadModifiedDocuments\0FullPathInTitle\0ZoomLevels\0ZoomIncr"
-    "ement\0\0PrinterDefaults\0ForwardSearch\0AnnotationDefaults\0DefaultPasswords\0CustomScreenDPI\0\0RememberStatePer"
-    "Document\0UiLanguage\0ShowToolbar\0ShowFavorites\0AssociatedExtensions\0AssociateSilently\0CheckForUpdates\0Versio"
-    "nToSkip\0RememberOpenedFiles\0InverseSearchCmdLine\0EnableTeXEnhancements\0DefaultDisplayMode\0DefaultZoom\0Window"
-    "State\0WindowPos\0ShowToc\0SidebarDx\0TocDy\0TreeFontSize\0ShowStartPage\0UseTabs\0\0FileStates\0SessionData\0Reop"
-    "enOnce\0TimeOfLastUpdateCheck\0OpenCountWeek\0\0"};
+    "ement\0\0PrinterDefaults\0ForwardSearch\0AnnotationDefaults\0DefaultPasswords\0CustomScreenDPI\0RenderThreads\0Ren"
+    "derCacheSize\0DiskTileCacheSize\0DiskTextIndexSize\0TextCacheSize\0DocumentCacheSize\0\0RememberStatePerDocument\0"
+    "UiLanguage\0ShowToolbar\0ShowFavorites\0AssociatedExtensions\0AssociateSilently\0CheckForUpdates\0VersionToSkip\0R"
+    "ememberOpenedFiles\0InverseSearchCmdLine\0EnableTeXEnhancements\0DefaultDisplayMode\0DefaultZoom\0WindowState\0Win"
+    "dowPos\0ShowToc\0SidebarDx\0TocDy\0TreeFontSize\0ShowStartPage\0UseTabs\0\0FileStates\0SessionData\0ReopenOnce\0Ti"
+    "meOfLastUpdateCheck\0OpenCountWeek\0\0"};
 
 #endif
 
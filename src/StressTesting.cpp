@@ -7,6 +7,7 @@
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/JsonParser.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlWindow.h"
 #include "mui/Mui.h"
@@ -42,6 +43,7 @@
 #include "Flags.h"
 #include "SearchAndDDE.h"
 #include "StressTesting.h"
+#include "Version.h"
 
 #define FIRST_STRESS_TIMER_ID 101
 
@@ -82,9 +84,15 @@ static void BenchLoadRender(EngineBase* engine, int pagenum) {
         logf(L"Error: failed to render page %d", pagenum);
         return;
     }
-    delete rendered;
     timeMs = TimeSinceInMs(t);
     logf(L"pagerender %3d: %.2f ms", pagenum, timeMs);
+
+    // cost of recoloring with inverted colors, as done by RenderCache
+    t = TimeGet();
+    UpdateBitmapColors(rendered->GetBitmap(), WIN_COL_WHITE, WIN_COL_BLACK);
+    timeMs = TimeSinceInMs(t);
+    logf(L"recolor    %3d: %.2f ms", pagenum, timeMs);
+    delete rendered;
 }
 
 static int FormatWholeDoc(Doc& doc) {
@@ -118,7 +126,10 @@ static int TimeOneMethod(Doc& doc, TextRenderMethod method, const WCHAR* methodN
 // using different text measurement method (since the time is mostly
 // dominated by text measure)
 void BenchEbookLayout(const WCHAR* filePath) {
-    gLogBuf->Reset();
+    FlushLog();
+    if (gLogBuf) {
+        gLogBuf->Reset();
+    }
     logf(L"Starting: %s", filePath);
     if (!file::Exists(filePath)) {
         logf(L"Error: file doesn't exist");
@@ -257,14 +268,343 @@ static void BenchDir(WCHAR* dir) {
     }
 }
 
-void BenchFileOrDir(WStrVec& pathsToBench) {
+// -bench with -bench-out runs a benchmark suite instead: every document is loaded
+// benchWarmupRuns + benchRuns times with a new engine and each phase is timed for all
+// selected pages at once. only the last benchRuns are measured and their min/median/p95
+// are written as JSON or CSV, so that the results of different versions can be compared
+
+enum class BenchPhase {
+    Load,
+    PageLoad,
+    Render,
+    Text,
+    Search,
+};
+
+static const char* benchPhaseNames = "load\0pageload\0render\0text\0search\0";
+
+struct BenchMetric {
+    BenchPhase phase = BenchPhase::Load;
+    // only used by BenchPhase::Render (zoom is in percent)
+    float zoom = 0;
+    int rotation = 0;
+    // in ms, one per measured run
+    Vec<double> samples;
+};
+
+struct BenchStats {
+    double min = 0;
+    double median = 0;
+    double p95 = 0;
+    double mean = 0;
+};
+
+struct BenchDocResult {
+    WCHAR* path = nullptr;
+    int pageCount = 0;
+    int nPagesBenched = 0;
+    const char* error = nullptr;
+    Vec<BenchMetric*> metrics;
+
+    ~BenchDocResult() {
+        free(path);
+        DeleteVecMembers(metrics);
+    }
+};
+
+struct BenchSuite {
+    int nRuns = 5;
+    int nWarmupRuns = 1;
+    Vec<float> zooms;
+    Vec<int> rotations;
+    const WCHAR* searchText = nullptr;
+    Vec<BenchDocResult*> docs;
+
+    ~BenchSuite() {
+        DeleteVecMembers(docs);
+    }
+};
+
+static void AddBenchSample(BenchDocResult* doc, BenchPhase phase, float zoom, int rotation, double ms) {
+    for (BenchMetric* m : doc->metrics) {
+        if (m->phase == phase && m->zoom == zoom && m->rotation == rotation) {
+            m->samples.Append(ms);
+            return;
+        }
+    }
+    BenchMetric* m = new BenchMetric();
+    m->phase = phase;
+    m->zoom = zoom;
+    m->rotation = rotation;
+    m->samples.Append(ms);
+    doc->metrics.Append(m);
+}
+
+// p95 is the nearest-rank percentile, so it's the maximum for less than 20 runs
+static BenchStats CalcBenchStats(const Vec<double>& samples) {
+    BenchStats stats;
+    size_t n = samples.size();
+    if (0 == n) {
+        return stats;
+    }
+    Vec<double> sorted(samples);
+    std::sort(sorted.begin(), sorted.end());
+    stats.min = sorted.at(0);
+    stats.median = n % 2 ? sorted.at(n / 2) : (sorted.at(n / 2 - 1) + sorted.at(n / 2)) / 2;
+    stats.p95 = sorted.at((size_t)ceil(0.95 * n) - 1);
+    double sum = 0;
+    for (double ms : sorted) {
+        sum += ms;
+    }
+    stats.mean = sum / n;
+    return stats;
+}
+
+static void CollectBenchPages(const WCHAR* pagesSpec, int pageCount, Vec<int>& pages) {
+    if (!pagesSpec) {
+        for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+            pages.Append(pageNo);
+        }
+        return;
+    }
+    // for "loadonly" no pages are benchmarked
+    Vec<PageRange> ranges;
+    if (!ParsePageRanges(pagesSpec, ranges)) {
+        return;
+    }
+    for (PageRange& range : ranges) {
+        for (int pageNo = range.start; pageNo <= range.end && pageNo <= pageCount; pageNo++) {
+            if (pageNo >= 1) {
+                pages.Append(pageNo);
+            }
+        }
+    }
+}
+
+// returns false if a phase failed (doc->error is set)
+static bool RunBenchPhases(BenchSuite* suite, BenchDocResult* doc, EngineBase* engine, Vec<int>& pages, bool measure) {
+    auto t = TimeGet();
+    for (int pageNo : pages) {
+        if (!engine->BenchLoadPage(pageNo)) {
+            doc->error = "failed to load a page";
+            return false;
+        }
+    }
+    if (measure) {
+        AddBenchSample(doc, BenchPhase::PageLoad, 0, 0, TimeSinceInMs(t));
+    }
+
+    for (float zoom : suite->zooms) {
+        for (int rotation : suite->rotations) {
+            t = TimeGet();
+            for (int pageNo : pages) {
+                RenderPageArgs args(pageNo, zoom / 100.f, rotation);
+                RenderedBitmap* bmp = engine->RenderPage(args);
+                if (!bmp) {
+                    doc->error = "failed to render a page";
+                    return false;
+                }
+                delete bmp;
+            }
+            if (measure) {
+                AddBenchSample(doc, BenchPhase::Render, zoom, rotation, TimeSinceInMs(t));
+            }
+        }
+    }
+
+    t = TimeGet();
+    for (int pageNo : pages) {
+        PageText pageText = engine->ExtractPageText(pageNo);
+        FreePageText(&pageText);
+    }
+    if (measure) {
+        AddBenchSample(doc, BenchPhase::Text, 0, 0, TimeSinceInMs(t));
+    }
+
+    if (!suite->searchText) {
+        return true;
+    }
+    // only time searching, not extracting the text of all pages (which FindAll would do)
+    DocumentTextCache textCache(engine);
+    for (int pageNo = 1; pageNo <= doc->pageCount; pageNo++) {
+        textCache.GetTextForPage(pageNo);
+    }
+    t = TimeGet();
+    TextSearch search(engine, &textCache);
+    Vec<TextSearchHit> hits;
+    search.FindAll(suite->searchText, hits);
+    if (measure) {
+        AddBenchSample(doc, BenchPhase::Search, 0, 0, TimeSinceInMs(t));
+    }
+    return true;
+}
+
+static void RunBenchDoc(BenchSuite* suite, BenchDocResult* doc, const WCHAR* pagesSpec) {
+    logf(L"Starting: %s", doc->path);
+    Vec<int> pages;
+    int nRuns = suite->nWarmupRuns + suite->nRuns;
+    for (int run = 0; run < nRuns; run++) {
+        bool measure = run >= suite->nWarmupRuns;
+        auto t = TimeGet();
+        EngineBase* engine = CreateEngine(doc->path);
+        double loadMs = TimeSinceInMs(t);
+        if (!engine) {
+            doc->error = "failed to load";
+            logf(L"Error: failed to load %s", doc->path);
+            return;
+        }
+        if (measure) {
+            AddBenchSample(doc, BenchPhase::Load, 0, 0, loadMs);
+        }
+        if (0 == run) {
+            doc->pageCount = engine->PageCount();
+            CollectBenchPages(pagesSpec, doc->pageCount, pages);
+            doc->nPagesBenched = pages.isize();
+        }
+        bool ok = pages.size() == 0 || RunBenchPhases(suite, doc, engine, pages, measure);
+        delete engine;
+        if (!ok) {
+            logf("Error: %s", doc->error);
+            return;
+        }
+    }
+}
+
+static void AppendBenchJson(str::Str& s, BenchSuite* suite) {
+    s.AppendFmt("{\n  \"version\": \"%s\",\n  \"runs\": %d,\n  \"warmupRuns\": %d,\n  \"documents\": [",
+                CURR_VERSION_STRA, suite->nRuns, suite->nWarmupRuns);
+    for (size_t i = 0; i < suite->docs.size(); i++) {
+        BenchDocResult* doc = suite->docs.at(i);
+        s.Append(i > 0 ? ",\n    {" : "\n    {");
+        s.Append("\"path\": ");
+        AutoFree path = strconv::WstrToUtf8(doc->path);
+        json::AppendQuoted(s, path.Get());
+        s.AppendFmt(", \"pages\": %d, \"pagesBenched\": %d", doc->pageCount, doc->nPagesBenched);
+        if (doc->error) {
+            s.AppendFmt(", \"error\": \"%s\"", doc->error);
+        }
+        s.Append(", \"metrics\": [");
+        for (size_t j = 0; j < doc->metrics.size(); j++) {
+            BenchMetric* m = doc->metrics.at(j);
+            BenchStats stats = CalcBenchStats(m->samples);
+            s.Append(j > 0 ? ",\n      {" : "\n      {");
+            s.AppendFmt("\"phase\": \"%s\"", seqstrings::IdxToStr(benchPhaseNames, (int)m->phase));
+            if (BenchPhase::Render == m->phase) {
+                s.AppendFmt(", \"zoom\": %g, \"rotation\": %d", m->zoom, m->rotation);
+            }
+            s.AppendFmt(", \"minMs\": %.3f, \"medianMs\": %.3f, \"p95Ms\": %.3f, \"meanMs\": %.3f, \"samplesMs\": [",
+                        stats.min, stats.median, stats.p95, stats.mean);
+            for (size_t k = 0; k < m->samples.size(); k++) {
+                s.AppendFmt(k > 0 ? ", %.3f" : "%.3f", m->samples.at(k));
+            }
+            s.Append("]}");
+        }
+        s.Append(doc->metrics.size() > 0 ? "\n    ]}" : "]}");
+    }
+    s.Append("\n  ]\n}\n");
+}
+
+// one row per metric, zoom and rotation are empty for phases other than render
+static void AppendBenchCsv(str::Str& s, BenchSuite* suite) {
+    s.Append("version,path,phase,zoom,rotation,runs,min_ms,median_ms,p95_ms,mean_ms,error\r\n");
+    for (BenchDocResult* doc : suite->docs) {
+        AutoFree path = strconv::WstrToUtf8(doc->path);
+        AutoFree quotedPath = str::Replace(path.Get(), "\"", "\"\"");
+        const char* error = doc->error ? doc->error : "";
+        if (doc->metrics.size() == 0) {
+            s.AppendFmt("%s,\"%s\",,,,0,,,,,%s\r\n", CURR_VERSION_STRA, quotedPath.Get(), error);
+        }
+        for (BenchMetric* m : doc->metrics) {
+            BenchStats stats = CalcBenchStats(m->samples);
+            s.AppendFmt("%s,\"%s\",%s,", CURR_VERSION_STRA, quotedPath.Get(),
+                        seqstrings::IdxToStr(benchPhaseNames, (int)m->phase));
+            if (BenchPhase::Render == m->phase) {
+                s.AppendFmt("%g,%d,", m->zoom, m->rotation);
+            } else {
+                s.Append(",,");
+            }
+            s.AppendFmt("%d,%.3f,%.3f,%.3f,%.3f,%s\r\n", m->samples.isize(), stats.min, stats.median, stats.p95,
+                        stats.mean, error);
+        }
+    }
+}
+
+static void ParseBenchList(const WCHAR* list, const WCHAR* defaultList, WStrVec& items) {
+    items.Split(list ? list : defaultList, L",", true);
+}
+
+static int RunBenchSuite(const Flags& i) {
+    BenchSuite suite;
+    suite.nRuns = std::max(i.benchRuns, 1);
+    suite.nWarmupRuns = std::max(i.benchWarmupRuns, 0);
+    suite.searchText = i.benchSearchText;
+    WStrVec items;
+    ParseBenchList(i.benchZooms, L"100", items);
+    for (const WCHAR* item : items) {
+        float zoom = (float)_wtof(item);
+        if (zoom > 0) {
+            suite.zooms.Append(zoom);
+        }
+    }
+    items.Reset();
+    ParseBenchList(i.benchRotations, L"0", items);
+    for (const WCHAR* item : items) {
+        int rotation = _wtoi(item);
+        if (rotation % 90 == 0) {
+            suite.rotations.Append(NormalizeRotation(rotation));
+        }
+    }
+
+    size_t n = i.pathsToBenchmark.size() / 2;
+    for (size_t j = 0; j < n; j++) {
+        WCHAR* path = i.pathsToBenchmark.at(2 * j);
+        const WCHAR* pagesSpec = i.pathsToBenchmark.at(2 * j + 1);
+        WStrVec files;
+        if (file::Exists(path)) {
+            files.Append(str::Dup(path));
+        } else if (dir::Exists(path)) {
+            CollectFilesToBench(path, files);
+            pagesSpec = nullptr;
+        } else {
+            logf(L"Error: file or dir %s doesn't exist", path);
+            continue;
+        }
+        for (const WCHAR* filePath : files) {
+            BenchDocResult* doc = new BenchDocResult();
+            doc->path = str::Dup(filePath);
+            suite.docs.Append(doc);
+            RunBenchDoc(&suite, doc, pagesSpec);
+        }
+    }
+
+    str::Str s(16 * 1024);
+    if (str::EndsWithI(i.benchOutPath, L".csv")) {
+        AppendBenchCsv(s, &suite);
+    } else {
+        AppendBenchJson(s, &suite);
+    }
+    if (!file::WriteFile(i.benchOutPath, s.AsSpan())) {
+        logf(L"Error: failed to write %s", i.benchOutPath);
+        return 1;
+    }
+    logf(L"Wrote benchmark results for %d documents to %s", suite.docs.isize(), i.benchOutPath);
+    return 0;
+}
+
+void BenchFileOrDir(const Flags& i) {
     logToStderr = true;
 
+    if (i.benchOutPath) {
+        RunBenchSuite(i);
+        return;
+    }
+
+    const WStrVec& pathsToBench = i.pathsToBenchmark;
     size_t n = pathsToBench.size() / 2;
-    for (size_t i = 0; i < n; i++) {
-        WCHAR* path = pathsToBench.at(2 * i);
+    for (size_t j = 0; j < n; j++) {
+        WCHAR* path = pathsToBench.at(2 * j);
         if (file::Exists(path)) {
-            BenchFile(path, pathsToBench.at(2 * i + 1));
+            BenchFile(path, pathsToBench.at(2 * j + 1));
         } else if (dir::Exists(path)) {
             BenchDir(path);
         } else {
@@ -497,6 +837,73 @@ static size_t GetAllMatchingFiles(const WCHAR* dir, const WCHAR* filter, WStrVec
 a human advancing one page at a time. This is mostly to run through a large number
 of PDFs before a release to make sure we're crash proof. */
 
+// responsiveness mode (-stress-responsiveness): instead of paging through
+// documents, a script of smooth scrolling, zooming and page jumps is run for
+// each document and the time from the start of an action until the document
+// is painted completely (all visible pages up-to-date) is measured together
+// with how long each paint takes
+
+enum class RespAction {
+    Scroll,
+    Zoom,
+    Jump,
+    Count,
+};
+
+static const WCHAR* respActionNames[] = {L"scroll", L"zoom", L"jump"};
+
+// actions not completely painted after that long are counted as timed out
+#define RESP_TIMEOUT_MS 10000
+// smooth scrolling is simulated by scrolling a bit every RESP_SCROLL_INTERVAL_MS
+#define RESP_SCROLL_INTERVAL_MS 16
+#define RESP_SCROLL_STEPS 12
+
+struct RespStep {
+    RespAction action = RespAction::Scroll;
+    // zoom resp. page number resp. scroll direction (1 or -1)
+    float value = 0;
+    // only the last step of an action waits for a complete paint
+    bool last = true;
+};
+
+static void AddRespScroll(Vec<RespStep>& steps, int direction) {
+    for (int i = 1; i <= RESP_SCROLL_STEPS; i++) {
+        steps.Append({RespAction::Scroll, (float)direction, i == RESP_SCROLL_STEPS});
+    }
+}
+
+static void AddRespJump(Vec<RespStep>& steps, int pageCount) {
+    steps.Append({RespAction::Jump, (float)(rand() % pageCount + 1), true});
+}
+
+static void BuildResponsivenessScript(Vec<RespStep>& steps, int pageCount) {
+    steps.Reset();
+    steps.Append({RespAction::Zoom, ZOOM_FIT_WIDTH, true});
+    AddRespScroll(steps, 1);
+    AddRespScroll(steps, 1);
+    for (int i = 0; i < 3; i++) {
+        AddRespJump(steps, pageCount);
+    }
+    steps.Append({RespAction::Zoom, 200.f, true});
+    AddRespScroll(steps, 1);
+    AddRespScroll(steps, -1);
+    steps.Append({RespAction::Zoom, 50.f, true});
+    steps.Append({RespAction::Zoom, ZOOM_FIT_PAGE, true});
+    for (int i = 0; i < 2; i++) {
+        AddRespJump(steps, pageCount);
+    }
+}
+
+static void AppendRespStats(str::WStr& s, const WCHAR* name, Vec<double>& samples) {
+    if (samples.size() == 0) {
+        return;
+    }
+    BenchStats stats = CalcBenchStats(samples);
+    double maxMs = *std::max_element(samples.begin(), samples.end());
+    s.AppendFmt(L"\n%s: %d, median %.1f ms, p95 %.1f ms, max %.1f ms", name, (int)samples.size(), stats.median,
+                stats.p95, maxMs);
+}
+
 struct StressTest {
     WindowInfo* win;
     LARGE_INTEGER currPageRenderTime;
@@ -516,14 +923,33 @@ struct StressTest {
     // owned by StressTest
     TestFileProvider* fileProvider;
 
+    // state for the responsiveness mode
+    bool measureResponsiveness = false;
+    // the script for the current document
+    Vec<RespStep> respSteps;
+    int respStepNo = 0;
+    LARGE_INTEGER respActionStart{};
+    // set after an action's last step until the action has been recorded
+    bool respWaiting = false;
+    // time until the action was completely painted (negative until then)
+    double respCompleteMs = -1;
+    Vec<double> respActionMs[(int)RespAction::Count];
+    int respTimeouts = 0;
+    Vec<double> respPaintMs;
+
     bool OpenFile(const WCHAR* fileName);
 
     bool GoToNextPage();
     bool GoToNextFile();
 
-    void TickTimer();
+    void TickTimer(UINT delayMs = USER_TIMER_MINIMUM);
     void Finished(bool success);
 
+    void OnResponsivenessTimer();
+    void RunResponsivenessStep(RespStep& step);
+    void RecordResponsivenessAction();
+    void GetResponsivenessReport(str::WStr& s);
+
     StressTest(WindowInfo* win, bool exitWhenDone)
         : win(win),
           currPage(0),
@@ -543,6 +969,7 @@ struct StressTest {
     void Start(TestFileProvider* fileProvider, int cycles);
 
     void OnTimer(int timerIdGot);
+    void OnPaint(double paintMs, bool complete);
     void GetLogInfo(str::Str* s);
 };
 
@@ -585,8 +1012,14 @@ void StressTest::Finished(bool success) {
     if (success) {
         int secs = SecsSinceSystemTime(stressStartTime);
         AutoFreeWstr tm(FormatTime(secs));
-        AutoFreeWstr s(str::Format(L"Stress test complete, rendered %d files in %s", filesCount, tm.Get()));
-        win->ShowNotification(s, NOS_PERSIST, NG_STRESS_TEST_SUMMARY);
+        str::WStr s;
+        s.AppendFmt(L"Stress test complete, rendered %d files in %s", filesCount, tm.Get());
+        if (measureResponsiveness) {
+            GetResponsivenessReport(s);
+            wprintf(L"%s\n", s.Get());
+            fflush(stdout);
+        }
+        win->ShowNotification(s.Get(), NOS_PERSIST, NG_STRESS_TEST_SUMMARY);
     }
 
     CloseWindow(win, exitWhenDone && MayCloseWindow(win));
@@ -664,6 +1097,18 @@ bool StressTest::OpenFile(const WCHAR* fileName) {
         SetSidebarVisibility(win, win->tocVisible, gGlobalPrefs->showFavorites);
     }
 
+    if (measureResponsiveness) {
+        respSteps.Reset();
+        // only the painting of fixed page documents can be measured
+        if (win->AsFixed()) {
+            BuildResponsivenessScript(respSteps, win->ctrl->PageCount());
+        }
+        respStepNo = 0;
+        respWaiting = false;
+        ++filesCount;
+        return true;
+    }
+
     currPage = pageRanges.at(0).start;
     win->ctrl->GoToPage(currPage, false);
     currPageRenderTime = TimeGet();
@@ -734,8 +1179,102 @@ bool StressTest::GoToNextPage() {
     return true;
 }
 
-void StressTest::TickTimer() {
-    SetTimer(win->hwndFrame, timerId, USER_TIMER_MINIMUM, nullptr);
+void StressTest::TickTimer(UINT delayMs) {
+    SetTimer(win->hwndFrame, timerId, delayMs, nullptr);
+}
+
+void StressTest::RunResponsivenessStep(RespStep& step) {
+    DisplayModel* dm = win->AsFixed();
+    switch (step.action) {
+        case RespAction::Scroll:
+            dm->ScrollYBy((int)step.value * std::max(dm->GetViewPort().dy / 10, 1), false);
+            break;
+        case RespAction::Zoom:
+            win->ctrl->SetZoomVirtual(step.value, nullptr);
+            break;
+        case RespAction::Jump:
+            win->ctrl->GoToPage((int)step.value, false);
+            break;
+    }
+    // make sure that there's a paint even if nothing has changed (e.g. when scrolling at the end)
+    RepaintAsync(win, 0);
+}
+
+void StressTest::RecordResponsivenessAction() {
+    RespStep& step = respSteps.at(respStepNo - 1);
+    double ms = respCompleteMs;
+    if (ms < 0) {
+        ms = RESP_TIMEOUT_MS;
+        respTimeouts++;
+    }
+    respActionMs[(int)step.action].Append(ms);
+    wprintf(L"  %s %g: %.1f ms%s\n", respActionNames[(int)step.action], step.value, ms,
+            respCompleteMs < 0 ? L" (timed out)" : L"");
+    fflush(stdout);
+    respWaiting = false;
+}
+
+void StressTest::OnResponsivenessTimer() {
+    if (respWaiting) {
+        if (respCompleteMs < 0 && TimeSinceInMs(respActionStart) < RESP_TIMEOUT_MS) {
+            TickTimer();
+            return;
+        }
+        RecordResponsivenessAction();
+    }
+    if (respStepNo >= respSteps.isize()) {
+        if (!GoToNextFile()) {
+            Finished(true);
+            return;
+        }
+        TickTimer();
+        return;
+    }
+
+    bool isFirstStep = 0 == respStepNo || respSteps.at(respStepNo - 1).last;
+    RespStep& step = respSteps.at(respStepNo++);
+    if (isFirstStep) {
+        respActionStart = TimeGet();
+    }
+    RunResponsivenessStep(step);
+    if (!step.last) {
+        TickTimer(RESP_SCROLL_INTERVAL_MS);
+        return;
+    }
+    respCompleteMs = -1;
+    respWaiting = true;
+    TickTimer();
+}
+
+void StressTest::OnPaint(double paintMs, bool complete) {
+    if (!measureResponsiveness) {
+        return;
+    }
+    respPaintMs.Append(paintMs);
+    if (respWaiting && complete && respCompleteMs < 0) {
+        respCompleteMs = TimeSinceInMs(respActionStart);
+    }
+}
+
+void StressTest::GetResponsivenessReport(str::WStr& s) {
+    for (int i = 0; i < (int)RespAction::Count; i++) {
+        AppendRespStats(s, respActionNames[i], respActionMs[i]);
+    }
+    if (respTimeouts > 0) {
+        s.AppendFmt(L"\n%d actions timed out after %d ms", respTimeouts, RESP_TIMEOUT_MS);
+    }
+    AppendRespStats(s, L"paints", respPaintMs);
+    // distribution of the slow paints (at 60 fps a frame takes 16.7 ms)
+    const double limits[] = {16.7, 33.3, 50, 100};
+    for (double limit : limits) {
+        int n = 0;
+        for (double ms : respPaintMs) {
+            if (ms > limit) {
+                n++;
+            }
+        }
+        s.AppendFmt(L"\npaints over %g ms: %d", limit, n);
+    }
 }
 
 void StressTest::OnTimer(int timerIdGot) {
@@ -750,6 +1289,11 @@ void StressTest::OnTimer(int timerIdGot) {
         return;
     }
 
+    if (measureResponsiveness) {
+        OnResponsivenessTimer();
+        return;
+    }
+
     // chm documents aren't rendered and we block until we show them
     // so we can assume previous page has been shown and go to next page
     if (!win->AsFixed()) {
@@ -918,6 +1462,7 @@ void StartStressTest(Flags* i, WindowInfo* win) {
             // dst will be deleted when the stress ends
             win = windows[j];
             StressTest* dst = new StressTest(win, i->exitWhenDone);
+            dst->measureResponsiveness = i->stressResponsiveness;
             win->stressTest = dst;
             // divide filesToTest among each window
             FilesProvider* filesProvider = new FilesProvider(filesToTest, n, j);
@@ -928,6 +1473,7 @@ void StartStressTest(Flags* i, WindowInfo* win) {
     } else {
         // dst will be deleted when the stress ends
         StressTest* dst = new StressTest(win, i->exitWhenDone);
+        dst->measureResponsiveness = i->stressResponsiveness;
         win->stressTest = dst;
         dst->Start(i->stressTestPath, i->stressTestFilter, i->stressTestRanges, i->stressTestCycles);
     }
@@ -937,6 +1483,10 @@ void OnStressTestTimer(WindowInfo* win, int timerId) {
     win->stressTest->OnTimer(timerId);
 }
 
+void OnStressTestPaint(WindowInfo* win, double paintMs, bool complete) {
+    win->stressTest->OnPaint(paintMs, complete);
+}
+
 void FinishStressTest(WindowInfo* win) {
     delete win->stressTest;
 }
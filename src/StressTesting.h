@@ -3,14 +3,16 @@
 
 bool IsValidPageRange(const WCHAR* ranges);
 bool IsBenchPagesInfo(const WCHAR* s);
-void BenchFileOrDir(WStrVec& pathsToBench);
-bool IsStressTesting();
-void BenchEbookLayout(WCHAR* filePath);
-
 struct Flags;
 struct WindowInfo;
 
+void BenchFileOrDir(const Flags& i);
+bool IsStressTesting();
+void BenchEbookLayout(WCHAR* filePath);
+
 void StartStressTest(Flags* i, WindowInfo* win);
 
 void OnStressTestTimer(WindowInfo* win, int timerId);
+// called after every paint of the document while stress testing
+void OnStressTestPaint(WindowInfo* win, double paintMs, bool complete);
 void FinishStressTest(WindowInfo* win);
@@ -643,6 +643,20 @@ void DrawAboutPage(WindowInfo* win, HDC hdc) {
 #define DOCLIST_MAX_THUMBNAILS_X 5
 #define DOCLIST_BOTTOM_BOX_DY DpiScale(win->hwndFrame, 50)
 
+static void OnBackgroundThumbnailCreated(const WCHAR* filePath, RenderedBitmap* bmp) {
+    DisplayState* ds = gFileHistory.Find(filePath, nullptr);
+    if (!bmp || !ds || ds->thumbnail) {
+        delete bmp;
+        return;
+    }
+    SetThumbnail(ds, bmp);
+    for (WindowInfo* win : gWindows) {
+        if (win->IsAboutWindow()) {
+            win->RedrawAll(true);
+        }
+    }
+}
+
 void DrawStartPage(WindowInfo* win, HDC hdc, FileHistory& fileHistory, COLORREF textColor, COLORREF backgroundColor) {
     auto col = GetAppColor(AppColor::MainWindowText);
     AutoDeletePen penBorder(CreatePen(PS_SOLID, DOCLIST_SEPARATOR_DY, col));
@@ -692,7 +706,7 @@ void DrawStartPage(WindowInfo* win, HDC hdc, FileHistory& fileHistory, COLORREF
     rc.dy -= DOCLIST_BOTTOM_BOX_DY;
 
     Vec<DisplayState*> list;
-    fileHistory.GetFrequencyOrder(list);
+    fileHistory.GetFrequencyOrder(list, FILE_HISTORY_MAX_FREQUENT);
 
     int dx = (rc.dx - DOCLIST_MARGIN_LEFT - DOCLIST_MARGIN_RIGHT + DOCLIST_MARGIN_BETWEEN_X) /
              (THUMBNAIL_DX + DOCLIST_MARGIN_BETWEEN_X);
@@ -743,6 +757,9 @@ void DrawStartPage(WindowInfo* win, HDC hdc, FileHistory& fileHistory, COLORREF
             bool loadOk = true;
             if (!state->thumbnail) {
                 loadOk = LoadThumbnail(*state);
+                if (!loadOk && HasPermission(Perm_SavePreferences)) {
+                    CreateThumbnailInBackground(state->filePath, OnBackgroundThumbnailCreated);
+                }
             }
             if (loadOk && state->thumbnail) {
                 Size thumbSize = state->thumbnail->Size();
@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include <psapi.h>
 #include "utils/WinDynCalls.h"
 #include "utils/CryptoUtil.h"
 #include "utils/DirIter.h"
@@ -18,6 +19,9 @@
 #include "utils/WinUtil.h"
 #include "utils/LogDbg.h"
 #include "utils/Log.h"
+#include "utils/Trace.h"
+#include "utils/SlowOps.h"
+#include "utils/AllocSampler.h"
 #include "utils/GdiPlusUtil.h"
 
 #include "wingui/WinGui.h"
@@ -51,8 +55,12 @@
 #include "FileHistory.h"
 #include "PdfSync.h"
 #include "RenderCache.h"
+#include "DiskTileCache.h"
+#include "DiskTextIndex.h"
+#include "ContentBoxCache.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
+#include "TextExport.h"
 #include "TextSearch.h"
 #include "AppColors.h"
 #include "SumatraPDF.h"
@@ -75,12 +83,14 @@
 #include "Menu.h"
 #include "Print.h"
 #include "SearchAndDDE.h"
+#include "SearchResults.h"
 #include "Selection.h"
 #include "StressTesting.h"
 #include "SumatraAbout.h"
 #include "SumatraDialogs.h"
 #include "SumatraProperties.h"
 #include "TableOfContents.h"
+#include "PageThumbnails.h"
 #include "Tabs.h"
 #include "Toolbar.h"
 #include "Translations.h"
@@ -88,6 +98,7 @@
 #include "Version.h"
 #include "SumatraConfig.h"
 #include "EditAnnotations.h"
+#include "MemoryPressure.h"
 
 // the default is for pre-release version.
 // for release we override BuildConfig.h and set to
@@ -127,6 +138,7 @@ bool gDebugShowLinks = false;
 // used to show it in debug, but is not very useful,
 // so always disable
 bool gShowFrameRate = false;
+bool gShowPerfHud = false;
 
 // in plugin mode, the window's frame isn't drawn and closing and
 // fullscreen are disabled, so that SumatraPDF can be displayed
@@ -661,7 +673,7 @@ static bool ShouldSaveThumbnail(DisplayState& ds) {
 
     // don't create thumbnails for files that won't need them anytime soon
     Vec<DisplayState*> list;
-    gFileHistory.GetFrequencyOrder(list);
+    gFileHistory.GetFrequencyOrder(list, FILE_HISTORY_MAX_FREQUENT * 2);
     int idx = list.Find(&ds);
     if (idx < 0 || FILE_HISTORY_MAX_FREQUENT * 2 <= idx) {
         return false;
@@ -702,9 +714,17 @@ struct ControllerCallbackHandler : ControllerCallback {
     void Repaint() override {
         RepaintAsync(win, 0);
     }
+    void RepaintScrolled(int dx, int dy) override {
+        RepaintScrolled(win, dx, dy);
+    }
+    void RepaintPage(DisplayModel* dm, int pageNo) override {
+        RepaintPageAsync(win, dm, pageNo);
+    }
     void PageNoChanged(Controller* ctrl, int pageNo) override;
     void UpdateScrollbars(Size canvas) override;
     void RequestRendering(int pageNo) override;
+    void RequestPrefetch(int pageNo) override;
+    void CancelPrefetch(DisplayModel* dm) override;
     void CleanUp(DisplayModel* dm) override;
     void RenderThumbnail(DisplayModel* dm, Size size, const onBitmapRenderedCb&) override;
     void GotoLink(PageDestination* dest) override {
@@ -788,9 +808,21 @@ void ControllerCallbackHandler::RequestRendering(int pageNo) {
     }
 }
 
+void ControllerCallbackHandler::RequestPrefetch(int pageNo) {
+    DisplayModel* dm = win->AsFixed();
+    if (dm && dm->ShouldCacheRendering(pageNo)) {
+        gRenderCache.RequestPrefetch(dm, pageNo);
+    }
+}
+
+void ControllerCallbackHandler::CancelPrefetch(DisplayModel* dm) {
+    gRenderCache.CancelPrefetch(dm);
+}
+
 void ControllerCallbackHandler::CleanUp(DisplayModel* dm) {
     gRenderCache.CancelRendering(dm);
     gRenderCache.FreeForDisplayModel(dm);
+    FreeThumbnailsForDisplayModel(dm);
 }
 
 void ControllerCallbackHandler::FocusFrame(bool always) {
@@ -893,6 +925,7 @@ void ControllerCallbackHandler::PageNoChanged(Controller* ctrl, int pageNo) {
     }
 
     UpdateTocSelection(win, pageNo);
+    UpdateThumbnailsSelection(win, pageNo);
     win->currPageNo = pageNo;
 
     NotificationWnd* wnd = win->notifications->GetForGroup(NG_PAGE_INFO_HELPER);
@@ -931,8 +964,11 @@ static NO_INLINE void VerifyController(Controller* ctrl, const WCHAR* path) {
     str::Free(s2);
 }
 
-static Controller* CreateForChm(const WCHAR* path, PasswordUI* pwdUI, WindowInfo* win) {
-    Kind kind = GuessFileType(path, true);
+// kind is nullptr if the file hasn't been sniffed yet
+static Controller* CreateForChm(const WCHAR* path, PasswordUI* pwdUI, WindowInfo* win, Kind kind) {
+    if (!kind) {
+        kind = GuessFileType(path, true);
+    }
 
     bool isChm = ChmModel::IsSupportedFileType(kind);
     if (!isChm) {
@@ -969,7 +1005,9 @@ static Controller* CreateForChm(const WCHAR* path, PasswordUI* pwdUI, WindowInfo
     return ctrl;
 }
 
-static Controller* CreateControllerForFile(const WCHAR* path, PasswordUI* pwdUI, WindowInfo* win) {
+static Controller* CreateControllerForFile(const WCHAR* path, PasswordUI* pwdUI, WindowInfo* win,
+                                          bool skipEngine = false) {
+    TRACE_ZONE("CreateControllerForFile");
     logf(L"CreateControllerForFile: '%s'\n", path);
     if (!win->cbHandler) {
         win->cbHandler = new ControllerCallbackHandler(win);
@@ -980,8 +1018,12 @@ static Controller* CreateControllerForFile(const WCHAR* path, PasswordUI* pwdUI,
     bool chmInFixedUI = gGlobalPrefs->chmUI.useFixedPageUI;
     bool ebookInFixedUI = gGlobalPrefs->ebookUI.useFixedPageUI;
 
-    // TODO: sniff file content only once
-    EngineBase* engine = CreateEngine(path, pwdUI, chmInFixedUI, ebookInFixedUI);
+    // the file type as determined by CreateEngine (which only sniffs the content when needed)
+    Kind kind = nullptr;
+    EngineBase* engine = nullptr;
+    if (!skipEngine) {
+        engine = CreateEngine(path, pwdUI, chmInFixedUI, ebookInFixedUI, &kind);
+    }
 
     if (engine) {
         ctrl = new DisplayModel(engine, win->cbHandler);
@@ -991,7 +1033,7 @@ static Controller* CreateControllerForFile(const WCHAR* path, PasswordUI* pwdUI,
     }
 
     if (!chmInFixedUI) {
-        ctrl = CreateForChm(path, pwdUI, win);
+        ctrl = CreateForChm(path, pwdUI, win, kind);
         if (ctrl) {
             return ctrl;
         }
@@ -1081,6 +1123,28 @@ static bool showTocByDefault(const WCHAR* path) {
     return showByDefault;
 }
 
+// pages of a reloaded document that look the same as before (as far as can be told
+// from the pages which have been loaded before the file changed), so that their
+// rendered bitmaps and extracted text can be kept
+static void FindUnchangedPages(DisplayModel* prevDm, DisplayModel* dm, Vec<int>& unchangedPages) {
+    EngineBase* prevEngine = prevDm->GetEngine();
+    EngineBase* engine = dm->GetEngine();
+    // the previous engine might show modifications that were never saved
+    if (EnginePdfHasUnsavedAnnotations(prevEngine)) {
+        return;
+    }
+    int nPages = std::min(prevEngine->PageCount(), engine->PageCount());
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        u8 prevDigest[16], digest[16];
+        if (!EnginePdfGetPageDigest(prevEngine, pageNo, prevDigest, false)) {
+            continue;
+        }
+        if (EnginePdfGetPageDigest(engine, pageNo, digest, true) && memeq(prevDigest, digest, sizeof(digest))) {
+            unchangedPages.Append(pageNo);
+        }
+    }
+}
+
 // meaning of the internal values of LoadArgs:
 // isNewWindow : if true then 'win' refers to a newly created window that needs
 //   to be resized and placed
@@ -1136,6 +1200,7 @@ static void LoadDocIntoCurrentTab(const LoadArgs& args, Controller* ctrl, Displa
     }
 
     AbortFinding(args.win, false);
+    AbortCopying(args.win);
 
     Controller* prevCtrl = win->ctrl;
     tab->ctrl = ctrl;
@@ -1162,7 +1227,11 @@ static void LoadDocIntoCurrentTab(const LoadArgs& args, Controller* ctrl, Displa
                 dm->SetDisplayR2L(state ? state->displayR2L : gGlobalPrefs->comicBookUI.cbxMangaMode);
             }
             if (prevCtrl && prevCtrl->AsFixed() && str::Eq(win->ctrl->FilePath(), prevCtrl->FilePath())) {
-                gRenderCache.KeepForDisplayModel(prevCtrl->AsFixed(), dm);
+                DisplayModel* prevDm = prevCtrl->AsFixed();
+                Vec<int> unchangedPages;
+                FindUnchangedPages(prevDm, dm, unchangedPages);
+                dm->textCache->KeepPagesFrom(prevDm->textCache, unchangedPages);
+                gRenderCache.KeepForDisplayModel(prevDm, dm, unchangedPages);
                 dm->CopyNavHistory(*prevCtrl->AsFixed());
             }
             // tell UI Automation about content change
@@ -1184,6 +1253,11 @@ static void LoadDocIntoCurrentTab(const LoadArgs& args, Controller* ctrl, Displa
     } else {
         state = nullptr;
     }
+    // the search results window uses the previous document
+    CloseSearchResults(tab);
+    if (prevCtrl) {
+        StopSearchingDocument(prevCtrl->AsFixed());
+    }
     delete prevCtrl;
 
     if (state) {
@@ -1231,6 +1305,9 @@ static void LoadDocIntoCurrentTab(const LoadArgs& args, Controller* ctrl, Displa
         // expose SyncTeX in the UI
         if (PDFSYNCERR_SUCCESS == res) {
             gGlobalPrefs->enableTeXEnhancements = true;
+            // after a LaTeX compilation the document is reloaded and
+            // forward searches shouldn't have to wait for the new index
+            win->AsFixed()->pdfSync->PreloadIndex();
         }
     }
 
@@ -1404,7 +1481,7 @@ static void UpdateToolbarSidebarText(WindowInfo* win) {
     UpdateToolbarFindText(win);
     UpdateToolbarButtonsToolTipsForWindow(win);
 
-    win->tocLabelWithClose->SetLabel(_TR("Bookmarks"));
+    win->tocLabelWithClose->SetLabel(IsShowingThumbnails(win) ? _TR("Thumbnails") : _TR("Bookmarks"));
     win->favLabelWithClose->SetLabel(_TR("Favorites"));
 }
 
@@ -1451,6 +1528,9 @@ static WindowInfo* CreateWindowInfo() {
         win->frameRateWnd = new FrameRateWnd();
         win->frameRateWnd->Create(win->hwndCanvas);
     }
+    if (gShowPerfHud) {
+        ShowPerfHud(win, true);
+    }
 
     // hide scrollbars to avoid showing/hiding on empty window
     ShowScrollBar(win->hwndCanvas, SB_BOTH, FALSE);
@@ -1533,6 +1613,7 @@ void DeleteWindowInfo(WindowInfo* win) {
     DragAcceptFiles(win->hwndCanvas, FALSE);
 
     CrashIf(win->findThread && WaitForSingleObject(win->findThread, 0) == WAIT_TIMEOUT);
+    CrashIf(win->copyThread && WaitForSingleObject(win->copyThread, 0) == WAIT_TIMEOUT);
     CrashIf(win->printThread && WaitForSingleObject(win->printThread, 0) == WAIT_TIMEOUT);
 
     if (win->uiaProvider) {
@@ -1559,7 +1640,7 @@ static void RenameFileInHistory(const WCHAR* oldPath, const WCHAR* newPath) {
     }
     ds = gFileHistory.Find(oldPath, nullptr);
     if (ds) {
-        str::ReplacePtr(&ds->filePath, newPath);
+        gFileHistory.SetFilePath(ds, newPath);
         // merge Frequently Read data, so that a file
         // doesn't accidentally vanish from there
         ds->isPinned = ds->isPinned || oldIsPinned;
@@ -1624,6 +1705,8 @@ void scheduleReloadTab(TabInfo* tab) {
 // the loaded document in the window (either by replacing document in existing
 // window or creating a new window for the document)
 WindowInfo* LoadDocument(LoadArgs& args) {
+    TRACE_ZONE("LoadDocument");
+    SLOW_OP("Load", args.fileName, 0);
     CrashAlwaysIf(gCrashOnOpen);
 
     int threadID = (int)GetCurrentThreadId();
@@ -1700,7 +1783,7 @@ WindowInfo* LoadDocument(LoadArgs& args) {
     if (args.engine != nullptr) {
         ctrl = CreateControllerForEngine(args.engine, fullPath, &pwdUI, win);
     } else {
-        ctrl = CreateControllerForFile(fullPath, &pwdUI, win);
+        ctrl = CreateControllerForFile(fullPath, &pwdUI, win, args.skipEngine);
     }
 
     if (!ctrl) {
@@ -1793,20 +1876,233 @@ WindowInfo* LoadDocument(LoadArgs& args) {
 
     // Add the file also to Windows' recently used documents (this doesn't
     // happen automatically on drag&drop, reopening from history, etc.)
+    // (the shell can take a while to update the jump list, so don't wait for it)
     if (HasPermission(Perm_DiskAccess) && !gPluginMode && !IsStressTesting()) {
-        SHAddToRecentDocs(SHARD_PATH, fullPath);
+        WCHAR* recentPath = str::Dup(fullPath);
+        RunAsync([recentPath] {
+            ScopedCom comScope;
+            SHAddToRecentDocs(SHARD_PATH, recentPath);
+            str::Free(recentPath);
+        });
     }
 
     return win;
 }
 
+// a document whose engine is being created on a background thread
+struct AsyncLoadData {
+    // the placeholder tab, nullptr once it has been closed
+    TabInfo* tab = nullptr;
+    AutoFreeWstr filePath;
+    bool chmInFixedUI = false;
+    bool ebookInFixedUI = false;
+    bool noSavePrefs = false;
+    // only used on the UI thread
+    HwndPasswordUI pwdUI;
+    bool isCanceled = false;
+
+    // set on the UI thread once the worker has finished
+    bool isDone = false;
+    EngineBase* engine = nullptr;
+
+    explicit AsyncLoadData(HWND hwnd) : pwdUI(hwnd) {
+    }
+    AsyncLoadData(AsyncLoadData const&) = delete;
+    AsyncLoadData& operator=(AsyncLoadData const&) = delete;
+
+    ~AsyncLoadData() {
+        delete engine;
+    }
+};
+
+// asks for passwords on the UI thread while the loading thread waits
+class AsyncPasswordUI : public PasswordUI {
+    AsyncLoadData* data;
+
+  public:
+    explicit AsyncPasswordUI(AsyncLoadData* data) : data(data) {
+    }
+
+    WCHAR* GetPassword(const WCHAR* fileName, u8* fileDigest, u8 decryptionKeyOut[32], bool* saveKey) override {
+        *saveKey = false;
+        if (data->isCanceled) {
+            return nullptr;
+        }
+        HANDLE done = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        if (!done) {
+            return nullptr;
+        }
+        WCHAR* pwd = nullptr;
+        uitask::Post([&] {
+            if (!data->isCanceled) {
+                pwd = data->pwdUI.GetPassword(fileName, fileDigest, decryptionKeyOut, saveKey);
+            }
+            SetEvent(done);
+        });
+        WaitForSingleObject(done, INFINITE);
+        CloseHandle(done);
+        return pwd;
+    }
+};
+
+// places the document into its tab once both the engine has been
+// created and the tab is selected
+static void FinishLoadDocumentAsync(AsyncLoadData* data) {
+    TabInfo* tab = data->tab;
+    if (!tab) {
+        delete data;
+        return;
+    }
+    WindowInfo* win = tab->win;
+    if (tab != win->currentTab) {
+        // see LoadModelIntoTab
+        return;
+    }
+
+    tab->asyncLoad = nullptr;
+    LoadArgs args(tab->filePath, win);
+    args.forceReuse = true;
+    args.noSavePrefs = data->noSavePrefs;
+    // the controller takes over the engine
+    args.engine = data->engine;
+    data->engine = nullptr;
+    args.skipEngine = !args.engine;
+    delete data;
+    LoadDocument(args);
+}
+
+// Like LoadDocument, but creates the engine on a background thread so that
+// documents on slow network shares or big comic book archives don't freeze
+// the window. The document gets a placeholder tab right away and several
+// documents opened at once are loaded in parallel. Closing the placeholder
+// tab cancels loading (an engine that is still being created is discarded).
+// Falls back to LoadDocument if tabs are disabled and for documents which
+// aren't handled by an engine (or don't exist).
+void LoadDocumentAsync(LoadArgs& args) {
+    WindowInfo* win = args.win;
+    if (!win && gGlobalPrefs->useTabs && !gWindows.empty()) {
+        win = gWindows.Last();
+    }
+    AutoFreeWstr fullPath(path::Normalize(args.fileName));
+    bool ebookInFixedUI = gGlobalPrefs->ebookUI.useFixedPageUI;
+    bool canLoadAsync = gGlobalPrefs->useTabs && win && !args.forceReuse && !args.engine && !gPluginMode;
+    if (canLoadAsync) {
+        Kind kind = GuessFileTypeFromName(fullPath);
+        canLoadAsync = file::Exists(fullPath) && IsSupportedFileType(kind, ebookInFixedUI);
+    }
+    if (!canLoadAsync) {
+        LoadDocument(args);
+        return;
+    }
+
+    if (win->IsAboutWindow()) {
+        // invalidate the links on the Frequently Read page
+        win->staticLinks.Reset();
+    } else {
+        SaveCurrentTabInfo(win);
+        CloseDocumentInTab(win, true);
+    }
+    TabInfo* tab = CreateNewTab(win, fullPath);
+    win->currentTab = tab;
+    SetFrameTitleForTab(tab, false);
+    UpdateUiForCurrentTab(win);
+    SetSidebarVisibility(win, false, gGlobalPrefs->showFavorites);
+    win->RedrawAll(true);
+
+    AsyncLoadData* data = new AsyncLoadData(win->hwndFrame);
+    data->tab = tab;
+    data->filePath.SetCopy(fullPath);
+    data->chmInFixedUI = gGlobalPrefs->chmUI.useFixedPageUI;
+    data->ebookInFixedUI = ebookInFixedUI;
+    data->noSavePrefs = args.noSavePrefs;
+    tab->asyncLoad = data;
+
+    RunAsync(
+        [data] {
+            EngineBase* engine = nullptr;
+            if (!data->isCanceled) {
+                AsyncPasswordUI pwdUI(data);
+                engine = CreateEngine(data->filePath, &pwdUI, data->chmInFixedUI, data->ebookInFixedUI);
+            }
+            uitask::Post([data, engine] {
+                data->engine = engine;
+                data->isDone = true;
+                FinishLoadDocumentAsync(data);
+            });
+        },
+        TaskPriority::High);
+}
+
+// called when a tab is closed while its document is still being loaded
+void AbortLoadDocumentAsync(TabInfo* tab) {
+    AsyncLoadData* data = tab->asyncLoad;
+    if (!data) {
+        return;
+    }
+    tab->asyncLoad = nullptr;
+    data->tab = nullptr;
+    data->isCanceled = true;
+    if (data->isDone) {
+        delete data;
+    }
+}
+
 // Loads document data into the WindowInfo.
+// restores the view state of a tab from a restored session
+// after its document has been loaded into the current tab
+void ApplyTabState(WindowInfo* win, TabState* state) {
+    TabInfo* tab = win->currentTab;
+    if (!tab || !tab->ctrl) {
+        return;
+    }
+
+    tab->tocState = *state->tocState;
+    SetSidebarVisibility(win, state->showToc, gGlobalPrefs->showFavorites);
+
+    DisplayMode displayMode = prefs::conv::ToDisplayMode(state->displayMode, DM_AUTOMATIC);
+    if (displayMode != DM_AUTOMATIC) {
+        SwitchToDisplayMode(win, displayMode);
+    }
+    // TODO: make EbookController::GoToPage not crash
+    if (!tab->AsEbook()) {
+        tab->ctrl->GoToPage(state->pageNo, true);
+    }
+    float zoom = prefs::conv::ToZoom(state->zoom, INVALID_ZOOM);
+    if (zoom != INVALID_ZOOM) {
+        if (tab->AsFixed()) {
+            tab->AsFixed()->Relayout(zoom, state->rotation);
+        } else {
+            tab->ctrl->SetZoomVirtual(zoom, nullptr);
+        }
+    }
+    if (tab->AsFixed()) {
+        tab->AsFixed()->SetScrollState(ScrollState(state->pageNo, state->scrollPos.x, state->scrollPos.y));
+    }
+}
+
+static void LoadDeferredTab(TabInfo* tab) {
+    WindowInfo* win = tab->win;
+    CrashIf(tab != win->currentTab || tab->ctrl);
+    TabState* state = tab->deferredState;
+    tab->deferredState = nullptr;
+
+    LoadArgs args(tab->filePath, win);
+    args.forceReuse = true;
+    args.noSavePrefs = true;
+    LoadDocument(args);
+    ApplyTabState(win, state);
+    DeleteTabState(state);
+}
+
 void LoadModelIntoTab(TabInfo* tab) {
     if (!tab) {
         return;
     }
     WindowInfo* win = tab->win;
     CloseDocumentInTab(win, true);
+    if (tab->deferredState) {
+        SetFrameTitleForTab(tab, false);
+    }
 
     win->currentTab = tab;
     win->ctrl = tab->ctrl;
@@ -1830,11 +2126,14 @@ void LoadModelIntoTab(TabInfo* tab) {
     }
 
     if (win->AsFixed()) {
+        DisplayModel* dm = win->AsFixed();
         if (tab->canvasRc != win->canvasRc) {
             win->ctrl->SetViewPortSize(win->GetViewPortSize());
+            dm->SetScrollState(dm->GetScrollState());
+        } else {
+            // no relayout needed, visible pages are usually still in gRenderCache
+            dm->ShowAgain();
         }
-        DisplayModel* dm = win->AsFixed();
-        dm->SetScrollState(dm->GetScrollState());
         if (dm->GetPresentationMode() != (win->presentation != PM_DISABLED)) {
             dm->SetPresentationMode(!dm->GetPresentationMode());
         }
@@ -1856,7 +2155,11 @@ void LoadModelIntoTab(TabInfo* tab) {
     SetFocus(win->hwndFrame);
     win->RedrawAll(true);
 
-    if (tab->reloadOnFocus) {
+    if (tab->deferredState) {
+        LoadDeferredTab(tab);
+    } else if (tab->asyncLoad && tab->asyncLoad->isDone) {
+        FinishLoadDocumentAsync(tab->asyncLoad);
+    } else if (tab->reloadOnFocus) {
         tab->reloadOnFocus = false;
         ReloadDocument(win, true);
     }
@@ -2230,6 +2533,7 @@ static void CloseDocumentInTab(WindowInfo* win, bool keepUIEnabled, bool deleteM
     }
     ClearTocBox(win);
     AbortFinding(win, true);
+    AbortCopying(win);
 
     delete win->linkOnLastButtonDown;
     win->linkOnLastButtonDown = nullptr;
@@ -2241,8 +2545,11 @@ static void CloseDocumentInTab(WindowInfo* win, bool keepUIEnabled, bool deleteM
         win->uiaProvider->OnDocumentUnload();
     }
     win->ctrl = nullptr;
+    // the canvas still shows the previous document, so it mustn't be scrolled
+    win->canvasPaintComplete = false;
     auto currentTab = win->currentTab;
     if (deleteModel) {
+        CloseSearchResults(currentTab);
         delete currentTab->ctrl;
         currentTab->ctrl = nullptr;
         FileWatcherUnsubscribe(win->currentTab->watcher);
@@ -2358,6 +2665,7 @@ void CloseTab(WindowInfo* win, bool quitIfLast) {
     } else {
         CrashIf(gPluginMode && !gWindows.Contains(win));
         AbortFinding(win, true);
+        AbortCopying(win);
         TabsOnCloseDoc(win);
     }
     if (!didSavePrefs) {
@@ -2408,6 +2716,7 @@ void CloseWindow(WindowInfo* win, bool quitIfLast, bool forceClose) {
     }
 
     AbortFinding(win, true);
+    AbortCopying(win);
     AbortPrinting(win);
 
     if (win->AsFixed()) {
@@ -2508,6 +2817,158 @@ static bool AppendFileFilterForDoc(Controller* ctrl, str::WStr& fileFilter) {
     return true;
 }
 
+enum class SaveAsKind {
+    None,
+    CopyFile,
+    Text,
+    Pdf,
+    Engine,
+};
+
+// saves a document on a background thread so that big files or
+// slow network shares don't freeze the window
+class SaveAsThreadData : public ProgressUpdateUI {
+  public:
+    NotificationWnd* wnd = nullptr;
+    bool isCanceled = false;
+    WindowInfo* win = nullptr;
+
+    SaveAsKind kind = SaveAsKind::CopyFile;
+    EngineBase* engine = nullptr;
+    bool ownsEngine = true;
+    AutoFreeWstr srcPath;
+    AutoFreeWstr dstPath;
+    bool setZoneIdentifier = false;
+
+    bool ok = false;
+    AutoFreeWstr errorMsg;
+    int lastProgress = -1;
+
+    SaveAsThreadData(WindowInfo* win, SaveAsKind kind, const WCHAR* srcPath, const WCHAR* dstPath) {
+        this->win = win;
+        this->kind = kind;
+        this->srcPath.SetCopy(srcPath);
+        this->dstPath.SetCopy(dstPath);
+        const WCHAR* progressMsg = _TR("Saving %d of %d MB...");
+        if (kind == SaveAsKind::Text) {
+            progressMsg = _TR("Saving page %d of %d...");
+        }
+        wnd = new NotificationWnd(win->hwndCanvas, 0);
+        wnd->wndRemovedCb = [this](NotificationWnd* wnd) { this->RemoveNotification(wnd); };
+        wnd->Create(_TR("Saving..."), progressMsg);
+        win->notifications->Add(wnd, 0);
+    }
+    SaveAsThreadData(SaveAsThreadData const&) = delete;
+    SaveAsThreadData& operator=(SaveAsThreadData const&) = delete;
+
+    ~SaveAsThreadData() override {
+        if (ownsEngine) {
+            delete engine;
+        }
+        RemoveNotification(wnd);
+    }
+
+    // called when saving has been canceled
+    void RemoveNotification(NotificationWnd* wnd) {
+        isCanceled = true;
+        this->wnd = nullptr;
+        if (WindowInfoStillValid(win)) {
+            win->notifications->RemoveNotification(wnd);
+        }
+    }
+
+    void UpdateProgress(int current, int total) override {
+        // the copy callback fires for every chunk, so only post actual changes
+        if (current == lastProgress) {
+            return;
+        }
+        lastProgress = current;
+        uitask::Post([=] {
+            if (WindowInfoStillValid(win) && win->notifications->Contains(wnd)) {
+                wnd->UpdateProgress(current, total);
+            }
+        });
+    }
+
+    bool WasCanceled() override {
+        return isCanceled;
+    }
+
+    void Save() {
+        AutoFree pathUtf8(strconv::WstrToUtf8(dstPath));
+        switch (kind) {
+            case SaveAsKind::Text:
+                ok = SaveAsText();
+                break;
+            case SaveAsKind::Pdf:
+                ok = engine->SaveFileAsPDF(pathUtf8.Get(), true);
+                if (!ok && gIsDebugBuild) {
+                    // rendering includes all page annotations
+                    ok = PdfCreator::RenderToFile(pathUtf8.Get(), engine);
+                }
+                break;
+            case SaveAsKind::Engine:
+                ok = engine->SaveFileAs(pathUtf8.Get(), true);
+                break;
+            case SaveAsKind::CopyFile:
+                ok = CopyDocument();
+                break;
+            default:
+                ok = true;
+                break;
+        }
+    }
+
+    // Extract all text when saving as a plain text file
+    bool SaveAsText() {
+        TextExportOptions opts;
+        return ExportText(engine, dstPath, opts, this);
+    }
+
+    bool CopyDocument() {
+        auto progressCb = [this](i64 copied, i64 total) {
+            const i64 mb = 1024 * 1024;
+            int totalMB = std::max((int)((total + mb - 1) / mb), 1);
+            UpdateProgress((int)((copied + mb - 1) / mb), totalMB);
+            return !WasCanceled();
+        };
+        bool ok = file::Copy(srcPath, dstPath, progressCb);
+        if (ok) {
+            // Make sure that the copy isn't write-locked or hidden
+            const DWORD attributesToDrop = FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM;
+            DWORD attributes = GetFileAttributes(dstPath);
+            if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & attributesToDrop)) {
+                SetFileAttributes(dstPath, attributes & ~attributesToDrop);
+            }
+            return true;
+        }
+        WCHAR* msgBuf;
+        DWORD err = GetLastError();
+        if (err != ERROR_REQUEST_ABORTED &&
+            FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                          nullptr, err, 0, (LPWSTR)&msgBuf, 0, nullptr)) {
+            errorMsg.Set(str::Format(L"%s\n\n%s", _TR("Failed to save a file"), msgBuf));
+            LocalFree(msgBuf);
+        }
+        return false;
+    }
+
+    // called on the ui thread once saving has finished
+    void Finish() {
+        if (!ok && !isCanceled && WindowInfoStillValid(win)) {
+            const WCHAR* msg = _TR("Failed to save a file");
+            if (errorMsg) {
+                msg = errorMsg.Get();
+            }
+            MessageBoxWarning(win->hwndFrame, msg);
+        }
+        if (ok && setZoneIdentifier) {
+            file::SetZoneIdentifier(dstPath);
+        }
+        delete this;
+    }
+};
+
 static void OnMenuSaveAs(WindowInfo* win) {
     if (!HasPermission(Perm_DiskAccess)) {
         return;
@@ -2629,68 +3090,43 @@ static void OnMenuSaveAs(WindowInfo* win) {
         realDstFileName = str::Format(L"%s%s", dstFileName, defExt);
     }
 
-    // TODO: just remove it
-    bool saveAnnotsInDoc = true;
-    AutoFree pathUtf8(strconv::WstrToUtf8(realDstFileName));
-    AutoFreeWstr errorMsg;
-    // Extract all text when saving as a plain text file
+    SaveAsKind kind = SaveAsKind::CopyFile;
     if (convertToTXT) {
-        str::WStr text(1024);
-        for (int pageNo = 1; pageNo <= ctrl->PageCount(); pageNo++) {
-            PageText pageText = engine->ExtractPageText(pageNo);
-            if (pageText.text != nullptr) {
-                WCHAR* tmp = str::Replace(pageText.text, L"\n", L"\r\n");
-                text.AppendAndFree(tmp);
-            }
-            FreePageText(&pageText);
-        }
-
-        AutoFree textUTF8 = strconv::WstrToUtf8(text.LendData());
-        AutoFree textUTF8BOM = str::Join(UTF8_BOM, textUTF8.Get());
-        ok = file::WriteFile(realDstFileName, textUTF8BOM.AsSpan());
+        kind = SaveAsKind::Text;
     } else if (convertToPDF) {
-        // Convert the file into a PDF one
+        kind = SaveAsKind::Pdf;
         AutoFreeWstr producerName = str::Join(GetAppName(), L" ", CURR_VERSION_STR);
         PdfCreator::SetProducerName(producerName);
-        ok = engine->SaveFileAsPDF(pathUtf8.Get(), saveAnnotsInDoc);
-        if (!ok && gIsDebugBuild) {
-            // rendering includes all page annotations
-            ok = PdfCreator::RenderToFile(pathUtf8.Get(), engine);
-        }
     } else if (!file::Exists(srcFileName) && engine) {
         // Recreate inexistant files from memory...
-        ok = engine->SaveFileAs(pathUtf8.Get(), saveAnnotsInDoc);
-    } else if (saveAnnotsInDoc && EngineSupportsAnnotations(engine)) {
+        kind = SaveAsKind::Engine;
+    } else if (EngineSupportsAnnotations(engine)) {
         // ... as well as files containing annotations ...
-        ok = engine->SaveFileAs(pathUtf8.Get(), true);
-    } else if (!path::IsSame(srcFileName, realDstFileName)) {
-        // ... else just copy the file
-        WCHAR* msgBuf;
-        ok = CopyFile(srcFileName, realDstFileName, FALSE);
-        if (ok) {
-            // Make sure that the copy isn't write-locked or hidden
-            const DWORD attributesToDrop = FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM;
-            DWORD attributes = GetFileAttributes(realDstFileName);
-            if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & attributesToDrop)) {
-                SetFileAttributes(realDstFileName, attributes & ~attributesToDrop);
-            }
-        } else if (FormatMessage(
-                       FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-                       nullptr, GetLastError(), 0, (LPWSTR)&msgBuf, 0, nullptr)) {
-            errorMsg.Set(str::Format(L"%s\n\n%s", _TR("Failed to save a file"), msgBuf));
-            LocalFree(msgBuf);
+        kind = SaveAsKind::Engine;
+    } else if (path::IsSame(srcFileName, realDstFileName)) {
+        // ... else just copy the file (unless it's the same one)
+        kind = SaveAsKind::None;
+    }
+
+    if (kind != SaveAsKind::None) {
+        auto* data = new SaveAsThreadData(win, kind, srcFileName, realDstFileName);
+        data->setZoneIdentifier = IsUntrustedFile(ctrl->FilePath(), gPluginURL) && !convertToTXT;
+        if (kind != SaveAsKind::CopyFile) {
+            // work on a copy of the engine so that the document can be closed while saving
+            data->engine = engine->Clone();
         }
-    }
-    if (!ok) {
-        const WCHAR* msg = _TR("Failed to save a file");
-        if (errorMsg) {
-            msg = errorMsg.Get();
+        if (kind == SaveAsKind::CopyFile || data->engine) {
+            RunAsync([data] {
+                data->Save();
+                uitask::Post([data] { data->Finish(); });
+            });
+        } else {
+            // not all documents can be cloned (e.g. those loaded from a stream)
+            data->engine = engine;
+            data->ownsEngine = false;
+            data->Save();
+            data->Finish();
         }
-        MessageBoxWarning(win->hwndFrame, msg);
-    }
-
-    if (ok && IsUntrustedFile(win->ctrl->FilePath(), gPluginURL) && !convertToTXT) {
-        file::SetZoneIdentifier(realDstFileName);
     }
 
     if (realDstFileName != dstFileName) {
@@ -2973,6 +3409,18 @@ static void OnMenuOpenFolder(WindowInfo* win) {
     LoadDocument(args);
 }
 
+static void OnMenuFindInFolder(WindowInfo* win) {
+    if (!HasPermission(Perm_DiskAccess)) {
+        return;
+    }
+    WCHAR dirW[MAX_PATH + 2] = {0};
+    bool ok = BrowseForFolder(win->hwndFrame, nullptr, _TR("Select the folder to search in:"), dirW, dimof(dirW));
+    if (!ok) {
+        return;
+    }
+    ShowSearchResultsInDocuments(win, dirW);
+}
+
 static void OnMenuOpen(WindowInfo* win) {
     if (!HasPermission(Perm_DiskAccess)) {
         return;
@@ -3060,7 +3508,7 @@ static void OnMenuOpen(WindowInfo* win) {
     if (*(fileName - 1)) {
         // special case: single filename without nullptr separator
         LoadArgs args(ofn.lpstrFile, win);
-        LoadDocument(args);
+        LoadDocumentAsync(args);
         return;
     }
 
@@ -3068,7 +3516,7 @@ static void OnMenuOpen(WindowInfo* win) {
         AutoFreeWstr filePath = path::Join(ofn.lpstrFile, fileName);
         if (filePath) {
             LoadArgs args(filePath, win);
-            LoadDocument(args);
+            LoadDocumentAsync(args);
         }
         fileName += str::Len(fileName) + 1;
     }
@@ -3340,6 +3788,9 @@ static void OnMenuOptions(HWND hwnd) {
     if (!gGlobalPrefs->rememberOpenedFiles) {
         gFileHistory.Clear(true);
         CleanUpThumbnailCache(gFileHistory);
+        RemoveDiskTiles(nullptr);
+        RemoveDiskTextIndex(nullptr);
+        RemoveDiskContentBoxes(nullptr);
     }
     UpdateDocumentColors();
 
@@ -4150,7 +4601,9 @@ void SetSidebarVisibility(WindowInfo* win, bool tocVisible, bool showFavorites)
         showFavorites = false;
     }
 
-    if (!win->IsDocLoaded() || !win->ctrl->HacToc()) {
+    // thumbnails are only available for fixed page documents
+    bool showThumbnails = win->thumbnailsVisible && win->AsFixed();
+    if (!win->IsDocLoaded() || (!win->ctrl->HacToc() && !showThumbnails)) {
         tocVisible = false;
     }
 
@@ -4159,7 +4612,7 @@ void SetSidebarVisibility(WindowInfo* win, bool tocVisible, bool showFavorites)
         showFavorites = false;
     }
 
-    if (tocVisible) {
+    if (tocVisible && !showThumbnails) {
         LoadTocTree(win);
         CrashIf(!win->tocLoaded);
     }
@@ -4185,6 +4638,7 @@ void SetSidebarVisibility(WindowInfo* win, bool tocVisible, bool showFavorites)
     }
 
     win::SetVisibility(win->sidebarSplitter->hwnd, tocVisible || showFavorites);
+    ShowThumbnails(win, tocVisible && showThumbnails);
     win::SetVisibility(win->hwndTocBox, tocVisible);
     win->sidebarSplitter->isLive = !win->AsEbook();
 
@@ -4248,6 +4702,65 @@ static int TestBigNew()
 }
 #endif
 
+static double BytesToMB(size_t n) {
+    return (double)n / (1024.0 * 1024.0);
+}
+
+// what the memory of the process is used for, by subsystem and by document
+// (the total of the subsystems is usually less than the private bytes, as
+// e.g. Windows, GDI, fonts and allocator overhead aren't accounted for)
+static WCHAR* BuildMemoryReport() {
+    str::WStr s;
+    PROCESS_MEMORY_COUNTERS_EX pmc{};
+    pmc.cb = sizeof(pmc);
+    if (GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc))) {
+        s.AppendFmt(L"process: working set %.1f MB, private %.1f MB", BytesToMB(pmc.WorkingSetSize),
+                    BytesToMB(pmc.PrivateUsage));
+    }
+    int nBitmaps = 0;
+    size_t bitmapsSize = gRenderCache.GetMemoryUsage(nullptr, &nBitmaps);
+    s.AppendFmt(L"\nrendered bitmaps: %.1f MB (%d, budget %.1f MB)", BytesToMB(bitmapsSize), nBitmaps,
+                BytesToMB(gRenderCache.maxCacheSize));
+    s.AppendFmt(L"\nMuPDF (all documents): %.1f MB", BytesToMB((size_t)FzAllocatedTotal()));
+
+    size_t thumbsSize = 0;
+    int nThumbs = 0;
+    DisplayState* ds;
+    for (size_t i = 0; (ds = gFileHistory.Get(i)) != nullptr; i++) {
+        if (ds->thumbnail) {
+            Size size = ds->thumbnail->Size();
+            thumbsSize += (size_t)size.dx * (size_t)size.dy * 4;
+            nThumbs++;
+        }
+    }
+    s.AppendFmt(L"\nthumbnails: %.1f MB (%d)", BytesToMB(thumbsSize), nThumbs);
+
+    for (WindowInfo* win : gWindows) {
+        for (TabInfo* tab : win->tabs) {
+            if (!tab->ctrl) {
+                continue;
+            }
+            s.AppendFmt(L"\n%s:", path::GetBaseNameNoFree(tab->filePath));
+            if (DisplayModel* dm = tab->AsFixed()) {
+                int nTabBitmaps = 0;
+                size_t tabBitmapsSize = gRenderCache.GetMemoryUsage(dm, &nTabBitmaps);
+                s.AppendFmt(L" engine %.1f MB, bitmaps %.1f MB (%d)", BytesToMB(dm->GetEngine()->GetMemoryUsage()),
+                            BytesToMB(tabBitmapsSize), nTabBitmaps);
+                if (dm->textCache) {
+                    int nPages = 0;
+                    size_t textSize = dm->textCache->GetMemoryUsage(&nPages);
+                    s.AppendFmt(L", text %.1f MB (%d pages)", BytesToMB(textSize), nPages);
+                }
+            } else if (EbookController* ec = tab->AsEbook()) {
+                int nLayouts = 0;
+                size_t layoutSize = ec->GetLayoutMemoryUsage(&nLayouts);
+                s.AppendFmt(L" layouts %.1f MB (%d, %d pages)", BytesToMB(layoutSize), nLayouts, ec->PageCount());
+            }
+        }
+    }
+    return s.StealData();
+}
+
 // To avoid including mui/Mui.h, which conflicts with wingui/Layout.h
 namespace mui {
 extern void SetDebugPaint(bool);
@@ -4268,7 +4781,7 @@ static LRESULT FrameOnCommand(WindowInfo* win, HWND hwnd, UINT msg, WPARAM wp, L
         DisplayState* state = gFileHistory.Get(wmId - CmdFileHistoryFirst);
         if (state && HasPermission(Perm_DiskAccess)) {
             LoadArgs args(state->filePath, win);
-            LoadDocument(args);
+            LoadDocumentAsync(args);
         }
         return 0;
     }
@@ -4444,6 +4957,10 @@ static LRESULT FrameOnCommand(WindowInfo* win, HWND hwnd, UINT msg, WPARAM wp, L
             ToggleTocBox(win);
             break;
 
+        case CmdViewThumbnails:
+            ToggleThumbnails(win);
+            break;
+
         case CmdGoToNextPage:
             if (win->IsDocLoaded()) {
                 ctrl->GoToNextPage();
@@ -4516,6 +5033,18 @@ static LRESULT FrameOnCommand(WindowInfo* win, HWND hwnd, UINT msg, WPARAM wp, L
             OnMenuFindSel(win, TextSearchDirection::Backward);
             break;
 
+        case CmdFindAll:
+            ShowSearchResults(win);
+            break;
+
+        case CmdFindInOpenDocuments:
+            ShowSearchResultsInDocuments(win, nullptr);
+            break;
+
+        case CmdFindInFolder:
+            OnMenuFindInFolder(win);
+            break;
+
         case CmdHelpVisitWebsite:
             SumatraLaunchBrowser(WEBSITE_MAIN_URL);
             break;
@@ -4660,6 +5189,47 @@ static LRESULT FrameOnCommand(WindowInfo* win, HWND hwnd, UINT msg, WPARAM wp, L
             // win->ShowNotification(L"This is a second notification\nMy friend.");
         } break;
 
+        case CmdDebugRenderStats: {
+            RenderQueueStats stats = gRenderCache.GetStats();
+            const WCHAR* names[] = {L"preview", L"visible", L"nearby", L"elements", L"prefetch", L"callback"};
+            static_assert(dimof(names) == (int)RenderRequestClass::Count);
+            str::WStr msg;
+            msg.AppendFmt(L"max queue depth: %d", stats.maxQueueDepth);
+            for (int i = 0; i < (int)RenderRequestClass::Count; i++) {
+                int n = stats.rendered[i];
+                int avgWaitMs = n > 0 ? (int)(stats.totalWaitMs[i] / n) : 0;
+                msg.AppendFmt(L"\n%s: %d rendered, wait avg %d ms, max %d ms", names[i], n, avgWaitMs,
+                              (int)stats.maxWaitMs[i]);
+            }
+            win->ShowNotification(msg.Get(), NOS_PERSIST);
+        } break;
+
+        case CmdDebugShowMemory: {
+            AutoFreeWstr report = BuildMemoryReport();
+            logf(L"memory usage:\n%s\n", report.Get());
+            win->ShowNotification(report, NOS_PERSIST);
+        } break;
+
+        case CmdDebugAllocSamples: {
+            // the first use starts sampling (unless started with -alloc-sample)
+            if (!IsAllocSampling()) {
+                AutoFreeWstr path = AppGenDataFilename(L"alloc-samples.txt");
+                StartAllocSampling(path, 256 * 1024);
+                win->ShowNotification(L"Started sampling allocations");
+            } else if (WriteAllocSamplingReport()) {
+                win->ShowNotification(L"Wrote the allocation samples");
+            } else {
+                win->ShowNotification(L"Failed to write the allocation samples", NOS_WARNING);
+            }
+        } break;
+
+        case CmdDebugTogglePerfHud:
+            gShowPerfHud = !gShowPerfHud;
+            for (WindowInfo* w : gWindows) {
+                ShowPerfHud(w, gShowPerfHud);
+            }
+            break;
+
         case CmdDebugCrashMe:
             CrashMe();
             break;
@@ -4692,6 +5262,19 @@ static LRESULT OnFrameGetMinMaxInfo(MINMAXINFO* info) {
     return 0;
 }
 
+// all windows get WM_ACTIVATEAPP, so the caches are only trimmed once per deactivation
+static LONG gTrimOnDeactivateKey;
+static LONG gTrimOnMinimizeKey;
+
+static void TrimCachesIfAllMinimized() {
+    for (WindowInfo* win : gWindows) {
+        if (!IsIconic(win->hwndFrame)) {
+            return;
+        }
+    }
+    TrimCaches(TrimLevel::Minimized);
+}
+
 LRESULT CALLBACK WndProcFrame(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
     WindowInfo* win = FindWindowInfoByHwnd(hwnd);
 
@@ -4722,6 +5305,15 @@ LRESULT CALLBACK WndProcFrame(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
                 // dbglog::LogF("dx: %d, dy: %d", dx, dy);
                 FrameOnSize(win, dx, dy);
             }
+            if (win && SIZE_MINIMIZED == wp) {
+                uitask::PostCoalesced(&gTrimOnMinimizeKey, TrimCachesIfAllMinimized);
+            }
+            break;
+
+        case WM_ACTIVATEAPP:
+            if (!wp) {
+                uitask::PostCoalesced(&gTrimOnDeactivateKey, [] { TrimCaches(TrimLevel::Inactive); });
+            }
             break;
 
         case WM_GETMINMAXINFO:
@@ -4906,6 +5498,17 @@ LRESULT CALLBACK WndProcFrame(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
         case WM_COPYDATA:
             return OnCopyData(hwnd, wp, lp);
 
+        // the text of large selections is only put on the clipboard when it's pasted
+        case WM_RENDERFORMAT:
+            OnRenderClipboardFormat((UINT)wp);
+            return 0;
+        case WM_RENDERALLFORMATS:
+            OnRenderAllClipboardFormats(hwnd);
+            return 0;
+        case WM_DESTROYCLIPBOARD:
+            OnDestroyClipboard();
+            return 0;
+
         case WM_TIMER:
             if (win && win->stressTest) {
                 OnStressTestTimer(win, (int)wp);
@@ -28,6 +28,12 @@
 
 #define EBOOK_LAYOUT_TIMER_ID 7
 
+#define SCROLL_ANIMATION_TIMER_ID 8
+#define SCROLL_ANIMATION_INTERVAL_IN_MS 10
+
+#define LINK_PREFETCH_TIMER_ID 9
+#define LINK_PREFETCH_DELAY_IN_MS 300
+
 // permissions that can be revoked through sumatrapdfrestrict.ini or the -restrict command line flag
 enum {
     // enables Update checks, crash report submitting and hyperlinks
@@ -87,6 +93,8 @@ struct DropDownCtrl;
 // all defined in SumatraPDF.cpp
 extern bool gDebugShowLinks;
 extern bool gShowFrameRate;
+// developer HUD for the fixed page canvas (Ctrl+Shift+Alt+P)
+extern bool gShowPerfHud;
 
 extern const WCHAR* gPluginURL;
 extern Vec<WindowInfo*> gWindows;
@@ -159,9 +167,15 @@ struct LoadArgs {
     // TODO: this is hacky. I save prefs too frequently. Need to go over
     // and rationalize all prefs::Save() calls
     bool noSavePrefs{false};
+    // CreateEngine has already failed for the file (in LoadDocumentAsync),
+    // so only the CHM and ebook controllers are tried
+    bool skipEngine{false};
 };
 
 WindowInfo* LoadDocument(LoadArgs& args);
+void LoadDocumentAsync(LoadArgs& args);
+void AbortLoadDocumentAsync(TabInfo* tab);
+void ApplyTabState(WindowInfo* win, TabState* state);
 WindowInfo* CreateAndShowWindowInfo(SessionData* data = nullptr);
 
 uint MbRtlReadingMaybe();
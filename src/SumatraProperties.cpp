@@ -4,6 +4,8 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -69,17 +71,22 @@ class PropertiesLayout : public Vec<PropertyEl*> {
             free(value);
         }
     }
-    bool HasProperty(const WCHAR* key) {
+    PropertyEl* FindProperty(const WCHAR* key) {
         for (size_t i = 0; i < size(); i++) {
             if (str::Eq(key, at(i)->leftTxt)) {
-                return true;
+                return at(i);
             }
         }
-        return false;
+        return nullptr;
+    }
+    bool HasProperty(const WCHAR* key) {
+        return FindProperty(key) != nullptr;
     }
 
     HWND hwnd{nullptr};
     HWND hwndParent{nullptr};
+    // signaled once the font list has been extracted in the background
+    HANDLE fontsDone{nullptr};
 };
 
 static Vec<PropertiesLayout*> gPropertiesWindows;
@@ -425,6 +432,23 @@ static void UpdatePropertiesLayout(PropertiesLayout* layoutData, HDC hdc, Rect*
     SelectObject(hdc, origFont);
 }
 
+// resizes the window to just match the dimensions required for its content
+// (as long as they fit into the current monitor's work area)
+static void ResizePropertiesWindow(PropertiesLayout* layoutData) {
+    HWND hwnd = layoutData->hwnd;
+    Rect rc;
+    HDC hdc = GetDC(hwnd);
+    UpdatePropertiesLayout(layoutData, hdc, &rc);
+    ReleaseDC(hwnd, hdc);
+
+    Rect wRc = WindowRect(hwnd);
+    Rect cRc = ClientRect(hwnd);
+    Rect work = GetWorkAreaRect(WindowRect(layoutData->hwndParent));
+    wRc.dx = std::min(rc.dx + wRc.dx - cRc.dx, work.dx);
+    wRc.dy = std::min(rc.dy + wRc.dy - cRc.dy, work.dy);
+    MoveWindow(hwnd, wRc.x, wRc.y, wRc.dx, wRc.dy, FALSE);
+}
+
 static bool CreatePropertiesWindow(HWND hParent, PropertiesLayout* layoutData) {
     CrashIf(layoutData->hwnd);
     HWND hwnd = CreateWindow(PROPERTIES_CLASS_NAME, PROPERTIES_WIN_TITLE, WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU,
@@ -438,21 +462,7 @@ static bool CreatePropertiesWindow(HWND hParent, PropertiesLayout* layoutData) {
     layoutData->hwndParent = hParent;
     SetRtl(hwnd, IsUIRightToLeft());
 
-    // get the dimensions required for the about box's content
-    Rect rc;
-    PAINTSTRUCT ps;
-    HDC hdc = BeginPaint(hwnd, &ps);
-    UpdatePropertiesLayout(layoutData, hdc, &rc);
-    EndPaint(hwnd, &ps);
-
-    // resize the new window to just match these dimensions
-    // (as long as they fit into the current monitor's work area)
-    Rect wRc = WindowRect(hwnd);
-    Rect cRc = ClientRect(hwnd);
-    Rect work = GetWorkAreaRect(WindowRect(hParent));
-    wRc.dx = std::min(rc.dx + wRc.dx - cRc.dx, work.dx);
-    wRc.dy = std::min(rc.dy + wRc.dy - cRc.dy, work.dy);
-    MoveWindow(hwnd, wRc.x, wRc.y, wRc.dx, wRc.dy, FALSE);
+    ResizePropertiesWindow(layoutData);
     CenterDialog(hwnd, hParent);
 
     ShowWindow(hwnd, SW_SHOW);
@@ -510,9 +520,14 @@ static void GetProps(Controller* ctrl, PropertiesLayout* layoutData, bool extend
     i64 fileSize = file::GetSize(path.AsView());
     if (-1 == fileSize && dm) {
         EngineBase* engine = dm->GetEngine();
-        AutoFree d = engine->GetFileData();
-        if (!d.empty()) {
-            fileSize = d.size();
+        auto data = engine->BorrowFileData();
+        if (!data.empty()) {
+            fileSize = (i64)data.size();
+        } else {
+            AutoFree d = engine->GetFileData();
+            if (!d.empty()) {
+                fileSize = d.size();
+            }
         }
     }
     if (-1 != fileSize) {
@@ -543,19 +558,45 @@ static void GetProps(Controller* ctrl, PropertiesLayout* layoutData, bool extend
 
 #if defined(DEBUG) || defined(ENABLE_EXTENDED_PROPERTIES)
     if (extended) {
-        // TODO: FontList extraction can take a while
-        str = ctrl->GetProperty(DocumentProperty::FontList);
-        if (str) {
-            // add a space between basic and extended file properties
-            layoutData->AddProperty(L" ", str::Dup(L" "));
-        }
-        layoutData->AddProperty(_TR("Fonts:"), str);
+        // add a space between basic and extended file properties
+        layoutData->AddProperty(L" ", str::Dup(L" "));
+        // the font list is filled in by StartExtractingFonts
+        layoutData->AddProperty(_TR("Fonts:"), str::Dup(L"..."));
     }
 #else
     UNUSED(extended);
 #endif
 }
 
+#if defined(DEBUG) || defined(ENABLE_EXTENDED_PROPERTIES)
+static void SetFontsProperty(HWND hwnd, WCHAR* fonts) {
+    PropertiesLayout* layoutData = FindPropertyWindowByHwnd(hwnd);
+    PropertyEl* el = layoutData ? layoutData->FindProperty(_TR("Fonts:")) : nullptr;
+    if (!el) {
+        free(fonts);
+        return;
+    }
+    if (str::IsEmpty(fonts)) {
+        free(fonts);
+        fonts = str::Dup(L"-");
+    }
+    el->rightTxt.Set(fonts);
+    ResizePropertiesWindow(layoutData);
+    InvalidateRect(hwnd, nullptr, FALSE);
+}
+
+// extracting the font list can take a while, so the other properties
+// are displayed right away and the fonts are added once they're known
+static void StartExtractingFonts(PropertiesLayout* layoutData, Controller* ctrl) {
+    HWND hwnd = layoutData->hwnd;
+    auto fn = [=] {
+        WCHAR* fonts = ctrl->GetProperty(DocumentProperty::FontList);
+        uitask::Post([=] { SetFontsProperty(hwnd, fonts); });
+    };
+    layoutData->fontsDone = RunAsyncWithHandle(fn, TaskPriority::Low);
+}
+#endif
+
 static void ShowProperties(HWND parent, Controller* ctrl, bool extended = false) {
     PropertiesLayout* layoutData = FindPropertyWindowByParent(parent);
     if (layoutData) {
@@ -571,8 +612,15 @@ static void ShowProperties(HWND parent, Controller* ctrl, bool extended = false)
     GetProps(ctrl, layoutData, extended);
 
     if (!CreatePropertiesWindow(parent, layoutData)) {
+        gPropertiesWindows.Remove(layoutData);
         delete layoutData;
+        return;
     }
+#if defined(DEBUG) || defined(ENABLE_EXTENDED_PROPERTIES)
+    if (extended) {
+        StartExtractingFonts(layoutData, ctrl);
+    }
+#endif
 }
 
 void OnMenuProperties(WindowInfo* win) {
@@ -697,6 +745,11 @@ LRESULT CALLBACK WndProcProperties(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
         case WM_DESTROY:
             pl = FindPropertyWindowByHwnd(hwnd);
             CrashIf(!pl);
+            if (pl->fontsDone) {
+                // the controller might be deleted right after the window
+                WaitForSingleObject(pl->fontsDone, INFINITE);
+                CloseHandle(pl->fontsDone);
+            }
             gPropertiesWindows.Remove(pl);
             delete pl;
             break;
@@ -14,12 +14,16 @@
 #include "mui/Mui.h"
 #include "utils/SquareTreeParser.h"
 #include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
 #include "utils/UITask.h"
 #include "utils/WinUtil.h"
 #include "utils/Archive.h"
 #include "utils/LzmaSimpleArchive.h"
 #include "utils/LogDbg.h"
 #include "utils/Log.h"
+#include "utils/Trace.h"
+#include "utils/AllocSampler.h"
+#include "utils/SlowOps.h"
 
 #include "SumatraConfig.h"
 
@@ -43,6 +47,9 @@
 #include "GlobalPrefs.h"
 #include "PdfSync.h"
 #include "RenderCache.h"
+#include "DiskTileCache.h"
+#include "DiskTextIndex.h"
+#include "ContentBoxCache.h"
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
@@ -50,6 +57,7 @@
 #include "SumatraPDF.h"
 #include "WindowInfo.h"
 #include "TabInfo.h"
+#include "EngineEbook.h"
 #include "resource.h"
 #include "Commands.h"
 #include "Flags.h"
@@ -68,6 +76,9 @@
 #include "Translations.h"
 #include "uia/Provider.h"
 #include "StressTesting.h"
+#include "BatchMode.h"
+#include "AutomationPipe.h"
+#include "MemoryPressure.h"
 #include "Version.h"
 #include "Tests.h"
 #include "Menu.h"
@@ -113,7 +124,7 @@ void FileExistenceChecker::GetFilePathsToCheck() {
     }
     // add missing paths from the list of most frequently opened documents
     Vec<DisplayState*> frequencyList;
-    gFileHistory.GetFrequencyOrder(frequencyList);
+    gFileHistory.GetFrequencyOrder(frequencyList, 2 * FILE_HISTORY_MAX_FREQUENT);
     size_t iMax = std::min<size_t>(2 * FILE_HISTORY_MAX_FREQUENT, frequencyList.size());
     for (size_t i = 0; i < iMax; i++) {
         state = frequencyList.at(i);
@@ -139,14 +150,90 @@ void FileExistenceChecker::Terminate() {
     delete this;
 }
 
+// how long to wait for a path to be checked before assuming that it exists.
+// Checks can take long for sleeping removable drives and unreachable network
+// shares, so all paths are checked at the same time on their own threads.
+#define FILE_CHECK_TIMEOUT_MS 5000
+#define FILE_CHECK_NETWORK_TIMEOUT_MS 1500
+
+// shared between FileExistenceChecker and the thread doing the check, which
+// might outlive the checker if the check hangs
+struct PathExistenceCheck {
+    LONG refCount = 2;
+    AutoFreeWstr path;
+    HANDLE done = nullptr;
+    // false if the file doesn't exist or if it couldn't be determined
+    // (e.g. because the drive or network share isn't available)
+    bool isMissing = false;
+
+    explicit PathExistenceCheck(const WCHAR* path) : path(str::Dup(path)) {
+        done = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    }
+    ~PathExistenceCheck() {
+        CloseHandle(done);
+    }
+};
+
+static void ReleasePathExistenceCheck(PathExistenceCheck* check) {
+    if (InterlockedDecrement(&check->refCount) == 0) {
+        delete check;
+    }
+}
+
+static DWORD WINAPI CheckPathExistence(void* data) {
+    PathExistenceCheck* check = (PathExistenceCheck*)data;
+    const WCHAR* path = check->path;
+    if (path::IsOnFixedDrive(path)) {
+        check->isMissing = !DocumentPathExists(path);
+    } else if (!DocumentPathExists(path)) {
+        // only consider files on network and removable drives missing
+        // if the drive is there and just the file isn't
+        WCHAR root[MAX_PATH];
+        str::BufSet(root, dimof(root), path);
+        check->isMissing = PathStripToRoot(root) && dir::Exists(root);
+    }
+    SetEvent(check->done);
+    ReleasePathExistenceCheck(check);
+    return 0;
+}
+
 void FileExistenceChecker::Run() {
-    // filters all file paths on network drives, removable drives and
-    // all paths which still exist from the list (remaining paths will
-    // be marked as inexistent in gFileHistory)
+    // filters all paths which still exist (or which couldn't be checked in time)
+    // from the list (remaining paths will be marked as inexistent in gFileHistory)
+    Vec<PathExistenceCheck*> checks;
+    for (const WCHAR* path : paths) {
+        PathExistenceCheck* check = new PathExistenceCheck(path ? path : L"");
+        checks.Append(check);
+        HANDLE hThread = nullptr;
+        if (path && check->done) {
+            hThread = CreateThread(nullptr, 0, CheckPathExistence, check, 0, 0);
+        }
+        if (hThread) {
+            CloseHandle(hThread);
+        } else {
+            // nothing to check (or no thread to check it on)
+            SetEvent(check->done);
+            ReleasePathExistenceCheck(check);
+        }
+    }
+
+    Vec<bool> isMissing;
+    DWORD start = GetTickCount();
     for (size_t i = 0; i < paths.size(); i++) {
-        const WCHAR* path = paths.at(i);
-        if (!path || !path::IsOnFixedDrive(path) || DocumentPathExists(path)) {
-            free(paths.PopAt(i--));
+        PathExistenceCheck* check = checks.at(i);
+        DWORD timeout = FILE_CHECK_TIMEOUT_MS;
+        if (PathIsNetworkPath(check->path)) {
+            timeout = FILE_CHECK_NETWORK_TIMEOUT_MS;
+        }
+        DWORD elapsed = GetTickCount() - start;
+        DWORD waitMs = elapsed < timeout ? timeout - elapsed : 0;
+        bool checked = check->done && WaitForSingleObject(check->done, waitMs) == WAIT_OBJECT_0;
+        isMissing.Append(checked && check->isMissing);
+        ReleasePathExistenceCheck(check);
+    }
+    for (size_t i = paths.size(); i > 0; i--) {
+        if (!isMissing.at(i - 1)) {
+            free(paths.PopAt(i - 1));
         }
     }
 
@@ -312,32 +399,45 @@ static void RestoreTabOnStartup(WindowInfo* win, TabState* state) {
     if (!LoadDocument(args)) {
         return;
     }
-    TabInfo* tab = win->currentTab;
-    if (!tab || !tab->ctrl) {
+    ApplyTabState(win, state);
+}
+
+static void RestoreSessionWindow(WindowInfo* win, SessionData* data) {
+    Vec<TabState*>* tabStates = data->tabStates;
+    int selectedIdx = data->tabIndex - 1;
+    bool deferLoading = gGlobalPrefs->useTabs && tabStates->size() > 1 && selectedIdx >= 0 &&
+                        selectedIdx < (int)tabStates->size();
+    if (!deferLoading) {
+        for (TabState* state : *tabStates) {
+            // TODO: if prefs::Save() is called, it deletes gGlobalPrefs->sessionData
+            // we're currently iterating (happened e.g. if the file is deleted)
+            // the current fix is to not call prefs::Save() below but maybe there's a better way
+            // maybe make a copy of TabState so that it isn't invalidated
+            // https://github.com/sumatrapdfreader/sumatrapdf/issues/1674
+            RestoreTabOnStartup(win, state);
+        }
+        TabsSelect(win, data->tabIndex - 1);
         return;
     }
 
-    tab->tocState = *state->tocState;
-    SetSidebarVisibility(win, state->showToc, gGlobalPrefs->showFavorites);
-
-    DisplayMode displayMode = prefs::conv::ToDisplayMode(state->displayMode, DM_AUTOMATIC);
-    if (displayMode != DM_AUTOMATIC) {
-        SwitchToDisplayMode(win, displayMode);
-    }
-    // TODO: make EbookController::GoToPage not crash
-    if (!tab->AsEbook()) {
-        tab->ctrl->GoToPage(state->pageNo, true);
-    }
-    float zoom = prefs::conv::ToZoom(state->zoom, INVALID_ZOOM);
-    if (zoom != INVALID_ZOOM) {
-        if (tab->AsFixed()) {
-            tab->AsFixed()->Relayout(zoom, state->rotation);
-        } else {
-            tab->ctrl->SetZoomVirtual(zoom, nullptr);
+    // only load the document of the selected tab, the other documents
+    // are loaded when their tab is selected for the first time
+    RestoreTabOnStartup(win, tabStates->at(selectedIdx));
+    for (int idx = 0; idx < (int)tabStates->size(); idx++) {
+        if (idx == selectedIdx) {
+            continue;
         }
-    }
-    if (tab->AsFixed()) {
-        tab->AsFixed()->SetScrollState(ScrollState(state->pageNo, state->scrollPos.x, state->scrollPos.y));
+        // the tab takes over ownership of the state
+        TabState* state = tabStates->at(idx);
+        tabStates->at(idx) = nullptr;
+        // deferred tabs are inserted in order before resp. after the selected one
+        int tabIdx = idx < selectedIdx ? idx : (int)win->tabs.size();
+        CreateDeferredTab(win, state, tabIdx);
+    }
+    if (!win->currentTab && win->tabs.size() > 0) {
+        // the selected document failed to load
+        TabCtrl_SetCurSel(win->tabCtrl->hwnd, 0);
+        LoadModelIntoTab(win->tabs.at(0));
     }
 }
 
@@ -415,13 +515,47 @@ static void SetupCrashHandler() {
     free(symDir);
 }
 
-static HWND FindPrevInstWindow(HANDLE* hMutex) {
-    // create a unique identifier for this executable
-    // (allows independent side-by-side installations)
+// a unique identifier for this executable
+// (allows independent side-by-side installations)
+static WCHAR* GetInstanceMappingId() {
     AutoFreeWstr exePath = GetExePath();
     str::ToLowerInPlace(exePath);
     u32 hash = MurmurHash2(exePath, str::Len(exePath) * sizeof(WCHAR));
-    AutoFreeWstr mapId = str::Format(L"SumatraPDF-%08x", hash);
+    return str::Format(L"SumatraPDF-%08x", hash);
+}
+
+static HWND FindFrameWindowOfProcess(DWORD procId) {
+    HWND hwnd = nullptr;
+    while ((hwnd = FindWindowEx(HWND_DESKTOP, hwnd, FRAME_CLASS_NAME, nullptr)) != nullptr) {
+        DWORD wndProcId;
+        GetWindowThreadProcessId(hwnd, &wndProcId);
+        if (wndProcId == procId) {
+            AllowSetForegroundWindow(procId);
+            return hwnd;
+        }
+    }
+    return nullptr;
+}
+
+// like FindPrevInstWindow but only looks for an instance that's already running
+// and doesn't create the mapping if there's none
+static HWND FindRunningInstWindow() {
+    AutoFreeWstr mapId = GetInstanceMappingId();
+    HANDLE hMap = OpenFileMappingW(FILE_MAP_READ, FALSE, mapId);
+    if (!hMap) {
+        return nullptr;
+    }
+    DWORD* procId = (DWORD*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, sizeof(DWORD));
+    DWORD prevProcId = procId ? *procId : 0;
+    if (procId) {
+        UnmapViewOfFile(procId);
+    }
+    CloseHandle(hMap);
+    return prevProcId ? FindFrameWindowOfProcess(prevProcId) : nullptr;
+}
+
+static HWND FindPrevInstWindow(HANDLE* hMutex) {
+    AutoFreeWstr mapId = GetInstanceMappingId();
 
     int retriesLeft = 3;
     HANDLE hMap = nullptr;
@@ -450,14 +584,9 @@ Retry:
     DWORD prevProcId = *procId;
     UnmapViewOfFile(procId);
     CloseHandle(hMap);
-    HWND hwnd = nullptr;
-    while ((hwnd = FindWindowEx(HWND_DESKTOP, hwnd, FRAME_CLASS_NAME, nullptr)) != nullptr) {
-        DWORD wndProcId;
-        GetWindowThreadProcessId(hwnd, &wndProcId);
-        if (wndProcId == prevProcId) {
-            AllowSetForegroundWindow(prevProcId);
-            return hwnd;
-        }
+    HWND hwnd = FindFrameWindowOfProcess(prevProcId);
+    if (hwnd) {
+        return hwnd;
     }
 
     // fall through
@@ -498,12 +627,107 @@ static bool RegisterForPdfExtentions(HWND hwnd) {
     return true;
 }
 
+static void TrimEbookImages(TrimLevel level) {
+    if (level != TrimLevel::Inactive) {
+        FreeEbookImageCache();
+    }
+}
+
+// the text of pages close to the visible ones is kept for selecting and searching
+static void TrimDocumentText(TrimLevel level) {
+    if (level == TrimLevel::Inactive) {
+        return;
+    }
+    for (WindowInfo* win : gWindows) {
+        for (TabInfo* tab : win->tabs) {
+            DisplayModel* dm = tab->AsFixed();
+            if (dm && dm->textCache) {
+                dm->textCache->EvictPages(dm->FirstVisiblePageNo(), dm->LastVisiblePageNo(), true);
+            }
+        }
+    }
+}
+
+// while inactive, only documents in tabs that aren't shown give up their resources
+static void TrimEngineResources(TrimLevel level) {
+    for (WindowInfo* win : gWindows) {
+        for (TabInfo* tab : win->tabs) {
+            bool isShown = tab == win->currentTab;
+            if (tab->AsFixed() && (!isShown || level != TrimLevel::Inactive)) {
+                tab->GetEngine()->ReleaseCachedResources();
+            }
+        }
+    }
+}
+
+// tiles of visible pages are always kept, so that restoring a window doesn't flicker
+static void TrimRenderedTiles(TrimLevel level) {
+    if (level == TrimLevel::Inactive) {
+        return;
+    }
+    // pages that are neither visible nor about to become visible
+    gRenderCache.FreePage();
+    FreeDibPool();
+    if (level != TrimLevel::LowMemory) {
+        return;
+    }
+    for (WindowInfo* win : gWindows) {
+        for (TabInfo* tab : win->tabs) {
+            if (tab != win->currentTab && tab->AsFixed()) {
+                gRenderCache.FreePage(tab->AsFixed());
+            }
+        }
+    }
+}
+
+static void RegisterCacheTrimmers() {
+    RegisterCacheTrimmer(CacheTier::EbookImages, TrimEbookImages);
+    RegisterCacheTrimmer(CacheTier::DocumentText, TrimDocumentText);
+    RegisterCacheTrimmer(CacheTier::EngineResources, TrimEngineResources);
+    RegisterCacheTrimmer(CacheTier::RenderedTiles, TrimRenderedTiles);
+}
+
+// when WinMain started and when the current startup phase started
+static LARGE_INTEGER gStartupTime;
+static LARGE_INTEGER gStartupPhaseTime;
+
+// logs how long a phase of the startup took, to see where cold start time goes
+static void LogStartupPhase(const char* phase) {
+    logf("Startup: %s took %.2f ms (%.2f ms since start)\n", phase, TimeSinceInMs(gStartupPhaseTime),
+         TimeSinceInMs(gStartupTime));
+    gStartupPhaseTime = TimeGet();
+}
+
+// initialization that isn't needed for showing the first window
+// is run once the message loop has nothing else to do
+static std::function<void()> gDeferredStartupTasks;
+
+static void RunDeferredStartupTasks() {
+    if (!gDeferredStartupTasks) {
+        return;
+    }
+    MSG msg;
+    if (PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE)) {
+        return;
+    }
+    // by now the first window has been painted
+    LogStartupPhase("showing the first window");
+    auto tasks = gDeferredStartupTasks;
+    gDeferredStartupTasks = nullptr;
+    tasks();
+    LogStartupPhase("deferred initialization");
+}
+
 static int RunMessageLoop() {
     HACCEL accTable = CreateSumatraAcceleratorTable();
 
     MSG msg = {0};
 
-    while (GetMessage(&msg, nullptr, 0, 0)) {
+    for (;;) {
+        RunDeferredStartupTasks();
+        if (!GetMessage(&msg, nullptr, 0, 0)) {
+            break;
+        }
         // dispatch the accelerator to the correct window
         HWND accHwnd = msg.hwnd;
         WindowInfo* win = FindWindowInfoByHwnd(msg.hwnd);
@@ -745,6 +969,63 @@ static void testLogf() {
 }
 #endif
 
+static void HandOffToPrevInstance(HWND hPrevWnd, Flags& i) {
+    size_t nFiles = i.fileNames.size();
+    for (size_t n = 0; n < nFiles; n++) {
+        OpenUsingDde(hPrevWnd, i.fileNames.at(n), i, 0 == n);
+    }
+    if (0 == nFiles) {
+        win::ToForeground(hPrevWnd);
+    }
+}
+
+// whether the command line might be handled by handing it over to a running instance
+// (everything else, e.g. printing or running the installer, needs the full initialization)
+static bool CanHandOffEarly(const Flags& i) {
+    if (i.printDialog || i.printerName || i.stressTestPath || i.hwndPluginParent || i.batchAction ||
+        i.exportTextSrc) {
+        return false;
+    }
+    if (i.install || i.uninstall || i.justExtractFiles || i.showHelp || i.registerAsDefault) {
+        return false;
+    }
+    if (i.testRenderPage || i.testExtractPage || i.testApp || i.tester || i.regress || i.exitImmediately) {
+        return false;
+    }
+    // these might change the settings that determine whether to reuse an instance
+    if (i.appdataDir || i.globalPrefArgs.size() > 0) {
+        return false;
+    }
+    if (i.pathsToBenchmark.size() > 0 || i.showConsole) {
+        return false;
+    }
+    return !IsInstallerAndNamedAsSuch();
+}
+
+// Opening a file from e.g. Explorer in an already running instance only needs the
+// command line. This is tried before anything else is initialized, so that such
+// a process exits within milliseconds. Only an instance which reuses itself (as
+// per its settings at startup) creates the mapping FindRunningInstWindow looks for,
+// so the settings don't have to be loaded. Returns false if WinMain should continue
+// (it then checks again for the cases which aren't handled here).
+static bool TryHandOffEarly(Flags& i) {
+    if (!CanHandOffEarly(i)) {
+        return false;
+    }
+    HWND hPrevWnd = i.reuseDdeInstance ? FindWindow(FRAME_CLASS_NAME, nullptr) : FindRunningInstWindow();
+    if (!hPrevWnd) {
+        return false;
+    }
+    DWORD otherProcId = 1;
+    GetWindowThreadProcessId(hPrevWnd, &otherProcId);
+    if (!CanTalkToProcess(otherProcId)) {
+        // WinMain shows the error message
+        return false;
+    }
+    HandOffToPrevInstance(hPrevWnd, i);
+    return true;
+}
+
 // in mupdf_load_system_font.c
 extern "C" void destroy_system_font_list();
 
@@ -754,6 +1035,8 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     UNUSED(cmdLine);
     UNUSED(nCmdShow);
     int retCode = 1; // by default it's error
+    gStartupTime = TimeGet();
+    gStartupPhaseTime = gStartupTime;
 
     CrashIf(hInstance != GetInstance());
 
@@ -781,6 +1064,12 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     // without a cd).
     SetErrorMode(SEM_NOOPENFILEERRORBOX | SEM_FAILCRITICALERRORS);
 
+    Flags i;
+    ParseCommandLine(GetCommandLineW(), i);
+    if (TryHandOffEarly(i)) {
+        return 0;
+    }
+
     srand((unsigned int)time(nullptr));
 
     if (!gIsAsanBuild) {
@@ -800,6 +1089,7 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     }
 
     log("Starting SumatraPDF\n");
+    LogStartupPhase("initializing the runtime");
 
     // testLogf();
 
@@ -813,8 +1103,12 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         logf("CmdLine: %s\n", cmdLineA.Get());
     }
 
-    Flags i;
-    ParseCommandLine(GetCommandLineW(), i);
+    if (i.traceFilePath) {
+        StartTracing(i.traceFilePath);
+    }
+    if (i.allocSamplePath) {
+        StartAllocSampling(i.allocSamplePath, (size_t)i.allocSampleIntervalKB * 1024);
+    }
 
     if (false && gIsDebugBuild) {
         int TestLice(HINSTANCE hInstance, int nCmdShow);
@@ -831,8 +1125,8 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
             return TesterMain();
         }
         if (i.regress) {
-            extern int RegressMain(); // in Regress.cpp
-            return RegressMain();
+            extern int RegressMain(const Flags&); // in Regress.cpp
+            return RegressMain(i);
         }
     }
 
@@ -867,11 +1161,13 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         retCode = RunInstaller(&i);
         // exit immediately. for some reason exit handlers try to
         // pull in libmupdf.dll which we don't have access to in the installer
+        FlushLog();
         ::ExitProcess(retCode);
     }
 
     if (i.uninstall) {
         retCode = RunUninstaller(&i);
+        FlushLog();
         ::ExitProcess(retCode);
     }
 
@@ -903,6 +1199,7 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     prefs::Load();
     UpdateGlobalPrefs(i);
     SetCurrentLang(i.lang ? i.lang : gGlobalPrefs->uiLanguage);
+    LogStartupPhase("loading settings");
 
     // This allows ad-hoc comparison of gdi, gdi+ and gdi+ quick when used
     // in layout
@@ -924,12 +1221,22 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     }
 
     if (i.pathsToBenchmark.size() > 0) {
-        BenchFileOrDir(i.pathsToBenchmark);
+        BenchFileOrDir(i);
         if (i.showConsole) {
             system("pause");
         }
     }
 
+    if (i.batchAction) {
+        retCode = RunBatch(i);
+        goto Exit;
+    }
+
+    if (i.exportTextSrc) {
+        retCode = RunExportText(i);
+        goto Exit;
+    }
+
     if (i.exitImmediately) {
         goto Exit;
     }
@@ -937,6 +1244,14 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     gCrashOnOpen = i.crashOnOpen;
 
     GetFixedPageUiColors(gRenderCache.textColor, gRenderCache.backgroundColor);
+    gRenderCache.SetRenderThreadsCount(gGlobalPrefs->renderThreads);
+    SetJpxDecodeThreads(gRenderCache.workersCount);
+    gRenderCache.SetMaxCacheSizeMB(gGlobalPrefs->renderCacheSize);
+    SetDiskTileCacheSizeMB(gGlobalPrefs->diskTileCacheSize);
+    SetDiskTextIndexSizeMB(gGlobalPrefs->diskTextIndexSize);
+    SetTextCacheSizeMB(gGlobalPrefs->textCacheSize);
+    SetFzStoreSizeMB(gGlobalPrefs->documentCacheSize);
+    RegisterCacheTrimmers();
 
     gIsStartup = true;
     if (!RegisterWinClass()) {
@@ -947,6 +1262,7 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     if (!InstanceInit()) {
         goto Exit;
     }
+    LogStartupPhase("registering window classes");
 
     if (i.hwndPluginParent) {
         if (!SetupPluginMode(i)) {
@@ -986,13 +1302,7 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
             MessageBoxA(nullptr, msg, "Error", MB_OK | MB_ICONERROR);
             goto Exit;
         }
-        size_t nFiles = i.fileNames.size();
-        for (size_t n = 0; n < nFiles; n++) {
-            OpenUsingDde(hPrevWnd, i.fileNames.at(n), i, 0 == n);
-        }
-        if (0 == nFiles) {
-            win::ToForeground(hPrevWnd);
-        }
+        HandOffToPrevInstance(hPrevWnd, i);
         goto Exit;
     }
 
@@ -1025,15 +1335,7 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     if (restoreSession) {
         for (SessionData* data : *gGlobalPrefs->sessionData) {
             win = CreateAndShowWindowInfo(data);
-            for (TabState* state : *data->tabStates) {
-                // TODO: if prefs::Save() is called, it deletes gGlobalPrefs->sessionData
-                // we're currently iterating (happened e.g. if the file is deleted)
-                // the current fix is to not call prefs::Save() below but maybe there's a better way
-                // maybe make a copy of TabState so that it isn't invalidated
-                // https://github.com/sumatrapdfreader/sumatrapdf/issues/1674
-                RestoreTabOnStartup(win, state);
-            }
-            TabsSelect(win, data->tabIndex - 1);
+            RestoreSessionWindow(win, data);
         }
     }
     ResetSessionState(gGlobalPrefs->sessionData);
@@ -1070,6 +1372,7 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     }
 
     gIsStartup = false;
+    LogStartupPhase("opening documents");
 
     if (i.fileNames.size() > 0 && !win) {
         // failed to create any window, even though there
@@ -1087,10 +1390,8 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         }
     }
 
-    // Make sure that we're still registered as default,
-    // if the user has explicitly told us to be
-    if (gGlobalPrefs->associatedExtensions) {
-        RegisterForPdfExtentions(win->hwndFrame);
+    if (i.automationPipeName) {
+        StartAutomationPipe(i.automationPipeName);
     }
 
     if (i.stressTestPath) {
@@ -1101,9 +1402,22 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         fastExit = true;
     }
 
-    if (gGlobalPrefs->checkForUpdates) {
-        UpdateCheckAsync(win, true);
-    }
+    gDeferredStartupTasks = [win] {
+        if (!gIsAsanBuild) {
+            FinishCrashHandlerSetup();
+        }
+        if (!WindowInfoStillValid(win)) {
+            return;
+        }
+        // Make sure that we're still registered as default,
+        // if the user has explicitly told us to be
+        if (gGlobalPrefs->associatedExtensions) {
+            RegisterForPdfExtentions(win->hwndFrame);
+        }
+        if (gGlobalPrefs->checkForUpdates) {
+            UpdateCheckAsync(win, true);
+        }
+    };
 
     // only hide newly missing files when showing the start page on startup
     if (showStartPage && gFileHistory.Get(0)) {
@@ -1128,11 +1442,26 @@ int APIENTRY WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 
     BringWindowToTop(win->hwndFrame);
 
+    StartUiWatchdog();
+    StartMemoryPressureMonitor();
     retCode = RunMessageLoop();
+    StopMemoryPressureMonitor();
+    StopUiWatchdog();
     SafeCloseHandle(&hMutex);
     CleanUpThumbnailCache(gFileHistory);
+    CleanUpDiskTileCache();
+    CleanUpDiskTextIndexes();
+    CleanUpDiskContentBoxes();
 
 Exit:
+    FlushLog();
+    StopAutomationPipe();
+    if (i.traceFilePath && !StopTracing()) {
+        logf(L"Error: failed to write the trace to %s\n", i.traceFilePath);
+    }
+    if (IsAllocSampling() && !StopAllocSampling()) {
+        logf("Error: failed to write the allocation samples\n");
+    }
     prefs::UnregisterForFileChanges();
     CrashIf(gAllowAllocFailure != 0);
 
@@ -1154,6 +1483,8 @@ Exit:
     CleanupDjVuEngine();
     destroy_system_font_list();
 
+    prefs::FlushPendingSave();
+
     // wait for FileExistenceChecker to terminate
     // (which should be necessary only very rarely)
     while (gFileExistenceChecker) {
@@ -1183,8 +1514,7 @@ Exit:
         UninstallCrashHandler();
     }
 
-    delete gLogBuf;
-    delete gLogAllocator;
+    DestroyLog();
 
     if (gIsAsanBuild) {
         // TODO: crashes in wild places without this
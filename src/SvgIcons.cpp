@@ -242,11 +242,20 @@ fz_pixmap* BuildIconsPixmap(MupdfContext* muctx, int dx, int dy) {
     return dstPixmap;
 }
 
-HBITMAP CreateBitmapFromPixmap(fz_pixmap* pixmap) {
-    int w = pixmap->w;
-    int h = pixmap->h;
-    int n = pixmap->n;
-    int imgSize = pixmap->stride * h;
+// pixels of BuildIconsPixmap's result
+struct IconsPixels {
+    int w = 0;
+    int h = 0;
+    int n = 0;
+    int stride = 0;
+    u8* samples = nullptr;
+};
+
+static HBITMAP CreateBitmapFromPixels(const IconsPixels& px) {
+    int w = px.w;
+    int h = px.h;
+    int n = px.n;
+    int imgSize = px.stride * h;
     int bitsCount = n * 8;
 
     ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
@@ -266,35 +275,49 @@ HBITMAP CreateBitmapFromPixmap(fz_pixmap* pixmap) {
     uint usage = DIB_RGB_COLORS;
     HBITMAP hbmp = CreateDIBSection(nullptr, bmi, usage, &data, hMap, 0);
     if (data) {
-        u8* samples = pixmap->samples;
-        memcpy(data, samples, imgSize);
+        memcpy(data, px.samples, imgSize);
     }
     return hbmp;
 }
 
-HBITMAP BuildIconsBitmap(int dx, int dy) {
+// parsing and rasterizing the svg icons takes a while, so they're only
+// rasterized once per icon size (i.e. per DPI scale factor) and reused
+// for all toolbars of that size (e.g. for new windows or after DPI changes)
+struct CachedIcons {
+    int dx = 0;
+    int dy = 0;
+    IconsPixels px;
+};
+
+// only accessed from the UI thread
+static Vec<CachedIcons*> gCachedIcons;
+
+static CachedIcons* GetCachedIcons(int dx, int dy) {
+    for (CachedIcons* icons : gCachedIcons) {
+        if (icons->dx == dx && icons->dy == dy) {
+            return icons;
+        }
+    }
     MupdfContext* muctx = new MupdfContext();
     fz_pixmap* pixmap = BuildIconsPixmap(muctx, dx, dy);
-    // ClearPixmap(pixmap);
-#if 1
-#if 0
-    RenderedBitmap* rbmp = new_rendered_fz_pixmap(muctx->ctx, pixmap);
-    HBITMAP bmp = rbmp->hbmp;
-#else
-    HBITMAP bmp = CreateBitmapFromPixmap(pixmap);
-#endif
-    fz_drop_pixmap(muctx->ctx, pixmap);
-    delete muctx;
-    return bmp;
-#else
-    int nIcons = dimof(gAllIcons);
-    int bmpDx = dx * nIcons;
-    int bmpDy = dy;
-    u8* bits = pixmap->samples;
-    HBITMAP res = CreateBitmap(bmpDx, bmpDy, 1, 24, bits);
+    CachedIcons* icons = new CachedIcons();
+    icons->dx = dx;
+    icons->dy = dy;
+    icons->px.w = pixmap->w;
+    icons->px.h = pixmap->h;
+    icons->px.n = pixmap->n;
+    icons->px.stride = (int)pixmap->stride;
+    icons->px.samples = (u8*)memdup(pixmap->samples, pixmap->stride * pixmap->h);
     fz_drop_pixmap(muctx->ctx, pixmap);
     delete muctx;
+    gCachedIcons.Append(icons);
+    return icons;
+}
 
-    return res;
-#endif
+HBITMAP BuildIconsBitmap(int dx, int dy) {
+    CachedIcons* icons = GetCachedIcons(dx, dy);
+    if (!icons->px.samples) {
+        return nullptr;
+    }
+    return CreateBitmapFromPixels(icons->px);
 }
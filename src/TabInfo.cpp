@@ -28,6 +28,7 @@
 #include "Translations.h"
 #include "ParseBKM.h"
 #include "EditAnnotations.h"
+#include "SearchResults.h"
 
 TabInfo::TabInfo(WindowInfo* win, const WCHAR* filePath) {
     this->win = win;
@@ -41,9 +42,13 @@ TabInfo::~TabInfo() {
     }
     DeleteVecMembers(altBookmarks);
     delete selectionOnPage;
+    // the search results window uses ctrl
+    CloseSearchResults(this);
     delete ctrl;
     delete tocSorted;
     DeleteEditAnnotationsWindow(editAnnotsWindow);
+    DeleteTabState(deferredState);
+    AbortLoadDocumentAsync(this);
 }
 
 bool TabInfo::IsDocLoaded() const {
@@ -5,7 +5,10 @@ struct SelectionOnPage;
 struct WatchedFile;
 struct VbkmFile;
 struct EditAnnotationsWindow;
+struct SearchResultsWindow;
 struct WindowInfo;
+struct TabState;
+struct AsyncLoadData;
 
 enum class TocSort { None, TagSmallFirst, TagBigFirst, Color };
 
@@ -41,6 +44,12 @@ struct TabInfo {
     // if sortTag is != SortTag::None, this is a sorted toc tree to be displayed
     TocTree* tocSorted = nullptr;
     EditAnnotationsWindow* editAnnotsWindow = nullptr;
+    SearchResultsWindow* searchResultsWindow = nullptr;
+    // for tabs restored from a session, the document is only loaded
+    // when the tab is selected for the first time (see LoadModelIntoTab)
+    TabState* deferredState = nullptr;
+    // set while the document is being loaded in the background (see LoadDocumentAsync)
+    AsyncLoadData* asyncLoad = nullptr;
 
     TabInfo(WindowInfo* win, const WCHAR* filePath = nullptr);
     ~TabInfo();
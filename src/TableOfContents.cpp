@@ -44,6 +44,7 @@
 #include "Commands.h"
 #include "AppTools.h"
 #include "TableOfContents.h"
+#include "PageThumbnails.h"
 #include "Translations.h"
 #include "Tabs.h"
 #include "Menu.h"
@@ -236,10 +237,12 @@ void ToggleTocBox(WindowInfo* win) {
     if (!win->IsDocLoaded()) {
         return;
     }
-    if (win->tocVisible) {
+    // switches from the thumbnails to the bookmarks instead of hiding the sidebar
+    if (win->tocVisible && !IsShowingThumbnails(win)) {
         SetSidebarVisibility(win, false, gGlobalPrefs->showFavorites);
         return;
     }
+    win->thumbnailsVisible = false;
     SetSidebarVisibility(win, true, gGlobalPrefs->showFavorites);
     if (win->tocVisible) {
         win->tocTreeCtrl->SetFocus();
@@ -248,46 +251,34 @@ void ToggleTocBox(WindowInfo* win) {
 
 // find the closest item in tree view to a given page number
 static TreeItem* TreeItemForPageNo(TreeCtrl* treeCtrl, int pageNo) {
-    TocItem* bestMatch = nullptr;
-    int bestMatchPageNo = 0;
-
-    TreeModel* tm = treeCtrl->treeModel;
-    if (!tm) {
+    // the ToC tree control always shows a TocTree
+    auto* tocTree = (TocTree*)treeCtrl->treeModel;
+    if (!tocTree) {
         return nullptr;
     }
-    VisitTreeModelItems(tm, [&](TreeItem* ti) {
-        auto* docItem = (TocItem*)ti;
-        if (!docItem) {
-            return true;
-        }
-        if (!bestMatch) {
-            // if nothing else matches, match the root node
-            bestMatch = docItem;
-        }
-
-        int page = docItem->pageNo;
-        if ((page <= pageNo) && (page >= bestMatchPageNo) && (page >= 1)) {
-            bestMatch = docItem;
-            bestMatchPageNo = page;
-            if (pageNo == bestMatchPageNo) {
-                // we can stop earlier if we found the exact match
-                return false;
-            }
-        }
-        return true;
-    });
-    return bestMatch;
+    return tocTree->FindItemForPageNo(pageNo);
 }
 
+// the selection is updated asynchronously, so that only the last of
+// many page changes (e.g. while scrolling fast) updates the tree control
 void UpdateTocSelection(WindowInfo* win, int currPageNo) {
     if (!win->tocLoaded || !win->tocVisible || win->tocKeepSelection) {
+        // drop a pending update, so that it doesn't override the selection
+        win->tocSelectionPageNo = 0;
         return;
     }
 
-    TreeItem* item = TreeItemForPageNo(win->tocTreeCtrl, currPageNo);
-    if (item) {
-        win->tocTreeCtrl->SelectItem(item);
-    }
+    win->tocSelectionPageNo = currPageNo;
+    uitask::PostCoalesced(win->tocTreeCtrl, [win] {
+        if (!WindowInfoStillValid(win) || !win->tocLoaded || !win->tocVisible || 0 == win->tocSelectionPageNo) {
+            return;
+        }
+        TreeItem* item = TreeItemForPageNo(win->tocTreeCtrl, win->tocSelectionPageNo);
+        win->tocSelectionPageNo = 0;
+        if (item) {
+            win->tocTreeCtrl->SelectItem(item);
+        }
+    });
 }
 
 static void UpdateDocTocExpansionStateRecur(TreeCtrl* treeCtrl, Vec<int>& tocState, TocItem* tocItem) {
@@ -1051,11 +1042,12 @@ static LRESULT CALLBACK WndProcTocBox(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp,
     switch (msg) {
         case WM_SIZE:
             LayoutTreeContainer(win->tocLabelWithClose, win->altBookmarks, win->tocTreeCtrl->hwnd);
+            LayoutThumbnails(win);
             break;
 
         case WM_COMMAND:
             if (LOWORD(wp) == IDC_TOC_LABEL_WITH_CLOSE) {
-                ToggleTocBox(win);
+                SetSidebarVisibility(win, false, gGlobalPrefs->showFavorites);
             }
             break;
     }
@@ -93,6 +93,10 @@ using Gdiplus::Win32Error;
 #define TABBAR_HEIGHT 24
 #define MIN_TAB_WIDTH 100
 
+// number of most recently deselected tabs that keep their documents' decoded
+// images and fonts, so that alternating between a few tabs stays fast
+#define MAX_RECENT_HIDDEN_TABS 3
+
 int GetTabbarHeight(HWND hwnd, float factor) {
     int dy = DpiScale(hwnd, TABBAR_HEIGHT);
     return (int)(dy * factor);
@@ -723,8 +727,18 @@ void SaveCurrentTabInfo(WindowInfo* win) {
     VerifyTabInfo(win, tab);
 
     // update the selection history
-    win->tabSelectionHistory->Remove(tab);
-    win->tabSelectionHistory->Append(tab);
+    Vec<TabInfo*>* history = win->tabSelectionHistory;
+    history->Remove(tab);
+    history->Append(tab);
+
+    // only documents in visible and recently selected tabs keep their decoded
+    // images and fonts cached (their rendered tiles are kept in gRenderCache
+    // until it runs out of space)
+    int idx = history->isize() - 1 - MAX_RECENT_HIDDEN_TABS;
+    TabInfo* oldTab = idx >= 0 ? history->at(idx) : nullptr;
+    if (oldTab && oldTab->AsFixed()) {
+        oldTab->GetEngine()->ReleaseCachedResources();
+    }
 }
 
 void UpdateCurrentTabBgColor(WindowInfo* win) {
@@ -762,6 +776,37 @@ TabInfo* CreateNewTab(WindowInfo* win, const WCHAR* filePath) {
     return tab;
 }
 
+// Inserts a tab for a document from a restored session without loading it
+// (which happens when it's selected for the first time). The tab takes
+// ownership of state and the current tab remains selected.
+TabInfo* CreateDeferredTab(WindowInfo* win, TabState* state, int idx) {
+    CrashIf(!win || idx < 0 || idx > (int)win->tabs.size());
+    if (!win) {
+        return nullptr;
+    }
+
+    TabInfo* tab = new TabInfo(win, state->filePath);
+    tab->deferredState = state;
+    tab->showToc = state->showToc;
+    tab->tocState = *state->tocState;
+    tab->canvasRc = win->canvasRc;
+    win->tabs.InsertAt(idx, tab);
+    // deferred tabs are the least recently selected ones
+    win->tabSelectionHistory->InsertAt(0, tab);
+
+    TCITEMW tcs = {0};
+    tcs.mask = TCIF_TEXT;
+    tcs.pszText = (WCHAR*)tab->GetTabTitle();
+
+    auto insertedIdx = TabCtrl_InsertItem(win->tabCtrl->hwnd, idx, &tcs);
+    CrashIf(insertedIdx == -1);
+    if (win->currentTab) {
+        TabCtrl_SetCurSel(win->tabCtrl->hwnd, win->tabs.Find(win->currentTab));
+    }
+    UpdateTabWidth(win);
+    return tab;
+}
+
 // Refresh the tab's title
 void TabsOnChangedDoc(WindowInfo* win) {
     TabInfo* tab = win->currentTab;
@@ -8,6 +8,7 @@ void LoadModelIntoTab(TabInfo* tab);
 
 void CreateTabbar(WindowInfo* win);
 TabInfo* CreateNewTab(WindowInfo* win, const WCHAR* filePath);
+TabInfo* CreateDeferredTab(WindowInfo* win, TabState* state, int idx);
 void TabsOnCloseDoc(WindowInfo* win);
 void TabsOnCloseWindow(WindowInfo* win);
 void TabsOnChangedDoc(WindowInfo* win);
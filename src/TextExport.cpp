@@ -0,0 +1,216 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
+
+#include "wingui/TreeModel.h"
+
+#include "EngineBase.h"
+#include "ProgressUpdateUI.h"
+#include "TextExport.h"
+
+// The pages are extracted by worker threads (each but the first with its own clone
+// of the engine, so that they aren't serialized by the engine's locks) while the
+// calling thread writes them out in page order. The workers don't get more than
+// kMaxPendingPages ahead of the writer, so that the memory used doesn't grow with
+// the size of the document.
+
+#define MAX_TEXT_EXPORT_WORKERS 8
+
+constexpr int kMaxPendingPages = 64;
+constexpr size_t kTextExportBufferSize = 256 * 1024;
+
+struct TextExportJob {
+    EngineBase* engine = nullptr;
+    bool pageMarkers = false;
+    int nPages = 0;
+
+    CRITICAL_SECTION access;
+    // signaled when a worker has extracted a page
+    CONDITION_VARIABLE pageExtracted;
+    // signaled when the writer has freed a slot
+    CONDITION_VARIABLE pageWritten;
+    // the UTF-8 text of page pageNo is in slot pageNo % kMaxPendingPages
+    // (for pages from nextToWrite to nextToWrite + kMaxPendingPages - 1)
+    std::string_view pages[kMaxPendingPages];
+    bool extracted[kMaxPendingPages]{};
+    int nextToExtract = 1;
+    int nextToWrite = 1;
+    bool canceled = false;
+
+    TextExportJob() {
+        InitializeCriticalSection(&access);
+        InitializeConditionVariable(&pageExtracted);
+        InitializeConditionVariable(&pageWritten);
+    }
+    ~TextExportJob() {
+        for (int i = 0; i < kMaxPendingPages; i++) {
+            str::Free(pages[i].data());
+        }
+        DeleteCriticalSection(&access);
+    }
+};
+
+static std::string_view ExtractPageTextUtf8(EngineBase* engine, int pageNo, bool pageMarker) {
+    str::WStr text;
+    if (pageMarker) {
+        text.AppendFmt(L"--- Page %d ---\r\n", pageNo);
+    }
+    PageText pageText = engine->ExtractPageText(pageNo);
+    if (pageText.text != nullptr) {
+        WCHAR* tmp = str::Replace(pageText.text, L"\n", L"\r\n");
+        text.AppendAndFree(tmp);
+    }
+    FreePageText(&pageText);
+    return strconv::WstrToUtf8(text.Get(), text.size());
+}
+
+static DWORD WINAPI TextExportThread(void* data) {
+    TextExportJob* job = (TextExportJob*)data;
+    SetThreadName(GetCurrentThreadId(), "TextExport");
+
+    // the worker that claims the first page uses the original engine
+    EnterCriticalSection(&job->access);
+    bool canceled = job->canceled;
+    bool isFirst = !canceled && 1 == job->nextToExtract;
+    int pageNo = isFirst ? job->nextToExtract++ : 0;
+    LeaveCriticalSection(&job->access);
+    if (canceled) {
+        return 0;
+    }
+
+    EngineBase* engine = job->engine;
+    if (!isFirst) {
+        engine = job->engine->Clone();
+        if (!engine) {
+            return 0;
+        }
+    }
+
+    for (;;) {
+        if (pageNo > 0) {
+            std::string_view text = ExtractPageTextUtf8(engine, pageNo, job->pageMarkers);
+            EnterCriticalSection(&job->access);
+            int slot = pageNo % kMaxPendingPages;
+            job->pages[slot] = text;
+            job->extracted[slot] = true;
+            WakeAllConditionVariable(&job->pageExtracted);
+            LeaveCriticalSection(&job->access);
+        }
+
+        EnterCriticalSection(&job->access);
+        // wait for the writer to catch up
+        while (!job->canceled && job->nextToExtract <= job->nPages &&
+               job->nextToExtract >= job->nextToWrite + kMaxPendingPages) {
+            SleepConditionVariableCS(&job->pageWritten, &job->access, INFINITE);
+        }
+        bool done = job->canceled || job->nextToExtract > job->nPages;
+        pageNo = done ? 0 : job->nextToExtract++;
+        LeaveCriticalSection(&job->access);
+        if (done) {
+            break;
+        }
+    }
+
+    if (engine != job->engine) {
+        delete engine;
+    }
+    return 0;
+}
+
+static bool WriteAll(HANDLE h, std::string_view s) {
+    while (s.size() > 0) {
+        DWORD toWrite = (DWORD)std::min(s.size(), (size_t)(1024 * 1024 * 1024));
+        DWORD written = 0;
+        if (!WriteFile(h, s.data(), toWrite, &written, nullptr) || written != toWrite) {
+            return false;
+        }
+        s.remove_prefix(written);
+    }
+    return true;
+}
+
+static int GetTextExportWorkersCount(const TextExportOptions& opts, int nPages) {
+    int n = opts.nWorkers;
+    if (n <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        n = (int)si.dwNumberOfProcessors;
+    }
+    return limitValue(std::min(n, nPages), 1, MAX_TEXT_EXPORT_WORKERS);
+}
+
+bool ExportText(EngineBase* engine, const WCHAR* path, const TextExportOptions& opts, ProgressUpdateUI* progress) {
+    HANDLE fh = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+    if (INVALID_HANDLE_VALUE == fh) {
+        return false;
+    }
+    AutoCloseHandle h(fh);
+
+    TextExportJob job;
+    job.engine = engine;
+    job.pageMarkers = opts.pageMarkers;
+    job.nPages = engine->PageCount();
+
+    int nWorkers = GetTextExportWorkersCount(opts, job.nPages);
+    HANDLE workers[MAX_TEXT_EXPORT_WORKERS];
+    int nStarted = 0;
+    for (int i = 0; i < nWorkers && job.nPages > 0; i++) {
+        workers[nStarted] = CreateThread(nullptr, 0, TextExportThread, &job, 0, nullptr);
+        if (workers[nStarted]) {
+            nStarted++;
+        }
+    }
+
+    str::Str out(kTextExportBufferSize + 4096);
+    out.Append(UTF8_BOM);
+    bool ok = true;
+    for (int pageNo = 1; ok && pageNo <= job.nPages; pageNo++) {
+        std::string_view text;
+        if (0 == nStarted) {
+            // extract on this thread instead
+            text = ExtractPageTextUtf8(engine, pageNo, job.pageMarkers);
+        } else {
+            EnterCriticalSection(&job.access);
+            int slot = pageNo % kMaxPendingPages;
+            while (!job.extracted[slot]) {
+                SleepConditionVariableCS(&job.pageExtracted, &job.access, INFINITE);
+            }
+            text = job.pages[slot];
+            job.pages[slot] = {};
+            job.extracted[slot] = false;
+            job.nextToWrite = pageNo + 1;
+            WakeAllConditionVariable(&job.pageWritten);
+            LeaveCriticalSection(&job.access);
+        }
+
+        out.AppendView(text);
+        str::Free(text.data());
+        if (out.size() >= kTextExportBufferSize) {
+            ok = WriteAll(h, out.AsView());
+            out.Reset();
+        }
+        if (progress) {
+            progress->UpdateProgress(pageNo, job.nPages);
+            if (progress->WasCanceled()) {
+                ok = false;
+            }
+        }
+    }
+    if (ok) {
+        ok = WriteAll(h, out.AsView());
+    }
+
+    EnterCriticalSection(&job.access);
+    job.canceled = true;
+    WakeAllConditionVariable(&job.pageWritten);
+    LeaveCriticalSection(&job.access);
+    WaitForMultipleObjects(nStarted, workers, TRUE, INFINITE);
+    for (int i = 0; i < nStarted; i++) {
+        CloseHandle(workers[i]);
+    }
+    return ok;
+}
@@ -0,0 +1,16 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+struct ProgressUpdateUI;
+
+struct TextExportOptions {
+    // precede the text of every page with a "--- Page N ---" line
+    bool pageMarkers = false;
+    // 0 means one worker per processor
+    int nWorkers = 0;
+};
+
+// writes the text of all pages of engine to path as UTF-8 (with BOM),
+// extracting the pages in parallel on clones of engine
+bool ExportText(EngineBase* engine, const WCHAR* path, const TextExportOptions& opts,
+                ProgressUpdateUI* progress = nullptr);
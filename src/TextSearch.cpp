@@ -3,6 +3,9 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/Dict.h"
+#include "utils/Regex.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/TreeModel.h"
 
@@ -17,6 +20,23 @@
 // cf. http://code.google.com/p/sumatrapdf/issues/detail?id=959
 #define isnoncjkwordchar(c) (isWordChar(c) && (unsigned short)(c) < 0x2E80)
 
+struct TextSearchRegex {
+    Regex* re = nullptr;
+    // only used on the thread calling FindFirst/FindNext
+    RegexMatcher* matcher = nullptr;
+    // the matches within the page last searched
+    Vec<RegexMatch> pageMatches;
+    int pageNo = 0;
+    // the last match found, for changing the search direction
+    RegexMatch hit = {0, 0};
+    int hitPage = 0;
+
+    ~TextSearchRegex() {
+        delete matcher;
+        FreeRegex(re);
+    }
+};
+
 static void markAllPagesNonSkip(Vec<bool>& pagesToSkip) {
     for (size_t i = 0; i < pagesToSkip.size(); i++) {
         pagesToSkip[i] = false;
@@ -74,6 +94,10 @@ void TextSearch::SetText(const WCHAR* text) {
     } else {
         anchor = str::DupN(text, 1);
     }
+    if (anchor) {
+        foldedAnchor = str::Dup(anchor);
+        CharLowerBuffW(foldedAnchor, (DWORD)str::Len(foldedAnchor));
+    }
 
     if (str::Len(this->findText) >= INT_MAX) {
         this->findText[(unsigned)INT_MAX - 1] = '\0';
@@ -81,15 +105,37 @@ void TextSearch::SetText(const WCHAR* text) {
     if (str::EndsWith(this->findText, L" ")) {
         this->findText[str::Len(this->findText) - 1] = '\0';
     }
+    UpdateRegex();
 
     markAllPagesNonSkip(pagesToSkip);
 }
 
+// compiles findText if it's enclosed in slashes, so that e.g. "/colou?r/"
+// finds both "color" and "colour" (invalid patterns are searched for verbatim)
+void TextSearch::UpdateRegex() {
+    delete regex;
+    regex = nullptr;
+    size_t len = str::Len(findText);
+    if (len < 3 || findText[0] != '/' || findText[len - 1] != '/') {
+        return;
+    }
+    AutoFreeWstr pattern(str::DupN(findText + 1, len - 2));
+    // unless the search is case sensitive, the page's text folded to lower case is searched
+    Regex* re = CompileRegex(pattern, !caseSensitive);
+    if (!re) {
+        return;
+    }
+    regex = new TextSearchRegex();
+    regex->re = re;
+    regex->matcher = new RegexMatcher(re);
+}
+
 void TextSearch::SetSensitive(bool sensitive) {
     if (caseSensitive == sensitive) {
         return;
     }
     this->caseSensitive = sensitive;
+    UpdateRegex();
 
     markAllPagesNonSkip(pagesToSkip);
 }
@@ -100,7 +146,12 @@ void TextSearch::SetDirection(TextSearchDirection direction) {
         return;
     }
     this->forward = forward;
-    if (findText) {
+    if (regex) {
+        // continue after resp. before the last match
+        if (regex->hitPage == findPage) {
+            findIndex = forward ? regex->hit.end : regex->hit.start;
+        }
+    } else if (findText) {
         int n = (int)str::Len(findText);
         if (forward) {
             findIndex += n;
@@ -246,21 +297,39 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
     // get here with pageNo != 0 the findText has already been set so I didn't add
     // a findText = textCache->GetData(findPage) here.
     findPage = pageNo;
+    if (regex) {
+        return FindRegexInPage(pageNo, finalGlyph);
+    }
+
+    // unless the search is case sensitive, the anchor is searched for in
+    // the page's text folded to lower case (which has the same offsets)
+    const WCHAR* toFind = caseSensitive ? anchor : foldedAnchor;
+    size_t toFindLen = str::Len(anchor);
+    const WCHAR* haystack = nullptr;
+    int pageLen = 0;
+    if (anchor) {
+        if (caseSensitive) {
+            haystack = textCache->GetTextForPage(pageNo, &pageLen);
+        } else {
+            haystack = textCache->GetFoldedTextForPage(pageNo, &pageLen);
+        }
+    }
 
     const WCHAR* found;
     PageAndOffset fg;
     do {
         if (!anchor) {
             found = GetNextIndex(pageText, findIndex, forward);
-        } else if (forward) {
-            const WCHAR* s = pageText + findIndex;
-            if (caseSensitive) {
-                found = StrStr(s, anchor);
-            } else {
-                found = StrStrI(s, anchor);
-            }
         } else {
-            found = StrRStrI(pageText, pageText + findIndex, anchor);
+            const WCHAR* s = nullptr;
+            if (forward && findIndex <= pageLen) {
+                s = str::FindN(haystack + findIndex, pageLen - findIndex, toFind, toFindLen);
+            } else if (!forward && findIndex > 0) {
+                // the match has to start before findIndex
+                size_t len = std::min((size_t)findIndex - 1 + toFindLen, (size_t)pageLen);
+                s = str::FindLastN(haystack, len, toFind, toFindLen);
+            }
+            found = s ? pageText + (s - haystack) : nullptr;
         }
         if (!found) {
             return false;
@@ -286,12 +355,56 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
     return true;
 }
 
+// finds the first match starting at or after findIndex (resp. the
+// last one starting before findIndex when searching backwards)
+bool TextSearch::FindRegexInPage(int pageNo, TextSearch::PageAndOffset* finalGlyph) {
+    if (regex->pageNo != pageNo) {
+        int len = 0;
+        const WCHAR* text = nullptr;
+        if (caseSensitive) {
+            text = textCache->GetTextForPage(pageNo, &len);
+        } else {
+            text = textCache->GetFoldedTextForPage(pageNo, &len);
+        }
+        regex->pageMatches.Reset();
+        regex->matcher->FindAll(text, len, regex->pageMatches);
+        regex->pageNo = pageNo;
+    }
+
+    int n = regex->pageMatches.isize();
+    for (int i = 0; i < n; i++) {
+        RegexMatch m = regex->pageMatches.at(forward ? i : n - 1 - i);
+        if (forward ? m.start < findIndex : m.start >= findIndex) {
+            continue;
+        }
+        StartAt(pageNo, m.start);
+        SelectUpTo(pageNo, m.end);
+        // skip matches completely outside the page's mediabox
+        if (result.len == 0) {
+            continue;
+        }
+        searchHitStartAt = pageNo;
+        findIndex = forward ? m.end : m.start;
+        regex->hit = m;
+        regex->hitPage = pageNo;
+        if (finalGlyph) {
+            *finalGlyph = {pageNo, m.end};
+        }
+        return true;
+    }
+    return false;
+}
+
 bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker) {
     if (str::IsEmpty(findText)) {
         return false;
     }
 
     int next = forward ? 1 : -1;
+    if (1 <= pageNo && pageNo <= nPages) {
+        // extract the text of the pages still to be searched in parallel
+        textCache->PrefetchPages(pageNo, forward ? nPages : 1);
+    }
     while (1 <= pageNo && pageNo <= nPages && (!tracker || !tracker->WasCanceled())) {
         if (tracker) {
             tracker->UpdateProgress(pageNo, nPages);
@@ -304,7 +417,11 @@ bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker) {
 
         Reset();
 
-        pageText = textCache->GetTextForPage(pageNo, &findIndex);
+        pageText = textCache->GetTextForPage(pageNo, &findIndex, nullptr, &extractAbort);
+        if (tracker && tracker->WasCanceled()) {
+            // the page's text might be incomplete (see AbortExtraction)
+            break;
+        }
         if (pageText) {
             if (forward) {
                 findIndex = 0;
@@ -333,6 +450,8 @@ bool TextSearch::FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker) {
 }
 
 TextSel* TextSearch::FindFirst(int page, const WCHAR* text, ProgressUpdateUI* tracker) {
+    ScopedTextCachePin pin(textCache);
+    InterlockedExchange(&extractAbort.aborted, 0);
     SetText(text);
 
     if (FindStartingAtPage(page, tracker)) {
@@ -341,6 +460,177 @@ TextSel* TextSearch::FindFirst(int page, const WCHAR* text, ProgressUpdateUI* tr
     return nullptr;
 }
 
+// adds the match starting at the given glyph, if there is one
+bool TextSearch::AddHitAt(int pageNo, int offset, Vec<TextSearchHit>& hits) {
+    findPage = pageNo;
+    pageText = textCache->GetTextForPage(pageNo);
+    PageAndOffset fg = MatchEnd(pageText + offset);
+    if (fg.page <= 0) {
+        return false;
+    }
+    StartAt(pageNo, offset);
+    SelectUpTo(fg.page, fg.offset);
+    // ignore matches completely outside the page's mediabox
+    if (0 == result.len) {
+        return false;
+    }
+    hits.Append({pageNo, offset, fg.page, fg.offset, result.rects[0]});
+    return true;
+}
+
+struct RegexPagesSearch {
+    DocumentTextCache* textCache = nullptr;
+    const Regex* re = nullptr;
+    bool folded = false;
+    // the matches of all pages, with pageMatches[0] being those of page 1
+    Vec<RegexMatch>* pageMatches = nullptr;
+    LONG nextPage = 0;
+    LONG nPagesDone = 0;
+    LONG cancelled = 0;
+};
+
+static DWORD WINAPI RegexSearchThread(void* data) {
+    RegexPagesSearch* search = (RegexPagesSearch*)data;
+    SetThreadName(GetCurrentThreadId(), "RegexSearch");
+
+    // each thread uses its own matcher, as matchers aren't thread-safe
+    RegexMatcher matcher(search->re);
+    int nPages = search->textCache->nPages;
+    for (;;) {
+        int pageNo = (int)InterlockedIncrement(&search->nextPage);
+        if (pageNo > nPages || InterlockedAdd(&search->cancelled, 0) > 0) {
+            break;
+        }
+        ScopedTextCachePin pin(search->textCache);
+        int len = 0;
+        const WCHAR* text = nullptr;
+        if (search->folded) {
+            text = search->textCache->GetFoldedTextForPage(pageNo, &len);
+        } else {
+            text = search->textCache->GetTextForPage(pageNo, &len);
+        }
+        matcher.FindAll(text, len, search->pageMatches[pageNo - 1]);
+        InterlockedIncrement(&search->nPagesDone);
+    }
+    return 0;
+}
+
+// matches the text of all pages in parallel (note: matches can't span several pages)
+void TextSearch::FindAllRegex(Vec<TextSearchHit>& hits, ProgressUpdateUI* tracker) {
+    textCache->PrefetchPages(1, nPages);
+
+    RegexPagesSearch search;
+    search.textCache = textCache;
+    search.re = regex->re;
+    search.folded = !caseSensitive;
+    search.pageMatches = new Vec<RegexMatch>[nPages];
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int nThreads = limitValue((int)si.dwNumberOfProcessors, 1, MAX_TEXT_PREFETCH_THREADS);
+    nThreads = std::min(nThreads, nPages);
+    HANDLE threads[MAX_TEXT_PREFETCH_THREADS];
+    int n = 0;
+    for (int i = 0; i < nThreads; i++) {
+        threads[n] = CreateThread(nullptr, 0, RegexSearchThread, &search, 0, nullptr);
+        if (threads[n]) {
+            n++;
+        }
+    }
+    if (0 == n) {
+        RegexSearchThread(&search);
+    }
+    while (n > 0 && WaitForMultipleObjects(n, threads, TRUE, 100) == WAIT_TIMEOUT) {
+        if (!tracker) {
+            continue;
+        }
+        if (tracker->WasCanceled()) {
+            InterlockedIncrement(&search.cancelled);
+        } else {
+            tracker->UpdateProgress(std::max((int)search.nPagesDone, 1), nPages);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        CloseHandle(threads[i]);
+    }
+
+    if (!search.cancelled) {
+        for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+            for (RegexMatch& m : search.pageMatches[pageNo - 1]) {
+                StartAt(pageNo, m.start);
+                SelectUpTo(pageNo, m.end);
+                // ignore matches completely outside the page's mediabox
+                if (result.len > 0) {
+                    hits.Append({pageNo, m.start, pageNo, m.end, result.rects[0]});
+                }
+            }
+        }
+    }
+    delete[] search.pageMatches;
+}
+
+void TextSearch::FindAll(const WCHAR* text, Vec<TextSearchHit>& hits, DocumentWordIndex* index,
+                         ProgressUpdateUI* tracker) {
+    ScopedTextCachePin pin(textCache);
+    SetText(text);
+    if (str::IsEmpty(findText)) {
+        return;
+    }
+    forward = true;
+    if (regex) {
+        FindAllRegex(hits, tracker);
+        return;
+    }
+
+    // matches don't overlap (as with FindNext), so candidates
+    // before the end of the previous match are skipped
+    int pageNo = 1;
+    TextIndexPos lastEnd = {0, 0};
+    auto isAfterLastEnd = [&lastEnd](int pageNo, int offset) {
+        return pageNo > lastEnd.pageNo || (pageNo == lastEnd.pageNo && offset >= lastEnd.offset);
+    };
+
+    // the anchor consists of word characters only, so all its occurrences are within indexed words
+    if (index && anchor && isnoncjkwordchar(*anchor)) {
+        Vec<TextIndexPos> candidates;
+        int nIndexed = index->FindOccurrences(foldedAnchor, candidates);
+        for (TextIndexPos& pos : candidates) {
+            if (tracker && tracker->WasCanceled()) {
+                return;
+            }
+            if (isAfterLastEnd(pos.pageNo, pos.offset) && AddHitAt(pos.pageNo, pos.offset, hits)) {
+                lastEnd = {hits.Last().endPage, hits.Last().endGlyph};
+            }
+        }
+        pageNo = nIndexed + 1;
+    }
+
+    for (; pageNo <= nPages; pageNo++) {
+        if (tracker) {
+            if (tracker->WasCanceled()) {
+                return;
+            }
+            tracker->UpdateProgress(pageNo, nPages);
+        }
+        Reset();
+        pageText = textCache->GetTextForPage(pageNo);
+        findIndex = lastEnd.pageNo == pageNo ? lastEnd.offset : 0;
+        PageAndOffset fg;
+        while (FindTextInPage(pageNo, &fg)) {
+            hits.Append({startPage, startGlyph, endPage, endGlyph, result.rects[0]});
+            lastEnd = {fg.page, fg.offset};
+            // the rest of the page has been searched before a match spanning several pages
+            if (fg.page != pageNo) {
+                break;
+            }
+        }
+    }
+}
+
+void TextSearch::AbortExtraction() {
+    textCache->AbortExtraction(&extractAbort);
+}
+
 TextSel* TextSearch::FindNext(ProgressUpdateUI* tracker) {
     CrashIf(!findText);
     if (!findText) {
@@ -354,6 +644,13 @@ TextSel* TextSearch::FindNext(ProgressUpdateUI* tracker) {
         tracker->UpdateProgress(findPage, nPages);
     }
 
+    ScopedTextCachePin pin(textCache);
+    InterlockedExchange(&extractAbort.aborted, 0);
+    // the page's text might have been evicted since the last search
+    if (1 <= findPage && findPage <= nPages) {
+        pageText = textCache->GetTextForPage(findPage);
+    }
+
     PageAndOffset finalGlyph;
     if (FindTextInPage(findPage, &finalGlyph)) {
         if (forward) {
@@ -370,3 +667,112 @@ TextSel* TextSearch::FindNext(ProgressUpdateUI* tracker) {
     }
     return nullptr;
 }
+
+DocumentWordIndex::DocumentWordIndex(DocumentTextCache* textCache) : textCache(textCache) {
+    wordIndexes = new dict::MapWStrToInt(4096);
+    InitializeCriticalSection(&access);
+}
+
+DocumentWordIndex::~DocumentWordIndex() {
+    StopIndexing();
+    for (IndexedWord& iw : words) {
+        free(iw.word);
+    }
+    delete wordIndexes;
+    DeleteCriticalSection(&access);
+}
+
+void DocumentWordIndex::IndexPage(int pageNo, const WCHAR* text, int len) {
+    ScopedCritSec scope(&access);
+    for (int i = 0; i < len; i++) {
+        if (!isnoncjkwordchar(text[i])) {
+            continue;
+        }
+        int start = i;
+        while (i < len && isnoncjkwordchar(text[i])) {
+            i++;
+        }
+        AutoFreeWstr word(str::DupN(text + start, i - start));
+        CharLowerBuffW(word, (DWORD)(i - start));
+
+        int wordIdx;
+        if (!wordIndexes->Get(word, &wordIdx)) {
+            wordIdx = words.isize();
+            wordIndexes->Insert(word, wordIdx, nullptr);
+            words.Append({word.StealData(), i - start, -1, -1});
+        }
+        int postingIdx = postings.isize();
+        postings.Append({pageNo, start, -1});
+        IndexedWord& iw = words.at(wordIdx);
+        if (iw.last < 0) {
+            iw.first = postingIdx;
+        } else {
+            postings.at(iw.last).next = postingIdx;
+        }
+        iw.last = postingIdx;
+    }
+    nPagesIndexed = pageNo;
+}
+
+DWORD WINAPI DocumentWordIndex::IndexThread(void* data) {
+    DocumentWordIndex* index = (DocumentWordIndex*)data;
+    SetThreadName(GetCurrentThreadId(), "WordIndex");
+
+    // nPagesIndexed is only modified on this thread
+    int nPages = index->textCache->nPages;
+    for (int pageNo = index->nPagesIndexed + 1; pageNo <= nPages; pageNo++) {
+        if (InterlockedAdd(&index->cancelled, 0) > 0) {
+            break;
+        }
+        ScopedTextCachePin pin(index->textCache);
+        int len = 0;
+        const WCHAR* text = index->textCache->GetTextForPage(pageNo, &len);
+        index->IndexPage(pageNo, text, len);
+    }
+    return 0;
+}
+
+void DocumentWordIndex::StartIndexing() {
+    if (thread && WaitForSingleObject(thread, 0) == WAIT_TIMEOUT) {
+        return;
+    }
+    StopIndexing();
+    if (nPagesIndexed >= textCache->nPages) {
+        return;
+    }
+    cancelled = 0;
+    thread = CreateThread(nullptr, 0, IndexThread, this, 0, nullptr);
+}
+
+void DocumentWordIndex::StopIndexing() {
+    if (!thread) {
+        return;
+    }
+    InterlockedIncrement(&cancelled);
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    thread = nullptr;
+}
+
+int DocumentWordIndex::FindOccurrences(const WCHAR* word, Vec<TextIndexPos>& res) {
+    ScopedCritSec scope(&access);
+    int wordLen = (int)str::Len(word);
+    size_t nFound = res.size();
+    for (IndexedWord& iw : words) {
+        if (iw.len < wordLen) {
+            continue;
+        }
+        // word might occur several times within an indexed word
+        for (const WCHAR* s = wcsstr(iw.word, word); s; s = wcsstr(s + 1, word)) {
+            int delta = (int)(s - iw.word);
+            for (int i = iw.first; i >= 0; i = postings.at(i).next) {
+                WordPosting& p = postings.at(i);
+                res.Append({p.pageNo, p.offset + delta});
+            }
+        }
+    }
+    std::sort(res.begin() + nFound, res.end(), [](const TextIndexPos& a, const TextIndexPos& b) {
+        return a.pageNo < b.pageNo || (a.pageNo == b.pageNo && a.offset < b.offset);
+    });
+    return nPagesIndexed;
+}
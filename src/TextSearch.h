@@ -3,6 +3,72 @@
 
 enum class TextSearchDirection : bool { Backward = false, Forward = true };
 
+namespace dict {
+class MapWStrToInt;
+}
+
+struct TextSearchRegex;
+
+// a match found by TextSearch::FindAll
+struct TextSearchHit {
+    int startPage;
+    int startGlyph;
+    int endPage;
+    int endGlyph;
+    // bounding box of the match's first glyphs
+    Rect rect;
+};
+
+struct TextIndexPos {
+    int pageNo;
+    int offset;
+};
+
+// word-level inverted index over the text of a document's pages, so that finding all
+// matches takes time proportional to the number of matches instead of the document's size.
+// the index is built in page order on a background thread and can be used while incomplete
+class DocumentWordIndex {
+  public:
+    explicit DocumentWordIndex(DocumentTextCache* textCache);
+    ~DocumentWordIndex();
+
+    // indexes the pages which haven't been indexed yet
+    void StartIndexing();
+    void StopIndexing();
+
+    // appends the positions of all occurences of the (lowercase) word within indexed words
+    // in page order and returns the number of pages indexed so far (starting at page 1)
+    int FindOccurrences(const WCHAR* word, Vec<TextIndexPos>& res);
+
+  private:
+    struct IndexedWord {
+        WCHAR* word;
+        int len;
+        // first and last of the word's postings (chained through WordPosting::next)
+        int first;
+        int last;
+    };
+    struct WordPosting {
+        int pageNo;
+        int offset;
+        int next;
+    };
+
+    DocumentTextCache* textCache = nullptr;
+    // guards all the following
+    CRITICAL_SECTION access;
+    dict::MapWStrToInt* wordIndexes = nullptr;
+    Vec<IndexedWord> words;
+    Vec<WordPosting> postings;
+    int nPagesIndexed = 0;
+
+    HANDLE thread = nullptr;
+    LONG cancelled = 0;
+
+    void IndexPage(int pageNo, const WCHAR* text, int len);
+    static DWORD WINAPI IndexThread(void* data);
+};
+
 class TextSearch : public TextSelection {
   public:
     TextSearch(EngineBase* engine, DocumentTextCache* textCache);
@@ -11,8 +77,18 @@ class TextSearch : public TextSelection {
     void SetSensitive(bool sensitive);
     void SetDirection(TextSearchDirection direction);
     void SetLastResult(TextSelection* sel);
+    // search text enclosed in slashes (e.g. "/colou?r|grey/") is matched as a regular
+    // expression (cf. utils/Regex.h), unless it isn't a supported one
     TextSel* FindFirst(int page, const WCHAR* text, ProgressUpdateUI* tracker = nullptr);
     TextSel* FindNext(ProgressUpdateUI* tracker = nullptr);
+    // appends all matches from the first to the last page, using index for
+    // the pages it has already indexed (if text starts with a word)
+    void FindAll(const WCHAR* text, Vec<TextSearchHit>& hits, DocumentWordIndex* index = nullptr,
+                 ProgressUpdateUI* tracker = nullptr);
+
+    // aborts the text extraction FindFirst/FindNext (on another thread) are waiting for,
+    // they then stop once they see the tracker being canceled
+    void AbortExtraction();
 
     // note: the result might not be a valid page number!
     int GetCurrentPageNo() const {
@@ -33,6 +109,8 @@ class TextSearch : public TextSelection {
 
     WCHAR* findText = nullptr;
     WCHAR* anchor = nullptr;
+    // anchor in lower case, for case insensitive searches
+    WCHAR* foldedAnchor = nullptr;
     int findPage = 0;
     int searchHitStartAt = 0; // when text found spans several pages, searchHitStartAt < findPage
     bool forward = true;
@@ -42,16 +120,24 @@ class TextSearch : public TextSelection {
     // combining them yields a 'Whole words' search
     bool matchWordStart = false;
     bool matchWordEnd = false;
+    // set if findText is a regular expression
+    TextSearchRegex* regex = nullptr;
 
     void SetText(const WCHAR* text);
     bool FindTextInPage(int pageNo, PageAndOffset* finalGlyph);
+    bool FindRegexInPage(int pageNo, PageAndOffset* finalGlyph);
+    void FindAllRegex(Vec<TextSearchHit>& hits, ProgressUpdateUI* tracker);
+    void UpdateRegex();
     bool FindStartingAtPage(int pageNo, ProgressUpdateUI* tracker);
     PageAndOffset MatchEnd(const WCHAR* start) const;
+    bool AddHitAt(int pageNo, int offset, Vec<TextSearchHit>& hits);
 
     void Clear() {
         str::ReplacePtr(&findText, nullptr);
         str::ReplacePtr(&anchor, nullptr);
+        str::ReplacePtr(&foldedAnchor, nullptr);
         str::ReplacePtr(&lastText, nullptr);
+        UpdateRegex();
         Reset();
     }
     void Reset();
@@ -63,4 +149,5 @@ class TextSearch : public TextSelection {
     WCHAR* lastText = nullptr;
     int nPages = 0;
     Vec<bool> pagesToSkip;
+    TextExtractionAbort extractAbort;
 };
@@ -3,11 +3,14 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Trace.h"
 
 #include "wingui/TreeModel.h"
 
 #include "Annotation.h"
 #include "EngineBase.h"
+#include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 
 uint distSq(int x, int y) {
@@ -18,26 +21,265 @@ bool isWordChar(WCHAR c) {
     return IsCharAlphaNumeric(c) || c == '_';
 }
 
+#define DEFAULT_TEXT_CACHE_SIZE (64 * 1024 * 1024)
+// the text of pages this close to the visible ones is never evicted
+#define TEXT_CACHE_KEEP_PAGES 8
+
+static size_t gMaxTextCacheSize = DEFAULT_TEXT_CACHE_SIZE;
+
+void SetTextCacheSizeMB(int sizeMB) {
+    gMaxTextCacheSize = sizeMB > 0 ? (size_t)sizeMB * 1024 * 1024 : DEFAULT_TEXT_CACHE_SIZE;
+}
+
+// set while no pages are being rendered or waiting to be rendered
+static HANDLE gRenderingIdle = CreateEventW(nullptr, TRUE, TRUE, nullptr);
+
+void SetRenderingIdle(bool isIdle) {
+    if (isIdle) {
+        SetEvent(gRenderingIdle);
+    } else {
+        ResetEvent(gRenderingIdle);
+    }
+}
+
+bool WaitForRenderingIdle(DWORD timeoutMs) {
+    return WaitForSingleObject(gRenderingIdle, timeoutMs) == WAIT_OBJECT_0;
+}
+
+// a glyph can be added to a run if it's on the same line and its x offset fits into 16 bits
+static bool FitsRun(const GlyphCoords::Run& run, const Rect& r) {
+    return r.y == run.y && r.dy == run.dy && r.x >= run.x && (i64)r.x - run.x <= UINT16_MAX;
+}
+
+void GlyphCoords::Set(const Rect* coords, int n) {
+    Free();
+    len = n;
+    bool fits = true;
+    int nRunsNeeded = 0;
+    Run run{};
+    for (int i = 0; i < n && fits; i++) {
+        Rect r = coords ? coords[i] : Rect();
+        fits = r.dx >= 0 && r.dx <= UINT16_MAX;
+        if (0 == i || !FitsRun(run, r)) {
+            run = {i, r.x, r.y, r.dy};
+            nRunsNeeded++;
+        }
+    }
+    if (0 == n) {
+        return;
+    }
+    if (!fits) {
+        rects = AllocArray<Rect>(n);
+        memcpy(rects, coords, n * sizeof(Rect));
+        SetLines(coords);
+        return;
+    }
+
+    runs = AllocArray<Run>(nRunsNeeded);
+    glyphs = AllocArray<Glyph>(n);
+    for (int i = 0; i < n; i++) {
+        Rect r = coords ? coords[i] : Rect();
+        if (0 == i || !FitsRun(runs[nRuns - 1], r)) {
+            runs[nRuns++] = {i, r.x, r.y, r.dy};
+        }
+        glyphs[i] = {(u16)(r.x - runs[nRuns - 1].x), (u16)r.dx};
+    }
+    CrashIf(nRuns != nRunsNeeded);
+    SetLines(coords);
+}
+
+void GlyphCoords::SetLines(const Rect* coords) {
+    if (!coords) {
+        return;
+    }
+    Vec<Line> v;
+    for (int i = 0; i < len; i++) {
+        Rect r = coords[i];
+        // skip line breaks
+        if (!r.x && !r.dx) {
+            continue;
+        }
+        int centerX = r.x + r.dx / 2;
+        int x0 = std::min(r.x, r.x + r.dx);
+        int x1 = std::max(r.x, r.x + r.dx);
+        Line* line = v.size() > 0 ? &v.Last() : nullptr;
+        if (line && line->endGlyph == i && line->bbox.y == r.y && line->bbox.dy == r.dy) {
+            line->endGlyph = i + 1;
+            line->minCenterX = std::min(line->minCenterX, centerX);
+            line->maxCenterX = std::max(line->maxCenterX, centerX);
+            x1 = std::max(x1, line->bbox.x + line->bbox.dx);
+            line->bbox.x = std::min(x0, line->bbox.x);
+            line->bbox.dx = x1 - line->bbox.x;
+            continue;
+        }
+        v.Append({i, i + 1, r.y + r.dy / 2, centerX, centerX, Rect(x0, r.y, x1 - x0, r.dy)});
+        maxLineDy = std::max(maxLineDy, abs(r.dy));
+    }
+    std::sort(v.begin(), v.end(), [](const Line& a, const Line& b) {
+        if (a.centerY != b.centerY) {
+            return a.centerY < b.centerY;
+        }
+        return a.firstGlyph < b.firstGlyph;
+    });
+    nLines = v.isize();
+    lines = AllocArray<Line>(nLines);
+    memcpy(lines, v.LendData(), nLines * sizeof(Line));
+}
+
+void GlyphCoords::Free() {
+    free(runs);
+    free(glyphs);
+    free(rects);
+    free(lines);
+    runs = nullptr;
+    glyphs = nullptr;
+    rects = nullptr;
+    lines = nullptr;
+    nRuns = 0;
+    nLines = 0;
+    maxLineDy = 0;
+    len = 0;
+}
+
+Rect GlyphCoords::At(int glyph) const {
+    CrashIf(glyph < 0 || glyph >= len);
+    if (rects) {
+        return rects[glyph];
+    }
+    // find the last run starting at or before glyph
+    int lo = 0;
+    int hi = nRuns - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (runs[mid].firstGlyph <= glyph) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    const Run& run = runs[lo];
+    const Glyph& g = glyphs[glyph];
+    return Rect(run.x + g.x, run.y, g.dx, run.dy);
+}
+
+// glyphs are compared by the distance of their center to pt, then by their
+// index (as the first one of several at the same distance used to be found)
+void GlyphCoords::FindNearestInLine(const Line& line, Point pt, int* best, uint* bestDist) const {
+    for (int i = line.firstGlyph; i < line.endGlyph; i++) {
+        Rect r = At(i);
+        uint dist = distSq(pt.x - r.x - r.dx / 2, pt.y - r.y - r.dy / 2);
+        if (dist < *bestDist || (dist == *bestDist && i < *best)) {
+            *best = i;
+            *bestDist = dist;
+        }
+    }
+}
+
+// the first line with centerY >= y
+static int FindFirstLineAt(const GlyphCoords::Line* lines, int nLines, int y) {
+    auto end = lines + nLines;
+    auto it = std::lower_bound(lines, end, y, [](const GlyphCoords::Line& l, int v) { return l.centerY < v; });
+    return (int)(it - lines);
+}
+
+int GlyphCoords::FindNearest(PointF pt) const {
+    Point pti = ToPoint(pt);
+    Point ptc((int)pt.x, (int)pt.y);
+    int best = -1;
+    uint bestDist = UINT_MAX;
+
+    // lines the point can be over are within maxLineDy of it
+    int from = FindFirstLineAt(lines, nLines, pti.y - maxLineDy);
+    for (int l = from; l < nLines && lines[l].centerY <= pti.y + maxLineDy; l++) {
+        const Line& line = lines[l];
+        if (!line.bbox.Contains(pti)) {
+            continue;
+        }
+        for (int i = line.firstGlyph; i < line.endGlyph; i++) {
+            Rect r = At(i);
+            if (!r.Contains(pti)) {
+                continue;
+            }
+            uint dist = distSq(ptc.x - r.x - r.dx / 2, ptc.y - r.y - r.dy / 2);
+            if (dist < bestDist || (dist == bestDist && i < best)) {
+                best = i;
+                bestDist = dist;
+            }
+        }
+    }
+    if (best != -1) {
+        return best;
+    }
+
+    // search outwards from the point's line (in both directions) until
+    // the lines' vertical distance alone is larger than the best distance
+    int mid = FindFirstLineAt(lines, nLines, ptc.y);
+    for (int dir = 0; dir < 2; dir++) {
+        int step = dir == 0 ? 1 : -1;
+        for (int l = dir == 0 ? mid : mid - 1; l >= 0 && l < nLines; l += step) {
+            const Line& line = lines[l];
+            i64 dy = line.centerY - ptc.y;
+            if ((u64)(dy * dy) > bestDist) {
+                break;
+            }
+            i64 dx = 0;
+            if (ptc.x < line.minCenterX) {
+                dx = line.minCenterX - ptc.x;
+            } else if (ptc.x > line.maxCenterX) {
+                dx = ptc.x - line.maxCenterX;
+            }
+            if ((u64)(dx * dx + dy * dy) > bestDist) {
+                continue;
+            }
+            FindNearestInLine(line, ptc, &best, &bestDist);
+        }
+    }
+    return best;
+}
+
+size_t GlyphCoords::MemSize() const {
+    size_t size = nLines * sizeof(Line);
+    if (rects) {
+        return size + len * sizeof(Rect);
+    }
+    return size + nRuns * sizeof(Run) + len * sizeof(Glyph);
+}
+
 DocumentTextCache::DocumentTextCache(EngineBase* engine) : engine(engine) {
     nPages = engine->PageCount();
     pagesText = AllocArray<PageText>(nPages);
-    debugSize = nPages * (sizeof(Rect*) + sizeof(WCHAR*) + sizeof(int));
+    pagesCoords = AllocArray<GlyphCoords>(nPages);
+    extracting = AllocArray<bool>(nPages);
+    foldedTexts = AllocArray<WCHAR*>(nPages);
+    lastUsed = AllocArray<u32>(nPages);
+    debugSize = nPages * (sizeof(PageText) + sizeof(GlyphCoords) + sizeof(WCHAR*) + sizeof(bool));
 
     InitializeCriticalSection(&access);
+    InitializeCriticalSection(&prefetchAccess);
+    InitializeConditionVariable(&pageExtracted);
 }
 
 DocumentTextCache::~DocumentTextCache() {
+    StopExtractingInBackground();
+    StopPrefetching();
     EnterCriticalSection(&access);
 
     int nPages = engine->PageCount();
     for (int i = 0; i < nPages; i++) {
         PageText* pageText = &pagesText[i];
-        free(pageText->coords);
         free(pageText->text);
+        pagesCoords[i].Free();
+        free(foldedTexts[i]);
     }
+    free(foldedTexts);
     free(pagesText);
+    free(pagesCoords);
+    free(lastUsed);
+    free(extracting);
+    delete store;
     LeaveCriticalSection(&access);
     DeleteCriticalSection(&access);
+    DeleteCriticalSection(&prefetchAccess);
 }
 
 bool DocumentTextCache::HasTextForPage(int pageNo) {
@@ -46,30 +288,392 @@ bool DocumentTextCache::HasTextForPage(int pageNo) {
     return pageText->text != nullptr;
 }
 
-const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Rect** coordsOut) {
-    CrashIf(pageNo < 1 || pageNo > nPages);
+size_t DocumentTextCache::GetMemoryUsage(int* nPagesOut) {
+    ScopedCritSec scope(&access);
+    if (nPagesOut) {
+        *nPagesOut = nPagesCached;
+    }
+    return (size_t)debugSize;
+}
+
+// returned for pages whose extraction has been aborted (the text isn't cached then)
+static WCHAR gAbortedText[1] = {};
+static PageText gAbortedPageText = {gAbortedText, nullptr, 0};
+static GlyphCoords gAbortedCoords;
+
+static bool IsAborted(TextExtractionAbort* abort) {
+    return abort && InterlockedAdd(&abort->aborted, 0) != 0;
+}
 
+// extracts the text of a page unless that's already been done
+// or is being done on another thread, in which case it waits for that
+// (unless wait is false, then nullptr is returned instead)
+PageText* DocumentTextCache::ExtractTextForPage(EngineBase* engine, int pageNo, bool wait, TextExtractionAbort* abort) {
     ScopedCritSec scope(&access);
+    lastUsed[pageNo - 1] = ++useCount;
     PageText* pageText = &pagesText[pageNo - 1];
+    while (!pageText->text && extracting[pageNo - 1]) {
+        if (!wait) {
+            return nullptr;
+        }
+        if (IsAborted(abort)) {
+            return &gAbortedPageText;
+        }
+        SleepConditionVariableCS(&pageExtracted, &access, INFINITE);
+    }
+    if (pageText->text) {
+        return pageText;
+    }
+    if (IsAborted(abort)) {
+        return &gAbortedPageText;
+    }
+
+    extracting[pageNo - 1] = true;
+    LeaveCriticalSection(&access);
+    PageText res;
+    bool isStored = store && store->GetPageText(pageNo, res);
+    if (!isStored) {
+        res = engine->ExtractPageText(pageNo, abort ? &abort->cookie : nullptr);
+    }
+    if (!res.text) {
+        res.len = 0;
+    }
+    GlyphCoords coords;
+    coords.Set(res.coords, res.len);
+    free(res.coords);
+    res.coords = nullptr;
 
+    EnterCriticalSection(&access);
+    extracting[pageNo - 1] = false;
+    if (abort) {
+        delete abort->cookie;
+        abort->cookie = nullptr;
+    }
+    // engines return no text when aborted (text extracted completely is kept, though)
+    if (IsAborted(abort) && !res.text) {
+        coords.Free();
+        WakeAllConditionVariable(&pageExtracted);
+        return &gAbortedPageText;
+    }
+    if (!isStored) {
+        nPagesExtracted++;
+    }
+
+    *pageText = res;
     if (!pageText->text) {
-        *pageText = engine->ExtractPageText(pageNo);
-        if (!pageText->text) {
-            pageText->text = str::Dup(L"");
-            pageText->len = 0;
-        }
-        debugSize += (pageText->len + 1) * (sizeof(WCHAR) + sizeof(Rect));
+        pageText->text = str::Dup(L"");
     }
+    pagesCoords[pageNo - 1] = coords;
+    nPagesCached++;
+    size_t size = (pageText->len + 1) * sizeof(WCHAR) + coords.MemSize();
+    cachedSize += size;
+    debugSize += (int)size;
+    WakeAllConditionVariable(&pageExtracted);
+    return pageText;
+}
+
+const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, const GlyphCoords** coordsOut,
+                                              TextExtractionAbort* abort) {
+    TRACE_ZONE("DocumentTextCache::GetTextForPage");
+    CrashIf(pageNo < 1 || pageNo > nPages);
+
+    PageText* pageText = ExtractTextForPage(engine, pageNo, true, abort);
 
     if (lenOut) {
         *lenOut = pageText->len;
     }
     if (coordsOut) {
-        *coordsOut = pageText->coords;
+        *coordsOut = pageText == &gAbortedPageText ? &gAbortedCoords : &pagesCoords[pageNo - 1];
     }
     return pageText->text;
 }
 
+const WCHAR* DocumentTextCache::GetFoldedTextForPage(int pageNo, int* lenOut) {
+    int len = 0;
+    const WCHAR* text = GetTextForPage(pageNo, &len);
+
+    ScopedCritSec scope(&access);
+    WCHAR*& folded = foldedTexts[pageNo - 1];
+    if (!folded) {
+        folded = str::DupN(text, len);
+        CharLowerBuffW(folded, (DWORD)len);
+        cachedSize += (len + 1) * sizeof(WCHAR);
+        debugSize += (len + 1) * sizeof(WCHAR);
+    }
+    if (lenOut) {
+        *lenOut = len;
+    }
+    return folded;
+}
+
+void DocumentTextCache::SetStore(PageTextStore* newStore) {
+    StopExtractingInBackground();
+    StopPrefetching();
+    ScopedCritSec scope(&access);
+    delete store;
+    store = newStore;
+}
+
+void DocumentTextCache::AbortExtraction(TextExtractionAbort* abort) {
+    // the cookie is only deleted while holding access (see ExtractTextForPage)
+    ScopedCritSec scope(&access);
+    InterlockedExchange(&abort->aborted, 1);
+    if (abort->cookie) {
+        abort->cookie->Abort();
+    }
+    // for threads waiting for another thread's extraction
+    WakeAllConditionVariable(&pageExtracted);
+}
+
+void DocumentTextCache::KeepPagesFrom(DocumentTextCache* prev, const Vec<int>& unchangedPages) {
+    prev->StopExtractingInBackground();
+    prev->StopPrefetching();
+    ScopedCritSec scopePrev(&prev->access);
+    ScopedCritSec scope(&access);
+    for (int pageNo : unchangedPages) {
+        if (pageNo > nPages || pageNo > prev->nPages) {
+            continue;
+        }
+        int idx = pageNo - 1;
+        PageText* pageText = &prev->pagesText[idx];
+        if (!pageText->text || pagesText[idx].text || extracting[idx]) {
+            continue;
+        }
+        size_t size = (pageText->len + 1) * sizeof(WCHAR) + prev->pagesCoords[idx].MemSize();
+        pagesText[idx] = *pageText;
+        pagesCoords[idx] = prev->pagesCoords[idx];
+        nPagesCached++;
+        cachedSize += size;
+        debugSize += (int)size;
+
+        // prev no longer owns the text (its folded text is simply recreated if needed)
+        *pageText = PageText{};
+        prev->pagesCoords[idx] = GlyphCoords{};
+        prev->nPagesCached--;
+        prev->cachedSize -= size;
+        prev->debugSize -= (int)size;
+    }
+}
+
+// must be called while holding access
+void DocumentTextCache::FreeTextForPage(int pageNo) {
+    PageText* pageText = &pagesText[pageNo - 1];
+    size_t size = (pageText->len + 1) * sizeof(WCHAR) + pagesCoords[pageNo - 1].MemSize();
+    if (foldedTexts[pageNo - 1]) {
+        size += (pageText->len + 1) * sizeof(WCHAR);
+    }
+    cachedSize -= size;
+    debugSize -= (int)size;
+
+    free(pageText->text);
+    pageText->text = nullptr;
+    pageText->len = 0;
+    nPagesCached--;
+    pagesCoords[pageNo - 1].Free();
+    free(foldedTexts[pageNo - 1]);
+    foldedTexts[pageNo - 1] = nullptr;
+}
+
+void DocumentTextCache::EvictPages(int firstVisiblePage, int lastVisiblePage, bool evictAll) {
+    ScopedCritSec scope(&access);
+    if ((cachedSize <= gMaxTextCacheSize && !evictAll) || nPins > 0) {
+        return;
+    }
+
+    Vec<int> candidates;
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        bool isNear = firstVisiblePage - TEXT_CACHE_KEEP_PAGES <= pageNo &&
+                      pageNo <= lastVisiblePage + TEXT_CACHE_KEEP_PAGES;
+        if (pagesText[pageNo - 1].text && !isNear) {
+            candidates.Append(pageNo);
+        }
+    }
+    // pages stored on disk are the cheapest to get back, so they're evicted first
+    auto isStored = [this](int pageNo) { return store && store->HasPageText(pageNo); };
+    std::sort(candidates.begin(), candidates.end(), [&](int a, int b) {
+        bool aStored = isStored(a);
+        bool bStored = isStored(b);
+        if (aStored != bStored) {
+            return aStored;
+        }
+        return lastUsed[a - 1] < lastUsed[b - 1];
+    });
+
+    // evict a bit more than necessary, so that this doesn't happen again for every page
+    size_t targetSize = evictAll ? 0 : gMaxTextCacheSize / 4 * 3;
+    for (int pageNo : candidates) {
+        if (cachedSize <= targetSize) {
+            break;
+        }
+        FreeTextForPage(pageNo);
+    }
+}
+
+void DocumentTextCache::Pin() {
+    ScopedCritSec scope(&access);
+    nPins++;
+}
+
+void DocumentTextCache::Unpin() {
+    ScopedCritSec scope(&access);
+    CrashIf(nPins <= 0);
+    nPins--;
+}
+
+DWORD WINAPI DocumentTextCache::PrefetchThread(void* data) {
+    TextPrefetchWorker* worker = (TextPrefetchWorker*)data;
+    DocumentTextCache* cache = worker->cache;
+    SetThreadName(GetCurrentThreadId(), "TextPrefetch");
+
+    // the first worker shares the document's engine, the others use a clone each
+    // so that they aren't serialized by the engine's locks
+    EngineBase* engine = cache->engine;
+    if (worker != &cache->prefetchWorkers[0]) {
+        engine = cache->engine->Clone();
+        if (!engine) {
+            return 0;
+        }
+    }
+
+    int n = std::abs(cache->prefetchEnd - cache->prefetchStart) + 1;
+    int dir = cache->prefetchEnd >= cache->prefetchStart ? 1 : -1;
+    for (;;) {
+        LONG idx = InterlockedIncrement(&cache->prefetchNext) - 1;
+        if (idx >= n || InterlockedAdd(&cache->prefetchCancelled, 0) > 0) {
+            break;
+        }
+        int pageNo = cache->prefetchStart + idx * dir;
+        if (!cache->HasTextForPage(pageNo)) {
+            cache->ExtractTextForPage(engine, pageNo, false, &worker->abort);
+        }
+    }
+
+    if (engine != cache->engine) {
+        delete engine;
+    }
+    return 0;
+}
+
+void DocumentTextCache::PrefetchPages(int startPage, int endPage) {
+    ScopedCritSec scope(&prefetchAccess);
+    startPage = limitValue(startPage, 1, nPages);
+    endPage = limitValue(endPage, 1, nPages);
+    if (nPrefetchWorkers > 0) {
+        // keep going if the pages are already (being) prefetched
+        bool sameDir = (endPage >= startPage) == (prefetchEnd >= prefetchStart);
+        bool contained = std::abs(endPage - startPage) <= std::abs(prefetchEnd - prefetchStart);
+        if (sameDir && prefetchEnd == endPage && contained) {
+            return;
+        }
+        StopPrefetching();
+    }
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    // leave one processor for the thread that searches through the text
+    int n = limitValue((int)si.dwNumberOfProcessors - 1, 1, MAX_TEXT_PREFETCH_THREADS);
+    n = std::min(n, std::abs(endPage - startPage) + 1);
+
+    prefetchStart = startPage;
+    prefetchEnd = endPage;
+    prefetchNext = 0;
+    prefetchCancelled = 0;
+    for (int i = 0; i < n; i++) {
+        TextPrefetchWorker* worker = &prefetchWorkers[i];
+        worker->cache = this;
+        worker->abort = TextExtractionAbort{};
+        worker->thread = CreateThread(nullptr, 0, PrefetchThread, worker, 0, nullptr);
+        if (!worker->thread) {
+            break;
+        }
+        nPrefetchWorkers++;
+    }
+}
+
+void DocumentTextCache::StopPrefetching() {
+    ScopedCritSec scope(&prefetchAccess);
+    if (0 == nPrefetchWorkers) {
+        return;
+    }
+    InterlockedIncrement(&prefetchCancelled);
+    for (int i = 0; i < nPrefetchWorkers; i++) {
+        AbortExtraction(&prefetchWorkers[i].abort);
+    }
+    for (int i = 0; i < nPrefetchWorkers; i++) {
+        WaitForSingleObject(prefetchWorkers[i].thread, INFINITE);
+        CloseHandle(prefetchWorkers[i].thread);
+        prefetchWorkers[i].thread = nullptr;
+    }
+    nPrefetchWorkers = 0;
+}
+
+// returns the page closest to backgroundCenter whose text is neither cached
+// nor being extracted (0 if there's none or the cache is almost full)
+int DocumentTextCache::FindPageToExtractInBackground() {
+    ScopedCritSec scope(&access);
+    // don't extract pages that EvictPages would have to free again
+    if (nPagesCached == nPages || cachedSize >= gMaxTextCacheSize / 2) {
+        return 0;
+    }
+    int center = limitValue((int)InterlockedAdd(&backgroundCenter, 0), 1, nPages);
+    for (int dist = 0; dist < nPages; dist++) {
+        int candidates[2] = {center + dist, center - dist};
+        for (int pageNo : candidates) {
+            if (1 <= pageNo && pageNo <= nPages && !pagesText[pageNo - 1].text && !extracting[pageNo - 1]) {
+                return pageNo;
+            }
+        }
+    }
+    return 0;
+}
+
+DWORD WINAPI DocumentTextCache::BackgroundThread(void* data) {
+    DocumentTextCache* cache = (DocumentTextCache*)data;
+    SetThreadName(GetCurrentThreadId(), "TextExtraction");
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+
+    while (InterlockedAdd(&cache->backgroundCancelled, 0) == 0) {
+        // check for cancellation regularly while pages are being rendered
+        if (WaitForSingleObject(gRenderingIdle, 100) != WAIT_OBJECT_0) {
+            continue;
+        }
+        int pageNo = cache->FindPageToExtractInBackground();
+        if (0 == pageNo) {
+            break;
+        }
+        cache->ExtractTextForPage(cache->engine, pageNo, false, &cache->backgroundAbort);
+    }
+    return 0;
+}
+
+void DocumentTextCache::ExtractInBackground(int pageNo) {
+    InterlockedExchange(&backgroundCenter, pageNo);
+    if (backgroundThread && WaitForSingleObject(backgroundThread, 0) == WAIT_TIMEOUT) {
+        return;
+    }
+    {
+        ScopedCritSec scope(&access);
+        if (nPagesCached == nPages || cachedSize >= gMaxTextCacheSize / 2) {
+            return;
+        }
+    }
+    StopExtractingInBackground();
+    backgroundCancelled = 0;
+    backgroundAbort = TextExtractionAbort{};
+    backgroundThread = CreateThread(nullptr, 0, BackgroundThread, this, 0, nullptr);
+}
+
+void DocumentTextCache::StopExtractingInBackground() {
+    if (!backgroundThread) {
+        return;
+    }
+    InterlockedIncrement(&backgroundCancelled);
+    AbortExtraction(&backgroundAbort);
+    WaitForSingleObject(backgroundThread, INFINITE);
+    CloseHandle(backgroundThread);
+    backgroundThread = nullptr;
+}
+
 TextSelection::TextSelection(EngineBase* engine, DocumentTextCache* textCache) : engine(engine), textCache(textCache) {
 }
 
@@ -91,73 +695,65 @@ void TextSelection::Reset() {
 // glyph following it, which will be the first glyph (not) to be selected)
 static int FindClosestGlyph(TextSelection* ts, int pageNo, double x, double y) {
     int textLen;
-    Rect* coords;
+    const GlyphCoords* coords;
     ts->textCache->GetTextForPage(pageNo, &textLen, &coords);
     PointF pt = PointF(x, y);
 
-    unsigned int maxDist = UINT_MAX;
-    Point pti = ToPoint(pt);
-    bool overGlyph = false;
-    int result = -1;
-
-    for (int i = 0; i < textLen; i++) {
-        Rect& coord = coords[i];
-        if (!coord.x && !coord.dx) {
-            continue;
-        }
-        if (overGlyph && !coord.Contains(pti)) {
-            continue;
-        }
-
-        uint dist = distSq((int)x - coord.x - coord.dx / 2, (int)y - coord.y - coord.dy / 2);
-        if (dist < maxDist) {
-            result = i;
-            maxDist = dist;
-        }
-        // prefer glyphs the cursor is actually over
-        if (!overGlyph && coord.Contains(pti)) {
-            overGlyph = true;
-            result = i;
-            maxDist = dist;
-        }
-    }
-
+    // prefers glyphs the cursor is actually over
+    int result = coords->FindNearest(pt);
     if (-1 == result) {
         return 0;
     }
     CrashIf(result < 0 || result >= textLen);
 
     // the result indexes the first glyph to be selected in a forward selection
-    RectF bbox = ts->engine->Transform(ToRectFl(coords[result]), pageNo, 1.0, 0);
+    RectF bbox = ts->engine->Transform(ToRectFl(coords->At(result)), pageNo, 1.0, 0);
     pt = ts->engine->Transform(pt, pageNo, 1.0, 0);
     if (pt.x > bbox.x + 0.5 * bbox.dx) {
         result++;
         // for some (DjVu) documents, all glyphs of a word share the same bbox
-        while (result < textLen && coords[result - 1] == coords[result]) {
+        while (result < textLen && coords->At(result - 1) == coords->At(result)) {
             result++;
         }
     }
-    CrashIf(result > 0 && result < textLen && coords[result] == coords[result - 1]);
+    CrashIf(result > 0 && result < textLen && coords->At(result) == coords->At(result - 1));
 
     return result;
 }
 
-static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length, WStrVec* lines = nullptr) {
+// line breaks are glyphs without a bounding box
+static bool IsLineBreak(const Rect& c) {
+    return !c.x && !c.dx;
+}
+
+// a line of selected text, pointing into its page's text
+struct TextLine {
+    const WCHAR* s;
     int len;
-    Rect* coords;
+};
+
+static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length, Vec<TextLine>* lines = nullptr) {
+    int len;
+    const GlyphCoords* coords;
     const WCHAR* text = ts->textCache->GetTextForPage(pageNo, &len, &coords);
     CrashIf(len < glyph + length);
     Rect mediabox = ts->engine->PageMediabox(pageNo).Round();
-    Rect *c = &coords[glyph], *end = c + length;
-    while (c < end) {
+    int i = glyph;
+    int end = glyph + length;
+    while (i < end) {
         // skip line breaks
-        for (; c < end && !c->x && !c->dx; c++) {
+        for (; i < end && IsLineBreak(coords->At(i)); i++) {
             // no-op
         }
 
-        Rect bbox, *c0 = c;
-        for (; c < end && (c->x || c->dx); c++) {
-            bbox = bbox.Union(*c);
+        Rect bbox;
+        int i0 = i;
+        for (; i < end; i++) {
+            Rect c = coords->At(i);
+            if (IsLineBreak(c)) {
+                break;
+            }
+            bbox = bbox.Union(c);
         }
         bbox = bbox.Intersect(mediabox);
         // skip text that's completely outside a page's mediabox
@@ -166,13 +762,14 @@ static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length
         }
 
         if (lines) {
-            lines->Append(str::DupN(text + (c0 - coords), c - c0));
+            lines->Append({text + i0, i - i0});
             continue;
         }
 
         // cut the right edge, if it overlaps the next character
-        if (c < coords + len && (c->x || c->dx) && bbox.x < c->x && bbox.x + bbox.dx > c->x) {
-            bbox.dx = c->x - bbox.x;
+        Rect next = i < len ? coords->At(i) : Rect();
+        if (!IsLineBreak(next) && bbox.x < next.x && bbox.x + bbox.dx > next.x) {
+            bbox.dx = next.x - bbox.x;
         }
 
         int currLen = ts->result.len;
@@ -200,20 +797,20 @@ static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length
 
 bool TextSelection::IsOverGlyph(int pageNo, double x, double y) {
     int textLen;
-    Rect* coords;
+    const GlyphCoords* coords;
     textCache->GetTextForPage(pageNo, &textLen, &coords);
 
     int glyphIx = FindClosestGlyph(this, pageNo, x, y);
     Point pt = ToPoint(PointF(x, y));
     // when over the right half of a glyph, FindClosestGlyph returns the
     // index of the next glyph, in which case glyphIx must be decremented
-    if (glyphIx == textLen || !coords[glyphIx].Contains(pt)) {
+    if (glyphIx == textLen || !coords->At(glyphIx).Contains(pt)) {
         glyphIx--;
     }
     if (-1 == glyphIx) {
         return false;
     }
-    return coords[glyphIx].Contains(pt);
+    return coords->At(glyphIx).Contains(pt);
 }
 
 void TextSelection::StartAt(int pageNo, int glyphIx) {
@@ -230,13 +827,13 @@ void TextSelection::StartAt(int pageNo, double x, double y) {
     StartAt(pageNo, FindClosestGlyph(this, pageNo, x, y));
 }
 
-void TextSelection::SelectUpTo(int pageNo, double x, double y) {
-    SelectUpTo(pageNo, FindClosestGlyph(this, pageNo, x, y));
+bool TextSelection::SelectUpTo(int pageNo, double x, double y) {
+    return SelectUpTo(pageNo, FindClosestGlyph(this, pageNo, x, y));
 }
 
-void TextSelection::SelectUpTo(int pageNo, int glyphIx) {
+bool TextSelection::SelectUpTo(int pageNo, int glyphIx) {
     if (startPage == -1 || startGlyph == -1) {
-        return;
+        return false;
     }
 
     endPage = pageNo;
@@ -247,13 +844,23 @@ void TextSelection::SelectUpTo(int pageNo, int glyphIx) {
         endGlyph = textLen + glyphIx + 1;
     }
 
-    result.len = 0;
     int fromPage = std::min(startPage, endPage), toPage = std::max(startPage, endPage);
     int fromGlyph = (fromPage == endPage ? endGlyph : startGlyph);
     int toGlyph = (fromPage == endPage ? startGlyph : endGlyph);
     if (fromPage == toPage && fromGlyph > toGlyph) {
         std::swap(fromGlyph, toGlyph);
     }
+    // while dragging, most mouse moves don't change the selected glyphs, and
+    // re-computing the rectangles of a selection spanning many pages is expensive
+    if (result.len > 0 && fromPage == resultFromPage && fromGlyph == resultFromGlyph && toPage == resultToPage &&
+        toGlyph == resultToGlyph) {
+        return false;
+    }
+    result.len = 0;
+    resultFromPage = fromPage;
+    resultFromGlyph = fromGlyph;
+    resultToPage = toPage;
+    resultToGlyph = toGlyph;
 
     for (int page = fromPage; page <= toPage; page++) {
         int textLen;
@@ -265,6 +872,7 @@ void TextSelection::SelectUpTo(int pageNo, int glyphIx) {
             FillResultRects(this, page, glyph, length);
         }
     }
+    return true;
 }
 
 void TextSelection::SelectWordAt(int pageNo, double x, double y) {
@@ -293,13 +901,25 @@ void TextSelection::CopySelection(TextSelection* orig) {
     SelectUpTo(orig->endPage, orig->endGlyph);
 }
 
-WCHAR* TextSelection::ExtractText(const WCHAR* lineSep) {
-    WStrVec lines;
-
+WCHAR* TextSelection::ExtractText(const WCHAR* lineSep, ProgressUpdateUI* tracker) {
     int fromPage, fromGlyph, toPage, toGlyph;
     GetGlyphRange(&fromPage, &fromGlyph, &toPage, &toGlyph);
 
+    // the lines point into the pages' text, which mustn't be evicted before it's been copied
+    ScopedTextCachePin pin(textCache);
+    if (fromPage < toPage) {
+        textCache->PrefetchPages(fromPage, toPage);
+    }
+
+    Vec<TextLine> lines;
+    int nPages = toPage - fromPage + 1;
     for (int page = fromPage; page <= toPage; page++) {
+        if (tracker) {
+            if (tracker->WasCanceled()) {
+                return nullptr;
+            }
+            tracker->UpdateProgress(page - fromPage + 1, nPages);
+        }
         int textLen;
         textCache->GetTextForPage(page, &textLen);
         int glyph = page == fromPage ? fromGlyph : 0;
@@ -309,7 +929,24 @@ WCHAR* TextSelection::ExtractText(const WCHAR* lineSep) {
         }
     }
 
-    return lines.Join(lineSep);
+    // join the lines in a single allocation, as there can be millions of them
+    size_t sepLen = str::Len(lineSep);
+    size_t len = 0;
+    for (TextLine& line : lines) {
+        len += line.len + sepLen;
+    }
+    WCHAR* text = AllocArray<WCHAR>(len + 1);
+    WCHAR* dst = text;
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (i > 0) {
+            memcpy(dst, lineSep, sepLen * sizeof(WCHAR));
+            dst += sepLen;
+        }
+        memcpy(dst, lines.at(i).s, lines.at(i).len * sizeof(WCHAR));
+        dst += lines.at(i).len;
+    }
+    *dst = '\0';
+    return text;
 }
 
 void TextSelection::GetGlyphRange(int* fromPage, int* fromGlyph, int* toPage, int* toGlyph) const {
@@ -1,19 +1,193 @@
 /* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+#define MAX_TEXT_PREFETCH_THREADS 4
+
+struct DocumentTextCache;
+struct ProgressUpdateUI;
+
+// text extracted previously (e.g. stored on disk by DiskTextIndex), which
+// DocumentTextCache uses instead of extracting it from the engine again
+struct PageTextStore {
+    virtual ~PageTextStore() = default;
+    virtual bool HasPageText(int pageNo) = 0;
+    // pageText receives newly allocated text and coords
+    virtual bool GetPageText(int pageNo, PageText& pageText) = 0;
+};
+
+// bounding boxes of a page's glyphs, in about a quarter of the memory of a Rect per glyph:
+// consecutive glyphs on a line usually have the same y and dy, so those are stored once
+// per run of such glyphs and only a 16-bit offset from the run's x and width per glyph
+struct GlyphCoords {
+    struct Run {
+        int firstGlyph;
+        int x;
+        int y;
+        int dy;
+    };
+    struct Glyph {
+        u16 x;
+        u16 dx;
+    };
+    // consecutive glyphs with the same y and dy (i.e. with the same vertical center),
+    // for finding glyphs by position without testing all of them (see FindNearest)
+    struct Line {
+        int firstGlyph;
+        int endGlyph;
+        int centerY;
+        // range of the glyphs' horizontal centers
+        int minCenterX;
+        int maxCenterX;
+        // bounding box of the glyphs
+        Rect bbox;
+    };
+
+    int len{0};
+    int nRuns{0};
+    Run* runs{nullptr};
+    Glyph* glyphs{nullptr};
+    // instead of runs and glyphs for the rare pages with glyphs too wide for them
+    Rect* rects{nullptr};
+    // sorted by centerY (line breaks aren't part of any line)
+    int nLines{0};
+    Line* lines{nullptr};
+    int maxLineDy{0};
+
+    // coords has len entries (or is nullptr, if they're all unknown)
+    void Set(const Rect* coords, int len);
+    void Free();
+    Rect At(int glyph) const;
+    // the glyph pt is over (the one with the closest center, if it's over several)
+    // or else the one with the closest center, -1 if there are no glyphs
+    int FindNearest(PointF pt) const;
+    size_t MemSize() const;
+
+  private:
+    void SetLines(const Rect* coords);
+    void FindNearestInLine(const Line& line, Point pt, int* best, uint* bestDist) const;
+};
+
+// maximum amount of memory used for the text of each document
+// (if sizeMB isn't positive, a default is used)
+void SetTextCacheSizeMB(int sizeMB);
+// text is only extracted in the background while nothing is being rendered
+// (see DocumentTextCache::ExtractInBackground)
+void SetRenderingIdle(bool isIdle);
+// returns false if pages are still being rendered after timeoutMs
+bool WaitForRenderingIdle(DWORD timeoutMs);
+
+// lets another thread abort the text extraction a thread is doing or waiting for
+// (e.g. when a search is canceled), see DocumentTextCache::AbortExtraction
+struct TextExtractionAbort {
+    LONG aborted{0};
+    // the engine's cookie for the extraction in progress (see EngineBase::ExtractPageText)
+    AbortCookie* cookie{nullptr};
+};
+
+struct TextPrefetchWorker {
+    DocumentTextCache* cache{nullptr};
+    HANDLE thread{nullptr};
+    TextExtractionAbort abort;
+};
+
 struct DocumentTextCache {
     EngineBase* engine{nullptr};
     int nPages{0};
+    // the text of pages (their coords are stored in pagesCoords instead)
     PageText* pagesText{nullptr};
+    GlyphCoords* pagesCoords{nullptr};
     int debugSize{0};
+    // owned, must not be changed while pages are being extracted
+    PageTextStore* store{nullptr};
+    // number of pages whose text wasn't available from store
+    int nPagesExtracted{0};
 
+    // guards pagesText and extracting (but isn't held while extracting text)
     CRITICAL_SECTION access;
+    // set for pages whose text is currently being extracted
+    bool* extracting{nullptr};
+    // the text of pages in lower case, for case insensitive searches
+    WCHAR** foldedTexts{nullptr};
+    CONDITION_VARIABLE pageExtracted;
+
+    // state for EvictPages (guarded by access)
+    size_t cachedSize{0};
+    // pages are stamped with useCount when their text is requested
+    u32* lastUsed{nullptr};
+    u32 useCount{0};
+    int nPins{0};
+    int nPagesCached{0};
+
+    // state for ExtractInBackground
+    HANDLE backgroundThread{nullptr};
+    LONG backgroundCenter{1};
+    LONG backgroundCancelled{0};
+    TextExtractionAbort backgroundAbort;
+
+    // state for PrefetchPages (guarded by prefetchAccess, as several threads can prefetch)
+    CRITICAL_SECTION prefetchAccess;
+    TextPrefetchWorker prefetchWorkers[MAX_TEXT_PREFETCH_THREADS];
+    int nPrefetchWorkers{0};
+    int prefetchStart{0};
+    int prefetchEnd{0};
+    LONG prefetchNext{0};
+    LONG prefetchCancelled{0};
 
     explicit DocumentTextCache(EngineBase* engine);
     ~DocumentTextCache();
 
     bool HasTextForPage(int pageNo);
-    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, Rect** coordsOut = nullptr);
+    // memory used for the text of cached pages
+    size_t GetMemoryUsage(int* nPagesOut = nullptr);
+    // if the extraction is aborted through abort, the result is an empty text (which isn't cached)
+    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, const GlyphCoords** coordsOut = nullptr,
+                                TextExtractionAbort* abort = nullptr);
+    // returns the page's text folded to lower case (with the same length as the text)
+    const WCHAR* GetFoldedTextForPage(int pageNo, int* lenOut = nullptr);
+    void SetStore(PageTextStore* newStore);
+    // aborts the extraction done with abort (also if it's waiting for another thread's
+    // extraction of the same page) and all of its later ones, until abort->aborted is reset
+    void AbortExtraction(TextExtractionAbort* abort);
+    // takes over the text of pages which are the same in prev's document (e.g. after a reload)
+    void KeepPagesFrom(DocumentTextCache* prev, const Vec<int>& unchangedPages);
+
+    // frees the text of the least recently used pages not close to the visible ones,
+    // if the text of all pages takes more memory than allowed (unless pinned)
+    // evictAll frees the text of all pages not close to the visible ones
+    void EvictPages(int firstVisiblePage, int lastVisiblePage, bool evictAll = false);
+    // pointers to the text of pages remain valid until the last Unpin
+    // (necessary for all threads but the ui thread, which calls EvictPages)
+    void Pin();
+    void Unpin();
+
+    // extracts the text of pages startPage to endPage (in either direction)
+    // concurrently on background threads, each using its own engine clone
+    void PrefetchPages(int startPage, int endPage);
+    void StopPrefetching();
+
+    // extracts the text of the pages closest to pageNo first (and then moving outwards)
+    // on a low priority thread while nothing is being rendered, until all pages'
+    // text is cached or the cache is almost full
+    void ExtractInBackground(int pageNo);
+    void StopExtractingInBackground();
+
+  private:
+    PageText* ExtractTextForPage(EngineBase* engine, int pageNo, bool wait, TextExtractionAbort* abort = nullptr);
+    void FreeTextForPage(int pageNo);
+    static DWORD WINAPI PrefetchThread(void* data);
+    static DWORD WINAPI BackgroundThread(void* data);
+    int FindPageToExtractInBackground();
+};
+
+struct ScopedTextCachePin {
+    DocumentTextCache* cache = nullptr;
+
+    explicit ScopedTextCachePin(DocumentTextCache* cache) : cache(cache) {
+        cache->Pin();
+    }
+    ~ScopedTextCachePin() {
+        cache->Unpin();
+    }
 };
 
 // TODO: replace with Vec<TextSel>
@@ -37,14 +211,20 @@ struct TextSelection {
     bool IsOverGlyph(int pageNo, double x, double y);
     void StartAt(int pageNo, int glyphIx);
     void StartAt(int pageNo, double x, double y);
-    void SelectUpTo(int pageNo, int glyphIx);
-    void SelectUpTo(int pageNo, double x, double y);
+    // return false if the selected range didn't change (and result wasn't recomputed)
+    bool SelectUpTo(int pageNo, int glyphIx);
+    bool SelectUpTo(int pageNo, double x, double y);
     void SelectWordAt(int pageNo, double x, double y);
     void CopySelection(TextSelection* orig);
-    WCHAR* ExtractText(const WCHAR* lineSep);
+    // the text of selections spanning many pages is extracted in parallel
+    // (returns nullptr if tracker canceled the extraction)
+    WCHAR* ExtractText(const WCHAR* lineSep, ProgressUpdateUI* tracker = nullptr);
     void Reset();
 
     TextSel result{};
+    // the glyph range result was computed for (only valid if result.len > 0)
+    int resultFromPage{-1}, resultFromGlyph{-1};
+    int resultToPage{-1}, resultToGlyph{-1};
 
     void GetGlyphRange(int* fromPage, int* fromGlyph, int* toPage, int* toGlyph) const;
 };
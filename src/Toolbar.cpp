@@ -90,9 +90,12 @@ static bool IsVisibleToolbarButton(WindowInfo* win, int buttonNo) {
         case CmdFindFirst:
         case CmdFindNext:
         case CmdFindPrev:
-        case CmdFindMatch:
             return NeedsFindUI(win);
 
+        case CmdFindMatch:
+            // CHM search is always case-insensitive
+            return NeedsFindUI(win) && !win->AsChm();
+
         default:
             return true;
     }
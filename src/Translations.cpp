@@ -114,6 +114,36 @@ static void FreeTransCache() {
     }
     free(gLangsTransCache);
     free(gCurrLangStrings);
+    free(gEnglishStringsIndex);
+}
+
+// hash table from English strings to their index (+1, so that 0 marks
+// an empty slot) so that GetTranslation doesn't have to compare against
+// all strings; uses open addressing with linear probing
+static u16* gEnglishStringsIndex = nullptr;
+static u32 gEnglishStringsIndexMask = 0;
+
+static u32 GetEnglishStringsIndexSlot(const char* s) {
+    return MurmurHash2(s, str::Len(s)) & gEnglishStringsIndexMask;
+}
+
+static void BuildEnglishStringsIndex() {
+    // keep the table at most half full
+    u32 size = 1;
+    while (size < (u32)gStringsCount * 2) {
+        size *= 2;
+    }
+    CrashIf(gStringsCount >= 0xffff);
+    gEnglishStringsIndex = AllocArray<u16>(size);
+    gEnglishStringsIndexMask = size - 1;
+    const char** origStrings = GetOriginalStrings();
+    for (int idx = 0; idx < gStringsCount; idx++) {
+        u32 slot = GetEnglishStringsIndexSlot(origStrings[idx]);
+        while (gEnglishStringsIndex[slot] != 0) {
+            slot = (slot + 1) & gEnglishStringsIndexMask;
+        }
+        gEnglishStringsIndex[slot] = (u16)(idx + 1);
+    }
 }
 
 static void BuildStringsIndexForLang(int langIdx) {
@@ -149,6 +179,7 @@ void SetCurrentLangByCode(const char* langCode) {
     if (!gCurrLangStrings) {
         gCurrLangStrings = AllocArray<const char*>(gStringsCount);
         gLangsTransCache = AllocArray<WCHAR**>(gLangsCount);
+        BuildEnglishStringsIndex();
     }
 
     if (str::Eq(langCode, gCurrLangCode)) {
@@ -233,11 +264,12 @@ const char* DetectUserLang() {
 
 static int GetEnglishStringIndex(const char* txt) {
     const char** origStrings = GetOriginalStrings();
-    for (int idx = 0; idx < gStringsCount; idx++) {
-        const char* s = origStrings[idx];
-        if (str::Eq(s, txt)) {
-            return idx;
+    u32 slot = GetEnglishStringsIndexSlot(txt);
+    for (u16 n = gEnglishStringsIndex[slot]; n != 0; n = gEnglishStringsIndex[slot]) {
+        if (str::Eq(origStrings[n - 1], txt)) {
+            return n - 1;
         }
+        slot = (slot + 1) & gEnglishStringsIndexMask;
     }
     return -1;
 }
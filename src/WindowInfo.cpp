@@ -38,6 +38,7 @@
 #include "SumatraPDF.h"
 #include "WindowInfo.h"
 #include "TabInfo.h"
+#include "PageThumbnails.h"
 #include "TableOfContents.h"
 #include "resource.h"
 #include "Commands.h"
@@ -68,6 +69,10 @@ void CreateMovePatternLazy(WindowInfo* win) {
     CrashIf(!win->brMovePattern);
 }
 
+PerfHud::~PerfHud() {
+    delete wnd;
+}
+
 WindowInfo::~WindowInfo() {
     FinishStressTest(this);
 
@@ -101,7 +106,9 @@ WindowInfo::~WindowInfo() {
     delete cbHandler;
 
     delete frameRateWnd;
+    delete perfHud;
     delete infotip;
+    DeleteThumbnails(this);
     delete altBookmarks;
     delete tocTreeCtrl;
     if (favTreeCtrl) {
@@ -533,7 +540,7 @@ void LinkHandler::GotoNamedDest(const WCHAR* name) {
     if (dest) {
         ScrollTo(dest);
         delete dest;
-    } else if (ctrl->HacToc()) {
+    } else if (ctrl->HacToc() && ctrl->GetToc()) {
         auto* docTree = ctrl->GetToc();
         TocItem* root = docTree->root;
         AutoFreeWstr fuzName(NormalizeFuzzy(name));
@@ -25,6 +25,7 @@ struct TabInfo;
 struct TreeCtrl;
 struct TooltipCtrl;
 struct DropDownCtrl;
+struct ThumbnailStrip;
 
 /* Describes actions which can be performed by mouse */
 // clang-format off
@@ -57,6 +58,23 @@ struct TouchState {
     double startArg{0};
 };
 
+#define PERF_HUD_PAINTS 32
+
+// developer overlay with painting and rendering statistics (see UpdatePerfHud)
+struct PerfHud {
+    FrameRateWnd* wnd{nullptr};
+    // durations of the most recent paints in ms
+    double paintMs[PERF_HUD_PAINTS]{};
+    int nPaints{0};
+    // RenderQueueStats counters when the HUD was shown
+    int tileHits{0};
+    int tileMisses{0};
+    int tilesRendered{0};
+    u64 totalTileLatencyMs{0};
+
+    ~PerfHud();
+};
+
 /* Describes position, the target (URL or file path) and infotip of a "hyperlink" */
 struct StaticLinkInfo {
     Rect rect;
@@ -119,6 +137,11 @@ struct WindowInfo {
     bool tocVisible{false};
     // set to temporarily disable UpdateTocSelection
     bool tocKeepSelection{false};
+    // page whose ToC item is about to be selected (0 if none, see UpdateTocSelection)
+    int tocSelectionPageNo{0};
+    // whether the ToC sidebar shows page thumbnails instead of the bookmarks
+    bool thumbnailsVisible{false};
+    ThumbnailStrip* thumbnails{nullptr};
 
     // state related to favorites
     HWND hwndFavBox{nullptr};
@@ -149,6 +172,9 @@ struct WindowInfo {
     bool isMenuHidden{false}; // not persisted at shutdown
 
     DoubleBuffer* buffer{nullptr};
+    // true if the canvas was last painted without placeholders (such as
+    // "rendering...") that depend on the scroll position
+    bool canvasPaintComplete{false};
 
     MouseAction mouseAction = MouseAction::Idle;
     bool dragRightClick{false}; // if true, drag was initiated with right mouse click
@@ -188,6 +214,11 @@ struct WindowInfo {
     int currPageNo{0}; // cached value, needed to determine when to auto-update the ToC selection
 
     int wheelAccumDelta{0};
+    // vertical scroll animation (see AnimateScrollYTo), scrollAnimY is
+    // where the last step has moved the viewport to
+    bool scrollAnimating{false};
+    int scrollAnimTargetY{0};
+    int scrollAnimY{0};
     UINT_PTR delayedRepaintTimer{0};
 
     Notifications* notifications{nullptr}; // only access from UI thread
@@ -198,8 +229,14 @@ struct WindowInfo {
     HANDLE findThread{nullptr};
     bool findCanceled{false};
 
+    // extracts the text of large selections for copying them to the clipboard
+    HANDLE copyThread{nullptr};
+    bool copyCanceled{false};
+
     LinkHandler* linkHandler{nullptr};
     IPageElement* linkOnLastButtonDown{nullptr};
+    // destination page of the internal link under the cursor (0 if none)
+    int linkPrefetchPageNo{0};
     const WCHAR* urlOnLastButtonDown{nullptr};
     Annotation* annotationOnLastButtonDown{nullptr};
     Size annotationBeingMovedSize;
@@ -224,6 +261,7 @@ struct WindowInfo {
     TouchState touchState;
 
     FrameRateWnd* frameRateWnd{nullptr};
+    PerfHud* perfHud{nullptr};
 
     SumatraUIAutomationProvider* uiaProvider{nullptr};
 
@@ -264,6 +302,8 @@ struct LinkHandler {
 
 void UpdateTreeCtrlColors(WindowInfo*);
 void RepaintAsync(WindowInfo*, int delay);
+void RepaintScrolled(WindowInfo*, int dx, int dy);
+void RepaintPageAsync(WindowInfo*, DisplayModel*, int pageNo);
 void ClearFindBox(WindowInfo*);
 void CreateMovePatternLazy(WindowInfo*);
 void ClearMouseState(WindowInfo*);
@@ -1,49 +1,193 @@
 /* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+extern "C" {
+#include <mupdf/fitz.h>
+#include <mupdf/pdf.h>
+}
+
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
 
 #include "Annotation.h"
 #include "EngineBase.h"
-#include "EnginePdf.h"
+#include "EngineFzUtil.h"
 
 #include "FilterBase.h"
 #include "PdfFilter.h"
 #include "CPdfFilter.h"
 
-VOID CPdfFilter::CleanUp() {
-    if (m_pdfEngine) {
-        delete m_pdfEngine;
-        m_pdfEngine = nullptr;
+// the indexer runs the filter for every PDF document (often on file servers),
+// so the document is read straight from the indexer's stream and only one page
+// is loaded at a time. Memory and time per document are capped, and the text
+// extracted until then is all that gets indexed
+
+// maximum memory MuPDF may allocate for a single document
+#define FILTER_MAX_MEMORY (128 * 1024 * 1024)
+// how much of that may be used for caching fonts, images, etc.
+#define FILTER_STORE_SIZE (32 * 1024 * 1024)
+// no further pages are extracted after this time
+#define FILTER_MAX_TIME_MS (60 * 1000)
+
+// an allocator which fails allocations above FILTER_MAX_MEMORY
+// (which MuPDF handles by first emptying its store and then throwing)
+struct FilterAllocator {
+    size_t used = 0;
+    size_t limit = FILTER_MAX_MEMORY;
+};
+
+// allocations are prefixed with their size (keeping 16 byte alignment)
+#define ALLOC_HEADER_SIZE 16
+
+static void* FilterMalloc(void* user, size_t size) {
+    FilterAllocator* a = (FilterAllocator*)user;
+    if (size > a->limit - a->used) {
+        return nullptr;
     }
-    m_state = STATE_PDF_END;
+    u8* p = (u8*)malloc(size + ALLOC_HEADER_SIZE);
+    if (!p) {
+        return nullptr;
+    }
+    *(size_t*)p = size;
+    a->used += size;
+    return p + ALLOC_HEADER_SIZE;
 }
 
-HRESULT CPdfFilter::OnInit() {
-    CleanUp();
+static void FilterFree(void* user, void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    FilterAllocator* a = (FilterAllocator*)user;
+    u8* p = (u8*)ptr - ALLOC_HEADER_SIZE;
+    a->used -= *(size_t*)p;
+    free(p);
+}
+
+static void* FilterRealloc(void* user, void* ptr, size_t size) {
+    if (!ptr) {
+        return FilterMalloc(user, size);
+    }
+    if (0 == size) {
+        FilterFree(user, ptr);
+        return nullptr;
+    }
+    FilterAllocator* a = (FilterAllocator*)user;
+    u8* p = (u8*)ptr - ALLOC_HEADER_SIZE;
+    size_t oldSize = *(size_t*)p;
+    if (size > oldSize && size - oldSize > a->limit - a->used) {
+        return nullptr;
+    }
+    p = (u8*)realloc(p, size + ALLOC_HEADER_SIZE);
+    if (!p) {
+        return nullptr;
+    }
+    *(size_t*)p = size;
+    a->used = a->used - oldSize + size;
+    return p + ALLOC_HEADER_SIZE;
+}
 
-    // TODO: EnginePdf::CreateFromStream never returns with
-    //       m_pStream instead of a clone - why?
+struct PdfFilterDoc {
+    FilterAllocator allocator;
+    fz_alloc_context allocCtx = {&allocator, FilterMalloc, FilterRealloc, FilterFree};
+    fz_context* ctx = nullptr;
+    fz_document* doc = nullptr;
+    int pageCount = 0;
+    LARGE_INTEGER started = TimeGet();
 
-    // load content of PDF document into a seekable stream
-    HRESULT res;
-    AutoFree data = GetDataFromStream(m_pStream, &res);
-    if (data.empty()) {
-        return res;
+    ~PdfFilterDoc() {
+        if (ctx) {
+            fz_drop_document(ctx, doc);
+            fz_drop_context(ctx);
+        }
     }
 
-    auto strm = CreateStreamFromData(data.AsSpan());
-    ScopedComPtr<IStream> stream(strm);
-    if (!stream) {
-        return E_FAIL;
+    bool Open(IStream* stream) {
+        if (!stream) {
+            return false;
+        }
+        ctx = fz_new_context(&allocCtx, nullptr, FILTER_STORE_SIZE);
+        if (!ctx) {
+            return false;
+        }
+        fz_stream* stm = nullptr;
+        fz_var(stm);
+        fz_try(ctx) {
+            stm = fz_open_istream(ctx, stream);
+            doc = (fz_document*)pdf_open_document_with_stream(ctx, stm);
+            // password protected documents can't be indexed
+            if (fz_needs_password(ctx, doc)) {
+                fz_throw(ctx, FZ_ERROR_GENERIC, "document needs a password");
+            }
+            pageCount = fz_count_pages(ctx, doc);
+        }
+        fz_always(ctx) {
+            fz_drop_stream(ctx, stm);
+        }
+        fz_catch(ctx) {
+            return false;
+        }
+        return true;
     }
 
-    m_pdfEngine = CreateEnginePdfFromStream(stream);
-    if (!m_pdfEngine) {
+    WCHAR* GetMetadata(const char* key) {
+        char buf[1024];
+        int n = -1;
+        fz_try(ctx) {
+            n = fz_lookup_metadata(ctx, doc, key, buf, (int)sizeof(buf));
+        }
+        fz_catch(ctx) {
+            n = -1;
+        }
+        if (n <= 0) {
+            return nullptr;
+        }
+        return strconv::Utf8ToWstr(buf);
+    }
+
+    // loads a single page and drops it again right after extracting its text
+    WCHAR* ExtractPageText(int pageNo) {
+        fz_page* page = nullptr;
+        fz_stext_page* stext = nullptr;
+        fz_var(page);
+        fz_var(stext);
+        fz_stext_options opts{};
+        fz_try(ctx) {
+            page = fz_load_page(ctx, doc, pageNo - 1);
+            stext = fz_new_stext_page_from_page(ctx, page, &opts);
+        }
+        fz_always(ctx) {
+            fz_drop_page(ctx, page);
+        }
+        fz_catch(ctx) {
+            fz_drop_stext_page(ctx, stext);
+            return nullptr;
+        }
+        WCHAR* text = fz_text_page_to_str(stext, nullptr);
+        fz_drop_stext_page(ctx, stext);
+        return text;
+    }
+
+    bool IsOutOfTime() {
+        return TimeSinceInMs(started) > FILTER_MAX_TIME_MS;
+    }
+};
+
+VOID CPdfFilter::CleanUp() {
+    delete m_pdfDoc;
+    m_pdfDoc = nullptr;
+    m_state = STATE_PDF_END;
+}
+
+HRESULT CPdfFilter::OnInit() {
+    CleanUp();
+
+    m_pdfDoc = new PdfFilterDoc();
+    if (!m_pdfDoc->Open(m_pStream)) {
+        CleanUp();
         return E_FAIL;
     }
 
@@ -78,7 +222,7 @@ HRESULT CPdfFilter::GetNextChunkValue(CChunkValue& chunkValue) {
 
         case STATE_PDF_AUTHOR:
             m_state = STATE_PDF_TITLE;
-            str.Set(m_pdfEngine->GetProperty(DocumentProperty::Author));
+            str.Set(m_pdfDoc->GetMetadata(FZ_META_INFO_AUTHOR));
             if (!str::IsEmpty(str.Get())) {
                 chunkValue.SetTextValue(PKEY_Author, str);
                 return S_OK;
@@ -87,9 +231,9 @@ HRESULT CPdfFilter::GetNextChunkValue(CChunkValue& chunkValue) {
 
         case STATE_PDF_TITLE:
             m_state = STATE_PDF_DATE;
-            str.Set(m_pdfEngine->GetProperty(DocumentProperty::Title));
+            str.Set(m_pdfDoc->GetMetadata(FZ_META_INFO_TITLE));
             if (!str) {
-                str.Set(m_pdfEngine->GetProperty(DocumentProperty::Subject));
+                str.Set(m_pdfDoc->GetMetadata("info:Subject"));
             }
             if (!str::IsEmpty(str.Get())) {
                 chunkValue.SetTextValue(PKEY_Title, str);
@@ -99,9 +243,9 @@ HRESULT CPdfFilter::GetNextChunkValue(CChunkValue& chunkValue) {
 
         case STATE_PDF_DATE:
             m_state = STATE_PDF_CONTENT;
-            str.Set(m_pdfEngine->GetProperty(DocumentProperty::ModificationDate));
+            str.Set(m_pdfDoc->GetMetadata("info:ModDate"));
             if (!str) {
-                str.Set(m_pdfEngine->GetProperty(DocumentProperty::CreationDate));
+                str.Set(m_pdfDoc->GetMetadata("info:CreationDate"));
             }
             if (!str::IsEmpty(str.Get())) {
                 SYSTEMTIME systime;
@@ -114,16 +258,13 @@ HRESULT CPdfFilter::GetNextChunkValue(CChunkValue& chunkValue) {
             // fall through
 
         case STATE_PDF_CONTENT:
-            while (++m_iPageNo <= m_pdfEngine->PageCount()) {
-                PageText pageText = m_pdfEngine->ExtractPageText(m_iPageNo);
-                if (str::IsEmpty(pageText.text)) {
-                    FreePageText(&pageText);
+            while (++m_iPageNo <= m_pdfDoc->pageCount && !m_pdfDoc->IsOutOfTime()) {
+                str.Set(m_pdfDoc->ExtractPageText(m_iPageNo));
+                if (str::IsEmpty(str.Get())) {
                     continue;
                 }
-                str.Set(pageText.text);
                 AutoFreeWstr str2 = str::Replace(str.Get(), L"\n", L"\r\n");
                 chunkValue.SetTextValue(PKEY_Search_Contents, str2.Get(), CHUNK_TEXT);
-                FreePageText(&pageText);
                 return S_OK;
             }
             m_state = STATE_PDF_END;
@@ -3,13 +3,13 @@
 
 enum PDF_FILTER_STATE { STATE_PDF_START, STATE_PDF_AUTHOR, STATE_PDF_TITLE, STATE_PDF_DATE, STATE_PDF_CONTENT, STATE_PDF_END };
 
-class EngineBase;
+struct PdfFilterDoc;
 
 class CPdfFilter : public CFilterBase
 {
 public:
     CPdfFilter(long *plRefCount) : CFilterBase(plRefCount),
-        m_state(STATE_PDF_END), m_iPageNo(-1), m_pdfEngine(nullptr) { }
+        m_state(STATE_PDF_END), m_iPageNo(-1), m_pdfDoc(nullptr) { }
     ~CPdfFilter()  override { CleanUp(); }
 
     HRESULT OnInit() override;
@@ -25,5 +25,5 @@ public:
 private:
     PDF_FILTER_STATE m_state;
     int m_iPageNo;
-    EngineBase *m_pdfEngine;
+    PdfFilterDoc *m_pdfDoc;
 };
@@ -214,6 +214,7 @@ void RequestRepaint(Control* c, const Rect* r1, const Rect* r2) {
 }
 
 void RequestLayout(Control* c) {
+    c->InvalidateLayout();
     HwndWrapper* wnd = GetRootHwndWnd(c);
     if (wnd) {
         wnd->RequestLayout();
@@ -116,6 +116,7 @@ void DestroyBase() {
         e.Free();
     }
     delete gGraphicsCache;
+    FreeTextMeasureCaches();
     delete gFontsCache;
     DeleteCriticalSection(&gMuiCs);
 }
@@ -61,6 +61,8 @@ Control::Control(Control* newParent) {
     hCursor = nullptr;
     cachedStyle = nullptr;
     namedEventClick = nullptr;
+    measureDirty = true;
+    arrangeDirty = true;
     SetStyle(nullptr);
     pos = Rect();
     if (newParent) {
@@ -155,6 +157,7 @@ void Control::AddChild(Control* c, int pos) {
         children.InsertAt(pos, c);
     }
     c->SetParent(this);
+    InvalidateLayout();
 }
 
 void Control::AddChild(Control* c1, Control* c2, Control* c3) {
@@ -171,7 +174,7 @@ Size Control::Measure(const Size availableSize) {
     }
     if (children.size() == 1) {
         ILayout* l = children.at(0);
-        return l->Measure(availableSize);
+        return l->MeasureIfNeeded(availableSize);
     }
     desiredSize = Size();
     return desiredSize;
@@ -181,9 +184,40 @@ Size Control::DesiredSize() {
     return desiredSize;
 }
 
+// re-laying out the whole tree e.g. for every status update is wasteful, so only
+// controls invalidated since are measured again (unless there's more or less
+// space available to them)
+Size Control::MeasureIfNeeded(const Size availableSize) {
+    if (!measureDirty && availableSize.Equals(measuredFor)) {
+        return measuredSize;
+    }
+    measuredSize = Measure(availableSize);
+    measuredFor = availableSize;
+    measureDirty = false;
+    // the sizes of the children might have changed
+    arrangeDirty = true;
+    return measuredSize;
+}
+
+void Control::ArrangeIfNeeded(const Rect finalRect) {
+    if (!arrangeDirty && finalRect.Equals(arrangedTo)) {
+        return;
+    }
+    Arrange(finalRect);
+    arrangedTo = finalRect;
+    arrangeDirty = false;
+}
+
+void Control::InvalidateLayout() {
+    for (Control* c = this; c; c = c->parent) {
+        c->measureDirty = true;
+        c->arrangeDirty = true;
+    }
+}
+
 void Control::MeasureChildren(Size availableSize) const {
     for (size_t i = 0; i < GetChildCount(); i++) {
-        GetChild(i)->Measure(availableSize);
+        GetChild(i)->MeasureIfNeeded(availableSize);
     }
 }
 
@@ -195,7 +229,7 @@ void Control::Arrange(const Rect finalRect) {
     } else {
         if (children.size() == 1) {
             ILayout* l = children.at(0);
-            l->Arrange(finalRect);
+            l->ArrangeIfNeeded(finalRect);
         }
     }
 }
@@ -291,6 +325,8 @@ bool Control::SetStyle(Style* style) {
         changed = true;
     }
     if (changed) {
+        // e.g. padding and borders are part of the size
+        InvalidateLayout();
         RequestRepaint(this);
     }
     return changed;
@@ -42,6 +42,11 @@ class Control : public ILayout {
     Size Measure(const Size availableSize) override;
     void Arrange(const Rect finalRect) override;
     Size DesiredSize() override;
+    Size MeasureIfNeeded(const Size availableSize) override;
+    void ArrangeIfNeeded(const Rect finalRect) override;
+    // the size of this control might have changed, so it (and its ancestors)
+    // have to be measured and arranged again during the next layout
+    void InvalidateLayout();
 
     // mouse enter/leave are used e.g. by a button to change the look when mouse
     // is over them. The intention is that in response to those a window should
@@ -107,4 +112,12 @@ class Control : public ILayout {
 
     // desired size calculated in Measure()
     Size desiredSize;
+
+    // the arguments and result of the last Measure() and Arrange()
+    // (only valid if !measureDirty and !arrangeDirty)
+    bool measureDirty;
+    bool arrangeDirty;
+    Size measuredFor;
+    Size measuredSize;
+    Rect arrangedTo;
 };
@@ -140,7 +140,7 @@ Size Grid::Measure(const Size availableSize) {
 
         // calculate max dx of each column (dx of widest cell in the row)
         //  and max dy of each row (dy of tallest cell in the column)
-        el->Measure(availableSize);
+        el->MeasureIfNeeded(availableSize);
 
         // TODO: take cell's border and padding into account
 
@@ -220,7 +220,7 @@ void Grid::Arrange(const Rect finalRect) {
         int yOff = d.vertAlign.CalcOffset(elDy, containerDy);
         pos.y += yOff;
         Rect r(pos, cell->desiredSize);
-        el->Arrange(r);
+        el->ArrangeIfNeeded(r);
     }
     SetPosition(finalRect);
 }
@@ -55,7 +55,7 @@ Size HwndWrapper::Measure(const Size availableSize) {
     }
     if (children.size() == 1) {
         ILayout* l = children.at(0);
-        return l->Measure(availableSize);
+        return l->MeasureIfNeeded(availableSize);
     }
     desiredSize = Size();
     return desiredSize;
@@ -68,7 +68,7 @@ void HwndWrapper::Arrange(const Rect finalRect) {
     } else {
         if (children.size() == 1) {
             ILayout* l = children.at(0);
-            l->Arrange(finalRect);
+            l->ArrangeIfNeeded(finalRect);
         }
     }
 }
@@ -19,7 +19,7 @@ DirectionalLayout& DirectionalLayout::Add(const DirectionalLayoutData& ld) {
 
 Size DirectionalLayout::Measure(const Size availableSize) {
     for (DirectionalLayoutData& e : els) {
-        e.element->Measure(availableSize);
+        e.element->MeasureIfNeeded(availableSize);
         e.desiredSize = e.element->DesiredSize();
     }
     // TODO: this is wrong
@@ -84,7 +84,7 @@ void HorizontalLayout::Arrange(const Rect finalRect) {
     for (DirectionalLayoutData& e : els) {
         int dy = CalcScaledClippedSize(finalRect.dy, e.sizeNonLayoutAxis, e.desiredSize.dy);
         int y = e.alignNonLayoutAxis.CalcOffset(dy, finalRect.dy);
-        e.element->Arrange(Rect((*si).finalPos, y, (*si).finalSize, dy));
+        e.element->ArrangeIfNeeded(Rect((*si).finalPos, y, (*si).finalSize, dy));
         ++si;
     }
     CrashIf(si != sizes.end());
@@ -103,7 +103,7 @@ void VerticalLayout::Arrange(const Rect finalRect) {
     for (DirectionalLayoutData& e : els) {
         int dx = CalcScaledClippedSize(finalRect.dx, e.sizeNonLayoutAxis, e.desiredSize.dx);
         int x = e.alignNonLayoutAxis.CalcOffset(dx, finalRect.dx);
-        e.element->Arrange(Rect(x, (*si).finalPos, dx, (*si).finalSize));
+        e.element->ArrangeIfNeeded(Rect(x, (*si).finalPos, dx, (*si).finalSize));
         ++si;
     }
     CrashIf(si != sizes.end());
@@ -25,6 +25,14 @@ class ILayout {
     virtual Size Measure(const Size availableSize) = 0;
     virtual Size DesiredSize() = 0;
     virtual void Arrange(const Rect finalRect) = 0;
+    // like Measure() and Arrange() but might re-use the result of the previous
+    // layout (which only Controls do, see Control::InvalidateLayout())
+    virtual Size MeasureIfNeeded(const Size availableSize) {
+        return Measure(availableSize);
+    }
+    virtual void ArrangeIfNeeded(const Rect finalRect) {
+        Arrange(finalRect);
+    }
 };
 
 #define SizeSelf 666.f
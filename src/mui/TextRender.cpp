@@ -2,6 +2,9 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/Dict.h"
+#include "utils/ScopedWin.h"
+#include "utils/ThreadUtil.h"
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
@@ -96,6 +99,8 @@ void TextRenderGdi::SetFont(mui::CachedFont* font) {
     if (hdcForTextMeasure) {
         RestoreHdcForTextMeasurePrevFont();
         hdcForTextMeasurePrevFont = SelectFont(hdcForTextMeasure, hfont);
+        DWORD complexFlags = GCP_DIACRITIC | GCP_GLYPHSHAPE | GCP_KASHIDA | GCP_LIGATE | GCP_REORDER;
+        currFontHasSimpleGlyphs = (GetFontLanguageInfo(hdcForTextMeasure) & complexFlags) == 0;
     }
 }
 
@@ -110,18 +115,6 @@ float TextRenderGdi::GetCurrFontLineSpacing() {
 #endif
 }
 
-RectF TextRenderGdi::Measure(const WCHAR* s, size_t sLen) {
-    SIZE txtSize;
-    GetTextExtentPoint32W(hdcForTextMeasure, s, (int)sLen, &txtSize);
-    RectF res(0.0f, 0.0f, (float)txtSize.cx, (float)txtSize.cy);
-    return res;
-}
-
-RectF TextRenderGdi::Measure(const char* s, size_t sLen) {
-    size_t strLen = strconv::Utf8ToWcharBuf(s, sLen, txtConvBuf, dimof(txtConvBuf));
-    return Measure(txtConvBuf, strLen);
-}
-
 void TextRenderGdi::SetTextColor(Gdiplus::Color col) {
     if (textColor.GetValue() == col.GetValue()) {
         return;
@@ -164,6 +157,253 @@ void TextRenderGdi::Unlock() {
     hdcGfxLocked = nullptr;
 }
 
+// Ebook pages draw the same words over and over (every repaint, every scroll)
+// so we remember the glyph indices of drawn strings and pass them to
+// ExtTextOut() with ETO_GLYPH_INDEX, which skips mapping characters to glyphs.
+// The cache is direct-mapped: a new string simply replaces whatever was in its slot
+#define GLYPH_CACHE_SLOTS 4096
+#define GLYPH_CACHE_MAX_STR_LEN 64
+
+struct CachedGlyphs {
+    HFONT font = nullptr;
+    u32 hash = 0;
+    int len = 0;
+    // len characters followed by len glyph indices
+    WCHAR* s = nullptr;
+};
+
+struct GlyphCache {
+    CRITICAL_SECTION access;
+    CachedGlyphs slots[GLYPH_CACHE_SLOTS];
+
+    GlyphCache() {
+        InitializeCriticalSection(&access);
+    }
+    ~GlyphCache() {
+        for (CachedGlyphs& slot : slots) {
+            free(slot.s);
+        }
+        DeleteCriticalSection(&access);
+    }
+};
+
+static GlyphCache gGlyphCache;
+
+// only strings where a character always maps to a single glyph that doesn't
+// interact with its neighbours (no combining marks, no complex scripts)
+static bool HasSimpleGlyphs(const WCHAR* s, size_t sLen) {
+    for (size_t i = 0; i < sLen; i++) {
+        WCHAR c = s[i];
+        if ((c >= 0x300 && c < 0x370) || c >= 0x590) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// returns false if the string has to be drawn as characters
+bool TextRenderGdi::DrawCachedGlyphs(const WCHAR* s, size_t sLen, int x, int y, uint opts) {
+    if (!currFontHasSimpleGlyphs || sLen == 0 || sLen > GLYPH_CACHE_MAX_STR_LEN || !HasSimpleGlyphs(s, sLen)) {
+        return false;
+    }
+    HFONT font = currFont->GetHFont();
+    u32 hash = MurmurHash2(s, sLen * sizeof(WCHAR));
+    CachedGlyphs& slot = gGlyphCache.slots[(hash ^ (u32)(uintptr_t)font) % GLYPH_CACHE_SLOTS];
+    WORD glyphs[GLYPH_CACHE_MAX_STR_LEN];
+
+    ScopedCritSec scope(&gGlyphCache.access);
+    if (slot.font == font && slot.hash == hash && slot.len == (int)sLen && memeq(slot.s, s, sLen * sizeof(WCHAR))) {
+        memcpy(glyphs, slot.s + sLen, sLen * sizeof(WORD));
+    } else {
+        DWORD n = GetGlyphIndicesW(hdcForTextMeasure, s, (int)sLen, glyphs, GGI_MARK_NONEXISTING_GLYPHS);
+        if (n != (DWORD)sLen) {
+            return false;
+        }
+        for (size_t i = 0; i < sLen; i++) {
+            // let ExtTextOut() do font fallback for characters the font doesn't have
+            if (glyphs[i] == 0xffff) {
+                return false;
+            }
+        }
+        WCHAR* tmp = (WCHAR*)realloc(slot.s, sLen * 2 * sizeof(WCHAR));
+        if (!tmp) {
+            return false;
+        }
+        memcpy(tmp, s, sLen * sizeof(WCHAR));
+        memcpy(tmp + sLen, glyphs, sLen * sizeof(WORD));
+        slot.s = tmp;
+        slot.font = font;
+        slot.hash = hash;
+        slot.len = (int)sLen;
+    }
+    ExtTextOutW(hdcGfxLocked, x, y, opts | ETO_GLYPH_INDEX, nullptr, (const WCHAR*)glyphs, (uint)sLen, nullptr);
+    return true;
+}
+
+// Complex scripts (Arabic, Hebrew, Indic etc.) and combining marks have to be shaped
+// (reordered, joined and ligated), which GetTextExtentPoint32() and ExtTextOut() redo
+// on every call, i.e. for every re-layout and repaint. Instead such strings are shaped
+// once with GetCharacterPlacement() and Measure() and Draw() both use the resulting
+// glyph indices (in display order) and advances. The cache is direct-mapped as well
+#define SHAPED_RUN_CACHE_SLOTS 2048
+
+struct ShapedGlyphs {
+    int nGlyphs = 0;
+    SIZE size{};
+    // a few scripts need more glyphs than characters
+    int advances[GLYPH_CACHE_MAX_STR_LEN * 2];
+    WORD glyphs[GLYPH_CACHE_MAX_STR_LEN * 2];
+};
+
+struct ShapedRun {
+    HFONT font = nullptr;
+    u32 hash = 0;
+    int len = 0;
+    bool isRtl = false;
+    // 0 if the string has to be measured and drawn as characters
+    int nGlyphs = 0;
+    SIZE size{};
+    // nGlyphs advances, nGlyphs glyph indices and len characters
+    u8* data = nullptr;
+};
+
+struct ShapedRunCache {
+    CRITICAL_SECTION access;
+    ShapedRun slots[SHAPED_RUN_CACHE_SLOTS];
+
+    ShapedRunCache() {
+        InitializeCriticalSection(&access);
+    }
+    ~ShapedRunCache() {
+        for (ShapedRun& slot : slots) {
+            free(slot.data);
+        }
+        DeleteCriticalSection(&access);
+    }
+};
+
+static ShapedRunCache gShapedRunCache;
+
+static bool NeedsShaping(const WCHAR* s, size_t sLen) {
+    for (size_t i = 0; i < sLen; i++) {
+        WCHAR c = s[i];
+        if ((c >= 0x300 && c < 0x370) || (c >= 0x590 && c < 0x10A0) || (c >= 0x1AB0 && c < 0x1B00) ||
+            (c >= 0x1DC0 && c < 0x1E00) || (c >= 0x20D0 && c < 0x2100) || (c >= 0xFB1D && c < 0xFF00)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool HasRtlChars(const WCHAR* s, size_t sLen) {
+    for (size_t i = 0; i < sLen; i++) {
+        WCHAR c = s[i];
+        if ((c >= 0x590 && c < 0x900) || (c >= 0xFB1D && c < 0xFE00) || (c >= 0xFE70 && c < 0xFF00)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// shapes s with the font selected into hdc
+static bool ShapeRun(HDC hdc, const WCHAR* s, int sLen, bool isRtl, ShapedGlyphs& res) {
+    GCP_RESULTSW gcp = {};
+    gcp.lStructSize = sizeof(gcp);
+    gcp.lpDx = res.advances;
+    gcp.lpGlyphs = (LPWSTR)res.glyphs;
+    gcp.nGlyphs = dimof(res.glyphs);
+    // use the font's default ligatures
+    res.glyphs[0] = 0;
+
+    UINT prevAlign = GetTextAlign(hdc);
+    if (isRtl) {
+        SetTextAlign(hdc, prevAlign | TA_RTLREADING);
+    }
+    DWORD flags = GetFontLanguageInfo(hdc) & FLI_MASK;
+    DWORD size = GetCharacterPlacementW(hdc, s, sLen, 0, &gcp, flags);
+    if (isRtl) {
+        SetTextAlign(hdc, prevAlign);
+    }
+    // the glyphs might not have fit
+    if (0 == size || 0 == gcp.nGlyphs || gcp.nGlyphs >= dimof(res.glyphs)) {
+        return false;
+    }
+    for (UINT i = 0; i < gcp.nGlyphs; i++) {
+        // let ExtTextOut() do font fallback for characters the font doesn't have
+        if (0 == res.glyphs[i]) {
+            return false;
+        }
+    }
+    res.nGlyphs = (int)gcp.nGlyphs;
+    res.size.cx = LOWORD(size);
+    res.size.cy = HIWORD(size);
+    return true;
+}
+
+// returns false if the string has to be measured and drawn as characters
+bool TextRenderGdi::GetShapedRun(const WCHAR* s, size_t sLen, bool isRtl, ShapedGlyphs& res) {
+    if (sLen == 0 || sLen > GLYPH_CACHE_MAX_STR_LEN || !NeedsShaping(s, sLen)) {
+        return false;
+    }
+    HFONT font = currFont->GetHFont();
+    u32 hash = MurmurHash2(s, sLen * sizeof(WCHAR));
+    ShapedRun& slot = gShapedRunCache.slots[(hash ^ (u32)(uintptr_t)font ^ (isRtl ? 1 : 0)) % SHAPED_RUN_CACHE_SLOTS];
+    {
+        ScopedCritSec scope(&gShapedRunCache.access);
+        bool isCached = slot.font == font && slot.hash == hash && slot.len == (int)sLen && slot.isRtl == isRtl;
+        u8* data = slot.data;
+        size_t charsOffset = (size_t)slot.nGlyphs * (sizeof(int) + sizeof(WORD));
+        if (isCached && memeq(data + charsOffset, s, sLen * sizeof(WCHAR))) {
+            res.nGlyphs = slot.nGlyphs;
+            res.size = slot.size;
+            memcpy(res.advances, data, slot.nGlyphs * sizeof(int));
+            memcpy(res.glyphs, data + slot.nGlyphs * sizeof(int), slot.nGlyphs * sizeof(WORD));
+            return slot.nGlyphs > 0;
+        }
+    }
+
+    // shaping is slow, so other threads can use the cache in the meantime
+    bool ok = ShapeRun(hdcForTextMeasure, s, (int)sLen, isRtl, res);
+    int nGlyphs = ok ? res.nGlyphs : 0;
+
+    // remember strings that can't be shaped as well, so that they aren't tried again
+    ScopedCritSec scope(&gShapedRunCache.access);
+    size_t charsOffset = (size_t)nGlyphs * (sizeof(int) + sizeof(WORD));
+    u8* data = (u8*)realloc(slot.data, charsOffset + sLen * sizeof(WCHAR));
+    if (!data) {
+        return ok;
+    }
+    memcpy(data, res.advances, nGlyphs * sizeof(int));
+    memcpy(data + nGlyphs * sizeof(int), res.glyphs, nGlyphs * sizeof(WORD));
+    memcpy(data + charsOffset, s, sLen * sizeof(WCHAR));
+    slot.data = data;
+    slot.font = font;
+    slot.hash = hash;
+    slot.len = (int)sLen;
+    slot.isRtl = isRtl;
+    slot.nGlyphs = nGlyphs;
+    slot.size = ok ? res.size : SIZE{};
+    return ok;
+}
+
+RectF TextRenderGdi::Measure(const WCHAR* s, size_t sLen) {
+    ShapedGlyphs shaped;
+    // the width doesn't depend on the reading direction, so measure
+    // in the direction the string is most likely to be drawn
+    if (GetShapedRun(s, sLen, HasRtlChars(s, sLen), shaped)) {
+        return RectF(0.0f, 0.0f, (float)shaped.size.cx, (float)shaped.size.cy);
+    }
+    SIZE txtSize;
+    GetTextExtentPoint32W(hdcForTextMeasure, s, (int)sLen, &txtSize);
+    RectF res(0.0f, 0.0f, (float)txtSize.cx, (float)txtSize.cy);
+    return res;
+}
+
+RectF TextRenderGdi::Measure(const char* s, size_t sLen) {
+    size_t strLen = strconv::Utf8ToWcharBuf(s, sLen, txtConvBuf, dimof(txtConvBuf));
+    return Measure(txtConvBuf, strLen);
+}
+
 void TextRenderGdi::Draw(const WCHAR* s, size_t sLen, const RectF bb, bool isRtl) {
 #if 0
     DrawTransparent(s, sLen, bb, isRtl);
@@ -172,8 +412,17 @@ void TextRenderGdi::Draw(const WCHAR* s, size_t sLen, const RectF bb, bool isRtl
     int x = (int)bb.x;
     int y = (int)bb.y;
     uint opts = ETO_OPAQUE;
+    ShapedGlyphs shaped;
+    if (GetShapedRun(s, sLen, isRtl, shaped)) {
+        // the glyphs are already in display order
+        ExtTextOutW(hdcGfxLocked, x, y, opts | ETO_GLYPH_INDEX, nullptr, (const WCHAR*)shaped.glyphs,
+                    (uint)shaped.nGlyphs, shaped.advances);
+        return;
+    }
     if (isRtl) {
         opts = opts | ETO_RTLREADING;
+    } else if (DrawCachedGlyphs(s, sLen, x, y, opts)) {
+        return;
     }
     ExtTextOut(hdcGfxLocked, x, y, opts, nullptr, s, (uint)sLen, nullptr);
 #endif
@@ -525,6 +774,74 @@ size_t StringLenForWidth(ITextRender* textMeasure, const WCHAR* s, size_t len, f
 
 // TODO: not quite sure why spaceDx1 != spaceDx2, using spaceDx2 because
 // is smaller and looks as better spacing to me
+// only words are worth caching, longer strings are unlikely to be measured again
+#define MAX_CACHED_MEASURE_LEN 64
+#define MAX_CACHED_MEASUREMENTS (64 * 1024)
+
+// measured sizes of strings for a given font and text render method
+struct TextMeasureCache {
+    CachedFont* font = nullptr;
+    TextRenderMethod method = TextRenderMethodGdiplus;
+    // maps a string to its index in sizes
+    dict::MapWStrToInt indexes{1024};
+    Vec<RectF> sizes;
+};
+
+// fonts live until mui is destroyed, so the caches can be shared by all formatters
+// (including formatters running on different threads at the same time)
+static Mutex gTextMeasureCachesMutex;
+static Vec<TextMeasureCache*> gTextMeasureCaches;
+
+static TextMeasureCache* GetTextMeasureCache(CachedFont* font, TextRenderMethod method) {
+    for (TextMeasureCache* cache : gTextMeasureCaches) {
+        if (cache->font == font && cache->method == method) {
+            return cache;
+        }
+    }
+    TextMeasureCache* cache = new TextMeasureCache();
+    cache->font = font;
+    cache->method = method;
+    gTextMeasureCaches.Append(cache);
+    return cache;
+}
+
+// same as textRender->Measure(s, sLen) for the current font (which must be font),
+// but remembers the results so that re-formatting a document (e.g. after
+// a window resize) doesn't have to measure the same words over and over
+RectF MeasureCached(ITextRender* textRender, CachedFont* font, const WCHAR* s, size_t sLen) {
+    if (!font || sLen > MAX_CACHED_MEASURE_LEN) {
+        return textRender->Measure(s, sLen);
+    }
+    WCHAR key[MAX_CACHED_MEASURE_LEN + 1];
+    memcpy(key, s, sLen * sizeof(WCHAR));
+    key[sLen] = 0;
+
+    gTextMeasureCachesMutex.Lock();
+    TextMeasureCache* cache = GetTextMeasureCache(font, textRender->method);
+    int idx;
+    if (cache->indexes.Get(key, &idx)) {
+        RectF res = cache->sizes.at(idx);
+        gTextMeasureCachesMutex.Unlock();
+        return res;
+    }
+    gTextMeasureCachesMutex.Unlock();
+
+    RectF res = textRender->Measure(s, sLen);
+
+    gTextMeasureCachesMutex.Lock();
+    if (cache->sizes.size() < MAX_CACHED_MEASUREMENTS && cache->indexes.Insert(key, (int)cache->sizes.size(), &idx)) {
+        cache->sizes.Append(res);
+    }
+    gTextMeasureCachesMutex.Unlock();
+    return res;
+}
+
+void FreeTextMeasureCaches() {
+    gTextMeasureCachesMutex.Lock();
+    DeleteVecMembers(gTextMeasureCaches);
+    gTextMeasureCachesMutex.Unlock();
+}
+
 float GetSpaceDx(ITextRender* textMeasure) {
     RectF bbox;
 #if 0
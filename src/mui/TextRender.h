@@ -10,6 +10,8 @@ enum TextRenderMethod {
     // TextRenderDirectDraw
 };
 
+struct ShapedGlyphs;
+
 class ITextRender {
   public:
     virtual void SetFont(CachedFont* font) = 0;
@@ -47,6 +49,8 @@ class TextRenderGdi : public ITextRender {
     HDC hdcForTextMeasure = nullptr;
     HGDIOBJ hdcForTextMeasurePrevFont = nullptr;
     CachedFont* currFont = nullptr;
+    // true if currFont maps characters 1:1 to glyphs, so Draw() can use cached glyph indices
+    bool currFontHasSimpleGlyphs = false;
     Gdiplus::Graphics* gfx = nullptr;
     Gdiplus::Color textColor;
     Gdiplus::Color textBgColor;
@@ -67,6 +71,8 @@ class TextRenderGdi : public ITextRender {
     void RestoreMemHdcPrevFont();
     void RestoreHdcForTextMeasurePrevFont();
     void RestoreMemHdcPrevBitmap();
+    bool DrawCachedGlyphs(const WCHAR* s, size_t sLen, int x, int y, uint opts);
+    bool GetShapedRun(const WCHAR* s, size_t sLen, bool isRtl, ShapedGlyphs& res);
 
   public:
     void CreateHdcForTextMeasure();
@@ -175,3 +181,6 @@ ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, in
 
 size_t StringLenForWidth(ITextRender* textRender, const WCHAR* s, size_t len, float dx);
 float GetSpaceDx(ITextRender* textRender);
+
+RectF MeasureCached(ITextRender* textRender, CachedFont* font, const WCHAR* s, size_t sLen);
+void FreeTextMeasureCaches();
@@ -3,6 +3,9 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/Archive.h"
+#include "utils/GdiPlusUtil.h"
+#include "utils/GuessFileType.h"
 #include "utils/WinUtil.h"
 #include "utils/LogDbg.h"
 
@@ -15,81 +18,225 @@
 #include "mui/MiniMui.h"
 #include "EngineEbook.h"
 #include "EngineImages.h"
+#include "EbookBase.h"
+#include "EbookDoc.h"
 #include "PdfPreview.h"
+#include "PreviewCache.h"
 #include "PdfPreviewBase.h"
 
-IFACEMETHODIMP PreviewBase::GetThumbnail(uint cx, HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha) {
-    EngineBase* engine = GetEngine();
-    if (!engine) {
-        return E_FAIL;
-    }
-
-    dbglogf("PdfPreview: PreviewBase::GetThumbnail(cx=%d)\n", (int)cx);
-
-    RectF page = engine->Transform(engine->PageMediabox(1), 1, 1.0, 0);
-    float zoom = std::min(cx / (float)page.dx, cx / (float)page.dy) - 0.001f;
-    Rect thumb = RectF(0, 0, page.dx * zoom, page.dy * zoom).Round();
-
+static HBITMAP CreateThumbnailDIB(Size size, u32** pixels) {
     BITMAPINFO bmi = {0};
     bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
-    bmi.bmiHeader.biHeight = thumb.dy;
-    bmi.bmiHeader.biWidth = thumb.dx;
+    bmi.bmiHeader.biHeight = size.dy;
+    bmi.bmiHeader.biWidth = size.dx;
     bmi.bmiHeader.biPlanes = 1;
     bmi.bmiHeader.biBitCount = 32;
     bmi.bmiHeader.biCompression = BI_RGB;
+    return CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, (void**)pixels, nullptr, 0);
+}
+
+// cf. http://msdn.microsoft.com/en-us/library/bb774612(v=VS.85).aspx
+static void SetOpaqueAlpha(u32* pixels, Size size) {
+    size_t n = (size_t)size.dx * (size_t)size.dy;
+    for (size_t i = 0; i < n; i++) {
+        pixels[i] |= 0xFF000000;
+    }
+}
+
+// returns the pixels of bmp if it already is a 32-bit DIB section
+static u32* GetDIBPixels32(HBITMAP hbmp) {
+    DIBSECTION ds;
+    if (GetObject(hbmp, sizeof(ds), &ds) != sizeof(ds) || ds.dsBm.bmBitsPixel != 32) {
+        return nullptr;
+    }
+    return (u32*)ds.dsBm.bmBits;
+}
 
-    u8* bmpData = nullptr;
-    HBITMAP hthumb = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, (void**)&bmpData, nullptr, 0);
+// scales bmp into a new 32-bit DIB section of the given size
+static HBITMAP StretchIntoThumbnailDIB(RenderedBitmap* bmp, Size size) {
+    u32* pixels = nullptr;
+    HBITMAP hthumb = CreateThumbnailDIB(size, &pixels);
     if (!hthumb) {
-        return E_OUTOFMEMORY;
+        return nullptr;
+    }
+    HDC hdc = CreateCompatibleDC(nullptr);
+    HGDIOBJ oldBmp = SelectObject(hdc, hthumb);
+    bool ok = bmp->StretchDIBits(hdc, Rect(0, 0, size.dx, size.dy));
+    SelectObject(hdc, oldBmp);
+    DeleteDC(hdc);
+    if (!ok) {
+        DeleteObject(hthumb);
+        return nullptr;
+    }
+    SetOpaqueAlpha(pixels, size);
+    return hthumb;
+}
+
+static Size FitThumbnailSize(Size size, uint cx) {
+    float zoom = std::min(cx / (float)size.dx, cx / (float)size.dy);
+    int dx = std::max((int)(size.dx * zoom), 1);
+    int dy = std::max((int)(size.dy * zoom), 1);
+    return Size(dx, dy);
+}
+
+static HBITMAP RenderThumbnail(EngineBase* engine, uint cx) {
+    RectF page = engine->Transform(engine->PageMediabox(1), 1, 1.0, 0);
+    float zoom = std::min(cx / (float)page.dx, cx / (float)page.dy) - 0.001f;
+    Rect thumb = RectF(0, 0, page.dx * zoom, page.dy * zoom).Round();
+    if (thumb.IsEmpty()) {
+        return nullptr;
     }
 
     page = engine->Transform(ToRectFl(thumb), 1, zoom, 0, true);
     RenderPageArgs args(1, zoom, 0, &page);
     RenderedBitmap* bmp = engine->RenderPage(args);
+    if (!bmp) {
+        return nullptr;
+    }
+
+    HBITMAP hthumb = nullptr;
+    u32* pixels = GetDIBPixels32(bmp->GetBitmap());
+    if (pixels && bmp->Size() == thumb.Size()) {
+        // the engine rendered straight into a DIB section of the final size,
+        // so only the alpha channel has to be fixed up
+        SetOpaqueAlpha(pixels, thumb.Size());
+        hthumb = bmp->hbmp;
+        bmp->hbmp = nullptr;
+    } else {
+        // e.g. palette bitmaps for grayscale pages
+        hthumb = StretchIntoThumbnailDIB(bmp, thumb.Size());
+    }
+    delete bmp;
+    return hthumb;
+}
+
+// decodes a cover image, JPEGs at a reduced size if they're much larger than needed
+static RenderedBitmap* DecodeThumbnailImage(std::span<u8> data, uint cx) {
+    if (data.empty()) {
+        return nullptr;
+    }
+    Gdiplus::Bitmap* bmp = nullptr;
+    Size size = BitmapSizeFromData(data);
+    int l2factor = 0;
+    while ((uint)std::max(size.dx, size.dy) >> (l2factor + 1) >= cx) {
+        l2factor++;
+    }
+    if (l2factor > 0) {
+        bmp = BitmapFromDataReduced(data, l2factor);
+    }
+    if (!bmp) {
+        bmp = BitmapFromData(data);
+    }
+    if (!bmp) {
+        return nullptr;
+    }
+
+    HBITMAP hbmp;
+    RenderedBitmap* rendered = nullptr;
+    if (bmp->GetHBITMAP((Gdiplus::ARGB)Gdiplus::Color::White, &hbmp) == Gdiplus::Ok) {
+        rendered = new RenderedBitmap(hbmp, Size(bmp->GetWidth(), bmp->GetHeight()));
+    }
+    delete bmp;
+    return rendered;
+}
+
+IFACEMETHODIMP PreviewBase::GetThumbnail(uint cx, HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha) {
+    dbglogf("PdfPreview: PreviewBase::GetThumbnail(cx=%d)\n", (int)cx);
+    if (!cx) {
+        return E_INVALIDARG;
+    }
 
-    HDC hdc = GetDC(nullptr);
-    if (bmp && GetDIBits(hdc, bmp->GetBitmap(), 0, thumb.dy, bmpData, &bmi, DIB_RGB_COLORS)) {
-        // cf. http://msdn.microsoft.com/en-us/library/bb774612(v=VS.85).aspx
-        for (int i = 0; i < thumb.dx * thumb.dy; i++) {
-            bmpData[4 * i + 3] = 0xFF;
+    Size reqSize((int)cx, (int)cx);
+    if (m_hasCacheKey) {
+        HBITMAP hthumb = LoadCachedPreview(m_cacheKey, 0, reqSize, nullptr);
+        if (hthumb) {
+            dbglog("PdfPreview: using a cached thumbnail\n");
+            *phbmp = hthumb;
+            if (pdwAlpha) {
+                *pdwAlpha = WTSAT_RGB;
+            }
+            return S_OK;
         }
+    }
 
-        *phbmp = hthumb;
-        if (pdwAlpha) {
-            *pdwAlpha = WTSAT_RGB;
+    HBITMAP hthumb = nullptr;
+    // Explorer asks for the thumbnails of all files in a folder, so a ready-made
+    // thumbnail is preferred to loading the document and rendering its first page
+    // (as long as it doesn't have to be enlarged)
+    if (!m_engine && m_pStream) {
+        RenderedBitmap* bmp = LoadEmbeddedThumbnail(m_pStream, cx);
+        if (bmp) {
+            Size size = bmp->Size();
+            if ((uint)std::max(size.dx, size.dy) >= cx) {
+                dbglog("PdfPreview: using an embedded thumbnail\n");
+                hthumb = StretchIntoThumbnailDIB(bmp, FitThumbnailSize(size, cx));
+            }
+            delete bmp;
         }
-    } else {
-        DeleteObject(hthumb);
-        hthumb = nullptr;
     }
 
-    ReleaseDC(nullptr, hdc);
-    delete bmp;
+    if (!hthumb) {
+        EngineBase* engine = GetEngine();
+        if (!engine) {
+            return E_FAIL;
+        }
+        hthumb = RenderThumbnail(engine, cx);
+    }
+    if (!hthumb) {
+        return E_NOTIMPL;
+    }
+    if (m_hasCacheKey) {
+        SaveCachedPreview(m_cacheKey, 0, reqSize, hthumb);
+    }
 
-    return hthumb ? S_OK : E_NOTIMPL;
+    *phbmp = hthumb;
+    if (pdwAlpha) {
+        *pdwAlpha = WTSAT_RGB;
+    }
+    return S_OK;
 }
 
 #define COL_WINDOW_BG RGB(0x99, 0x99, 0x99)
 #define PREVIEW_MARGIN 2
 #define UWM_PAINT_AGAIN (WM_USER + 101)
+// number of pages rendered ahead on either side of the visible page
+#define PREVIEW_RENDER_AHEAD 1
+// rendered pages kept in memory (the visible page, its neighbours and a few recent ones)
+#define MAX_PREVIEW_PAGES 5
+
+struct PreviewPage {
+    int pageNo = 0;
+    float zoom = 0;
+    Size size;
+    RenderedBitmap* bmp = nullptr;
+};
 
+// renders pages on a background thread: the visible page first, then its
+// neighbours. renders of pages that are no longer wanted are aborted
 class PageRenderer {
     EngineBase* engine;
     HWND hwnd;
-
-    int currPage;
-    RenderedBitmap* currBmp;
-    // due to rounding differences, currBmp->Size() and currSize can differ slightly
-    Size currSize;
-    int reqPage;
-    float reqZoom;
-    Size reqSize;
-    bool reqAbort;
+    // rendered pages are shared with other processes if set
+    const PreviewCacheKey* cacheKey;
+    int pageCount;
+    // page rectangles at zoom 1.0 (empty until first needed)
+    Vec<RectF> pageRects;
+
+    CRITICAL_SECTION access;
+    // most recently used first
+    Vec<PreviewPage> pages;
+    // requests in the order they're to be rendered
+    Vec<PreviewPage> queue;
+    PreviewPage curr;
+    // set by Render if curr is still one of the pages to render
+    bool currWanted;
+    bool currAborted;
     AbortCookie* abortCookie;
+    int visiblePage;
 
-    CRITICAL_SECTION currAccess;
     HANDLE thread;
+    HANDLE wakeUp;
+    bool stopThread;
 
     // seeking inside an IStream spins an inner event loop
     // which can cause reentrance in OnPaint and leave an
@@ -99,87 +246,241 @@ class PageRenderer {
     bool preventRecursion;
 
   public:
-    PageRenderer(EngineBase* engine, HWND hwnd)
+    PageRenderer(EngineBase* engine, HWND hwnd, const PreviewCacheKey* cacheKey)
         : engine(engine),
           hwnd(hwnd),
-          currPage(0),
-          currBmp(nullptr),
-          reqPage(0),
-          reqZoom(0),
-          reqAbort(false),
+          cacheKey(cacheKey),
+          currWanted(false),
+          currAborted(false),
           abortCookie(nullptr),
+          visiblePage(0),
           thread(nullptr),
+          stopThread(false),
           preventRecursion(false) {
-        InitializeCriticalSection(&currAccess);
+        InitializeCriticalSection(&access);
+        pageCount = engine->PageCount();
+        pageRects.AppendBlanks(pageCount + 1);
+        wakeUp = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        thread = CreateThread(nullptr, 0, RenderThread, this, 0, 0);
     }
     ~PageRenderer() {
+        EnterCriticalSection(&access);
+        stopThread = true;
+        if (abortCookie) {
+            abortCookie->Abort();
+        }
+        LeaveCriticalSection(&access);
+        SetEvent(wakeUp);
         if (thread) {
             WaitForSingleObject(thread, INFINITE);
+            CloseHandle(thread);
         }
-        delete currBmp;
-        DeleteCriticalSection(&currAccess);
+        CloseHandle(wakeUp);
+        for (PreviewPage& page : pages) {
+            delete page.bmp;
+        }
+        DeleteCriticalSection(&access);
     }
 
     RectF GetPageRect(int pageNo) {
-        if (preventRecursion) {
+        if (pageNo < 1 || pageNo > pageCount) {
             return RectF();
         }
+        if (!pageRects.at(pageNo).IsEmpty() || preventRecursion) {
+            return pageRects.at(pageNo);
+        }
 
         preventRecursion = true;
         // assume that any engine methods could lead to a seek
         RectF bbox = engine->PageMediabox(pageNo);
         bbox = engine->Transform(bbox, pageNo, 1.0, 0);
         preventRecursion = false;
+        pageRects.at(pageNo) = bbox;
         return bbox;
     }
 
-    void Render(HDC hdc, Rect target, int pageNo, float zoom) {
+    // returns the page's rectangle centered in area (empty if unknown)
+    Rect GetPageOnScreen(int pageNo, Rect area, float* zoom) {
+        RectF page = GetPageRect(pageNo);
+        if (page.IsEmpty()) {
+            return Rect();
+        }
+        *zoom = (float)std::min(area.dx / page.dx, area.dy / page.dy) - 0.001f;
+        Rect onScreen = RectF((float)area.x, (float)area.y, (float)page.dx * *zoom, (float)page.dy * *zoom).Round();
+        onScreen.Offset((area.dx - onScreen.dx) / 2, (area.dy - onScreen.dy) / 2);
+        return onScreen;
+    }
+
+    void Render(HDC hdc, Rect target, int pageNo, float zoom, Rect area) {
         dbglog("PdfPreview: PageRenderer::Render()\n");
 
-        ScopedCritSec scope(&currAccess);
-        if (currBmp && currPage == pageNo && currSize == target.Size()) {
-            currBmp->StretchDIBits(hdc, target);
-        } else if (!thread) {
-            reqPage = pageNo;
-            reqZoom = zoom;
-            reqSize = target.Size();
-            reqAbort = false;
-            thread = CreateThread(nullptr, 0, RenderThread, this, 0, 0);
-        } else if (reqPage != pageNo || reqSize != target.Size()) {
+        ScopedCritSec scope(&access);
+        visiblePage = pageNo;
+
+        int idx = FindPage(pageNo, target.Size());
+        if (idx < 0 && LoadCachedPage(pageNo, zoom, target.Size())) {
+            idx = 0;
+        }
+        if (idx >= 0) {
+            PreviewPage page = pages.at(idx);
+            pages.RemoveAt(idx);
+            pages.InsertAt(0, page);
+            page.bmp->StretchDIBits(hdc, target);
+        }
+
+        // the visible page first, then the following and the preceding ones
+        queue.Reset();
+        currWanted = false;
+        QueuePage(pageNo, zoom, target.Size());
+        for (int n = 1; n <= PREVIEW_RENDER_AHEAD; n++) {
+            QueueNeighbour(pageNo + n, area);
+            QueueNeighbour(pageNo - n, area);
+        }
+        // don't let pages that aren't wanted anymore (or a neighbour) delay the visible page
+        bool visibleQueued = queue.size() > 0 && queue.at(0).pageNo == pageNo;
+        if (curr.pageNo && !currAborted && (!currWanted || visibleQueued)) {
             if (abortCookie) {
                 abortCookie->Abort();
             }
-            reqAbort = true;
+            currAborted = true;
+            if (currWanted) {
+                PreviewPage page = curr;
+                queue.InsertAt(1, page);
+            }
+        }
+        if (queue.size() > 0) {
+            SetEvent(wakeUp);
         }
     }
 
   protected:
-    static DWORD WINAPI RenderThread(LPVOID data) {
-        ScopedCom comScope; // because the engine reads data from a COM IStream
+    int FindPage(int pageNo, Size size) {
+        for (size_t i = 0; i < pages.size(); i++) {
+            if (pages.at(i).pageNo == pageNo && pages.at(i).size == size) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
 
-        PageRenderer* pr = (PageRenderer*)data;
-        RenderPageArgs args(pr->reqPage, pr->reqZoom, 0, nullptr, RenderTarget::View, &pr->abortCookie);
-        RenderedBitmap* bmp = pr->engine->RenderPage(args);
+    void QueuePage(int pageNo, float zoom, Size size) {
+        if (FindPage(pageNo, size) >= 0) {
+            return;
+        }
+        if (curr.pageNo == pageNo && curr.size == size && !currAborted) {
+            currWanted = true;
+            return;
+        }
+        PreviewPage page;
+        page.pageNo = pageNo;
+        page.zoom = zoom;
+        page.size = size;
+        queue.Append(page);
+    }
+
+    void QueueNeighbour(int pageNo, Rect area) {
+        if (pageNo < 1 || pageNo > pageCount) {
+            return;
+        }
+        float zoom;
+        Rect onScreen = GetPageOnScreen(pageNo, area, &zoom);
+        if (!onScreen.IsEmpty()) {
+            QueuePage(pageNo, zoom, onScreen.Size());
+        }
+    }
 
-        ScopedCritSec scope(&pr->currAccess);
+    // must be called with access held, the new page is the most recently used
+    void AddPage(PreviewPage page) {
+        pages.InsertAt(0, page);
+        while (pages.size() > MAX_PREVIEW_PAGES) {
+            delete pages.Last().bmp;
+            pages.RemoveAt(pages.size() - 1);
+        }
+    }
 
-        if (!pr->reqAbort) {
-            delete pr->currBmp;
-            pr->currBmp = bmp;
-            pr->currPage = pr->reqPage;
-            pr->currSize = pr->reqSize;
+    bool LoadCachedPage(int pageNo, float zoom, Size size) {
+        if (!cacheKey) {
+            return false;
+        }
+        Size bmpSize;
+        HBITMAP hbmp = LoadCachedPreview(*cacheKey, pageNo, size, &bmpSize);
+        if (!hbmp) {
+            return false;
+        }
+        dbglog("PdfPreview: using a cached page\n");
+        PreviewPage page;
+        page.pageNo = pageNo;
+        page.zoom = zoom;
+        page.size = size;
+        page.bmp = new RenderedBitmap(hbmp, bmpSize);
+        AddPage(page);
+        return true;
+    }
+
+    // returns false if the thread is to be stopped
+    bool RenderNext() {
+        EnterCriticalSection(&access);
+        if (stopThread || queue.size() == 0) {
+            bool stop = stopThread;
+            LeaveCriticalSection(&access);
+            return !stop;
+        }
+        curr = queue.at(0);
+        queue.RemoveAt(0);
+        currAborted = false;
+        LeaveCriticalSection(&access);
+
+        RenderPageArgs args(curr.pageNo, curr.zoom, 0, nullptr, RenderTarget::View, &abortCookie);
+        RenderedBitmap* bmp = engine->RenderPage(args);
+
+        EnterCriticalSection(&access);
+        PreviewPage page = curr;
+        bool aborted = currAborted || stopThread;
+        curr = PreviewPage();
+        delete abortCookie;
+        abortCookie = nullptr;
+        bool isVisible = page.pageNo == visiblePage;
+        if (bmp && !aborted) {
+            page.bmp = bmp;
+            AddPage(page);
+            if (cacheKey) {
+                SaveCachedPreview(*cacheKey, page.pageNo, page.size, bmp->GetBitmap());
+            }
         } else {
             delete bmp;
         }
-        delete pr->abortCookie;
-        pr->abortCookie = nullptr;
+        bool stop = stopThread;
+        LeaveCriticalSection(&access);
+
+        if (bmp && !aborted && isVisible) {
+            PostMessageW(hwnd, UWM_PAINT_AGAIN, 0, 0);
+        }
+        return !stop;
+    }
 
-        HANDLE th = pr->thread;
-        pr->thread = nullptr;
-        PostMessageW(pr->hwnd, UWM_PAINT_AGAIN, 0, 0);
+    static DWORD WINAPI RenderThread(LPVOID data) {
+        ScopedCom comScope; // because the engine reads data from a COM IStream
 
-        CloseHandle(th);
-        return 0;
+        PageRenderer* pr = (PageRenderer*)data;
+        for (;;) {
+            WaitForSingleObject(pr->wakeUp, INFINITE);
+            // render until the queue is empty
+            for (;;) {
+                EnterCriticalSection(&pr->access);
+                bool idle = pr->queue.size() == 0;
+                bool stop = pr->stopThread;
+                LeaveCriticalSection(&pr->access);
+                if (stop) {
+                    return 0;
+                }
+                if (idle) {
+                    break;
+                }
+                if (!pr->RenderNext()) {
+                    return 0;
+                }
+            }
+        }
     }
 };
 
@@ -195,16 +496,13 @@ static LRESULT OnPaint(HWND hwnd) {
     PreviewBase* preview = (PreviewBase*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
     if (preview && preview->renderer) {
         int pageNo = GetScrollPos(hwnd, SB_VERT);
-        RectF page = preview->renderer->GetPageRect(pageNo);
-        if (!page.IsEmpty()) {
-            rect.Inflate(-PREVIEW_MARGIN, -PREVIEW_MARGIN);
-            float zoom = (float)std::min(rect.dx / page.dx, rect.dy / page.dy) - 0.001f;
-            Rect onScreen = RectF((float)rect.x, (float)rect.y, (float)page.dx * zoom, (float)page.dy * zoom).Round();
-            onScreen.Offset((rect.dx - onScreen.dx) / 2, (rect.dy - onScreen.dy) / 2);
-
+        rect.Inflate(-PREVIEW_MARGIN, -PREVIEW_MARGIN);
+        float zoom;
+        Rect onScreen = preview->renderer->GetPageOnScreen(pageNo, rect, &zoom);
+        if (!onScreen.IsEmpty()) {
             RECT rcPage = ToRECT(onScreen);
             FillRect(hdc, &rcPage, brushWhite);
-            preview->renderer->Render(hdc, onScreen, pageNo, zoom);
+            preview->renderer->Render(hdc, onScreen, pageNo, zoom, rect);
         }
     }
 
@@ -330,7 +628,7 @@ IFACEMETHODIMP PreviewBase::DoPreview() {
     int pageCount = 1;
     if (engine) {
         pageCount = engine->PageCount();
-        this->renderer = new PageRenderer(engine, m_hwnd);
+        this->renderer = new PageRenderer(engine, m_hwnd, m_hasCacheKey ? &m_cacheKey : nullptr);
         // don't use the engine afterwards directly (cf. PageRenderer::preventRecursion)
         engine = nullptr;
     }
@@ -353,6 +651,11 @@ EngineBase* CPdfPreview::LoadEngine(IStream* stream) {
     return CreateEnginePdfFromStream(stream);
 }
 
+RenderedBitmap* CPdfPreview::LoadEmbeddedThumbnail(IStream* stream, uint cx) {
+    UNUSED(cx);
+    return LoadEmbeddedPdfThumbnail(stream);
+}
+
 EngineBase* CXpsPreview::LoadEngine(IStream* stream) {
     return CreateXpsEngineFromStream(stream);
 }
@@ -376,6 +679,11 @@ EngineBase* CEpubPreview::LoadEngine(IStream* stream) {
     return CreateEpubEngineFromStream(stream);
 }
 
+RenderedBitmap* CEpubPreview::LoadEmbeddedThumbnail(IStream* stream, uint cx) {
+    AutoFree data = EpubDoc::LoadCoverImage(stream);
+    return DecodeThumbnailImage(data.AsSpan(), cx);
+}
+
 CFb2Preview::CFb2Preview(long* plRefCount) : PreviewBase(plRefCount, SZ_FB2_PREVIEW_CLSID) {
     m_gdiScope = new ScopedGdiPlus();
     mui::Initialize();
@@ -406,6 +714,51 @@ EngineBase* CCbxPreview::LoadEngine(IStream* stream) {
     return CreateCbxEngineFromStream(stream);
 }
 
+static bool IsCbxPageFile(const char* fileName) {
+    if (str::IsEmpty(fileName) || str::StartsWith(path::GetBaseNameNoFree(fileName), ".")) {
+        return false;
+    }
+    AutoFreeWstr fileNameW = strconv::Utf8ToWstr(fileName);
+    return IsImageEngineSupportedFileType(GuessFileTypeFromName(fileNameW));
+}
+
+// the cover is the first page in natural sort order (as in EngineCbx)
+static std::span<u8> LoadCbxCoverImage(MultiFormatArchive* archive) {
+    MultiFormatArchive::FileInfo* cover = nullptr;
+    for (auto* fileInfo : archive->GetFileInfos()) {
+        const char* fileName = fileInfo->name.data();
+        if (!IsCbxPageFile(fileName)) {
+            continue;
+        }
+        if (!cover || str::CmpNatural(fileName, cover->name.data()) < 0) {
+            cover = fileInfo;
+        }
+    }
+    if (!cover) {
+        return {};
+    }
+    return archive->GetFileDataById(cover->fileId);
+}
+
+RenderedBitmap* CCbxPreview::LoadEmbeddedThumbnail(IStream* stream, uint cx) {
+    MultiFormatArchive* archive = OpenZipArchive(stream, false);
+    if (!archive) {
+        archive = OpenRarArchive(stream);
+    }
+    if (!archive) {
+        archive = Open7zArchive(stream);
+    }
+    if (!archive) {
+        archive = OpenTarArchive(stream);
+    }
+    if (!archive) {
+        return nullptr;
+    }
+    AutoFree data = LoadCbxCoverImage(archive);
+    delete archive;
+    return DecodeThumbnailImage(data.AsSpan(), cx);
+}
+
 EngineBase* CTgaPreview::LoadEngine(IStream* stream) {
     return CreateImageEngineFromStream(stream);
 }
@@ -25,7 +25,8 @@ class PreviewBase : public IThumbnailProvider,
           m_hwnd(nullptr),
           m_hwndParent(nullptr),
           m_clsid(clsid),
-          m_extractCx(0) {
+          m_extractCx(0),
+          m_hasCacheKey(false) {
         InterlockedIncrement(m_plModuleRef);
         m_dateStamp.dwLowDateTime = m_dateStamp.dwHighDateTime = 0;
     }
@@ -70,6 +71,7 @@ class PreviewBase : public IThumbnailProvider,
         if (!m_pStream)
             return E_INVALIDARG;
         m_pStream->AddRef();
+        m_hasCacheKey = GetPreviewCacheKey(m_pStream, &m_cacheKey);
         return S_OK;
     };
 
@@ -137,6 +139,7 @@ class PreviewBase : public IThumbnailProvider,
             m_hwnd = nullptr;
         }
         m_pStream = nullptr;
+        m_hasCacheKey = false;
         delete m_engine;
         m_engine = nullptr;
         return S_OK;
@@ -191,6 +194,8 @@ class PreviewBase : public IThumbnailProvider,
         }
         HRESULT res = Initialize(pStm, 0);
         pStm->Release();
+        // the HGLOBAL stream doesn't know which file it was read from
+        m_hasCacheKey = GetPreviewCacheKey(pszFileName, size, m_dateStamp, &m_cacheKey);
         return res;
     }
     IFACEMETHODIMP IsDirty() {
@@ -266,8 +271,18 @@ class PreviewBase : public IThumbnailProvider,
     const WCHAR* m_clsid;
     uint m_extractCx;
     FILETIME m_dateStamp;
+    // for the cache shared with other processes
+    PreviewCacheKey m_cacheKey;
+    bool m_hasCacheKey;
 
     virtual EngineBase* LoadEngine(IStream* stream) = 0;
+    // returns a ready-made thumbnail (e.g. an embedded page thumbnail or
+    // a cover image) that's cheaper to get than loading the whole document
+    virtual RenderedBitmap* LoadEmbeddedThumbnail(IStream* stream, uint cx) {
+        UNUSED(stream);
+        UNUSED(cx);
+        return nullptr;
+    }
 };
 
 class CPdfPreview : public PreviewBase {
@@ -277,6 +292,7 @@ class CPdfPreview : public PreviewBase {
 
   protected:
     EngineBase* LoadEngine(IStream* stream) override;
+    RenderedBitmap* LoadEmbeddedThumbnail(IStream* stream, uint cx) override;
 };
 
 class CXpsPreview : public PreviewBase {
@@ -305,6 +321,7 @@ class CEpubPreview : public PreviewBase {
 
   protected:
     virtual EngineBase* LoadEngine(IStream* stream);
+    RenderedBitmap* LoadEmbeddedThumbnail(IStream* stream, uint cx) override;
 };
 
 class CFb2Preview : public PreviewBase {
@@ -333,6 +350,7 @@ class CCbxPreview : public PreviewBase {
 
   protected:
     virtual EngineBase* LoadEngine(IStream* stream);
+    RenderedBitmap* LoadEmbeddedThumbnail(IStream* stream, uint cx) override;
 };
 
 class CTgaPreview : public PreviewBase {
@@ -12,6 +12,7 @@
 #include "Annotation.h"
 #include "EngineBase.h"
 #include "PdfPreview.h"
+#include "PreviewCache.h"
 #include "PdfPreviewBase.h"
 
 long g_lRefCount = 0;
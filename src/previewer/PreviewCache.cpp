@@ -0,0 +1,274 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/WinUtil.h"
+#include "utils/LogDbg.h"
+
+#include "PreviewCache.h"
+
+// the cache file consists of a PreviewCacheHeader followed by the pixel data of
+// all entries which is written like a ring buffer (new data overwrites the oldest)
+
+#define PREVIEW_CACHE_FILE_NAME L"PreviewCache.dat"
+#define PREVIEW_CACHE_MUTEX_NAME L"SumatraPDF-PreviewCache-Mutex"
+#define PREVIEW_CACHE_MAGIC 0x32435053 // "SPC2"
+#define PREVIEW_CACHE_DATA_SIZE (48 * 1024 * 1024)
+#define PREVIEW_CACHE_MAX_ENTRIES 2048
+// don't let a single preview page evict too much of the cache
+#define PREVIEW_CACHE_MAX_BITMAP_SIZE (PREVIEW_CACHE_DATA_SIZE / 8)
+// waiting longer than that is slower than just rendering again
+#define PREVIEW_CACHE_LOCK_TIMEOUT_MS 1000
+
+struct PreviewCacheEntry {
+    PreviewCacheKey key;
+    int pageNo;
+    int reqDx, reqDy;
+    // negative for top-down DIBs (as in BITMAPINFOHEADER)
+    int dx, dy;
+    u32 dataOffset;
+    // 0 for unused entries
+    u32 dataLen;
+};
+
+struct PreviewCacheHeader {
+    u32 magic;
+    u32 dataSize;
+    u32 nextDataOffset;
+    u32 nextEntry;
+    PreviewCacheEntry entries[PREVIEW_CACHE_MAX_ENTRIES];
+};
+
+struct PreviewCache {
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMap = nullptr;
+    HANDLE hMutex = nullptr;
+    PreviewCacheHeader* header = nullptr;
+    u8* data = nullptr;
+};
+
+static PreviewCache gCache;
+static INIT_ONCE gCacheInitOnce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK OpenPreviewCache(INIT_ONCE*, void*, void**) {
+    AutoFreeWstr dir = GetSpecialFolder(CSIDL_LOCAL_APPDATA, true);
+    if (!dir) {
+        return TRUE;
+    }
+    dir.Set(path::Join(dir, L"SumatraPDF"));
+    dir::Create(dir);
+    AutoFreeWstr path = path::Join(dir, PREVIEW_CACHE_FILE_NAME);
+
+    // processes without write access (e.g. at low integrity) just don't use the cache
+    gCache.hMutex = CreateMutexW(nullptr, FALSE, PREVIEW_CACHE_MUTEX_NAME);
+    if (!gCache.hMutex) {
+        return TRUE;
+    }
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    gCache.hFile = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, share, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                               nullptr);
+    if (gCache.hFile == INVALID_HANDLE_VALUE) {
+        return TRUE;
+    }
+    DWORD size = sizeof(PreviewCacheHeader) + PREVIEW_CACHE_DATA_SIZE;
+    gCache.hMap = CreateFileMappingW(gCache.hFile, nullptr, PAGE_READWRITE, 0, size, nullptr);
+    if (!gCache.hMap) {
+        return TRUE;
+    }
+    void* view = MapViewOfFile(gCache.hMap, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, size);
+    if (!view) {
+        return TRUE;
+    }
+    gCache.header = (PreviewCacheHeader*)view;
+    gCache.data = (u8*)view + sizeof(PreviewCacheHeader);
+    dbglog("PdfPreview: opened the preview cache\n");
+    return TRUE;
+}
+
+class ScopedPreviewCacheLock {
+    bool locked = false;
+
+  public:
+    ScopedPreviewCacheLock() {
+        InitOnceExecuteOnce(&gCacheInitOnce, OpenPreviewCache, nullptr, nullptr);
+        if (!gCache.header) {
+            return;
+        }
+        DWORD res = WaitForSingleObject(gCache.hMutex, PREVIEW_CACHE_LOCK_TIMEOUT_MS);
+        // a process crashing while holding the lock leaves the data in an
+        // unknown state, so start over in that case
+        if (WAIT_ABANDONED == res) {
+            gCache.header->magic = 0;
+        }
+        locked = (WAIT_OBJECT_0 == res || WAIT_ABANDONED == res);
+        if (locked && (gCache.header->magic != PREVIEW_CACHE_MAGIC ||
+                       gCache.header->dataSize != PREVIEW_CACHE_DATA_SIZE)) {
+            ZeroMemory(gCache.header, sizeof(PreviewCacheHeader));
+            gCache.header->magic = PREVIEW_CACHE_MAGIC;
+            gCache.header->dataSize = PREVIEW_CACHE_DATA_SIZE;
+        }
+    }
+    ~ScopedPreviewCacheLock() {
+        if (locked) {
+            ReleaseMutex(gCache.hMutex);
+        }
+    }
+    bool IsLocked() const {
+        return locked;
+    }
+};
+
+static void CalcPreviewCacheKey(const WCHAR* name, i64 size, FILETIME modified, PreviewCacheKey* key) {
+    AutoFree nameU = strconv::WstrToUtf8(name);
+    AutoFree s = str::Format("%s|%lld|%u|%u", nameU.Get(), size, modified.dwHighDateTime, modified.dwLowDateTime);
+    str::ToLowerInPlace(s.Get());
+    CalcFastDigest(s.Get(), str::Len(s), key->digest);
+}
+
+// IStream::Stat only returns the file's name (not its path) which together with
+// the size and the modification time is unique enough for our purposes
+bool GetPreviewCacheKey(IStream* stream, PreviewCacheKey* key) {
+    STATSTG stat{};
+    if (FAILED(stream->Stat(&stat, STATFLAG_DEFAULT))) {
+        return false;
+    }
+    bool ok = stat.pwcsName && (stat.mtime.dwLowDateTime || stat.mtime.dwHighDateTime);
+    if (ok) {
+        CalcPreviewCacheKey(path::GetBaseNameNoFree(stat.pwcsName), (i64)stat.cbSize.QuadPart, stat.mtime, key);
+    }
+    CoTaskMemFree(stat.pwcsName);
+    return ok;
+}
+
+bool GetPreviewCacheKey(const WCHAR* filePath, i64 fileSize, FILETIME modified, PreviewCacheKey* key) {
+    if (!filePath || (!modified.dwLowDateTime && !modified.dwHighDateTime)) {
+        return false;
+    }
+    CalcPreviewCacheKey(path::GetBaseNameNoFree(filePath), fileSize, modified, key);
+    return true;
+}
+
+static PreviewCacheEntry* FindEntry(const PreviewCacheKey& key, int pageNo, Size reqSize) {
+    for (PreviewCacheEntry& e : gCache.header->entries) {
+        if (e.dataLen != 0 && e.pageNo == pageNo && e.reqDx == reqSize.dx && e.reqDy == reqSize.dy &&
+            memeq(&e.key, &key, sizeof(key))) {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+static u32 GetBitmapDataLen(int dx, int dy) {
+    return (u32)dx * (u32)abs(dy) * 4;
+}
+
+static HBITMAP CreatePreviewDIB(int dx, int dy, void** bits) {
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = dx;
+    bmi.bmiHeader.biHeight = dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    return CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, bits, nullptr, 0);
+}
+
+HBITMAP LoadCachedPreview(const PreviewCacheKey& key, int pageNo, Size reqSize, Size* bmpSize) {
+    ScopedPreviewCacheLock lock;
+    if (!lock.IsLocked()) {
+        return nullptr;
+    }
+    PreviewCacheEntry* e = FindEntry(key, pageNo, reqSize);
+    if (!e) {
+        return nullptr;
+    }
+    u32 dataSize = gCache.header->dataSize;
+    if (e->dx <= 0 || e->dy == 0 || e->dataLen != GetBitmapDataLen(e->dx, e->dy) || e->dataOffset > dataSize ||
+        e->dataLen > dataSize - e->dataOffset) {
+        e->dataLen = 0;
+        return nullptr;
+    }
+    void* bits = nullptr;
+    HBITMAP hbmp = CreatePreviewDIB(e->dx, e->dy, &bits);
+    if (!hbmp) {
+        return nullptr;
+    }
+    memcpy(bits, gCache.data + e->dataOffset, e->dataLen);
+    if (bmpSize) {
+        *bmpSize = Size(e->dx, abs(e->dy));
+    }
+    return hbmp;
+}
+
+// reserves len bytes at the ring buffer's current position and
+// drops all entries whose data is about to be overwritten
+static u32 AllocData(u32 len) {
+    PreviewCacheHeader* h = gCache.header;
+    if (h->nextDataOffset > h->dataSize || len > h->dataSize - h->nextDataOffset) {
+        h->nextDataOffset = 0;
+    }
+    u32 offset = h->nextDataOffset;
+    for (PreviewCacheEntry& e : h->entries) {
+        if (e.dataLen != 0 && e.dataOffset < offset + len && offset < e.dataOffset + e.dataLen) {
+            e.dataLen = 0;
+        }
+    }
+    h->nextDataOffset = offset + len;
+    return offset;
+}
+
+void SaveCachedPreview(const PreviewCacheKey& key, int pageNo, Size reqSize, HBITMAP hbmp) {
+    DIBSECTION ds;
+    if (GetObject(hbmp, sizeof(ds), &ds) != sizeof(ds) || !ds.dsBm.bmBits) {
+        return;
+    }
+    int dx = ds.dsBmih.biWidth;
+    int dy = ds.dsBmih.biHeight;
+    u32 len = GetBitmapDataLen(dx, dy);
+    if (dx <= 0 || dy == 0 || len > PREVIEW_CACHE_MAX_BITMAP_SIZE) {
+        return;
+    }
+
+    // e.g. palette bitmaps for grayscale pages are stored as 32-bit DIBs
+    HBITMAP hbmp32 = nullptr;
+    void* bits = ds.dsBm.bmBits;
+    if (ds.dsBm.bmBitsPixel != 32) {
+        hbmp32 = CreatePreviewDIB(dx, dy, &bits);
+        if (!hbmp32) {
+            return;
+        }
+        HDC hdc = CreateCompatibleDC(nullptr);
+        HGDIOBJ oldBmp = SelectObject(hdc, hbmp32);
+        BlitHBITMAP(hbmp, hdc, Rect(0, 0, dx, abs(dy)));
+        SelectObject(hdc, oldBmp);
+        DeleteDC(hdc);
+    }
+
+    ScopedPreviewCacheLock lock;
+    if (lock.IsLocked()) {
+        PreviewCacheHeader* h = gCache.header;
+        PreviewCacheEntry* e = FindEntry(key, pageNo, reqSize);
+        if (!e) {
+            e = &h->entries[h->nextEntry % PREVIEW_CACHE_MAX_ENTRIES];
+            h->nextEntry = (h->nextEntry + 1) % PREVIEW_CACHE_MAX_ENTRIES;
+        }
+        e->dataLen = 0;
+        u32 offset = AllocData(len);
+        memcpy(gCache.data + offset, bits, len);
+        e->key = key;
+        e->pageNo = pageNo;
+        e->reqDx = reqSize.dx;
+        e->reqDy = reqSize.dy;
+        e->dx = dx;
+        e->dy = dy;
+        e->dataOffset = offset;
+        e->dataLen = len;
+    }
+
+    if (hbmp32) {
+        DeleteObject(hbmp32);
+    }
+}
@@ -0,0 +1,19 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// rendered thumbnails and preview pane pages shared by all processes hosting
+// PdfPreview.dll (Explorer starts several dllhost.exe/prevhost.exe instances)
+// and kept across sessions in a memory-mapped file in %LOCALAPPDATA%
+
+// identifies a version of a file (name, size and modification time)
+struct PreviewCacheKey {
+    u8 digest[16];
+};
+
+bool GetPreviewCacheKey(IStream* stream, PreviewCacheKey* key);
+bool GetPreviewCacheKey(const WCHAR* filePath, i64 fileSize, FILETIME modified, PreviewCacheKey* key);
+
+// pageNo is 0 for thumbnails, reqSize is the size the bitmap was requested for
+// (which can differ from the bitmap's actual size)
+HBITMAP LoadCachedPreview(const PreviewCacheKey& key, int pageNo, Size reqSize, Size* bmpSize);
+void SaveCachedPreview(const PreviewCacheKey& key, int pageNo, Size reqSize, HBITMAP hbmp);
@@ -13,19 +13,25 @@ To write new regression test:
 - add a file src/regress/Regress${NN}.cpp with Regress${NN} function
 - #include "Regress${NN}.cpp" right before RunTest() function
 - call Regress${NN} function from RunTests()
+
+-regress-perf runs a performance regression check instead (see RegressPerf.cpp)
 */
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include <psapi.h>
 #include "utils/WinDynCalls.h"
 #include "utils/Archive.h"
 #include "utils/DbgHelpDyn.h"
+#include "utils/Dict.h"
 #include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "mui/Mui.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -42,6 +48,9 @@ To write new regression test:
 #include "ProgressUpdateUI.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
+// For RegressPerf
+#include "DisplayMode.h"
+#include "Flags.h"
 
 static WCHAR* gTestFilesDir;
 
@@ -168,6 +177,7 @@ static void UninstallCrashHandler() {
 
 #include "Regress00.cpp"
 #include "Regress03.cpp"
+#include "RegressPerf.cpp"
 
 static void RunTests() {
     Regress00();
@@ -176,10 +186,11 @@ static void RunTests() {
     Regress03();
 }
 
-int RegressMain() {
+int RegressMain(const Flags& i) {
     RedirectIOToConsole();
 
-    if (!FindTestFilesDir()) {
+    bool perf = i.regressPerfManifest != nullptr;
+    if (!perf && !FindTestFilesDir()) {
         return Usage();
     }
 
@@ -188,12 +199,19 @@ int RegressMain() {
     ScopedGdiPlus gdi;
     mui::Initialize();
 
-    RunTests();
-
-    printflush("All tests completed successfully!\n");
+    int res = 0;
+    if (perf) {
+        res = RunPerfRegress(i);
+    } else {
+        RunTests();
+        printflush("All tests completed successfully!\n");
+    }
     mui::Destroy();
     UninstallCrashHandler();
 
-    system("pause");
-    return 0;
+    // the perf runner is meant to be run unattended
+    if (!perf) {
+        system("pause");
+    }
+    return res;
 }
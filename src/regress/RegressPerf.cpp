@@ -0,0 +1,288 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// must be #included from Regress.cpp
+
+/*
+Performance regression runner:
+-regress-perf <corpus manifest> <baseline> [-regress-workers <n>] [-regress-tolerance <percent>]
+
+The manifest lists one document per line (relative to the manifest's directory),
+optionally followed by a tab and the pages to render (e.g. "1-5"). Lines starting
+with # are ignored.
+
+Every document is opened with CreateEngine() and its pages are rendered at 100%
+on n workers (one per processor by default). If the baseline doesn't exist yet,
+it's created from the results. Otherwise the results are compared against it
+(and saved as <baseline>.new) and the documents which got slower or use more
+memory by more than the tolerance are reported as regressed.
+
+The peak working set is the growth of the process' working set while a document
+is processed, so it's only precise with -regress-workers 1.
+*/
+
+// differences below these are considered noise regardless of the tolerance
+#define PERF_MIN_DIFF_MS 5.0
+#define PERF_MIN_DIFF_KB 1024
+
+struct PerfResult {
+    bool ok = false;
+    int nPages = 0;
+    double openMs = 0;
+    double renderMs = 0;
+    int peakWsKB = 0;
+};
+
+struct PerfFile {
+    // as listed in the manifest, used as key in the baseline
+    WCHAR* name = nullptr;
+    WCHAR* path = nullptr;
+    WCHAR* pages = nullptr;
+    PerfResult res;
+
+    ~PerfFile() {
+        free(name);
+        free(path);
+        free(pages);
+    }
+};
+
+static int GetWorkingSetKB() {
+    PROCESS_MEMORY_COUNTERS pmc = {0};
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return 0;
+    }
+    return (int)(pmc.WorkingSetSize / 1024);
+}
+
+static bool ParsePerfManifest(const WCHAR* manifestPath, Vec<PerfFile*>& files) {
+    AutoFree data = file::ReadFile(manifestPath);
+    if (data.empty()) {
+        return false;
+    }
+    AutoFreeWstr dir = path::GetDir(manifestPath);
+    AutoFreeWstr text = strconv::Utf8ToWstr(data.AsView());
+    str::RemoveChars(text, L"\r");
+    WStrVec lines;
+    lines.Split(text, L"\n", true);
+    for (const WCHAR* line : lines) {
+        if ('#' == *line) {
+            continue;
+        }
+        PerfFile* f = new PerfFile();
+        const WCHAR* tab = str::FindChar(line, '\t');
+        if (tab) {
+            f->name = str::DupN(line, tab - line);
+            f->pages = str::Dup(tab + 1);
+        } else {
+            f->name = str::Dup(line);
+        }
+        f->path = path::Join(dir, f->name);
+        files.Append(f);
+    }
+    return true;
+}
+
+static void RunPerfFile(PerfFile* f) {
+    // some engines use COM (e.g. WIC for images)
+    ScopedCom com;
+    PerfResult& res = f->res;
+    int startWsKB = GetWorkingSetKB();
+    int peakWsKB = startWsKB;
+
+    auto t = TimeGet();
+    EngineBase* engine = CreateEngine(f->path);
+    res.openMs = TimeSinceInMs(t);
+    if (!engine) {
+        wprintf(L"Error: failed to open %s\n", f->path);
+        return;
+    }
+    peakWsKB = std::max(peakWsKB, GetWorkingSetKB());
+
+    int pageCount = engine->PageCount();
+    Vec<PageRange> ranges;
+    if (!f->pages || !ParsePageRanges(f->pages, ranges)) {
+        ranges.Append(PageRange{});
+    }
+    res.ok = true;
+    t = TimeGet();
+    for (PageRange& range : ranges) {
+        for (int pageNo = range.start; pageNo <= range.end && pageNo <= pageCount && res.ok; pageNo++) {
+            RenderPageArgs args(pageNo, 1.0f, 0);
+            RenderedBitmap* bmp = engine->RenderPage(args);
+            if (!bmp) {
+                wprintf(L"Error: failed to render page %d of %s\n", pageNo, f->path);
+                res.ok = false;
+                break;
+            }
+            peakWsKB = std::max(peakWsKB, GetWorkingSetKB());
+            delete bmp;
+            res.nPages++;
+        }
+    }
+    res.renderMs = TimeSinceInMs(t);
+    res.peakWsKB = peakWsKB - startWsKB;
+    delete engine;
+}
+
+static void RunPerfFiles(Vec<PerfFile*>& files, int nWorkers) {
+    LONG nextFile = -1;
+    auto worker = [&files, &nextFile] {
+        for (;;) {
+            LONG fileNo = InterlockedIncrement(&nextFile);
+            if (fileNo >= files.isize()) {
+                return;
+            }
+            PerfFile* f = files.at(fileNo);
+            RunPerfFile(f);
+            wprintf(L"open %.2f ms, render %.2f ms (%d pages), peak ws %d KB: %s\n", f->res.openMs, f->res.renderMs,
+                    f->res.nPages, f->res.peakWsKB, f->name);
+            fflush(stdout);
+        }
+    };
+    if (nWorkers <= 1) {
+        worker();
+        return;
+    }
+    TaskGroup workers;
+    for (int n = 0; n < nWorkers; n++) {
+        workers.Run(worker);
+    }
+    workers.Join();
+}
+
+// tab-separated: name, ok, pages, open ms, render ms, peak working set in KB
+static bool SavePerfResults(const WCHAR* path, Vec<PerfFile*>& files) {
+    str::Str s(16 * 1024);
+    s.Append("# name\tok\tpages\topen_ms\trender_ms\tpeak_ws_kb\r\n");
+    for (PerfFile* f : files) {
+        AutoFree name = strconv::WstrToUtf8(f->name);
+        s.AppendFmt("%s\t%d\t%d\t%.2f\t%.2f\t%d\r\n", name.Get(), f->res.ok ? 1 : 0, f->res.nPages, f->res.openMs,
+                    f->res.renderMs, f->res.peakWsKB);
+    }
+    return file::WriteFile(path, s.AsSpan());
+}
+
+static bool LoadPerfBaseline(const WCHAR* path, WStrVec& names, Vec<PerfResult>& results) {
+    AutoFree data = file::ReadFile(path);
+    if (data.empty()) {
+        return false;
+    }
+    AutoFreeWstr text = strconv::Utf8ToWstr(data.AsView());
+    str::RemoveChars(text, L"\r");
+    WStrVec lines;
+    lines.Split(text, L"\n", true);
+    for (const WCHAR* line : lines) {
+        if ('#' == *line) {
+            continue;
+        }
+        WStrVec fields;
+        fields.Split(line, L"\t");
+        if (fields.size() != 6) {
+            continue;
+        }
+        PerfResult res;
+        res.ok = _wtoi(fields.at(1)) != 0;
+        res.nPages = _wtoi(fields.at(2));
+        res.openMs = _wtof(fields.at(3));
+        res.renderMs = _wtof(fields.at(4));
+        res.peakWsKB = _wtoi(fields.at(5));
+        names.Append(str::Dup(fields.at(0)));
+        results.Append(res);
+    }
+    return true;
+}
+
+static bool IsPerfRegression(double baseline, double curr, double minDiff, int tolerance) {
+    return curr - baseline > minDiff && curr > baseline * (100 + tolerance) / 100;
+}
+
+// returns true if f regressed compared to base
+static bool ComparePerfResult(PerfFile* f, const PerfResult& base, int tolerance) {
+    const PerfResult& res = f->res;
+    if (base.ok && !res.ok) {
+        wprintf(L"REGRESSED (failed): %s\n", f->name);
+        return true;
+    }
+    bool regressed = false;
+    if (IsPerfRegression(base.openMs, res.openMs, PERF_MIN_DIFF_MS, tolerance)) {
+        wprintf(L"REGRESSED open: %.2f ms -> %.2f ms: %s\n", base.openMs, res.openMs, f->name);
+        regressed = true;
+    }
+    // render times are only comparable for the same pages
+    if (base.nPages == res.nPages && IsPerfRegression(base.renderMs, res.renderMs, PERF_MIN_DIFF_MS, tolerance)) {
+        wprintf(L"REGRESSED render: %.2f ms -> %.2f ms: %s\n", base.renderMs, res.renderMs, f->name);
+        regressed = true;
+    }
+    if (IsPerfRegression(base.peakWsKB, res.peakWsKB, PERF_MIN_DIFF_KB, tolerance)) {
+        wprintf(L"REGRESSED peak ws: %d KB -> %d KB: %s\n", base.peakWsKB, res.peakWsKB, f->name);
+        regressed = true;
+    }
+    return regressed;
+}
+
+// returns the process exit code: 0 if no document regressed
+static int RunPerfRegress(const Flags& i) {
+    Vec<PerfFile*> files;
+    if (!ParsePerfManifest(i.regressPerfManifest, files)) {
+        wprintf(L"Error: failed to read the corpus manifest %s\n", i.regressPerfManifest);
+        return 1;
+    }
+    int nWorkers = i.regressWorkers;
+    if (nWorkers <= 0) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        nWorkers = (int)si.dwNumberOfProcessors;
+    }
+    int tolerance = i.regressTolerance;
+    wprintf(L"Running %d documents on %d workers\n", files.isize(), nWorkers);
+    auto t = TimeGet();
+    RunPerfFiles(files, nWorkers);
+    wprintf(L"Finished in %.2f ms\n", TimeSinceInMs(t));
+
+    int exitCode = 0;
+    WStrVec baselineNames;
+    Vec<PerfResult> baseline;
+    if (!LoadPerfBaseline(i.regressPerfBaseline, baselineNames, baseline)) {
+        if (!SavePerfResults(i.regressPerfBaseline, files)) {
+            wprintf(L"Error: failed to write the baseline %s\n", i.regressPerfBaseline);
+            exitCode = 1;
+        } else {
+            wprintf(L"Created the baseline %s\n", i.regressPerfBaseline);
+        }
+        DeleteVecMembers(files);
+        return exitCode;
+    }
+
+    dict::MapWStrToInt baselineIdx;
+    for (int n = 0; n < baselineNames.isize(); n++) {
+        int prevIdx;
+        baselineIdx.Insert(baselineNames.at(n), n, &prevIdx);
+    }
+    int nRegressed = 0;
+    int nNew = 0;
+    for (PerfFile* f : files) {
+        int idx;
+        if (!baselineIdx.Get(f->name, &idx)) {
+            nNew++;
+            continue;
+        }
+        if (ComparePerfResult(f, baseline.at(idx), tolerance)) {
+            nRegressed++;
+        }
+    }
+    wprintf(L"%d of %d documents regressed (tolerance %d%%), %d not in the baseline\n", nRegressed, files.isize(),
+            tolerance, nNew);
+
+    AutoFreeWstr newBaseline = str::Join(i.regressPerfBaseline, L".new");
+    if (!SavePerfResults(newBaseline, files)) {
+        wprintf(L"Error: failed to write %s\n", newBaseline.Get());
+        exitCode = 1;
+    }
+    if (nRegressed > 0) {
+        exitCode = 1;
+    }
+    DeleteVecMembers(files);
+    return exitCode;
+}
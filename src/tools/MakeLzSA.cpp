@@ -14,6 +14,7 @@
 #include "utils/CmdLineParser.h"
 #include "utils/FileUtil.h"
 #include "utils/WinUtil.h"
+#include "utils/ThreadUtil.h"
 #include "utils/LzmaSimpleArchive.h"
 
 namespace lzsa {
@@ -36,6 +37,12 @@ struct ISzCrtAlloc : ISzAlloc {
 
 #define LZMA_MAGIC_ID 0x41537a4c
 #define LZMA_HEADER_SIZE (1 + LZMA_PROPS_SIZE)
+#define COMPRESSION_CHUNKED 2
+
+// files bigger than this are split into independently compressed chunks
+// so that the installer can decompress them in parallel (at the cost
+// of a slightly worse compression ratio)
+#define CHUNK_SIZE (4 * 1024 * 1024)
 
 static bool Compress(const char* uncompressed, size_t uncompressedSize, char* compressed, size_t* compressedSize) {
     CrashIf(*compressedSize < uncompressedSize + 1);
@@ -80,6 +87,52 @@ static bool Compress(const char* uncompressed, size_t uncompressedSize, char* co
     return true;
 }
 
+struct CompressedChunk {
+    const char* uncompressed = nullptr;
+    size_t uncompressedSize = 0;
+    ScopedMem<char> compressed;
+    size_t compressedSize = 0;
+    bool ok = false;
+};
+
+// the chunks are compressed in parallel
+static bool CompressChunked(const char* uncompressed, size_t uncompressedSize, str::Str& compressed) {
+    size_t nChunks = (uncompressedSize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    Vec<CompressedChunk*> chunks;
+    TaskGroup tasks;
+    for (size_t i = 0; i < nChunks; i++) {
+        CompressedChunk* chunk = new CompressedChunk();
+        chunk->uncompressed = uncompressed + i * CHUNK_SIZE;
+        chunk->uncompressedSize = std::min(uncompressedSize - i * CHUNK_SIZE, (size_t)CHUNK_SIZE);
+        chunks.Append(chunk);
+        tasks.Run([chunk] {
+            chunk->compressedSize = chunk->uncompressedSize + 1;
+            chunk->compressed.Set((char*)malloc(chunk->compressedSize));
+            if (chunk->compressed.Get()) {
+                chunk->ok = Compress(chunk->uncompressed, chunk->uncompressedSize, chunk->compressed.Get(),
+                                     &chunk->compressedSize);
+            }
+        });
+    }
+    tasks.Join();
+
+    ByteWriterLE header(1 + 4 + nChunks * 8);
+    header.Write8(COMPRESSION_CHUNKED);
+    header.Write32((u32)nChunks);
+    bool ok = true;
+    for (CompressedChunk* chunk : chunks) {
+        ok &= chunk->ok;
+        header.Write32((u32)chunk->compressedSize);
+        header.Write32((u32)chunk->uncompressedSize);
+    }
+    ok = ok && compressed.AppendSpan(header.AsSpan());
+    for (CompressedChunk* chunk : chunks) {
+        ok = ok && compressed.Append(chunk->compressed.Get(), chunk->compressedSize);
+    }
+    DeleteVecMembers(chunks);
+    return ok;
+}
+
 static bool AppendEntry(str::Str& data, str::Str& content, const WCHAR* filePath, const char* inArchiveName,
                         lzma::FileInfo* fi = nullptr) {
     size_t nameLen = str::Len(inArchiveName);
@@ -113,14 +166,23 @@ static bool AppendEntry(str::Str& data, str::Str& content, const WCHAR* filePath
     if (fi && fi->uncompressedCrc32 == fileDataCrc && fi->uncompressedSize == fileData.size())
         goto ReusePrevious;
 
-    size_t compressedSize = fileData.size() + 1;
-    AutoFree compressed((char*)malloc(compressedSize));
-    if (!compressed.Get()) {
-        return false;
-    }
-    if (!Compress(fileData.data, fileData.size(), compressed, &compressedSize)) {
-        return false;
+    str::Str compressed;
+    if (fileData.size() > CHUNK_SIZE) {
+        if (!CompressChunked(fileData.data, fileData.size(), compressed)) {
+            return false;
+        }
+    } else {
+        size_t compressedSize = fileData.size() + 1;
+        ScopedMem<char> buf((char*)malloc(compressedSize));
+        if (!buf.Get()) {
+            return false;
+        }
+        if (!Compress(fileData.data, fileData.size(), buf, &compressedSize)) {
+            return false;
+        }
+        compressed.Append(buf.Get(), compressedSize);
     }
+    size_t compressedSize = compressed.size();
 
     ByteWriterLE meta(kBufSize);
     meta.Write32(headerSize);
@@ -132,7 +194,7 @@ static bool AppendEntry(str::Str& data, str::Str& content, const WCHAR* filePath
     CrashIf(meta.Size() != kBufSize);
     data.AppendSpan(meta.AsSpan());
     data.Append(inArchiveName, nameLen + 1);
-    return content.Append(compressed, compressedSize);
+    return content.Append(compressed.Get(), compressedSize);
 }
 
 // creates an archive from files (starting at index skipFiles);
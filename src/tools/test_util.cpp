@@ -1,5 +1,7 @@
 #include "utils/BaseUtil.h"
 #include "utils/WinDynCalls.h"
+#include "utils/Timer.h"
+#include "utils/UtBench.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -14,6 +16,7 @@ extern void SumatraPDF_UnitTests();
 extern void SvgPath_UnitTests();
 
 extern void BaseUtilTest();
+extern void BitReaderTest();
 extern void ByteOrderTests();
 extern void CmdLineParserTest();
 extern void CryptoUtilTest();
@@ -23,6 +26,7 @@ extern void FileUtilTest();
 extern void HtmlPrettyPrintTest();
 extern void HtmlPullParser_UnitTests();
 extern void JsonTest();
+extern void RegexTest();
 extern void SettingsUtilTest();
 extern void SimpleLogTest();
 extern void SquareTreeTest();
@@ -33,13 +37,40 @@ extern void TrivialHtmlParser_UnitTests();
 extern void VecTest();
 extern void WinUtilTest();
 extern void StrFormatTest();
+extern void BaseUtilBenchmark();
+extern void BitReaderBenchmark();
+extern void CssParserBenchmark();
+extern void HtmlPullParserBenchmark();
+extern void JsonBenchmark();
+extern void SquareTreeBenchmark();
+extern void StrBenchmark();
+extern void StrFindBenchmark();
+extern void VecBenchmark();
+extern void WinUtilBenchmark();
 
 int main(int argc, char** argv) {
-    UNUSED(argc);
-    UNUSED(argv);
-    printf("Running unit tests\n");
     InitDynCalls();
+    // -bench [<filter>] only runs benchmarks whose name contains <filter>
+    if (argc > 1 && str::Eq(argv[1], "-bench")) {
+        printf("Running benchmarks\n");
+        if (argc > 2) {
+            utbench_set_filter(argv[2]);
+        }
+        BaseUtilBenchmark();
+        BitReaderBenchmark();
+        CssParserBenchmark();
+        HtmlPullParserBenchmark();
+        JsonBenchmark();
+        SquareTreeBenchmark();
+        StrBenchmark();
+        StrFindBenchmark();
+        VecBenchmark();
+        WinUtilBenchmark();
+        return 0;
+    }
+    printf("Running unit tests\n");
     BaseUtilTest();
+    BitReaderTest();
     ByteOrderTests();
     CmdLineParserTest();
     CryptoUtilTest();
@@ -49,6 +80,7 @@ int main(int argc, char** argv) {
     HtmlPrettyPrintTest();
     HtmlPullParser_UnitTests();
     JsonTest();
+    RegexTest();
     SettingsUtilTest();
     SimpleLogTest();
     SquareTreeTest();
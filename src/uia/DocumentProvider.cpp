@@ -22,6 +22,7 @@
 #include "uia/PageProvider.h"
 #include "uia/Provider.h"
 #include "uia/TextRange.h"
+#include "TextSelection.h"
 
 SumatraUIAutomationDocumentProvider::SumatraUIAutomationDocumentProvider(HWND canvasHwnd,
                                                                          SumatraUIAutomationProvider* root)
@@ -31,7 +32,8 @@ SumatraUIAutomationDocumentProvider::SumatraUIAutomationDocumentProvider(HWND ca
       released(true),
       child_first(nullptr),
       child_last(nullptr),
-      dm(nullptr) {
+      dm(nullptr),
+      boundsSelection(nullptr) {
     // root->AddRef(); Don't add refs to our parent & owner.
 }
 
@@ -72,6 +74,8 @@ void SumatraUIAutomationDocumentProvider::FreeDocument() {
 
     released = true;
     dm = nullptr;
+    delete boundsSelection;
+    boundsSelection = nullptr;
 
     SumatraUIAutomationPageProvider* it = child_first;
     while (it) {
@@ -98,6 +102,22 @@ DisplayModel* SumatraUIAutomationDocumentProvider::GetDM() {
     return dm;
 }
 
+HWND SumatraUIAutomationDocumentProvider::GetCanvasHwnd() const {
+    return canvasHwnd;
+}
+
+TextSelection* SumatraUIAutomationDocumentProvider::GetRangeLines(int startPage, int startGlyph, int endPage,
+                                                                  int endGlyph) {
+    DisplayModel* model = GetDM();
+    if (!boundsSelection) {
+        boundsSelection = new TextSelection(model->GetEngine(), model->textCache);
+    }
+    boundsSelection->StartAt(startPage, startGlyph);
+    // doesn't re-compute the rectangles if the range hasn't changed
+    boundsSelection->SelectUpTo(endPage, endGlyph);
+    return boundsSelection;
+}
+
 SumatraUIAutomationPageProvider* SumatraUIAutomationDocumentProvider::GetFirstPage() {
     CrashIf(!IsDocumentLoaded());
     return child_first;
@@ -2,6 +2,7 @@
    License: GPLv3 */
 
 struct DisplayModel;
+struct TextSelection;
 class SumatraUIAutomationProvider;
 class SumatraUIAutomationPageProvider;
 class SumatraUIAutomationTextRange;
@@ -19,6 +20,8 @@ class SumatraUIAutomationDocumentProvider : public IRawElementProviderFragment,
     SumatraUIAutomationPageProvider* child_last;
 
     DisplayModel* dm;
+    // the line rectangles of the last range whose bounding rectangles were requested
+    TextSelection* boundsSelection;
 
   public:
     SumatraUIAutomationDocumentProvider(HWND canvasHwnd, SumatraUIAutomationProvider* root);
@@ -31,7 +34,11 @@ class SumatraUIAutomationDocumentProvider : public IRawElementProviderFragment,
 
     // GetDM() must not be called if IsDocumentLoaded()==FALSE
     DisplayModel* GetDM();
+    // computes the line rectangles (in page coordinates) of the given range, reusing
+    // them if the same range is queried again (e.g. while a screen reader tracks a line)
+    TextSelection* GetRangeLines(int startPage, int startGlyph, int endPage, int endGlyph);
 
+    HWND GetCanvasHwnd() const;
     SumatraUIAutomationPageProvider* GetFirstPage();
     SumatraUIAutomationPageProvider* GetLastPage();
 
@@ -4,6 +4,7 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/WinDynCalls.h"
+#include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
 
@@ -425,8 +426,52 @@ HRESULT STDMETHODCALLTYPE SumatraUIAutomationTextRange::GetBoundingRectangles(SA
         return S_OK;
     }
 
-    // TODO: support GetBoundingRectangles
-    return E_NOTIMPL;
+    // only the lines on visible pages are reported, so that the
+    // text of the whole range doesn't have to be extracted
+    DisplayModel* dm = document->GetDM();
+    int firstPage = std::max(startPage, dm->FirstVisiblePageNo());
+    int lastPage = std::min(endPage, dm->LastVisiblePageNo());
+    Vec<Rect> rects;
+    if (dm->ValidPageNo(firstPage) && dm->ValidPageNo(lastPage) && firstPage <= lastPage) {
+        int firstGlyph = firstPage == startPage ? startGlyph : 0;
+        int lastGlyph = lastPage == endPage ? endGlyph : -1;
+        TextSel* lines = &document->GetRangeLines(firstPage, firstGlyph, lastPage, lastGlyph)->result;
+        Rect canvasRc = ClientRect(document->GetCanvasHwnd());
+        for (int i = 0; i < lines->len; i++) {
+            PageInfo* pageInfo = dm->GetPageInfo(lines->pages[i]);
+            if (!pageInfo || pageInfo->visibleRatio <= 0.0) {
+                continue;
+            }
+            Rect rc = dm->CvtToScreen(lines->pages[i], ToRectFl(lines->rects[i])).Intersect(canvasRc);
+            if (!rc.IsEmpty()) {
+                rects.Append(rc);
+            }
+        }
+    }
+
+    SAFEARRAY* sarray = SafeArrayCreateVector(VT_R8, 0, (ULONG)rects.size() * 4);
+    if (!sarray) {
+        return E_OUTOFMEMORY;
+    }
+    RECT canvasRect;
+    GetWindowRect(document->GetCanvasHwnd(), &canvasRect);
+    double* values = nullptr;
+    HRESULT hr = SafeArrayAccessData(sarray, (void**)&values);
+    if (FAILED(hr)) {
+        SafeArrayDestroy(sarray);
+        return hr;
+    }
+    for (size_t i = 0; i < rects.size(); i++) {
+        Rect rc = rects.at(i);
+        values[4 * i] = canvasRect.left + rc.x;
+        values[4 * i + 1] = canvasRect.top + rc.y;
+        values[4 * i + 2] = rc.dx;
+        values[4 * i + 3] = rc.dy;
+    }
+    SafeArrayUnaccessData(sarray);
+
+    *boundingRects = sarray;
+    return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE
@@ -456,28 +501,43 @@ HRESULT STDMETHODCALLTYPE SumatraUIAutomationTextRange::GetText(int maxLength, B
         return S_OK;
     }
 
-    TextSelection selection(document->GetDM()->GetEngine(), document->GetDM()->textCache);
-    selection.StartAt(startPage, startGlyph);
-    selection.SelectUpTo(endPage, endGlyph);
-
-    AutoFreeWstr selected_text(selection.ExtractText(L"\r\n"));
-    size_t selected_text_length = str::Len(selected_text);
+    if (maxLength < -1) {
+        return E_INVALIDARG;
+    }
 
-    // -1 and [0, inf) are allowed
-    if (maxLength > -2) {
-        if (maxLength != -1 && selected_text_length > (size_t)maxLength) {
-            selected_text[maxLength] = '\0'; // truncate
+    // the text is extracted one page at a time, so that only as many pages as needed
+    // for maxLength characters are extracted (instead of all the pages of the range)
+    DocumentTextCache* textCache = document->GetDM()->textCache;
+    if (-1 == maxLength && startPage < endPage) {
+        // extract the pages of the range concurrently, in reading order
+        textCache->PrefetchPages(startPage, endPage);
+    }
+    TextSelection selection(document->GetDM()->GetEngine(), textCache);
+    str::WStr selected_text;
+    int page = startPage;
+    for (; page <= endPage; page++) {
+        if (maxLength != -1 && selected_text.size() >= (size_t)maxLength) {
+            break;
         }
+        selection.StartAt(page, page == startPage ? startGlyph : 0);
+        selection.SelectUpTo(page, page == endPage ? endGlyph : -1);
+        AutoFreeWstr pageText(selection.ExtractText(L"\r\n"));
+        selected_text.Append(pageText);
+    }
+    // a screen reader usually continues reading where it stopped
+    if (page <= endPage) {
+        textCache->ExtractInBackground(page);
+    }
 
-        *text = SysAllocString(selected_text);
-        if (*text) {
-            return S_OK;
-        } else {
-            return E_OUTOFMEMORY;
-        }
-    } else {
-        return E_INVALIDARG;
+    if (maxLength != -1 && selected_text.size() > (size_t)maxLength) {
+        selected_text.RemoveAt(maxLength, selected_text.size() - maxLength); // truncate
     }
+
+    *text = SysAllocString(selected_text.Get());
+    if (!*text) {
+        return E_OUTOFMEMORY;
+    }
+    return S_OK;
 }
 
 HRESULT STDMETHODCALLTYPE SumatraUIAutomationTextRange::Move(enum TextUnit unit, int count, int* moved) {
@@ -0,0 +1,195 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/AllocSampler.h"
+#include "utils/WinDynCalls.h"
+#include "utils/DbgHelpDyn.h"
+#include "utils/FileUtil.h"
+
+// the sites are kept in a fixed-size hash table which is allocated with
+// VirtualAlloc, so that sampling never allocates (and thus never recurses)
+
+constexpr int kMaxSampleFrames = 16;
+// must be a power of 2
+constexpr int kMaxSampleSites = 8192;
+
+struct AllocSite {
+    ULONG hash;
+    int nFrames;
+    void* frames[kMaxSampleFrames];
+    // estimated from the samples
+    u64 bytes;
+    u64 allocs;
+    int samples;
+};
+
+static CRITICAL_SECTION gSamplerAccess;
+// protected by gSamplerAccess
+static AllocSite* gSites = nullptr;
+static int gSitesCount = 0;
+static int gSamplesDropped = 0;
+static WCHAR* gSamplerReportPath = nullptr;
+
+static i64 gSampleInterval = 0;
+static thread_local i64 tlBytesUntilSample = 0;
+// set while a thread is sampling or writing the report
+static thread_local bool tlNoSampling = false;
+
+static void SampleAllocSlow(size_t size);
+
+void StartAllocSampling(const WCHAR* reportPath, size_t intervalBytes) {
+    if (gSites) {
+        return;
+    }
+    InitializeCriticalSection(&gSamplerAccess);
+    size_t size = sizeof(AllocSite) * kMaxSampleSites;
+    gSites = (AllocSite*)VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!gSites) {
+        return;
+    }
+    gSamplerReportPath = str::Dup(reportPath);
+    gSampleInterval = (i64)std::max(intervalBytes, (size_t)1024);
+    gSampleAllocFunc = SampleAllocSlow;
+}
+
+bool IsAllocSampling() {
+    return gSampleAllocFunc != nullptr;
+}
+
+__declspec(noinline) static void RecordAllocSample(size_t size, int nSamples) {
+    void* frames[kMaxSampleFrames];
+    ULONG hash = 0;
+    // skip RecordAllocSample and SampleAllocSlow
+    int nFrames = (int)RtlCaptureStackBackTrace(2, kMaxSampleFrames, frames, &hash);
+    u64 bytes = (u64)nSamples * (u64)gSampleInterval;
+    // one sample stands for many small allocations
+    u64 allocs = std::max(bytes / std::max(size, (size_t)1), (u64)1);
+
+    EnterCriticalSection(&gSamplerAccess);
+    int idx = (int)(hash & (kMaxSampleSites - 1));
+    for (int n = 0; n < kMaxSampleSites; n++) {
+        AllocSite* site = &gSites[idx];
+        if (site->samples > 0 && site->hash == hash && site->nFrames == nFrames &&
+            memeq(site->frames, frames, nFrames * sizeof(void*))) {
+            break;
+        }
+        if (0 == site->samples) {
+            // the table must not fill up completely, so that lookups terminate
+            if (gSitesCount >= kMaxSampleSites - 1) {
+                idx = -1;
+                break;
+            }
+            site->hash = hash;
+            site->nFrames = nFrames;
+            memcpy(site->frames, frames, nFrames * sizeof(void*));
+            gSitesCount++;
+            break;
+        }
+        idx = (idx + 1) & (kMaxSampleSites - 1);
+    }
+    if (idx < 0) {
+        gSamplesDropped += nSamples;
+    } else {
+        gSites[idx].bytes += bytes;
+        gSites[idx].allocs += allocs;
+        gSites[idx].samples += nSamples;
+    }
+    LeaveCriticalSection(&gSamplerAccess);
+}
+
+static void SampleAllocSlow(size_t size) {
+    if (tlNoSampling) {
+        return;
+    }
+    if (0 == tlBytesUntilSample) {
+        // spread the first sample of each thread over the interval
+        tlBytesUntilSample = 1 + (i64)((u64)GetCurrentThreadId() * 2654435761u % (u64)gSampleInterval);
+    }
+    tlBytesUntilSample -= (i64)size;
+    if (tlBytesUntilSample > 0) {
+        return;
+    }
+    int nSamples = (int)(1 + -tlBytesUntilSample / gSampleInterval);
+    tlBytesUntilSample += nSamples * gSampleInterval;
+
+    tlNoSampling = true;
+    RecordAllocSample(size, nSamples);
+    tlNoSampling = false;
+}
+
+static void AppendAllocSite(str::Str& s, AllocSite* site, bool symbolize) {
+    s.AppendFmt("%.1f MB in ~%llu allocations (%d samples)\r\n", (double)site->bytes / (1024.0 * 1024.0),
+                site->allocs, site->samples);
+    for (int i = 0; i < site->nFrames; i++) {
+        s.Append("    ");
+        if (symbolize) {
+            dbghelp::GetAddressInfo(s, (DWORD64)site->frames[i]);
+        } else {
+            s.AppendFmt("%p\r\n", site->frames[i]);
+        }
+    }
+}
+
+void GetAllocSamplingReport(str::Str& s, int maxSites) {
+    if (!gSites) {
+        return;
+    }
+    bool wasNoSampling = tlNoSampling;
+    tlNoSampling = true;
+
+    Vec<AllocSite> sites;
+    // so that appending won't allocate while holding gSamplerAccess
+    sites.Reserve(kMaxSampleSites);
+    u64 totalBytes = 0;
+    EnterCriticalSection(&gSamplerAccess);
+    for (int i = 0; i < kMaxSampleSites; i++) {
+        if (gSites[i].samples > 0) {
+            sites.Append(gSites[i]);
+            totalBytes += gSites[i].bytes;
+        }
+    }
+    int nDropped = gSamplesDropped;
+    LeaveCriticalSection(&gSamplerAccess);
+
+    bool symbolize = dbghelp::Initialize(L"", false);
+    s.AppendFmt("sampled every %d KB: ~%.1f MB allocated at %d sites", (int)(gSampleInterval / 1024),
+                (double)totalBytes / (1024.0 * 1024.0), sites.isize());
+    if (nDropped > 0) {
+        s.AppendFmt(" (%d samples dropped)", nDropped);
+    }
+    s.Append("\r\n");
+
+    int n = std::min(sites.isize(), maxSites);
+    std::sort(sites.begin(), sites.end(), [](const AllocSite& a, const AllocSite& b) { return a.bytes > b.bytes; });
+    s.Append("\r\ntop sites by bytes:\r\n");
+    for (int i = 0; i < n; i++) {
+        AppendAllocSite(s, &sites.at(i), symbolize);
+    }
+    std::sort(sites.begin(), sites.end(), [](const AllocSite& a, const AllocSite& b) { return a.allocs > b.allocs; });
+    s.Append("\r\ntop sites by allocations:\r\n");
+    for (int i = 0; i < n; i++) {
+        AppendAllocSite(s, &sites.at(i), symbolize);
+    }
+    tlNoSampling = wasNoSampling;
+}
+
+bool WriteAllocSamplingReport() {
+    if (!gSites || !gSamplerReportPath) {
+        return false;
+    }
+    bool wasNoSampling = tlNoSampling;
+    tlNoSampling = true;
+    str::Str s(64 * 1024);
+    GetAllocSamplingReport(s);
+    bool ok = file::WriteFile(gSamplerReportPath, s.AsSpan());
+    tlNoSampling = wasNoSampling;
+    return ok;
+}
+
+bool StopAllocSampling() {
+    bool ok = WriteAllocSamplingReport();
+    // the table is kept, as other threads might still be sampling
+    gSampleAllocFunc = nullptr;
+    return ok;
+}
@@ -0,0 +1,20 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// opt-in, low overhead allocation profiling: whenever a thread has allocated
+// another intervalBytes (through Allocator, AllocArray, memdup, str::Dup or
+// MuPDF), the callstack of the allocation is recorded. Each sample stands for
+// intervalBytes, so that the allocation sites responsible for the most memory
+// can be estimated without tracking every allocation (cf. memtrace.dll).
+// Note: frees aren't tracked, so the report is about allocation volume.
+
+// the allocation functions call SampleAlloc() (see BaseUtil.h)
+
+void StartAllocSampling(const WCHAR* reportPath, size_t intervalBytes);
+bool IsAllocSampling();
+// writes the report for the samples collected so far, returns false on failure
+bool WriteAllocSamplingReport();
+// writes the report and stops sampling
+bool StopAllocSampling();
+// appends the allocation sites with the most bytes resp. allocations
+void GetAllocSamplingReport(str::Str& s, int maxSites = 25);
@@ -36,6 +36,9 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
     if (!data) {
         return false;
     }
+    if (archivePath) {
+        archivePath_ = Allocator::AllocString(&allocator_, archivePath).data();
+    }
     if ((format == Format::Rar) && archivePath) {
         bool ok = OpenUnrarFallback(archivePath);
         if (ok) {
@@ -70,9 +73,42 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
     return true;
 }
 
+#if OS_WIN
+bool MultiFormatArchive::OpenMapped(const WCHAR* path) {
+    AutoFree pathUtf = strconv::WstrToUtf8(path);
+    CrashIf(mappedData_);
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    // the view keeps the mapping (and the file) open
+    if (GetFileSizeEx(hFile, &size) && size.QuadPart > 0 && (u64)size.QuadPart <= (u64)SIZE_MAX) {
+        HANDLE hMap = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (hMap) {
+            mappedData_ = (u8*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+            mappedSize_ = mappedData_ ? (size_t)size.QuadPart : 0;
+            CloseHandle(hMap);
+        }
+    }
+    CloseHandle(hFile);
+
+    // e.g. not enough address space on 32-bit
+    if (!mappedData_) {
+        return Open(ar_open_file_w(path), pathUtf);
+    }
+    return Open(ar_open_memory(mappedData_, mappedSize_), pathUtf);
+}
+#endif
+
 MultiFormatArchive::~MultiFormatArchive() {
     ar_close_archive(ar_);
     ar_close(data_);
+#if OS_WIN
+    if (mappedData_) {
+        UnmapViewOfFile(mappedData_);
+    }
+#endif
 }
 
 size_t getFileIdByName(Vec<MultiFormatArchive::FileInfo*>& fileInfos, const char* name) {
@@ -118,14 +154,7 @@ std::span<u8> MultiFormatArchive::GetFileDataById(size_t fileId) {
         return {};
     }
 
-    auto* fileInfo = fileInfos_[fileId];
-    CrashIf(fileInfo->fileId != fileId);
-
-    auto filePos = fileInfo->filePos;
-    if (!ar_parse_entry_at(ar_, filePos)) {
-        return {};
-    }
-    size_t size = fileInfo->fileSizeUncompressed;
+    size_t size = fileInfos_[fileId]->fileSizeUncompressed;
     if (addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
         return {};
     }
@@ -133,13 +162,195 @@ std::span<u8> MultiFormatArchive::GetFileDataById(size_t fileId) {
     if (!data) {
         return {};
     }
-    if (!ar_entry_uncompress(ar_, data, size)) {
+    if (!GetFileDataByIdInto(fileId, {data, size})) {
+        free(data);
         return {};
     }
 
     return {data, size};
 }
 
+bool MultiFormatArchive::GetFileDataByIdInto(size_t fileId, std::span<u8> dst) {
+    if (fileId >= fileInfos_.size() || !ar_) {
+        return false;
+    }
+    auto* fileInfo = fileInfos_[fileId];
+    CrashIf(fileInfo->fileId != fileId);
+    if (dst.size() != fileInfo->fileSizeUncompressed) {
+        return false;
+    }
+
+    if (!ar_parse_entry_at(ar_, fileInfo->filePos)) {
+        return false;
+    }
+    return ar_entry_uncompress(ar_, dst.data(), dst.size());
+}
+
+std::span<u8> MultiFormatArchive::GetStoredFileDataById(size_t fileId) {
+    if (!mappedData_ || !ar_ || fileId >= fileInfos_.size()) {
+        return {};
+    }
+    auto* fileInfo = fileInfos_[fileId];
+    if (!ar_parse_entry_at(ar_, fileInfo->filePos)) {
+        return {};
+    }
+    off64_t offset = ar_zip_entry_get_stored_offset(ar_);
+    size_t size = fileInfo->fileSizeUncompressed;
+    if (offset < 0 || (u64)offset > mappedSize_ || size > mappedSize_ - (size_t)offset) {
+        return {};
+    }
+    return {mappedData_ + offset, size};
+}
+
+Vec<std::span<u8>> MultiFormatArchive::GetFilesDataById(const Vec<size_t>& fileIds) {
+    Vec<std::span<u8>> res;
+    res.AppendBlanks(fileIds.size());
+
+    // indexes into fileIds, in the order in which the files are stored
+    Vec<size_t> order;
+    for (size_t i = 0; i < fileIds.size(); i++) {
+        order.Append(i);
+    }
+    std::sort(order.begin(), order.end(), [&fileIds](size_t i1, size_t i2) { return fileIds[i1] < fileIds[i2]; });
+
+    if (LoadedUsingUnrarDll()) {
+        GetFilesDataByIdUnrarDll(fileIds, order, res);
+        return res;
+    }
+#if OS_WIN
+    if (GetFilesDataByIdParallel(fileIds, order, res)) {
+        return res;
+    }
+#endif
+
+    size_t nextFileId = 0;
+    for (size_t i : order) {
+        size_t fileId = fileIds[i];
+        if (fileId >= fileInfos_.size()) {
+            continue;
+        }
+        if (Format::Rar == format) {
+            // unarr restarts decompression of a solid archive from its start
+            // when an entry is skipped, so extract the entries in between as well
+            for (; nextFileId < fileId; nextFileId++) {
+                free(GetFileDataById(nextFileId).data());
+            }
+        }
+        res[i] = GetFileDataById(fileId);
+        nextFileId = fileId + 1;
+    }
+    return res;
+}
+
+#if OS_WIN
+// number of threads extracting the files of a non-solid archive
+#define MAX_EXTRACT_THREADS 4
+// extracting fewer files per thread isn't worth starting it
+#define MIN_FILES_PER_EXTRACT_THREAD 8
+
+// the files of solid archives (RAR archives created as such and 7z archives,
+// which usually are) have to be extracted in order, tar archives aren't compressed
+bool MultiFormatArchive::CanExtractInParallel() {
+    if (!ar_ || (!mappedData_ && !archivePath_)) {
+        return false;
+    }
+    switch (format) {
+        case Format::Zip:
+            return true;
+        case Format::Rar:
+            return !ar_rar_is_solid(ar_);
+        default:
+            return false;
+    }
+}
+
+struct ExtractJob {
+    MultiFormatArchive* archive = nullptr;
+    const Vec<size_t>* fileIds = nullptr;
+    // indexes into fileIds of the files to extract
+    const size_t* order = nullptr;
+    size_t n = 0;
+    Vec<std::span<u8>>* res = nullptr;
+};
+
+// extracts a part of the files through a reader of its own
+DWORD WINAPI MultiFormatArchive::ExtractThreadProc(void* data) {
+    ExtractJob* job = (ExtractJob*)data;
+    MultiFormatArchive* self = job->archive;
+    ar_stream* stream = nullptr;
+    if (self->mappedData_) {
+        stream = ar_open_memory(self->mappedData_, self->mappedSize_);
+    } else {
+        AutoFreeWstr path = strconv::Utf8ToWstr(self->archivePath_);
+        stream = ar_open_file_w(path);
+    }
+    ar_archive* ar = stream ? self->opener_(stream) : nullptr;
+    for (size_t k = 0; ar && k < job->n; k++) {
+        size_t i = job->order[k];
+        size_t fileId = job->fileIds->at(i);
+        if (fileId >= self->fileInfos_.size()) {
+            continue;
+        }
+        size_t size = self->fileInfos_[fileId]->fileSizeUncompressed;
+        if (addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
+            continue;
+        }
+        u8* fileData = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+        if (!fileData) {
+            continue;
+        }
+        if (!ar_parse_entry_at(ar, self->fileInfos_[fileId]->filePos) || !ar_entry_uncompress(ar, fileData, size)) {
+            free(fileData);
+            continue;
+        }
+        job->res->at(i) = {fileData, size};
+    }
+    ar_close_archive(ar);
+    ar_close(stream);
+    return 0;
+}
+
+// splits the files (in archive order) among several threads, each reading
+// from its own stream. returns false if that isn't possible or worth it
+bool MultiFormatArchive::GetFilesDataByIdParallel(const Vec<size_t>& fileIds, const Vec<size_t>& order,
+                                                  Vec<std::span<u8>>& res) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    size_t nThreads = std::min((size_t)MAX_EXTRACT_THREADS, (size_t)si.dwNumberOfProcessors);
+    nThreads = std::min(nThreads, order.size() / MIN_FILES_PER_EXTRACT_THREAD);
+    if (nThreads < 2 || !CanExtractInParallel()) {
+        return false;
+    }
+
+    ExtractJob jobs[MAX_EXTRACT_THREADS];
+    HANDLE threads[MAX_EXTRACT_THREADS];
+    int nStarted = 0;
+    size_t perThread = (order.size() + nThreads - 1) / nThreads;
+    for (size_t t = 0; t < nThreads; t++) {
+        ExtractJob& job = jobs[t];
+        job.archive = this;
+        job.fileIds = &fileIds;
+        job.order = order.LendData() + t * perThread;
+        job.n = std::min(perThread, order.size() - t * perThread);
+        job.res = &res;
+        // the last part is extracted on this thread
+        if (t < nThreads - 1) {
+            threads[nStarted] = CreateThread(nullptr, 0, ExtractThreadProc, &job, 0, nullptr);
+            if (threads[nStarted]) {
+                nStarted++;
+                continue;
+            }
+        }
+        ExtractThreadProc(&job);
+    }
+    WaitForMultipleObjects(nStarted, threads, TRUE, INFINITE);
+    for (int i = 0; i < nStarted; i++) {
+        CloseHandle(threads[i]);
+    }
+    return true;
+}
+#endif
+
 std::string_view MultiFormatArchive::GetComment() {
     if (!ar_) {
         return {};
@@ -226,7 +437,12 @@ MultiFormatArchive* OpenZipArchive(const WCHAR* path, bool deflatedOnly) {
         opener = ar_open_zip_archive_deflated;
     }
     auto* archive = new MultiFormatArchive(opener, MultiFormatArchive::Format::Zip);
-    return open(archive, path);
+    bool ok = archive->OpenMapped(path);
+    if (!ok) {
+        delete archive;
+        return nullptr;
+    }
+    return archive;
 }
 
 MultiFormatArchive* Open7zArchive(const WCHAR* path) {
@@ -359,6 +575,69 @@ Exit:
     return {(u8*)data, size};
 }
 
+void MultiFormatArchive::GetFilesDataByIdUnrarDll(const Vec<size_t>& fileIds, const Vec<size_t>& order,
+                                                  Vec<std::span<u8>>& res) {
+    CrashIf(!rarFilePath_);
+
+    AutoFreeWstr rarPath = strconv::Utf8ToWstr(rarFilePath_);
+
+    str::Slice uncompressedBuf;
+
+    RAROpenArchiveDataEx arcData = {0};
+    arcData.ArcNameW = rarPath.Get();
+    arcData.OpenMode = RAR_OM_EXTRACT;
+    arcData.Callback = unrarCallback;
+    arcData.UserData = (LPARAM)&uncompressedBuf;
+
+    HANDLE hArc = RAROpenArchiveEx(&arcData);
+    if (!hArc || arcData.OpenResult != 0) {
+        return;
+    }
+
+    // file ids are the indexes of the file headers (cf. OpenUnrarFallback)
+    size_t headerId = 0;
+    for (size_t i : order) {
+        size_t fileId = fileIds[i];
+        if (fileId >= fileInfos_.size()) {
+            break;
+        }
+        RARHeaderDataEx rarHeader = {0};
+        int readRes = 0;
+        for (; headerId < fileId && readRes == 0; headerId++) {
+            readRes = RARReadHeaderEx(hArc, &rarHeader);
+            if (readRes == 0) {
+                RARProcessFile(hArc, RAR_SKIP, nullptr, nullptr);
+            }
+        }
+        if (readRes != 0 || RARReadHeaderEx(hArc, &rarHeader) != 0) {
+            break;
+        }
+        headerId++;
+
+        size_t size = fileInfos_[fileId]->fileSizeUncompressed;
+        // don't support files whose uncompressed size is greater than 4GB
+        if (rarHeader.UnpSizeHigh != 0 || size != rarHeader.UnpSize || addOverflows<size_t>(size, ZERO_PADDING_COUNT)) {
+            RARProcessFile(hArc, RAR_SKIP, nullptr, nullptr);
+            continue;
+        }
+        char* data = AllocArray<char>(size + ZERO_PADDING_COUNT);
+        if (!data) {
+            RARProcessFile(hArc, RAR_SKIP, nullptr, nullptr);
+            continue;
+        }
+        uncompressedBuf.Set(data, size);
+        int processRes = RARProcessFile(hArc, RAR_TEST, nullptr, nullptr);
+        if (processRes != 0 || uncompressedBuf.Left() != 0) {
+            // the archive is probably corrupted from here on
+            free(data);
+            break;
+        }
+        res[i] = {(u8*)data, size};
+    }
+
+    RARCloseArchive(hArc);
+}
+
 // asan build crashes in UnRAR code
 // see https://codeeval.dev/gist/801ad556960e59be41690d0c2fa7cba0
 bool MultiFormatArchive::OpenUnrarFallback(const char* rarPathUtf) {
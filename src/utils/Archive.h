@@ -32,6 +32,11 @@ class MultiFormatArchive {
     Format format;
 
     bool Open(ar_stream* data, const char* archivePath);
+#if OS_WIN
+    // reads the archive through a memory mapping of the file, which
+    // GetStoredFileDataById needs (falls back to reading the file)
+    bool OpenMapped(const WCHAR* path);
+#endif
 
     Vec<FileInfo*> const& GetFileInfos();
 
@@ -42,6 +47,18 @@ class MultiFormatArchive {
 #endif
     std::span<u8> GetFileDataByName(const char* filename);
     std::span<u8> GetFileDataById(size_t fileId);
+    // uncompresses a file into dst which must be fileSizeUncompressed bytes big
+    bool GetFileDataByIdInto(size_t fileId, std::span<u8> dst);
+    // returns the data of a file stored uncompressed in a memory-mapped zip archive
+    // in place, without copying it. the data is owned by the archive (and not
+    // zero-padded). returns an empty span for all other files
+    std::span<u8> GetStoredFileDataById(size_t fileId);
+    // extracts several (distinct) files in a single pass over the archive which,
+    // for solid archives, avoids decompressing all preceding files again for
+    // each of them (files of other archives are extracted on several threads).
+    // the data is returned in the order of fileIds (empty if a file couldn't
+    // be extracted) and must be freed by the caller
+    Vec<std::span<u8>> GetFilesDataById(const Vec<size_t>& fileIds);
 
     std::string_view GetComment();
 
@@ -54,14 +71,26 @@ class MultiFormatArchive {
     ar_stream* data_ = nullptr;
     ar_archive* ar_ = nullptr;
 
+    // set when opened with OpenMapped
+    u8* mappedData_ = nullptr;
+    size_t mappedSize_ = 0;
+
     // only set when we loaded file infos using unrar.dll fallback
     const char* rarFilePath_ = nullptr;
+    // only set when opened from a file
+    const char* archivePath_ = nullptr;
 
     bool OpenUnrarFallback(const char* rarPathUtf);
     std::span<u8> GetFileDataByIdUnarrDll(size_t fileId);
+    void GetFilesDataByIdUnrarDll(const Vec<size_t>& fileIds, const Vec<size_t>& order, Vec<std::span<u8>>& res);
     bool LoadedUsingUnrarDll() const {
         return rarFilePath_ != nullptr;
     }
+#if OS_WIN
+    bool CanExtractInParallel();
+    bool GetFilesDataByIdParallel(const Vec<size_t>& fileIds, const Vec<size_t>& order, Vec<std::span<u8>>& res);
+    static DWORD WINAPI ExtractThreadProc(void* data);
+#endif
 };
 
 MultiFormatArchive* OpenZipArchive(const char* path, bool deflatedOnly);
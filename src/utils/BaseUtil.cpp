@@ -6,8 +6,11 @@
 // if > 1 we won't crash when memory allocation fails
 int gAllowAllocFailure = 0;
 
+void (*gSampleAllocFunc)(size_t size) = nullptr;
+
 void* Allocator::Alloc(Allocator* a, size_t size) {
     if (!a) {
+        SampleAlloc(size);
         return malloc(size);
     }
     return a->Alloc(size);
@@ -34,6 +37,7 @@ void Allocator::Free(Allocator* a, void* p) {
 
 void* Allocator::Realloc(Allocator* a, void* mem, size_t size) {
     if (!a) {
+        SampleAlloc(size);
         return realloc(mem, size);
     }
     return a->Realloc(mem, size);
@@ -91,6 +95,7 @@ void PoolAllocator::FreeAll() {
     currBlock = nullptr;
     firstBlock = nullptr;
     nAllocs = 0;
+    blocksSize = 0;
 }
 
 // optimization: frees all but first block
@@ -151,8 +156,10 @@ void* PoolAllocator::Alloc(size_t size) {
             freeSpaceSize = minBlockSize - hdrSize;
         }
         // TODO: zero with calloc()? slower but safer
+        SampleAlloc(blockSize);
         auto block = (Block*)malloc(blockSize);
         char* start = (char*)block;
+        blocksSize += blockSize;
 
         block->nAllocs = 0;
         block->curr = start + hdrSize;
@@ -215,10 +222,12 @@ void ZeroMemory(void* p, size_t len) {
 // to catch allocations of a given size and it won't cause
 // re-compilation of everything caused by changing BaseUtil.h
 void* AllocZero(size_t count, size_t size) {
+    SampleAlloc(count * size);
     return calloc(count, size);
 }
 
 void* memdup(const void* data, size_t len) {
+    SampleAlloc(len);
     void* dup = malloc(len);
     if (!dup) {
         return nullptr;
@@ -438,6 +438,8 @@ struct PoolAllocator : Allocator {
     Block* currBlock = nullptr;
     Block* firstBlock = nullptr;
     int nAllocs = 0;
+    // total size of all blocks (i.e. the memory used by the allocator)
+    size_t blocksSize = 0;
 
     PoolAllocator() = default;
 
@@ -612,6 +614,15 @@ class ExitScopeHelp {
 
 extern int gAllowAllocFailure;
 
+// set while allocations are being sampled (see AllocSampler.h)
+extern void (*gSampleAllocFunc)(size_t size);
+
+inline void SampleAlloc(size_t size) {
+    if (gSampleAllocFunc) {
+        gSampleAllocFunc(size);
+    }
+}
+
 /* How to use:
 defer { free(tools_filename); };
 defer { fclose(f); };
@@ -25,7 +25,7 @@ u8 BitReader::GetByte(size_t pos) {
 // returns false if we've eaten bits more than we have
 bool BitReader::Eat(size_t bitsCount) {
     currBitPos += bitsCount;
-    return (currBitPos <= bitsCount);
+    return (currBitPos <= this->bitsCount);
 }
 
 size_t BitReader::BitsLeft() {
@@ -8,8 +8,14 @@ extern "C" {
 #endif
 
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
 #include "utils/CryptoUtil.h"
 
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#include <emmintrin.h>
+#endif
+
 #ifndef DWORD_MAX
 #define DWORD_MAX 0xffffffffUL
 #endif
@@ -253,3 +259,210 @@ CleanUp:
     }
     return ok;
 }
+
+/***** fast non-cryptographic digest *****/
+
+// the digest consumes the data in stripes of 64 bytes, which are mixed into 8 64-bit
+// accumulators with a 32x32 bit multiplication each, using a different part of the
+// secret for each stripe of a block. after each block, the accumulators are scrambled
+
+#define FD_STRIPE_LEN 64
+#define FD_STRIPES_PER_BLOCK 16
+
+static const u64 kFdPrime32 = 0x9E3779B1U;
+static const u64 kFdPrime64_1 = 0x9E3779B185EBCA87ULL;
+static const u64 kFdPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+
+// generated with splitmix64
+alignas(16) static const u64 kFdSecret[24] = {
+    0xD0C948294D1A3D01ULL, 0x1D6E748B9FA73F09ULL, 0x9944E177556AED03ULL,
+    0xE8495C5AFD13C85AULL, 0x29180F44FF65E670ULL, 0xC2E442193ECA5607ULL,
+    0xA34E3A79CEC59F87ULL, 0x23FADE1F0AAC939BULL, 0xF13AECDA3724F546ULL,
+    0x3C3BA55F33A46DA1ULL, 0xE5D3F1224EDCBD7CULL, 0x7A1F54FE010166D8ULL,
+    0x9736F89AA50BDDBFULL, 0xC9B306668EE198FEULL, 0xC32EDE074EA66806ULL,
+    0x181AA120C5F017D0ULL, 0x80FADF7BFDE3032CULL, 0x7C574B03000987AAULL,
+    0x6BD6F4CE10848CC5ULL, 0x051EC8AFD620028EULL, 0x8DB7B324EAC960ECULL,
+    0x7D8FFCBA931C3B44ULL, 0x04D0219F52696C1FULL, 0xE8158CDA829408F4ULL,
+};
+
+static u64 Mul128Fold64(u64 a, u64 b) {
+#if defined(_M_X64)
+    u64 hi;
+    u64 lo = _umul128(a, b, &hi);
+    return lo ^ hi;
+#else
+    u64 aLo = (u32)a, aHi = a >> 32;
+    u64 bLo = (u32)b, bHi = b >> 32;
+    u64 loLo = aLo * bLo;
+    u64 hiLo = aHi * bLo;
+    u64 loHi = aLo * bHi;
+    u64 hiHi = aHi * bHi;
+    u64 cross = (loLo >> 32) + (u32)hiLo + loHi;
+    u64 hi = hiHi + (hiLo >> 32) + (cross >> 32);
+    u64 lo = (cross << 32) | (u32)loLo;
+    return lo ^ hi;
+#endif
+}
+
+static u64 FdAvalanche(u64 h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+FastDigest::FastDigest() {
+    acc[0] = kFdPrime32;
+    acc[1] = kFdPrime64_1;
+    acc[2] = kFdPrime64_2;
+    acc[3] = 0x165667B19E3779F9ULL;
+    acc[4] = 0x85EBCA77C2B2AE63ULL;
+    acc[5] = 0x85EBCA77U;
+    acc[6] = 0x27D4EB2F165667C5ULL;
+    acc[7] = 0x27D4EB2FU;
+}
+
+void FastDigest::ConsumeStripe(const u8* stripe) {
+    const u8* key = (const u8*)kFdSecret + nStripes * 8;
+#if defined(_M_IX86) || defined(_M_X64)
+    __m128i* a = (__m128i*)acc;
+    for (int i = 0; i < 4; i++) {
+        __m128i d = _mm_loadu_si128((const __m128i*)stripe + i);
+        __m128i dk = _mm_xor_si128(d, _mm_loadu_si128((const __m128i*)key + i));
+        // multiply the low and high 32 bits of each 64-bit lane
+        __m128i dkHi = _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i product = _mm_mul_epu32(dk, dkHi);
+        // add the data of the other lane
+        __m128i dSwapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+        a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, dSwapped));
+    }
+#else
+    for (int i = 0; i < 8; i++) {
+        u64 d, k;
+        memcpy(&d, stripe + i * 8, 8);
+        memcpy(&k, key + i * 8, 8);
+        u64 dk = d ^ k;
+        acc[i ^ 1] += d;
+        acc[i] += (u64)(u32)dk * (dk >> 32);
+    }
+#endif
+
+    nStripes++;
+    if (nStripes < FD_STRIPES_PER_BLOCK) {
+        return;
+    }
+    nStripes = 0;
+    const u8* scrambleKey = (const u8*)kFdSecret + 128;
+#if defined(_M_IX86) || defined(_M_X64)
+    __m128i prime = _mm_set_epi32(0, (int)kFdPrime32, 0, (int)kFdPrime32);
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_xor_si128(a[i], _mm_srli_epi64(a[i], 47));
+        v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i*)scrambleKey + i));
+        // 64x32 bit multiplication
+        __m128i lo = _mm_mul_epu32(v, prime);
+        __m128i hi = _mm_mul_epu32(_mm_srli_epi64(v, 32), prime);
+        a[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+    }
+#else
+    for (int i = 0; i < 8; i++) {
+        u64 k;
+        memcpy(&k, scrambleKey + i * 8, 8);
+        u64 v = acc[i] ^ (acc[i] >> 47);
+        acc[i] = (v ^ k) * kFdPrime32;
+    }
+#endif
+}
+
+void FastDigest::Update(const void* data, size_t byteCount) {
+    const u8* d = (const u8*)data;
+    totalLen += byteCount;
+    if (bufLen > 0) {
+        size_t n = std::min(byteCount, FD_STRIPE_LEN - bufLen);
+        memcpy(buf + bufLen, d, n);
+        bufLen += n;
+        d += n;
+        byteCount -= n;
+        if (bufLen < FD_STRIPE_LEN) {
+            return;
+        }
+        ConsumeStripe(buf);
+        bufLen = 0;
+    }
+    for (; byteCount >= FD_STRIPE_LEN; d += FD_STRIPE_LEN, byteCount -= FD_STRIPE_LEN) {
+        ConsumeStripe(d);
+    }
+    memcpy(buf, d, byteCount);
+    bufLen = byteCount;
+}
+
+void FastDigest::Final(u8 digest[16]) {
+    // the total length distinguishes the zero padding from data
+    if (bufLen > 0) {
+        ZeroMemory(buf + bufLen, FD_STRIPE_LEN - bufLen);
+        ConsumeStripe(buf);
+        bufLen = 0;
+    }
+    u64 lo = totalLen * kFdPrime64_1;
+    u64 hi = ~totalLen * kFdPrime64_2;
+    for (int i = 0; i < 4; i++) {
+        lo += Mul128Fold64(acc[2 * i] ^ kFdSecret[1 + 2 * i], acc[2 * i + 1] ^ kFdSecret[2 + 2 * i]);
+        hi += Mul128Fold64(acc[2 * i] ^ kFdSecret[9 + 2 * i], acc[2 * i + 1] ^ kFdSecret[10 + 2 * i]);
+    }
+    lo = FdAvalanche(lo);
+    hi = FdAvalanche(hi);
+    memcpy(digest, &lo, 8);
+    memcpy(digest + 8, &hi, 8);
+}
+
+void CalcFastDigest(const void* data, size_t byteCount, u8 digest[16]) {
+    FastDigest fd;
+    fd.Update(data, byteCount);
+    fd.Final(digest);
+}
+
+#define FINGERPRINT_FULL_MAX (16 * 1024 * 1024)
+#define FINGERPRINT_SAMPLES 64
+#define FINGERPRINT_SAMPLE_SIZE (64 * 1024)
+
+bool CalcFileFingerprint(const WCHAR* filePath, u8 digest[16]) {
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE;
+    HANDLE h = CreateFileW(filePath, GENERIC_READ, share, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    AutoCloseHandle hFile(h);
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(hFile, &size)) {
+        return false;
+    }
+    ScopedMem<u8> buf(AllocArray<u8>(FINGERPRINT_SAMPLE_SIZE));
+    if (!buf) {
+        return false;
+    }
+
+    FastDigest fd;
+    i64 fileSize = size.QuadPart;
+    fd.Update(&fileSize, sizeof(fileSize));
+    // smaller files are read in full, of bigger ones only evenly spread samples
+    // (always including the start and the end of the file)
+    bool sampled = fileSize > FINGERPRINT_FULL_MAX;
+    i64 nSamples = sampled ? FINGERPRINT_SAMPLES : (fileSize + FINGERPRINT_SAMPLE_SIZE - 1) / FINGERPRINT_SAMPLE_SIZE;
+    for (i64 i = 0; i < nSamples; i++) {
+        LARGE_INTEGER offset;
+        offset.QuadPart = i * FINGERPRINT_SAMPLE_SIZE;
+        if (sampled) {
+            offset.QuadPart = (fileSize - FINGERPRINT_SAMPLE_SIZE) * i / (nSamples - 1);
+            if (!SetFilePointerEx(hFile, offset, nullptr, FILE_BEGIN)) {
+                return false;
+            }
+        }
+        DWORD toRead = (DWORD)std::min((i64)FINGERPRINT_SAMPLE_SIZE, fileSize - offset.QuadPart);
+        DWORD nRead = 0;
+        if (!ReadFile(hFile, buf, toRead, &nRead, nullptr) || nRead != toRead) {
+            return false;
+        }
+        fd.Update(buf, nRead);
+    }
+    fd.Final(digest);
+    return true;
+}
@@ -9,5 +9,29 @@ void CalcMD5DigestWin(const void* data, size_t byteCount, u8 digest[16]);
 void CalcSha1DigestWin(const void* data, size_t byteCount, u8 digest[20]);
 void CalcSha2DigestWin(const void* data, size_t byteCount, u8 digest[32]);
 
+// fast non-cryptographic 128-bit digest (in the style of XXH3, using SSE2)
+// for cache keys and detecting changes. unlike MD5 and SHA it doesn't
+// resist deliberate collisions, so don't use it for anything security related
+struct FastDigest {
+    alignas(16) u64 acc[8];
+    u8 buf[64];
+    size_t bufLen = 0;
+    // number of stripes consumed in the current block
+    size_t nStripes = 0;
+    u64 totalLen = 0;
+
+    FastDigest();
+    void Update(const void* data, size_t byteCount);
+    void Final(u8 digest[16]);
+
+  private:
+    void ConsumeStripe(const u8* stripe);
+};
+
+void CalcFastDigest(const void* data, size_t byteCount, u8 digest[16]);
+// a fast digest of a file's size and content, for cache keys. files bigger
+// than 16 MB are sampled instead of being read in full
+bool CalcFileFingerprint(const WCHAR* filePath, u8 digest[16]);
+
 bool VerifySHA1Signature(const void* data, size_t dataLen, const char* hexSignature, const void* pubkey,
                          size_t pubkeyLen);
@@ -14,5 +14,7 @@ void FreeCallstackLogs();
 std::span<u8> GetCallstacks();
 void GetAllThreadsCallstacks(str::Str& s);
 void GetExceptionInfo(str::Str& s, EXCEPTION_POINTERS* excPointers);
+// appends the module, symbol and source line of addr (and a newline)
+void GetAddressInfo(str::Str& s, DWORD64 addr);
 
 } // namespace dbghelp
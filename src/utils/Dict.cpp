@@ -10,203 +10,263 @@ just as well be a tree of some kind.
 Usually those things are done as a templated hash table class,
 but I want to avoid code bloat and awful syntax.
 
-The classes are based on a generic, untyped uintptr => uintptr
+The classes are based on a generic, untyped uintptr => int
 hash table. The actual dict class is a wrapper that provides
 a type-safe API and handles policy decisions like allocations
 (if they are necessary).
 
-Our hash table uses the same parameters as the one in redis
-(but without complexity of incremental hashing):
-- we use chaining on collisions
-- size of the hash table is power of two
+The hash table uses open addressing in the style of Google's Swiss tables:
+- slots are stored in a single array (no per-entry allocations, no pointer chasing)
+- a separate array has one control byte per slot: empty, deleted or
+  7 bits of the hash of the key stored in the slot
+- the control bytes of a group of 16 slots are compared with SSE2 at once,
+  so that keys only need to be compared for slots that most likely match
+- groups are probed quadratically, the table is grown at a load factor of 7/8
+- the full hash is stored with the key, so resizing doesn't have to re-hash the keys
 
 TODO:
 - add iterator for keys/values
-- would hash function be faster if we got bytes one at a time
-  but only with a single pass vs. getting 4 at a time but
-  doing 2 passes (the first to calculate the length)?
 */
 
 #include "utils/BaseUtil.h"
 #include "utils/Dict.h"
 
-namespace dict {
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
-class HasherComparator {
-  public:
-    virtual size_t Hash(uintptr_t key) = 0;
-    virtual bool Equal(uintptr_t k1, uintptr_t k2) = 0;
-    virtual ~HasherComparator() {
-    }
-};
+namespace dict {
 
-class StrKeyHasherComparator : public HasherComparator {
-    size_t Hash(uintptr_t key) override {
-        return MurmurHash2((const void*)key, str::Len((const char*)key));
+struct StrKeyHasher {
+    static u32 Hash(uintptr_t key) {
+        const char* s = (const char*)key;
+        return MurmurHash2(s, str::Len(s));
     }
-    bool Equal(uintptr_t k1, uintptr_t k2) override {
-        const char* s1 = (const char*)k1;
-        const char* s2 = (const char*)k2;
-        return str::Eq(s1, s2);
+    static bool Equal(uintptr_t k1, uintptr_t k2) {
+        return str::Eq((const char*)k1, (const char*)k2);
     }
 };
 
-class WStrKeyHasherComparator : public HasherComparator {
-    size_t Hash(uintptr_t key) override {
-        size_t cbLen = str::Len((const WCHAR*)key) * sizeof(WCHAR);
-        return MurmurHash2((const void*)key, cbLen);
+struct WStrKeyHasher {
+    static u32 Hash(uintptr_t key) {
+        const WCHAR* s = (const WCHAR*)key;
+        return MurmurHash2(s, str::Len(s) * sizeof(WCHAR));
     }
-    bool Equal(uintptr_t k1, uintptr_t k2) override {
-        const WCHAR* s1 = (const WCHAR*)k1;
-        const WCHAR* s2 = (const WCHAR*)k2;
-        return str::Eq(s1, s2);
+    static bool Equal(uintptr_t k1, uintptr_t k2) {
+        return str::Eq((const WCHAR*)k1, (const WCHAR*)k2);
     }
 };
 
-static StrKeyHasherComparator gStrKeyHasherComparator;
-static WStrKeyHasherComparator gWStrKeyHasherComparator;
+constexpr size_t kGroupSize = 16;
+constexpr u8 kCtrlEmpty = 0x80;
+constexpr u8 kCtrlDeleted = 0xFE;
 
-struct HashTableEntry {
+struct HashTableSlot {
     uintptr_t key;
-    uintptr_t val;
-    struct HashTableEntry* next;
+    int val;
+    u32 hash;
 };
 
 // not a class so that it can be allocated with an allocator
 struct HashTable {
-    HashTableEntry** entries;
-    HashTableEntry* freeList;
+    // nSlots control bytes (kCtrlEmpty, kCtrlDeleted or the low 7 bits of the hash),
+    // followed by the slots (in the same allocation)
+    u8* ctrl;
+    HashTableSlot* slots;
 
-    size_t nEntries;
+    // power of 2 and a multiple of kGroupSize
+    size_t nSlots;
     size_t nUsed; // total number of inserted entries
+    size_t nDeleted;
 
     // for debugging
     size_t nResizes;
-    size_t nCollisions;
 };
 
+// returns a bit mask of the bytes in the group that are equal to b
+static inline u32 GroupMatch(const u8* group, u8 b) {
+#if defined(_M_IX86) || defined(_M_X64)
+    __m128i ctrl = _mm_load_si128((const __m128i*)group);
+    return (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)b)));
+#else
+    u32 res = 0;
+    for (size_t i = 0; i < kGroupSize; i++) {
+        if (group[i] == b) {
+            res |= 1 << i;
+        }
+    }
+    return res;
+#endif
+}
+
+// returns a bit mask of the empty or deleted slots in the group (i.e. with the high bit set)
+static inline u32 GroupMatchFree(const u8* group) {
+#if defined(_M_IX86) || defined(_M_X64)
+    __m128i ctrl = _mm_load_si128((const __m128i*)group);
+    return (u32)_mm_movemask_epi8(ctrl);
+#else
+    u32 res = 0;
+    for (size_t i = 0; i < kGroupSize; i++) {
+        if (group[i] & 0x80) {
+            res |= 1 << i;
+        }
+    }
+    return res;
+#endif
+}
+
+static inline size_t LowestBit(u32 mask) {
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return idx;
+}
+
+static inline u8 HashCtrl(u32 hash) {
+    return (u8)(hash & 0x7F);
+}
+
+static inline size_t HashGroup(HashTable* h, u32 hash) {
+    return (hash >> 7) & (h->nSlots / kGroupSize - 1);
+}
+
+static void AllocSlots(HashTable* h, size_t nSlots) {
+    size_t size = nSlots + nSlots * sizeof(HashTableSlot);
+    // 16 byte alignment for loading the control bytes of a group at once
+    h->ctrl = (u8*)_aligned_malloc(size, kGroupSize);
+    CrashAlwaysIf(!h->ctrl);
+    memset(h->ctrl, kCtrlEmpty, nSlots);
+    h->slots = (HashTableSlot*)(h->ctrl + nSlots);
+    h->nSlots = nSlots;
+    h->nDeleted = 0;
+}
+
 static HashTable* NewHashTable(size_t size, Allocator* allocator) {
     CrashIf(!allocator); // we'll leak otherwise
     HashTable* h = (HashTable*)Allocator::AllocZero(allocator, sizeof(HashTable));
-    // number of hash table entries should be power of 2
-    size = RoundToPowerOf2(size);
-    // entries are not allocated with allocator since those are large blocks
+    // number of slots should be power of 2 and a multiple of kGroupSize
+    size = RoundToPowerOf2(std::max(size, kGroupSize));
+    // slots are not allocated with allocator since those are large blocks
     // and we don't want to waste their memory after
-    h->entries = AllocArray<HashTableEntry*>(size);
-    h->nEntries = size;
+    AllocSlots(h, size);
     return h;
 }
 
 static void DeleteHashTable(HashTable* h) {
-    free(h->entries);
+    _aligned_free(h->ctrl);
     // the rest is freed by allocator
 }
 
-static void HashTableResize(HashTable* h, HasherComparator* hc) {
-    size_t newSize = RoundToPowerOf2(h->nEntries + 1);
-    CrashIf(newSize <= h->nEntries);
-    HashTableEntry** newEntries = AllocArray<HashTableEntry*>(newSize);
-    HashTableEntry *e, *next;
-    size_t hash, pos;
-    for (size_t i = 0; i < h->nEntries; i++) {
-        e = h->entries[i];
-        while (e) {
-            next = e->next;
-            hash = hc->Hash(e->key);
-            pos = hash % newSize;
-            e->next = newEntries[pos];
-            newEntries[pos] = e;
-            e = next;
+// returns the first empty or deleted slot in the probe sequence of hash
+static size_t FindFreeSlot(HashTable* h, u32 hash) {
+    size_t groupMask = h->nSlots / kGroupSize - 1;
+    size_t g = HashGroup(h, hash);
+    for (size_t step = 1;; step++) {
+        u32 m = GroupMatchFree(h->ctrl + g * kGroupSize);
+        if (m) {
+            return g * kGroupSize + LowestBit(m);
         }
+        g = (g + step) & groupMask;
     }
-    free(h->entries);
-    h->entries = newEntries;
-    h->nEntries = newSize;
-    h->nResizes += 1;
+}
 
-    CrashIf(h->nUsed >= (h->nEntries * 3) / 2);
+// re-inserts all entries into a table of nSlots slots (which also gets rid of deleted slots)
+static void HashTableResize(HashTable* h, size_t nSlots) {
+    u8* oldCtrl = h->ctrl;
+    HashTableSlot* oldSlots = h->slots;
+    size_t oldNSlots = h->nSlots;
+    AllocSlots(h, nSlots);
+    for (size_t i = 0; i < oldNSlots; i++) {
+        if (oldCtrl[i] & 0x80) {
+            continue;
+        }
+        HashTableSlot& slot = oldSlots[i];
+        size_t idx = FindFreeSlot(h, slot.hash);
+        h->ctrl[idx] = HashCtrl(slot.hash);
+        h->slots[idx] = slot;
+    }
+    _aligned_free(oldCtrl);
+    h->nResizes += 1;
 }
 
 // micro optimization: this is called often, so we want this check inlined. Resizing logic
 // is called rarely, so doesn't need to be inlined
-static inline void HashTableResizeIfNeeded(HashTable* h, HasherComparator* hc) {
-    // per http://stackoverflow.com/questions/1603712/when-should-i-do-rehashing-of-entire-hash-table/1604428#1604428
-    // when using collision chaining, load factor can be 150%
-    if (h->nUsed < (h->nEntries * 3) / 2) {
+static inline void HashTableResizeIfNeeded(HashTable* h) {
+    // keep at least 1/8 of the slots empty, so that probing stays short
+    // (and always terminates)
+    if ((h->nUsed + h->nDeleted + 1) * 8 <= h->nSlots * 7) {
         return;
     }
-    HashTableResize(h, hc);
+    // if mostly deleted slots are in the way, re-inserting at the same size is enough
+    size_t nSlots = h->nSlots;
+    if ((h->nUsed + 1) * 16 > nSlots * 7) {
+        nSlots *= 2;
+    }
+    HashTableResize(h, nSlots);
 }
 
-// note: allocator must be nullptr for get, non-nullptr for create
-static HashTableEntry* GetOrCreateEntry(HashTable* h, HasherComparator* hc, uintptr_t key, Allocator* allocator,
-                                        bool& newEntry) {
-    bool shouldCreate = (allocator != nullptr);
-    size_t hash = hc->Hash(key);
-    size_t pos = hash % h->nEntries;
-    HashTableEntry* e = h->entries[pos];
-    newEntry = false;
-    while (e) {
-        if (hc->Equal(key, e->key)) {
-            return e;
+// returns the index of the slot with the given key or -1 if there's none
+template <typename Hasher>
+static int FindSlot(HashTable* h, uintptr_t key, u32 hash) {
+    size_t groupMask = h->nSlots / kGroupSize - 1;
+    size_t g = HashGroup(h, hash);
+    u8 ctrl = HashCtrl(hash);
+    for (size_t step = 1;; step++) {
+        const u8* group = h->ctrl + g * kGroupSize;
+        for (u32 m = GroupMatch(group, ctrl); m; m &= m - 1) {
+            size_t idx = g * kGroupSize + LowestBit(m);
+            HashTableSlot& slot = h->slots[idx];
+            if (slot.hash == hash && Hasher::Equal(key, slot.key)) {
+                return (int)idx;
+            }
         }
-        e = e->next;
-    }
-    if (!shouldCreate) {
-        return nullptr;
+        // the key would've been inserted into the first empty slot
+        if (GroupMatch(group, kCtrlEmpty)) {
+            return -1;
+        }
+        g = (g + step) & groupMask;
     }
+}
 
-    if (h->freeList) {
-        e = h->freeList;
-        h->freeList = h->freeList->next;
-    } else {
-        e = (HashTableEntry*)Allocator::AllocZero(allocator, sizeof(HashTableEntry));
+// inserts a slot for key (which the caller has to set) unless the key already exists
+// returns the index of the slot and sets newEntry to true if it was inserted
+template <typename Hasher>
+static size_t GetOrCreateSlot(HashTable* h, uintptr_t key, bool& newEntry) {
+    u32 hash = Hasher::Hash(key);
+    int existing = FindSlot<Hasher>(h, key, hash);
+    if (existing >= 0) {
+        newEntry = false;
+        return (size_t)existing;
     }
-    e->next = h->entries[pos];
-    h->entries[pos] = e;
-    h->nUsed++;
-    if (e->next != nullptr) {
-        h->nCollisions++;
+    HashTableResizeIfNeeded(h);
+    size_t idx = FindFreeSlot(h, hash);
+    if (kCtrlDeleted == h->ctrl[idx]) {
+        h->nDeleted--;
     }
+    h->ctrl[idx] = HashCtrl(hash);
+    h->slots[idx].hash = hash;
+    h->nUsed++;
     newEntry = true;
-    return e;
+    return idx;
 }
 
-static bool RemoveEntry(HashTable* h, HasherComparator* hc, uintptr_t key, uintptr_t* removedValOut) {
-    size_t hash = hc->Hash(key);
-    size_t pos = hash % h->nEntries;
-    HashTableEntry* e = h->entries[pos];
-    while (e) {
-        if (hc->Equal(key, e->key)) {
-            break;
-        }
-        e = e->next;
-    }
-    if (!e) {
+template <typename Hasher>
+static bool RemoveEntry(HashTable* h, uintptr_t key, int* removedValOut) {
+    int idx = FindSlot<Hasher>(h, key, Hasher::Hash(key));
+    if (idx < 0) {
         return false;
     }
-
-    // remove the the entry from the list
-    HashTableEntry* e2 = h->entries[pos];
-    if (e2 == e) {
-        h->entries[pos] = e->next;
-    } else {
-        while (e2->next != e) {
-            e2 = e2->next;
-        }
-        e2->next = e->next;
+    h->ctrl[idx] = kCtrlDeleted;
+    h->nDeleted++;
+    if (removedValOut) {
+        *removedValOut = h->slots[idx].val;
     }
-    e->next = h->freeList;
-    h->freeList = e;
-    *removedValOut = e->val;
     CrashIf(0 == h->nUsed);
     h->nUsed -= 1;
     return true;
 }
 
 MapStrToInt::MapStrToInt(size_t initialSize) {
-    // we use PoolAllocator to allocate HashTableEntry entries
-    // and copies of string keys
+    // we use PoolAllocator to allocate HashTable and copies of string keys
     allocator.allocAlign = 4;
     h = NewHashTable(initialSize, &allocator);
 }
@@ -230,49 +290,40 @@ size_t MapStrToInt::Count() const {
 //   * sets existingKeyOut to (interned) key
 bool MapStrToInt::Insert(const char* key, int val, int* existingValOut, const char** existingKeyOut) {
     bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &gStrKeyHasherComparator, (uintptr_t)key, &allocator, newEntry);
+    size_t idx = GetOrCreateSlot<StrKeyHasher>(h, (uintptr_t)key, newEntry);
+    HashTableSlot& slot = h->slots[idx];
     if (!newEntry) {
         if (existingValOut) {
-            *existingValOut = (int)e->val;
+            *existingValOut = slot.val;
         }
         if (existingKeyOut) {
-            *existingKeyOut = (const char*)e->key;
+            *existingKeyOut = (const char*)slot.key;
         }
         return false;
     }
-    e->key = (intptr_t)Allocator::StrDup(&allocator, key);
-    e->val = (intptr_t)val;
+    slot.key = (uintptr_t)Allocator::StrDup(&allocator, key);
+    slot.val = val;
     if (existingKeyOut) {
-        *existingKeyOut = (const char*)e->key;
+        *existingKeyOut = (const char*)slot.key;
     }
-
-    HashTableResizeIfNeeded(h, &gStrKeyHasherComparator);
     return true;
 }
 
 bool MapStrToInt::Remove(const char* key, int* removedValOut) {
-    uintptr_t removedVal;
-    bool removed = RemoveEntry(h, &gStrKeyHasherComparator, (uintptr_t)key, &removedVal);
-    if (removed && removedValOut) {
-        *removedValOut = (int)removedVal;
-    }
-    return removed;
+    return RemoveEntry<StrKeyHasher>(h, (uintptr_t)key, removedValOut);
 }
 
 bool MapStrToInt::Get(const char* key, int* valOut) {
-    StrKeyHasherComparator hc;
-    bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &hc, (uintptr_t)key, nullptr, newEntry);
-    if (!e) {
+    int idx = FindSlot<StrKeyHasher>(h, (uintptr_t)key, StrKeyHasher::Hash((uintptr_t)key));
+    if (idx < 0) {
         return false;
     }
-    *valOut = (int)e->val;
+    *valOut = h->slots[idx].val;
     return true;
 }
 
 MapWStrToInt::MapWStrToInt(size_t initialSize) {
-    // we use PoolAllocator to allocate HashTableEntry entries
-    // and copies of string keys
+    // we use PoolAllocator to allocate HashTable and copies of string keys
     h = NewHashTable(initialSize, &allocator);
 }
 
@@ -286,37 +337,29 @@ size_t MapWStrToInt::Count() const {
 
 bool MapWStrToInt::Insert(const WCHAR* key, int val, int* prevVal) {
     bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &gWStrKeyHasherComparator, (uintptr_t)key, &allocator, newEntry);
+    size_t idx = GetOrCreateSlot<WStrKeyHasher>(h, (uintptr_t)key, newEntry);
+    HashTableSlot& slot = h->slots[idx];
     if (!newEntry) {
         if (prevVal) {
-            *prevVal = (int)e->val;
+            *prevVal = slot.val;
         }
         return false;
     }
-    e->key = (intptr_t)Allocator::StrDup(&allocator, key);
-    e->val = (intptr_t)val;
-
-    HashTableResizeIfNeeded(h, &gWStrKeyHasherComparator);
+    slot.key = (uintptr_t)Allocator::StrDup(&allocator, key);
+    slot.val = val;
     return true;
 }
 
 bool MapWStrToInt::Remove(const WCHAR* key, int* removedValOut) {
-    uintptr_t removedVal;
-    bool removed = RemoveEntry(h, &gStrKeyHasherComparator, (uintptr_t)key, &removedVal);
-    if (removed && removedValOut) {
-        *removedValOut = (int)removedVal;
-    }
-    return removed;
+    return RemoveEntry<WStrKeyHasher>(h, (uintptr_t)key, removedValOut);
 }
 
 bool MapWStrToInt::Get(const WCHAR* key, int* valOut) {
-    WStrKeyHasherComparator hc;
-    bool newEntry;
-    HashTableEntry* e = GetOrCreateEntry(h, &hc, (uintptr_t)key, nullptr, newEntry);
-    if (!e) {
+    int idx = FindSlot<WStrKeyHasher>(h, (uintptr_t)key, WStrKeyHasher::Hash((uintptr_t)key));
+    if (idx < 0) {
         return false;
     }
-    *valOut = (int)e->val;
+    *valOut = h->slots[idx].val;
     return true;
 }
 
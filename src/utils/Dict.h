@@ -7,12 +7,13 @@ struct HashTable;
 
 // we are very generous with default initial size. It's a trade-off
 // between memory used by hash table and how often we need to resize it.
-// We allocate size*sizeof(ptr) which is 64k on 32-bit for 16k entries.
-// 64k is very little on today's machines, especially for short-lived
+// Each slot takes a control byte plus key, value and cached hash, so 4k
+// entries are ~52k on 32-bit (~68k on 64-bit).
+// That is very little on today's machines, especially for short-lived
 // hash tables.
 // Should use smaller values for long-lived hash tables, especially
 // if there are many of them.
-enum { DEFAULT_HASH_TABLE_INITIAL_SIZE = 16 * 1024 };
+enum { DEFAULT_HASH_TABLE_INITIAL_SIZE = 4 * 1024 };
 
 // a dictionary whose keys are char * strings and the values are integers
 // note: StrToInt would be more natural name but it's re-#define'd in <shlwapi.h>
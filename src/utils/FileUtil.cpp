@@ -634,10 +634,38 @@ bool WriteFile(const WCHAR* filePath, std::span<u8> d) {
     }
     AutoCloseHandle h(fh);
 
-    DWORD size = 0;
-    BOOL ok = WriteFile(h, data, (DWORD)dataLen, &size, nullptr);
-    CrashIf(ok && (dataLen != (size_t)size));
-    return ok && dataLen == (size_t)size;
+    // write in chunks so that files larger than 4 GB can be written as well
+    const u8* curr = (const u8*)data;
+    while (dataLen > 0) {
+        DWORD toWrite = (DWORD)std::min(dataLen, (size_t)(1024 * 1024 * 1024));
+        DWORD size = 0;
+        BOOL ok = WriteFile(h, curr, toWrite, &size, nullptr);
+        CrashIf(ok && (toWrite != size));
+        if (!ok || toWrite != size) {
+            return false;
+        }
+        curr += size;
+        dataLen -= size;
+    }
+    return true;
+}
+
+static DWORD CALLBACK CopyProgressRoutine(LARGE_INTEGER totalSize, LARGE_INTEGER copied, LARGE_INTEGER, LARGE_INTEGER,
+                                          DWORD, DWORD, HANDLE, HANDLE, LPVOID data) {
+    auto progressCb = (const std::function<bool(i64, i64)>*)data;
+    if (!(*progressCb)(copied.QuadPart, totalSize.QuadPart)) {
+        return PROGRESS_CANCEL;
+    }
+    return PROGRESS_CONTINUE;
+}
+
+// copies the file in large unbuffered chunks instead of reading it into memory first
+// (which is much faster for big files and network shares). progressCb is called
+// after every chunk and cancels the copy (removing the partial file) by returning false
+bool Copy(const WCHAR* srcPath, const WCHAR* dstPath, const std::function<bool(i64 copied, i64 total)>& progressCb) {
+    LPPROGRESS_ROUTINE routine = progressCb ? CopyProgressRoutine : nullptr;
+    BOOL ok = CopyFileExW(srcPath, dstPath, routine, (LPVOID)&progressCb, nullptr, COPY_FILE_NO_BUFFERING);
+    return ok;
 }
 
 // Return true if the file wasn't there or was successfully deleted
@@ -57,6 +57,7 @@ i64 GetSize(std::string_view path);
 
 int ReadN(const WCHAR* path, char* buf, size_t toRead);
 bool WriteFile(const WCHAR* path, std::span<u8>);
+bool Copy(const WCHAR* srcPath, const WCHAR* dstPath, const std::function<bool(i64 copied, i64 total)>& progressCb);
 bool Delete(const WCHAR* path);
 FILETIME GetModificationTime(const WCHAR* path);
 bool SetModificationTime(const WCHAR* path, FILETIME lastMod);
@@ -29,18 +29,22 @@ worker thread so must be protected via g_threadCritSec.
 
 ReadDirectChangesW() doesn't always work for files on network drives,
 so for those files, we do manual checks, by using a timeout to
-periodically wake up thread.
+periodically wake up thread. To limit the network traffic, files that
+haven't changed for a while are checked less often and the files in
+the same directory are checked together, with a single directory query.
+
+Programs often write a file in several chunks (e.g. pdftex or a copy of a
+large file), each of which generates a notification. Instead of calling
+onFileChangedCb for each of them, a change only marks the file as pending
+and the callback is called once the file's size and modification time
+haven't changed for FILEWATCH_QUIESCENCE_IN_MS and no other program has
+it open for writing anymore.
 */
 
 /*
 TODO:
   - should I end the thread when there are no files to watch?
 
-  - a single file copy can generate multiple notifications for the same
-    file. add some delay mechanism so that subsequent change notifications
-    cancel a previous, delayed one ? E.g. a copy f2.pdf f.pdf generates 3
-    notifications if f2.pdf is 2 MB.
-
   - try to handle short file names as well: http://blogs.msdn.com/b/ericgu/archive/2005/10/07/478396.aspx
     but how to test it?
 
@@ -49,8 +53,17 @@ TODO:
     probably an overkill
 */
 
-// there's a balance between responsiveness to changes and efficiency
+// there's a balance between responsiveness to changes and efficiency:
+// manually checked files are checked after FILEWATCH_DELAY_IN_MS, then
+// twice as long after each check without a change (up to FILEWATCH_MAX_DELAY_IN_MS)
+// and after FILEWATCH_MIN_DELAY_IN_MS again after a change
 #define FILEWATCH_DELAY_IN_MS 1000
+#define FILEWATCH_MIN_DELAY_IN_MS 500
+#define FILEWATCH_MAX_DELAY_IN_MS 8000
+// how long a file must remain unchanged before we notify about a change
+#define FILEWATCH_QUIESCENCE_IN_MS 300
+// notify anyway if a file is being written to for longer than that
+#define FILEWATCH_MAX_PENDING_IN_MS 10000
 
 // Some people use overlapped.hEvent to store data but I'm playing it safe.
 struct OverlappedEx {
@@ -84,6 +97,17 @@ struct WatchedFile {
     // file state for changes
     bool isManualCheck;
     FileState fileState;
+    // GetTickCount() of the last manual check and the time until the next one
+    DWORD lastCheck;
+    DWORD checkInterval;
+
+    // a change has been noticed but onFileChangedCb will only be called
+    // once the file has stopped changing (see RunPendingNotifications)
+    bool isPending;
+    // GetTickCount() of the first and the most recent noticed change
+    DWORD pendingStart;
+    DWORD pendingSince;
+    FileState pendingState;
 };
 
 static HANDLE g_threadHandle = 0;
@@ -112,9 +136,62 @@ static void GetFileState(const WCHAR* filePath, FileState* fs) {
     // but it's also updated when the file is being read from (e.g.
     // copy f.pdf f2.pdf will change lastAccessTime of f.pdf)
     // So I'm sticking with lastWriteTime
-    fs->time = file::GetModificationTime(filePath);
-    AutoFreeStr path = strconv::WstrToUtf8(filePath);
-    fs->size = file::GetSize(path.AsView());
+    // (a single query, as opposed to opening the file, which matters for network drives)
+    WIN32_FILE_ATTRIBUTE_DATA fileInfo;
+    if (!GetFileAttributesExW(filePath, GetFileExInfoStandard, &fileInfo)) {
+        fs->time = {};
+        fs->size = -1;
+        return;
+    }
+    fs->time = fileInfo.ftLastWriteTime;
+    fs->size = ((i64)fileInfo.nFileSizeHigh << 32) | fileInfo.nFileSizeLow;
+}
+
+// gets the state of several files in dirPath with as few directory queries as
+// possible. Returns false if that takes more queries than querying the files
+// one by one (i.e. if the directory contains many other files)
+static bool GetFileStatesInDir(const WCHAR* dirPath, Vec<WatchedFile*>& files, Vec<FileState>& states) {
+    HANDLE hDir = CreateFileW(dirPath, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (INVALID_HANDLE_VALUE == hDir) {
+        return false;
+    }
+
+    // files that aren't in the directory (anymore) have an invalid state
+    for (FileState& fs : states) {
+        fs.time = {};
+        fs.size = -1;
+    }
+    size_t nFound = 0;
+    bool isComplete = false;
+    // 64 KB is the maximum that is transferred in one go over SMB
+    AutoFree buf = AllocArray<char>(64 * 1024);
+    for (size_t nQueries = 0; nQueries < files.size() && !isComplete; nQueries++) {
+        auto infoClass = 0 == nQueries ? FileIdBothDirectoryRestartInfo : FileIdBothDirectoryInfo;
+        if (!GetFileInformationByHandleEx(hDir, infoClass, buf.Get(), 64 * 1024)) {
+            isComplete = GetLastError() == ERROR_NO_MORE_FILES;
+            break;
+        }
+        auto info = (FILE_ID_BOTH_DIR_INFO*)buf.Get();
+        for (;;) {
+            AutoFreeWstr fileName = str::DupN(info->FileName, info->FileNameLength / sizeof(WCHAR));
+            for (size_t i = 0; i < files.size(); i++) {
+                if (str::EqI(fileName, path::GetBaseNameNoFree(files.at(i)->filePath))) {
+                    states.at(i).time.dwLowDateTime = info->LastWriteTime.LowPart;
+                    states.at(i).time.dwHighDateTime = (DWORD)info->LastWriteTime.HighPart;
+                    states.at(i).size = info->EndOfFile.QuadPart;
+                    nFound++;
+                }
+            }
+            if (!info->NextEntryOffset) {
+                break;
+            }
+            info = (FILE_ID_BOTH_DIR_INFO*)((char*)info + info->NextEntryOffset);
+        }
+        isComplete = nFound == files.size();
+    }
+    CloseHandle(hDir);
+    return isComplete;
 }
 
 static bool FileStateEq(FileState* fs1, FileState* fs2) {
@@ -127,26 +204,47 @@ static bool FileStateEq(FileState* fs1, FileState* fs2) {
     return true;
 }
 
-static bool FileStateChanged(const WCHAR* filePath, FileState* fs) {
-    FileState fsTmp;
+static void ScheduleNotification(WatchedFile* wf);
 
-    GetFileState(filePath, &fsTmp);
-    if (FileStateEq(fs, &fsTmp)) {
-        return false;
+// the state of a manually checked file as determined by RunManualChecks
+static void UpdateManualCheck(WatchedFile* wf, FileState* fs, DWORD now) {
+    wf->lastCheck = now;
+    if (FileStateEq(&wf->fileState, fs)) {
+        wf->checkInterval = std::min(wf->checkInterval * 2, (DWORD)FILEWATCH_MAX_DELAY_IN_MS);
+        return;
     }
+    // logf(L"UpdateManualCheck() %s changed\n", wf->filePath);
+    wf->fileState = *fs;
+    wf->checkInterval = FILEWATCH_MIN_DELAY_IN_MS;
+    ScheduleNotification(wf);
+}
 
-    memcpy(fs, &fsTmp, sizeof(*fs));
-    return true;
+// returns true if another program (still) has the file open for writing
+static bool IsFileBeingWritten(const WCHAR* filePath) {
+    // fails with a sharing violation if there's a handle with write access
+    HANDLE h = CreateFileW(filePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (INVALID_HANDLE_VALUE == h) {
+        DWORD err = GetLastError();
+        return ERROR_SHARING_VIOLATION == err || ERROR_LOCK_VIOLATION == err;
+    }
+    CloseHandle(h);
+    return false;
+}
+
+// subsequent changes before the callback is called are coalesced into one
+static void ScheduleNotification(WatchedFile* wf) {
+    DWORD now = GetTickCount();
+    if (!wf->isPending) {
+        wf->pendingStart = now;
+    }
+    wf->isPending = true;
+    wf->pendingSince = now;
+    GetFileState(wf->filePath, &wf->pendingState);
 }
 
 // TODO: per internet, fileName could be short, 8.3 dos-style name
 // and we don't handle that. On the other hand, I've only seen references
 // to it wrt. to rename/delete operation, which we don't get notified about
-//
-// TODO: to collapse multiple notifications for the same file, could put it on a
-// queue, restart the thread with a timeout, restart the process if we
-// get notified again before timeout expires, call OnFileChanges() when
-// timeout expires
 static void NotifyAboutFile(WatchedDir* d, const WCHAR* fileName) {
     // logf(L"NotifyAboutFile(): %s", fileName);
 
@@ -164,7 +262,7 @@ static void NotifyAboutFile(WatchedDir* d, const WCHAR* fileName) {
         // because the time granularity is so big that this can cause genuine
         // file notifications to be ignored. (This happens for instance for
         // PDF files produced by pdftex from small.tex document)
-        wf->onFileChangedCb();
+        ScheduleNotification(wf);
     }
 }
 
@@ -264,25 +362,84 @@ static void StartMonitoringDirForChanges(WatchedDir* wd) {
 
 static DWORD GetTimeoutInMs() {
     ScopedCritSec cs(&g_threadCritSec);
+    DWORD timeout = INFINITE;
+    DWORD now = GetTickCount();
     for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
         if (wf->isManualCheck) {
-            return FILEWATCH_DELAY_IN_MS;
+            DWORD elapsed = now - wf->lastCheck;
+            DWORD left = elapsed < wf->checkInterval ? wf->checkInterval - elapsed : 0;
+            timeout = std::min(timeout, left);
+        }
+        if (wf->isPending) {
+            DWORD elapsed = now - wf->pendingSince;
+            DWORD left = elapsed < FILEWATCH_QUIESCENCE_IN_MS ? FILEWATCH_QUIESCENCE_IN_MS - elapsed : 0;
+            timeout = std::min(timeout, left);
         }
     }
-    return INFINITE;
+    return timeout;
 }
 
 static void RunManualChecks() {
     ScopedCritSec cs(&g_threadCritSec);
 
+    DWORD now = GetTickCount();
+    Vec<WatchedFile*> due;
     for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
-        if (!wf->isManualCheck) {
+        if (wf->isManualCheck && now - wf->lastCheck >= wf->checkInterval) {
+            due.Append(wf);
+        }
+    }
+
+    while (due.size() > 0) {
+        // check the other files in the same directory as well, as
+        // that doesn't take additional queries
+        AutoFreeWstr dirPath = path::GetDir(due.at(0)->filePath);
+        Vec<WatchedFile*> inDir;
+        for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
+            AutoFreeWstr dir = path::GetDir(wf->filePath);
+            if (wf->isManualCheck && str::EqI(dir, dirPath)) {
+                inDir.Append(wf);
+                due.Remove(wf);
+            }
+        }
+
+        Vec<FileState> states;
+        states.AppendBlanks(inDir.size());
+        if (inDir.size() == 1 || !GetFileStatesInDir(dirPath, inDir, states)) {
+            for (size_t i = 0; i < inDir.size(); i++) {
+                GetFileState(inDir.at(i)->filePath, &states.at(i));
+            }
+        }
+        for (size_t i = 0; i < inDir.size(); i++) {
+            UpdateManualCheck(inDir.at(i), &states.at(i), now);
+        }
+    }
+}
+
+// calls onFileChangedCb for pending files that haven't changed for a while
+static void RunPendingNotifications() {
+    ScopedCritSec cs(&g_threadCritSec);
+
+    DWORD now = GetTickCount();
+    for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
+        if (!wf->isPending || now - wf->pendingSince < FILEWATCH_QUIESCENCE_IN_MS) {
             continue;
         }
-        if (FileStateChanged(wf->filePath, &wf->fileState)) {
-            // logf(L"RunManualCheck() %s changed\n", wf->filePath);
-            wf->onFileChangedCb();
+        bool tooLong = now - wf->pendingStart >= FILEWATCH_MAX_PENDING_IN_MS;
+        FileState fs;
+        GetFileState(wf->filePath, &fs);
+        if (!tooLong && (!FileStateEq(&fs, &wf->pendingState) || IsFileBeingWritten(wf->filePath))) {
+            // still being written to, wait for another quiet period
+            wf->pendingSince = now;
+            wf->pendingState = fs;
+            continue;
+        }
+        wf->isPending = false;
+        if (wf->isManualCheck) {
+            wf->fileState = fs;
         }
+        // logf(L"RunPendingNotifications() %s changed\n", wf->filePath);
+        wf->onFileChangedCb();
     }
 }
 
@@ -293,11 +450,15 @@ static DWORD WINAPI FileWatcherThread(void* param) {
     BOOL alertable = TRUE;
 
     for (;;) {
+        // a steady stream of notifications for one file mustn't
+        // delay the checks and notifications for the others
+        RunManualChecks();
+        RunPendingNotifications();
+
         handles[0] = g_threadControlHandle;
         DWORD timeout = GetTimeoutInMs();
         DWORD obj = WaitForMultipleObjectsEx(1, handles, FALSE, timeout, alertable);
         if (WAIT_TIMEOUT == obj) {
-            RunManualChecks();
             continue;
         }
 
@@ -397,6 +558,8 @@ static WatchedFile* NewWatchedFile(const WCHAR* filePath, const std::function<vo
 
     if (wf->isManualCheck) {
         GetFileState(filePath, &wf->fileState);
+        wf->lastCheck = GetTickCount();
+        wf->checkInterval = FILEWATCH_DELAY_IN_MS;
         AwakeWatcherThread();
     } else {
         if (newDir) {
@@ -20,7 +20,8 @@ extern "C" {
 
 namespace fitz {
 
-static Gdiplus::Bitmap* ImageFromJpegData(fz_context* ctx, const u8* data, int len) {
+// l2factor > 0 decodes the image at 1/2, 1/4 or 1/8 of its size (using libjpeg's DCT scaling)
+static Gdiplus::Bitmap* ImageFromJpegData(fz_context* ctx, const u8* data, int len, int l2factor) {
     int w = 0, h = 0, xres = 0, yres = 0;
     fz_colorspace* cs = nullptr;
     fz_stream* stm = nullptr;
@@ -31,17 +32,24 @@ static Gdiplus::Bitmap* ImageFromJpegData(fz_context* ctx, const u8* data, int l
     fz_try(ctx) {
         fz_load_jpeg_info(ctx, data, len, &w, &h, &xres, &yres, &cs);
         stm = fz_open_memory(ctx, data, len);
-        stm = fz_open_dctd(ctx, stm, -1, 0, nullptr);
+        stm = fz_open_dctd(ctx, stm, -1, l2factor, nullptr);
     }
     fz_catch(ctx) {
         fz_drop_colorspace(ctx, cs);
         cs = nullptr;
     }
 
+    // same rounding as libjpeg's jdiv_round_up
+    w = (w + (1 << l2factor) - 1) >> l2factor;
+    h = (h + (1 << l2factor) - 1) >> l2factor;
+    xres >>= l2factor;
+    yres >>= l2factor;
+
+    // 32bpp bitmaps are drawn faster by GDI+ than 24bpp ones
     Gdiplus::PixelFormat fmt = fz_device_rgb(ctx) == cs
-                                   ? PixelFormat24bppRGB
+                                   ? PixelFormat32bppRGB
                                    : fz_device_gray(ctx) == cs
-                                         ? PixelFormat24bppRGB
+                                         ? PixelFormat32bppRGB
                                          : fz_device_cmyk(ctx) == cs ? PixelFormat32bppCMYK : PixelFormatUndefined;
     if (PixelFormatUndefined == fmt || w <= 0 || h <= 0 || !cs) {
         fz_drop_stream(ctx, stm);
@@ -65,24 +73,34 @@ static Gdiplus::Bitmap* ImageFromJpegData(fz_context* ctx, const u8* data, int l
     fz_var(bmpRect);
 
     fz_try(ctx) {
+        int n = cs->n;
+        size_t lineLen = (size_t)w * n;
         for (int y = 0; y < h; y++) {
             u8* line = (u8*)bmpData.Scan0 + y * bmpData.Stride;
-            for (int x = 0; x < w; x++) {
-                int read = fz_read(ctx, stm, line, cs->n);
-                if (read != cs->n) {
-                    fz_throw(ctx, FZ_ERROR_GENERIC, "insufficient data for image");
+            // read a whole line at once to the end of the 32bpp scanline, so that
+            // it can be expanded in place (without overwriting unread pixels)
+            u8* src = line + (size_t)w * 4 - lineLen;
+            size_t read = fz_read(ctx, stm, src, lineLen);
+            if (read != lineLen) {
+                fz_throw(ctx, FZ_ERROR_GENERIC, "insufficient data for image");
+            }
+            if (3 == n) { // RGB -> BGRX
+                for (int x = 0; x < w; x++, src += 3, line += 4) {
+                    u8 r = src[0], g = src[1], b = src[2];
+                    line[0] = b;
+                    line[1] = g;
+                    line[2] = r;
+                    line[3] = 0xFF;
+                }
+            } else if (1 == n) { // gray -> BGRX
+                for (int x = 0; x < w; x++, src++, line += 4) {
+                    u8 v = src[0];
+                    line[0] = line[1] = line[2] = v;
+                    line[3] = 0xFF;
                 }
-                if (3 == cs->n) { // RGB -> BGR
-                    std::swap(line[0], line[2]);
-                    line += 3;
-                } else if (1 == cs->n) { // gray -> BGR
-                    line[1] = line[2] = line[0];
-                    line += 3;
-                } else if (4 == cs->n) { // CMYK color inversion
-                    for (int k = 0; k < 4; k++) {
-                        line[k] = 255 - line[k];
-                    }
-                    line += 4;
+            } else if (4 == n) { // CMYK color inversion
+                for (size_t k = 0; k < lineLen; k++) {
+                    line[k] = 255 - line[k];
                 }
             }
         }
@@ -201,7 +219,7 @@ Gdiplus::Bitmap* ImageFromData(std::span<u8> d) {
 
     Gdiplus::Bitmap* result = nullptr;
     if (str::StartsWith(data, "\xFF\xD8")) {
-        result = ImageFromJpegData(ctx, data, (int)len);
+        result = ImageFromJpegData(ctx, data, (int)len, 0);
     } else if (memeq(data, "\0\0\0\x0CjP  \x0D\x0A\x87\x0A", 12)) {
         result = ImageFromJp2Data(ctx, data, (int)len);
     }
@@ -211,6 +229,23 @@ Gdiplus::Bitmap* ImageFromData(std::span<u8> d) {
     return result;
 }
 
+Gdiplus::Bitmap* ReducedImageFromJpegData(std::span<u8> d, int l2factor) {
+    const u8* data = (const u8*)d.data();
+    size_t len = d.size();
+    if (len > INT_MAX || len < 12 || !str::StartsWith(data, "\xFF\xD8")) {
+        return nullptr;
+    }
+    CrashIf(l2factor < 0 || l2factor > 3);
+
+    fz_context* ctx = fz_new_context(nullptr, nullptr, 0);
+    if (!ctx) {
+        return nullptr;
+    }
+    Gdiplus::Bitmap* result = ImageFromJpegData(ctx, data, (int)len, l2factor);
+    fz_drop_context(ctx);
+    return result;
+}
+
 } // namespace fitz
 
 #else
@@ -219,6 +254,9 @@ namespace fitz {
 Gdiplus::Bitmap* ImageFromData(std::span<u8>) {
     return nullptr;
 }
+Gdiplus::Bitmap* ReducedImageFromJpegData(std::span<u8>, int) {
+    return nullptr;
+}
 } // namespace fitz
 
 #endif
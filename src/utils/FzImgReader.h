@@ -4,4 +4,6 @@
 namespace fitz {
 
 Gdiplus::Bitmap* ImageFromData(std::span<u8>);
+// decodes a JPEG image at 1/2^l2factor of its size (l2factor from 0 to 3)
+Gdiplus::Bitmap* ReducedImageFromJpegData(std::span<u8>, int l2factor);
 }
@@ -462,8 +462,78 @@ Bitmap* BitmapFromData(std::span<u8> bmpData) {
     return bmp;
 }
 
+// decodes an image at 1/2^l2factor of its size, which is much faster than decoding
+// and then scaling it down. returns nullptr for formats that don't support this
+// (currently only JPEG does)
+Bitmap* BitmapFromDataReduced(std::span<u8> bmpData, int l2factor) {
+    if (l2factor <= 0 || GfxFormatFromData(bmpData) != ImgFormat::JPEG) {
+        return nullptr;
+    }
+    return fitz::ReducedImageFromJpegData(bmpData, std::min(l2factor, 3));
+}
+
+// reads the image size from the TIFF (or JPEG XR) IFD at offset idx
+// returns the offset of the next IFD (0 if there's none or it can't be determined)
+static size_t TiffIfdSize(const ByteReader& r, size_t idx, bool isBE, bool isJXR, Size& result) {
+    size_t len = r.len;
+    const WORD WIDTH = isJXR ? 0xBC80 : 0x0100, HEIGHT = isJXR ? 0xBC81 : 0x0101;
+    if (idx > len - 2) {
+        return 0;
+    }
+    WORD count = r.Word(idx, isBE);
+    for (idx += 2; count > 0 && idx <= len - 12; count--, idx += 12) {
+        WORD tag = r.Word(idx, isBE), type = r.Word(idx + 2, isBE);
+        if (r.DWord(idx + 4, isBE) != 1) {
+            continue;
+        } else if (WIDTH == tag && 4 == type) {
+            result.dx = r.DWord(idx + 8, isBE);
+        } else if (WIDTH == tag && 3 == type) {
+            result.dx = r.Word(idx + 8, isBE);
+        } else if (WIDTH == tag && 1 == type) {
+            result.dx = r.Byte(idx + 8);
+        } else if (HEIGHT == tag && 4 == type) {
+            result.dy = r.DWord(idx + 8, isBE);
+        } else if (HEIGHT == tag && 3 == type) {
+            result.dy = r.Word(idx + 8, isBE);
+        } else if (HEIGHT == tag && 1 == type) {
+            result.dy = r.Byte(idx + 8);
+        }
+    }
+    if (count > 0 || idx > len - 4) {
+        return 0;
+    }
+    return r.DWord(idx, isBE);
+}
+
+// reads the sizes of the first nPages pages of a multi-page TIFF image from its
+// chain of IFDs, i.e. without decoding any of them. returns false if any size
+// couldn't be determined (or there are fewer pages)
+bool TiffPageSizesFromData(std::span<u8> d, int nPages, Vec<Size>& sizes) {
+    if (d.size() < 10 || GfxFormatFromData(d) != ImgFormat::TIFF) {
+        return false;
+    }
+    ByteReader r(d);
+    bool isBE = r.Byte(0) == 'M', isJXR = r.Byte(2) == 0xBC;
+    if (isJXR) {
+        return false;
+    }
+    size_t idx = r.DWord(4, isBE);
+    // (also stops reading IFD chains that loop)
+    while (idx != 0 && sizes.isize() < nPages) {
+        Size size;
+        idx = TiffIfdSize(r, idx, isBE, false, size);
+        if (size.IsEmpty()) {
+            return false;
+        }
+        sizes.Append(size);
+    }
+    return sizes.isize() == nPages;
+}
+
 // adapted from http://cpansearch.perl.org/src/RJRAY/Image-Size-3.230/lib/Image/Size.pm
-Size BitmapSizeFromData(std::span<u8> d) {
+// d may be just the beginning of the image (for most images, the first few KB
+// contain the size); returns an empty size if it couldn't be found there
+Size BitmapSizeFromHeader(std::span<u8> d) {
     Size result;
     ByteReader r(d);
     size_t len = d.size();
@@ -525,27 +595,7 @@ Size BitmapSizeFromData(std::span<u8> d) {
             if (len >= 10) {
                 bool isBE = r.Byte(0) == 'M', isJXR = r.Byte(2) == 0xBC;
                 CrashIf(!isBE && r.Byte(0) != 'I' || isJXR && isBE);
-                const WORD WIDTH = isJXR ? 0xBC80 : 0x0100, HEIGHT = isJXR ? 0xBC81 : 0x0101;
-                size_t idx = r.DWord(4, isBE);
-                WORD count = idx <= len - 2 ? r.Word(idx, isBE) : 0;
-                for (idx += 2; count > 0 && idx <= len - 12; count--, idx += 12) {
-                    WORD tag = r.Word(idx, isBE), type = r.Word(idx + 2, isBE);
-                    if (r.DWord(idx + 4, isBE) != 1) {
-                        continue;
-                    } else if (WIDTH == tag && 4 == type) {
-                        result.dx = r.DWord(idx + 8, isBE);
-                    } else if (WIDTH == tag && 3 == type) {
-                        result.dx = r.Word(idx + 8, isBE);
-                    } else if (WIDTH == tag && 1 == type) {
-                        result.dx = r.Byte(idx + 8);
-                    } else if (HEIGHT == tag && 4 == type) {
-                        result.dy = r.DWord(idx + 8, isBE);
-                    } else if (HEIGHT == tag && 3 == type) {
-                        result.dy = r.Word(idx + 8, isBE);
-                    } else if (HEIGHT == tag && 1 == type) {
-                        result.dy = r.Byte(idx + 8);
-                    }
-                }
+                TiffIfdSize(r, r.DWord(4, isBE), isBE, isJXR, result);
             }
             break;
         case ImgFormat::PNG:
@@ -590,7 +640,11 @@ Size BitmapSizeFromData(std::span<u8> d) {
             }
             break;
     }
+    return result;
+}
 
+Size BitmapSizeFromData(std::span<u8> d) {
+    Size result = BitmapSizeFromHeader(d);
     if (result.IsEmpty()) {
         // let GDI+ extract the image size if we've failed
         // (currently happens for animated GIF)
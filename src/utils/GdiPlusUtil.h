@@ -35,6 +35,9 @@ void GetBaseTransform(Gdiplus::Matrix& m, Gdiplus::RectF pageRect, float zoom, i
 const WCHAR* GfxFileExtFromData(std::span<u8>);
 bool IsGdiPlusNativeFormat(std::span<u8>);
 Gdiplus::Bitmap* BitmapFromData(std::span<u8>);
+Gdiplus::Bitmap* BitmapFromDataReduced(std::span<u8>, int l2factor);
+Size BitmapSizeFromHeader(std::span<u8>);
+bool TiffPageSizesFromData(std::span<u8>, int nPages, Vec<Size>& sizes);
 Size BitmapSizeFromData(std::span<u8>);
 CLSID GetEncoderClsid(const WCHAR* format);
 
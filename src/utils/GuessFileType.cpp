@@ -274,11 +274,7 @@ Kind GuessFileTypeFromContent(std::span<u8> d) {
     return nullptr;
 }
 
-static bool IsEpubFile(const WCHAR* path) {
-    AutoDelete<MultiFormatArchive> archive = OpenZipArchive(path, true);
-    if (!archive.Get()) {
-        return false;
-    }
+static bool IsEpubArchive(MultiFormatArchive* archive) {
     AutoFree mimetype(archive->GetFileDataByName("mimetype"));
     if (!mimetype.data) {
         return false;
@@ -304,24 +300,23 @@ static bool IsEpubFile(const WCHAR* path) {
     return str::Eq(mimetype.data, "application/x-ibooks+zip");
 }
 
-// check if a given file is a likely a .zip archive containing XPS
-// document
-static bool IsXpsArchive(const WCHAR* path) {
-    MultiFormatArchive* archive = OpenZipArchive(path, true);
-    if (!archive) {
-        return false;
-    }
-
-    bool res = archive->GetFileId("_rels/.rels") != (size_t)-1 ||
-               archive->GetFileId("_rels/.rels/[0].piece") != (size_t)-1 ||
-               archive->GetFileId("_rels/.rels/[0].last.piece") != (size_t)-1;
-    delete archive;
-    return res;
+// check if a given .zip archive likely contains an XPS document
+static bool IsXpsArchive(MultiFormatArchive* archive) {
+    return archive->GetFileId("_rels/.rels") != (size_t)-1 ||
+           archive->GetFileId("_rels/.rels/[0].piece") != (size_t)-1 ||
+           archive->GetFileId("_rels/.rels/[0].last.piece") != (size_t)-1;
 }
 
 // detect file type based on file content
 Kind GuessFileTypeFromContent(const WCHAR* path) {
+    return GuessFileTypeFromContent(path, nullptr);
+}
+
+Kind GuessFileTypeFromContent(const WCHAR* path, MultiFormatArchive** zipArchiveOut) {
     CrashIf(!path);
+    if (zipArchiveOut) {
+        *zipArchiveOut = nullptr;
+    }
 
     if (path::IsDirectory(path)) {
         AutoFreeWstr mimetypePath(path::Join(path, L"mimetype"));
@@ -339,14 +334,25 @@ Kind GuessFileTypeFromContent(const WCHAR* path) {
         return nullptr;
     }
     auto res = GuessFileTypeFromContent({(u8*)buf, (size_t)n});
-    if (res == kindFileZip) {
-        if (IsXpsArchive(path)) {
-            res = kindFileXps;
-        }
-        if (IsEpubFile(path)) {
-            res = kindFileEpub;
-        }
+    if (res != kindFileZip) {
+        return res;
+    }
+    // the archive is only opened once for all checks (and then possibly handed over for loading)
+    MultiFormatArchive* archive = OpenZipArchive(path, false);
+    if (!archive) {
+        return res;
     }
+    if (IsXpsArchive(archive)) {
+        res = kindFileXps;
+    }
+    if (IsEpubArchive(archive)) {
+        res = kindFileEpub;
+    }
+    if (zipArchiveOut && res == kindFileZip) {
+        *zipArchiveOut = archive;
+        return res;
+    }
+    delete archive;
     return res;
 }
 
@@ -2,6 +2,8 @@
 /* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
    License: Simplified BSD (see COPYING.BSD) */
 
+class MultiFormatArchive;
+
 extern Kind kindFilePDF;
 extern Kind kindFilePS;
 extern Kind kindFileXps;
@@ -42,6 +44,9 @@ extern Kind kindFileDir;
 const WCHAR* FindEmbeddedPdfFileStreamNo(const WCHAR* path);
 
 Kind GuessFileTypeFromContent(const WCHAR* path);
+// for plain .zip files, zipArchiveOut receives the archive opened for sniffing
+// so that it doesn't have to be opened again for loading
+Kind GuessFileTypeFromContent(const WCHAR* path, MultiFormatArchive** zipArchiveOut);
 Kind GuessFileTypeFromContent(std::span<u8> d);
 Kind GuessFileTypeFromName(const WCHAR*);
 Kind GuessFileType(const WCHAR* path, bool fromContent);
@@ -2,6 +2,12 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "BaseUtil.h"
+#if defined(_M_IX86) || defined(_M_X64)
+// SSE2 is available on all processors we support
+#include <intrin.h>
+#include <emmintrin.h>
+#define HAS_SSE2 1
+#endif
 #include "HtmlParserLookup.h"
 #include "HtmlPullParser.h"
 
@@ -31,7 +37,37 @@ int HtmlEntityNameToRune(const WCHAR* name, size_t nameLen) {
     return FindHtmlEntityRune(asciiName, nameLen);
 }
 
+#if defined(HAS_SSE2)
+static inline uint FirstSetBit(uint mask) {
+    unsigned long bit;
+    _BitScanForward(&bit, mask);
+    return (uint)bit;
+}
+
+// returns a mask with bit i set if s[i] is whitespace (as in str::IsWs) for 0 <= i < 16
+static inline uint WsMask(const char* s) {
+    __m128i v = _mm_loadu_si128((const __m128i*)s);
+    // bytes >= 0x80 are negative and thus not in the range '\t' to '\r'
+    __m128i isCtrlWs =
+        _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1)));
+    __m128i isSpace = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    return (uint)_mm_movemask_epi8(_mm_or_si128(isCtrlWs, isSpace));
+}
+#endif
+
+// SkipUntil (for a single char), SkipWs and SkipNonWs check 16 chars at a time,
+// as the text and attribute values they skip over tend to be long
 bool SkipUntil(const char*& s, const char* end, char c) {
+#if defined(HAS_SSE2)
+    __m128i toFind = _mm_set1_epi8(c);
+    for (; s + 16 <= end; s += 16) {
+        uint mask = (uint)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)s), toFind));
+        if (mask != 0) {
+            s += FirstSetBit(mask);
+            return true;
+        }
+    }
+#endif
     while ((s < end) && (*s != c)) {
         ++s;
     }
@@ -51,6 +87,15 @@ bool SkipUntil(const char*& s, const char* end, const char* term) {
 // return true if skipped
 bool SkipWs(const char*& s, const char* end) {
     const char* start = s;
+#if defined(HAS_SSE2)
+    for (; s + 16 <= end; s += 16) {
+        uint mask = ~WsMask(s) & 0xffff;
+        if (mask != 0) {
+            s += FirstSetBit(mask);
+            return start != s;
+        }
+    }
+#endif
     while ((s < end) && str::IsWs(*s)) {
         ++s;
     }
@@ -60,6 +105,15 @@ bool SkipWs(const char*& s, const char* end) {
 // return true if skipped
 bool SkipNonWs(const char*& s, const char* end) {
     const char* start = s;
+#if defined(HAS_SSE2)
+    for (; s + 16 <= end; s += 16) {
+        uint mask = WsMask(s);
+        if (mask != 0) {
+            s += FirstSetBit(mask);
+            return start != s;
+        }
+    }
+#endif
     while ((s < end) && !str::IsWs(*s)) {
         ++s;
     }
@@ -101,13 +155,17 @@ void MemAppend(char*& dst, const char* s, size_t len) {
 // (4 in case of "foo;")
 // returns a pointer to the first character after the entity
 const char* ResolveHtmlEntity(const char* s, size_t len, int& rune) {
-    const char* entEnd = str::Parse(s, len, "#%d%?;", &rune);
-    if (entEnd) {
-        return entEnd;
-    }
-    entEnd = str::Parse(s, len, "#x%x%?;", &rune);
-    if (entEnd) {
-        return entEnd;
+    const char* entEnd;
+    // most entities are named ones, for which str::Parse doesn't have to be tried
+    if (len > 0 && '#' == *s) {
+        entEnd = str::Parse(s, len, "#%d%?;", &rune);
+        if (entEnd) {
+            return entEnd;
+        }
+        entEnd = str::Parse(s, len, "#x%x%?;", &rune);
+        if (entEnd) {
+            return entEnd;
+        }
     }
 
     // go to the end of a potential named entity
@@ -248,4 +248,19 @@ bool Parse(const char* data, ValueVisitor* visitor) {
     return args.canceled || !*SkipWS(end);
 }
 
+void AppendQuoted(str::Str& out, const char* s) {
+    out.AppendChar('"');
+    for (const char* c = s; c && *c; c++) {
+        if ('"' == *c || '\\' == *c) {
+            out.AppendChar('\\');
+            out.AppendChar(*c);
+        } else if ((u8)*c < 0x20) {
+            out.AppendFmt("\\u%04x", (u8)*c);
+        } else {
+            out.AppendChar(*c);
+        }
+    }
+    out.AppendChar('"');
+}
+
 } // namespace json
@@ -28,4 +28,7 @@ class ValueVisitor {
 // returns false on error
 bool Parse(const char* data, ValueVisitor* visitor);
 
+// appends s (UTF-8) as a quoted JSON string
+void AppendQuoted(str::Str& out, const char* s);
+
 } // namespace json
@@ -4,62 +4,206 @@
 #include "utils/BaseUtil.h"
 #include "utils/ThreadUtil.h"
 
+// Messages are appended to a lock-free ring buffer by the logging threads and
+// written out (to the in-memory history, the log file, stderr and the debugger)
+// by a background thread, so that logging doesn't block e.g. the rendering threads
+// on file i/o. The ring buffer is drained synchronously only when it's full.
+
+// protects everything written by DrainLogRing()
 Mutex gLogMutex;
 
 // we use HeapAllocator because we can do logging during crash handling
 // where we want to avoid allocator deadlocks by calling malloc()
 HeapAllocator* gLogAllocator = nullptr;
 
+// the most recent messages (at most kMaxLogHistory bytes)
 str::Str* gLogBuf = nullptr;
 bool logToStderr = false;
 bool logToDebugger = false;
 
-static char* logFilePath;
+static FILE* gLogFile = nullptr;
+static bool gLogDestroyed = false;
 
 // 1 MB - 128 to stay under 1 MB even after appending (an estimate)
-constexpr int kMaxLogBuf = 1024 * 1024 - 128;
+constexpr int kMaxLogHistory = 1024 * 1024 - 128;
 
-static bool shouldLog() {
-    gLogMutex.Lock();
-    bool bufFull = gLogBuf && gLogBuf->isize() > kMaxLogBuf;
-    gLogMutex.Unlock();
-    return !bufFull;
+// must be a power of 2
+constexpr u32 kLogRingSize = 256 * 1024;
+constexpr u32 kMaxLogRecord = kLogRingSize / 8;
+constexpr DWORD kLogFlushIntervalMs = 100;
+
+// followed by the message, padded to a multiple of 8 bytes
+// (so that a header never wraps around the end of the ring)
+struct LogRecord {
+    u32 size;
+    // set once the message has been copied
+    LONG ready;
+};
+
+static char gLogRing[kLogRingSize];
+// positions only ever grow (and wrap around at 4 GB), records are at pos % kLogRingSize
+static LONG gLogWritePos = 0;
+static LONG gLogReadPos = 0;
+static LONG gLogDropped = 0;
+
+static LONG gLogFlusherState = 0; // 0: not started, 1: running, 2: failed to start
+static HANDLE gLogFlushEvent = nullptr;
+
+static u32 LogRecordSize(u32 msgSize) {
+    return (u32)sizeof(LogRecord) + (u32)RoundUp((size_t)msgSize, 8);
 }
 
-void log(std::string_view s) {
-    if (!shouldLog()) {
+// must be called with gLogMutex locked
+static void AppendToHistory(std::string_view s) {
+    if (!gLogBuf) {
+        gLogBuf = new str::Str(32 * 1024, gLogAllocator);
+    }
+    gLogBuf->AppendView(s);
+    int excess = gLogBuf->isize() - kMaxLogHistory;
+    if (excess <= 0) {
         return;
     }
+    // drop the oldest messages (up to a line end, so that no partial line remains)
+    const char* start = gLogBuf->Get();
+    const char* end = str::FindChar(start + excess, '\n');
+    size_t n = end ? end - start + 1 : gLogBuf->size();
+    gLogBuf->RemoveAt(0, n);
+}
 
-    gLogMutex.Lock();
+// moves all complete records from the ring to their destinations
+// must be called with gLogMutex locked
+static void DrainLogRing() {
+    u32 r = (u32)gLogReadPos;
+    u32 w = (u32)InterlockedAdd(&gLogWritePos, 0);
+    if (!gLogAllocator && !gLogDestroyed) {
+        gLogAllocator = new HeapAllocator();
+    }
+    str::Str out(4096, gLogAllocator);
+    while (r != w) {
+        LogRecord* rec = (LogRecord*)(gLogRing + (r & (kLogRingSize - 1)));
+        if (InterlockedAdd(&rec->ready, 0) == 0) {
+            // still being written, the remaining records will be drained next time
+            break;
+        }
+        u32 msgPos = (r + (u32)sizeof(LogRecord)) & (kLogRingSize - 1);
+        u32 n1 = std::min(rec->size, kLogRingSize - msgPos);
+        out.Append(gLogRing + msgPos, n1);
+        out.Append(gLogRing, rec->size - n1);
 
-    gAllowAllocFailure++;
-    defer {
-        gAllowAllocFailure--;
-    };
+        // clear the record, as a later header might be written where its message was
+        u32 recSize = LogRecordSize(rec->size);
+        u32 recPos = r & (kLogRingSize - 1);
+        u32 c1 = std::min(recSize, kLogRingSize - recPos);
+        ZeroMemory(gLogRing + recPos, c1);
+        ZeroMemory(gLogRing, recSize - c1);
+        r += recSize;
+    }
+    InterlockedExchange(&gLogReadPos, (LONG)r);
 
-    if (!gLogBuf) {
-        gLogAllocator = new HeapAllocator();
-        gLogBuf = new str::Str(32 * 1024, gLogAllocator);
+    LONG dropped = InterlockedExchange(&gLogDropped, 0);
+    if (dropped > 0) {
+        out.AppendFmt("(%d log messages dropped)\n", (int)dropped);
+    }
+    if (out.size() == 0 || gLogDestroyed) {
+        return;
     }
-    gLogBuf->Append(s.data(), s.size());
+
+    AppendToHistory(out.AsView());
     if (logToStderr) {
-        fwrite(s.data(), 1, s.size(), stderr);
+        fwrite(out.Get(), 1, out.size(), stderr);
         fflush(stderr);
     }
+    if (gLogFile) {
+        fwrite(out.Get(), 1, out.size(), gLogFile);
+        fflush(gLogFile);
+    }
+    if (logToDebugger) {
+        OutputDebugStringA(out.Get());
+    }
+}
+
+static DWORD WINAPI LogFlusherThread(void*) {
+    SetThreadName(GetCurrentThreadId(), "LogFlusher");
+    for (;;) {
+        WaitForSingleObject(gLogFlushEvent, kLogFlushIntervalMs);
+        FlushLog();
+    }
+}
+
+static void StartLogFlusher() {
+    if (InterlockedCompareExchange(&gLogFlusherState, 1, 0) != 0) {
+        return;
+    }
+    gLogFlushEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    HANDLE h = gLogFlushEvent ? CreateThread(nullptr, 0, LogFlusherThread, nullptr, 0, nullptr) : nullptr;
+    if (!h) {
+        InterlockedExchange(&gLogFlusherState, 2);
+        return;
+    }
+    CloseHandle(h);
+}
 
-    if (logFilePath) {
-        auto f = fopen(logFilePath, "a");
-        if (f != nullptr) {
-            fwrite(s.data(), 1, s.size(), f);
-            fflush(f);
-            fclose(f);
+// returns false if there's no space left in the ring
+static bool PushLogRecord(std::string_view s) {
+    u32 size = (u32)std::min(s.size(), (size_t)kMaxLogRecord);
+    u32 recSize = LogRecordSize(size);
+    u32 w;
+    for (;;) {
+        w = (u32)InterlockedAdd(&gLogWritePos, 0);
+        u32 r = (u32)InterlockedAdd(&gLogReadPos, 0);
+        if (w - r + recSize > kLogRingSize) {
+            return false;
+        }
+        if ((u32)InterlockedCompareExchange(&gLogWritePos, (LONG)(w + recSize), (LONG)w) == w) {
+            break;
         }
     }
-    if (logToDebugger) {
-        OutputDebugStringA(s.data());
+
+    LogRecord* rec = (LogRecord*)(gLogRing + (w & (kLogRingSize - 1)));
+    rec->size = size;
+    u32 msgPos = (w + (u32)sizeof(LogRecord)) & (kLogRingSize - 1);
+    u32 n1 = std::min(size, kLogRingSize - msgPos);
+    memcpy(gLogRing + msgPos, s.data(), n1);
+    memcpy(gLogRing, s.data() + n1, size - n1);
+    // publishes the message (InterlockedExchange is a full memory barrier)
+    InterlockedExchange(&rec->ready, 1);
+
+    if (w - (u32)gLogReadPos + recSize > kLogRingSize / 2 && gLogFlushEvent) {
+        SetEvent(gLogFlushEvent);
     }
-    gLogMutex.Unlock();
+    return true;
+}
+
+void log(std::string_view s) {
+    if (s.empty()) {
+        return;
+    }
+    StartLogFlusher();
+
+    gAllowAllocFailure++;
+    defer {
+        gAllowAllocFailure--;
+    };
+
+    if (PushLogRecord(s)) {
+        if (gLogFlusherState == 2) {
+            FlushLog();
+        }
+        return;
+    }
+    // the ring is full: drain it on this thread, unless another thread is doing that already
+    if (TryEnterCriticalSection(&gLogMutex.cs)) {
+        DrainLogRing();
+        bool ok = PushLogRecord(s);
+        if (ok) {
+            DrainLogRing();
+        }
+        gLogMutex.Unlock();
+        if (ok) {
+            return;
+        }
+    }
+    InterlockedIncrement(&gLogDropped);
 }
 
 void log(const char* s) {
@@ -68,9 +212,6 @@ void log(const char* s) {
 }
 
 void logf(const char* fmt, ...) {
-    if (!shouldLog()) {
-        return;
-    }
     va_list args;
     va_start(args, fmt);
     AutoFree s = str::FmtV(fmt, args);
@@ -78,9 +219,33 @@ void logf(const char* fmt, ...) {
     va_end(args);
 }
 
+void FlushLog() {
+    gLogMutex.Lock();
+    DrainLogRing();
+    gLogMutex.Unlock();
+}
+
 void StartLogToFile(const char* path) {
-    logFilePath = str::Dup(path);
+    gLogMutex.Lock();
+    DrainLogRing();
     remove(path);
+    gLogFile = fopen(path, "a");
+    gLogMutex.Unlock();
+}
+
+void DestroyLog() {
+    gLogMutex.Lock();
+    DrainLogRing();
+    gLogDestroyed = true;
+    if (gLogFile) {
+        fclose(gLogFile);
+        gLogFile = nullptr;
+    }
+    delete gLogBuf;
+    gLogBuf = nullptr;
+    delete gLogAllocator;
+    gLogAllocator = nullptr;
+    gLogMutex.Unlock();
 }
 
 #if OS_WIN
@@ -88,18 +253,12 @@ void log(const WCHAR* s) {
     if (!s) {
         return;
     }
-    if (!shouldLog()) {
-        return;
-    }
     AutoFree tmp = strconv::WstrToUtf8(s);
     auto sv = tmp.AsView();
     log(sv);
 }
 
 void logf(const WCHAR* fmt, ...) {
-    if (!shouldLog()) {
-        return;
-    }
     va_list args;
     va_start(args, fmt);
     AutoFreeWstr s = str::FmtV(fmt, args);
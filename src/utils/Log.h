@@ -2,10 +2,16 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 extern HeapAllocator* gLogAllocator;
+// the most recent log messages (call FlushLog() before accessing it)
 extern str::Str* gLogBuf;
 extern bool logToStderr;
 extern bool logToDebugger;
 void StartLogToFile(const char* path);
+// messages are written out on a background thread,
+// this writes out all messages logged so far
+void FlushLog();
+// call at the end of the program
+void DestroyLog();
 
 void log(std::string_view s);
 void log(const char* s);
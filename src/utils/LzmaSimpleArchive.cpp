@@ -70,6 +70,9 @@ u32 lzma_crc32(u32 crc32, const u8* data, size_t data_len) {
 #define LZMA_HEADER_SIZE (1 + LZMA_PROPS_SIZE)
 
 // the first compressed byte indicates whether compression is LZMA (0), LZMA+BJC (1) or none (-1)
+// or whether the data is split into chunks (2, see ParseSimpleArchive) which are compressed
+// the same way (each of them starting with its own compression method byte)
+#define COMPRESSION_CHUNKED 2
 static bool Decompress(const u8* compressed, size_t compressedSize, u8* uncompressed, size_t uncompressedSize,
                        Allocator* allocator) {
     if (compressedSize < 1) {
@@ -132,6 +135,16 @@ u32   crc32 checksum of the header (i.e. data so far)
 for each file:
   compressed file data (for each file, the first byte indicates the compression method)
 
+Big files are split into chunks which are compressed independently so that
+they can be decompressed in parallel. Their compressed data is:
+u8    2 (compression method)
+u32   number of chunks
+for each chunk:
+  u32        chunk size compressed
+  u32        chunk size uncompressed
+for each chunk:
+  compressed chunk data (the first byte indicates the compression method)
+
 Integers are little-endian.
 */
 
@@ -222,6 +235,64 @@ int GetIdxFromName(SimpleArchive* archive, const char* fileName) {
     return -1;
 }
 
+// magic byte + number of chunks
+#define CHUNKED_HEADER_SIZE (1 + 4)
+// compressed + uncompressed size
+#define CHUNK_ENTRY_SIZE (4 + 4)
+
+bool GetFileChunks(FileInfo* fi, Vec<ChunkInfo>& chunksOut) {
+    const u8* data = fi->compressedData;
+    size_t dataLen = fi->compressedSize;
+    if (dataLen < 1) {
+        return false;
+    }
+    if (data[0] != COMPRESSION_CHUNKED) {
+        ChunkInfo chunk = {fi->compressedSize, fi->uncompressedSize, 0, data};
+        chunksOut.Append(chunk);
+        return true;
+    }
+
+    if (dataLen < CHUNKED_HEADER_SIZE) {
+        return false;
+    }
+    ByteOrderDecoder br(data + 1, dataLen - 1, ByteOrderDecoder::LittleEndian);
+    u32 chunksCount = br.UInt32();
+    if (chunksCount > (dataLen - CHUNKED_HEADER_SIZE) / CHUNK_ENTRY_SIZE) {
+        return false;
+    }
+    size_t compressedOffset = CHUNKED_HEADER_SIZE + chunksCount * CHUNK_ENTRY_SIZE;
+    size_t uncompressedOffset = 0;
+    for (u32 i = 0; i < chunksCount; i++) {
+        ChunkInfo chunk;
+        chunk.compressedSize = br.UInt32();
+        chunk.uncompressedSize = br.UInt32();
+        // overflow checks
+        if (chunk.compressedSize > dataLen - compressedOffset) {
+            return false;
+        }
+        if (chunk.uncompressedSize > fi->uncompressedSize - uncompressedOffset) {
+            return false;
+        }
+        chunk.compressedData = data + compressedOffset;
+        chunk.uncompressedOffset = (u32)uncompressedOffset;
+        chunksOut.Append(chunk);
+        compressedOffset += chunk.compressedSize;
+        uncompressedOffset += chunk.uncompressedSize;
+    }
+
+    return compressedOffset == dataLen && uncompressedOffset == fi->uncompressedSize;
+}
+
+bool DecompressChunk(const ChunkInfo* chunk, u8* uncompressed, Allocator* allocator) {
+    return Decompress(chunk->compressedData, chunk->compressedSize, uncompressed + chunk->uncompressedOffset,
+                      chunk->uncompressedSize, allocator);
+}
+
+bool VerifyFileData(FileInfo* fi, const u8* uncompressed) {
+    u32 realCrc = lzma_crc32(0, uncompressed, fi->uncompressedSize);
+    return realCrc == fi->uncompressedCrc32;
+}
+
 u8* GetFileDataByIdx(SimpleArchive* archive, int idx, Allocator* allocator) {
     if (idx >= archive->filesCount) {
         return nullptr;
@@ -229,19 +300,21 @@ u8* GetFileDataByIdx(SimpleArchive* archive, int idx, Allocator* allocator) {
 
     FileInfo* fi = &archive->files[idx];
 
-    u8* uncompressed = (u8*)Allocator::Alloc(allocator, fi->uncompressedSize);
-    if (!uncompressed) {
+    Vec<ChunkInfo> chunks;
+    if (!GetFileChunks(fi, chunks)) {
         return nullptr;
     }
 
-    bool ok = Decompress(fi->compressedData, fi->compressedSize, uncompressed, fi->uncompressedSize, allocator);
-    if (!ok) {
-        Allocator::Free(allocator, uncompressed);
+    u8* uncompressed = (u8*)Allocator::Alloc(allocator, fi->uncompressedSize);
+    if (!uncompressed) {
         return nullptr;
     }
 
-    u32 realCrc = lzma_crc32(0, (const u8*)uncompressed, fi->uncompressedSize);
-    if (realCrc != fi->uncompressedCrc32) {
+    bool ok = true;
+    for (ChunkInfo& chunk : chunks) {
+        ok = ok && DecompressChunk(&chunk, uncompressed, allocator);
+    }
+    if (!ok || !VerifyFileData(fi, uncompressed)) {
         Allocator::Free(allocator, uncompressed);
         return nullptr;
     }
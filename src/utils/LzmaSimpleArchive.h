@@ -13,6 +13,16 @@ struct FileInfo {
     const u8* compressedData;
 };
 
+// the data of big files is split into independently compressed chunks
+// which can be decompressed in parallel
+struct ChunkInfo {
+    u32 compressedSize;
+    u32 uncompressedSize;
+    // where the chunk's data starts within the file's uncompressed data
+    u32 uncompressedOffset;
+    const u8* compressedData;
+};
+
 // Note: good enough for our purposes, can be expanded when needed
 #define MAX_LZMA_ARCHIVE_FILES 128
 
@@ -25,6 +35,12 @@ bool ParseSimpleArchive(const u8* archiveHeader, size_t dataLen, SimpleArchive*
 int GetIdxFromName(SimpleArchive* archive, const char* name);
 u8* GetFileDataByIdx(SimpleArchive* archive, int idx, Allocator* allocator);
 u8* GetFileDataByName(SimpleArchive* archive, const char* fileName, Allocator* allocator);
+// a file that isn't split is a single chunk
+bool GetFileChunks(FileInfo* fi, Vec<ChunkInfo>& chunksOut);
+// decompresses a chunk into its part of uncompressed, which must be fi->uncompressedSize bytes big
+bool DecompressChunk(const ChunkInfo* chunk, u8* uncompressed, Allocator* allocator);
+// to be called once all chunks have been decompressed
+bool VerifyFileData(FileInfo* fi, const u8* uncompressed);
 // files is an array of char * entries, last element must be nullptr
 bool ExtractFiles(const char* archivePath, const char* dstDir, const char** files, Allocator* allocator);
 
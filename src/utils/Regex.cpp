@@ -0,0 +1,863 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/Dict.h"
+#include "utils/Regex.h"
+
+/*
+A pattern is parsed into a syntax tree which is then compiled into two
+Thompson-style NFA programs: one matching the pattern and one matching the
+pattern reversed. Both are executed as DFAs whose states (i.e. sets of NFA
+instructions) are only built while they're needed and then cached.
+
+To find all matches, the reverse DFA is run once from the text's end to its
+start, marking all positions at which a match starts. From the first of those,
+the forward DFA then determines where the longest match ends and the search
+continues at the first match start after that.
+*/
+
+// limits for the size of a compiled pattern, so that e.g. "(a{1000}){1000}" fails to
+// compile and deeply nested groups don't exhaust the stack
+#define MAX_REGEX_INSTS 100000
+#define MAX_REGEX_NESTING 100
+#define MAX_REGEX_REPEAT 1000
+// the cached DFA states are discarded when there are this many of them
+#define MAX_DFA_STATES 2000
+
+enum class RegexOp : u8 {
+    Char,  // matches x
+    Any,   // matches anything but '\n'
+    Class, // matches the characters of classes[x]
+    Split, // continues at both x and y
+    Jmp,   // continues at x
+    Match,
+};
+
+struct RegexInst {
+    RegexOp op;
+    int x;
+    int y;
+};
+
+enum {
+    ClassDigit = 1 << 0,
+    ClassNotDigit = 1 << 1,
+    ClassWord = 1 << 2,
+    ClassNotWord = 1 << 3,
+    ClassSpace = 1 << 4,
+    ClassNotSpace = 1 << 5,
+};
+
+struct RegexRange {
+    WCHAR first;
+    WCHAR last;
+};
+
+struct RegexClass {
+    int firstRange;
+    int nRanges;
+    // combination of the Class* flags for \d \w \s etc.
+    int builtins;
+    bool negated;
+};
+
+struct Regex {
+    bool ignoreCase = false;
+    Vec<RegexInst> forward;
+    Vec<RegexInst> reverse;
+    Vec<RegexClass> classes;
+    Vec<RegexRange> ranges;
+};
+
+static WCHAR CharToLower(WCHAR c) {
+    if (c < 128) {
+        return 'A' <= c && c <= 'Z' ? c + 32 : c;
+    }
+    WCHAR buf[1] = {c};
+    CharLowerBuffW(buf, 1);
+    return buf[0];
+}
+
+static WCHAR CharToUpper(WCHAR c) {
+    if (c < 128) {
+        return 'a' <= c && c <= 'z' ? c - 32 : c;
+    }
+    WCHAR buf[1] = {c};
+    CharUpperBuffW(buf, 1);
+    return buf[0];
+}
+
+static bool IsWordChar(WCHAR c) {
+    if (c < 128) {
+        return ('0' <= c && c <= '9') || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_';
+    }
+    return IsCharAlphaNumericW(c);
+}
+
+static bool IsSpaceChar(WCHAR c) {
+    return c == ' ' || ('\t' <= c && c <= '\r') || c == 0xa0 || c == 0x3000 || (0x2000 <= c && c <= 0x200b);
+}
+
+static bool MatchesBuiltins(int builtins, WCHAR c) {
+    bool isDigit = '0' <= c && c <= '9';
+    bool isWord = IsWordChar(c);
+    bool isSpace = IsSpaceChar(c);
+    return ((builtins & ClassDigit) && isDigit) || ((builtins & ClassNotDigit) && !isDigit) ||
+           ((builtins & ClassWord) && isWord) || ((builtins & ClassNotWord) && !isWord) ||
+           ((builtins & ClassSpace) && isSpace) || ((builtins & ClassNotSpace) && !isSpace);
+}
+
+static bool MatchesClassNoCase(const Regex* re, const RegexClass& cls, WCHAR c) {
+    if (cls.builtins && MatchesBuiltins(cls.builtins, c)) {
+        return true;
+    }
+    for (int i = 0; i < cls.nRanges; i++) {
+        RegexRange& r = re->ranges.at(cls.firstRange + i);
+        if (r.first <= c && c <= r.last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool MatchesClass(const Regex* re, const RegexClass& cls, WCHAR c) {
+    bool isMatch = MatchesClassNoCase(re, cls, c);
+    // the text is folded to lower case, so e.g. [A-Z] must also match 'a'
+    if (!isMatch && re->ignoreCase) {
+        WCHAR upper = CharToUpper(c);
+        isMatch = upper != c && MatchesClassNoCase(re, cls, upper);
+    }
+    return isMatch != cls.negated;
+}
+
+static bool MatchesInst(const Regex* re, const RegexInst& inst, WCHAR c) {
+    switch (inst.op) {
+        case RegexOp::Char:
+            return c == (WCHAR)inst.x;
+        case RegexOp::Any:
+            return c != '\n';
+        case RegexOp::Class:
+            return MatchesClass(re, re->classes.at(inst.x), c);
+        default:
+            return false;
+    }
+}
+
+// parsing
+
+enum class RegexNodeType {
+    Empty,
+    Char,  // c
+    Any,   // .
+    Class, // [...]
+    Cat,   // ab
+    Alt,   // a|b
+    Star,  // a*
+    Plus,  // a+
+    Quest, // a?
+    Repeat // a{min,max} (max is -1 for a{min,})
+};
+
+struct RegexNode {
+    RegexNodeType type;
+    // the character for Char, index into classes for Class
+    // and the children's index for all others
+    int a;
+    int b;
+    int min;
+    int max;
+};
+
+struct RegexParser {
+    Regex* re = nullptr;
+    const WCHAR* s = nullptr;
+    Vec<RegexNode> nodes;
+    int nesting = 0;
+    bool failed = false;
+
+    int AddNode(RegexNodeType type, int a = 0, int b = 0, int min = 0, int max = 0);
+    int ParseAlternatives();
+    int ParseSequence();
+    int ParseRepeat();
+    int ParseAtom();
+    int ParseClass();
+    bool ParseEscape(WCHAR* c, int* builtins);
+    bool ParseNumber(int* n);
+    WCHAR Fold(WCHAR c) const {
+        return re->ignoreCase ? CharToLower(c) : c;
+    }
+};
+
+int RegexParser::AddNode(RegexNodeType type, int a, int b, int min, int max) {
+    nodes.Append({type, a, b, min, max});
+    return nodes.isize() - 1;
+}
+
+int RegexParser::ParseAlternatives() {
+    int node = ParseSequence();
+    while (!failed && *s == '|') {
+        s++;
+        int other = ParseSequence();
+        node = AddNode(RegexNodeType::Alt, node, other);
+    }
+    return node;
+}
+
+int RegexParser::ParseSequence() {
+    int node = -1;
+    while (!failed && *s && *s != '|' && *s != ')') {
+        int next = ParseRepeat();
+        node = node < 0 ? next : AddNode(RegexNodeType::Cat, node, next);
+    }
+    if (node < 0) {
+        node = AddNode(RegexNodeType::Empty);
+    }
+    return node;
+}
+
+bool RegexParser::ParseNumber(int* n) {
+    if (*s < '0' || *s > '9') {
+        return false;
+    }
+    *n = 0;
+    for (; '0' <= *s && *s <= '9'; s++) {
+        *n = *n * 10 + (*s - '0');
+        if (*n > MAX_REGEX_REPEAT) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int RegexParser::ParseRepeat() {
+    int node = ParseAtom();
+    while (!failed) {
+        if (*s == '*') {
+            node = AddNode(RegexNodeType::Star, node);
+        } else if (*s == '+') {
+            node = AddNode(RegexNodeType::Plus, node);
+        } else if (*s == '?') {
+            node = AddNode(RegexNodeType::Quest, node);
+        } else if (*s == '{') {
+            s++;
+            int min = 0, max = 0;
+            if (!ParseNumber(&min)) {
+                failed = true;
+                break;
+            }
+            max = min;
+            if (*s == ',') {
+                s++;
+                max = -1;
+                if (*s != '}' && (!ParseNumber(&max) || max < min)) {
+                    failed = true;
+                    break;
+                }
+            }
+            if (*s != '}') {
+                failed = true;
+                break;
+            }
+            node = AddNode(RegexNodeType::Repeat, node, 0, min, max);
+        } else {
+            break;
+        }
+        s++;
+        // non-greedy quantifiers make no difference for leftmost-longest matches
+        if (*s == '?') {
+            s++;
+        }
+    }
+    return node;
+}
+
+// parses the character after a '\\' into either c or builtins
+bool RegexParser::ParseEscape(WCHAR* c, int* builtins) {
+    *builtins = 0;
+    WCHAR e = *s;
+    if (!e) {
+        return false;
+    }
+    s++;
+    switch (e) {
+        case 'd':
+            *builtins = ClassDigit;
+            return true;
+        case 'D':
+            *builtins = ClassNotDigit;
+            return true;
+        case 'w':
+            *builtins = ClassWord;
+            return true;
+        case 'W':
+            *builtins = ClassNotWord;
+            return true;
+        case 's':
+            *builtins = ClassSpace;
+            return true;
+        case 'S':
+            *builtins = ClassNotSpace;
+            return true;
+        case 'n':
+            *c = '\n';
+            return true;
+        case 'r':
+            *c = '\r';
+            return true;
+        case 't':
+            *c = '\t';
+            return true;
+        case 'f':
+            *c = '\f';
+            return true;
+        case 'v':
+            *c = '\v';
+            return true;
+    }
+    // unknown escapes of letters and digits (e.g. \b or \1) aren't supported
+    if (IsWordChar(e)) {
+        return false;
+    }
+    *c = e;
+    return true;
+}
+
+int RegexParser::ParseClass() {
+    RegexClass cls = {re->ranges.isize(), 0, 0, false};
+    if (*s == '^') {
+        cls.negated = true;
+        s++;
+    }
+    bool isFirst = true;
+    while (*s != ']' || isFirst) {
+        isFirst = false;
+        WCHAR first = *s;
+        if (!first) {
+            failed = true;
+            return 0;
+        }
+        s++;
+        if (first == '\\') {
+            int builtins;
+            if (!ParseEscape(&first, &builtins)) {
+                failed = true;
+                return 0;
+            }
+            if (builtins) {
+                cls.builtins |= builtins;
+                continue;
+            }
+        }
+        WCHAR last = first;
+        if (s[0] == '-' && s[1] && s[1] != ']') {
+            s++;
+            last = *s++;
+            int builtins = 0;
+            if (last == '\\' && (!ParseEscape(&last, &builtins) || builtins)) {
+                failed = true;
+                return 0;
+            }
+            if (last < first) {
+                failed = true;
+                return 0;
+            }
+        }
+        if (re->ignoreCase && first == last) {
+            first = last = CharToLower(first);
+        }
+        re->ranges.Append({first, last});
+        cls.nRanges++;
+    }
+    s++;
+    re->classes.Append(cls);
+    return AddNode(RegexNodeType::Class, re->classes.isize() - 1);
+}
+
+int RegexParser::ParseAtom() {
+    WCHAR c = *s++;
+    switch (c) {
+        case '(': {
+            if (s[0] == '?' && s[1] == ':') {
+                s += 2;
+            }
+            if (++nesting > MAX_REGEX_NESTING) {
+                failed = true;
+                return 0;
+            }
+            int node = ParseAlternatives();
+            nesting--;
+            if (*s != ')') {
+                failed = true;
+                return 0;
+            }
+            s++;
+            return node;
+        }
+        case '.':
+            return AddNode(RegexNodeType::Any);
+        case '[':
+            return ParseClass();
+        case '\\': {
+            int builtins;
+            if (!ParseEscape(&c, &builtins)) {
+                failed = true;
+                return 0;
+            }
+            if (builtins) {
+                re->classes.Append({0, 0, builtins, false});
+                return AddNode(RegexNodeType::Class, re->classes.isize() - 1);
+            }
+            return AddNode(RegexNodeType::Char, Fold(c));
+        }
+        // nothing to repeat and unsupported anchors
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+        case '^':
+        case '$':
+        case ')':
+        case '\0':
+            failed = true;
+            return 0;
+    }
+    return AddNode(RegexNodeType::Char, Fold(c));
+}
+
+// compilation
+
+struct RegexCompiler {
+    Vec<RegexNode>* nodes = nullptr;
+    Vec<RegexInst>* prog = nullptr;
+    bool reversed = false;
+    bool failed = false;
+
+    int Emit(RegexOp op, int x = 0, int y = 0);
+    void Compile(int nodeIdx);
+    void CompileSequence(int nodeIdx);
+    void CompileAlternatives(int nodeIdx);
+};
+
+int RegexCompiler::Emit(RegexOp op, int x, int y) {
+    if (prog->size() >= MAX_REGEX_INSTS) {
+        failed = true;
+    }
+    prog->Append({op, x, y});
+    return prog->isize() - 1;
+}
+
+// sequences are compiled iteratively, as long ones nest very deeply
+void RegexCompiler::CompileSequence(int nodeIdx) {
+    Vec<int> parts;
+    for (; nodes->at(nodeIdx).type == RegexNodeType::Cat; nodeIdx = nodes->at(nodeIdx).a) {
+        parts.Append(nodes->at(nodeIdx).b);
+    }
+    parts.Append(nodeIdx);
+    // parts contains the sequence's last part first
+    for (int i = 0; i < parts.isize(); i++) {
+        Compile(parts.at(reversed ? i : parts.isize() - 1 - i));
+    }
+}
+
+void RegexCompiler::CompileAlternatives(int nodeIdx) {
+    Vec<int> alts;
+    for (; nodes->at(nodeIdx).type == RegexNodeType::Alt; nodeIdx = nodes->at(nodeIdx).a) {
+        alts.Append(nodes->at(nodeIdx).b);
+    }
+    alts.Append(nodeIdx);
+    Vec<int> jmps;
+    for (int i = alts.isize() - 1; i > 0 && !failed; i--) {
+        int split = Emit(RegexOp::Split);
+        prog->at(split).x = prog->isize();
+        Compile(alts.at(i));
+        jmps.Append(Emit(RegexOp::Jmp));
+        prog->at(split).y = prog->isize();
+    }
+    Compile(alts.at(0));
+    for (int jmp : jmps) {
+        prog->at(jmp).x = prog->isize();
+    }
+}
+
+void RegexCompiler::Compile(int nodeIdx) {
+    if (failed) {
+        return;
+    }
+    RegexNode node = nodes->at(nodeIdx);
+    switch (node.type) {
+        case RegexNodeType::Empty:
+            break;
+        case RegexNodeType::Char:
+            Emit(RegexOp::Char, node.a);
+            break;
+        case RegexNodeType::Any:
+            Emit(RegexOp::Any);
+            break;
+        case RegexNodeType::Class:
+            Emit(RegexOp::Class, node.a);
+            break;
+        case RegexNodeType::Cat:
+            CompileSequence(nodeIdx);
+            break;
+        case RegexNodeType::Alt:
+            CompileAlternatives(nodeIdx);
+            break;
+        case RegexNodeType::Star: {
+            int split = Emit(RegexOp::Split);
+            prog->at(split).x = prog->isize();
+            Compile(node.a);
+            Emit(RegexOp::Jmp, split);
+            prog->at(split).y = prog->isize();
+            break;
+        }
+        case RegexNodeType::Plus: {
+            int start = prog->isize();
+            Compile(node.a);
+            int split = Emit(RegexOp::Split, start);
+            prog->at(split).y = prog->isize();
+            break;
+        }
+        case RegexNodeType::Quest: {
+            int split = Emit(RegexOp::Split);
+            prog->at(split).x = prog->isize();
+            Compile(node.a);
+            prog->at(split).y = prog->isize();
+            break;
+        }
+        case RegexNodeType::Repeat: {
+            for (int i = 0; i < node.min && !failed; i++) {
+                Compile(node.a);
+            }
+            if (node.max < 0) {
+                RegexNode star = {RegexNodeType::Star, node.a};
+                nodes->Append(star);
+                Compile(nodes->isize() - 1);
+            }
+            for (int i = node.min; i < node.max && !failed; i++) {
+                int split = Emit(RegexOp::Split);
+                prog->at(split).x = prog->isize();
+                Compile(node.a);
+                prog->at(split).y = prog->isize();
+            }
+            break;
+        }
+    }
+}
+
+Regex* CompileRegex(const WCHAR* pattern, bool ignoreCase) {
+    if (!pattern) {
+        return nullptr;
+    }
+    Regex* re = new Regex();
+    re->ignoreCase = ignoreCase;
+
+    RegexParser parser;
+    parser.re = re;
+    parser.s = pattern;
+    int root = parser.ParseAlternatives();
+    // a ')' without matching '('
+    if (!parser.failed && *parser.s) {
+        parser.failed = true;
+    }
+
+    bool failed = parser.failed;
+    for (int i = 0; i < 2 && !failed; i++) {
+        RegexCompiler compiler;
+        compiler.nodes = &parser.nodes;
+        compiler.reversed = i == 1;
+        compiler.prog = compiler.reversed ? &re->reverse : &re->forward;
+        compiler.Compile(root);
+        compiler.Emit(RegexOp::Match);
+        failed = compiler.failed;
+    }
+    if (failed) {
+        delete re;
+        return nullptr;
+    }
+    return re;
+}
+
+void FreeRegex(Regex* re) {
+    delete re;
+}
+
+// matching
+
+class RegexDfa {
+  public:
+    RegexDfa(const Regex* re, const Vec<RegexInst>* prog, bool anchored);
+    ~RegexDfa();
+
+    // the dead state from which no match can be reached (only for anchored DFAs)
+    static const int Dead = 0;
+    int Start() const {
+        return startState;
+    }
+    bool IsMatch(int state) const {
+        return states.at(state).isMatch;
+    }
+    // returns the state after state consumed c (note: this invalidates all state
+    // numbers but Dead, Start() and the one returned, if the cache was full)
+    int Next(int state, WCHAR c) {
+        if (c < 128) {
+            int next = states.LendData()[state].next[c];
+            if (next >= 0) {
+                return next;
+            }
+        }
+        return ComputeNext(state, c);
+    }
+
+  private:
+    struct State {
+        // the sorted instructions are at insts[first] to insts[first + n - 1]
+        int first;
+        int n;
+        // whether the text consumed so far ends with a match
+        bool isMatch;
+        // the cached transitions for ASCII characters (-1 if not computed yet)
+        int next[128];
+    };
+
+    const Regex* re = nullptr;
+    const Vec<RegexInst>* prog = nullptr;
+    // an unanchored DFA restarts the pattern at every character
+    bool anchored = false;
+
+    Vec<State> states;
+    int startState = 0;
+    Vec<int> insts;
+    dict::MapStrToInt* stateNos = nullptr;
+    // the cached transitions for non-ASCII characters, as an
+    // open-address hash table from (state << 16 | c) + 1 to states
+    Vec<u64> otherKeys;
+    Vec<int> otherStates;
+    int nOther = 0;
+    static u64 OtherKey(int state, WCHAR c) {
+        return ((u64)state << 16 | c) + 1;
+    }
+
+    // temporary state for ComputeNext
+    Vec<int> visited;
+    int generation = 0;
+    Vec<int> stack;
+    Vec<int> set;
+    Vec<int> prevSet;
+    str::Str key;
+
+    void Reset();
+    void AddClosure(int pc, bool withMatch);
+    int AddState();
+    int ComputeNext(int state, WCHAR c);
+    size_t FindOtherSlot(u64 key) const;
+    void InsertOther(u64 key, int next);
+};
+
+RegexDfa::RegexDfa(const Regex* re, const Vec<RegexInst>* prog, bool anchored)
+    : re(re), prog(prog), anchored(anchored) {
+    visited.AppendBlanks(prog->size());
+    Reset();
+}
+
+RegexDfa::~RegexDfa() {
+    delete stateNos;
+}
+
+void RegexDfa::Reset() {
+    states.Reset();
+    insts.Reset();
+    delete stateNos;
+    stateNos = new dict::MapStrToInt(1024);
+    otherKeys.Reset();
+    otherStates.Reset();
+    otherKeys.AppendBlanks(256);
+    otherStates.AppendBlanks(256);
+    nOther = 0;
+
+    set.Reset();
+    AddState();
+    // the start state never contains the match instruction, as empty matches are ignored
+    generation++;
+    set.Reset();
+    AddClosure(0, false);
+    startState = AddState();
+}
+
+// adds the instructions reachable from pc without consuming a character to set
+void RegexDfa::AddClosure(int pc, bool withMatch) {
+    RegexInst* code = prog->LendData();
+    int* marks = visited.LendData();
+    stack.Append(pc);
+    while (stack.size() > 0) {
+        pc = stack.Pop();
+        if (marks[pc] == generation) {
+            continue;
+        }
+        marks[pc] = generation;
+        switch (code[pc].op) {
+            case RegexOp::Jmp:
+                stack.Append(code[pc].x);
+                break;
+            case RegexOp::Split:
+                stack.Append(code[pc].y);
+                stack.Append(code[pc].x);
+                break;
+            case RegexOp::Match:
+                if (withMatch) {
+                    set.Append(pc);
+                }
+                break;
+            default:
+                set.Append(pc);
+                break;
+        }
+    }
+}
+
+// returns the number of the state for the instructions in set, adding it if needed
+int RegexDfa::AddState() {
+    std::sort(set.begin(), set.end());
+    key.Reset();
+    for (int pc : set) {
+        key.AppendFmt("%d,", pc);
+    }
+    int stateNo;
+    if (stateNos->Get(key.Get(), &stateNo)) {
+        return stateNo;
+    }
+
+    State* state = states.AppendBlanks(1);
+    state->first = insts.isize();
+    state->n = set.isize();
+    state->isMatch = set.size() > 0 && prog->at(set.Last()).op == RegexOp::Match;
+    for (int& next : state->next) {
+        next = -1;
+    }
+    insts.Append(set.LendData(), set.size());
+    stateNo = states.isize() - 1;
+    stateNos->Insert(key.Get(), stateNo);
+    return stateNo;
+}
+
+// returns the slot for key in otherKeys, which is either empty or contains key
+size_t RegexDfa::FindOtherSlot(u64 key) const {
+    size_t mask = otherKeys.size() - 1;
+    size_t i = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 40) & mask;
+    u64* keys = otherKeys.LendData();
+    while (keys[i] != 0 && keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+void RegexDfa::InsertOther(u64 key, int next) {
+    if ((size_t)(nOther + 1) * 2 > otherKeys.size()) {
+        Vec<u64> keys(otherKeys);
+        Vec<int> nextStates(otherStates);
+        otherKeys.Reset();
+        otherStates.Reset();
+        otherKeys.AppendBlanks(keys.size() * 2);
+        otherStates.AppendBlanks(keys.size() * 2);
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys.at(i) != 0) {
+                size_t slot = FindOtherSlot(keys.at(i));
+                otherKeys.at(slot) = keys.at(i);
+                otherStates.at(slot) = nextStates.at(i);
+            }
+        }
+    }
+    size_t slot = FindOtherSlot(key);
+    otherKeys.at(slot) = key;
+    otherStates.at(slot) = next;
+    nOther++;
+}
+
+int RegexDfa::ComputeNext(int state, WCHAR c) {
+    if (c >= 128) {
+        size_t slot = FindOtherSlot(OtherKey(state, c));
+        if (otherKeys.at(slot) != 0) {
+            return otherStates.at(slot);
+        }
+    }
+
+    generation++;
+    set.Reset();
+    const State& s = states.at(state);
+    RegexInst* code = prog->LendData();
+    for (int i = 0; i < s.n; i++) {
+        int pc = insts.at(s.first + i);
+        if (MatchesInst(re, code[pc], c)) {
+            AddClosure(pc + 1, true);
+        }
+    }
+    if (!anchored) {
+        AddClosure(0, false);
+    }
+
+    if (states.size() >= MAX_DFA_STATES) {
+        // start over with an empty cache, keeping only the current state
+        Vec<int> nextSet(set);
+        prevSet.Reset();
+        prevSet.Append(insts.LendData() + s.first, s.n);
+        Reset();
+        set = prevSet;
+        state = AddState();
+        set = nextSet;
+    }
+
+    int next = AddState();
+    if (c < 128) {
+        states.at(state).next[c] = next;
+    } else {
+        InsertOther(OtherKey(state, c), next);
+    }
+    return next;
+}
+
+RegexMatcher::RegexMatcher(const Regex* re) {
+    forward = new RegexDfa(re, &re->forward, true);
+    reverse = new RegexDfa(re, &re->reverse, false);
+}
+
+RegexMatcher::~RegexMatcher() {
+    delete forward;
+    delete reverse;
+}
+
+void RegexMatcher::FindAll(const WCHAR* s, int len, Vec<RegexMatch>& matches) {
+    if (len <= 0) {
+        return;
+    }
+    // isMatchStart[i] is set if a non-empty match starts at s[i]
+    isMatchStart.Reset();
+    bool* isStart = isMatchStart.AppendBlanks(len);
+    int state = reverse->Start();
+    for (int i = len - 1; i >= 0; i--) {
+        state = reverse->Next(state, s[i]);
+        isStart[i] = reverse->IsMatch(state);
+    }
+
+    for (int start = 0; start < len; start++) {
+        if (!isStart[start]) {
+            continue;
+        }
+        int end = -1;
+        state = forward->Start();
+        for (int i = start; i < len; i++) {
+            state = forward->Next(state, s[i]);
+            if (RegexDfa::Dead == state) {
+                break;
+            }
+            if (forward->IsMatch(state)) {
+                end = i + 1;
+            }
+        }
+        CrashIf(end <= start);
+        if (end <= start) {
+            continue;
+        }
+        matches.Append({start, end});
+        start = end - 1;
+    }
+}
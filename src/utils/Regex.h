@@ -0,0 +1,39 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// regular expressions which are matched without backtracking, through
+// lazily built DFAs, so that matching takes time linear in the text's length.
+// supported syntax: literal characters, . (any character but '\n'), [abc], [^a-z],
+// \d \w \s \D \W \S (also within classes), escaped characters (e.g. \. \\ \n \t),
+// the quantifiers * + ? {m} {m,} {m,n} and alternatives "a|b" grouped by (...) or (?:...)
+// (an alternative of literal terms like "term1|term2|term3" is matched in a single pass)
+
+struct Regex;
+class RegexDfa;
+
+// a match spans s[start] to s[end - 1]
+struct RegexMatch {
+    int start;
+    int end;
+};
+
+// returns nullptr if pattern isn't supported
+// if ignoreCase is set, the text to match must be folded to lower case (with CharLowerBuff)
+Regex* CompileRegex(const WCHAR* pattern, bool ignoreCase);
+void FreeRegex(Regex* re);
+
+// a matcher caches the DFAs it builds for a regex, so it should be
+// reused for all searches but must only be used by one thread at a time
+class RegexMatcher {
+  public:
+    explicit RegexMatcher(const Regex* re);
+    ~RegexMatcher();
+
+    // appends the leftmost-longest, non-empty and non-overlapping matches within s[0] to s[len - 1]
+    void FindAll(const WCHAR* s, int len, Vec<RegexMatch>& matches);
+
+  private:
+    RegexDfa* forward = nullptr;
+    RegexDfa* reverse = nullptr;
+    Vec<bool> isMatchStart;
+};
@@ -596,3 +596,261 @@ void FreeStruct(const StructInfo* info, void* strct) {
     }
     free(strct);
 }
+
+// describes the layout of all (sub)structs so that binary snapshots
+// written by a different build (or for a different struct) are rejected
+static void DescribeStructLayout(str::Str& out, const StructInfo* info) {
+    out.AppendFmt("%d:%d{", (int)info->structSize, (int)info->fieldCount);
+    const char* fieldName = info->fieldNames;
+    for (size_t i = 0; i < info->fieldCount; i++, fieldName += str::Len(fieldName) + 1) {
+        const FieldInfo& field = info->fields[i];
+        out.AppendFmt("%s:%d:%d;", fieldName, (int)field.offset, (int)field.type);
+        if (SettingType::Struct == field.type || SettingType::Prerelease == field.type ||
+            SettingType::Array == field.type || SettingType::Compact == field.type) {
+            DescribeStructLayout(out, GetSubstruct(field));
+        }
+    }
+    out.AppendChar('}');
+}
+
+static u32 GetStructLayoutHash(const StructInfo* info) {
+    str::Str desc;
+    DescribeStructLayout(desc, info);
+    return MurmurHash2(desc.Get(), desc.size());
+}
+
+static const u32 kNullLen = (u32)-1;
+
+static void WriteBinaryU32(str::Str& out, u32 n) {
+    out.Append((const char*)&n, sizeof(n));
+}
+
+static void SerializeStructBinaryRec(str::Str& out, const StructInfo* info, const u8* base) {
+    for (size_t i = 0; i < info->fieldCount; i++) {
+        const FieldInfo& field = info->fields[i];
+        const u8* fieldPtr = base + field.offset;
+        switch (field.type) {
+            case SettingType::Struct:
+            case SettingType::Prerelease:
+            case SettingType::Compact:
+                SerializeStructBinaryRec(out, GetSubstruct(field), fieldPtr);
+                break;
+            case SettingType::Array: {
+                Vec<void*>* array = *(Vec<void*>**)fieldPtr;
+                WriteBinaryU32(out, array ? (u32)array->size() : 0);
+                for (size_t j = 0; array && j < array->size(); j++) {
+                    SerializeStructBinaryRec(out, GetSubstruct(field), (const u8*)array->at(j));
+                }
+                break;
+            }
+            case SettingType::Bool:
+                out.AppendChar(*(bool*)fieldPtr ? 1 : 0);
+                break;
+            case SettingType::Color:
+            case SettingType::Float:
+            case SettingType::Int:
+                out.Append((const char*)fieldPtr, sizeof(int));
+                break;
+            case SettingType::String: {
+                const WCHAR* s = *(const WCHAR**)fieldPtr;
+                WriteBinaryU32(out, s ? (u32)str::Len(s) : kNullLen);
+                if (s) {
+                    out.Append((const char*)s, str::Len(s) * sizeof(WCHAR));
+                }
+                break;
+            }
+            case SettingType::Utf8String: {
+                const char* s = *(const char**)fieldPtr;
+                WriteBinaryU32(out, s ? (u32)str::Len(s) : kNullLen);
+                if (s) {
+                    out.Append(s, str::Len(s));
+                }
+                break;
+            }
+            case SettingType::ColorArray:
+            case SettingType::FloatArray:
+            case SettingType::IntArray: {
+                Vec<int>* v = *(Vec<int>**)fieldPtr;
+                WriteBinaryU32(out, v ? (u32)v->size() : 0);
+                if (v && v->size() > 0) {
+                    out.Append((const char*)v->LendData(), v->size() * sizeof(int));
+                }
+                break;
+            }
+            case SettingType::StringArray: {
+                Vec<WCHAR*>* v = *(Vec<WCHAR*>**)fieldPtr;
+                WriteBinaryU32(out, v ? (u32)v->size() : 0);
+                for (size_t j = 0; v && j < v->size(); j++) {
+                    const WCHAR* s = v->at(j);
+                    WriteBinaryU32(out, (u32)str::Len(s));
+                    out.Append((const char*)s, str::Len(s) * sizeof(WCHAR));
+                }
+                break;
+            }
+            case SettingType::Comment:
+                break;
+            default:
+                CrashIf(true);
+        }
+    }
+}
+
+std::span<u8> SerializeStructBinary(const StructInfo* info, const void* strct) {
+    str::Str out;
+    WriteBinaryU32(out, GetStructLayoutHash(info));
+    SerializeStructBinaryRec(out, info, (const u8*)strct);
+    return out.StealAsSpan();
+}
+
+struct BinaryReader {
+    const u8* curr = nullptr;
+    const u8* end = nullptr;
+
+    bool Read(void* dst, size_t len) {
+        if ((size_t)(end - curr) < len) {
+            return false;
+        }
+        memcpy(dst, curr, len);
+        curr += len;
+        return true;
+    }
+    bool ReadU32(u32* n) {
+        return Read(n, sizeof(*n));
+    }
+    // checks that count items of itemSize bytes can still be read
+    // so that corrupted data doesn't cause huge allocations
+    bool CanRead(u32 count, size_t itemSize) {
+        return count <= (size_t)(end - curr) / itemSize;
+    }
+};
+
+static WCHAR* ReadBinaryWstr(BinaryReader& r, u32 len) {
+    if (!r.CanRead(len, sizeof(WCHAR))) {
+        return nullptr;
+    }
+    WCHAR* s = AllocArray<WCHAR>((size_t)len + 1);
+    r.Read(s, len * sizeof(WCHAR));
+    return s;
+}
+
+static bool DeserializeStructBinaryRec(BinaryReader& r, const StructInfo* info, u8* base) {
+    for (size_t i = 0; i < info->fieldCount; i++) {
+        const FieldInfo& field = info->fields[i];
+        u8* fieldPtr = base + field.offset;
+        u32 n = 0;
+        switch (field.type) {
+            case SettingType::Struct:
+            case SettingType::Prerelease:
+            case SettingType::Compact:
+                if (!DeserializeStructBinaryRec(r, GetSubstruct(field), fieldPtr)) {
+                    return false;
+                }
+                break;
+            case SettingType::Array: {
+                Vec<void*>* array = new Vec<void*>();
+                *(Vec<void*>**)fieldPtr = array;
+                if (!r.ReadU32(&n) || !r.CanRead(n, 1)) {
+                    return false;
+                }
+                for (u32 j = 0; j < n; j++) {
+                    u8* item = AllocArray<u8>(GetSubstruct(field)->structSize);
+                    array->Append(item);
+                    if (!DeserializeStructBinaryRec(r, GetSubstruct(field), item)) {
+                        return false;
+                    }
+                }
+                break;
+            }
+            case SettingType::Bool: {
+                u8 b = 0;
+                if (!r.Read(&b, 1)) {
+                    return false;
+                }
+                *(bool*)fieldPtr = b != 0;
+                break;
+            }
+            case SettingType::Color:
+            case SettingType::Float:
+            case SettingType::Int:
+                if (!r.Read(fieldPtr, sizeof(int))) {
+                    return false;
+                }
+                break;
+            case SettingType::String:
+                if (!r.ReadU32(&n)) {
+                    return false;
+                }
+                if (n != kNullLen) {
+                    *(WCHAR**)fieldPtr = ReadBinaryWstr(r, n);
+                    if (!*(WCHAR**)fieldPtr) {
+                        return false;
+                    }
+                }
+                break;
+            case SettingType::Utf8String:
+                if (!r.ReadU32(&n)) {
+                    return false;
+                }
+                if (n != kNullLen) {
+                    if (!r.CanRead(n, 1)) {
+                        return false;
+                    }
+                    char* s = AllocArray<char>((size_t)n + 1);
+                    r.Read(s, n);
+                    *(char**)fieldPtr = s;
+                }
+                break;
+            case SettingType::ColorArray:
+            case SettingType::FloatArray:
+            case SettingType::IntArray: {
+                Vec<int>* v = new Vec<int>();
+                *(Vec<int>**)fieldPtr = v;
+                if (!r.ReadU32(&n) || !r.CanRead(n, sizeof(int))) {
+                    return false;
+                }
+                if (n > 0) {
+                    r.Read(v->AppendBlanks(n), n * sizeof(int));
+                }
+                break;
+            }
+            case SettingType::StringArray: {
+                Vec<WCHAR*>* v = new Vec<WCHAR*>();
+                *(Vec<WCHAR*>**)fieldPtr = v;
+                if (!r.ReadU32(&n) || !r.CanRead(n, sizeof(u32))) {
+                    return false;
+                }
+                for (u32 j = 0; j < n; j++) {
+                    u32 len = 0;
+                    WCHAR* s = r.ReadU32(&len) ? ReadBinaryWstr(r, len) : nullptr;
+                    if (!s) {
+                        return false;
+                    }
+                    v->Append(s);
+                }
+                break;
+            }
+            case SettingType::Comment:
+                break;
+            default:
+                CrashIf(true);
+        }
+    }
+    return true;
+}
+
+void* DeserializeStructBinary(const StructInfo* info, std::span<u8> data) {
+    BinaryReader r;
+    r.curr = data.data();
+    r.end = r.curr + data.size();
+    u32 layoutHash = 0;
+    if (!r.ReadU32(&layoutHash) || layoutHash != GetStructLayoutHash(info)) {
+        return nullptr;
+    }
+    u8* base = AllocArray<u8>(info->structSize);
+    // partially deserialized data can be freed as all unread pointers are still nullptr
+    if (!DeserializeStructBinaryRec(r, info, base) || r.curr != r.end) {
+        FreeStruct(info, base);
+        return nullptr;
+    }
+    return base;
+}
@@ -63,3 +63,9 @@ struct StructInfo {
 std::span<u8> SerializeStruct(const StructInfo* info, const void* strct, const char* prevData = nullptr);
 void* DeserializeStruct(const StructInfo* info, const char* data, void* strct = nullptr);
 void FreeStruct(const StructInfo* info, void* strct);
+
+// binary snapshots of deserialized structs can be loaded without parsing; they're
+// tagged with a hash of the struct layout and are rejected if that doesn't match
+std::span<u8> SerializeStructBinary(const StructInfo* info, const void* strct);
+// returns nullptr if data is truncated or was written for a different layout
+void* DeserializeStructBinary(const StructInfo* info, std::span<u8> data);
@@ -0,0 +1,185 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/DbgHelpDyn.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/SlowOps.h"
+#include "utils/Log.h"
+
+// must be a power of 2
+constexpr int kSlowOpCount = 64;
+constexpr DWORD kHangMs = 5000;
+constexpr DWORD kWatchdogIntervalMs = 1000;
+
+struct SlowOp {
+    // 0 while being written, otherwise the (1-based) sequence number
+    LONG seq;
+    DWORD threadId;
+    // GetTickCount() at the end of the operation
+    DWORD endTick;
+    int pageNo;
+    float ms;
+    const char* what;
+    // the end of the file path (usually the whole file name)
+    WCHAR name[48];
+};
+
+static SlowOp gSlowOps[kSlowOpCount];
+static LONG gSlowOpSeq = 0;
+
+void RecordSlowOp(const char* what, const WCHAR* path, int pageNo, double ms) {
+    LONG seq = InterlockedIncrement(&gSlowOpSeq);
+    SlowOp* op = &gSlowOps[(seq - 1) & (kSlowOpCount - 1)];
+    InterlockedExchange(&op->seq, 0);
+    op->threadId = GetCurrentThreadId();
+    op->endTick = GetTickCount();
+    op->pageNo = pageNo;
+    op->ms = (float)ms;
+    op->what = what;
+    op->name[0] = 0;
+    if (path) {
+        const WCHAR* name = path::GetBaseNameNoFree(path);
+        size_t len = str::Len(name);
+        if (len >= dimof(op->name)) {
+            name += len - dimof(op->name) + 1;
+        }
+        str::BufSet(op->name, dimof(op->name), name);
+    }
+    InterlockedExchange(&op->seq, seq);
+}
+
+SlowOpScope::~SlowOpScope() {
+    LARGE_INTEGER end, freq;
+    QueryPerformanceCounter(&end);
+    QueryPerformanceFrequency(&freq);
+    double ms = (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)freq.QuadPart;
+    if (ms >= kSlowOpMinMs) {
+        RecordSlowOp(what, path, pageNo, ms);
+    }
+}
+
+void GetSlowOpJournal(str::Str& s) {
+    // copy the entries first, as they might be overwritten while we format them
+    SlowOp ops[kSlowOpCount];
+    int n = 0;
+    for (SlowOp& op : gSlowOps) {
+        LONG seq = InterlockedAdd(&op.seq, 0);
+        if (seq == 0) {
+            continue;
+        }
+        ops[n] = op;
+        if (InterlockedAdd(&op.seq, 0) == seq) {
+            ops[n].seq = seq;
+            n++;
+        }
+    }
+    std::sort(ops, ops + n, [](const SlowOp& a, const SlowOp& b) { return a.seq < b.seq; });
+
+    char line[256];
+    snprintf(line, dimof(line), "Slow operations (at least %d ms, the last %d):\n", kSlowOpMinMs, kSlowOpCount);
+    s.Append(line);
+    if (n == 0) {
+        s.Append("  none\n");
+        return;
+    }
+    DWORD now = GetTickCount();
+    for (int i = 0; i < n; i++) {
+        SlowOp& op = ops[i];
+        char page[32] = "";
+        if (op.pageNo > 0) {
+            snprintf(page, dimof(page), ", page %d", op.pageNo);
+        }
+        char name[3 * dimof(op.name)];
+        if (WideCharToMultiByte(CP_UTF8, 0, op.name, -1, name, (int)sizeof(name), nullptr, nullptr) <= 0) {
+            name[0] = 0;
+        }
+        double ago = (double)(now - op.endTick) / 1000.0;
+        snprintf(line, dimof(line), "  %.1f s ago: %s took %d ms (thread %x%s%s%s)\n", ago, op.what, (int)op.ms,
+                 op.threadId, page, name[0] ? ", " : "", name);
+        s.Append(line);
+    }
+}
+
+static HWND gWatchdogHwnd = nullptr;
+static HANDLE gWatchdogThread = nullptr;
+static HANDLE gWatchdogStopEvent = nullptr;
+static DWORD gWatchedThreadId = 0;
+
+static void LogHangReport() {
+    str::Str s;
+    s.AppendFmt("UI thread hasn't responded for %d s\n", (int)(kHangMs / 1000));
+    if (dbghelp::Initialize(L"", false)) {
+        dbghelp::GetThreadCallstack(s, gWatchedThreadId);
+        s.Append("\n");
+    }
+    GetSlowOpJournal(s);
+    log(s.AsView());
+}
+
+// the watched thread processes sent messages in every message loop (including those
+// of modal dialogs and menus), so a message that isn't processed in time means a hang
+static DWORD WINAPI UiWatchdogThread(void*) {
+    SetThreadName(GetCurrentThreadId(), "UiWatchdog");
+    bool isHung = false;
+    DWORD hangStart = 0;
+    while (WaitForSingleObject(gWatchdogStopEvent, kWatchdogIntervalMs) == WAIT_TIMEOUT) {
+        DWORD_PTR res;
+        DWORD start = GetTickCount();
+        if (SendMessageTimeoutW(gWatchdogHwnd, WM_NULL, 0, 0, SMTO_BLOCK, kHangMs, &res)) {
+            if (isHung) {
+                logf("UI thread is responding again after %.1f s\n", (double)(GetTickCount() - hangStart) / 1000.0);
+                isHung = false;
+            }
+            continue;
+        }
+        if (GetLastError() != ERROR_TIMEOUT) {
+            // the window is gone
+            break;
+        }
+        if (!isHung) {
+            isHung = true;
+            hangStart = start;
+            LogHangReport();
+        }
+    }
+    return 0;
+}
+
+void StartUiWatchdog() {
+    if (gWatchdogThread) {
+        return;
+    }
+    gWatchedThreadId = GetCurrentThreadId();
+    gWatchdogHwnd = CreateWindowW(L"STATIC", nullptr, 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, nullptr, nullptr);
+    gWatchdogStopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (gWatchdogHwnd && gWatchdogStopEvent) {
+        gWatchdogThread = CreateThread(nullptr, 0, UiWatchdogThread, nullptr, 0, nullptr);
+    }
+    if (!gWatchdogThread) {
+        StopUiWatchdog();
+    }
+}
+
+// must be called from the thread that called StartUiWatchdog()
+void StopUiWatchdog() {
+    if (gWatchdogThread) {
+        SetEvent(gWatchdogStopEvent);
+        // the watchdog might be waiting for us to process its message
+        while (MsgWaitForMultipleObjects(1, &gWatchdogThread, FALSE, INFINITE, QS_SENDMESSAGE) == WAIT_OBJECT_0 + 1) {
+            MSG msg;
+            PeekMessageW(&msg, nullptr, 0, 0, PM_NOREMOVE);
+        }
+        CloseHandle(gWatchdogThread);
+        gWatchdogThread = nullptr;
+    }
+    if (gWatchdogHwnd) {
+        DestroyWindow(gWatchdogHwnd);
+        gWatchdogHwnd = nullptr;
+    }
+    if (gWatchdogStopEvent) {
+        CloseHandle(gWatchdogStopEvent);
+        gWatchdogStopEvent = nullptr;
+    }
+}
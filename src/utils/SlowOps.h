@@ -0,0 +1,36 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// a small journal of recent slow operations (renders, loads, searches, layouts)
+// for diagnosing crashes and hangs in the field:
+//   SLOW_OP("Render", dm->FilePath(), pageNo);
+// records the rest of the enclosing scope if it takes at least kSlowOpMinMs.
+// The journal has a fixed size and recording is lock-free, so that it can be
+// read from the crash handler.
+
+constexpr int kSlowOpMinMs = 500;
+
+// path can be nullptr, pageNo can be 0
+void RecordSlowOp(const char* what, const WCHAR* path, int pageNo, double ms);
+// appends the journal (oldest operation first) without allocating memory other than for s
+void GetSlowOpJournal(str::Str& s);
+
+struct SlowOpScope {
+    // what must be a string literal, path must outlive the scope
+    const char* what = nullptr;
+    const WCHAR* path = nullptr;
+    int pageNo = 0;
+    LARGE_INTEGER start{};
+
+    SlowOpScope(const char* what, const WCHAR* path, int pageNo) : what(what), path(path), pageNo(pageNo) {
+        QueryPerformanceCounter(&start);
+    }
+    ~SlowOpScope();
+};
+
+#define SLOW_OP(what, path, pageNo) SlowOpScope CONCAT(slowOp__, __LINE__)(what, path, pageNo)
+
+// logs a hang report (the calling thread's callstack and the journal) when
+// the calling thread doesn't process messages for several seconds
+void StartUiWatchdog();
+void StopUiWatchdog();
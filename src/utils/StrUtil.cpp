@@ -164,7 +164,11 @@ size_t Len(const char* s) {
 }
 
 char* Dup(const char* s) {
-    return s ? _strdup(s) : nullptr;
+    if (!s) {
+        return nullptr;
+    }
+    SampleAlloc(strlen(s) + 1);
+    return _strdup(s);
 }
 
 // return true if s1 == s2, case sensitive
@@ -103,6 +103,10 @@ WCHAR* FindCharLast(WCHAR* str, WCHAR c);
 const WCHAR* Find(const WCHAR* str, const WCHAR* find);
 
 const WCHAR* FindI(const WCHAR* str, const WCHAR* find);
+// find the first (resp. last) occurrence of toFind within the first sLen
+// characters of s (which don't have to be zero-terminated)
+const WCHAR* FindN(const WCHAR* s, size_t sLen, const WCHAR* toFind, size_t toFindLen);
+const WCHAR* FindLastN(const WCHAR* s, size_t sLen, const WCHAR* toFind, size_t toFindLen);
 bool BufFmtV(WCHAR* buf, size_t bufCchSize, const WCHAR* fmt, va_list args);
 WCHAR* FmtV(const WCHAR* fmt, va_list args);
 WCHAR* Format(const WCHAR* fmt, ...);
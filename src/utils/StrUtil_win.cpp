@@ -3,6 +3,9 @@
 
 #include "BaseUtil.h"
 
+#include <intrin.h>
+#include <emmintrin.h>
+
 namespace str {
 
 bool IsWs(WCHAR c) {
@@ -26,7 +29,11 @@ void Free(const WCHAR* s) {
 }
 
 WCHAR* Dup(const WCHAR* s) {
-    return s ? _wcsdup(s) : nullptr;
+    if (!s) {
+        return nullptr;
+    }
+    SampleAlloc((wcslen(s) + 1) * sizeof(WCHAR));
+    return _wcsdup(s);
 }
 
 // return true if s1 == s2, case sensitive
@@ -185,6 +192,87 @@ const WCHAR* FindI(const WCHAR* s, const WCHAR* toFind) {
     return nullptr;
 }
 
+// returns a mask with the two bits for s[i] set if s[i] and s[i + 1]
+// are first and second (for 0 <= i < 8, reads s[0] to s[8])
+static inline uint MatchFirstTwo(const WCHAR* s, __m128i first, __m128i second) {
+    __m128i c1 = _mm_loadu_si128((const __m128i*)s);
+    __m128i c2 = _mm_loadu_si128((const __m128i*)(s + 1));
+    __m128i eq = _mm_and_si128(_mm_cmpeq_epi16(c1, first), _mm_cmpeq_epi16(c2, second));
+    return (uint)_mm_movemask_epi8(eq);
+}
+
+// filters 8 positions at once by the first two characters of toFind,
+// so that only few positions have to be compared in full
+const WCHAR* FindN(const WCHAR* s, size_t sLen, const WCHAR* toFind, size_t toFindLen) {
+    if (0 == toFindLen) {
+        return s;
+    }
+    if (toFindLen > sLen) {
+        return nullptr;
+    }
+    size_t lastStart = sLen - toFindLen;
+    size_t i = 0;
+    if (toFindLen >= 2) {
+        __m128i first = _mm_set1_epi16((short)toFind[0]);
+        __m128i second = _mm_set1_epi16((short)toFind[1]);
+        size_t cmpLen = (toFindLen - 2) * sizeof(WCHAR);
+        for (; i + 8 <= lastStart; i += 8) {
+            uint mask = MatchFirstTwo(s + i, first, second);
+            while (mask != 0) {
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+                const WCHAR* pos = s + i + bit / 2;
+                if (memcmp(pos + 2, toFind + 2, cmpLen) == 0) {
+                    return pos;
+                }
+                mask &= ~(3u << bit);
+            }
+        }
+    }
+    for (; i <= lastStart; i++) {
+        if (s[i] == toFind[0] && memcmp(s + i, toFind, toFindLen * sizeof(WCHAR)) == 0) {
+            return s + i;
+        }
+    }
+    return nullptr;
+}
+
+const WCHAR* FindLastN(const WCHAR* s, size_t sLen, const WCHAR* toFind, size_t toFindLen) {
+    if (0 == toFindLen) {
+        return s + sLen;
+    }
+    if (toFindLen > sLen) {
+        return nullptr;
+    }
+    // positions still to be checked are 0 to end - 1
+    size_t end = sLen - toFindLen + 1;
+    if (toFindLen >= 2) {
+        __m128i first = _mm_set1_epi16((short)toFind[0]);
+        __m128i second = _mm_set1_epi16((short)toFind[1]);
+        size_t cmpLen = (toFindLen - 2) * sizeof(WCHAR);
+        for (; end >= 8; end -= 8) {
+            size_t i = end - 8;
+            uint mask = MatchFirstTwo(s + i, first, second);
+            while (mask != 0) {
+                unsigned long bit;
+                _BitScanReverse(&bit, mask);
+                const WCHAR* pos = s + i + bit / 2;
+                if (memcmp(pos + 2, toFind + 2, cmpLen) == 0) {
+                    return pos;
+                }
+                mask &= ~(3u << (bit & ~1));
+            }
+        }
+    }
+    while (end > 0) {
+        end--;
+        if (s[end] == toFind[0] && memcmp(s + end, toFind, toFindLen * sizeof(WCHAR)) == 0) {
+            return s + end;
+        }
+    }
+    return nullptr;
+}
+
 void ReplacePtr(WCHAR** s, const WCHAR* snew) {
     free(*s);
     *s = str::Dup(snew);
@@ -59,43 +59,338 @@ ThreadBase::ThreadBase(const char* name) {
     // lf("ThreadBase() %d", threadNo);
 }
 
-ThreadBase::~ThreadBase() {
-    // lf("~ThreadBase() %d", threadNo);
-    CloseHandle(hThread);
+// the shared thread pool: there's one thread per processor ("core" threads) which
+// are created as needed and never exit. When a task is queued while no thread is idle,
+// an additional thread is created for it (up to POOL_MAX_THREADS), so that e.g.
+// a blocking network request doesn't delay printing. These exit after having been
+// idle for POOL_IDLE_TIMEOUT_MS. Tasks of a TaskGroup and Low priority tasks don't
+// create additional threads (as they're meant to keep the processors busy, not to
+// oversubscribe them) and Low priority tasks only run on core threads.
+
+#define POOL_MAX_THREADS 64
+#define POOL_IDLE_TIMEOUT_MS 10000
+
+struct PoolTask {
+    std::function<void()> func;
+    TaskPriority prio = TaskPriority::Normal;
+    TaskGroup* group = nullptr;
+    // signaled when the task is done (for RunAsyncWithHandle)
+    HANDLE done = nullptr;
+};
+
+struct PoolThread {
+    HANDLE hThread = nullptr;
+    bool isCore = false;
+    bool isIdle = false;
+    // group tasks queued by the tasks running on this thread, taken by this
+    // thread from the end and stolen by other threads from the front
+    Vec<PoolTask*> local;
+};
+
+struct ThreadPool {
+    // protects all the fields and PoolThread::local
+    CRITICAL_SECTION access;
+    CONDITION_VARIABLE wakeUp;
+    // tasks queued from other threads, by priority
+    Vec<PoolTask*> queues[3];
+    Vec<PoolThread*> threads;
+    int nCoreThreads = 0;
+    int maxCoreThreads = 0;
+    int nIdle = 0;
+    int nIdleCore = 0;
+
+    ThreadPool() {
+        InitializeCriticalSection(&access);
+        InitializeConditionVariable(&wakeUp);
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        maxCoreThreads = std::clamp((int)si.dwNumberOfProcessors, 1, POOL_MAX_THREADS);
+    }
+};
+
+// never deleted, as pool threads might still be running at exit
+static ThreadPool* GetThreadPool() {
+    static ThreadPool* pool = new ThreadPool();
+    return pool;
+}
+
+// the pool thread executing the current task (nullptr outside of the pool)
+static thread_local PoolThread* gCurrPoolThread = nullptr;
+
+static Vec<PoolTask*>& GetQueue(ThreadPool* pool, TaskPriority prio) {
+    return pool->queues[(int)prio];
+}
+
+// must be called within pool->access
+static PoolTask* TakeTask(ThreadPool* pool, PoolThread* self) {
+    Vec<PoolTask*>& high = GetQueue(pool, TaskPriority::High);
+    if (high.size() > 0) {
+        return high.PopAt(0);
+    }
+    if (self->local.size() > 0) {
+        return self->local.Pop();
+    }
+    Vec<PoolTask*>& normal = GetQueue(pool, TaskPriority::Normal);
+    if (normal.size() > 0) {
+        return normal.PopAt(0);
+    }
+    for (PoolThread* other : pool->threads) {
+        if (other != self && other->local.size() > 0) {
+            return other->local.PopAt(0);
+        }
+    }
+    Vec<PoolTask*>& low = GetQueue(pool, TaskPriority::Low);
+    if (self->isCore && low.size() > 0) {
+        return low.PopAt(0);
+    }
+    return nullptr;
 }
 
-DWORD WINAPI ThreadBase::ThreadProc(void* data) {
-    ThreadBase* thread = reinterpret_cast<ThreadBase*>(data);
-    if (thread->threadName) {
-        SetThreadName(GetCurrentThreadId(), thread->threadName);
+void RunPoolTask(PoolTask* task) {
+    TaskGroup* group = task->group;
+    if (!group || !group->WasCancelRequested()) {
+        bool lowerPriority = TaskPriority::Low == task->prio && gCurrPoolThread;
+        if (lowerPriority) {
+            SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+        }
+        task->func();
+        if (lowerPriority) {
+            SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+        }
+    }
+    if (task->done) {
+        SetEvent(task->done);
+        CloseHandle(task->done);
+    }
+    delete task;
+    // must come last, as this might allow the group to be deleted
+    if (group) {
+        group->TaskFinished();
     }
-    thread->Run();
+}
+
+static DWORD WINAPI PoolThreadProc(void* data) {
+    PoolThread* self = (PoolThread*)data;
+    ThreadPool* pool = GetThreadPool();
+    gCurrPoolThread = self;
+    SetThreadName(GetCurrentThreadId(), "PoolThread");
+
+    ScopedCritSec scope(&pool->access);
+    for (;;) {
+        PoolTask* task = TakeTask(pool, self);
+        if (task) {
+            LeaveCriticalSection(&pool->access);
+            RunPoolTask(task);
+            EnterCriticalSection(&pool->access);
+            continue;
+        }
+
+        self->isIdle = true;
+        pool->nIdle++;
+        pool->nIdleCore += self->isCore ? 1 : 0;
+        DWORD timeout = self->isCore ? INFINITE : POOL_IDLE_TIMEOUT_MS;
+        BOOL ok = SleepConditionVariableCS(&pool->wakeUp, &pool->access, timeout);
+        self->isIdle = false;
+        pool->nIdle--;
+        pool->nIdleCore -= self->isCore ? 1 : 0;
+        if (!ok && !self->isCore) {
+            // timed out (a task queued in the meantime is still taken first)
+            task = TakeTask(pool, self);
+            if (!task) {
+                break;
+            }
+            LeaveCriticalSection(&pool->access);
+            RunPoolTask(task);
+            EnterCriticalSection(&pool->access);
+        }
+    }
+
+    pool->threads.Remove(self);
+    CloseHandle(self->hThread);
+    delete self;
     return 0;
 }
 
-void ThreadBase::Start() {
-    CrashIf(hThread);
-    hThread = CreateThread(nullptr, 0, ThreadProc, this, 0, 0);
+// must be called within pool->access
+static void StartPoolThread(ThreadPool* pool) {
+    PoolThread* thread = new PoolThread();
+    thread->isCore = pool->nCoreThreads < pool->maxCoreThreads;
+    thread->hThread = CreateThread(nullptr, 0, PoolThreadProc, thread, 0, nullptr);
+    if (!thread->hThread) {
+        delete thread;
+        return;
+    }
+    pool->threads.Append(thread);
+    pool->nCoreThreads += thread->isCore ? 1 : 0;
 }
 
-bool ThreadBase::Join(DWORD waitMs) {
-    DWORD res = WaitForSingleObject(hThread, waitMs);
-    if (WAIT_OBJECT_0 == res) {
-        CloseHandle(hThread);
-        hThread = nullptr;
-        return true;
+static void QueuePoolTask(PoolTask* task) {
+    ThreadPool* pool = GetThreadPool();
+    ScopedCritSec scope(&pool->access);
+
+    bool isLow = TaskPriority::Low == task->prio;
+    if (task->group && !isLow && gCurrPoolThread) {
+        gCurrPoolThread->local.Append(task);
+    } else {
+        GetQueue(pool, task->prio).Append(task);
     }
-    return false;
+
+    if (pool->nCoreThreads < pool->maxCoreThreads) {
+        if ((isLow ? pool->nIdleCore : pool->nIdle) == 0) {
+            StartPoolThread(pool);
+        }
+    } else if (pool->nIdle == 0 && !isLow && !task->group && pool->threads.size() < POOL_MAX_THREADS) {
+        StartPoolThread(pool);
+    }
+    // wake all, as not every idle thread may take every task
+    WakeAllConditionVariable(&pool->wakeUp);
 }
 
-static DWORD WINAPI ThreadFunc(void* data) {
-    auto* func = reinterpret_cast<std::function<void()>*>(data);
-    (*func)();
-    delete func;
-    return 0;
+void RunAsync(const std::function<void()>& func, TaskPriority prio) {
+    PoolTask* task = new PoolTask();
+    task->func = func;
+    task->prio = prio;
+    QueuePoolTask(task);
 }
 
-void RunAsync(const std::function<void()>& func) {
-    auto fp = new std::function<void()>(func);
-    AutoCloseHandle h(CreateThread(nullptr, 0, ThreadFunc, fp, 0, 0));
+HANDLE RunAsyncWithHandle(const std::function<void()>& func, TaskPriority prio) {
+    HANDLE done = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!done) {
+        return nullptr;
+    }
+    PoolTask* task = new PoolTask();
+    task->func = func;
+    task->prio = prio;
+    HANDLE proc = GetCurrentProcess();
+    if (!DuplicateHandle(proc, done, proc, &task->done, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        CloseHandle(done);
+        delete task;
+        return nullptr;
+    }
+    QueuePoolTask(task);
+    return done;
+}
+
+TaskGroup::TaskGroup() {
+    InitializeCriticalSection(&access);
+    allDone = CreateEvent(nullptr, TRUE, TRUE, nullptr);
+}
+
+TaskGroup::~TaskGroup() {
+    Join();
+    // wait for TaskFinished to have left the critical section
+    EnterCriticalSection(&access);
+    LeaveCriticalSection(&access);
+    DeleteCriticalSection(&access);
+    CloseHandle(allDone);
+}
+
+void TaskGroup::Run(const std::function<void()>& func, TaskPriority prio) {
+    {
+        ScopedCritSec scope(&access);
+        if (0 == pending++) {
+            ResetEvent(allDone);
+        }
+    }
+    PoolTask* task = new PoolTask();
+    task->func = func;
+    task->prio = prio;
+    task->group = this;
+    QueuePoolTask(task);
+}
+
+void TaskGroup::TaskFinished() {
+    ScopedCritSec scope(&access);
+    CrashIf(pending <= 0);
+    if (0 == --pending) {
+        SetEvent(allDone);
+    }
+}
+
+void TaskGroup::RequestCancel() {
+    InterlockedIncrement(&cancelRequested);
+}
+
+bool TaskGroup::WasCancelRequested() {
+    LONG res = InterlockedAdd(&cancelRequested, 0);
+    return res > 0;
+}
+
+static PoolTask* RemoveGroupTask(Vec<PoolTask*>& tasks, TaskGroup* group) {
+    for (size_t i = 0; i < tasks.size(); i++) {
+        if (tasks.at(i)->group == group) {
+            return tasks.PopAt(i);
+        }
+    }
+    return nullptr;
+}
+
+bool TaskGroup::RunPending() {
+    ThreadPool* pool = GetThreadPool();
+    PoolTask* task = nullptr;
+    {
+        ScopedCritSec scope(&pool->access);
+        for (int i = 0; i < (int)dimof(pool->queues) && !task; i++) {
+            task = RemoveGroupTask(pool->queues[i], this);
+        }
+        for (size_t i = 0; i < pool->threads.size() && !task; i++) {
+            task = RemoveGroupTask(pool->threads.at(i)->local, this);
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    RunPoolTask(task);
+    return true;
+}
+
+bool TaskGroup::Join(DWORD waitMs) {
+    if (!gCurrPoolThread) {
+        return WaitForSingleObject(allDone, waitMs) == WAIT_OBJECT_0;
+    }
+    // on a pool thread, run queued tasks instead of blocking a thread
+    // the tasks might be waiting for
+    ULONGLONG start = GetTickCount64();
+    for (;;) {
+        if (WaitForSingleObject(allDone, 0) == WAIT_OBJECT_0) {
+            return true;
+        }
+        if (RunPending()) {
+            continue;
+        }
+        DWORD timeout = 10;
+        if (waitMs != INFINITE) {
+            ULONGLONG elapsed = GetTickCount64() - start;
+            if (elapsed >= waitMs) {
+                return false;
+            }
+            timeout = std::min(timeout, (DWORD)(waitMs - elapsed));
+        }
+        // tasks running elsewhere might queue further tasks, so check again regularly
+        if (WaitForSingleObject(allDone, timeout) == WAIT_OBJECT_0) {
+            return true;
+        }
+    }
+}
+
+ThreadBase::~ThreadBase() {
+    // lf("~ThreadBase() %d", threadNo);
+    CloseHandle(hDone);
+}
+
+void ThreadBase::Start() {
+    CrashIf(hDone);
+    // Run() might delete this object, so it mustn't be accessed afterwards
+    hDone = RunAsyncWithHandle([this] {
+        if (threadName) {
+            SetThreadName(GetCurrentThreadId(), threadName);
+        }
+        Run();
+        SetThreadName(GetCurrentThreadId(), "PoolThread");
+    });
+}
+
+bool ThreadBase::Join(DWORD waitMs) {
+    DWORD res = WaitForSingleObject(hDone, waitMs);
+    return WAIT_OBJECT_0 == res;
 }
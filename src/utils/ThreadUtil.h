@@ -19,14 +19,59 @@ struct Mutex {
     }
 };
 
+enum class TaskPriority {
+    // for work the user is waiting for, runs before all other queued tasks
+    High,
+    Normal,
+    // for background work (e.g. thumbnails), runs with lowered cpu and i/o
+    // priority and on at most one thread per processor
+    Low,
+};
+
+struct PoolTask;
+
+// a set of tasks run on the shared thread pool that can be canceled and waited for together
+// tasks queued from a pool thread are preferably run by that thread (in LIFO order)
+// while idle pool threads take them over from the other end (work stealing)
+class TaskGroup {
+  private:
+    CRITICAL_SECTION access;
+    HANDLE allDone = nullptr;
+    int pending = 0;
+    LONG cancelRequested = 0;
+
+    friend void RunPoolTask(PoolTask* task);
+    void TaskFinished();
+
+  public:
+    TaskGroup();
+    // waits for all tasks to finish
+    ~TaskGroup();
+
+    void Run(const std::function<void()>& func, TaskPriority prio = TaskPriority::Normal);
+
+    // tasks which haven't started yet are skipped, running tasks have
+    // to call WasCancelRequested() and stop processing if it returns true
+    void RequestCancel();
+    bool WasCancelRequested();
+
+    // runs one of the group's tasks that is still queued on the calling thread
+    // returns false if there's no such task
+    bool RunPending();
+
+    // synchronously waits for all tasks to end (helping to run them when called on a pool thread)
+    // returns true if all tasks finished and false if waiting timed out
+    bool Join(DWORD waitMs = INFINITE);
+};
+
 /* A very simple thread class that allows stopping a thread */
+// (Run() is executed on the shared thread pool)
 class ThreadBase {
   private:
     LONG cancelRequested = 0;
     int threadNo = 0;
-    HANDLE hThread = nullptr;
-
-    static DWORD WINAPI ThreadProc(void* data);
+    // signaled once Run() has returned
+    HANDLE hDone = nullptr;
 
   protected:
     // for debugging
@@ -69,4 +114,10 @@ class ThreadBase {
 
 void SetThreadName(DWORD threadId, const char* threadName);
 
-void RunAsync(const std::function<void()>&);
+// runs func on the shared thread pool which has one thread per processor
+// (and temporarily more while all of them are busy, so that a task never
+// has to wait for unrelated long running or blocked ones, except for Low priority tasks)
+void RunAsync(const std::function<void()>&, TaskPriority prio = TaskPriority::Normal);
+// like RunAsync but returns an event that is signaled once func has returned,
+// which can be used in place of a thread handle (the caller must close it)
+HANDLE RunAsyncWithHandle(const std::function<void()>&, TaskPriority prio = TaskPriority::Normal);
@@ -0,0 +1,90 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Trace.h"
+
+// a zone takes 24 bytes, so this is at most 24 MB
+constexpr int kMaxTraceEvents = 1024 * 1024;
+
+struct TraceEvent {
+    const char* name;
+    DWORD threadId;
+    LONGLONG start;
+    LONGLONG end;
+};
+
+bool gIsTracing = false;
+
+// protects all the following
+static Mutex gTraceMutex;
+static Vec<TraceEvent>* gTraceEvents = nullptr;
+static WCHAR* gTracePath = nullptr;
+static LARGE_INTEGER gTraceStart;
+static LARGE_INTEGER gTraceFreq;
+static int gTraceDropped = 0;
+
+void StartTracing(const WCHAR* path) {
+    gTraceMutex.Lock();
+    if (!gTraceEvents) {
+        gTraceEvents = new Vec<TraceEvent>(64 * 1024);
+        str::ReplacePtr(&gTracePath, path);
+        QueryPerformanceFrequency(&gTraceFreq);
+        QueryPerformanceCounter(&gTraceStart);
+        gIsTracing = true;
+    }
+    gTraceMutex.Unlock();
+}
+
+void TraceZone::End() {
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+    TraceEvent ev = {name, GetCurrentThreadId(), start.QuadPart, end.QuadPart};
+    gTraceMutex.Lock();
+    if (!gTraceEvents) {
+        // tracing was stopped in the meantime
+    } else if (gTraceEvents->isize() < kMaxTraceEvents) {
+        gTraceEvents->Append(ev);
+    } else {
+        gTraceDropped++;
+    }
+    gTraceMutex.Unlock();
+}
+
+static double TraceTimeUs(LONGLONG t) {
+    return (double)(t - gTraceStart.QuadPart) * 1000000.0 / (double)gTraceFreq.QuadPart;
+}
+
+// "X" events are complete events with a start and a duration
+// (cf. https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU)
+bool StopTracing() {
+    gTraceMutex.Lock();
+    gIsTracing = false;
+    Vec<TraceEvent>* events = gTraceEvents;
+    gTraceEvents = nullptr;
+    WCHAR* path = gTracePath;
+    gTracePath = nullptr;
+    int nDropped = gTraceDropped;
+    gTraceMutex.Unlock();
+    if (!events) {
+        return false;
+    }
+
+    DWORD pid = GetCurrentProcessId();
+    str::Str s(events->size() * 96 + 256);
+    s.Append("{\"traceEvents\": [");
+    for (size_t i = 0; i < events->size(); i++) {
+        TraceEvent& ev = events->at(i);
+        double ts = TraceTimeUs(ev.start);
+        double dur = TraceTimeUs(ev.end) - ts;
+        s.AppendFmt("%s\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %u, \"tid\": %u}",
+                    i > 0 ? "," : "", ev.name, ts, dur, pid, ev.threadId);
+    }
+    s.AppendFmt("\n], \"otherData\": {\"droppedZones\": %d}}\n", nDropped);
+    bool ok = file::WriteFile(path, s.AsSpan());
+    delete events;
+    free(path);
+    return ok;
+}
@@ -0,0 +1,40 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// lightweight tracing of where the time goes:
+//   TRACE_ZONE("RenderPage");
+// times the rest of the enclosing scope. Zones are only collected between
+// StartTracing() and StopTracing(), which writes them as a Chrome trace event
+// file (viewable in chrome://tracing or https://ui.perfetto.dev/).
+// Defining DISABLE_TRACING compiles all zones out.
+
+extern bool gIsTracing;
+
+void StartTracing(const WCHAR* path);
+// writes the zones collected so far, returns false on failure
+bool StopTracing();
+
+struct TraceZone {
+    // must be a string literal (or otherwise outlive tracing)
+    const char* name = nullptr;
+    LARGE_INTEGER start{};
+
+    explicit TraceZone(const char* name) : name(name) {
+        if (gIsTracing) {
+            QueryPerformanceCounter(&start);
+        }
+    }
+    ~TraceZone() {
+        if (gIsTracing && start.QuadPart != 0) {
+            End();
+        }
+    }
+
+    void End();
+};
+
+#if defined(DISABLE_TRACING)
+#define TRACE_ZONE(name)
+#else
+#define TRACE_ZONE(name) TraceZone CONCAT(traceZone__, __LINE__)(name)
+#endif
@@ -10,19 +10,115 @@ namespace uitask {
 static HWND gTaskDispatchHwnd = nullptr;
 
 #define UITASK_CLASS_NAME L"UITask_Wnd_Class"
-#define WM_EXECUTE_TASK (WM_USER + 104)
+#define WM_EXECUTE_TASKS (WM_USER + 104)
+
+// max number of unused Task objects kept for reuse
+#define MAX_FREE_TASKS 256
+// max number of coalesced tasks queued at the same time (further ones aren't coalesced)
+#define MAX_PENDING_KEYS 32
+
+// Tasks are pushed onto a lock-free list by any thread and executed in batches on
+// the ui thread, which is only sent a message when it isn't about to drain the list anyway.
+// Task objects are reused and std::function stores small lambdas inline, so that posting
+// a task usually doesn't allocate.
+struct Task {
+    SLIST_ENTRY entry; // must be the first member
+    std::function<void()> func;
+    // index in gPendingKeys for coalesced tasks
+    int keyIdx = -1;
+    // for the ui thread's batch
+    Task* next = nullptr;
+};
+
+static SLIST_HEADER gQueue;
+static SLIST_HEADER gFreeTasks;
+static LONG gWakeUpPosted = 0;
+// keys of queued tasks posted with PostCoalesced
+static PVOID volatile gPendingKeys[MAX_PENDING_KEYS];
+
+// tasks taken from gQueue but not executed yet, in posting order
+// (only accessed on the ui thread; tasks might pump messages and
+// thus execute further tasks before the current batch is done)
+static Task* gBatchFirst = nullptr;
+static Task* gBatchLast = nullptr;
+
+static Task* AllocTask(const std::function<void()>& f) {
+    Task* task = (Task*)InterlockedPopEntrySList(&gFreeTasks);
+    if (!task) {
+        task = new Task();
+    }
+    task->func = f;
+    return task;
+}
+
+static void FreeTask(Task* task) {
+    task->func = nullptr;
+    task->keyIdx = -1;
+    task->next = nullptr;
+    if (QueryDepthSList(&gFreeTasks) >= MAX_FREE_TASKS) {
+        delete task;
+        return;
+    }
+    InterlockedPushEntrySList(&gFreeTasks, &task->entry);
+}
+
+static void PushTask(Task* task) {
+    InterlockedPushEntrySList(&gQueue, &task->entry);
+    if (InterlockedExchange(&gWakeUpPosted, 1) == 0) {
+        PostMessageW(gTaskDispatchHwnd, WM_EXECUTE_TASKS, 0, 0);
+    }
+}
+
+static void ExecuteTasks() {
+    // reset before taking the tasks, so that tasks posted afterwards post a new message
+    InterlockedExchange(&gWakeUpPosted, 0);
+    // the list is in LIFO order, so reverse it before appending it to the batch
+    Task* first = nullptr;
+    Task* last = nullptr;
+    for (PSLIST_ENTRY e = InterlockedFlushSList(&gQueue); e; e = e->Next) {
+        Task* task = (Task*)e;
+        task->next = first;
+        first = task;
+        if (!last) {
+            last = task;
+        }
+    }
+    if (first) {
+        if (gBatchLast) {
+            gBatchLast->next = first;
+        } else {
+            gBatchFirst = first;
+        }
+        gBatchLast = last;
+    }
+
+    while (gBatchFirst) {
+        Task* task = gBatchFirst;
+        gBatchFirst = task->next;
+        if (!gBatchFirst) {
+            gBatchLast = nullptr;
+        }
+        if (task->keyIdx >= 0) {
+            // tasks posted from now on have to be executed again
+            InterlockedExchangePointer(&gPendingKeys[task->keyIdx], nullptr);
+        }
+        task->func();
+        FreeTask(task);
+    }
+}
 
 static LRESULT CALLBACK WndProcTaskDispatch(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) {
-    if (WM_EXECUTE_TASK == msg) {
-        auto func = (std::function<void()>*)lp;
-        (*func)();
-        delete func;
+    if (WM_EXECUTE_TASKS == msg) {
+        ExecuteTasks();
         return 0;
     }
     return DefWindowProc(hwnd, msg, wp, lp);
 }
 
 void Initialize() {
+    InitializeSListHead(&gQueue);
+    InitializeSListHead(&gFreeTasks);
+
     WNDCLASSEX wcex;
     FillWndClassEx(wcex, UITASK_CLASS_NAME, WndProcTaskDispatch);
     RegisterClassEx(&wcex);
@@ -35,9 +131,10 @@ void Initialize() {
 void DrainQueue() {
     CrashIf(!gTaskDispatchHwnd);
     MSG msg;
-    while (PeekMessage(&msg, gTaskDispatchHwnd, WM_EXECUTE_TASK, WM_EXECUTE_TASK, PM_REMOVE)) {
+    while (PeekMessage(&msg, gTaskDispatchHwnd, WM_EXECUTE_TASKS, WM_EXECUTE_TASKS, PM_REMOVE)) {
         DispatchMessage(&msg);
     }
+    ExecuteTasks();
 }
 
 void Destroy() {
@@ -47,8 +144,23 @@ void Destroy() {
 }
 
 void Post(const std::function<void()>& f) {
-    auto func = new std::function<void()>(f);
-    PostMessageW(gTaskDispatchHwnd, WM_EXECUTE_TASK, 0, (LPARAM)func);
+    PushTask(AllocTask(f));
+} // NOLINT
+
+void PostCoalesced(const void* key, const std::function<void()>& f) {
+    for (int i = 0; i < MAX_PENDING_KEYS; i++) {
+        if (gPendingKeys[i] == key) {
+            return;
+        }
+    }
+    Task* task = AllocTask(f);
+    for (int i = 0; i < MAX_PENDING_KEYS; i++) {
+        if (!InterlockedCompareExchangePointer(&gPendingKeys[i], (PVOID)key, nullptr)) {
+            task->keyIdx = i;
+            break;
+        }
+    }
+    PushTask(task);
 } // NOLINT
 
 void PostOptimized(const std::function<void()>& f) {
@@ -58,8 +170,7 @@ void PostOptimized(const std::function<void()>& f) {
         f();
         return;
     }
-    auto func = new std::function<void()>(f);
-    PostMessageW(gTaskDispatchHwnd, WM_EXECUTE_TASK, 0, (LPARAM)func);
+    PushTask(AllocTask(f));
 } // NOLINT
 
 } // namespace uitask
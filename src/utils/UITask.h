@@ -10,6 +10,10 @@ void Destroy();
 // call only from the same thread as Initialize() and Destroy()
 void DrainQueue();
 
+// tasks are executed in the order they've been posted
 void Post(const std::function<void()>&);
+// like Post, but does nothing if a task posted with the same key hasn't been executed yet
+// (for idempotent tasks such as repainting a window)
+void PostCoalesced(const void* key, const std::function<void()>&);
 void PostOptimized(const std::function<void()>& f);
 } // namespace uitask
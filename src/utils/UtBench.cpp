@@ -0,0 +1,28 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/Timer.h"
+#include "utils/UtBench.h"
+
+const void* volatile gUtBenchSink = nullptr;
+
+static const char* gFilter = nullptr;
+
+// only benchmarks whose name contains filter (case-insensitive) will run
+void utbench_set_filter(const char* filter) {
+    gFilter = filter;
+}
+
+bool utbench_is_enabled(const char* name) {
+    return !gFilter || str::FindI(name, gFilter) != nullptr;
+}
+
+void utbench_report(const char* name, double nsPerCall, size_t bytesPerCall) {
+    if (bytesPerCall == 0) {
+        printf("%-36s %12.1f ns\n", name, nsPerCall);
+        return;
+    }
+    double mbPerSec = (double)bytesPerCall / nsPerCall * 1e9 / (1024 * 1024);
+    printf("%-36s %12.1f ns %10.1f MB/s\n", name, nsPerCall, mbPerSec);
+}
@@ -0,0 +1,61 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+/* Micro-benchmarks for test_util.exe -bench [<name filter>].
+
+   utbench("str::Len", len, [&] { DoNotOptimize(str::Len(s)); });
+
+calls the function in batches, growing the batch until it takes long
+enough to be timed reliably, and prints the fastest time per call out of
+several batches (and the throughput, if the number of bytes processed
+per call is given). Needs utils/Timer.h. */
+
+void utbench_set_filter(const char* filter);
+bool utbench_is_enabled(const char* name);
+void utbench_report(const char* name, double nsPerCall, size_t bytesPerCall);
+
+extern const void* volatile gUtBenchSink;
+
+// makes the compiler assume that v is used, so that computing it can't be optimized away
+template <typename T>
+inline void DoNotOptimize(const T& v) {
+    gUtBenchSink = &v;
+    _ReadWriteBarrier();
+}
+
+// makes the compiler assume that all memory might have been read and written
+inline void ClobberMemory() {
+    _ReadWriteBarrier();
+}
+
+template <typename Fn>
+void utbench(const char* name, size_t bytesPerCall, const Fn& fn) {
+    if (!utbench_is_enabled(name)) {
+        return;
+    }
+    const double minBatchMs = 20;
+    const int nBatches = 5;
+
+    i64 n = 1;
+    double ms;
+    for (;;) {
+        auto t = TimeGet();
+        for (i64 i = 0; i < n; i++) {
+            fn();
+        }
+        ms = TimeSinceInMs(t);
+        if (ms >= minBatchMs || n >= ((i64)1 << 40)) {
+            break;
+        }
+        n *= ms < minBatchMs / 10 ? 10 : 2;
+    }
+    double best = ms;
+    for (int i = 1; i < nBatches; i++) {
+        auto t = TimeGet();
+        for (i64 j = 0; j < n; j++) {
+            fn();
+        }
+        best = std::min(best, TimeSinceInMs(t));
+    }
+    utbench_report(name, best * 1e6 / (double)n, bytesPerCall);
+}
@@ -11,16 +11,22 @@ We always pad the elements with a single 0 value. This makes
 Vec<char> and Vec<WCHAR> a C-compatible string. Although it's
 not useful for other types, the code is simpler if we always do it
 (rather than have it an optional behavior).
+
+The first kInlineCount - 1 elements are stored inline, so that small
+vectors don't allocate at all. Use a smaller kInlineCount for large
+elements or for vectors that are known to always grow bigger.
 */
-template <typename T>
+template <typename T, size_t kInlineCount = 16>
 class Vec {
+    static_assert(kInlineCount >= 1, "Vec needs space for the padding");
+
   public:
     Allocator* allocator{nullptr};
     size_t len{0};
     size_t cap{0};
     size_t capacityHint{0};
     T* els{nullptr};
-    T buf[16];
+    T buf[kInlineCount];
 
     static constexpr size_t kPadding = 1;
     static constexpr size_t kBufSize = sizeof(buf);
@@ -89,6 +95,21 @@ class Vec {
         }
     }
 
+    // takes over the elements of orig (which is reset)
+    void MoveFrom(Vec& orig) {
+        if (orig.els != orig.buf && orig.allocator == allocator) {
+            els = orig.els;
+            cap = orig.cap;
+            len = orig.len;
+            orig.els = orig.buf;
+        } else if (EnsureCap(orig.len)) {
+            // using memcpy, as Vec only supports POD types
+            memcpy(els, orig.els, kElSize * orig.len);
+            len = orig.len;
+        }
+        orig.Reset();
+    }
+
   public:
     // allocator is not owned by Vec and must outlive it
     explicit Vec(size_t capHint = 0, Allocator* allocator = nullptr) : capacityHint(capHint), allocator(allocator) {
@@ -105,12 +126,19 @@ class Vec {
     Vec(const Vec& orig) {
         els = buf;
         Reset();
-        EnsureCap(orig.cap);
+        EnsureCap(orig.len);
         len = orig.len;
         // using memcpy, as Vec only supports POD types
         memcpy(els, orig.els, kElSize * (orig.len));
     }
 
+    // unlike copying, moving keeps the allocator (and its allocation)
+    Vec(Vec&& orig) noexcept : allocator(orig.allocator), capacityHint(orig.capacityHint) {
+        els = buf;
+        Reset();
+        MoveFrom(orig);
+    }
+
     // this frees all elements and clears the array.
     // only applicable where T is a pointer. Otherwise will fail to compile
     void FreeMembers() {
@@ -123,7 +151,7 @@ class Vec {
 
     Vec& operator=(const Vec& that) {
         if (this != &that) {
-            EnsureCap(that.cap);
+            EnsureCap(that.len);
             // using memcpy, as Vec only supports POD types
             memcpy(els, that.els, kElSize * (len = that.len));
             memset(els + len, 0, kElSize * (cap - len));
@@ -131,6 +159,14 @@ class Vec {
         return *this;
     }
 
+    Vec& operator=(Vec&& that) noexcept {
+        if (this != &that) {
+            Reset();
+            MoveFrom(that);
+        }
+        return *this;
+    }
+
     [[nodiscard]] T& operator[](size_t idx) const {
         CrashIf(idx >= len);
         return els[idx];
@@ -166,6 +202,12 @@ class Vec {
         return MakeSpaceAt(0, newSize);
     }
 
+    // makes room for at least n elements without further reallocations
+    // (use when the final size is known, to avoid growing step by step)
+    bool Reserve(size_t n) {
+        return EnsureCap(n);
+    }
+
     [[nodiscard]] T& at(size_t idx) const {
         CrashIf(idx >= len);
         return els[idx];
@@ -363,8 +405,8 @@ class Vec {
 };
 
 // only suitable for T that are pointers to C++ objects
-template <typename T>
-inline void DeleteVecMembers(Vec<T>& v) {
+template <typename T, size_t kInlineCount>
+inline void DeleteVecMembers(Vec<T, kInlineCount>& v) {
     for (T& el : v) {
         delete el;
     }
@@ -4,6 +4,11 @@
 #include "utils/BaseUtil.h"
 #include "utils/Dpi.h"
 #include <mlang.h>
+#if defined(_M_IX86) || defined(_M_X64)
+// SSE2 is available on all processors we support
+#include <emmintrin.h>
+#define HAS_SSE2 1
+#endif
 
 #include "utils/BitManip.h"
 #include "utils/ScopedWin.h"
@@ -1111,6 +1116,14 @@ void DoubleBuffer::Flush(HDC hdc) {
     }
 }
 
+// only copies the part of the buffer that covers area (in target coordinates)
+void DoubleBuffer::Flush(HDC hdc, Rect area) {
+    CrashIf(hdc == hdcBuffer);
+    if (hdcBuffer) {
+        BitBlt(hdc, area.x, area.y, area.dx, area.dy, hdcBuffer, area.x - rect.x, area.y - rect.y, SRCCOPY);
+    }
+}
+
 DeferWinPosHelper::DeferWinPosHelper() {
     hdwp = ::BeginDeferWindowPos(32);
 }
@@ -1299,6 +1312,30 @@ std::span<u8> GetStreamOrFileData(IStream* stream, const WCHAR* filePath) {
     return file::ReadFile(filePath);
 }
 
+// returns the content of a stream created with CreateStreamOnHGlobal (such as
+// those from CreateStreamFromData) without copying it or an empty span for other
+// streams. The data is only valid as long as the stream isn't written to or released.
+std::span<u8> GetStreamMemory(IStream* stream) {
+    HGLOBAL hmem = nullptr;
+    if (!stream || FAILED(GetHGlobalFromStream(stream, &hmem))) {
+        return {};
+    }
+    STATSTG stat;
+    if (FAILED(stream->Stat(&stat, STATFLAG_NONAME)) || stat.cbSize.QuadPart == 0) {
+        return {};
+    }
+    if (stat.cbSize.QuadPart > (ULONGLONG)GlobalSize(hmem)) {
+        return {};
+    }
+    // the memory of such streams is only ever moved when the stream grows
+    u8* data = (u8*)GlobalLock(hmem);
+    GlobalUnlock(hmem);
+    if (!data) {
+        return {};
+    }
+    return {data, (size_t)stat.cbSize.QuadPart};
+}
+
 bool ReadDataFromStream(IStream* stream, void* buffer, size_t len, size_t offset) {
     LARGE_INTEGER off;
     off.QuadPart = offset;
@@ -1487,6 +1524,41 @@ inline int mul255(int a, int b) {
     return x >> 8;
 }
 
+#ifdef HAS_SSE2
+// mul255 for 8 16-bit values a (0...255) and b (-255...255),
+// using 32-bit intermediates so that the result is identical
+static inline __m128i mul255_sse2(__m128i a, __m128i b) {
+    __m128i round = _mm_set1_epi32(128);
+    __m128i lo = _mm_mullo_epi16(a, b);
+    __m128i hi = _mm_mulhi_epi16(a, b);
+    __m128i x1 = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round);
+    __m128i x2 = _mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round);
+    x1 = _mm_srai_epi32(_mm_add_epi32(x1, _mm_srai_epi32(x1, 8)), 8);
+    x2 = _mm_srai_epi32(_mm_add_epi32(x2, _mm_srai_epi32(x2, 8)), 8);
+    return _mm_packs_epi32(x1, x2);
+}
+
+// processes 4 pixels per iteration, returns the number of bytes updated
+static int UpdateColorsSSE2(u8* data, int nBytes, const int base[4], const int diff[4]) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i base2 = _mm_setr_epi16((short)base[0], (short)base[1], (short)base[2], (short)base[3], (short)base[0],
+                                   (short)base[1], (short)base[2], (short)base[3]);
+    __m128i diff2 = _mm_setr_epi16((short)diff[0], (short)diff[1], (short)diff[2], (short)diff[3], (short)diff[0],
+                                   (short)diff[1], (short)diff[2], (short)diff[3]);
+    int i = 0;
+    for (; i + 16 <= nBytes; i += 16) {
+        __m128i px = _mm_loadu_si128((__m128i*)(data + i));
+        __m128i px1 = _mm_unpacklo_epi8(px, zero);
+        __m128i px2 = _mm_unpackhi_epi8(px, zero);
+        px1 = _mm_add_epi16(base2, mul255_sse2(px1, diff2));
+        px2 = _mm_add_epi16(base2, mul255_sse2(px2, diff2));
+        // results are always within 0...255, so saturation doesn't change them
+        _mm_storeu_si128((__m128i*)(data + i), _mm_packus_epi16(px1, px2));
+    }
+    return i;
+}
+#endif
+
 void FinalizeBitmapPixels(BitmapPixels* bitmapPixels) {
     HDC hdc = bitmapPixels->hdc;
     if (hdc) {
@@ -1600,9 +1672,15 @@ void UpdateBitmapColors(HBITMAP hbmp, COLORREF textColor, COLORREF bgColor) {
         size.dx * 4 == info.dsBm.bmWidthBytes) {
         int bmpBytes = size.dx * size.dy * 4;
         u8* bmpData = (u8*)info.dsBm.bmBits;
-        for (int i = 0; i < bmpBytes; i++) {
-            int k = i % 4;
-            bmpData[i] = (u8)(base[k] + mul255(bmpData[i], diff[k]));
+        int i = 0;
+#ifdef HAS_SSE2
+        i = UpdateColorsSSE2(bmpData, bmpBytes, base, diff);
+#endif
+        for (; i < bmpBytes; i += 4) {
+            bmpData[i] = (u8)(base[0] + mul255(bmpData[i], diff[0]));
+            bmpData[i + 1] = (u8)(base[1] + mul255(bmpData[i + 1], diff[1]));
+            bmpData[i + 2] = (u8)(base[2] + mul255(bmpData[i + 2], diff[2]));
+            bmpData[i + 3] = (u8)(base[3] + mul255(bmpData[i + 3], diff[3]));
         }
         return;
     }
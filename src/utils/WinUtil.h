@@ -128,6 +128,7 @@ HFONT GetDefaultGuiFontOfSize(int size);
 IStream* CreateStreamFromData(std::span<u8>);
 std::span<u8> GetDataFromStream(IStream* stream, HRESULT* resOpt);
 std::span<u8> GetStreamOrFileData(IStream* stream, const WCHAR* filePath);
+std::span<u8> GetStreamMemory(IStream* stream);
 bool ReadDataFromStream(IStream* stream, void* buffer, size_t len, size_t offset = 0);
 uint GuessTextCodepage(const char* data, size_t len, uint defVal = CP_ACP);
 WCHAR* NormalizeString(const WCHAR* str, int /* NORM_FORM */ form);
@@ -200,6 +201,7 @@ struct DoubleBuffer {
 
     HDC GetDC() const;
     void Flush(HDC hdc);
+    void Flush(HDC hdc, Rect area);
 };
 
 class DeferWinPosHelper {
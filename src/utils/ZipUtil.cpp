@@ -9,6 +9,7 @@
 #include "utils/ScopedWin.h"
 #include "utils/DirIter.h"
 #include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
 
 extern "C" {
 #include <unarr.h>
@@ -80,7 +81,41 @@ bool ZipCreator::WriteData(const void* data, size_t size) {
     return true;
 }
 
-static u32 zip_compress(void* dst, u32 dstlen, const void* src, u32 srclen) {
+// files bigger than this are split into chunks which are deflated in parallel
+#define ZIP_CHUNK_SIZE (1024 * 1024)
+
+// a file being added, read and compressed on a worker thread before
+// it's written out in order by ZipCreator::WriteEntry
+struct ZipEntry {
+    AutoFree nameUtf8;
+    const WCHAR* filePath = nullptr;
+    // owned if read from filePath
+    AutoFree fileData;
+    const u8* data = nullptr;
+    size_t size = 0;
+    u32 dosdate = 0;
+
+    u32 crc = 0;
+    u16 method = 0; // Store
+    u8* compressed = nullptr;
+    u32 compressedSize = 0;
+    bool ok = false;
+
+    // signaled once the entry has been compressed on the thread pool
+    HANDLE hDone = nullptr;
+
+    ~ZipEntry() {
+        free(compressed);
+        if (hDone) {
+            CloseHandle(hDone);
+        }
+    }
+};
+
+// all but the last chunk of a file are ended with a full flush instead of Z_FINISH
+// which byte-aligns the output and resets the compressor, so that the chunks
+// can be compressed independently and the results simply concatenated
+static u32 zip_compress(void* dst, u32 dstlen, const void* src, u32 srclen, bool isLastChunk = true) {
     z_stream stream = {0};
     stream.next_in = (Bytef*)src;
     stream.avail_in = srclen;
@@ -92,55 +127,171 @@ static u32 zip_compress(void* dst, u32 dstlen, const void* src, u32 srclen) {
     if (err != Z_OK) {
         return 0;
     }
-    err = deflate(&stream, Z_FINISH);
-    if (Z_STREAM_END == err) {
-        newdstlen = stream.total_out;
+    if (isLastChunk) {
+        err = deflate(&stream, Z_FINISH);
+        if (Z_STREAM_END == err) {
+            newdstlen = stream.total_out;
+        }
+    } else {
+        err = deflate(&stream, Z_FULL_FLUSH);
+        // if there's no space left, the flush might not have completed
+        if (Z_OK == err && 0 == stream.avail_in && stream.avail_out > 0) {
+            newdstlen = stream.total_out;
+        }
     }
     err = deflateEnd(&stream);
-    if (err != Z_OK) {
+    // deflateEnd complains about the unfinished stream of a flushed chunk
+    if (err != Z_OK && isLastChunk) {
         return 0;
     }
     return newdstlen;
 }
 
-bool ZipCreator::AddFileData(const char* nameUtf8, const void* data, size_t size, u32 dosdate) {
-    CrashIf(size >= UINT32_MAX);
-    CrashIf(str::Len(nameUtf8) >= UINT16_MAX);
-    if (size >= UINT32_MAX) {
-        return false;
+struct ZipChunk {
+    size_t offset = 0;
+    u32 size = 0;
+    u32 crc = 0;
+    u32 compressedSize = 0;
+};
+
+// large files are compressed in chunks on the thread pool, each of them
+// into the part of the output buffer the uncompressed chunk would take
+static bool CompressZipEntryChunks(ZipEntry* e, u8* dst) {
+    size_t nChunks = (e->size + ZIP_CHUNK_SIZE - 1) / ZIP_CHUNK_SIZE;
+    Vec<ZipChunk> chunks;
+    chunks.Reserve(nChunks);
+    for (size_t i = 0; i < nChunks; i++) {
+        ZipChunk chunk;
+        chunk.offset = i * ZIP_CHUNK_SIZE;
+        chunk.size = (u32)std::min(e->size - chunk.offset, (size_t)ZIP_CHUNK_SIZE);
+        chunks.Append(chunk);
+    }
+
+    TaskGroup tasks;
+    for (size_t i = 0; i < nChunks; i++) {
+        ZipChunk* chunk = &chunks.at(i);
+        bool isLast = i == nChunks - 1;
+        tasks.Run([e, dst, chunk, isLast] {
+            const u8* src = e->data + chunk->offset;
+            chunk->crc = crc32(0, src, chunk->size);
+            chunk->compressedSize = zip_compress(dst + chunk->offset, chunk->size, src, chunk->size, isLast);
+        });
+    }
+    tasks.Join();
+
+    u32 crc = 0;
+    size_t compressedSize = 0;
+    bool ok = true;
+    for (ZipChunk& chunk : chunks) {
+        crc = crc32_combine(crc, chunk.crc, chunk.size);
+        if (0 == chunk.compressedSize) {
+            ok = false;
+            continue;
+        }
+        memmove(dst + compressedSize, dst + chunk.offset, chunk.compressedSize);
+        compressedSize += chunk.compressedSize;
+    }
+    e->crc = crc;
+    e->compressedSize = (u32)compressedSize;
+    return ok && compressedSize < e->size;
+}
+
+static void CompressZipEntry(ZipEntry* e) {
+    CrashIf(e->size >= UINT32_MAX);
+    if (e->size >= UINT32_MAX) {
+        return;
+    }
+
+    e->compressed = (u8*)malloc(e->size);
+    if (!e->compressed && e->size > 0) {
+        return;
+    }
+    bool ok;
+    if (e->size > ZIP_CHUNK_SIZE) {
+        ok = CompressZipEntryChunks(e, e->compressed);
+    } else {
+        e->crc = crc32(0, e->data, (uInt)e->size);
+        e->compressedSize = zip_compress(e->compressed, (u32)e->size, e->data, (u32)e->size);
+        ok = e->compressedSize != 0;
+    }
+    if (ok) {
+        e->method = Z_DEFLATED;
+    } else {
+        // Store
+        e->method = 0;
+        e->compressedSize = (u32)e->size;
+    }
+    e->ok = true;
+}
+
+static u32 GetFileDosDateTime(const WCHAR* filePath) {
+    FILETIME ft = file::GetModificationTime(filePath);
+    if (!ft.dwLowDateTime && !ft.dwHighDateTime) {
+        return 0;
+    }
+    FILETIME ftLocal;
+    WORD dosDate, dosTime;
+    if (!FileTimeToLocalFileTime(&ft, &ftLocal) || !FileTimeToDosDateTime(&ftLocal, &dosDate, &dosTime)) {
+        return 0;
+    }
+    return MAKELONG(dosTime, dosDate);
+}
+
+static void ReadAndCompressZipEntry(ZipEntry* e) {
+    e->fileData.Set(file::ReadFile(e->filePath));
+    if (!e->fileData.data) {
+        return;
+    }
+    e->data = (const u8*)e->fileData.data;
+    e->size = e->fileData.size();
+    e->dosdate = GetFileDosDateTime(e->filePath);
+    CompressZipEntry(e);
+}
+
+static char* GetZipName(const WCHAR* filePath, const WCHAR* nameInZip) {
+    if (!nameInZip) {
+        nameInZip = path::IsAbsolute(filePath) ? path::GetBaseNameNoFree(filePath) : filePath;
+    }
+    char* nameUtf8 = (char*)strconv::WstrToUtf8(nameInZip).data();
+    str::TransChars(nameUtf8, "\\", "/");
+    return nameUtf8;
+}
+
+// we use the filePath relative to dir as the zip name
+static const WCHAR* GetNameInDir(const WCHAR* filePath, const WCHAR* dir) {
+    if (str::IsEmpty(dir) || !str::StartsWith(filePath, dir)) {
+        return nullptr;
+    }
+    const WCHAR* nameInZip = filePath + str::Len(dir) + 1;
+    if (!path::IsSep(nameInZip[-1])) {
+        return nullptr;
     }
+    return nameInZip;
+}
 
+bool ZipCreator::WriteEntry(ZipEntry* e) {
+    if (!e->ok) {
+        return false;
+    }
     size_t fileOffset = bytesWritten;
     u16 flags = (1 << 11); // filename is UTF-8
-    uInt crc = crc32(0, (const Bytef*)data, (uInt)size);
+    const char* nameUtf8 = e->nameUtf8.Get();
     size_t namelen = str::Len(nameUtf8);
+    CrashIf(namelen >= UINT16_MAX);
     if (namelen >= UINT16_MAX) {
         return false;
     }
 
-    u16 method = Z_DEFLATED;
-    uLongf compressedSize = (u32)size;
-    AutoFree compressed((char*)malloc(size));
-    if (!compressed) {
-        return false;
-    }
-    compressedSize = zip_compress(compressed, (u32)size, data, (u32)size);
-    if (!compressedSize) {
-        method = 0; // Store
-        memcpy(compressed.Get(), data, size);
-        compressedSize = (u32)size;
-    }
-
     constexpr size_t kHdrSize = 30;
     ByteWriterLE local(kHdrSize);
     local.Write32(0x04034B50); // signature
     local.Write16(20);         // version needed to extract
     local.Write16(flags);
-    local.Write16(method);
-    local.Write32(dosdate);
-    local.Write32(crc);
-    local.Write32(compressedSize);
-    local.Write32((u32)size);
+    local.Write16(e->method);
+    local.Write32(e->dosdate);
+    local.Write32(e->crc);
+    local.Write32(e->compressedSize);
+    local.Write32((u32)e->size);
     local.Write16((u16)namelen);
     local.Write16(0); // extra field length
     CrashIf(local.d.size() != kHdrSize);
@@ -148,7 +299,11 @@ bool ZipCreator::AddFileData(const char* nameUtf8, const void* data, size_t size
     char* localHeader = local.d.Get();
     bool ok = WriteData(localHeader, kHdrSize);
     ok = ok && WriteData(nameUtf8, namelen);
-    ok = ok && WriteData(compressed, compressedSize);
+    if (Z_DEFLATED == e->method) {
+        ok = ok && WriteData(e->compressed, e->compressedSize);
+    } else {
+        ok = ok && WriteData(e->data, e->size);
+    }
 
     constexpr size_t kCentralSize = 46;
     ByteWriterLE central(kCentralSize);
@@ -156,11 +311,11 @@ bool ZipCreator::AddFileData(const char* nameUtf8, const void* data, size_t size
     central.Write16(20);         // version made by
     central.Write16(20);         // version needed to extract
     central.Write16(flags);
-    central.Write16(method);
-    central.Write32(dosdate);
-    central.Write32(crc);
-    central.Write32(compressedSize);
-    central.Write32((u32)size);
+    central.Write16(e->method);
+    central.Write32(e->dosdate);
+    central.Write32(e->crc);
+    central.Write32(e->compressedSize);
+    central.Write32((u32)e->size);
     central.Write16((u16)namelen);
     central.Write16(0); // extra field length
     central.Write16(0); // file comment length
@@ -177,53 +332,85 @@ bool ZipCreator::AddFileData(const char* nameUtf8, const void* data, size_t size
     return ok;
 }
 
+bool ZipCreator::AddFileData(const char* nameUtf8, const void* data, size_t size, u32 dosdate) {
+    ZipEntry e;
+    e.nameUtf8.SetCopy(nameUtf8);
+    e.data = (const u8*)data;
+    e.size = size;
+    e.dosdate = dosdate;
+    CompressZipEntry(&e);
+    return WriteEntry(&e);
+}
+
 // add a given file under (optional) nameInZip
 bool ZipCreator::AddFile(const WCHAR* filePath, const WCHAR* nameInZip) {
-    AutoFree fileData = file::ReadFile(filePath);
-    if (!fileData.data) {
-        return false;
-    }
-
-    u32 dosdatetime = 0;
-    FILETIME ft = file::GetModificationTime(filePath);
-    if (ft.dwLowDateTime || ft.dwHighDateTime) {
-        FILETIME ftLocal;
-        WORD dosDate, dosTime;
-        if (FileTimeToLocalFileTime(&ft, &ftLocal) && FileTimeToDosDateTime(&ftLocal, &dosDate, &dosTime)) {
-            dosdatetime = MAKELONG(dosTime, dosDate);
-        }
-    }
-
-    if (!nameInZip) {
-        nameInZip = path::IsAbsolute(filePath) ? path::GetBaseNameNoFree(filePath) : filePath;
-    }
-
-    AutoFree nameUtf8 = strconv::WstrToUtf8(nameInZip);
-    str::TransChars(nameUtf8.Get(), "\\", "/");
-
-    return AddFileData(nameUtf8.Get(), fileData.Get(), fileData.size(), dosdatetime);
+    ZipEntry e;
+    e.filePath = filePath;
+    e.nameUtf8.Set(GetZipName(filePath, nameInZip));
+    ReadAndCompressZipEntry(&e);
+    return WriteEntry(&e);
 }
 
-// we use the filePath relative to dir as the zip name
 bool ZipCreator::AddFileFromDir(const WCHAR* filePath, const WCHAR* dir) {
-    if (str::IsEmpty(dir) || !str::StartsWith(filePath, dir)) {
-        return false;
-    }
-    const WCHAR* nameInZip = filePath + str::Len(dir) + 1;
-    if (!path::IsSep(nameInZip[-1])) {
+    const WCHAR* nameInZip = GetNameInDir(filePath, dir);
+    if (!nameInZip) {
         return false;
     }
     return AddFile(filePath, nameInZip);
 }
 
+// how many files are read and compressed ahead of the one being written,
+// which bounds the memory used for them
+static size_t GetMaxZipEntriesInFlight() {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return std::clamp((size_t)si.dwNumberOfProcessors * 2, (size_t)2, (size_t)32);
+}
+
+// files are read and compressed on the thread pool and written in order
+// as soon as all files before them have been written
 bool ZipCreator::AddDir(const WCHAR* dirPath, bool recursive) {
+    WStrVec paths;
     DirIter di(dirPath, recursive);
     for (const WCHAR* filePath = di.First(); filePath; filePath = di.Next()) {
-        if (!AddFileFromDir(filePath, dirPath)) {
+        if (!GetNameInDir(filePath, dirPath)) {
             return false;
         }
+        paths.Append(str::Dup(filePath));
     }
-    return true;
+
+    size_t maxInFlight = GetMaxZipEntriesInFlight();
+    Vec<ZipEntry*> entries;
+    size_t nStarted = 0;
+    bool ok = true;
+    for (size_t i = 0; i < paths.size() && ok; i++) {
+        for (; nStarted < paths.size() && nStarted < i + maxInFlight; nStarted++) {
+            ZipEntry* e = new ZipEntry();
+            e->filePath = paths.at(nStarted);
+            e->nameUtf8.Set(GetZipName(e->filePath, GetNameInDir(e->filePath, dirPath)));
+            e->hDone = RunAsyncWithHandle([e] { ReadAndCompressZipEntry(e); });
+            if (!e->hDone) {
+                ReadAndCompressZipEntry(e);
+            }
+            entries.Append(e);
+        }
+        ZipEntry* e = entries.at(i);
+        if (e->hDone) {
+            WaitForSingleObject(e->hDone, INFINITE);
+        }
+        ok = WriteEntry(e);
+        delete e;
+        entries.at(i) = nullptr;
+    }
+
+    // after an error, the following files might still be compressed
+    for (ZipEntry* e : entries) {
+        if (e && e->hDone) {
+            WaitForSingleObject(e->hDone, INFINITE);
+        }
+        delete e;
+    }
+    return ok;
 }
 
 bool ZipCreator::Finish() {
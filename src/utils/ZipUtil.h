@@ -6,6 +6,8 @@ typedef struct ar_stream_s ar_stream;
 typedef struct ar_archive_s ar_archive;
 }
 
+struct ZipEntry;
+
 class ZipCreator {
     ISequentialStream* stream;
     str::Str centraldir;
@@ -14,6 +16,7 @@ class ZipCreator {
 
     bool WriteData(const void* data, size_t size);
     bool AddFileData(const char* nameUtf8, const void* data, size_t size, u32 dosdate = 0);
+    bool WriteEntry(ZipEntry* e);
 
   public:
     ZipCreator(const WCHAR* zipFilePath);
@@ -25,6 +28,7 @@ class ZipCreator {
 
     bool AddFile(const WCHAR* filePath, const WCHAR* nameInZip = nullptr);
     bool AddFileFromDir(const WCHAR* filePath, const WCHAR* dir);
+    // files are compressed in parallel on the thread pool
     bool AddDir(const WCHAR* dirPath, bool recursive = false);
     bool Finish();
 };
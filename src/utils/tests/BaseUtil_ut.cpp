@@ -3,6 +3,8 @@
 
 #include "utils/BaseUtil.h"
 
+#include "utils/Timer.h"
+#include "utils/UtBench.h"
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
 
@@ -99,6 +101,7 @@ static void PoolAllocatorStringsTest(PoolAllocator& a, int nRounds) {
         char* got = (char*)d;
         utassert(str::Eq(exp, got));
     }
+    utassert(a.blocksSize >= (size_t)a.minBlockSize);
 }
 
 static void PoolAllocatorTest() {
@@ -106,6 +109,8 @@ static void PoolAllocatorTest() {
     PoolAllocatorStringsTest(a, 2048);
     a.allocAlign = 1;
     PoolAllocatorStringsTest(a, 2048);
+    a.FreeAll();
+    utassert(0 == a.blocksSize);
 }
 
 static int roundUpTestCases[] = {
@@ -149,3 +154,35 @@ void BaseUtilTest() {
     utassert(addOverflows<u8>(127, 255));
     GeomTest();
 }
+
+// not run as part of the unit tests (use test_util.exe -bench)
+void BaseUtilBenchmark() {
+    // 1000 small allocations of varying size, freed all at once
+    utbench("PoolAllocator (1000 allocs)", 0, [&] {
+        PoolAllocator a;
+        for (int i = 0; i < 1000; i++) {
+            void* p = a.Alloc(16 + (i % 7) * 8);
+            DoNotOptimize(p);
+        }
+        a.FreeAll();
+    });
+    utbench("malloc/free (1000 allocs)", 0, [&] {
+        void* ptrs[1000];
+        for (int i = 0; i < 1000; i++) {
+            ptrs[i] = malloc(16 + (i % 7) * 8);
+            DoNotOptimize(ptrs[i]);
+        }
+        for (int i = 0; i < 1000; i++) {
+            free(ptrs[i]);
+        }
+    });
+    PoolAllocator a;
+    for (int i = 0; i < 1000; i++) {
+        a.Alloc(16);
+    }
+    utbench("PoolAllocator::At", 0, [&] {
+        for (int i = 0; i < 1000; i++) {
+            DoNotOptimize(a.At(i));
+        }
+    });
+}
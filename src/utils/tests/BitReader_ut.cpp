@@ -0,0 +1,57 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/BitReader.h"
+#include "utils/Timer.h"
+#include "utils/UtBench.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+void BitReaderTest() {
+    u8 data[] = {0xA5, 0x0F, 0xF0};
+    BitReader r(data, sizeof(data));
+    utassert(r.BitsLeft() == 24);
+    utassert(r.Peek(4) == 0xA);
+    utassert(r.Peek(8) == 0xA5);
+    utassert(r.Eat(3));
+    utassert(r.Peek(5) == 0x05);
+    utassert(r.Peek(9) == 0x50);
+    utassert(r.Eat(13));
+    utassert(r.BitsLeft() == 8);
+    utassert(r.Peek(8) == 0xF0);
+    // bits past the end are 0
+    utassert(r.Peek(12) == 0xF00);
+    utassert(!r.Eat(9));
+    utassert(r.BitsLeft() == 0);
+}
+
+// not run as part of the unit tests (use test_util.exe -bench)
+void BitReaderBenchmark() {
+    const size_t n = 64 * 1024;
+    u8* data = AllocArray<u8>(n);
+    for (size_t i = 0; i < n; i++) {
+        data[i] = (u8)(i * 31);
+    }
+    // typical for Huffman-style decoding: peek at a few bits, eat some of them
+    utbench("BitReader (3/5 bits)", n, [&] {
+        BitReader r(data, n);
+        u32 sum = 0;
+        while (r.BitsLeft() > 0) {
+            sum += r.Peek(5);
+            r.Eat(3);
+        }
+        DoNotOptimize(sum);
+    });
+    utbench("BitReader (8/8 bits)", n, [&] {
+        BitReader r(data, n);
+        u32 sum = 0;
+        while (r.BitsLeft() > 0) {
+            sum += r.Peek(8);
+            r.Eat(8);
+        }
+        DoNotOptimize(sum);
+    });
+    free(data);
+}
@@ -28,6 +28,23 @@ static bool TestDigestSHA2(const char* data, size_t size, const char* verify) {
     return str::Eq(hash, verify);
 }
 
+static bool TestFastDigest(const char* data, size_t size, const char* verify) {
+    u8 digest[16];
+    CalcFastDigest(data, size, digest);
+    AutoFree hash(_MemToHex(&digest));
+    if (!str::Eq(hash, verify)) {
+        return false;
+    }
+    // the digest mustn't depend on how the data is split up
+    FastDigest fd;
+    for (size_t i = 0; i < size; i += 1 + i % 97) {
+        fd.Update(data + i, std::min(size - i, 1 + i % 97));
+    }
+    u8 digest2[16];
+    fd.Final(digest2);
+    return memeq(digest, digest2, sizeof(digest));
+}
+
 void CryptoUtilTest() {
     utassert(TestDigestMD5("", 0, "d41d8cd98f00b204e9800998ecf8427e"));
     utassert(TestDigestMD5("The quick brown fox jumps over the lazy dog", 43, "9e107d9d372bb6826bd81d3542a419d6"));
@@ -44,4 +61,12 @@ void CryptoUtilTest() {
                             "d7a8fbb307d7809469ca9abcb0082e4f8d5651e46d3cdb762d02d0bf37c9e592"));
     utassert(TestDigestSHA2("The quick brown fox jumps over the lazy dog.", 44,
                             "ef537f25c895bfa782526529a9b63d97aa631564d5d789c2b765448c8635fb6c"));
+
+    utassert(TestFastDigest("", 0, "52f44d5e4a06304264e14b974c15e2d2"));
+    utassert(TestFastDigest("The quick brown fox jumps over the lazy dog", 43, "584a19bc72c7d9068bef69db54110570"));
+    char data[3000];
+    for (size_t i = 0; i < dimof(data); i++) {
+        data[i] = (char)(i * 7);
+    }
+    utassert(TestFastDigest(data, sizeof(data), "ece5837fe9ae0a0ca23044298801ca11"));
 }
@@ -5,6 +5,8 @@
 #include "utils/HtmlParserLookup.h"
 #include "utils/CssParser.h"
 
+#include "utils/Timer.h"
+#include "utils/UtBench.h"
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
 
@@ -194,3 +196,23 @@ void CssParser_UnitTests() {
     Test07();
     Test08();
 }
+
+// not run as part of the unit tests (use test_util.exe -bench)
+void CssParserBenchmark() {
+    str::Str css;
+    for (int i = 0; css.size() < 64 * 1024; i++) {
+        css.AppendFmt("p.c%d, div#id%d > span { color: #%06x; font-family: 'Times New Roman', serif; ", i, i, i);
+        css.Append("margin: 0 1em 0.5em 2px; text-indent: 1.5em; /* comment */ }\n");
+    }
+    utbench("CssPullParser", css.size(), [&] {
+        CssPullParser parser(css.Get(), css.size());
+        while (parser.NextRule()) {
+            while (const CssSelector* sel = parser.NextSelector()) {
+                DoNotOptimize(sel);
+            }
+            while (const CssProperty* prop = parser.NextProperty()) {
+                DoNotOptimize(prop);
+            }
+        }
+    });
+}
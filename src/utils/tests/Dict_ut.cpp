@@ -3,6 +3,8 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/Dict.h"
+#include "utils/Timer.h"
+#include "utils/Log.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -77,6 +79,65 @@ void DictTestMapStrToInt() {
     toRemove.FreeMembers();
 }
 
+// removing and re-inserting leaves deleted slots behind which must be
+// skipped by lookups and reclaimed when the table gets re-hashed
+void DictTestMapWStrToInt() {
+    dict::MapWStrToInt d(4);
+    bool ok;
+    int val;
+
+    for (int i = 0; i < 1000; i++) {
+        AutoFreeWstr k = str::Format(L"key%d", i);
+        ok = d.Insert(k, i, nullptr);
+        utassert(ok);
+    }
+    utassert(1000 == d.Count());
+    for (int round = 0; round < 8; round++) {
+        for (int i = round; i < 1000; i += 2) {
+            AutoFreeWstr k = str::Format(L"key%d", i);
+            ok = d.Remove(k, &val);
+            utassert(ok && val == i);
+            ok = d.Get(k, &val);
+            utassert(!ok);
+            ok = d.Insert(k, i + round, nullptr);
+            utassert(ok);
+        }
+    }
+    utassert(1000 == d.Count());
+    for (int i = 0; i < 1000; i++) {
+        AutoFreeWstr k = str::Format(L"key%d", i);
+        ok = d.Get(k, &val);
+        utassert(ok);
+    }
+    ok = d.Get(L"key1000", &val);
+    utassert(!ok);
+}
+
+// not a correctness test: logs lookups per second so that changes to
+// the hash table can be compared
+static void DictBenchLookups() {
+    const int nKeys = 20000;
+    dict::MapStrToInt d;
+    Vec<char*> keys;
+    for (int i = 0; i < nKeys; i++) {
+        keys.Append(str::Format("element-%d", i));
+        d.Insert(keys.at(i), i, nullptr);
+    }
+    int val, found = 0;
+    auto t = TimeGet();
+    for (int n = 0; n < 50; n++) {
+        for (int i = 0; i < nKeys; i++) {
+            found += d.Get(keys.at(i), &val) ? 1 : 0;
+        }
+    }
+    double ms = TimeSinceInMs(t);
+    utassert(found == 50 * nKeys);
+    keys.FreeMembers();
+    logf("dict: %d lookups in %.2f ms (%.1f M/sec)\n", found, ms, ms > 0 ? found / (ms * 1000.0) : 0.0);
+}
+
 void DictTest() {
     DictTestMapStrToInt();
+    DictTestMapWStrToInt();
+    DictBenchLookups();
 }
@@ -2,8 +2,12 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/FileUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
+#include "utils/Timer.h"
+#include "utils/UtBench.h"
+#include "utils/WinUtil.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -108,6 +112,104 @@ static void Test03() {
     utassert(!t);
 }
 
+// SkipUntil, SkipWs and SkipNonWs check 16 chars at a time,
+// so the chars they stop at are tested at all positions of a block
+static void Test04() {
+    char buf[64];
+    for (int len = 0; len < 48; len++) {
+        for (int pos = 0; pos <= len; pos++) {
+            memset(buf, 'a', sizeof(buf));
+            if (pos < len) {
+                buf[pos] = '<';
+            }
+            buf[len] = '\0';
+            const char* s = buf;
+            bool found = SkipUntil(s, buf + len, '<');
+            utassert(found == (pos < len) && s == buf + pos);
+
+            // including a non-ASCII char which must not be mistaken for whitespace
+            memset(buf, ' ', sizeof(buf));
+            if (pos < len) {
+                buf[pos] = '\xC3';
+            }
+            buf[len] = '\0';
+            s = buf;
+            SkipWs(s, buf + len);
+            utassert(s == buf + pos);
+
+            memset(buf, 'x', sizeof(buf));
+            if (pos < len) {
+                buf[pos] = '\n';
+            }
+            buf[len] = '\0';
+            s = buf;
+            SkipNonWs(s, buf + len);
+            utassert(s == buf + pos);
+        }
+    }
+}
+
+// not run as part of the unit tests (use test_util.exe -bench)
+void HtmlPullParserBenchmark() {
+    if (!utbench_is_enabled("HtmlPullParser")) {
+        return;
+    }
+    // We assume we're being run from obj-[dbg|rel], so the test
+    // files are in ..\src\utils directory relative to exe's dir
+    AutoFreeWstr exePath(GetExePath());
+    const WCHAR* exeDir = path::GetBaseNameNoFree(exePath);
+    AutoFreeWstr p1(path::Join(exeDir, L"..\\src\\utils"));
+    AutoFreeWstr p2(path::Join(p1, L"HtmlParseTest00.html"));
+    AutoFree d(file::ReadFile(p2));
+    if (!d.data) {
+        printf("HtmlParseTest00.html not found\n");
+        return;
+    }
+    utbench("HtmlPullParser", d.size(), [&] {
+        HtmlPullParser parser(d.AsSpan());
+        HtmlToken* tok;
+        while ((tok = parser.Next()) != nullptr && !tok->IsError()) {
+            DoNotOptimize(tok);
+        }
+    });
+    utbench("HtmlPullParser (with attributes)", d.size(), [&] {
+        HtmlPullParser parser(d.AsSpan());
+        HtmlToken* tok;
+        while ((tok = parser.Next()) != nullptr && !tok->IsError()) {
+            if (tok->IsTag()) {
+                for (AttrInfo* a = tok->NextAttr(); a; a = tok->NextAttr()) {
+                    DoNotOptimize(a);
+                }
+            }
+        }
+    });
+
+    // a corpus of about 32 MB made of copies of the test file
+    str::Str corpus;
+    while (corpus.size() < 32 * 1024 * 1024) {
+        corpus.Append(d.data, d.size());
+    }
+
+    auto t = TimeGet();
+    HtmlPullParser parser(corpus.AsSpan());
+    size_t nTokens = 0;
+    size_t nResolved = 0;
+    HtmlToken* tok;
+    while ((tok = parser.Next()) != nullptr && !tok->IsError()) {
+        nTokens++;
+        if (tok->IsText()) {
+            const char* text = ResolveHtmlEntities(tok->s, tok->s + tok->sLen, nullptr);
+            if (text != tok->s) {
+                nResolved++;
+                str::Free(text);
+            }
+        }
+    }
+    printf("HtmlPullParser:   %.2f ms (%d tokens, %d with entities)\n", TimeSinceInMs(t), (int)nTokens,
+           (int)nResolved);
+    utassert(nTokens > 0);
+}
+
 void HtmlPullParser_UnitTests() {
     Test00("<p a1='>' foo=bar />", HtmlToken::EmptyElementTag);
     Test00("<p a1 ='>'     foo=\"bar\"/>", HtmlToken::EmptyElementTag);
@@ -118,4 +220,5 @@ void HtmlPullParser_UnitTests() {
     Test01();
     Test02();
     Test03();
+    Test04();
 }
@@ -4,6 +4,8 @@
 #include "utils/BaseUtil.h"
 #include "utils/JsonParser.h"
 
+#include "utils/Timer.h"
+#include "utils/UtBench.h"
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
 
@@ -135,4 +137,44 @@ void JsonTest() {
 }";
     JsonVerifier sampleVerifier(testData, dimof(testData));
     utassert(json::Parse(jsonSample, &sampleVerifier));
+
+    const char* quoteData = "C:\\docs\\\"a\"\tb\n\xC4\xA3";
+    str::Str quoted;
+    json::AppendQuoted(quoted, quoteData);
+    utassert(str::Eq(quoted.Get(), "\"C:\\\\docs\\\\\\\"a\\\"\\u0009b\\u000a\xC4\xA3\""));
+    JsonValue quotedValue("", quoteData);
+    JsonVerifier quotedVerifier(&quotedValue, 1);
+    utassert(json::Parse(quoted.Get(), &quotedVerifier));
+}
+
+class JsonCounter : public json::ValueVisitor {
+  public:
+    int nValues = 0;
+
+    virtual bool Visit(const char*, const char* value, json::Type) {
+        DoNotOptimize(value);
+        nValues++;
+        return true;
+    }
+};
+
+// not run as part of the unit tests (use test_util.exe -bench)
+void JsonBenchmark() {
+    // similar to the output of -batch
+    str::Str data;
+    data.Append("{\"action\": \"render\", \"workers\": 8, \"files\": [");
+    for (int i = 0; data.size() < 64 * 1024; i++) {
+        data.AppendFmt("%s\n{\"path\": \"C:\\\\docs\\\\file %d.pdf\", \"ok\": %s, ", i > 0 ? "," : "", i,
+                       i % 5 ? "true" : "false");
+        data.AppendFmt("\"pages\": %d, \"loadMs\": %d.25, \"processMs\": 1.5e%d}", i % 300, i, i % 4);
+    }
+    data.Append("]}");
+
+    JsonCounter counter;
+    utassert(json::Parse(data.Get(), &counter) && counter.nValues > 0);
+    utbench("json::Parse", data.size(), [&] {
+        JsonCounter c;
+        json::Parse(data.Get(), &c);
+        DoNotOptimize(c.nValues);
+    });
 }
@@ -0,0 +1,147 @@
+/* Copyright 2020 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/Regex.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+// expected contains the start and end of all matches (terminated by -1)
+static void RegexMatchTest(const WCHAR* pattern, bool ignoreCase, const WCHAR* text, const int* expected) {
+    Regex* re = CompileRegex(pattern, ignoreCase);
+    utassert(re != nullptr);
+    if (!re) {
+        return;
+    }
+    RegexMatcher matcher(re);
+    // the second time the matcher uses the cached DFA states
+    for (int i = 0; i < 2; i++) {
+        Vec<RegexMatch> matches;
+        matcher.FindAll(text, (int)str::Len(text), matches);
+        int n = 0;
+        for (; expected[2 * n] >= 0; n++) {
+            utassert(n < matches.isize());
+            if (n >= matches.isize()) {
+                break;
+            }
+            utassert(matches.at(n).start == expected[2 * n]);
+            utassert(matches.at(n).end == expected[2 * n + 1]);
+        }
+        utassert(n == matches.isize());
+    }
+    FreeRegex(re);
+}
+
+static void RegexCompileTest() {
+    const WCHAR* invalid[] = {
+        L"(",    L"a)",     L"[a",   L"[b-a]", L"*a",     L"a{2",  L"a{3,2}", L"a{,2}",  L"a{1001}",
+        L"\\b",  L"\\1",    L"^a",   L"a$",    L"a|*",    L"(?:a", L"\\",     L"[a-\\d]", L"(a{1000}){1000}",
+    };
+    for (const WCHAR* pattern : invalid) {
+        Regex* re = CompileRegex(pattern, false);
+        utassert(re == nullptr);
+        FreeRegex(re);
+    }
+
+    const WCHAR* valid[] = {
+        L"a",     L"a|b|c", L"(a|)b", L"[]a]", L"[^]]", L"[a-]", L"a{2,}", L"a{0,3}?",
+        L"\\.\\*", L"[\\d\\s_]", L"(?:ab)+", L"a**", L"x{1000}", L"",
+    };
+    for (const WCHAR* pattern : valid) {
+        Regex* re = CompileRegex(pattern, false);
+        utassert(re != nullptr);
+        FreeRegex(re);
+    }
+}
+
+void RegexTest() {
+    RegexCompileTest();
+
+    {
+        const int exp[] = {0, 3, 4, 7, -1};
+        RegexMatchTest(L"abc", false, L"abc abcab", exp);
+    }
+    {
+        // leftmost-longest among alternatives
+        const int exp[] = {0, 6, 7, 10, -1};
+        RegexMatchTest(L"foo|foobar|bar", false, L"foobar bar", exp);
+    }
+    {
+        const int exp[] = {2, 8, 12, 17, -1};
+        RegexMatchTest(L"colou?r", false, L"a colour or color", exp);
+    }
+    {
+        // matches don't overlap and empty matches are ignored
+        const int exp[] = {1, 3, 5, 6, -1};
+        RegexMatchTest(L"a*", false, L"baab a", exp);
+    }
+    {
+        const int exp[] = {4, 14, -1};
+        RegexMatchTest(L"\\d{3}-\\d{4,6}", false, L"tel 555-123456 or 55-1234", exp);
+    }
+    {
+        // . doesn't match a newline
+        const int exp[] = {0, 4, 5, 8, -1};
+        RegexMatchTest(L"a.*c", false, L"abbc\nabc", exp);
+    }
+    {
+        const int exp[] = {0, 5, 6, 11, -1};
+        RegexMatchTest(L"[a-z]+", true, L"hello world", exp);
+    }
+    {
+        const int exp[] = {6, 11, -1};
+        RegexMatchTest(L"[a-z]+", false, L"HELLO world", exp);
+    }
+    {
+        // the text for case-insensitive patterns is folded, the pattern itself doesn't have to be
+        const int exp[] = {0, 5, 10, 15, -1};
+        RegexMatchTest(L"HeLLo|W(o|0)rlD", true, L"hello and world", exp);
+    }
+    {
+        const int exp[] = {0, 2, 3, 5, -1};
+        RegexMatchTest(L"[^\\s]+", false, L"ab\tcd", exp);
+    }
+    {
+        const int exp[] = {1, 4, -1};
+        RegexMatchTest(L"(?:ab|cd){1,2}?c", false, L"xabc", exp);
+    }
+    {
+        const int exp[] = {0, 1, 2, 3, -1};
+        RegexMatchTest(L"\\W", false, L".a;", exp);
+    }
+    {
+        const int exp[] = {2, 5, -1};
+        RegexMatchTest(L"xyz", false, L"xyxyzz", exp);
+    }
+    {
+        const int exp[] = {-1};
+        RegexMatchTest(L"", false, L"abc", exp);
+        RegexMatchTest(L"abc", false, L"", exp);
+    }
+    {
+        // non-ASCII characters
+        const int exp[] = {1, 4, -1};
+        RegexMatchTest(L"\x00e4\\w+", true, L" \x00e4\x00f6\x00fc", exp);
+    }
+
+    // many states, so that the DFA cache has to be reset while matching
+    {
+        Regex* re = CompileRegex(L"(a|b)*a(a|b){12}", false);
+        utassert(re != nullptr);
+        RegexMatcher matcher(re);
+        str::WStr text;
+        for (int i = 0; i < 20000; i++) {
+            text.AppendChar((rand() % 2) ? 'a' : 'b');
+        }
+        Vec<RegexMatch> matches;
+        matcher.FindAll(text.Get(), (int)text.size(), matches);
+        // (a|b)* consumes everything up to the last 'a' followed by 12 more characters
+        int lastA = (int)text.size() - 13;
+        while (lastA >= 0 && text.at(lastA) != 'a') {
+            lastA--;
+        }
+        utassert(lastA < 0 || (matches.size() == 1 && matches.at(0).end == lastA + 13));
+        FreeRegex(re);
+    }
+}
@@ -174,6 +174,21 @@ Key = Value";
     utassert(!str::Eq(serialized, AutoFree(SerializeStruct(&gSutStructInfo, data))));
     data->sutStructItems->at(0)->nested.point.x++;
     utassert(!str::Eq(serialized, AutoFree(SerializeStruct(&gSutStructInfo, data, unknownOnly))));
+
+    std::span<u8> binary = SerializeStructBinary(&gSutStructInfo, data);
+    utassert(!DeserializeStructBinary(&gSutStructInfo, {binary.data(), binary.size() - 1}));
+    utassert(!DeserializeStructBinary(&gSutStructItemInfo, binary));
+    SutStruct* fromBinary = (SutStruct*)DeserializeStructBinary(&gSutStructInfo, binary);
+    utassert(fromBinary);
+    if (fromBinary) {
+        AutoFree expected = SerializeStruct(&gSutStructInfo, data);
+        AutoFree actual = SerializeStruct(&gSutStructInfo, fromBinary);
+        utassert(str::Eq(expected, actual));
+        utassert(!fromBinary->nullString && !fromBinary->nullUtf8String);
+        utassert(0 == fromBinary->emptyStrArray->size());
+    }
+    FreeStruct(&gSutStructInfo, fromBinary);
+    free(binary.data());
     FreeStruct(&gSutStructInfo, data);
 
     data = (SutStruct*)DeserializeStruct(&gSutStructInfo, nullptr);
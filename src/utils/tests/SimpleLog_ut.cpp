@@ -14,6 +14,7 @@ void SimpleLogTest() {
         log(L"ML\n");
         logf(L"%s : %d\n", L"filename.pdf", 25);
 
+        FlushLog();
         char* got = gLogBuf->Get();
         const char* exp = "Test1\nML\nfilename.pdf : 25\n";
         utassert(str::Eq(got, exp));
@@ -4,6 +4,8 @@
 #include "utils/BaseUtil.h"
 #include "utils/SquareTreeParser.h"
 
+#include "utils/Timer.h"
+#include "utils/UtBench.h"
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
 
@@ -160,3 +162,32 @@ void SquareTreeTest() {
     utassert(0 == mixed.root->GetChild("node1")->data.size());
     utassert(str::Eq(mixed.root->GetChild("node2")->GetValue("Key"), "value"));
 }
+
+// not run as part of the unit tests (use test_util.exe -bench)
+void SquareTreeBenchmark() {
+    // similar to SumatraPDF-settings.txt with a long file history
+    str::Str data;
+    data.Append(UTF8_BOM "MainWindowBackground = #80fff200\nEscToExit = false\n");
+    data.Append("FixedPageUI [\n\tTextColor = #000000\n\tBackgroundColor = #ffffff\n]\n");
+    data.Append("FileStates [\n");
+    for (int i = 0; data.size() < 64 * 1024; i++) {
+        data.AppendFmt("\t[\n\t\tFilePath = C:\\Users\\user\\Documents\\document %d.pdf\n", i);
+        data.AppendFmt("\t\tOpenCount = %d\n\t\tPageNo = %d\n\t\tZoom = fit page\n", i % 7, i % 300);
+        data.Append("\t\tRotation = 0\n\t\tScrollPos = 0 0\n\t\tDisplayMode = automatic\n\t]\n");
+    }
+    data.Append("]\n");
+
+    utbench("SquareTree", data.size(), [&] {
+        SquareTree tree(data.Get());
+        DoNotOptimize(tree.root);
+    });
+    SquareTree tree(data.Get());
+    utassert(tree.root && tree.root->GetChild("FileStates"));
+    SquareTreeNode* states = tree.root->GetChild("FileStates");
+    utbench("SquareTreeNode::GetValue", 0, [&] {
+        size_t idx = 0;
+        while (SquareTreeNode* node = states->GetChild("", &idx)) {
+            DoNotOptimize(node->GetValue("Zoom"));
+        }
+    });
+}
@@ -2,6 +2,8 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/Timer.h"
+#include "utils/UtBench.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -275,6 +277,137 @@ void strWStrTest() {
     }
 }
 
+// FindN and FindLastN work on blocks of 8 characters, so check
+// matches at all positions relative to the block boundaries
+static void StrFindNTest() {
+    const WCHAR* s = L"abcabcabcabcabcabcabcabcXYabcX";
+    size_t sLen = str::Len(s);
+    utassert(str::FindN(s, sLen, L"XY", 2) == s + 24);
+    utassert(str::FindN(s, sLen, L"abc", 3) == s);
+    utassert(str::FindN(s, sLen, L"bcX", 3) == s + 22);
+    utassert(str::FindLastN(s, sLen, L"bcX", 3) == s + 27);
+    utassert(str::FindN(s, sLen, L"X", 1) == s + 24);
+    utassert(str::FindN(s, sLen, L"XYZ", 3) == nullptr);
+    utassert(str::FindN(s, 25, L"XY", 2) == nullptr);
+    utassert(str::FindN(s, 26, L"XY", 2) == s + 24);
+    utassert(str::FindN(s, sLen, L"", 0) == s);
+    utassert(str::FindN(s, 1, L"ab", 2) == nullptr);
+
+    utassert(str::FindLastN(s, sLen, L"abc", 3) == s + 26);
+    utassert(str::FindLastN(s, 26, L"abc", 3) == s + 21);
+    utassert(str::FindLastN(s, sLen, L"XY", 2) == s + 24);
+    utassert(str::FindLastN(s, sLen, L"X", 1) == s + 29);
+    utassert(str::FindLastN(s, sLen, L"cab", 3) == s + 20);
+    utassert(str::FindLastN(s, 4, L"cab", 3) == nullptr);
+    utassert(str::FindLastN(s, 5, L"cab", 3) == s + 2);
+    utassert(str::FindLastN(s, sLen, L"", 0) == s + sLen);
+
+    WCHAR buf[64];
+    for (size_t start = 0; start + 3 <= dimof(buf); start++) {
+        for (size_t i = 0; i < dimof(buf); i++) {
+            buf[i] = 'a';
+        }
+        buf[start] = 'x';
+        buf[start + 1] = 'y';
+        buf[start + 2] = 'z';
+        utassert(str::FindN(buf, dimof(buf), L"xyz", 3) == buf + start);
+        utassert(str::FindLastN(buf, dimof(buf), L"xyz", 3) == buf + start);
+        utassert(str::FindN(buf, start + 2, L"xyz", 3) == nullptr);
+        utassert(str::FindLastN(buf, start + 2, L"xyz", 3) == nullptr);
+    }
+}
+
+// not run as part of the unit tests (use test_util.exe -bench)
+void StrBenchmark() {
+    str::Str text;
+    while (text.size() < 1024) {
+        text.Append("Lorem ipsum dolor sit amet, consectetur adipiscing elit. ");
+    }
+    const char* s = text.Get();
+    size_t len = text.size();
+    AutoFree copy = str::Dup(s);
+    AutoFreeWstr ws = strconv::Utf8ToWstr(s);
+
+    utbench("str::Len", len, [&] { DoNotOptimize(str::Len(s)); });
+    utbench("str::Eq", len, [&] { DoNotOptimize(str::Eq(s, copy.Get())); });
+    utbench("str::EqI", len, [&] { DoNotOptimize(str::EqI(s, copy.Get())); });
+    utbench("str::FindChar", len, [&] { DoNotOptimize(str::FindChar(s, '!')); });
+    utbench("str::Find", len, [&] { DoNotOptimize(str::Find(s, "needle")); });
+    utbench("str::FindI", len, [&] { DoNotOptimize(str::FindI(s, "needle")); });
+    utbench("str::Dup", len, [&] {
+        char* tmp = str::Dup(s);
+        DoNotOptimize(tmp);
+        str::Free(tmp);
+    });
+    utbench("str::Str::Append", 0, [&] {
+        str::Str tmp;
+        for (int i = 0; i < 64; i++) {
+            tmp.Append("ipsum ");
+        }
+        DoNotOptimize(tmp.Get());
+    });
+    utbench("str::Format", 0, [&] {
+        char* tmp = str::Format("%s-%d.%s", "page", 123, "png");
+        DoNotOptimize(tmp);
+        str::Free(tmp);
+    });
+    utbench("strconv::Utf8ToWstr", len, [&] {
+        WCHAR* tmp = strconv::Utf8ToWstr(s);
+        DoNotOptimize(tmp);
+        free(tmp);
+    });
+    utbench("strconv::WstrToUtf8", len, [&] {
+        std::string_view tmp = strconv::WstrToUtf8(ws.Get());
+        DoNotOptimize(tmp);
+        str::Free(tmp.data());
+    });
+}
+
+void StrFindBenchmark() {
+    if (!utbench_is_enabled("StrFind")) {
+        return;
+    }
+    const size_t n = 16 * 1024 * 1024;
+    WCHAR* s = AllocArray<WCHAR>(n + 1);
+    const WCHAR* words[] = {L"lorem ", L"ipsum ", L"dolor ", L"sit ", L"amet, ", L"consectetur "};
+    size_t len = 0;
+    for (size_t i = 0; len + 16 < n; i++) {
+        const WCHAR* w = words[(i * 7) % dimof(words)];
+        size_t wLen = str::Len(w);
+        memcpy(s + len, w, wLen * sizeof(WCHAR));
+        len += wLen;
+    }
+    memcpy(s + len, L"needle", 6 * sizeof(WCHAR));
+    len += 6;
+
+    auto t = TimeGet();
+    const WCHAR* found = wcsstr(s, L"needle");
+    printf("wcsstr:           %.2f ms\n", TimeSinceInMs(t));
+    utassert(found == s + len - 6);
+
+    t = TimeGet();
+    found = str::FindI(s, L"needle");
+    printf("str::FindI:       %.2f ms\n", TimeSinceInMs(t));
+    utassert(found == s + len - 6);
+
+    t = TimeGet();
+    found = StrStrIW(s, L"needle");
+    printf("StrStrI:          %.2f ms\n", TimeSinceInMs(t));
+    utassert(found == s + len - 6);
+
+    t = TimeGet();
+    found = str::FindN(s, len, L"needle", 6);
+    printf("str::FindN:       %.2f ms\n", TimeSinceInMs(t));
+    utassert(found == s + len - 6);
+
+    t = TimeGet();
+    found = str::FindLastN(s, len - 1, L"needle", 6);
+    printf("str::FindLastN:   %.2f ms\n", TimeSinceInMs(t));
+    utassert(!found);
+
+    free(s);
+}
+
 void StrTest() {
     WCHAR buf[32];
     const WCHAR* str = L"a string";
@@ -700,4 +833,5 @@ void StrTest() {
     StrConvTest();
     StrUrlExtractTest();
     ParseUntilTest();
+    StrFindNTest();
 }
@@ -6,6 +6,8 @@
 #include <inttypes.h>
 #include <utils/VecSegmented.h>
 
+#include "utils/Timer.h"
+#include "utils/UtBench.h"
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
 
@@ -144,8 +146,75 @@ static void VecSegmentedTest() {
     }
 }
 
+// counts allocations, to verify that Vec doesn't allocate more often than necessary
+struct CountingAllocator : Allocator {
+    int nAllocs = 0;
+
+    void* Alloc(size_t size) override {
+        nAllocs++;
+        return malloc(size);
+    }
+    void* Realloc(void* mem, size_t size) override {
+        nAllocs++;
+        return realloc(mem, size);
+    }
+    void Free(const void* mem) override {
+        free((void*)mem);
+    }
+};
+
+static void VecAllocTest() {
+    CountingAllocator a;
+    {
+        Vec<int> v(0, &a);
+        for (int i = 0; i < 15; i++) {
+            v.Append(i);
+        }
+        // stored inline
+        utassert(a.nAllocs == 0);
+        v.Append(15);
+        utassert(a.nAllocs == 1);
+        for (int i = 16; i < 1000; i++) {
+            v.Append(i);
+        }
+        // the capacity doubles with every allocation
+        utassert(a.nAllocs == 7);
+    }
+
+    a.nAllocs = 0;
+    {
+        Vec<int> v(0, &a);
+        v.Reserve(1000);
+        for (int i = 0; i < 1000; i++) {
+            v.Append(i);
+        }
+        utassert(a.nAllocs == 1);
+
+        Vec<int> v2(std::move(v));
+        utassert(a.nAllocs == 1);
+        utassert(v.size() == 0 && v2.size() == 1000 && v2.at(999) == 999);
+        v = std::move(v2);
+        utassert(a.nAllocs == 1);
+        utassert(v.size() == 1000 && v2.size() == 0 && v.at(500) == 500);
+    }
+
+    a.nAllocs = 0;
+    {
+        Vec<int, 4> v(0, &a);
+        utassert(sizeof(v) < sizeof(Vec<int>));
+        v.Append(1);
+        v.Append(2);
+        v.Append(3);
+        utassert(a.nAllocs == 0);
+        v.Append(4);
+        utassert(a.nAllocs == 1);
+        utassert(v.size() == 4 && v.at(3) == 4);
+    }
+}
+
 void VecTest() {
     VecSegmentedTest();
+    VecAllocTest();
 
     Vec<int> ints;
     utassert(ints.size() == 0);
@@ -308,3 +377,40 @@ void VecTest() {
     StrListTest();
     VecStrTest();
 }
+
+// not run as part of the unit tests (use test_util.exe -bench)
+void VecBenchmark() {
+    utbench("Vec<int>::Append (1000)", 0, [&] {
+        Vec<int> v;
+        for (int i = 0; i < 1000; i++) {
+            v.Append(i);
+        }
+        DoNotOptimize(v.at(999));
+    });
+    utbench("Vec<int>::InsertAt(0) (1000)", 0, [&] {
+        Vec<int> v;
+        for (int i = 0; i < 1000; i++) {
+            v.InsertAt(0, i);
+        }
+        DoNotOptimize(v.at(999));
+    });
+    Vec<int> ints;
+    for (int i = 0; i < 1000; i++) {
+        ints.Append(i);
+    }
+    utbench("Vec<int>::Find (1000)", 1000 * sizeof(int), [&] { DoNotOptimize(ints.Find(-1)); });
+    utbench("Vec<int>::RemoveAt(0) (1000)", 0, [&] {
+        Vec<int> v(ints);
+        while (v.size() > 0) {
+            v.RemoveAt(0);
+        }
+        DoNotOptimize(v.size());
+    });
+    utbench("WStrVec::Append (1000)", 0, [&] {
+        WStrVec v;
+        for (int i = 0; i < 1000; i++) {
+            v.Append(str::Dup(L"C:\\Users\\user\\document.pdf"));
+        }
+        DoNotOptimize(v.size());
+    });
+}
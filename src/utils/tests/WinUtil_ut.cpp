@@ -5,6 +5,8 @@
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 
+#include "utils/Timer.h"
+#include "utils/UtBench.h"
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
 
@@ -38,6 +40,36 @@ void WinUtilTest() {
         utassert(allScreens.Intersect(oneScreen) == oneScreen);
     }
 
+    {
+        // an odd width so that not all pixels are updated 4 at a time
+        int dx = 37, dy = 5;
+        BITMAPINFO bmi{};
+        bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+        bmi.bmiHeader.biWidth = dx;
+        bmi.bmiHeader.biHeight = -dy;
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+        u8* data = nullptr;
+        HBITMAP hbmp = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, (void**)&data, nullptr, 0);
+        utassert(hbmp && data);
+        int nBytes = dx * dy * 4;
+        for (int i = 0; i < nBytes; i++) {
+            data[i] = (u8)(i * 7);
+        }
+        // text color RGB(10, 200, 30), background color RGB(250, 5, 128)
+        // mapped from black resp. white (in blue-green-red-alpha order)
+        int base[4] = {30, 200, 10, 0};
+        int diff[4] = {128 - 30, 5 - 200, 250 - 10, 255};
+        UpdateBitmapColors(hbmp, RGB(10, 200, 30), RGB(250, 5, 128));
+        for (int i = 0; i < nBytes; i++) {
+            int x = (u8)(i * 7) * diff[i % 4] + 128;
+            x += x >> 8;
+            utassert(data[i] == (u8)(base[i % 4] + (x >> 8)));
+        }
+        DeleteObject(hbmp);
+    }
+
     // TODO: moved AdjustLigthness() to Colors.[h|cpp] which is outside of utils directory
 #if 0
     {
@@ -54,3 +86,19 @@ void WinUtilTest() {
     }
 #endif
 }
+
+// not run as part of the unit tests (use test_util.exe -bench)
+void WinUtilBenchmark() {
+    Size size(1024, 1024);
+    HBITMAP hbmp = CreateMemoryBitmap(size);
+    if (!hbmp) {
+        printf("CreateMemoryBitmap failed\n");
+        return;
+    }
+    size_t nBytes = (size_t)size.dx * size.dy * 4;
+    utbench("UpdateBitmapColors (1024x1024)", nBytes, [&] {
+        UpdateBitmapColors(hbmp, RGB(0x20, 0x30, 0x40), RGB(0xf0, 0xe0, 0xd0));
+        ClobberMemory();
+    });
+    DeleteObject(hbmp);
+}
@@ -16,7 +16,8 @@
 /*
 Frame rate window is a debugging tool that shows the frame rate, most likely
 of how long it takes to service WM_PAINT. It's good for a rough measure of
-how fast painting is.
+how fast painting is. It can also show arbitrary text (e.g. more detailed
+performance statistics).
 
 The window is a top-level window, semi-transparent, without decorations
 that sits in the upper right corner of some other window (associated window).
@@ -39,6 +40,11 @@ static void FrameRatePaint(FrameRateWnd* w, HDC hdc, PAINTSTRUCT& ps) {
     SetTextColor(hdc, COL_WHITE);
 
     ScopedSelectObject selFont(hdc, w->font);
+    if (w->text) {
+        InflateRect(&rc, -4, -2);
+        DrawTextW(hdc, w->text, -1, &rc, DT_LEFT | DT_NOPREFIX);
+        return;
+    }
     AutoFreeWstr txt(str::Format(L"%d", w->frameRate));
     DrawCenteredText(hdc, rc, txt);
 }
@@ -50,9 +56,20 @@ static void PositionWindow(FrameRateWnd* w, SIZE s) {
     MoveWindow(w->hwnd, p.x, p.y, s.cx, s.cy, TRUE);
 }
 
+static Size TextSizeMultiLine(FrameRateWnd* w) {
+    HDC hdc = GetDC(w->hwnd);
+    RECT rc = {0};
+    {
+        ScopedSelectObject selFont(hdc, w->font);
+        DrawTextW(hdc, w->text, -1, &rc, DT_CALCRECT | DT_LEFT | DT_NOPREFIX);
+    }
+    ReleaseDC(w->hwnd, hdc);
+    return Size(rc.right - rc.left, rc.bottom - rc.top);
+}
+
 static SIZE GetIdealSize(FrameRateWnd* w) {
     WCHAR* txt = str::Format(L"%d", w->frameRate);
-    Size s = TextSizeInHwnd(w->hwnd, txt);
+    Size s = w->text ? TextSizeMultiLine(w) : TextSizeInHwnd(w->hwnd, txt);
 
     // add padding
     s.dy += 4;
@@ -180,12 +197,24 @@ void FrameRateWnd::ShowFrameRate(int frameRate) {
     ScheduleRepaint(this->hwnd);
 }
 
+void FrameRateWnd::ShowText(const WCHAR* text) {
+    if (str::Eq(this->text, text)) {
+        return;
+    }
+    str::ReplacePtr(&this->text, text);
+    SIZE s = GetIdealSize(this);
+    PositionWindow(this, s);
+    ScheduleRepaint(this->hwnd);
+}
+
 void FrameRateWnd::ShowFrameRateDur(double durMs) {
     this->ShowFrameRate(FrameRateFromDuration(durMs));
 }
 
 FrameRateWnd::~FrameRateWnd() {
     RemoveWindowSubclass(this->hwndAssociatedWithTopLevel, WndProcFrameRateAssociated, 0);
+    DestroyWindow(this->hwnd);
+    free(this->text);
 }
 
 int FrameRateFromDuration(double durMs) {
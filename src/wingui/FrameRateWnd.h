@@ -9,6 +9,8 @@ struct FrameRateWnd {
 
     void ShowFrameRate(int frameRate);
     void ShowFrameRateDur(double durMs);
+    // shows (multi-line) text instead of the frame rate
+    void ShowText(const WCHAR* text);
 
     HWND hwndAssociatedWith = nullptr;
     HWND hwndAssociatedWithTopLevel = nullptr;
@@ -18,6 +20,7 @@ struct FrameRateWnd {
 
     SIZE maxSizeSoFar = {0, 0};
     int frameRate = -1;
+    WCHAR* text = nullptr;
 };
 
 int FrameRateFromDuration(double durMs);
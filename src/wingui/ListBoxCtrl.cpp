@@ -43,16 +43,20 @@ ListBoxCtrl::ListBoxCtrl(HWND p) : WindowBase(p), idealSize({DpiScale(p, 120), D
 ListBoxCtrl::~ListBoxCtrl() {
 }
 
-static void FillWithItems(ListBoxCtrl* w, ListBoxModel* model) {
-    HWND hwnd = w->hwnd;
-    ListBox_ResetContent(hwnd);
-    for (int i = 0; i < model->ItemsCount(); i++) {
+static void AddItems(HWND hwnd, ListBoxModel* model, int start) {
+    for (int i = start; i < model->ItemsCount(); i++) {
         auto sv = model->Item(i);
         AutoFreeWstr ws = strconv::Utf8ToWstr(sv);
         ListBox_AddString(hwnd, ws.Get());
     }
 }
 
+static void FillWithItems(ListBoxCtrl* w, ListBoxModel* model) {
+    HWND hwnd = w->hwnd;
+    ListBox_ResetContent(hwnd);
+    AddItems(hwnd, model, 0);
+}
+
 static void DispatchSelectionChanged(ListBoxCtrl* w, WndEvent* ev) {
     ListBoxSelectionChangedEvent a;
     CopyWndEvent cp(&a, ev);
@@ -143,3 +147,16 @@ void ListBoxCtrl::SetModel(ListBoxModel* model) {
     SetCurrentSelection(-1);
     // TODO: update ideal size based on the size of the model
 }
+
+// cheaper than SetModel() for models that only grow and preserves the selection
+void ListBoxCtrl::ItemsAppended() {
+    if (!model || !hwnd) {
+        return;
+    }
+    int nShown = ListBox_GetCount(hwnd);
+    if (nShown == LB_ERR || nShown > model->ItemsCount()) {
+        FillWithItems(this, model);
+        return;
+    }
+    AddItems(hwnd, model, nShown);
+}
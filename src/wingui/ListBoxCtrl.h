@@ -45,4 +45,6 @@ struct ListBoxCtrl : WindowBase {
     int GetCurrentSelection();
     bool SetCurrentSelection(int);
     void SetModel(ListBoxModel*);
+    // shows the items appended to the model since it was set
+    void ItemsAppended();
 };
@@ -145,12 +145,19 @@ static void DragStart(TreeCtrl* w, NMTREEVIEWW* nmtv) {
     w->isDragging = true;
 }
 
-static void TreeViewExpandRecursively(HWND hTree, HTREEITEM hItem, uint flag, bool subtree) {
+static void InsertChildrenOnDemand(TreeCtrl* tree, HTREEITEM hItem);
+static HTREEITEM InsertItemOnDemand(TreeCtrl* tree, TreeItem* ti);
+
+static void TreeViewExpandRecursively(TreeCtrl* tree, HTREEITEM hItem, uint flag, bool subtree) {
+    HWND hTree = tree->hwnd;
     while (hItem) {
+        if (flag == TVE_EXPAND) {
+            InsertChildrenOnDemand(tree, hItem);
+        }
         TreeView_Expand(hTree, hItem, flag);
         HTREEITEM child = TreeView_GetChild(hTree, hItem);
         if (child) {
-            TreeViewExpandRecursively(hTree, child, flag, false);
+            TreeViewExpandRecursively(tree, child, flag, false);
         }
         if (subtree) {
             break;
@@ -176,12 +183,16 @@ static TVITEMW* GetTVITEM(TreeCtrl* tree, HTREEITEM hItem) {
 
 static TVITEMW* GetTVITEM(TreeCtrl* tree, TreeItem* ti) {
     HTREEITEM hi = tree->GetHandleByTreeItem(ti);
+    if (!hi) {
+        return nullptr;
+    }
     return GetTVITEM(tree, hi);
 }
 
 // expand if collapse, collapse if expanded
 static void TreeViewToggle(TreeCtrl* tree, HTREEITEM hItem, bool recursive) {
     HWND hTree = tree->hwnd;
+    InsertChildrenOnDemand(tree, hItem);
     HTREEITEM child = TreeView_GetChild(hTree, hItem);
     if (!child) {
         // only applies to nodes with children
@@ -198,7 +209,7 @@ static void TreeViewToggle(TreeCtrl* tree, HTREEITEM hItem, bool recursive) {
         flag = TVE_COLLAPSE;
     }
     if (recursive) {
-        TreeViewExpandRecursively(hTree, hItem, flag, false);
+        TreeViewExpandRecursively(tree, hItem, flag, false);
     } else {
         TreeView_Expand(hTree, hItem, flag);
     }
@@ -237,6 +248,12 @@ static void Handle_WM_NOTIFY(void* user, WndEvent* ev) {
 
     auto code = nmtv->hdr.code;
 
+    // https://docs.microsoft.com/en-us/windows/win32/controls/tvn-itemexpanding
+    if (code == TVN_ITEMEXPANDING && nmtv->action == TVE_EXPAND) {
+        InsertChildrenOnDemand(w, nmtv->itemNew.hItem);
+        return;
+    }
+
     // https://docs.microsoft.com/en-us/windows/win32/controls/tvn-getinfotip
     if (code == TVN_GETINFOTIP) {
         if (!w->onGetTooltip) {
@@ -420,9 +437,9 @@ static bool HandleKey(TreeCtrl* tree, WPARAM wp) {
     // consistently expand/collapse whole (sub)trees
     if (VK_MULTIPLY == wp) {
         if (IsShiftPressed()) {
-            TreeViewExpandRecursively(hwnd, TreeView_GetRoot(hwnd), TVE_EXPAND, false);
+            TreeViewExpandRecursively(tree, TreeView_GetRoot(hwnd), TVE_EXPAND, false);
         } else {
-            TreeViewExpandRecursively(hwnd, TreeView_GetSelection(hwnd), TVE_EXPAND, true);
+            TreeViewExpandRecursively(tree, TreeView_GetSelection(hwnd), TVE_EXPAND, true);
         }
     } else if (VK_DIVIDE == wp) {
         if (IsShiftPressed()) {
@@ -430,9 +447,9 @@ static bool HandleKey(TreeCtrl* tree, WPARAM wp) {
             if (!TreeView_GetNextSibling(hwnd, root)) {
                 root = TreeView_GetChild(hwnd, root);
             }
-            TreeViewExpandRecursively(hwnd, root, TVE_COLLAPSE, false);
+            TreeViewExpandRecursively(tree, root, TVE_COLLAPSE, false);
         } else {
-            TreeViewExpandRecursively(hwnd, TreeView_GetSelection(hwnd), TVE_COLLAPSE, true);
+            TreeViewExpandRecursively(tree, TreeView_GetSelection(hwnd), TVE_COLLAPSE, true);
         }
     } else if (wp == 13) {
         // this is Enter key
@@ -545,6 +562,10 @@ bool TreeCtrl::Create() {
 }
 
 bool TreeCtrl::IsExpanded(TreeItem* ti) {
+    if (!GetHandleByTreeItem(ti)) {
+        // not inserted yet, so the item's state hasn't changed
+        return ti->IsExpanded();
+    }
     auto state = GetItemState(ti);
     return state.isExpanded;
 }
@@ -552,6 +573,9 @@ bool TreeCtrl::IsExpanded(TreeItem* ti) {
 // https://docs.microsoft.com/en-us/windows/win32/api/commctrl/nf-commctrl-treeview_getitemrect
 bool TreeCtrl::GetItemRect(TreeItem* ti, bool justText, RECT& r) {
     HTREEITEM hi = GetHandleByTreeItem(ti);
+    if (!hi) {
+        return false;
+    }
     BOOL b = toBOOL(justText);
     BOOL ok = TreeView_GetItemRect(hwnd, hi, &r, b);
     return ok == TRUE;
@@ -563,7 +587,7 @@ TreeItem* TreeCtrl::GetSelection() {
 }
 
 bool TreeCtrl::SelectItem(TreeItem* ti) {
-    auto hi = GetHandleByTreeItem(ti);
+    auto hi = InsertItemOnDemand(this, ti);
     BOOL ok = TreeView_SelectItem(hwnd, hi);
     return ok == TRUE;
 }
@@ -581,20 +605,21 @@ void TreeCtrl::SetTextColor(COLORREF col) {
 void TreeCtrl::ExpandAll() {
     SuspendRedraw();
     auto root = TreeView_GetRoot(this->hwnd);
-    TreeViewExpandRecursively(this->hwnd, root, TVE_EXPAND, false);
+    TreeViewExpandRecursively(this, root, TVE_EXPAND, false);
     ResumeRedraw();
 }
 
 void TreeCtrl::CollapseAll() {
     SuspendRedraw();
     auto root = TreeView_GetRoot(this->hwnd);
-    TreeViewExpandRecursively(this->hwnd, root, TVE_COLLAPSE, false);
+    TreeViewExpandRecursively(this, root, TVE_COLLAPSE, false);
     ResumeRedraw();
 }
 
 void TreeCtrl::Clear() {
     treeModel = nullptr;
     insertedItems.Reset();
+    insertedItemsSorted = 0;
 
     HWND hwnd = this->hwnd;
     ::SendMessageW(hwnd, WM_SETREDRAW, FALSE, 0);
@@ -638,25 +663,45 @@ TreeItem* TreeCtrl::GetItemAt(int x, int y) {
     return GetTreeItemByHandle(ht.hItem);
 }
 
-// TODO: speed up by storing the pointer as TVINSERTSTRUCTW.lParam
+static bool InsertedItemLess(const std::tuple<TreeItem*, HTREEITEM>& a, const std::tuple<TreeItem*, HTREEITEM>& b) {
+    return std::get<0>(a) < std::get<0>(b);
+}
+
+// returns nullptr for items that haven't been inserted yet (see InsertChildrenOnDemand)
+// this is called for every item e.g. by UpdateTocExpansionState, so instead of a linear
+// search, items are kept sorted except for the most recently inserted ones
 HTREEITEM TreeCtrl::GetHandleByTreeItem(TreeItem* item) {
-    for (auto t : this->insertedItems) {
-        auto* i = std::get<0>(t);
-        if (i == item) {
-            return std::get<1>(t);
+    auto* begin = insertedItems.begin();
+    auto* end = insertedItems.end();
+    if (end - begin - insertedItemsSorted > 32) {
+        std::sort(begin, end, InsertedItemLess);
+        insertedItemsSorted = insertedItems.isize();
+    }
+    auto* sortedEnd = begin + insertedItemsSorted;
+    auto it = std::lower_bound(begin, sortedEnd, std::make_tuple(item, (HTREEITEM) nullptr), InsertedItemLess);
+    if (it != sortedEnd && std::get<0>(*it) == item) {
+        return std::get<1>(*it);
+    }
+    for (it = sortedEnd; it != end; it++) {
+        if (std::get<0>(*it) == item) {
+            return std::get<1>(*it);
         }
     }
     return nullptr;
 }
 
+// the TreeItem is stored as the item's lParam (see FillTVITEM)
 TreeItem* TreeCtrl::GetTreeItemByHandle(HTREEITEM item) {
-    for (auto t : this->insertedItems) {
-        auto* i = std::get<1>(t);
-        if (i == item) {
-            return std::get<0>(t);
-        }
+    if (!item) {
+        return nullptr;
     }
-    return nullptr;
+    TVITEMW tvi{};
+    tvi.hItem = item;
+    tvi.mask = TVIF_HANDLE | TVIF_PARAM;
+    if (!TreeView_GetItem(hwnd, &tvi)) {
+        return nullptr;
+    }
+    return (TreeItem*)tvi.lParam;
 }
 
 void FillTVITEM(TVITEMEXW* tvitem, TreeItem* ti, bool withCheckboxes) {
@@ -696,14 +741,18 @@ static HTREEITEM insertItem(TreeCtrl* tree, HTREEITEM parent, TreeItem* ti) {
     if (onDemand) {
         tvitem->pszText = LPSTR_TEXTCALLBACK;
     }
+    // children might only be inserted later, so the expand button must
+    // be shown based on the model
+    tvitem->mask |= TVIF_CHILDREN;
+    tvitem->cChildren = ti->ChildCount() > 0 ? 1 : 0;
     HTREEITEM res = TreeView_InsertItem(tree->hwnd, &toInsert);
     return res;
 }
 
 bool TreeCtrl::UpdateItem(TreeItem* ti) {
     HTREEITEM ht = GetHandleByTreeItem(ti);
-    CrashIf(!ht);
     if (!ht) {
+        // will be up to date once it's inserted
         return false;
     }
 
@@ -718,26 +767,56 @@ bool TreeCtrl::UpdateItem(TreeItem* ti) {
     return ok ? true : false;
 }
 
+// children of collapsed items are only inserted once the item gets expanded,
+// so that huge trees (e.g. ToCs with 100k entries) are shown quickly
 static void PopulateTreeItem(TreeCtrl* tree, TreeItem* item, HTREEITEM parent) {
-    int n = item->ChildCount();
-    for (int i = 0; i < n; i++) {
-        auto* ti = item->ChildAt(i);
+    Vec<TreeItem*> children;
+    item->GetChildren(children);
+    for (auto* ti : children) {
         HTREEITEM h = insertItem(tree, parent, ti);
         auto v = std::make_tuple(ti, h);
         tree->insertedItems.Append(v);
-        PopulateTreeItem(tree, ti, h);
+        if (ti->IsExpanded()) {
+            PopulateTreeItem(tree, ti, h);
+        }
     }
 }
 
+static void InsertChildrenOnDemand(TreeCtrl* tree, HTREEITEM hItem) {
+    if (!hItem || TreeView_GetChild(tree->hwnd, hItem)) {
+        return;
+    }
+    TreeItem* ti = tree->GetTreeItemByHandle(hItem);
+    if (ti && ti->ChildCount() > 0) {
+        PopulateTreeItem(tree, ti, hItem);
+    }
+}
+
+// inserts the children of ti's not yet expanded ancestors, as necessary
+static HTREEITEM InsertItemOnDemand(TreeCtrl* tree, TreeItem* ti) {
+    HTREEITEM hi = tree->GetHandleByTreeItem(ti);
+    if (hi || !ti || !ti->Parent()) {
+        return hi;
+    }
+    HTREEITEM hParent = InsertItemOnDemand(tree, ti->Parent());
+    if (!hParent) {
+        return nullptr;
+    }
+    InsertChildrenOnDemand(tree, hParent);
+    return tree->GetHandleByTreeItem(ti);
+}
+
 static void PopulateTree(TreeCtrl* tree, TreeModel* tm) {
     HTREEITEM parent = nullptr;
-    int n = tm->RootCount();
-    for (int i = 0; i < n; i++) {
-        auto* ti = tm->RootAt(i);
+    Vec<TreeItem*> roots;
+    tm->GetRoots(roots);
+    for (auto* ti : roots) {
         HTREEITEM h = insertItem(tree, parent, ti);
         auto v = std::make_tuple(ti, h);
         tree->insertedItems.Append(v);
-        PopulateTreeItem(tree, ti, h);
+        if (ti->IsExpanded()) {
+            PopulateTreeItem(tree, ti, h);
+        }
     }
 }
 
@@ -747,6 +826,7 @@ void TreeCtrl::SetTreeModel(TreeModel* tm) {
     SuspendRedraw();
 
     insertedItems.Reset();
+    insertedItemsSorted = 0;
     TreeView_DeleteAllItems(hwnd);
 
     treeModel = tm;
@@ -759,13 +839,18 @@ void TreeCtrl::SetTreeModel(TreeModel* tm) {
 
 void TreeCtrl::SetCheckState(TreeItem* item, bool enable) {
     HTREEITEM hi = GetHandleByTreeItem(item);
-    CrashIf(!hi);
+    if (!hi) {
+        // the state is taken from item->IsChecked() when it's inserted
+        return;
+    }
     TreeView_SetCheckState(hwnd, hi, enable);
 }
 
 bool TreeCtrl::GetCheckState(TreeItem* item) {
     HTREEITEM hi = GetHandleByTreeItem(item);
-    CrashIf(!hi);
+    if (!hi) {
+        return item->IsChecked();
+    }
     auto res = TreeView_GetCheckState(hwnd, hi);
     return res != 0;
 }
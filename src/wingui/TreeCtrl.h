@@ -164,8 +164,11 @@ struct TreeCtrl : WindowBase {
     TVITEMW item = {0};
 
     // TreeItem* -> HTREEITEM mapping so that we can
-    // find HTREEITEM from TreeItem*
+    // find HTREEITEM from TreeItem* (only for items inserted so far)
     Vec<std::tuple<TreeItem*, HTREEITEM>> insertedItems;
+    // insertedItems up to this index are sorted by TreeItem*
+    // (see GetHandleByTreeItem)
+    int insertedItemsSorted = 0;
 
     TreeCtrl(HWND parent);
     ~TreeCtrl();
@@ -4,6 +4,20 @@
 #include "utils/BaseUtil.h"
 #include "wingui/TreeModel.h"
 
+void TreeItem::GetChildren(Vec<TreeItem*>& v) {
+    int n = ChildCount();
+    for (int i = 0; i < n; i++) {
+        v.Append(ChildAt(i));
+    }
+}
+
+void TreeModel::GetRoots(Vec<TreeItem*>& v) {
+    int n = RootCount();
+    for (int i = 0; i < n; i++) {
+        v.Append(RootAt(i));
+    }
+}
+
 static bool VisitTreeItemRec(TreeItem* ti, const TreeItemVisitor& visitor) {
     bool cont;
     if (!ti) {
@@ -13,9 +27,9 @@ static bool VisitTreeItemRec(TreeItem* ti, const TreeItemVisitor& visitor) {
     if (!cont) {
         return false;
     }
-    int n = ti->ChildCount();
-    for (int i = 0; i < n; i++) {
-        auto child = ti->ChildAt(i);
+    Vec<TreeItem*> children;
+    ti->GetChildren(children);
+    for (auto* child : children) {
         cont = VisitTreeItemRec(child, visitor);
         if (!cont) {
             return false;
@@ -25,9 +39,9 @@ static bool VisitTreeItemRec(TreeItem* ti, const TreeItemVisitor& visitor) {
 }
 
 bool VisitTreeModelItems(TreeModel* tm, const TreeItemVisitor& visitor) {
-    int n = tm->RootCount();
-    for (int i = 0; i < n; i++) {
-        auto* ti = tm->RootAt(i);
+    Vec<TreeItem*> roots;
+    tm->GetRoots(roots);
+    for (auto* ti : roots) {
         if (!VisitTreeItemRec(ti, visitor)) {
             return false;
         }
@@ -14,6 +14,8 @@ struct TreeItem {
     virtual bool IsExpanded() = 0;
     // when showing checkboxes
     virtual bool IsChecked() = 0;
+    // appends all children to v (override if ChildAt() isn't O(1))
+    virtual void GetChildren(Vec<TreeItem*>& v);
 };
 
 // TreeModel provides data to TreeCtrl
@@ -22,6 +24,8 @@ struct TreeModel {
 
     virtual int RootCount() = 0;
     virtual TreeItem* RootAt(int) = 0;
+    // appends all root items to v (override if RootAt() isn't O(1))
+    virtual void GetRoots(Vec<TreeItem*>& v);
 };
 
 // function called for every item in the TreeModel